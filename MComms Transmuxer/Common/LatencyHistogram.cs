@@ -0,0 +1,269 @@
+﻿namespace MComms_Transmuxer.Common
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    /// <summary>
+    /// Lock-free histogram of durations in microseconds with log-linear buckets (HDR histogram layout):
+    /// every power of two range is split into 16 linear sub-buckets, so any recorded value is reported
+    /// with at most 1/16 relative error while the whole range up to days fits into a few hundred counters.
+    /// Recording is a couple of interlocked increments and can be called by any number of threads.
+    /// </summary>
+    public class LatencyHistogram
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Number of bits of the linear sub-bucket index
+        /// </summary>
+        private const int SubBucketBits = 4;
+
+        /// <summary>
+        /// Number of sub-buckets of each power of two range
+        /// </summary>
+        private const int SubBucketCount = 1 << LatencyHistogram.SubBucketBits;
+
+        /// <summary>
+        /// Number of power of two ranges above the linear range, values up to 2^40 us (12 days) are distinguished
+        /// </summary>
+        private const int MaxShift = 36;
+
+        /// <summary>
+        /// Largest value having its own bucket, bigger values are counted as this one
+        /// </summary>
+        private const long MaxTrackableValue = ((long)(2 * LatencyHistogram.SubBucketCount) << LatencyHistogram.MaxShift) - 1;
+
+        /// <summary>
+        /// Stopwatch ticks per microsecond
+        /// </summary>
+        private static readonly double TicksPerMicrosecond = Stopwatch.Frequency / 1000000.0;
+
+        /// <summary>
+        /// Bucket counters
+        /// </summary>
+        private long[] counts = new long[(LatencyHistogram.MaxShift + 2) * LatencyHistogram.SubBucketCount];
+
+        /// <summary>
+        /// Number of recorded values
+        /// </summary>
+        private long totalCount = 0;
+
+        /// <summary>
+        /// Sum of recorded values
+        /// </summary>
+        private long totalSum = 0;
+
+        /// <summary>
+        /// Maximum recorded value
+        /// </summary>
+        private long maxValue = 0;
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets number of recorded values
+        /// </summary>
+        public long Count
+        {
+            get
+            {
+                return Interlocked.Read(ref this.totalCount);
+            }
+        }
+
+        /// <summary>
+        /// Gets maximum recorded value, in microseconds
+        /// </summary>
+        public long Max
+        {
+            get
+            {
+                return Interlocked.Read(ref this.maxValue);
+            }
+        }
+
+        /// <summary>
+        /// Gets mean of recorded values, in microseconds
+        /// </summary>
+        public double Mean
+        {
+            get
+            {
+                long count = this.Count;
+                return count > 0 ? (double)Interlocked.Read(ref this.totalSum) / count : 0;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Records duration from the specified Stopwatch timestamp till now
+        /// </summary>
+        /// <param name="startTimestamp">Stopwatch.GetTimestamp() taken when the measured interval started</param>
+        public void RecordSince(long startTimestamp)
+        {
+            this.Record((long)((Stopwatch.GetTimestamp() - startTimestamp) / LatencyHistogram.TicksPerMicrosecond));
+        }
+
+        /// <summary>
+        /// Records duration
+        /// </summary>
+        /// <param name="value">Duration in microseconds, negative values are counted as 0</param>
+        public void Record(long value)
+        {
+            if (value < 0)
+            {
+                value = 0;
+            }
+
+            Interlocked.Increment(ref this.counts[LatencyHistogram.GetIndex(value)]);
+            Interlocked.Increment(ref this.totalCount);
+            Interlocked.Add(ref this.totalSum, value);
+            this.UpdateMax(value);
+        }
+
+        /// <summary>
+        /// Adds values recorded by another histogram, used to report several streams or threads together.
+        /// Values recorded concurrently to the other histogram may or may not be taken into account
+        /// </summary>
+        /// <param name="other">Histogram to add</param>
+        public void Add(LatencyHistogram other)
+        {
+            for (int i = 0; i < this.counts.Length; ++i)
+            {
+                long count = Interlocked.Read(ref other.counts[i]);
+                if (count > 0)
+                {
+                    Interlocked.Add(ref this.counts[i], count);
+                }
+            }
+
+            Interlocked.Add(ref this.totalCount, Interlocked.Read(ref other.totalCount));
+            Interlocked.Add(ref this.totalSum, Interlocked.Read(ref other.totalSum));
+            this.UpdateMax(other.Max);
+        }
+
+        /// <summary>
+        /// Returns value below or equal to which the specified percentage of recorded values fall.
+        /// Values recorded concurrently may or may not be taken into account
+        /// </summary>
+        /// <param name="percentile">Percentile, 0 to 100</param>
+        /// <returns>Upper bound of the bucket holding the percentile, in microseconds, 0 if nothing is recorded</returns>
+        public long GetValueAtPercentile(double percentile)
+        {
+            long[] snapshot = new long[this.counts.Length];
+            long total = 0;
+            for (int i = 0; i < snapshot.Length; ++i)
+            {
+                snapshot[i] = Interlocked.Read(ref this.counts[i]);
+                total += snapshot[i];
+            }
+
+            if (total == 0)
+            {
+                return 0;
+            }
+
+            long target = Math.Max(1, (long)Math.Ceiling(Math.Min(percentile, 100.0) / 100.0 * total));
+            long cumulative = 0;
+            for (int i = 0; i < snapshot.Length; ++i)
+            {
+                cumulative += snapshot[i];
+                if (cumulative >= target)
+                {
+                    // upper bound of a bucket may exceed the real maximum
+                    return Math.Min(LatencyHistogram.GetHighestValue(i), this.Max);
+                }
+            }
+
+            return this.Max;
+        }
+
+        /// <summary>
+        /// Clears recorded values. Values recorded concurrently may be partially kept
+        /// </summary>
+        public void Reset()
+        {
+            for (int i = 0; i < this.counts.Length; ++i)
+            {
+                Interlocked.Exchange(ref this.counts[i], 0);
+            }
+
+            Interlocked.Exchange(ref this.totalCount, 0);
+            Interlocked.Exchange(ref this.totalSum, 0);
+            Interlocked.Exchange(ref this.maxValue, 0);
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Raises maximum recorded value if the value is bigger
+        /// </summary>
+        /// <param name="value">Value</param>
+        private void UpdateMax(long value)
+        {
+            long max = Interlocked.Read(ref this.maxValue);
+            while (value > max)
+            {
+                long current = Interlocked.CompareExchange(ref this.maxValue, value, max);
+                if (current == max)
+                {
+                    break;
+                }
+
+                max = current;
+            }
+        }
+
+        /// <summary>
+        /// Returns bucket index of the value
+        /// </summary>
+        /// <param name="value">Non-negative value</param>
+        /// <returns>Bucket index</returns>
+        private static int GetIndex(long value)
+        {
+            if (value > LatencyHistogram.MaxTrackableValue)
+            {
+                value = LatencyHistogram.MaxTrackableValue;
+            }
+
+            // shift bringing the value to the range of [SubBucketCount, 2 * SubBucketCount)
+            int shift = 0;
+            while ((value >> shift) >= 2 * LatencyHistogram.SubBucketCount)
+            {
+                ++shift;
+            }
+
+            return (shift * LatencyHistogram.SubBucketCount) + (int)(value >> shift);
+        }
+
+        /// <summary>
+        /// Returns the biggest value counted in the bucket
+        /// </summary>
+        /// <param name="index">Bucket index</param>
+        /// <returns>Value</returns>
+        private static long GetHighestValue(int index)
+        {
+            if (index < 2 * LatencyHistogram.SubBucketCount)
+            {
+                return index;
+            }
+
+            int shift = (index / LatencyHistogram.SubBucketCount) - 1;
+            long subBucket = index - (shift * LatencyHistogram.SubBucketCount);
+            return ((subBucket + 1) << shift) - 1;
+        }
+
+        #endregion
+    }
+}
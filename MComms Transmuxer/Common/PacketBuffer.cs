@@ -6,6 +6,7 @@
     using System.Linq;
     using System.Runtime.CompilerServices;
     using System.Text;
+    using System.Threading;
     using System.Threading.Tasks;
 
     /// <summary>
@@ -16,14 +17,19 @@
         #region Private constants and fields
 
         /// <summary>
-        /// Static lock for id counter
+        /// Allocator state of a buffer which is free
         /// </summary>
-        private static object idCounterLock = new object();
+        internal const int StateFree = 0;
+
+        /// <summary>
+        /// Allocator state of a buffer which is locked
+        /// </summary>
+        internal const int StateLocked = 1;
 
         /// <summary>
         /// Id counter used to assign unique id for every PacketBuffer object
         /// </summary>
-        private static long idCounter = 0;
+        private static long idCounter = -1;
 
         /// <summary>
         /// Parent allocator which owns current packet
@@ -61,6 +67,12 @@
         /// </summary>
         private int position = 0;
 
+        /// <summary>
+        /// Allocator state, StateFree or StateLocked. Owned by the allocator,
+        /// it lets release find out in O(1) that the buffer has been released already
+        /// </summary>
+        internal int allocatorState = PacketBuffer.StateFree;
+
 #if TRACE_PACKET_BUFFERS
         /// <summary>
         /// List of functions referenced current packet
@@ -85,11 +97,7 @@
         /// <param name="bufferSize">Buffer size to create</param>
         public PacketBuffer(PacketBufferAllocator allocator, int bufferSize)
         {
-            lock (PacketBuffer.idCounterLock)
-            {
-                this.id = PacketBuffer.idCounter++;
-            }
-
+            this.id = Interlocked.Increment(ref PacketBuffer.idCounter);
             this.allocator = allocator;
             this.bufferSize = bufferSize;
             this.buffer = new byte[bufferSize];
@@ -178,13 +186,15 @@
         /// <returns>Current reference count</returns>
         public int AddRef()
         {
+#if TRACE_PACKET_BUFFERS
             lock (this)
             {
-#if TRACE_PACKET_BUFFERS
                 this.refdBy.Add(new KeyValuePair<DateTime, string>(DateTime.Now, this.GetCallingMethod()));
-#endif
                 return ++this.refCount;
             }
+#else
+            return Interlocked.Increment(ref this.refCount);
+#endif
         }
 
         /// <summary>
@@ -193,25 +203,35 @@
         /// <returns>Current reference count</returns>
         public int Release()
         {
+#if TRACE_PACKET_BUFFERS
             lock (this)
             {
                 if (--this.refCount == 0)
                 {
-                    this.allocator.ReleaseBuffer(this);
                     this.CleanUp();
-#if TRACE_PACKET_BUFFERS
                     this.refdBy.Clear();
                     this.releasedBy.Clear();
-#endif
+                    this.allocator.ReleaseBuffer(this);
                 }
-#if TRACE_PACKET_BUFFERS
                 else
                 {
                     this.releasedBy.Add(new KeyValuePair<DateTime, string>(DateTime.Now, this.GetCallingMethod()));
                 }
-#endif
+
                 return this.refCount;
             }
+#else
+            int refCount = Interlocked.Decrement(ref this.refCount);
+
+            if (refCount == 0)
+            {
+                // clean up first, once returned the buffer can be locked by another thread
+                this.CleanUp();
+                this.allocator.ReleaseBuffer(this);
+            }
+
+            return refCount;
+#endif
         }
 
         #endregion
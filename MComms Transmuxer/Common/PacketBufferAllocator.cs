@@ -1,24 +1,36 @@
 ﻿namespace MComms_Transmuxer.Common
 {
     using System;
+    using System.Collections.Concurrent;
     using System.Collections.Generic;
     using System.Linq;
     using System.Text;
+    using System.Threading;
     using System.Threading.Tasks;
 
     /// <summary>
     /// Class used to pre-allocate big amount of memory buffers
     /// to re-use them during the whole program execution time
-    /// to decrease allocation/de-allocation time and prevent memory fragmentation
+    /// to decrease allocation/de-allocation time and prevent memory fragmentation.
+    /// Free buffers are kept in small per-thread caches in front of a shared lock-free stack. A thread
+    /// locks from and releases to its own cache; buffers move between the cache and the shared stack
+    /// in batches of half a cache, so a buffer locked on one thread and released on another (received
+    /// packet sent by another session) costs one shared operation per batch instead of one per buffer.
+    /// Buffers left in the caches of other threads are collected before the allocator grows.
     /// </summary>
     public class PacketBufferAllocator
     {
         #region Private constants and fields
 
+        /// <summary>
+        /// Number of buffers a thread keeps for itself
+        /// </summary>
+        private const int CacheSize = 32;
+
         /// <summary>
         /// Size of one buffer
         /// </summary>
-        private int bufferSize = 0;
+        private volatile int bufferSize = 0;
 
         /// <summary>
         /// Number of pre-allocated buffers
@@ -27,21 +39,35 @@
 
         /// <summary>
         /// Current number of free buffers.
-        /// This is a volatile field, can be used without locks
-        /// but its value is informational, i.e. it can be changed
-        /// while you're processing it
+        /// This field is updated without locks, its value is informational,
+        /// i.e. it can be changed while you're processing it
+        /// </summary>
+        private int freeBufferCount = 0;
+
+        /// <summary>
+        /// Current number of locked buffers
+        /// </summary>
+        private int lockedBufferCount = 0;
+
+        /// <summary>
+        /// Free buffers shared by all threads
         /// </summary>
-        private volatile int freeBufferCount = 0;
+        private volatile ConcurrentStack<PacketBuffer> freeBuffers = new ConcurrentStack<PacketBuffer>();
 
         /// <summary>
-        /// Free buffers
+        /// Free buffers of the current thread
         /// </summary>
-        private List<PacketBuffer> freeBuffers = new List<PacketBuffer>();
+        private ThreadLocal<BufferCache> cache = null;
 
         /// <summary>
-        /// Locked buffers
+        /// Caches of all threads which have used the allocator, guarded by growLock
         /// </summary>
-        private List<PacketBuffer> lockedBuffers = new List<PacketBuffer>();
+        private List<BufferCache> caches = new List<BufferCache>();
+
+        /// <summary>
+        /// Serializes growing and re-allocation, never taken while free buffers are available
+        /// </summary>
+        private object growLock = new object();
 
 #if ALLOCATOR_USAGE_STAT
         // statistics
@@ -67,11 +93,11 @@
             this.bufferSize = bufferSize;
             this.bufferCount = bufferCount;
             this.freeBufferCount = bufferCount;
+            this.cache = new ThreadLocal<BufferCache>(this.CreateCache);
 
             for (int i = 0; i < this.bufferCount; ++i)
             {
-                PacketBuffer buffer = new PacketBuffer(this, this.bufferSize);
-                this.freeBuffers.Add(buffer);
+                this.freeBuffers.Push(this.CreateBuffer(bufferSize));
             }
         }
 
@@ -97,7 +123,7 @@
         {
             get
             {
-                return this.bufferCount;
+                return Thread.VolatileRead(ref this.bufferCount);
             }
         }
 
@@ -110,7 +136,19 @@
         {
             get
             {
-                return this.freeBufferCount;
+                return Thread.VolatileRead(ref this.freeBufferCount);
+            }
+        }
+
+        /// <summary>
+        /// Current number of locked buffers.
+        /// This property is thread safe but its value is informational
+        /// </summary>
+        public int LockedBufferCount
+        {
+            get
+            {
+                return Thread.VolatileRead(ref this.lockedBufferCount);
             }
         }
 
@@ -121,24 +159,30 @@
         /// <param name="bufferCount">New number of buffers</param>
         public void Reallocate(int bufferSize, int bufferCount)
         {
-            lock (this)
+            lock (this.growLock)
             {
                 Global.Log.WarnFormat("Re-allocating buffers size {0} count {1}", bufferSize, bufferCount);
 
-                this.bufferSize = bufferSize;
-
-                // delete all free buffers
-                this.freeBuffers.Clear();
-
-                this.bufferCount = bufferCount;
-                this.freeBufferCount = bufferCount;
+                ConcurrentStack<PacketBuffer> freeBuffers = new ConcurrentStack<PacketBuffer>();
 
                 // allocate buffers with new size
-                for (int i = 0; i < this.bufferCount; ++i)
+                for (int i = 0; i < bufferCount; ++i)
+                {
+                    freeBuffers.Push(this.CreateBuffer(bufferSize));
+                }
+
+                // buffers of the old size are dropped when they're released,
+                // the free ones left in thread caches right away
+                PacketBuffer[] dropped = new PacketBuffer[PacketBufferAllocator.CacheSize];
+                foreach (BufferCache cache in this.caches)
                 {
-                    PacketBuffer buffer = new PacketBuffer(this, this.bufferSize);
-                    this.freeBuffers.Add(buffer);
+                    cache.TakeAll(dropped);
                 }
+
+                this.bufferSize = bufferSize;
+                this.freeBuffers = freeBuffers;
+                this.bufferCount = bufferCount;
+                Interlocked.Exchange(ref this.freeBufferCount, bufferCount);
             }
         }
 
@@ -148,47 +192,51 @@
         /// <returns>Locked buffer</returns>
         public PacketBuffer LockBuffer()
         {
-            lock (this)
+            PacketBuffer buffer = null;
+            BufferCache cache = this.cache.Value;
+
+            while (true)
             {
-                if (this.freeBuffers.Count == 0)
+                buffer = cache.Take();
+                if (buffer == null)
                 {
-                    int addBufferCount = this.bufferCount / 10;
-                    if (addBufferCount == 0) ++addBufferCount;
-                    Global.Log.WarnFormat("Allocator[{0}/{1}]: No more empty buffers, allocate additional {2} buffers", this.bufferSize, this.bufferCount, addBufferCount);
-
-                    for (int i = 0; i < addBufferCount; ++i)
-                    {
-                        this.freeBuffers.Add(new PacketBuffer(this, this.bufferSize));
-                    }
-
-                    this.bufferCount += addBufferCount;
-                    this.freeBufferCount = addBufferCount;
+                    buffer = this.TakeShared(cache);
                 }
 
-                PacketBuffer buffer = this.freeBuffers[this.freeBuffers.Count - 1];
-                this.freeBuffers.RemoveAt(this.freeBuffers.Count - 1);
-                this.lockedBuffers.Add(buffer);
-
-#if ALLOCATOR_USAGE_STAT
-                if (this.lockedBuffers.Count > this.maxLockedBuffers)
+                if (buffer == null)
                 {
-                    this.maxLockedBuffers = this.lockedBuffers.Count;
+                    buffer = this.Grow();
                 }
 
-                this.lockedBuffersTotal += this.lockedBuffers.Count;
-                this.lockedBuffersCount++;
-
-                if (this.bufferCount > 1000 && this.lockedBuffersCount % (this.bufferCount * 10) == 0)
+                if (buffer.Size == this.bufferSize)
                 {
-                    Global.Log.DebugFormat("Allocator[{0}/{1}]: avg locked buffers {2}, max locked buffers {3}", this.bufferSize, this.bufferCount, (this.lockedBuffersTotal / this.lockedBuffersCount), this.maxLockedBuffers);
+                    Interlocked.Decrement(ref this.freeBufferCount);
+                    break;
                 }
-#endif
 
-                this.freeBufferCount = freeBuffers.Count;
+                // taken from the list replaced by a concurrent re-allocation
+            }
+
+            Interlocked.Exchange(ref buffer.allocatorState, PacketBuffer.StateLocked);
+            int lockedBufferCount = Interlocked.Increment(ref this.lockedBufferCount);
+
+#if ALLOCATOR_USAGE_STAT
+            if (lockedBufferCount > this.maxLockedBuffers)
+            {
+                this.maxLockedBuffers = lockedBufferCount;
+            }
+
+            Interlocked.Add(ref this.lockedBuffersTotal, lockedBufferCount);
+            long lockedBuffersCount = Interlocked.Increment(ref this.lockedBuffersCount);
 
-                buffer.AddRef();
-                return buffer;
+            if (this.bufferCount > 1000 && lockedBuffersCount % (this.bufferCount * 10) == 0)
+            {
+                Global.Log.DebugFormat("Allocator[{0}/{1}]: avg locked buffers {2}, max locked buffers {3}", this.bufferSize, this.bufferCount, (this.lockedBuffersTotal / lockedBuffersCount), this.maxLockedBuffers);
             }
+#endif
+
+            buffer.AddRef();
+            return buffer;
         }
 
         #endregion
@@ -202,35 +250,253 @@
         /// <param name="buffer">Packet to move from locked buffers to free buffers</param>
         public void ReleaseBuffer(PacketBuffer buffer)
         {
-            lock (this)
+            if (Interlocked.Exchange(ref buffer.allocatorState, PacketBuffer.StateFree) != PacketBuffer.StateLocked)
+            {
+                // not locked by this allocator or released already
+                return;
+            }
+
+            Interlocked.Decrement(ref this.lockedBufferCount);
+
+#if ALLOCATOR_USAGE_STAT
+            Interlocked.Add(ref this.usedBuffersSize, buffer.ActualBufferSize);
+            long usedBuffersCount = Interlocked.Increment(ref this.usedBuffersCount);
+
+            if (this.bufferCount > 1000 && usedBuffersCount % (this.bufferCount * 10) == 0)
             {
-                if (!this.lockedBuffers.Contains(buffer))
+                Global.Log.DebugFormat("Allocator[{0}/{1}]: avg buffer usage {2:0.00}%", this.bufferSize, this.bufferCount, ((double)this.usedBuffersSize / this.bufferSize / usedBuffersCount) * 100.0, this.maxLockedBuffers);
+            }
+#endif
+
+            if (buffer.Size != this.bufferSize)
+            {
+                // buffers were re-allocated,
+                // this buffer is an old buffer which must be deleted
+            }
+            else
+            {
+                // counted first, the buffer may be taken again as soon as it's added
+                Interlocked.Increment(ref this.freeBufferCount);
+
+                BufferCache cache = this.cache.Value;
+                if (!cache.Add(buffer))
                 {
-                    return;
+                    // cache is full, move half of it and the buffer to the shared stack
+                    PacketBuffer[] batch = cache.Batch;
+                    int count = cache.TakeRange(batch, PacketBufferAllocator.CacheSize / 2);
+                    batch[count++] = buffer;
+                    this.freeBuffers.PushRange(batch, 0, count);
+                    Array.Clear(batch, 0, count);
                 }
+            }
+        }
 
-                lockedBuffers.Remove(buffer);
+        #endregion
 
-#if ALLOCATOR_USAGE_STAT
-                this.usedBuffersSize += buffer.ActualBufferSize;
-                this.usedBuffersCount++;
+        #region Private methods
+
+        /// <summary>
+        /// Creates buffer owned by this allocator
+        /// </summary>
+        /// <param name="bufferSize">Buffer size</param>
+        /// <returns>Free buffer</returns>
+        private PacketBuffer CreateBuffer(int bufferSize)
+        {
+            PacketBuffer buffer = new PacketBuffer(this, bufferSize);
+            buffer.allocatorState = PacketBuffer.StateFree;
+            return buffer;
+        }
 
-                if (this.bufferCount > 1000 && this.usedBuffersCount % (this.bufferCount * 10) == 0)
+        /// <summary>
+        /// Creates cache of the current thread
+        /// </summary>
+        /// <returns>Empty cache</returns>
+        private BufferCache CreateCache()
+        {
+            BufferCache cache = new BufferCache(PacketBufferAllocator.CacheSize);
+
+            lock (this.growLock)
+            {
+                this.caches.Add(cache);
+            }
+
+            return cache;
+        }
+
+        /// <summary>
+        /// Takes buffer from the shared stack, moving up to half a cache more to the thread cache
+        /// </summary>
+        /// <param name="cache">Cache of the current thread, empty</param>
+        /// <returns>Free buffer or null if the shared stack is empty</returns>
+        private PacketBuffer TakeShared(BufferCache cache)
+        {
+            PacketBuffer[] batch = cache.Batch;
+            int count = this.freeBuffers.TryPopRange(batch, 0, PacketBufferAllocator.CacheSize / 2);
+            for (int i = 1; i < count; ++i)
+            {
+                cache.Add(batch[i]);
+            }
+
+            PacketBuffer buffer = count > 0 ? batch[0] : null;
+            Array.Clear(batch, 0, count);
+            return buffer;
+        }
+
+        /// <summary>
+        /// Moves free buffers of all thread caches to the shared stack, must be called under growLock
+        /// </summary>
+        private void CollectCachedBuffers()
+        {
+            PacketBuffer[] batch = new PacketBuffer[PacketBufferAllocator.CacheSize];
+            foreach (BufferCache cache in this.caches)
+            {
+                int count = cache.TakeAll(batch);
+                if (count > 0)
                 {
-                    Global.Log.DebugFormat("Allocator[{0}/{1}]: avg buffer usage {2:0.00}%", this.bufferSize, this.bufferCount, ((double)this.usedBuffersSize / this.bufferSize / this.usedBuffersCount) * 100.0, this.maxLockedBuffers);
+                    this.freeBuffers.PushRange(batch, 0, count);
                 }
-#endif
+            }
+        }
+
+        /// <summary>
+        /// Called when there are no free buffers, allocates 10% more
+        /// </summary>
+        /// <returns>Free buffer for the caller, counted as free</returns>
+        private PacketBuffer Grow()
+        {
+            lock (this.growLock)
+            {
+                PacketBuffer buffer = null;
 
-                if (buffer.Size != bufferSize)
+                // another thread may have grown meanwhile, or other threads keep free buffers in their caches
+                this.CollectCachedBuffers();
+                if (this.freeBuffers.TryPop(out buffer))
                 {
-                    // buffers were re-allocated,
-                    // this buffer is an old buffer which must be deleted
+                    return buffer;
                 }
-                else
+
+                int addBufferCount = this.bufferCount / 10;
+                if (addBufferCount == 0) ++addBufferCount;
+                Global.Log.WarnFormat("Allocator[{0}/{1}]: No more empty buffers, allocate additional {2} buffers", this.bufferSize, this.bufferCount, addBufferCount);
+
+                for (int i = 1; i < addBufferCount; ++i)
                 {
-                    this.freeBuffers.Add(buffer);
-                    this.freeBufferCount = freeBuffers.Count;
+                    this.freeBuffers.Push(this.CreateBuffer(this.bufferSize));
                 }
+
+                this.bufferCount += addBufferCount;
+                Interlocked.Add(ref this.freeBufferCount, addBufferCount);
+
+                return this.CreateBuffer(this.bufferSize);
+            }
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Free buffers of one thread. Only the owner thread adds and takes them, other threads may
+        /// collect them under growLock; slots are exchanged atomically, so a slot emptied by a collector
+        /// is skipped by the owner
+        /// </summary>
+        private class BufferCache
+        {
+            /// <summary>
+            /// Buffer slots, the ones from count up are empty
+            /// </summary>
+            private PacketBuffer[] slots = null;
+
+            /// <summary>
+            /// Number of slots which may hold a buffer, used by the owner thread only
+            /// </summary>
+            private int count = 0;
+
+            /// <summary>
+            /// Creates new instance of BufferCache
+            /// </summary>
+            /// <param name="size">Maximum number of buffers</param>
+            public BufferCache(int size)
+            {
+                this.slots = new PacketBuffer[size];
+                this.Batch = new PacketBuffer[size / 2 + 1];
+            }
+
+            /// <summary>
+            /// Gets array used by the owner thread to move buffers to and from the shared stack
+            /// </summary>
+            public PacketBuffer[] Batch { get; private set; }
+
+            /// <summary>
+            /// Adds buffer, called by the owner thread
+            /// </summary>
+            /// <param name="buffer">Free buffer</param>
+            /// <returns>False if the cache is full</returns>
+            public bool Add(PacketBuffer buffer)
+            {
+                if (this.count == this.slots.Length)
+                {
+                    return false;
+                }
+
+                Interlocked.Exchange(ref this.slots[this.count++], buffer);
+                return true;
+            }
+
+            /// <summary>
+            /// Takes the buffer added last, called by the owner thread
+            /// </summary>
+            /// <returns>Free buffer or null if the cache is empty</returns>
+            public PacketBuffer Take()
+            {
+                while (this.count > 0)
+                {
+                    PacketBuffer buffer = Interlocked.Exchange(ref this.slots[--this.count], null);
+                    if (buffer != null)
+                    {
+                        return buffer;
+                    }
+                }
+
+                return null;
+            }
+
+            /// <summary>
+            /// Takes up to specified number of buffers, called by the owner thread
+            /// </summary>
+            /// <param name="buffers">Array to store buffers to</param>
+            /// <param name="maxCount">Maximum number of buffers to take</param>
+            /// <returns>Number of buffers taken</returns>
+            public int TakeRange(PacketBuffer[] buffers, int maxCount)
+            {
+                int taken = 0;
+                PacketBuffer buffer = null;
+                while (taken < maxCount && (buffer = this.Take()) != null)
+                {
+                    buffers[taken++] = buffer;
+                }
+
+                return taken;
+            }
+
+            /// <summary>
+            /// Takes all buffers, may be called by any thread
+            /// </summary>
+            /// <param name="buffers">Array to store buffers to, at least as long as the cache</param>
+            /// <returns>Number of buffers taken</returns>
+            public int TakeAll(PacketBuffer[] buffers)
+            {
+                int taken = 0;
+                for (int i = 0; i < this.slots.Length; ++i)
+                {
+                    PacketBuffer buffer = Interlocked.Exchange(ref this.slots[i], null);
+                    if (buffer != null)
+                    {
+                        buffers[taken++] = buffer;
+                    }
+                }
+
+                return taken;
             }
         }
 
@@ -1,7 +1,6 @@
 ﻿namespace MComms_Transmuxer.Common
 {
     using System;
-    using System.Collections;
     using System.Collections.Generic;
     using System.Diagnostics;
     using System.IO;
@@ -11,7 +10,9 @@
 
     /// <summary>
     /// It is an abstraction stream above underlying packet buffer(s)
-    /// containing the real data
+    /// containing the real data. Buffers are kept as a list of referenced segments
+    /// with a cursor pointing to the segment and offset of current position, so sequential
+    /// reads and writes cost O(1) per call and trimming doesn't move any data.
     /// </summary>
     public class PacketBufferStream : Stream
     {
@@ -32,6 +33,11 @@
             /// </summary>
             public int Size { get; set; }
 
+            /// <summary>
+            /// Stream position of the first byte of the buffer
+            /// </summary>
+            public long Start { get; set; }
+
             /// <summary>
             /// Underlying buffer
             /// </summary>
@@ -39,15 +45,14 @@
         }
 
         /// <summary>
-        /// Current stream position
+        /// Empty array returned by PeekSegment at the end of the stream
         /// </summary>
-        private long position = 0;
+        private static readonly byte[] EmptyArray = new byte[0];
 
         /// <summary>
-        /// Position key in position2BufferId list pointing to a buffer
-        /// holding the data for current position
+        /// Current stream position
         /// </summary>
-        private long positionKey = 0;
+        private long position = 0;
 
         /// <summary>
         /// Total stream length
@@ -55,19 +60,20 @@
         private long totalLength = 0;
 
         /// <summary>
-        /// Map from buffer's starting position in the stream to buffer id
+        /// Underlying buffers in stream order
         /// </summary>
-        private SortedList<long, long> position2BufferId = new SortedList<long, long>();
+        private List<BufferEntry> entries = new List<BufferEntry>();
 
         /// <summary>
-        /// Map from buffer id to buffer entry
+        /// Index of the entry holding the data for current position,
+        /// equals to the number of entries when position is at the end of the stream
         /// </summary>
-        private Hashtable bufferId2BufferEntry = new Hashtable();
+        private int entryIndex = 0;
 
         /// <summary>
-        /// Field used for optimization when we have single buffer per stream
+        /// Offset of current position in the current entry, always less than entry size
         /// </summary>
-        private BufferEntry singleEntry = null;
+        private int entryOffset = 0;
 
         #endregion
 
@@ -112,11 +118,13 @@
         {
             if (disposing)
             {
-                foreach (BufferEntry entry in bufferId2BufferEntry.Values)
+                foreach (BufferEntry entry in this.entries)
                 {
                     entry.Buffer.Release();
                 }
-                bufferId2BufferEntry.Clear();
+                this.entries.Clear();
+                this.entryIndex = 0;
+                this.entryOffset = 0;
             }
 
             base.Dispose(disposing);
@@ -169,28 +177,8 @@
                 {
                     throw new ArgumentOutOfRangeException();
                 }
-                this.position = value;
-                if (this.position2BufferId.Count > 0)
-                {
-                    try
-                    {
-                        int index = this.position2BufferId.FindFirstIndexLessThanOrEqualTo(this.position);
-                        if (index < 0)
-                        {
-                            Global.Log.ErrorFormat("Unexpected binary search result {0}", index);
-                            index = 0;
-                        }
-                        this.positionKey = this.position2BufferId.Keys[index];
-                    }
-                    catch (Exception ex)
-                    {
-                        Global.Log.Error("Setting this.positionKey exception", ex);
-                    }
-                }
-                else
-                {
-                    this.positionKey = 0;
-                }
+
+                this.Locate(value);
             }
         }
 
@@ -238,54 +226,23 @@
         /// <summary>
         /// Read one byte from the stream
         /// </summary>
-        /// <returns>Byte read at current stream position</returns>
+        /// <returns>Byte read at current stream position or -1 at the end of the stream</returns>
         public override int ReadByte()
         {
-            int value = 0;
-
-            if (this.singleEntry != null)
+            if (this.entryIndex == this.entries.Count)
             {
-                // optimization for single-buffer case
-                long intPacketOffset = 0;
-                if (this.position > this.positionKey)
-                {
-                    intPacketOffset = this.position - this.positionKey;
-                }
-
-                if (intPacketOffset < this.singleEntry.Size)
-                {
-                    value = this.singleEntry.Buffer.Buffer[this.singleEntry.Offset + intPacketOffset];
-                }
+                return -1;
             }
-            else
-            {
-                for (int i = this.position2BufferId.Keys.IndexOf(this.positionKey); i < this.position2BufferId.Count; ++i)
-                {
-                    long key = this.position2BufferId.Keys[i];
-
-                    // update position key
-                    this.positionKey = key;
-                    long intPacketOffset = 0;
-                    if (this.position > this.positionKey)
-                    {
-                        intPacketOffset = this.position - this.positionKey;
-                    }
-
-                    long bufferId = this.position2BufferId[key];
-                    BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
 
-                    if (intPacketOffset >= entry.Size)
-                    {
-                        // nothing to read in current packet
-                        continue;
-                    }
+            BufferEntry entry = this.entries[this.entryIndex];
+            int value = entry.Buffer.Buffer[entry.Offset + this.entryOffset];
 
-                    value = entry.Buffer.Buffer[entry.Offset + intPacketOffset];
-                    break;
-                }
+            this.position++;
+            if (++this.entryOffset == entry.Size)
+            {
+                this.NextEntry();
             }
 
-            this.position++;
             return value;
         }
 
@@ -300,113 +257,48 @@
         {
             int actuallyRead = 0;
 
-            for (int i = this.position2BufferId.Keys.IndexOf(this.positionKey); i < this.position2BufferId.Count; ++i)
+            while (actuallyRead < count && this.entryIndex < this.entries.Count)
             {
-                long key = this.position2BufferId.Keys[i];
-
-                // update position key
-                this.positionKey = key;
-                long intPacketOffset = 0;
-                if (this.position > this.positionKey)
-                {
-                    intPacketOffset = this.position - this.positionKey;
-                }
-
-                long bufferId = this.position2BufferId[key];
-                BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
-
-                if (intPacketOffset >= entry.Size)
-                {
-                    // nothing to read in current packet
-                    continue;
-                }
+                BufferEntry entry = this.entries[this.entryIndex];
 
-                int copySize = (int)Math.Min(count - actuallyRead, entry.Size - intPacketOffset);
-                if (count == 1 && copySize == 1)
+                int copySize = Math.Min(count - actuallyRead, entry.Size - this.entryOffset);
+                if (copySize == 1)
                 {
                     // optimization for byte read
-                    buffer[offset] = entry.Buffer.Buffer[entry.Offset + intPacketOffset];
+                    buffer[offset + actuallyRead] = entry.Buffer.Buffer[entry.Offset + this.entryOffset];
                 }
                 else
                 {
-                    Array.Copy(entry.Buffer.Buffer, entry.Offset + intPacketOffset, buffer, offset + actuallyRead, copySize);
+                    Array.Copy(entry.Buffer.Buffer, entry.Offset + this.entryOffset, buffer, offset + actuallyRead, copySize);
                 }
 
                 actuallyRead += copySize;
-                if (actuallyRead == count)
-                {
-                    break;
-                }
+                this.Advance(entry, copySize);
             }
 
-            this.position += actuallyRead;
             return actuallyRead;
         }
 
         /// <summary>
-        /// Write specified number of bytes from the byte buffer to the stream
+        /// Write specified number of bytes from the byte buffer to the stream.
+        /// Stream doesn't grow, data not fitting into underlying buffers is dropped.
         /// </summary>
         /// <param name="buffer">Byte buffer to write data from</param>
         /// <param name="offset">Byte buffer offset</param>
         /// <param name="count">Number of bytes to write</param>
         public override void Write(byte[] buffer, int offset, int count)
         {
-            if (this.singleEntry != null)
-            {
-                // optimization for single-buffer case
-                long intPacketOffset = 0;
-                if (this.position > this.positionKey)
-                {
-                    intPacketOffset = this.position - this.positionKey;
-                }
-
-                if (intPacketOffset >= this.singleEntry.Size)
-                {
-                    // no more space to write
-                    return;
-                }
+            int actuallyWritten = 0;
 
-                int copySize = (int)Math.Min(count, this.singleEntry.Size - intPacketOffset);
-                Array.Copy(buffer, offset, this.singleEntry.Buffer.Buffer, this.singleEntry.Offset + intPacketOffset, copySize);
-
-                this.position += copySize;
-            }
-            else
+            while (actuallyWritten < count && this.entryIndex < this.entries.Count)
             {
-                int actuallyWritten = 0;
-
-                for (int i = this.position2BufferId.Keys.IndexOf(this.positionKey); i < this.position2BufferId.Count; ++i)
-                {
-                    long key = this.position2BufferId.Keys[i];
-
-                    // update position key
-                    this.positionKey = key;
-                    long intPacketOffset = 0;
-                    if (this.position > this.positionKey)
-                    {
-                        intPacketOffset = this.position - this.positionKey;
-                    }
-
-                    long bufferId = this.position2BufferId[key];
-                    BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
+                BufferEntry entry = this.entries[this.entryIndex];
 
-                    if (intPacketOffset >= entry.Size)
-                    {
-                        // nothing to write in current packet
-                        continue;
-                    }
+                int copySize = Math.Min(count - actuallyWritten, entry.Size - this.entryOffset);
+                Array.Copy(buffer, offset + actuallyWritten, entry.Buffer.Buffer, entry.Offset + this.entryOffset, copySize);
 
-                    int copySize = (int)Math.Min(count - actuallyWritten, entry.Size - intPacketOffset);
-                    Array.Copy(buffer, offset + actuallyWritten, entry.Buffer.Buffer, entry.Offset + intPacketOffset, copySize);
-
-                    actuallyWritten += copySize;
-                    if (actuallyWritten == count)
-                    {
-                        break;
-                    }
-                }
-
-                this.position += actuallyWritten;
+                actuallyWritten += copySize;
+                this.Advance(entry, copySize);
             }
         }
 
@@ -420,6 +312,17 @@
         /// </summary>
         public bool OneMessage { get; set; }
 
+        /// <summary>
+        /// Gets number of bytes from current position till the end of the stream
+        /// </summary>
+        public long Available
+        {
+            get
+            {
+                return this.totalLength - this.position;
+            }
+        }
+
         /// <summary>
         /// Gets the first underlying packet buffer
         /// </summary>
@@ -427,18 +330,13 @@
         {
             get
             {
-                if (this.bufferId2BufferEntry.Count == 0)
+                if (this.entries.Count == 0)
                 {
                     return null;
                 }
-                else if (this.singleEntry != null)
-                {
-                    return this.singleEntry.Buffer;
-                }
                 else
                 {
-                    long bufferId = (int)this.position2BufferId[0];
-                    return ((BufferEntry)this.bufferId2BufferEntry[bufferId]).Buffer;
+                    return this.entries[0].Buffer;
                 }
             }
         }
@@ -452,94 +350,82 @@
         /// <param name="count">Number of bytes to use from the packet buffer</param>
         public void Append(PacketBuffer buffer, int offset, int count)
         {
-            if (this.position != this.totalLength)
-            {
-                this.Seek(0, SeekOrigin.End);
-            }
-
             buffer.AddRef();
 
-            this.position2BufferId.Add(this.totalLength, buffer.Id);
-            BufferEntry entry = new BufferEntry { Offset = offset, Size = count, Buffer = buffer };
-            this.bufferId2BufferEntry.Add(buffer.Id, entry);
-
-            if (this.bufferId2BufferEntry.Count == 1)
-            {
-                this.singleEntry = entry;
-            }
-            else
-            {
-                this.singleEntry = null;
-            }
-
-            this.positionKey = this.totalLength;
+            this.entries.Add(new BufferEntry { Offset = offset, Size = count, Start = this.totalLength, Buffer = buffer });
             this.totalLength += count;
 
+            // move to the end of the stream which is the beginning of the new data
+            this.Locate(this.totalLength - count);
+
             //Global.Log.DebugFormat("Added buffer {0}, size {1}, offset {2}", buffer.Id, count, offset);
         }
 
         /// <summary>
-        /// Copies specified number of bytes from current position to specified stream.
+        /// Copies up to specified number of bytes from current position to the specified buffer
+        /// without moving current position
         /// </summary>
-        /// <param name="stream">Target stream receiving the data</param>
+        /// <param name="buffer">Byte buffer to hold the data</param>
+        /// <param name="offset">Offset of the byte buffer</param>
         /// <param name="count">Number of bytes to copy</param>
         /// <returns>Number of bytes actually copied</returns>
-        public int CopyTo(PacketBufferStream stream, int count)
+        public int Peek(byte[] buffer, int offset, int count)
         {
             int actuallyCopied = 0;
+            int entryOffset = this.entryOffset;
 
-            if (this.singleEntry != null)
+            for (int i = this.entryIndex; i < this.entries.Count && actuallyCopied < count; ++i)
             {
-                // optimization for single-buffer case
-                long intPacketOffset = 0;
-                if (this.position > this.positionKey)
-                {
-                    intPacketOffset = this.position - this.positionKey;
-                }
+                BufferEntry entry = this.entries[i];
 
-                if (intPacketOffset < this.singleEntry.Size)
-                {
-                    int copySize = (int)Math.Min(count, this.singleEntry.Size - intPacketOffset);
-                    stream.Write(this.singleEntry.Buffer.Buffer, (int)(this.singleEntry.Offset + intPacketOffset), copySize);
+                int copySize = Math.Min(count - actuallyCopied, entry.Size - entryOffset);
+                Array.Copy(entry.Buffer.Buffer, entry.Offset + entryOffset, buffer, offset + actuallyCopied, copySize);
 
-                    actuallyCopied += copySize;
-                }
+                actuallyCopied += copySize;
+                entryOffset = 0;
             }
-            else
+
+            return actuallyCopied;
+        }
+
+        /// <summary>
+        /// Gets the contiguous part of the data starting at current position, i.e. the rest
+        /// of the current underlying buffer, without copying and without moving current position.
+        /// The segment is empty at the end of the stream.
+        /// </summary>
+        /// <returns>Segment of the underlying byte buffer</returns>
+        public ArraySegment<byte> PeekSegment()
+        {
+            if (this.entryIndex == this.entries.Count)
             {
-                for (int i = this.position2BufferId.Keys.IndexOf(this.positionKey); i < this.position2BufferId.Count; ++i)
-                {
-                    long key = this.position2BufferId.Keys[i];
+                return new ArraySegment<byte>(PacketBufferStream.EmptyArray);
+            }
 
-                    // update position key
-                    this.positionKey = key;
-                    long intPacketOffset = 0;
-                    if (this.position > this.positionKey)
-                    {
-                        intPacketOffset = this.position - this.positionKey;
-                    }
+            BufferEntry entry = this.entries[this.entryIndex];
+            return new ArraySegment<byte>(entry.Buffer.Buffer, entry.Offset + this.entryOffset, entry.Size - this.entryOffset);
+        }
 
-                    long bufferId = this.position2BufferId[key];
-                    BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
+        /// <summary>
+        /// Copies specified number of bytes from current position to specified stream.
+        /// </summary>
+        /// <param name="stream">Target stream receiving the data</param>
+        /// <param name="count">Number of bytes to copy</param>
+        /// <returns>Number of bytes actually copied</returns>
+        public int CopyTo(PacketBufferStream stream, int count)
+        {
+            int actuallyCopied = 0;
 
-                    if (intPacketOffset >= entry.Size)
-                    {
-                        // nothing to read in current packet
-                        continue;
-                    }
+            while (actuallyCopied < count && this.entryIndex < this.entries.Count)
+            {
+                BufferEntry entry = this.entries[this.entryIndex];
 
-                    int copySize = (int)Math.Min(count - actuallyCopied, entry.Size - intPacketOffset);
-                    stream.Write(entry.Buffer.Buffer, (int)(entry.Offset + intPacketOffset), copySize);
+                int copySize = Math.Min(count - actuallyCopied, entry.Size - this.entryOffset);
+                stream.Write(entry.Buffer.Buffer, entry.Offset + this.entryOffset, copySize);
 
-                    actuallyCopied += copySize;
-                    if (actuallyCopied == count)
-                    {
-                        break;
-                    }
-                }
+                actuallyCopied += copySize;
+                this.Advance(entry, copySize);
             }
 
-            this.position += actuallyCopied;
             return actuallyCopied;
         }
 
@@ -548,87 +434,115 @@
         /// </summary>
         public void TrimBegin()
         {
-            //Global.Log.DebugFormat("Pos {0}, key {1}", this.Position, this.positionKey);
+            //Global.Log.DebugFormat("Pos {0}, entry {1}, offset {2}", this.position, this.entryIndex, this.entryOffset);
 
-            long removedLength = 0;
-
-            while (this.position2BufferId.Count > 0 && this.position2BufferId.Keys[0] < this.positionKey)
+            // release completely used buffers
+            for (int i = 0; i < this.entryIndex; ++i)
             {
-                long key = this.position2BufferId.Keys[0];
-
-                long bufferId = this.position2BufferId[key];
-                BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
-
-                // accumulate removed length
-                removedLength += entry.Size;
+                this.entries[i].Buffer.Release();
+            }
 
-                // release the buffer
-                entry.Buffer.Release();
+            this.entries.RemoveRange(0, this.entryIndex);
 
-                // clean up data
-                this.position2BufferId.Remove(key);
-                this.bufferId2BufferEntry.Remove(bufferId);
+            // cut the beginning of current buffer
+            if (this.entryOffset > 0)
+            {
+                BufferEntry entry = this.entries[0];
+                entry.Offset += this.entryOffset;
+                entry.Size -= this.entryOffset;
             }
 
-            // adjust offset and size of current buffer
-            if (removedLength < this.position)
+            long start = 0;
+            foreach (BufferEntry entry in this.entries)
             {
-                long gap = this.position - removedLength;
-                long bufferId = this.position2BufferId[this.positionKey];
-                BufferEntry entry = (BufferEntry)this.bufferId2BufferEntry[bufferId];
+                entry.Start = start;
+                start += entry.Size;
+            }
 
-                entry.Size -= (int)gap;
-                entry.Offset += (int)gap;
+            this.totalLength = start;
+            this.position = 0;
+            this.entryIndex = 0;
+            this.entryOffset = 0;
+            this.SkipEmptyEntries();
+        }
 
-                this.position2BufferId.Remove(this.positionKey);
+        #endregion
 
-                if (entry.Size == 0)
-                {
-                    // free completely used buffer
-                    entry.Buffer.Release();
-                    this.bufferId2BufferEntry.Remove(bufferId);
-                }
-                else
-                {
-                    // re-insert with new position
-                    this.position2BufferId.Add(0, bufferId);
-                }
+        #region Private methods
 
-                removedLength = this.position;
-            }
-            else
+        /// <summary>
+        /// Moves cursor to the specified position. Positions in current and following
+        /// entries are found by walking forward, others by binary search.
+        /// </summary>
+        /// <param name="position">New stream position</param>
+        private void Locate(long position)
+        {
+            int index = this.entryIndex;
+
+            if (index == this.entries.Count || position < this.entries[index].Start)
             {
-                if (this.positionKey < this.totalLength)
+                // binary search for the last entry starting at or before position
+                int low = 0;
+                int high = this.entries.Count - 1;
+                index = 0;
+
+                while (low <= high)
                 {
-                    // re-insert with new position
-                    long bufferId = this.position2BufferId[this.positionKey];
-                    this.position2BufferId.Remove(this.positionKey);
-                    this.position2BufferId.Add(0, bufferId);
+                    int middle = low + (high - low) / 2;
+                    if (this.entries[middle].Start <= position)
+                    {
+                        index = middle;
+                        low = middle + 1;
+                    }
+                    else
+                    {
+                        high = middle - 1;
+                    }
                 }
             }
 
-            // adjust positions of remaining packets
-            for (int i = this.position2BufferId.FindFirstIndexGreaterThan(this.positionKey); i < this.position2BufferId.Count; ++i)
-            {
-                long key = this.position2BufferId.Keys[i];
-                long bufferId = this.position2BufferId[key];
-                this.position2BufferId.Remove(key);
-                this.position2BufferId.Add(key - removedLength, bufferId);
-            }
+            this.position = position;
+            this.entryIndex = index;
+            this.entryOffset = (index < this.entries.Count) ? (int)(position - this.entries[index].Start) : 0;
+            this.SkipEmptyEntries();
+        }
 
-            if (this.bufferId2BufferEntry.Count == 1)
+        /// <summary>
+        /// Moves cursor forward within the current entry
+        /// </summary>
+        /// <param name="entry">Current entry</param>
+        /// <param name="count">Number of bytes to move, must not exceed the rest of the entry</param>
+        private void Advance(BufferEntry entry, int count)
+        {
+            this.position += count;
+            this.entryOffset += count;
+
+            if (this.entryOffset == entry.Size)
             {
-                IDictionaryEnumerator denum = this.bufferId2BufferEntry.GetEnumerator();
-                this.singleEntry = denum.MoveNext() ? (BufferEntry)((DictionaryEntry)denum.Current).Value : null;
+                this.NextEntry();
             }
-            else
+        }
+
+        /// <summary>
+        /// Moves cursor to the beginning of the next non-empty entry
+        /// </summary>
+        private void NextEntry()
+        {
+            this.entryIndex++;
+            this.entryOffset = 0;
+            this.SkipEmptyEntries();
+        }
+
+        /// <summary>
+        /// Moves cursor forward till it points inside an entry or to the end of the stream
+        /// </summary>
+        private void SkipEmptyEntries()
+        {
+            while (this.entryIndex < this.entries.Count && this.entryOffset >= this.entries[this.entryIndex].Size)
             {
-                this.singleEntry = null;
+                this.entryOffset -= this.entries[this.entryIndex].Size;
+                this.entryIndex++;
             }
-
-            this.totalLength -= removedLength;
-            this.positionKey = 0;
-            this.Position = 0;
         }
 
         #endregion
@@ -0,0 +1,44 @@
+﻿namespace MComms_Transmuxer.Common
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    /// <summary>
+    /// Stage of the ingest pipeline whose latency is measured by StreamStatistics.
+    /// Decode contains the stages processing messages of the packet on the session thread
+    /// </summary>
+    public enum PipelineStage
+    {
+        /// <summary>
+        /// Received data waiting in the session queue, from socket receive till the session takes it
+        /// </summary>
+        Receive = 0,
+
+        /// <summary>
+        /// Chunk decoding and processing of one received packet
+        /// </summary>
+        Decode,
+
+        /// <summary>
+        /// Timestamp fix and hand-off of one media message to the outputs
+        /// </summary>
+        Timestamp,
+
+        /// <summary>
+        /// Media sample waiting in an output queue till the output takes it
+        /// </summary>
+        OutputQueue,
+
+        /// <summary>
+        /// One push of media samples or demuxed messages to the native muxer
+        /// </summary>
+        Mux,
+
+        /// <summary>
+        /// Fragment waiting for upload and being written, from its completion till the publishing point has it
+        /// </summary>
+        Upload,
+    }
+}
@@ -0,0 +1,157 @@
+﻿namespace MComms_Transmuxer.Common
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    /// <summary>
+    /// Action run by a WorkerPool whenever it's scheduled. Runs never overlap and a work is queued at
+    /// most once: scheduling while it's queued does nothing, scheduling while it runs makes it run once
+    /// more afterwards. So an owner can schedule it on every event and process everything pending
+    /// in one run, in order, without a thread of its own.
+    /// </summary>
+    public class ScheduledWork
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Not queued nor running
+        /// </summary>
+        private const int StateIdle = 0;
+
+        /// <summary>
+        /// Queued in the pool
+        /// </summary>
+        private const int StateScheduled = 1;
+
+        /// <summary>
+        /// Running
+        /// </summary>
+        private const int StateRunning = 2;
+
+        /// <summary>
+        /// Running and scheduled again
+        /// </summary>
+        private const int StateRescheduled = 3;
+
+        /// <summary>
+        /// Pool running the work
+        /// </summary>
+        private WorkerPool pool = null;
+
+        /// <summary>
+        /// Action to run
+        /// </summary>
+        private Action action = null;
+
+        /// <summary>
+        /// Scheduling state
+        /// </summary>
+        private int state = ScheduledWork.StateIdle;
+
+        /// <summary>
+        /// Held while the action runs
+        /// </summary>
+        private object runLock = new object();
+
+        /// <summary>
+        /// Whether work is closed, its action isn't called anymore
+        /// </summary>
+        private volatile bool closed = false;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of ScheduledWork
+        /// </summary>
+        /// <param name="pool">Pool to run the work</param>
+        /// <param name="action">Action to run, exceptions are logged and ignored</param>
+        public ScheduledWork(WorkerPool pool, Action action)
+        {
+            this.pool = pool;
+            this.action = action;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Makes the pool run the action, never blocks
+        /// </summary>
+        public void Schedule()
+        {
+            while (!this.closed)
+            {
+                int current = this.state;
+
+                if (current == ScheduledWork.StateScheduled || current == ScheduledWork.StateRescheduled)
+                {
+                    return;
+                }
+
+                int next = (current == ScheduledWork.StateIdle) ? ScheduledWork.StateScheduled : ScheduledWork.StateRescheduled;
+                if (Interlocked.CompareExchange(ref this.state, next, current) == current)
+                {
+                    if (next == ScheduledWork.StateScheduled)
+                    {
+                        this.pool.Enqueue(this);
+                    }
+
+                    return;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops scheduling and waits for the action if it's running. May be called by the action itself
+        /// </summary>
+        public void Close()
+        {
+            lock (this.runLock)
+            {
+                this.closed = true;
+            }
+        }
+
+        #endregion
+
+        #region Internal methods
+
+        /// <summary>
+        /// Called by worker thread of the pool
+        /// </summary>
+        internal void Run()
+        {
+            Interlocked.Exchange(ref this.state, ScheduledWork.StateRunning);
+
+            lock (this.runLock)
+            {
+                if (!this.closed)
+                {
+                    try
+                    {
+                        this.action();
+                    }
+                    catch (Exception ex)
+                    {
+                        Global.Log.ErrorFormat("Scheduled work exception: {0}", ex.ToString());
+                    }
+                }
+            }
+
+            if (Interlocked.CompareExchange(ref this.state, ScheduledWork.StateIdle, ScheduledWork.StateRunning) != ScheduledWork.StateRunning)
+            {
+                // scheduled while running
+                Interlocked.Exchange(ref this.state, ScheduledWork.StateScheduled);
+                this.pool.Enqueue(this);
+            }
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,314 @@
+﻿namespace MComms_Transmuxer.Common
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    /// <summary>
+    /// Latency and throughput statistics of one published stream: a latency histogram per pipeline
+    /// stage, queue depths and byte counters. Recorded by every component the stream's media passes
+    /// through and read by the statistics endpoint. Statistics of a stream which stopped publishing are
+    /// kept for a while so a latency spike can still be looked at after the encoder has gone.
+    /// </summary>
+    public class StreamStatistics
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Statistics by publishing point and stream name
+        /// </summary>
+        private static Dictionary<string, StreamStatistics> streams = new Dictionary<string, StreamStatistics>();
+
+        /// <summary>
+        /// Latency histograms by stage
+        /// </summary>
+        private LatencyHistogram[] stages = new LatencyHistogram[Enum.GetValues(typeof(PipelineStage)).Length];
+
+        /// <summary>
+        /// Number of publishers using the statistics
+        /// </summary>
+        private int users = 0;
+
+        /// <summary>
+        /// When the last publisher stopped using the statistics
+        /// </summary>
+        private DateTime lastActivity = DateTime.Now;
+
+        /// <summary>
+        /// Number of bytes received
+        /// </summary>
+        private long receivedBytes = 0;
+
+        /// <summary>
+        /// Number of bytes uploaded
+        /// </summary>
+        private long uploadedBytes = 0;
+
+        /// <summary>
+        /// Received bytes counted by the last update
+        /// </summary>
+        private long lastReceivedBytes = 0;
+
+        /// <summary>
+        /// Uploaded bytes counted by the last update
+        /// </summary>
+        private long lastUploadedBytes = 0;
+
+        /// <summary>
+        /// Stopwatch timestamp of the last update
+        /// </summary>
+        private long lastUpdate = Stopwatch.GetTimestamp();
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of StreamStatistics
+        /// </summary>
+        /// <param name="publishingPoint">Publishing point name</param>
+        /// <param name="stream">Stream name</param>
+        public StreamStatistics(string publishingPoint, string stream)
+        {
+            this.PublishingPoint = publishingPoint;
+            this.Stream = stream;
+
+            for (int i = 0; i < this.stages.Length; ++i)
+            {
+                this.stages[i] = new LatencyHistogram();
+            }
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets publishing point name
+        /// </summary>
+        public string PublishingPoint { get; private set; }
+
+        /// <summary>
+        /// Gets stream name
+        /// </summary>
+        public string Stream { get; private set; }
+
+        /// <summary>
+        /// Gets whether stream is being published
+        /// </summary>
+        public bool Active
+        {
+            get
+            {
+                return this.users > 0;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets number of received packets waiting for the session
+        /// </summary>
+        public int ReceiveQueueDepth { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of samples queued for the slowest output
+        /// </summary>
+        public int OutputQueueDepth { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of fragments waiting for upload
+        /// </summary>
+        public int UploadQueueDepth { get; set; }
+
+        /// <summary>
+        /// Gets number of bytes received
+        /// </summary>
+        public long ReceivedBytes
+        {
+            get
+            {
+                return Interlocked.Read(ref this.receivedBytes);
+            }
+        }
+
+        /// <summary>
+        /// Gets number of bytes uploaded
+        /// </summary>
+        public long UploadedBytes
+        {
+            get
+            {
+                return Interlocked.Read(ref this.uploadedBytes);
+            }
+        }
+
+        /// <summary>
+        /// Gets receive bitrate measured by the last update, in bits per second
+        /// </summary>
+        public long ReceiveBitrate { get; private set; }
+
+        /// <summary>
+        /// Gets upload bitrate measured by the last update, in bits per second
+        /// </summary>
+        public long UploadBitrate { get; private set; }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Returns statistics of the stream, creating them if necessary, and registers one more user of them.
+        /// Each call must be paired with Close
+        /// </summary>
+        /// <param name="publishingPoint">Publishing point name</param>
+        /// <param name="stream">Stream name</param>
+        /// <returns>Stream statistics</returns>
+        public static StreamStatistics Open(string publishingPoint, string stream)
+        {
+            string key = publishingPoint + "/" + stream;
+
+            lock (StreamStatistics.streams)
+            {
+                StreamStatistics statistics = null;
+                if (!StreamStatistics.streams.TryGetValue(key, out statistics))
+                {
+                    statistics = new StreamStatistics(publishingPoint, stream);
+                    StreamStatistics.streams.Add(key, statistics);
+                }
+
+                statistics.users++;
+                return statistics;
+            }
+        }
+
+        /// <summary>
+        /// Returns statistics of all streams, sorted by publishing point and stream name
+        /// </summary>
+        /// <returns>List of statistics</returns>
+        public static List<StreamStatistics> GetAll()
+        {
+            lock (StreamStatistics.streams)
+            {
+                return StreamStatistics.streams.OrderBy(pair => pair.Key, StringComparer.Ordinal).Select(pair => pair.Value).ToList();
+            }
+        }
+
+        /// <summary>
+        /// Updates bitrates of all streams and deletes statistics of streams not published for a while.
+        /// Called every second
+        /// </summary>
+        public static void UpdateAll()
+        {
+            lock (StreamStatistics.streams)
+            {
+                foreach (string key in StreamStatistics.streams.Keys.ToList())
+                {
+                    StreamStatistics statistics = StreamStatistics.streams[key];
+                    if (statistics.users == 0 && (DateTime.Now - statistics.lastActivity).TotalMilliseconds > Global.StreamStatisticsRetentionMs)
+                    {
+                        StreamStatistics.streams.Remove(key);
+                        continue;
+                    }
+
+                    statistics.Update();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Unregisters user of the statistics
+        /// </summary>
+        public void Close()
+        {
+            lock (StreamStatistics.streams)
+            {
+                if (this.users > 0)
+                {
+                    this.users--;
+                }
+
+                this.lastActivity = DateTime.Now;
+            }
+        }
+
+        /// <summary>
+        /// Returns latency histogram of the stage
+        /// </summary>
+        /// <param name="stage">Pipeline stage</param>
+        /// <returns>Latency histogram</returns>
+        public LatencyHistogram GetHistogram(PipelineStage stage)
+        {
+            return this.stages[(int)stage];
+        }
+
+        /// <summary>
+        /// Records duration of the stage from the specified Stopwatch timestamp till now
+        /// </summary>
+        /// <param name="stage">Pipeline stage</param>
+        /// <param name="startTimestamp">Stopwatch.GetTimestamp() taken when the stage started</param>
+        public void Record(PipelineStage stage, long startTimestamp)
+        {
+            this.stages[(int)stage].RecordSince(startTimestamp);
+        }
+
+        /// <summary>
+        /// Counts received bytes
+        /// </summary>
+        /// <param name="count">Number of bytes</param>
+        public void AddReceivedBytes(int count)
+        {
+            Interlocked.Add(ref this.receivedBytes, count);
+        }
+
+        /// <summary>
+        /// Counts uploaded bytes
+        /// </summary>
+        /// <param name="count">Number of bytes</param>
+        public void AddUploadedBytes(int count)
+        {
+            Interlocked.Add(ref this.uploadedBytes, count);
+        }
+
+        /// <summary>
+        /// Clears latency histograms
+        /// </summary>
+        public void Reset()
+        {
+            foreach (LatencyHistogram histogram in this.stages)
+            {
+                histogram.Reset();
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Updates bitrates from byte counters
+        /// </summary>
+        private void Update()
+        {
+            long now = Stopwatch.GetTimestamp();
+            double seconds = (double)(now - this.lastUpdate) / Stopwatch.Frequency;
+            if (seconds <= 0)
+            {
+                return;
+            }
+
+            long received = this.ReceivedBytes;
+            long uploaded = this.UploadedBytes;
+
+            this.ReceiveBitrate = (long)((received - this.lastReceivedBytes) * 8 / seconds);
+            this.UploadBitrate = (long)((uploaded - this.lastUploadedBytes) * 8 / seconds);
+
+            this.lastReceivedBytes = received;
+            this.lastUploadedBytes = uploaded;
+            this.lastUpdate = now;
+        }
+
+        #endregion
+    }
+}
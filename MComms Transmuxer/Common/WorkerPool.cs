@@ -0,0 +1,298 @@
+﻿namespace MComms_Transmuxer.Common
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    /// <summary>
+    /// Fixed pool of worker threads running ScheduledWork items. Every worker has its own queue, work
+    /// scheduled from a worker stays on it, work scheduled from other threads goes to the shared queue.
+    /// A worker takes from its own queue first, then from the shared one, and steals from the other
+    /// workers when both are empty; idle workers sleep till something is scheduled.
+    /// </summary>
+    public class WorkerPool : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Worker of the current thread, null for threads not belonging to a pool
+        /// </summary>
+        [ThreadStatic]
+        private static Worker currentWorker;
+
+        /// <summary>
+        /// Workers
+        /// </summary>
+        private Worker[] workers = null;
+
+        /// <summary>
+        /// Work scheduled by threads outside of the pool
+        /// </summary>
+        private ConcurrentQueue<ScheduledWork> sharedQueue = new ConcurrentQueue<ScheduledWork>();
+
+        /// <summary>
+        /// Idle workers wait on it
+        /// </summary>
+        private object syncRoot = new object();
+
+        /// <summary>
+        /// Number of workers waiting for work
+        /// </summary>
+        private int idleWorkers = 0;
+
+        /// <summary>
+        /// Whether pool is disposed
+        /// </summary>
+        private volatile bool disposed = false;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of WorkerPool and starts its threads
+        /// </summary>
+        /// <param name="name">Pool name, used for thread names</param>
+        /// <param name="workerCount">Number of worker threads</param>
+        public WorkerPool(string name, int workerCount)
+        {
+            this.workers = new Worker[Math.Max(workerCount, 1)];
+
+            for (int i = 0; i < this.workers.Length; ++i)
+            {
+                Worker worker = new Worker();
+                worker.Index = i;
+                worker.Thread = new Thread(this.WorkerThreadProc);
+                worker.Thread.Name = string.Format("{0} worker {1}", name, i);
+                worker.Thread.IsBackground = true;
+                this.workers[i] = worker;
+            }
+
+            foreach (Worker worker in this.workers)
+            {
+                worker.Thread.Start(worker);
+            }
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets number of worker threads
+        /// </summary>
+        public int WorkerCount
+        {
+            get
+            {
+                return this.workers.Length;
+            }
+        }
+
+        /// <summary>
+        /// Gets number of works waiting for a worker
+        /// </summary>
+        public int QueuedWorks
+        {
+            get
+            {
+                int count = this.sharedQueue.Count;
+                foreach (Worker worker in this.workers)
+                {
+                    count += worker.Queue.Count;
+                }
+
+                return count;
+            }
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Lets workers run what's scheduled and waits for them
+        /// </summary>
+        public void Dispose()
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed)
+                {
+                    return;
+                }
+
+                this.disposed = true;
+                Monitor.PulseAll(this.syncRoot);
+            }
+
+            foreach (Worker worker in this.workers)
+            {
+                if (worker != WorkerPool.currentWorker)
+                {
+                    worker.Thread.Join();
+                }
+            }
+        }
+
+        #endregion
+
+        #region Internal methods
+
+        /// <summary>
+        /// Queues work to run, called by ScheduledWork once per scheduling
+        /// </summary>
+        /// <param name="work">Work to queue</param>
+        internal void Enqueue(ScheduledWork work)
+        {
+            Worker worker = WorkerPool.currentWorker;
+            if (worker != null && worker.Pool == this)
+            {
+                worker.Queue.Enqueue(work);
+            }
+            else
+            {
+                this.sharedQueue.Enqueue(work);
+            }
+
+            // queuing is a full fence, so a worker going idle either sees the work or is counted here
+            if (Thread.VolatileRead(ref this.idleWorkers) > 0)
+            {
+                lock (this.syncRoot)
+                {
+                    Monitor.Pulse(this.syncRoot);
+                }
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Worker thread, runs scheduled work till the pool is disposed
+        /// </summary>
+        /// <param name="state">Worker</param>
+        private void WorkerThreadProc(object state)
+        {
+            Worker worker = (Worker)state;
+            worker.Pool = this;
+            WorkerPool.currentWorker = worker;
+
+            while (true)
+            {
+                ScheduledWork work = this.TakeWork(worker);
+
+                if (work != null)
+                {
+                    work.Run();
+                    continue;
+                }
+
+                lock (this.syncRoot)
+                {
+                    Interlocked.Increment(ref this.idleWorkers);
+
+                    // look again now that schedulers see this worker idle
+                    if (!this.HasWork())
+                    {
+                        if (this.disposed)
+                        {
+                            Interlocked.Decrement(ref this.idleWorkers);
+                            break;
+                        }
+
+                        Monitor.Wait(this.syncRoot);
+                    }
+
+                    Interlocked.Decrement(ref this.idleWorkers);
+                }
+            }
+
+            WorkerPool.currentWorker = null;
+        }
+
+        /// <summary>
+        /// Takes work from worker's own queue, the shared queue or another worker's queue
+        /// </summary>
+        /// <param name="worker">Worker looking for work</param>
+        /// <returns>Work to run or null if there's nothing</returns>
+        private ScheduledWork TakeWork(Worker worker)
+        {
+            ScheduledWork work = null;
+
+            if (worker.Queue.TryDequeue(out work) || this.sharedQueue.TryDequeue(out work))
+            {
+                return work;
+            }
+
+            for (int i = 1; i < this.workers.Length; ++i)
+            {
+                Worker victim = this.workers[(worker.Index + i) % this.workers.Length];
+                if (victim.Queue.TryDequeue(out work))
+                {
+                    return work;
+                }
+            }
+
+            return null;
+        }
+
+        /// <summary>
+        /// Checks whether any queue has work
+        /// </summary>
+        /// <returns>True if there is work to run</returns>
+        private bool HasWork()
+        {
+            if (!this.sharedQueue.IsEmpty)
+            {
+                return true;
+            }
+
+            foreach (Worker worker in this.workers)
+            {
+                if (!worker.Queue.IsEmpty)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Worker thread and its queue
+        /// </summary>
+        private class Worker
+        {
+            /// <summary>
+            /// Work scheduled by this worker
+            /// </summary>
+            public ConcurrentQueue<ScheduledWork> Queue = new ConcurrentQueue<ScheduledWork>();
+
+            /// <summary>
+            /// Gets or sets pool the worker belongs to
+            /// </summary>
+            public WorkerPool Pool { get; set; }
+
+            /// <summary>
+            /// Gets or sets worker index
+            /// </summary>
+            public int Index { get; set; }
+
+            /// <summary>
+            /// Gets or sets worker thread
+            /// </summary>
+            public Thread Thread { get; set; }
+        }
+
+        #endregion
+    }
+}
@@ -54,6 +54,17 @@ namespace MComms_Transmuxer
         /// </summary>
         public const int RtmpSessionInactivityTimeoutMs = 30000;
 
+        /// <summary>
+        /// Maximum number of received packets one RTMP session processes before other sessions
+        /// of the same worker get their turn
+        /// </summary>
+        public const int RtmpSessionPacketsPerRun = 16;
+
+        /// <summary>
+        /// Maximum number of messages returned by one native demuxer call
+        /// </summary>
+        public const int RtmpMaxDemuxedMessages = 64;
+
         /// <summary>
         /// Transport buffer size used to accumulate received data.
         /// This must be equal or bigger than RtmpOurChunkSize
@@ -66,15 +77,57 @@ namespace MComms_Transmuxer
         public const int OneMediaBufferSize = 1024 * 1024;
 
         /// <summary>
-        /// Buffer size to store one segment data.
+        /// Initial size of the native buffer to store one segment data, grows with the biggest segment.
+        /// Native pool rounds it up to a power of two.
         /// </summary>
-        public const int SegmentBufferSize = 10 * 1024 * 1024;
+        public const int SegmentBufferSize = 2 * 1024 * 1024;
 
         /// <summary>
         /// Timescale of the smooth streaming timstamps
         /// </summary>
         public const long SmoothStreamingTimescale = 10000000;
 
+        /// <summary>
+        /// Maximum number of media samples queued by the segmenter before they're pushed to the muxer in one call
+        /// </summary>
+        public const int SmoothStreamingMaxBatchSize = 16;
+
+        /// <summary>
+        /// Maximum number of segments the muxer may complete in one batch call
+        /// </summary>
+        public const int SmoothStreamingMaxBatchSegments = 4;
+
+        /// <summary>
+        /// Maximum number of fragments queued for upload per stream, the oldest ones are dropped when exceeded
+        /// </summary>
+        public const int SmoothStreamingUploadQueueLength = 64;
+
+        /// <summary>
+        /// Delay before the first reconnection attempt of an uploader, in milliseconds
+        /// </summary>
+        public const int SmoothStreamingUploadRetryDelayMs = 250;
+
+        /// <summary>
+        /// Reconnection delay doubles on each failure up to this value, in milliseconds
+        /// </summary>
+        public const int SmoothStreamingUploadMaxRetryDelayMs = 8000;
+
+        /// <summary>
+        /// Maximum number of simultaneous connections to one publishing server, each stream keeps one open
+        /// </summary>
+        public const int SmoothStreamingMaxUploadConnections = 256;
+
+        /// <summary>
+        /// Maximum number of media samples queued per output of a published stream. Every queued sample
+        /// holds a media buffer, so the queue is kept short; samples are dropped when exceeded
+        /// </summary>
+        public const int MediaSinkQueueLength = 64;
+
+        /// <summary>
+        /// How long statistics of a stream are kept after it stopped publishing, in milliseconds
+        /// </summary>
+        public const int StreamStatisticsRetentionMs = 600000;
+
         /// <summary>
         /// Allocator is used for transport purpose. Buffer size is relatively small
         /// (should not be too small though because it reduces socket transport performance).
@@ -89,13 +142,6 @@ namespace MComms_Transmuxer
         /// </summary>
         public static PacketBufferAllocator MediaAllocator { get; set; }
 
-        /// <summary>
-        /// Allocator is used to store the whole segment. Buffer size should be big enough
-        /// to store 2 seconds of video data in full HD resolution. Number of buffers should be relatively small
-        /// because this buffer is used for a very short time every 2-5 seconds for every connection.
-        /// </summary>
-        public static PacketBufferAllocator SegmentAllocator { get; set; }
-
         /// <summary>
         /// Logger
         /// </summary>
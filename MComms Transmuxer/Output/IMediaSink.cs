@@ -0,0 +1,41 @@
+﻿namespace MComms_Transmuxer.Output
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Output of a published stream. Sinks are fed by MediaFanOut, each one from its own worker
+    /// thread, so a sink is never called concurrently and doesn't need to be thread safe
+    /// </summary>
+    public interface IMediaSink : IDisposable
+    {
+        /// <summary>
+        /// Registers stream with specified media type, called before the first sample of the stream
+        /// and again when the stream configuration changes
+        /// </summary>
+        /// <param name="mediaType">Media type with codec private data</param>
+        void RegisterStream(MediaType mediaType);
+
+        /// <summary>
+        /// Takes one sample. Media data buffer is referenced only for the duration of the call,
+        /// sink must add its own reference to keep it longer
+        /// </summary>
+        /// <param name="sample">Media sample</param>
+        void PushSample(MediaSample sample);
+
+        /// <summary>
+        /// Adjusts absolute time after timestamps were re-synchronized in RTMP message stream
+        /// </summary>
+        /// <param name="gap">Absolute time change, in 100 ns units</param>
+        void AdjustAbsoluteTime(long gap);
+
+        /// <summary>
+        /// Called when the sink has caught up with the stream, sinks which batch samples push them here
+        /// </summary>
+        void Flush();
+    }
+}
@@ -0,0 +1,199 @@
+﻿namespace MComms_Transmuxer.Output
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Fan-out stage of a published stream. Media is parsed and timestamps are normalized once by the
+    /// message stream, the resulting samples are handed by reference to every registered sink through
+    /// its own bounded queue and worker thread, so adding an output costs queue slots rather than
+    /// another pipeline. Methods are called by the thread of the RTMP session only.
+    /// </summary>
+    public class MediaFanOut : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Workers of registered sinks
+        /// </summary>
+        private List<MediaSinkWorker> workers = new List<MediaSinkWorker>();
+
+        /// <summary>
+        /// Registered streams by content type, replayed to sinks added later
+        /// </summary>
+        private Dictionary<MediaContentType, MediaType> streams = new Dictionary<MediaContentType, MediaType>();
+
+        /// <summary>
+        /// Maximum number of queued media samples per sink
+        /// </summary>
+        private int queueLength = 0;
+
+        /// <summary>
+        /// Whether pushing waits for room in the queues instead of dropping samples
+        /// </summary>
+        private bool lossless = false;
+
+        /// <summary>
+        /// Statistics of the published stream, null if not collected
+        /// </summary>
+        private StreamStatistics statistics = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of MediaFanOut
+        /// </summary>
+        /// <param name="queueLength">Maximum number of queued media samples per sink</param>
+        /// <param name="statistics">Statistics of the published stream, null if not collected</param>
+        /// <param name="lossless">Whether pushing waits for room in the queues instead of dropping samples</param>
+        public MediaFanOut(int queueLength, StreamStatistics statistics = null, bool lossless = false)
+        {
+            this.queueLength = queueLength;
+            this.statistics = statistics;
+            this.lossless = lossless;
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets number of registered sinks
+        /// </summary>
+        public int SinkCount
+        {
+            get
+            {
+                return this.workers.Count;
+            }
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Lets every sink process its queue and disposes it
+        /// </summary>
+        public void Dispose()
+        {
+            foreach (MediaSinkWorker worker in this.workers)
+            {
+                worker.Dispose();
+            }
+
+            this.workers.Clear();
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Registers sink, the fan-out owns it from now on. Streams registered so far are registered
+        /// with the sink first
+        /// </summary>
+        /// <param name="name">Sink name used in log and exception messages</param>
+        /// <param name="sink">Sink to add</param>
+        public void AddSink(string name, IMediaSink sink)
+        {
+            MediaSinkWorker worker = new MediaSinkWorker(name, sink, this.queueLength, this.statistics, this.lossless);
+
+            foreach (MediaType mediaType in this.streams.Values)
+            {
+                worker.RegisterStream(mediaType);
+            }
+
+            this.workers.Add(worker);
+        }
+
+        /// <summary>
+        /// Registers stream with all sinks
+        /// </summary>
+        /// <param name="mediaType">Media type with codec private data</param>
+        public void RegisterStream(MediaType mediaType)
+        {
+            this.ThrowIfFailed();
+
+            this.streams[mediaType.ContentType] = mediaType;
+
+            foreach (MediaSinkWorker worker in this.workers)
+            {
+                worker.RegisterStream(mediaType);
+            }
+        }
+
+        /// <summary>
+        /// Queues sample to all sinks, it stays referenced till the last one has taken it
+        /// </summary>
+        /// <param name="sample">Media sample</param>
+        public void PushSample(MediaSample sample)
+        {
+            this.ThrowIfFailed();
+
+            int queueDepth = 0;
+            foreach (MediaSinkWorker worker in this.workers)
+            {
+                worker.PushSample(sample);
+
+                if (this.statistics != null)
+                {
+                    queueDepth = Math.Max(queueDepth, worker.QueuedItems);
+                }
+            }
+
+            if (this.statistics != null)
+            {
+                this.statistics.OutputQueueDepth = queueDepth;
+            }
+        }
+
+        /// <summary>
+        /// Queues absolute time adjustment to all sinks
+        /// </summary>
+        /// <param name="gap">Absolute time change, in 100 ns units</param>
+        public void AdjustAbsoluteTime(long gap)
+        {
+            foreach (MediaSinkWorker worker in this.workers)
+            {
+                worker.AdjustAbsoluteTime(gap);
+            }
+        }
+
+        /// <summary>
+        /// Calls action on the caller's thread if the sink is the only one and has nothing queued.
+        /// Lets a sink take data it can process itself faster than it's parsed and queued
+        /// </summary>
+        /// <param name="sink">Sink the action calls</param>
+        /// <param name="action">Action to call</param>
+        /// <returns>True if action was called</returns>
+        public bool RunIfSoleAndIdle(IMediaSink sink, Action action)
+        {
+            if (this.workers.Count != 1 || this.workers[0].Sink != sink)
+            {
+                return false;
+            }
+
+            return this.workers[0].RunIfIdle(action);
+        }
+
+        /// <summary>
+        /// Throws CriticalStreamException if any sink has failed
+        /// </summary>
+        public void ThrowIfFailed()
+        {
+            foreach (MediaSinkWorker worker in this.workers)
+            {
+                worker.ThrowIfFailed();
+            }
+        }
+
+        #endregion
+    }
+}
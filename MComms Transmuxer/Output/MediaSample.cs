@@ -0,0 +1,63 @@
+﻿namespace MComms_Transmuxer.Output
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// Media sample handed to output sinks after timestamp normalization. One sample is shared by
+    /// all sinks, every queue it's waiting in holds a reference to its media data buffer
+    /// </summary>
+    public class MediaSample
+    {
+        /// <summary>
+        /// Gets or sets content type of the stream the sample belongs to
+        /// </summary>
+        public MediaContentType ContentType { get; set; }
+
+        /// <summary>
+        /// Gets or sets packet type, configuration and EOS packets are passed for sinks which store the stream as is
+        /// </summary>
+        public RtmpMediaPacketType PacketType { get; set; }
+
+        /// <summary>
+        /// Gets or sets absolute time of the sample
+        /// </summary>
+        public DateTime AbsoluteTime { get; set; }
+
+        /// <summary>
+        /// Gets or sets sample timestamp adjusted by the message stream, in 100 ns units
+        /// </summary>
+        public long Timestamp { get; set; }
+
+        /// <summary>
+        /// Gets or sets whether sample is a key frame, audio samples always are
+        /// </summary>
+        public bool KeyFrame { get; set; }
+
+        /// <summary>
+        /// Gets or sets buffer with the whole media message including FLV media header
+        /// </summary>
+        public PacketBuffer MediaData { get; set; }
+
+        /// <summary>
+        /// Gets or sets offset of the codec data in media data buffer
+        /// </summary>
+        public int MediaDataOffset { get; set; }
+
+        /// <summary>
+        /// Gets length of the codec data
+        /// </summary>
+        public int MediaDataLength
+        {
+            get
+            {
+                return this.MediaData.ActualBufferSize - this.MediaDataOffset;
+            }
+        }
+    }
+}
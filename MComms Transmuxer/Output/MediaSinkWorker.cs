@@ -0,0 +1,467 @@
+﻿namespace MComms_Transmuxer.Output
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// Feeds one sink from a bounded queue on its own thread. Queuing only adds a reference to the
+    /// sample, so a slow sink never blocks the message stream or the other sinks. When the queue is
+    /// full media samples are dropped, video resumes with the next key frame; stream registrations,
+    /// configuration and time adjustments are never dropped. Lossless workers make the caller wait for
+    /// room instead, for sources which can be paused like capture replay. A sink which throws is not
+    /// called anymore, the exception is reported to the message stream by ThrowIfFailed.
+    /// </summary>
+    public class MediaSinkWorker : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Sink name used in log and exception messages
+        /// </summary>
+        private string name = null;
+
+        /// <summary>
+        /// Sink fed by the worker
+        /// </summary>
+        private IMediaSink sink = null;
+
+        /// <summary>
+        /// Maximum number of queued media samples
+        /// </summary>
+        private int queueLength = 0;
+
+        /// <summary>
+        /// Whether pushing waits for room in the queue instead of dropping samples
+        /// </summary>
+        private bool lossless = false;
+
+        /// <summary>
+        /// Protects queue and state, signalled when there is something to process
+        /// </summary>
+        private object syncRoot = new object();
+
+        /// <summary>
+        /// Work items waiting for the sink
+        /// </summary>
+        private Queue<WorkItem> queue = new Queue<WorkItem>();
+
+        /// <summary>
+        /// Whether the sink is being called, either by worker thread or by RunIfIdle
+        /// </summary>
+        private bool busy = false;
+
+        /// <summary>
+        /// Whether video samples are dropped till the next key frame
+        /// </summary>
+        private bool waitingForKeyFrame = false;
+
+        /// <summary>
+        /// Whether samples are being dropped, only the first drop is logged
+        /// </summary>
+        private bool dropping = false;
+
+        /// <summary>
+        /// Exception thrown by the sink, the sink isn't called after it
+        /// </summary>
+        private volatile Exception failure = null;
+
+        /// <summary>
+        /// Worker thread
+        /// </summary>
+        private Thread workerThread = null;
+
+        /// <summary>
+        /// Whether worker is disposed
+        /// </summary>
+        private bool disposed = false;
+
+        /// <summary>
+        /// Number of samples dropped because the queue was full
+        /// </summary>
+        private long droppedSamples = 0;
+
+        /// <summary>
+        /// Statistics of the published stream, null if not collected
+        /// </summary>
+        private StreamStatistics statistics = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of MediaSinkWorker and starts its thread
+        /// </summary>
+        /// <param name="name">Sink name</param>
+        /// <param name="sink">Sink to feed</param>
+        /// <param name="queueLength">Maximum number of queued media samples</param>
+        /// <param name="statistics">Statistics of the published stream, time samples wait in the queue is recorded to it</param>
+        /// <param name="lossless">Whether pushing waits for room in the queue instead of dropping samples</param>
+        public MediaSinkWorker(string name, IMediaSink sink, int queueLength, StreamStatistics statistics = null, bool lossless = false)
+        {
+            this.name = name;
+            this.sink = sink;
+            this.queueLength = queueLength;
+            this.statistics = statistics;
+            this.lossless = lossless;
+            this.workerThread = new Thread(this.WorkerThreadProc);
+            this.workerThread.IsBackground = true;
+            this.workerThread.Start();
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets sink name
+        /// </summary>
+        public string Name
+        {
+            get
+            {
+                return this.name;
+            }
+        }
+
+        /// <summary>
+        /// Gets sink fed by the worker
+        /// </summary>
+        public IMediaSink Sink
+        {
+            get
+            {
+                return this.sink;
+            }
+        }
+
+        /// <summary>
+        /// Gets number of work items waiting for the sink
+        /// </summary>
+        public int QueuedItems
+        {
+            get
+            {
+                lock (this.syncRoot)
+                {
+                    return this.queue.Count;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets number of samples dropped because the queue was full
+        /// </summary>
+        public long DroppedSamples
+        {
+            get
+            {
+                return Interlocked.Read(ref this.droppedSamples);
+            }
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Lets worker thread process what's queued, waits for it and disposes the sink
+        /// </summary>
+        public void Dispose()
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed)
+                {
+                    return;
+                }
+
+                this.disposed = true;
+                Monitor.PulseAll(this.syncRoot);
+            }
+
+            this.workerThread.Join();
+
+            try
+            {
+                this.sink.Dispose();
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Failed to close output {0}: {1}", this.name, ex.Message);
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Queues stream registration
+        /// </summary>
+        /// <param name="mediaType">Media type of the stream</param>
+        public void RegisterStream(MediaType mediaType)
+        {
+            this.Enqueue(new WorkItem { MediaType = mediaType });
+        }
+
+        /// <summary>
+        /// Queues absolute time adjustment
+        /// </summary>
+        /// <param name="gap">Absolute time change, in 100 ns units</param>
+        public void AdjustAbsoluteTime(long gap)
+        {
+            this.Enqueue(new WorkItem { Gap = gap });
+        }
+
+        /// <summary>
+        /// Queues sample referencing its media data, never blocks unless the worker is lossless
+        /// </summary>
+        /// <param name="sample">Media sample</param>
+        public void PushSample(MediaSample sample)
+        {
+            lock (this.syncRoot)
+            {
+                if (this.lossless && sample.PacketType == RtmpMediaPacketType.Media)
+                {
+                    while (!this.disposed && this.failure == null && this.queue.Count >= this.queueLength)
+                    {
+                        Monitor.Wait(this.syncRoot);
+                    }
+                }
+
+                if (this.disposed || this.failure != null)
+                {
+                    return;
+                }
+
+                if (sample.PacketType == RtmpMediaPacketType.Media)
+                {
+                    bool video = sample.ContentType == MediaContentType.Video;
+
+                    if (video && this.waitingForKeyFrame && !sample.KeyFrame)
+                    {
+                        Interlocked.Increment(ref this.droppedSamples);
+                        return;
+                    }
+
+                    if (this.queue.Count >= this.queueLength)
+                    {
+                        if (video)
+                        {
+                            this.waitingForKeyFrame = true;
+                        }
+
+                        Interlocked.Increment(ref this.droppedSamples);
+                        if (!this.dropping)
+                        {
+                            this.dropping = true;
+                            Global.Log.WarnFormat("Queue of output {0} is full, dropping samples", this.name);
+                        }
+
+                        return;
+                    }
+
+                    if (video)
+                    {
+                        this.waitingForKeyFrame = false;
+                    }
+
+                    this.dropping = false;
+                }
+
+                sample.MediaData.AddRef();
+                this.queue.Enqueue(new WorkItem { Sample = sample, Queued = this.statistics != null ? Stopwatch.GetTimestamp() : 0 });
+                Monitor.PulseAll(this.syncRoot);
+            }
+        }
+
+        /// <summary>
+        /// Calls action on the caller's thread if there is nothing queued for the sink, so it can be
+        /// fed directly without breaking the order of samples. Exceptions of the action are passed to the caller
+        /// </summary>
+        /// <param name="action">Action calling the sink</param>
+        /// <returns>True if action was called, false if the sink is busy</returns>
+        public bool RunIfIdle(Action action)
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed || this.failure != null || this.busy || this.queue.Count > 0)
+                {
+                    return false;
+                }
+
+                this.busy = true;
+            }
+
+            try
+            {
+                action();
+            }
+            finally
+            {
+                lock (this.syncRoot)
+                {
+                    this.busy = false;
+                    Monitor.PulseAll(this.syncRoot);
+                }
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Throws CriticalStreamException if the sink has failed
+        /// </summary>
+        public void ThrowIfFailed()
+        {
+            Exception ex = this.failure;
+            if (ex != null)
+            {
+                throw new CriticalStreamException(string.Format("Output {0} failed: {1}", this.name, ex.Message));
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Queues work item which must not be dropped
+        /// </summary>
+        /// <param name="item">Work item</param>
+        private void Enqueue(WorkItem item)
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed || this.failure != null)
+                {
+                    return;
+                }
+
+                this.queue.Enqueue(item);
+                Monitor.PulseAll(this.syncRoot);
+            }
+        }
+
+        /// <summary>
+        /// Worker thread, passes queued items to the sink and flushes it whenever the queue is drained
+        /// </summary>
+        private void WorkerThreadProc()
+        {
+            while (true)
+            {
+                WorkItem item = null;
+
+                lock (this.syncRoot)
+                {
+                    while (!this.disposed && (this.busy || this.queue.Count == 0))
+                    {
+                        Monitor.Wait(this.syncRoot);
+                    }
+
+                    if (this.queue.Count == 0)
+                    {
+                        // disposed and drained
+                        break;
+                    }
+
+                    item = this.queue.Dequeue();
+                    this.busy = true;
+                }
+
+                try
+                {
+                    if (this.failure == null)
+                    {
+                        if (item.Sample != null)
+                        {
+                            if (this.statistics != null)
+                            {
+                                this.statistics.Record(PipelineStage.OutputQueue, item.Queued);
+                            }
+
+                            this.sink.PushSample(item.Sample);
+                        }
+                        else if (item.MediaType != null)
+                        {
+                            this.sink.RegisterStream(item.MediaType);
+                        }
+                        else
+                        {
+                            this.sink.AdjustAbsoluteTime(item.Gap);
+                        }
+
+                        bool drained = false;
+                        lock (this.syncRoot)
+                        {
+                            drained = this.queue.Count == 0;
+                        }
+
+                        if (drained)
+                        {
+                            this.sink.Flush();
+                        }
+                    }
+                }
+                catch (Exception ex)
+                {
+                    Global.Log.ErrorFormat("Output {0} failed: {1}", this.name, ex.ToString());
+                    this.failure = ex;
+                }
+                finally
+                {
+                    if (item.Sample != null)
+                    {
+                        item.Sample.MediaData.Release();
+                    }
+
+                    lock (this.syncRoot)
+                    {
+                        this.busy = false;
+                        Monitor.PulseAll(this.syncRoot);
+                    }
+                }
+            }
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Queued call of the sink, exactly one of sample, media type or gap is meaningful
+        /// </summary>
+        private class WorkItem
+        {
+            /// <summary>
+            /// Gets or sets sample to push
+            /// </summary>
+            public MediaSample Sample { get; set; }
+
+            /// <summary>
+            /// Gets or sets media type of the stream to register
+            /// </summary>
+            public MediaType MediaType { get; set; }
+
+            /// <summary>
+            /// Gets or sets absolute time adjustment
+            /// </summary>
+            public long Gap { get; set; }
+
+            /// <summary>
+            /// Gets or sets Stopwatch timestamp of queuing the sample, 0 if not measured
+            /// </summary>
+            public long Queued { get; set; }
+        }
+
+        #endregion
+    }
+}
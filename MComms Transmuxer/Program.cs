@@ -2,6 +2,7 @@
 {
     using System;
     using System.Collections.Generic;
+    using System.IO;
     using System.Linq;
     using System.ServiceProcess;
     using System.Text;
@@ -10,6 +11,7 @@
 
     using MComms_Transmuxer.Common;
     using MComms_Transmuxer.RTMP;
+    using MComms_Transmuxer.SmoothStreaming;
 
     /// <summary>
     /// Main program
@@ -25,7 +27,6 @@
 
             Global.Allocator = new PacketBufferAllocator(Global.TransportBufferSize, Global.RtmpMaxConnections * 30);
             Global.MediaAllocator = new PacketBufferAllocator(Global.OneMediaBufferSize, Global.RtmpMaxConnections);
-            Global.SegmentAllocator = new PacketBufferAllocator(Global.SegmentBufferSize, Global.RtmpMaxConnections / 50);
 
             if (System.Environment.UserInteractive)
             {
@@ -48,6 +49,37 @@
                                 server.Stop();
                                 break;
                             }
+
+                        case "-transmux":
+                            {
+                                // -transmux <output folder> <FLV file or folder>...
+                                if (args.Length < 3)
+                                {
+                                    Global.Log.Error("Usage: -transmux <output folder> <FLV file or folder>...");
+                                    Environment.ExitCode = 1;
+                                    break;
+                                }
+
+                                List<string> files = new List<string>();
+                                foreach (string input in args.Skip(2))
+                                {
+                                    if (Directory.Exists(input))
+                                    {
+                                        files.AddRange(Directory.GetFiles(input, "*.flv"));
+                                    }
+                                    else
+                                    {
+                                        files.Add(input);
+                                    }
+                                }
+
+                                SmoothStreamingBatchTransmuxer transmuxer = new SmoothStreamingBatchTransmuxer(args[1], Environment.ProcessorCount);
+                                int transmuxed = transmuxer.Run(files);
+
+                                Global.Log.InfoFormat("Transmuxed {0} of {1} files to {2}", transmuxed, files.Count, args[1]);
+                                Environment.ExitCode = transmuxed == files.Count ? 0 : 1;
+                                break;
+                            }
                     }
                 }
             }
@@ -35,4 +35,5 @@ using System.Runtime.InteropServices;
 [assembly: AssemblyVersion("1.0.0.0")]
 [assembly: AssemblyFileVersion("1.0.0.0")]
 
-[assembly: System.Runtime.CompilerServices.InternalsVisibleTo("MComms TransmuxerTests")]
\ No newline at end of file
+[assembly: System.Runtime.CompilerServices.InternalsVisibleTo("MComms TransmuxerTests")]
+[assembly: System.Runtime.CompilerServices.InternalsVisibleTo("MComms TransmuxerBenchmark")]
\ No newline at end of file
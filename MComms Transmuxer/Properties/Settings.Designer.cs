@@ -103,5 +103,233 @@ namespace MComms_Transmuxer.Properties {
                 this["EnableFlvDump"] = value;
             }
         }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("2000")]
+        public int VideoFragmentDuration {
+            get {
+                return ((int)(this["VideoFragmentDuration"]));
+            }
+            set {
+                this["VideoFragmentDuration"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("5000")]
+        public int AudioFragmentDuration {
+            get {
+                return ((int)(this["AudioFragmentDuration"]));
+            }
+            set {
+                this["AudioFragmentDuration"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("0")]
+        public int MaxFragmentDuration {
+            get {
+                return ((int)(this["MaxFragmentDuration"]));
+            }
+            set {
+                this["MaxFragmentDuration"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool AlignAudioFragments {
+            get {
+                return ((bool)(this["AlignAudioFragments"]));
+            }
+            set {
+                this["AlignAudioFragments"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("0")]
+        public int ChunkDuration {
+            get {
+                return ((int)(this["ChunkDuration"]));
+            }
+            set {
+                this["ChunkDuration"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("0")]
+        public int ChunkSamples {
+            get {
+                return ((int)(this["ChunkSamples"]));
+            }
+            set {
+                this["ChunkSamples"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("True")]
+        public bool EnableNativeIngest {
+            get {
+                return ((bool)(this["EnableNativeIngest"]));
+            }
+            set {
+                this["EnableNativeIngest"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("True")]
+        public bool EnablePublishingPointPush {
+            get {
+                return ((bool)(this["EnablePublishingPointPush"]));
+            }
+            set {
+                this["EnablePublishingPointPush"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool EnableOrigin {
+            get {
+                return ((bool)(this["EnableOrigin"]));
+            }
+            set {
+                this["EnableOrigin"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("http://+:8080/")]
+        public string OriginPrefix {
+            get {
+                return ((string)(this["OriginPrefix"]));
+            }
+            set {
+                this["OriginPrefix"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("120000")]
+        public int OriginDvrWindow {
+            get {
+                return ((int)(this["OriginDvrWindow"]));
+            }
+            set {
+                this["OriginDvrWindow"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool EnableHls {
+            get {
+                return ((bool)(this["EnableHls"]));
+            }
+            set {
+                this["EnableHls"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("6000")]
+        public int HlsSegmentDuration {
+            get {
+                return ((int)(this["HlsSegmentDuration"]));
+            }
+            set {
+                this["HlsSegmentDuration"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("6")]
+        public int HlsPlaylistLength {
+            get {
+                return ((int)(this["HlsPlaylistLength"]));
+            }
+            set {
+                this["HlsPlaylistLength"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool UseNativeTransport {
+            get {
+                return ((bool)(this["UseNativeTransport"]));
+            }
+            set {
+                this["UseNativeTransport"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool EnableStatisticsEndpoint {
+            get {
+                return ((bool)(this["EnableStatisticsEndpoint"]));
+            }
+            set {
+                this["EnableStatisticsEndpoint"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("http://localhost:8081/statistics/")]
+        public string StatisticsPrefix {
+            get {
+                return ((string)(this["StatisticsPrefix"]));
+            }
+            set {
+                this["StatisticsPrefix"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("False")]
+        public bool EnableFragmentDump {
+            get {
+                return ((bool)(this["EnableFragmentDump"]));
+            }
+            set {
+                this["EnableFragmentDump"] = value;
+            }
+        }
+        
+        [global::System.Configuration.UserScopedSettingAttribute()]
+        [global::System.Diagnostics.DebuggerNonUserCodeAttribute()]
+        [global::System.Configuration.DefaultSettingValueAttribute("D:\\AVTest\\")]
+        public string FragmentSaveFolder {
+            get {
+                return ((string)(this["FragmentSaveFolder"]));
+            }
+            set {
+                this["FragmentSaveFolder"] = value;
+            }
+        }
     }
 }
@@ -0,0 +1,219 @@
+﻿namespace MComms_Transmuxer.RTMP
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.Output;
+
+    /// <summary>
+    /// Archive output, writes received media messages as they are to FLV file.
+    /// Write errors are logged and close the file, they never break the published stream
+    /// </summary>
+    public class FlvArchiveSink : IMediaSink
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// FLV file stream, null once writing has failed
+        /// </summary>
+        private FileStream flvStream = null;
+
+        /// <summary>
+        /// Whether stream has video
+        /// </summary>
+        private bool hasVideo = false;
+
+        /// <summary>
+        /// FLV first timestamp, in 100 ns units
+        /// </summary>
+        private long firstTimestamp = -1;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates FLV file and writes file header and metadata to it
+        /// </summary>
+        /// <param name="path">Path to FLV file</param>
+        /// <param name="metadataMessage">Stream metadata</param>
+        /// <param name="hasAudio">Whether metadata announces audio</param>
+        /// <param name="hasVideo">Whether metadata announces video</param>
+        public FlvArchiveSink(string path, RtmpMessageMetadata metadataMessage, bool hasAudio, bool hasVideo)
+        {
+            this.hasVideo = hasVideo;
+
+            PacketBuffer headerPacket = null;
+            PacketBuffer metadataPacket = null;
+
+            try
+            {
+                this.flvStream = new FileStream(path, FileMode.Create, FileAccess.Write, FileShare.Read);
+
+                FlvFileHeader fileHeader = new FlvFileHeader(hasAudio, hasVideo);
+                headerPacket = fileHeader.ToPacketBuffer();
+                metadataPacket = metadataMessage.ToFlvTag();
+
+                using (EndianBinaryWriter writer = new EndianBinaryWriter(this.flvStream, true))
+                {
+                    // write file header
+                    writer.Write(headerPacket.Buffer, 0, headerPacket.ActualBufferSize);
+                    // write first previous tag size 0
+                    writer.Write((int)0);
+                    // write metadata
+                    writer.Write(metadataPacket.Buffer, 0, metadataPacket.ActualBufferSize);
+                    // write previous tag size
+                    writer.Write(metadataPacket.ActualBufferSize);
+                }
+            }
+            catch
+            {
+                if (this.flvStream != null)
+                {
+                    this.flvStream.Dispose();
+                    this.flvStream = null;
+                }
+
+                throw;
+            }
+            finally
+            {
+                if (headerPacket != null)
+                {
+                    headerPacket.Release();
+                }
+
+                if (metadataPacket != null)
+                {
+                    metadataPacket.Release();
+                }
+            }
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Closes FLV file
+        /// </summary>
+        public void Dispose()
+        {
+            if (this.flvStream != null)
+            {
+                this.flvStream.Flush();
+                this.flvStream.Close();
+                this.flvStream.Dispose();
+                this.flvStream = null;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Notes whether stream has video, media is written only from the first video key frame then
+        /// </summary>
+        /// <param name="mediaType">Media type of the stream</param>
+        public void RegisterStream(MediaType mediaType)
+        {
+            if (mediaType.ContentType == MediaContentType.Video)
+            {
+                this.hasVideo = true;
+            }
+        }
+
+        /// <summary>
+        /// Writes media message as FLV tag
+        /// </summary>
+        /// <param name="sample">Media sample</param>
+        public void PushSample(MediaSample sample)
+        {
+            if (this.flvStream == null)
+            {
+                return;
+            }
+
+            // drop data till the first non-zero video frame
+            // or the first non-zero audio frame if there is no video data
+            if (this.firstTimestamp <= 0 && sample.PacketType != RtmpMediaPacketType.Configuration && sample.Timestamp > 0)
+            {
+                if (this.hasVideo ? sample.ContentType == MediaContentType.Video && sample.KeyFrame : sample.ContentType == MediaContentType.Audio)
+                {
+                    this.firstTimestamp = sample.Timestamp;
+                }
+            }
+
+            if (this.firstTimestamp <= 0 && sample.PacketType != RtmpMediaPacketType.Configuration)
+            {
+                return;
+            }
+
+            PacketBuffer packet = null;
+
+            try
+            {
+                FlvTagHeader hdr = new FlvTagHeader
+                {
+                    TagType = sample.ContentType == MediaContentType.Video ? RtmpMessageType.Video : RtmpMessageType.Audio,
+                    DataSize = (uint)sample.MediaData.ActualBufferSize,
+                    StreamId = 0,
+                    Timestamp = 0
+                };
+
+                if (sample.PacketType != RtmpMediaPacketType.Configuration)
+                {
+                    hdr.Timestamp = (uint)((sample.Timestamp - this.firstTimestamp) / 10000);
+                }
+
+                packet = hdr.ToPacketBuffer();
+
+                using (EndianBinaryWriter writer = new EndianBinaryWriter(this.flvStream, true))
+                {
+                    // write tag header
+                    writer.Write(packet.Buffer, 0, packet.ActualBufferSize);
+                    // write media data
+                    writer.Write(sample.MediaData.Buffer, 0, sample.MediaData.ActualBufferSize);
+                    // write previous tag size
+                    writer.Write((uint)(hdr.HeaderSize + sample.MediaData.ActualBufferSize));
+                }
+            }
+            catch (Exception ex)
+            {
+                this.flvStream.Dispose();
+                this.flvStream = null;
+
+                Global.Log.ErrorFormat("FLV write failed: {0}", ex.ToString());
+            }
+            finally
+            {
+                if (packet != null)
+                {
+                    packet.Release();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Nothing to adjust, FLV timestamps are relative to the first written frame
+        /// </summary>
+        /// <param name="gap">Absolute time change, in 100 ns units</param>
+        public void AdjustAbsoluteTime(long gap)
+        {
+        }
+
+        /// <summary>
+        /// Nothing to flush, file stream is flushed when closed
+        /// </summary>
+        public void Flush()
+        {
+        }
+
+        #endregion
+    }
+}
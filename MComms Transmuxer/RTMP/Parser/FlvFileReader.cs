@@ -0,0 +1,210 @@
+﻿namespace MComms_Transmuxer.RTMP
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.IO.MemoryMappedFiles;
+    using System.Linq;
+    using System.Runtime.InteropServices;
+    using System.Text;
+
+    /// <summary>
+    /// Walks tags of memory mapped FLV file. Tag bodies aren't copied, they are returned as pointers
+    /// to the mapped file which stay valid until the reader is disposed
+    /// </summary>
+    public class FlvFileReader : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// FLV file header size including the first previous tag size
+        /// </summary>
+        private const int FileHeaderSize = 13;
+
+        /// <summary>
+        /// FLV tag header size
+        /// </summary>
+        private const int TagHeaderSize = 11;
+
+        /// <summary>
+        /// Size of the previous tag size field following every tag
+        /// </summary>
+        private const int TagTrailerSize = 4;
+
+        /// <summary>
+        /// Mapped file
+        /// </summary>
+        private MemoryMappedFile file = null;
+
+        /// <summary>
+        /// View of the whole file
+        /// </summary>
+        private MemoryMappedViewAccessor view = null;
+
+        /// <summary>
+        /// Whether the view handle is referenced for data pointer
+        /// </summary>
+        private bool referenced = false;
+
+        /// <summary>
+        /// Start of the mapped file
+        /// </summary>
+        private IntPtr data = IntPtr.Zero;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Maps FLV file and checks its header
+        /// </summary>
+        /// <param name="path">FLV file path</param>
+        /// <exception cref="InvalidDataException">Not an FLV file</exception>
+        public FlvFileReader(string path)
+        {
+            this.Path = path;
+            this.Length = new FileInfo(path).Length;
+
+            // empty files can't be mapped
+            if (this.Length < FlvFileReader.FileHeaderSize)
+            {
+                throw new InvalidDataException(string.Format("{0} is not an FLV file", path));
+            }
+
+            try
+            {
+                this.file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+                this.view = this.file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.Read);
+                this.view.SafeMemoryMappedViewHandle.DangerousAddRef(ref this.referenced);
+                this.data = this.view.SafeMemoryMappedViewHandle.DangerousGetHandle();
+
+                if (this.ReadUInt(0, 3) != 0x464C56)
+                {
+                    throw new InvalidDataException(string.Format("{0} is not an FLV file", path));
+                }
+
+                // header is followed by the first previous tag size
+                this.Position = this.ReadUInt(5, 4) + FlvFileReader.TagTrailerSize;
+            }
+            catch
+            {
+                this.Dispose();
+                throw;
+            }
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets FLV file path
+        /// </summary>
+        public string Path { get; private set; }
+
+        /// <summary>
+        /// Gets file length
+        /// </summary>
+        public long Length { get; private set; }
+
+        /// <summary>
+        /// Gets position of the next tag
+        /// </summary>
+        public long Position { get; private set; }
+
+        /// <summary>
+        /// Gets whether the tag at Position doesn't fit the file
+        /// </summary>
+        public bool Truncated { get; private set; }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Unmaps the file, pointers to tag bodies are no longer valid
+        /// </summary>
+        public void Dispose()
+        {
+            this.data = IntPtr.Zero;
+
+            if (this.referenced)
+            {
+                this.view.SafeMemoryMappedViewHandle.DangerousRelease();
+                this.referenced = false;
+            }
+
+            if (this.view != null)
+            {
+                this.view.Dispose();
+                this.view = null;
+            }
+
+            if (this.file != null)
+            {
+                this.file.Dispose();
+                this.file = null;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Reads next tag
+        /// </summary>
+        /// <param name="header">Tag header to fill in</param>
+        /// <param name="body">Tag body in the mapped file</param>
+        /// <returns>False at the end of file or if the next tag is truncated</returns>
+        public bool ReadTag(FlvTagHeader header, out IntPtr body)
+        {
+            body = IntPtr.Zero;
+
+            if (this.Truncated || this.Position + FlvFileReader.TagHeaderSize > this.Length)
+            {
+                return false;
+            }
+
+            long payload = this.Position + FlvFileReader.TagHeaderSize;
+            uint dataSize = (uint)this.ReadUInt(this.Position + 1, 3);
+            if (payload + dataSize > this.Length)
+            {
+                this.Truncated = true;
+                return false;
+            }
+
+            header.TagType = (RtmpMessageType)(this.ReadUInt(this.Position, 1) & 0x1F);
+            header.DataSize = dataSize;
+            header.Timestamp = (uint)(this.ReadUInt(this.Position + 4, 3) | (this.ReadUInt(this.Position + 7, 1) << 24));
+            header.StreamId = (int)this.ReadUInt(this.Position + 8, 3);
+
+            body = new IntPtr(this.data.ToInt64() + payload);
+            this.Position = payload + dataSize + FlvFileReader.TagTrailerSize;
+            return true;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Reads big endian unsigned integer from mapped file
+        /// </summary>
+        /// <param name="position">Position of the integer</param>
+        /// <param name="size">Integer size in bytes</param>
+        /// <returns>Read value</returns>
+        private long ReadUInt(long position, int size)
+        {
+            long value = 0;
+            for (int i = 0; i < size; ++i)
+            {
+                value = (value << 8) | Marshal.ReadByte(new IntPtr(this.data.ToInt64() + position + i));
+            }
+
+            return value;
+        }
+
+        #endregion
+    }
+}
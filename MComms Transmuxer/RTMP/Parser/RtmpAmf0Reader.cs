@@ -0,0 +1,675 @@
+﻿namespace MComms_Transmuxer.RTMP
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    /// <summary>
+    /// AMF0 decoder reading values straight from a byte buffer holding the whole message body.
+    /// Values are returned in the same form as before (string, double, bool, RtmpAmfNull, RtmpAmfObject).
+    /// Property names and short strings are interned, so repeated keys like "app" or "tcUrl" don't
+    /// allocate on every message. AMF3 values switched to by the avmplus marker are decoded as well,
+    /// objects and arrays into RtmpAmfObject like AMF0 ones (dense array elements are keyed by their
+    /// index); byte arrays, vectors, dictionaries and externalizable objects are not supported.
+    /// </summary>
+    public class RtmpAmf0Reader
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Strings up to this length are interned
+        /// </summary>
+        private const int MaxInternedLength = 32;
+
+        /// <summary>
+        /// Maximum number of interned strings, keeps the table bounded against hostile clients
+        /// </summary>
+        private const int MaxInternedCount = 4096;
+
+        /// <summary>
+        /// Maximum nesting level of AMF objects
+        /// </summary>
+        private const int MaxDepth = 32;
+
+        /// <summary>
+        /// Interned strings by hash of their UTF-8 bytes
+        /// </summary>
+        private static ConcurrentDictionary<int, string[]> internedStrings = new ConcurrentDictionary<int, string[]>();
+
+        /// <summary>
+        /// Number of interned strings
+        /// </summary>
+        private static int internedCount = 0;
+
+        /// <summary>
+        /// Buffer with AMF data
+        /// </summary>
+        private byte[] data = null;
+
+        /// <summary>
+        /// Current read position
+        /// </summary>
+        private int position = 0;
+
+        /// <summary>
+        /// End of AMF data
+        /// </summary>
+        private int end = 0;
+
+        /// <summary>
+        /// AMF3 string reference table, created on first AMF3 string
+        /// </summary>
+        private List<string> amf3Strings = null;
+
+        /// <summary>
+        /// AMF3 object reference table (objects, arrays, dates and XML), created on first AMF3 object
+        /// </summary>
+        private List<object> amf3Objects = null;
+
+        /// <summary>
+        /// AMF3 traits reference table, created on first AMF3 object
+        /// </summary>
+        private List<Amf3Traits> amf3Traits = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of RtmpAmf0Reader
+        /// </summary>
+        /// <param name="data">Buffer with AMF data</param>
+        /// <param name="offset">Offset of the data</param>
+        /// <param name="count">Data size</param>
+        public RtmpAmf0Reader(byte[] data, int offset, int count)
+        {
+            this.data = data;
+            this.position = offset;
+            this.end = offset + count;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Reads all top level values till the end of data
+        /// </summary>
+        /// <returns>List of values</returns>
+        public List<object> ReadAll()
+        {
+            List<object> values = new List<object>();
+
+            while (this.position < this.end)
+            {
+                values.Add(this.ReadValue(0));
+            }
+
+            return values;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Reads one value
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        /// <returns>Value</returns>
+        private object ReadValue(int depth)
+        {
+            RtmpAmf0Types type = (RtmpAmf0Types)this.ReadByte();
+
+            switch (type)
+            {
+                case RtmpAmf0Types.Number:
+                    return this.ReadDouble();
+
+                case RtmpAmf0Types.Boolean:
+                    return this.ReadByte() != 0;
+
+                case RtmpAmf0Types.String:
+                    return this.ReadString(this.ReadUInt16());
+
+                case RtmpAmf0Types.LongString:
+                    return this.ReadString(this.ReadInt32());
+
+                case RtmpAmf0Types.Null:
+                case RtmpAmf0Types.Undefined:
+                    return new RtmpAmfNull();
+
+                case RtmpAmf0Types.Object:
+                    return this.ReadObject(depth + 1);
+
+                case RtmpAmf0Types.Array:
+                    // associative array count is informational only
+                    this.ReadInt32();
+                    return this.ReadObject(depth + 1);
+
+                case RtmpAmf0Types.AvmPlus:
+                    return this.ReadAmf3Value(depth);
+
+                default:
+                    throw new ArgumentOutOfRangeException("type", string.Format("Unsupported AMF0 type {0}", type));
+            }
+        }
+
+        /// <summary>
+        /// Reads object properties till object end marker
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        /// <returns>Object</returns>
+        private RtmpAmfObject ReadObject(int depth)
+        {
+            this.CheckDepth(depth);
+
+            RtmpAmfObject obj = new RtmpAmfObject();
+
+            while (true)
+            {
+                string key = this.ReadString(this.ReadUInt16());
+
+                if (key.Length == 0 && this.position < this.end && this.data[this.position] == (byte)RtmpAmf0Types.ObjectEnd)
+                {
+                    this.position++;
+                    return obj;
+                }
+
+                RtmpAmf0Reader.SetProperty(obj, key, this.ReadValue(depth));
+            }
+        }
+
+        /// <summary>
+        /// Stores property value in the dictionary of its type
+        /// </summary>
+        /// <param name="obj">Object</param>
+        /// <param name="key">Property name</param>
+        /// <param name="value">Property value</param>
+        private static void SetProperty(RtmpAmfObject obj, string key, object value)
+        {
+            if (value is double)
+            {
+                obj.Numbers[key] = (double)value;
+            }
+            else if (value is string)
+            {
+                obj.Strings[key] = (string)value;
+            }
+            else if (value is bool)
+            {
+                obj.Booleans[key] = (bool)value;
+            }
+            else if (value is RtmpAmfObject)
+            {
+                obj.Objects[key] = (RtmpAmfObject)value;
+            }
+            else
+            {
+                obj.Nulls++;
+            }
+        }
+
+        /// <summary>
+        /// Reads one AMF3 value
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        /// <returns>Value</returns>
+        private object ReadAmf3Value(int depth)
+        {
+            byte type = this.ReadByte();
+
+            switch (type)
+            {
+                case 0x00: // undefined
+                case 0x01: // null
+                    return new RtmpAmfNull();
+
+                case 0x02: // false
+                    return false;
+
+                case 0x03: // true
+                    return true;
+
+                case 0x04: // integer, 29-bit signed
+                    {
+                        int value = this.ReadU29();
+                        if ((value & 0x10000000) != 0)
+                        {
+                            value -= 0x20000000;
+                        }
+
+                        return (double)value;
+                    }
+
+                case 0x05: // double
+                    return this.ReadDouble();
+
+                case 0x06: // string
+                    return this.ReadAmf3String();
+
+                case 0x07: // XML document
+                case 0x0B: // XML
+                    {
+                        int reference = this.ReadU29();
+                        if ((reference & 1) == 0)
+                        {
+                            return this.GetAmf3Object(reference >> 1);
+                        }
+
+                        string value = this.ReadString(reference >> 1);
+                        this.AddAmf3Object(value);
+                        return value;
+                    }
+
+                case 0x08: // date, milliseconds since epoch
+                    {
+                        int reference = this.ReadU29();
+                        if ((reference & 1) == 0)
+                        {
+                            return this.GetAmf3Object(reference >> 1);
+                        }
+
+                        double value = this.ReadDouble();
+                        this.AddAmf3Object(value);
+                        return value;
+                    }
+
+                case 0x09: // array
+                    return this.ReadAmf3Array(depth + 1);
+
+                case 0x0A: // object
+                    return this.ReadAmf3Object(depth + 1);
+
+                default:
+                    throw new ArgumentOutOfRangeException("type", string.Format("Unsupported AMF3 type {0}", type));
+            }
+        }
+
+        /// <summary>
+        /// Reads AMF3 string or string reference
+        /// </summary>
+        /// <returns>String</returns>
+        private string ReadAmf3String()
+        {
+            int reference = this.ReadU29();
+            if (this.amf3Strings == null)
+            {
+                this.amf3Strings = new List<string>();
+            }
+
+            if ((reference & 1) == 0)
+            {
+                if ((reference >> 1) >= this.amf3Strings.Count)
+                {
+                    throw new ArgumentOutOfRangeException("reference", "Invalid AMF3 string reference");
+                }
+
+                return this.amf3Strings[reference >> 1];
+            }
+
+            string value = this.ReadString(reference >> 1);
+            if (value.Length > 0)
+            {
+                this.amf3Strings.Add(value);
+            }
+
+            return value;
+        }
+
+        /// <summary>
+        /// Reads AMF3 array, associative part first, dense part is keyed by element index
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        /// <returns>Array as object</returns>
+        private object ReadAmf3Array(int depth)
+        {
+            int reference = this.ReadU29();
+            if ((reference & 1) == 0)
+            {
+                return this.GetAmf3Object(reference >> 1);
+            }
+
+            this.CheckDepth(depth);
+
+            RtmpAmfObject array = new RtmpAmfObject();
+            this.AddAmf3Object(array);
+
+            while (true)
+            {
+                string key = this.ReadAmf3String();
+                if (key.Length == 0)
+                {
+                    break;
+                }
+
+                RtmpAmf0Reader.SetProperty(array, key, this.ReadAmf3Value(depth));
+            }
+
+            int count = reference >> 1;
+            for (int i = 0; i < count; ++i)
+            {
+                RtmpAmf0Reader.SetProperty(array, i.ToString(System.Globalization.CultureInfo.InvariantCulture), this.ReadAmf3Value(depth));
+            }
+
+            return array;
+        }
+
+        /// <summary>
+        /// Reads AMF3 object, sealed members followed by dynamic ones
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        /// <returns>Object</returns>
+        private object ReadAmf3Object(int depth)
+        {
+            int reference = this.ReadU29();
+            if ((reference & 1) == 0)
+            {
+                return this.GetAmf3Object(reference >> 1);
+            }
+
+            if (this.amf3Traits == null)
+            {
+                this.amf3Traits = new List<Amf3Traits>();
+            }
+
+            Amf3Traits traits;
+            if ((reference & 2) == 0)
+            {
+                if ((reference >> 2) >= this.amf3Traits.Count)
+                {
+                    throw new ArgumentOutOfRangeException("reference", "Invalid AMF3 traits reference");
+                }
+
+                traits = this.amf3Traits[reference >> 2];
+            }
+            else if ((reference & 4) != 0)
+            {
+                throw new ArgumentOutOfRangeException("reference", "Externalizable AMF3 objects are not supported");
+            }
+            else
+            {
+                traits = new Amf3Traits();
+                traits.IsDynamic = (reference & 8) != 0;
+                this.ReadAmf3String(); // class name
+
+                // each member name takes at least one byte, a hostile count fails here
+                int count = reference >> 4;
+                this.Require(count);
+                traits.Members = new string[count];
+                for (int i = 0; i < count; ++i)
+                {
+                    traits.Members[i] = this.ReadAmf3String();
+                }
+
+                this.amf3Traits.Add(traits);
+            }
+
+            this.CheckDepth(depth);
+
+            RtmpAmfObject obj = new RtmpAmfObject();
+            this.AddAmf3Object(obj);
+
+            foreach (string member in traits.Members)
+            {
+                RtmpAmf0Reader.SetProperty(obj, member, this.ReadAmf3Value(depth));
+            }
+
+            if (traits.IsDynamic)
+            {
+                while (true)
+                {
+                    string key = this.ReadAmf3String();
+                    if (key.Length == 0)
+                    {
+                        break;
+                    }
+
+                    RtmpAmf0Reader.SetProperty(obj, key, this.ReadAmf3Value(depth));
+                }
+            }
+
+            return obj;
+        }
+
+        /// <summary>
+        /// Adds AMF3 complex value to the object reference table
+        /// </summary>
+        /// <param name="value">Value</param>
+        private void AddAmf3Object(object value)
+        {
+            if (this.amf3Objects == null)
+            {
+                this.amf3Objects = new List<object>();
+            }
+
+            this.amf3Objects.Add(value);
+        }
+
+        /// <summary>
+        /// Gets AMF3 complex value from the object reference table
+        /// </summary>
+        /// <param name="index">Reference index</param>
+        /// <returns>Value</returns>
+        private object GetAmf3Object(int index)
+        {
+            if (this.amf3Objects == null || index >= this.amf3Objects.Count)
+            {
+                throw new ArgumentOutOfRangeException("index", "Invalid AMF3 object reference");
+            }
+
+            return this.amf3Objects[index];
+        }
+
+        /// <summary>
+        /// Checks object nesting level
+        /// </summary>
+        /// <param name="depth">Object nesting level</param>
+        private void CheckDepth(int depth)
+        {
+            if (depth > RtmpAmf0Reader.MaxDepth)
+            {
+                throw new ArgumentOutOfRangeException("depth", "AMF objects are nested too deep");
+            }
+        }
+
+        /// <summary>
+        /// Ensures specified number of bytes is available
+        /// </summary>
+        /// <param name="count">Number of bytes</param>
+        private void Require(int count)
+        {
+            if (count < 0 || this.end - this.position < count)
+            {
+                throw new IndexOutOfRangeException("AMF data is truncated");
+            }
+        }
+
+        /// <summary>
+        /// Reads one byte
+        /// </summary>
+        /// <returns>Byte</returns>
+        private byte ReadByte()
+        {
+            this.Require(1);
+            return this.data[this.position++];
+        }
+
+        /// <summary>
+        /// Reads big endian 16-bit unsigned integer
+        /// </summary>
+        /// <returns>Integer</returns>
+        private int ReadUInt16()
+        {
+            this.Require(2);
+            int value = (this.data[this.position] << 8) | this.data[this.position + 1];
+            this.position += 2;
+            return value;
+        }
+
+        /// <summary>
+        /// Reads big endian 32-bit signed integer
+        /// </summary>
+        /// <returns>Integer</returns>
+        private int ReadInt32()
+        {
+            this.Require(4);
+            int value = (this.data[this.position] << 24) | (this.data[this.position + 1] << 16) | (this.data[this.position + 2] << 8) | this.data[this.position + 3];
+            this.position += 4;
+            return value;
+        }
+
+        /// <summary>
+        /// Reads big endian double
+        /// </summary>
+        /// <returns>Double</returns>
+        private double ReadDouble()
+        {
+            this.Require(8);
+            long value = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                value = (value << 8) | this.data[this.position + i];
+            }
+
+            this.position += 8;
+            return BitConverter.Int64BitsToDouble(value);
+        }
+
+        /// <summary>
+        /// Reads AMF3 variable length 29-bit unsigned integer
+        /// </summary>
+        /// <returns>Integer</returns>
+        private int ReadU29()
+        {
+            int value = 0;
+
+            for (int i = 0; i < 3; ++i)
+            {
+                byte b = this.ReadByte();
+                value = (value << 7) | (b & 0x7F);
+                if ((b & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+
+            return (value << 8) | this.ReadByte();
+        }
+
+        /// <summary>
+        /// Reads UTF-8 string of specified length
+        /// </summary>
+        /// <param name="length">String length in bytes</param>
+        /// <returns>String</returns>
+        private string ReadString(int length)
+        {
+            this.Require(length);
+
+            string value = (length <= RtmpAmf0Reader.MaxInternedLength) ?
+                RtmpAmf0Reader.Intern(this.data, this.position, length) :
+                Encoding.UTF8.GetString(this.data, this.position, length);
+
+            this.position += length;
+            return value;
+        }
+
+        /// <summary>
+        /// Returns interned string for the specified UTF-8 bytes
+        /// </summary>
+        /// <param name="data">Buffer</param>
+        /// <param name="offset">Offset of the string</param>
+        /// <param name="length">String length in bytes</param>
+        /// <returns>String</returns>
+        private static string Intern(byte[] data, int offset, int length)
+        {
+            if (length == 0)
+            {
+                return string.Empty;
+            }
+
+            int hash = length;
+            for (int i = 0; i < length; ++i)
+            {
+                hash = hash * 31 + data[offset + i];
+            }
+
+            string[] bucket = null;
+            if (RtmpAmf0Reader.internedStrings.TryGetValue(hash, out bucket))
+            {
+                foreach (string candidate in bucket)
+                {
+                    if (RtmpAmf0Reader.Matches(candidate, data, offset, length))
+                    {
+                        return candidate;
+                    }
+                }
+            }
+
+            string value = Encoding.UTF8.GetString(data, offset, length);
+
+            if (RtmpAmf0Reader.internedCount < RtmpAmf0Reader.MaxInternedCount)
+            {
+                string[] newBucket = (bucket == null) ? new string[] { value } : bucket.Concat(new string[] { value }).ToArray();
+                if ((bucket == null) ? RtmpAmf0Reader.internedStrings.TryAdd(hash, newBucket) : RtmpAmf0Reader.internedStrings.TryUpdate(hash, newBucket, bucket))
+                {
+                    System.Threading.Interlocked.Increment(ref RtmpAmf0Reader.internedCount);
+                }
+            }
+
+            return value;
+        }
+
+        /// <summary>
+        /// Checks whether the string is equal to the specified UTF-8 bytes
+        /// </summary>
+        /// <param name="value">String</param>
+        /// <param name="data">Buffer</param>
+        /// <param name="offset">Offset of the bytes</param>
+        /// <param name="length">Number of bytes</param>
+        /// <returns>True if equal</returns>
+        private static bool Matches(string value, byte[] data, int offset, int length)
+        {
+            if (value.Length == length)
+            {
+                // ASCII fast path
+                int i = 0;
+                while (i < length && value[i] < 0x80 && value[i] == data[offset + i])
+                {
+                    ++i;
+                }
+
+                if (i == length)
+                {
+                    return true;
+                }
+            }
+
+            return Encoding.UTF8.GetByteCount(value) == length && Encoding.UTF8.GetString(data, offset, length) == value;
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Traits of AMF3 objects, shared by reference between objects of the same class
+        /// </summary>
+        private class Amf3Traits
+        {
+            /// <summary>
+            /// Gets or sets whether objects have dynamic members after the sealed ones
+            /// </summary>
+            public bool IsDynamic { get; set; }
+
+            /// <summary>
+            /// Gets or sets names of the sealed members
+            /// </summary>
+            public string[] Members { get; set; }
+        }
+
+        #endregion
+    }
+}
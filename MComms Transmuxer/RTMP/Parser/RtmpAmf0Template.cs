@@ -0,0 +1,335 @@
+﻿namespace MComms_Transmuxer.RTMP
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Linq;
+    using System.Text;
+
+    /// <summary>
+    /// Precompiled AMF0 encoding of a command with fixed structure. Constant parts are encoded once
+    /// when the template is built, only slot values are encoded per message. Used for the replies
+    /// sent to every connecting encoder (_result, onStatus, onFCPublish).
+    /// </summary>
+    public class RtmpAmf0Template
+    {
+        #region Private types, constants and fields
+
+        /// <summary>
+        /// Template part type
+        /// </summary>
+        private enum PartType
+        {
+            /// <summary>
+            /// Precompiled bytes
+            /// </summary>
+            Constant,
+
+            /// <summary>
+            /// Number value
+            /// </summary>
+            Number,
+
+            /// <summary>
+            /// String value
+            /// </summary>
+            String,
+        }
+
+        /// <summary>
+        /// Template part
+        /// </summary>
+        private class Part
+        {
+            /// <summary>
+            /// Gets or sets part type
+            /// </summary>
+            public PartType Type { get; set; }
+
+            /// <summary>
+            /// Gets or sets precompiled bytes of constant part
+            /// </summary>
+            public byte[] Bytes { get; set; }
+        }
+
+        /// <summary>
+        /// Template parts
+        /// </summary>
+        private List<Part> parts = new List<Part>();
+
+        /// <summary>
+        /// Constant bytes added since the last slot
+        /// </summary>
+        private MemoryStream constant = new MemoryStream();
+
+        /// <summary>
+        /// Number of slots
+        /// </summary>
+        private int slotCount = 0;
+
+        /// <summary>
+        /// Whether template is compiled, it can't be changed anymore
+        /// </summary>
+        private bool compiled = false;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new template starting with the specified command name
+        /// </summary>
+        /// <param name="commandName">Command name</param>
+        public RtmpAmf0Template(string commandName)
+        {
+            this.CommandName = commandName;
+            this.String(commandName);
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets command name
+        /// </summary>
+        public string CommandName { get; private set; }
+
+        /// <summary>
+        /// Gets number of values to pass to Encode
+        /// </summary>
+        public int SlotCount
+        {
+            get
+            {
+                return this.slotCount;
+            }
+        }
+
+        #endregion
+
+        #region Building methods
+
+        /// <summary>
+        /// Adds constant number
+        /// </summary>
+        /// <param name="value">Number</param>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template Number(double value)
+        {
+            byte[] bytes = new byte[9];
+            RtmpAmf0Template.WriteNumber(bytes, 0, value);
+            this.constant.Write(bytes, 0, bytes.Length);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds constant string
+        /// </summary>
+        /// <param name="value">String</param>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template String(string value)
+        {
+            this.constant.WriteByte((byte)RtmpAmf0Types.String);
+            this.WriteConstantKey(value);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds null
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template Null()
+        {
+            this.constant.WriteByte((byte)RtmpAmf0Types.Null);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds object start
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template ObjectStart()
+        {
+            this.constant.WriteByte((byte)RtmpAmf0Types.Object);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds property name, must be followed by the property value
+        /// </summary>
+        /// <param name="key">Property name</param>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template Key(string key)
+        {
+            this.WriteConstantKey(key);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds object end
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template ObjectEnd()
+        {
+            this.constant.WriteByte(0x00);
+            this.constant.WriteByte(0x00);
+            this.constant.WriteByte((byte)RtmpAmf0Types.ObjectEnd);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds number slot, value is passed to Encode
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template NumberSlot()
+        {
+            this.AddSlot(PartType.Number);
+            return this;
+        }
+
+        /// <summary>
+        /// Adds string slot, value is passed to Encode
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template StringSlot()
+        {
+            this.AddSlot(PartType.String);
+            return this;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Finishes building. Compiled template can be shared by threads.
+        /// </summary>
+        /// <returns>This template</returns>
+        public RtmpAmf0Template Compile()
+        {
+            this.Seal();
+            this.constant = null;
+            this.compiled = true;
+            return this;
+        }
+
+        /// <summary>
+        /// Encodes the template with specified slot values to the buffer
+        /// </summary>
+        /// <param name="buffer">Buffer to write to</param>
+        /// <param name="offset">Buffer offset</param>
+        /// <param name="values">Slot values in template order, double for number slots and string for string slots</param>
+        /// <returns>Number of bytes written</returns>
+        public int Encode(byte[] buffer, int offset, object[] values)
+        {
+            if (!this.compiled)
+            {
+                throw new InvalidOperationException("Template is not compiled");
+            }
+
+            if (values.Length != this.slotCount)
+            {
+                throw new ArgumentException(string.Format("Template {0} expects {1} values", this.CommandName, this.slotCount), "values");
+            }
+
+            int position = offset;
+            int slot = 0;
+
+            foreach (Part part in this.parts)
+            {
+                switch (part.Type)
+                {
+                    case PartType.Constant:
+                        Array.Copy(part.Bytes, 0, buffer, position, part.Bytes.Length);
+                        position += part.Bytes.Length;
+                        break;
+
+                    case PartType.Number:
+                        position += RtmpAmf0Template.WriteNumber(buffer, position, Convert.ToDouble(values[slot++]));
+                        break;
+
+                    case PartType.String:
+                        {
+                            string value = (string)values[slot++];
+                            int length = Encoding.UTF8.GetBytes(value, 0, value.Length, buffer, position + 3);
+                            if (length > ushort.MaxValue)
+                            {
+                                throw new ArgumentOutOfRangeException("values", "AMF0 string is too long");
+                            }
+
+                            buffer[position] = (byte)RtmpAmf0Types.String;
+                            buffer[position + 1] = (byte)(length >> 8);
+                            buffer[position + 2] = (byte)length;
+                            position += length + 3;
+                            break;
+                        }
+                }
+            }
+
+            return position - offset;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Writes UTF-8 string with 16-bit length to constant bytes
+        /// </summary>
+        /// <param name="value">String</param>
+        private void WriteConstantKey(string value)
+        {
+            byte[] utf8 = Encoding.UTF8.GetBytes(value);
+            this.constant.WriteByte((byte)(utf8.Length >> 8));
+            this.constant.WriteByte((byte)utf8.Length);
+            this.constant.Write(utf8, 0, utf8.Length);
+        }
+
+        /// <summary>
+        /// Closes current constant part and adds slot
+        /// </summary>
+        /// <param name="type">Slot type</param>
+        private void AddSlot(PartType type)
+        {
+            this.Seal();
+            this.parts.Add(new Part { Type = type });
+            this.slotCount++;
+        }
+
+        /// <summary>
+        /// Moves constant bytes added since the last slot to the part list
+        /// </summary>
+        private void Seal()
+        {
+            if (this.constant.Length > 0)
+            {
+                this.parts.Add(new Part { Type = PartType.Constant, Bytes = this.constant.ToArray() });
+                this.constant.SetLength(0);
+            }
+        }
+
+        /// <summary>
+        /// Writes AMF0 number
+        /// </summary>
+        /// <param name="buffer">Buffer to write to</param>
+        /// <param name="offset">Buffer offset</param>
+        /// <param name="value">Number</param>
+        /// <returns>Number of bytes written</returns>
+        private static int WriteNumber(byte[] buffer, int offset, double value)
+        {
+            long bits = BitConverter.DoubleToInt64Bits(value);
+
+            buffer[offset] = (byte)RtmpAmf0Types.Number;
+            for (int i = 8; i > 0; --i)
+            {
+                buffer[offset + i] = (byte)bits;
+                bits >>= 8;
+            }
+
+            return 9;
+        }
+
+        #endregion
+    }
+}
@@ -36,6 +36,11 @@
         /// </summary>
         Null = 0x05,
 
+        /// <summary>
+        /// Undefined, decoded as null
+        /// </summary>
+        Undefined = 0x06,
+
         /// <summary>
         /// Array, contains the list of values of the same type
         /// </summary>
@@ -45,5 +50,15 @@
         /// Object end indicator
         /// </summary>
         ObjectEnd = 0x09,
+
+        /// <summary>
+        /// String longer than 65535 bytes
+        /// </summary>
+        LongString = 0x0C,
+
+        /// <summary>
+        /// Switch to AMF3 for the next value
+        /// </summary>
+        AvmPlus = 0x11,
     }
 }
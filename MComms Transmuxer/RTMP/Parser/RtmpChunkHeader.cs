@@ -13,6 +13,15 @@
     /// </summary>
     public class RtmpChunkHeader
     {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Maximum chunk header size: 3-byte basic header, 11-byte message header and extended timestamp
+        /// </summary>
+        private const int MaxHeaderSize = 18;
+
+        #endregion
+
         #region Constructor
 
         /// <summary>
@@ -119,21 +128,34 @@
         #region Public methods
 
         /// <summary>
-        /// Decodes chunk header from the specified stream
+        /// Decodes chunk header from the specified stream. Header is parsed directly from
+        /// the underlying buffer, stream position is moved past the header only if it's complete.
         /// </summary>
         /// <param name="dataStream">Stream to read data from</param>
         /// <returns>New chunk header if it was decoded, null otherwise</returns>
         public static RtmpChunkHeader Decode(PacketBufferStream dataStream)
         {
-            if (dataStream.Length < 1)
+            ArraySegment<byte> segment = dataStream.PeekSegment();
+            byte[] data = segment.Array;
+            int offset = segment.Offset;
+            int available = segment.Count;
+
+            if (available < RtmpChunkHeader.MaxHeaderSize && dataStream.Available > available)
+            {
+                // header may span several buffers
+                data = new byte[RtmpChunkHeader.MaxHeaderSize];
+                offset = 0;
+                available = dataStream.Peek(data, 0, data.Length);
+            }
+
+            if (available < 1)
             {
                 return null; // not enough data
             }
 
             int totalRead = 0;
 
-            byte byte0 = (byte)dataStream.ReadByte();
-            totalRead++;
+            byte byte0 = data[offset + totalRead++];
 
             RtmpChunkHeader hdr = new RtmpChunkHeader();
             hdr.Format = (byte)((byte0 & 0xC0) >> 6);
@@ -143,31 +165,25 @@
             {
                 case 0:
                     {
-                        if (dataStream.Length < 2)
+                        if (available < 2)
                         {
-                            dataStream.Seek(-totalRead, System.IO.SeekOrigin.Current);
                             return null; // not enough data
                         }
 
-                        byte byte1 = (byte)dataStream.ReadByte();
-                        totalRead++;
-                        hdr.ChunkStreamId = (uint)byte1 + 64;
+                        hdr.ChunkStreamId = (uint)data[offset + totalRead++] + 64;
 
                         break;
                     }
 
                 case 1:
                     {
-                        if (dataStream.Length < 3)
+                        if (available < 3)
                         {
-                            dataStream.Seek(-totalRead, System.IO.SeekOrigin.Current);
                             return null; // not enough data
                         }
 
-                        byte byte1 = (byte)dataStream.ReadByte();
-                        byte byte2 = (byte)dataStream.ReadByte();
+                        hdr.ChunkStreamId = 64 + (uint)data[offset + totalRead] + (uint)data[offset + totalRead + 1] * 256;
                         totalRead += 2;
-                        hdr.ChunkStreamId = 64 + (uint)byte1 + (uint)byte2 * 256;
 
                         break;
                     }
@@ -190,48 +206,50 @@
                     break;
             }
 
-            if (requiredSize > dataStream.Length - dataStream.Position)
+            if (requiredSize > available - totalRead)
             {
-                dataStream.Seek(-totalRead, System.IO.SeekOrigin.Current);
                 return null; // not enough data
             }
 
-            using (EndianBinaryReader reader = new EndianBinaryReader(dataStream, true))
+            if (hdr.Format <= 2)
             {
-                if (hdr.Format <= 2)
+                int timestamp = RtmpChunkHeader.ReadBigEndian(data, offset + totalRead, 3);
+                totalRead += 3;
+                if (hdr.Format <= 1)
                 {
-                    int timestamp = reader.ReadInt32(3);
-                    totalRead += 3;
-                    if (hdr.Format <= 1)
+                    hdr.MessageLength = RtmpChunkHeader.ReadBigEndian(data, offset + totalRead, 3);
+                    hdr.MessageType = (RtmpMessageType)data[offset + totalRead + 3];
+                    totalRead += 4;
+                    if (hdr.Format == 0)
                     {
-                        hdr.MessageLength = reader.ReadInt32(3);
-                        hdr.MessageType = (RtmpMessageType)reader.ReadByte();
+                        hdr.MessageStreamId = data[offset + totalRead] | (data[offset + totalRead + 1] << 8) | (data[offset + totalRead + 2] << 16) | (data[offset + totalRead + 3] << 24);
                         totalRead += 4;
-                        if (hdr.Format == 0)
-                        {
-                            hdr.MessageStreamId = reader.ReadInt32(4, Endianness.LittleEndian);
-                            totalRead += 4;
-                        }
                     }
+                }
 
-                    if (timestamp == 0xFFFFFF)
+                if (timestamp == 0xFFFFFF)
+                {
+                    // need to read 4-byte extended timestamp
+                    if (available - totalRead < 4)
                     {
-                        // need to read 4-byte extended timestamp
-                        timestamp = reader.ReadInt32();
-                        totalRead += 4;
+                        return null; // not enough data
                     }
 
-                    if (hdr.Format == 0)
-                    {
-                        hdr.Timestamp = timestamp;
-                    }
-                    else
-                    {
-                        hdr.TimestampDelta = timestamp;
-                    }
+                    timestamp = RtmpChunkHeader.ReadBigEndian(data, offset + totalRead, 4);
+                    totalRead += 4;
+                }
+
+                if (hdr.Format == 0)
+                {
+                    hdr.Timestamp = timestamp;
+                }
+                else
+                {
+                    hdr.TimestampDelta = timestamp;
                 }
             }
 
+            dataStream.Seek(totalRead, System.IO.SeekOrigin.Current);
             return hdr;
         }
 
@@ -313,5 +331,27 @@
         }
 
         #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Reads big endian integer from the byte buffer
+        /// </summary>
+        /// <param name="data">Byte buffer</param>
+        /// <param name="offset">Offset of the first byte</param>
+        /// <param name="byteCount">Number of bytes to read, up to 4</param>
+        /// <returns>Integer value</returns>
+        private static int ReadBigEndian(byte[] data, int offset, int byteCount)
+        {
+            int value = 0;
+            for (int i = 0; i < byteCount; ++i)
+            {
+                value = (value << 8) | data[offset + i];
+            }
+
+            return value;
+        }
+
+        #endregion
     }
 }
@@ -293,6 +293,7 @@
                     }
 
                 case RtmpMessageType.DataAmf0:
+                case RtmpMessageType.DataAmf3:
                     {
                         if (hdr.MessageStreamId == 0)
                         {
@@ -305,6 +306,7 @@
                     }
 
                 case RtmpMessageType.CommandAmf0:
+                case RtmpMessageType.CommandAmf3:
                     {
                         msg = RtmpMessage.DecodeAmf0(hdr, dataStream);
                         break;
@@ -345,138 +347,43 @@
         /// <returns>New RTMP message if parsing was successful, null otherwise</returns>
         private static RtmpMessage DecodeAmf0(RtmpChunkHeader hdr, PacketBufferStream dataStream)
         {
-            List<object> pars = new List<object>();
-            long startPosition = dataStream.Position;
+            List<object> pars = null;
 
-            using (EndianBinaryReader reader = new EndianBinaryReader(dataStream, true))
+            // AMF3 command and data messages start with format byte followed by AMF0 values
+            int formatSize = (hdr.MessageType == RtmpMessageType.CommandAmf3 || hdr.MessageType == RtmpMessageType.DataAmf3) ? 1 : 0;
+            if (hdr.MessageLength < formatSize)
             {
-                try
-                {
-                    Stack<RtmpAmfObject> objectStack = new Stack<RtmpAmfObject>();
+                Global.Log.ErrorFormat("Message {0} is too short: {1} bytes", hdr.MessageType, hdr.MessageLength);
+                return null;
+            }
 
-                    while (dataStream.Position < startPosition + hdr.MessageLength)
-                    {
-                        if (objectStack.Count != 0)
-                        {
-                            var count = reader.ReadUInt16();
-                            var propString = "";
-                            for (var i = 0; i < count; i++)
-                            {
-                                propString += (char)reader.ReadByte();
-                            }
-                            objectStack.Peek().CurrentProperty = propString;
-                        }
+            // parse the body in place if it's in one buffer
+            ArraySegment<byte> segment = dataStream.PeekSegment();
+            byte[] data = segment.Array;
+            int offset = segment.Offset;
 
-                        var type = (RtmpAmf0Types)reader.ReadByte();
+            if (segment.Count < hdr.MessageLength)
+            {
+                data = new byte[hdr.MessageLength];
+                offset = 0;
+                dataStream.Peek(data, 0, hdr.MessageLength);
+            }
 
-                        switch (type)
-                        {
-                            case RtmpAmf0Types.Number:
-                                {
-                                    double value = reader.ReadDouble();
-                                    if (objectStack.Count != 0)
-                                    {
-                                        objectStack.Peek().Numbers.Add(objectStack.Peek().CurrentProperty, value);
-                                    }
-                                    else
-                                    {
-                                        pars.Add(value);
-                                    }
-
-                                    break;
-                                }
-
-                            case RtmpAmf0Types.Boolean:
-                                {
-                                    bool value = reader.ReadBoolean();
-                                    if (objectStack.Count != 0)
-                                    {
-                                        objectStack.Peek().Booleans.Add(objectStack.Peek().CurrentProperty, value);
-                                    }
-                                    else
-                                    {
-                                        pars.Add(value);
-                                    }
-
-                                    break;
-                                }
-
-                            case RtmpAmf0Types.String:
-                                {
-                                    ushort count = reader.ReadUInt16();
-                                    byte[] utf8 = reader.ReadBytes(count);
-                                    string pushString = System.Text.Encoding.UTF8.GetString(utf8);
-
-                                    if (objectStack.Count != 0)
-                                    {
-                                        objectStack.Peek().Strings.Add(objectStack.Peek().CurrentProperty, pushString);
-                                    }
-                                    else
-                                    {
-                                        pars.Add(pushString);
-                                    }
-
-                                    break;
-                                }
-
-                            case RtmpAmf0Types.Null:
-                                {
-                                    if (objectStack.Count != 0)
-                                    {
-                                        objectStack.Peek().Nulls++;
-                                    }
-                                    else
-                                    {
-                                        pars.Add(new RtmpAmfNull());
-                                    }
-
-                                    break;
-                                }
-
-                            case RtmpAmf0Types.Object:
-                            case RtmpAmf0Types.Array:
-                                {
-                                    if (type == RtmpAmf0Types.Array)
-                                    {
-                                        var arrayLength = reader.ReadInt32();
-                                    }
-
-                                    var objectAdd = new RtmpAmfObject();
-                                    objectStack.Push(objectAdd);
-
-                                    break;
-                                }
-
-                            case RtmpAmf0Types.ObjectEnd:
-                                {
-                                    if (objectStack.Count == 1)
-                                    {
-                                        pars.Add(objectStack.Pop());
-                                    }
-                                    else if (objectStack.Count > 1)
-                                    {
-                                        var mostRecentObject = objectStack.Pop();
-                                        objectStack.Peek().Objects.Add(objectStack.Peek().CurrentProperty, mostRecentObject);
-                                    }
-
-                                    break;
-                                }
-
-                            default:
-                                throw new ArgumentOutOfRangeException();
-                        }
-                    }
-                }
-                catch (Exception ex)
-                {
-                    Global.Log.ErrorFormat("AMF0 parser failed: {0}", ex.ToString());
-                    return null;
-                }
+            dataStream.Seek(hdr.MessageLength, System.IO.SeekOrigin.Current);
+
+            try
+            {
+                pars = new RtmpAmf0Reader(data, offset + formatSize, hdr.MessageLength - formatSize).ReadAll();
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("AMF0 parser failed: {0}", ex.ToString());
+                return null;
             }
 
             RtmpMessage msg = null;
 
-            if (hdr.MessageType == RtmpMessageType.CommandAmf0)
+            if (hdr.MessageType == RtmpMessageType.CommandAmf0 || hdr.MessageType == RtmpMessageType.CommandAmf3)
             {
                 if (pars.Count < 2 || pars[0].GetType() != typeof(string) || pars[1].GetType() != typeof(double))
                 {
@@ -487,7 +394,7 @@
 
                 msg = new RtmpMessageCommand((string)pars[0], (int)(double)pars[1], pars.GetRange(2, pars.Count - 2));
             }
-            else if (hdr.MessageType == RtmpMessageType.DataAmf0)
+            else if (hdr.MessageType == RtmpMessageType.DataAmf0 || hdr.MessageType == RtmpMessageType.DataAmf3)
             {
                 if (pars.Count < 2 || pars[0].GetType() != typeof(string))
                 {
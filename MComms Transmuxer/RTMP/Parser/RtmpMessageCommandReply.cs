@@ -0,0 +1,137 @@
+﻿namespace MComms_Transmuxer.RTMP
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// RTMP message "AMF0 encoded command" generated from precompiled template.
+    /// Used for the fixed replies of connect, createStream, FCPublish and publish commands.
+    /// </summary>
+    public class RtmpMessageCommandReply : RtmpMessage
+    {
+        #region Templates
+
+        /// <summary>
+        /// Reply to successful connect, values: client id
+        /// </summary>
+        public static readonly RtmpAmf0Template ConnectResult = new RtmpAmf0Template("_result")
+            .Number(1)
+            .ObjectStart()
+                .Key("fmsVer").String("FMS/3,0,1,123") // NOTE: value taken from FFmpeg implementation
+                .Key("capabilities").Number(31) // NOTE: value taken from FFmpeg implementation
+            .ObjectEnd()
+            .ObjectStart()
+                .Key("level").String("status")
+                .Key("code").String("NetConnection.Connect.Success")
+                .Key("description").String("Connection succeeded.")
+                .Key("clientId").NumberSlot()
+                .Key("objectEncoding").Number(0) // AMF0
+            .ObjectEnd()
+            .Compile();
+
+        /// <summary>
+        /// Reply to createStream, values: transaction id, message stream id
+        /// </summary>
+        public static readonly RtmpAmf0Template CreateStreamResult = new RtmpAmf0Template("_result")
+            .NumberSlot()
+            .Null()
+            .NumberSlot()
+            .Compile();
+
+        /// <summary>
+        /// Reply to FCPublish, values: description, client id
+        /// </summary>
+        public static readonly RtmpAmf0Template OnFCPublish = new RtmpAmf0Template("onFCPublish")
+            .Number(0)
+            .Null()
+            .ObjectStart()
+                .Key("level").String("status")
+                .Key("code").String("NetStream.Publish.Start")
+                .Key("description").StringSlot()
+                .Key("clientId").NumberSlot()
+            .ObjectEnd()
+            .Compile();
+
+        /// <summary>
+        /// Reply to successful publish, values: description, client id
+        /// </summary>
+        public static readonly RtmpAmf0Template PublishStart = new RtmpAmf0Template("onStatus")
+            .Number(0)
+            .Null()
+            .ObjectStart()
+                .Key("level").String("status")
+                .Key("code").String("NetStream.Publish.Start")
+                .Key("description").StringSlot()
+                .Key("clientId").NumberSlot()
+            .ObjectEnd()
+            .Compile();
+
+        #endregion
+
+        #region Private fields
+
+        /// <summary>
+        /// Template
+        /// </summary>
+        private RtmpAmf0Template template = null;
+
+        /// <summary>
+        /// Template slot values
+        /// </summary>
+        private object[] values = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of RtmpMessageCommandReply
+        /// </summary>
+        /// <param name="template">Precompiled template</param>
+        /// <param name="values">Template slot values</param>
+        public RtmpMessageCommandReply(RtmpAmf0Template template, params object[] values)
+        {
+            this.OrigMessageType = RtmpMessageType.CommandAmf0;
+            this.MessageType = (template.CommandName == "_result") ? RtmpIntMessageType.CommandResult :
+                (template.CommandName == "onStatus") ? RtmpIntMessageType.CommandNetStreamOnStatus :
+                RtmpIntMessageType.CommandNetConnectionOnFCPublish;
+            this.template = template;
+            this.values = values;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Converts current object to RTMP chunk and returns packet buffer containing it
+        /// </summary>
+        /// <returns>Packet buffer containing the converted RTMP chunk</returns>
+        public override PacketBuffer ToRtmpChunk()
+        {
+            RtmpChunkHeader hdr = new RtmpChunkHeader
+            {
+                Format = 0,
+                Timestamp = this.Timestamp,
+                ChunkStreamId = this.ChunkStreamId,
+                MessageStreamId = this.MessageStreamId,
+                MessageType = RtmpMessageType.CommandAmf0
+            };
+
+            int hdrSize = hdr.HeaderSize;
+
+            PacketBuffer packet = Global.Allocator.LockBuffer();
+            hdr.MessageLength = this.template.Encode(packet.Buffer, hdrSize, this.values);
+            hdr.ToPacketBuffer(packet);
+            packet.ActualBufferSize = hdrSize + hdr.MessageLength;
+
+            return packet;
+        }
+
+        #endregion
+    }
+}
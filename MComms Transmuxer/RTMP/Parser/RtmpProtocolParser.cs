@@ -3,6 +3,7 @@
     using System;
     using System.Collections.Generic;
     using System.Linq;
+    using System.Runtime.InteropServices;
     using System.Text;
     using System.Threading.Tasks;
 
@@ -13,7 +14,7 @@
     /// Decoder receives PacketBuffer and outputs parsed RtmpMessage objects.
     /// Encoder receives RtmpMessage objects and generates PacketBuffer with ready to send data.
     /// </summary>
-    public class RtmpProtocolParser
+    public class RtmpProtocolParser : IDisposable
     {
         #region Private constants and fields
 
@@ -48,6 +49,51 @@
         /// </summary>
         private List<PacketBuffer> outputQueue = new List<PacketBuffer>();
 
+        /// <summary>
+        /// Whether chunks are parsed by the native demuxer once handshake is finished
+        /// </summary>
+        private bool nativeDemux = Properties.Settings.Default.EnableNativeIngest;
+
+        /// <summary>
+        /// Native chunk demuxer id, -1 till handshake is finished
+        /// </summary>
+        private int demuxerId = -1;
+
+        /// <summary>
+        /// Received packets waiting to be passed to the native demuxer
+        /// </summary>
+        private Queue<PacketBuffer> demuxInput = new Queue<PacketBuffer>();
+
+        /// <summary>
+        /// Packet currently parsed by the native demuxer, pinned till its messages are processed
+        /// </summary>
+        private PacketBuffer demuxPacket = null;
+
+        /// <summary>
+        /// Pinning handle of the current packet
+        /// </summary>
+        private GCHandle demuxPacketHandle;
+
+        /// <summary>
+        /// Number of bytes of the current packet passed to the native demuxer
+        /// </summary>
+        private int demuxPacketOffset = 0;
+
+        /// <summary>
+        /// Messages returned by the last native demuxer call, payloads are valid till the next call
+        /// </summary>
+        private MCSSF_RTMP_MESSAGE[] demuxMessages = new MCSSF_RTMP_MESSAGE[Global.RtmpMaxDemuxedMessages];
+
+        /// <summary>
+        /// Number of messages returned by the last native demuxer call
+        /// </summary>
+        private int demuxMessageCount = 0;
+
+        /// <summary>
+        /// Index of the next message to process
+        /// </summary>
+        private int demuxMessageIndex = 0;
+
 #if DEBUG_RTMP_CORRUPTION
         // used to resolve data synchronization issues
         private List<PacketBuffer> history = new List<PacketBuffer>();
@@ -71,6 +117,31 @@
 
         #endregion
 
+        #region IDisposable
+
+        /// <summary>
+        /// Releases native demuxer and packets waiting for it
+        /// </summary>
+        public void Dispose()
+        {
+            this.ReleaseDemuxPacket();
+
+            while (this.demuxInput.Count > 0)
+            {
+                this.demuxInput.Dequeue().Release();
+            }
+
+            if (this.demuxerId >= 0)
+            {
+                RtmpProtocolParser.MCSSF_DestroyChunkDemuxer(this.demuxerId);
+                this.demuxerId = -1;
+            }
+
+            this.dataStream.Dispose();
+        }
+
+        #endregion
+
         #region Public properties and methods
 
         /// <summary>
@@ -81,6 +152,13 @@
         /// </summary>
         public RtmpSessionState State { get; set; }
 
+        /// <summary>
+        /// Gets or sets handler of media messages demuxed by the native demuxer. It's called with
+        /// consecutive audio/video messages and returns how many of them it has taken, the rest
+        /// is decoded into RtmpMessage objects as usual
+        /// </summary>
+        public Func<MCSSF_RTMP_MESSAGE[], int, int, int> MediaHandler { get; set; }
+
         /// <summary>
         /// Current chunk size. Takes RTMP standard chunk size as default, can be adjusted during a session.
         /// </summary>
@@ -111,6 +189,11 @@
         /// </returns>
         public RtmpMessage Decode(PacketBuffer dataPacket)
         {
+            if (this.nativeDemux && this.State == RtmpSessionState.Receiving)
+            {
+                return this.DecodeNative(dataPacket);
+            }
+
             RtmpMessage msg = null;
 
             if (dataPacket != null)
@@ -244,21 +327,46 @@
         }
 
         /// <summary>
-        /// Gets next packet buffer from the output queue
+        /// Gets next packet buffer from the output queue. Consecutive queued packets fitting
+        /// into one transport buffer are gathered into a single packet, so replies produced
+        /// during one processing run (e.g. connect/publish handshake bursts) go out in one write.
         /// </summary>
         /// <returns>Next packet buffer from the output queue</returns>
         public PacketBuffer GetSendPacket()
         {
-            if (this.outputQueue.Count > 0)
+            if (this.outputQueue.Count == 0)
+            {
+                return null;
+            }
+
+            int gatherCount = 1;
+            int gatherSize = this.outputQueue[0].ActualBufferSize;
+
+            while (gatherCount < this.outputQueue.Count && gatherSize + this.outputQueue[gatherCount].ActualBufferSize <= Global.Allocator.BufferSize)
+            {
+                gatherSize += this.outputQueue[gatherCount].ActualBufferSize;
+                ++gatherCount;
+            }
+
+            if (gatherCount == 1)
             {
                 PacketBuffer packet = this.outputQueue[0];
                 this.outputQueue.RemoveAt(0);
                 return packet;
             }
-            else
+
+            PacketBuffer gathered = Global.Allocator.LockBuffer();
+
+            for (int i = 0; i < gatherCount; ++i)
             {
-                return null;
+                PacketBuffer packet = this.outputQueue[i];
+                Array.Copy(packet.Buffer, 0, gathered.Buffer, gathered.ActualBufferSize, packet.ActualBufferSize);
+                gathered.ActualBufferSize += packet.ActualBufferSize;
+                packet.Release();
             }
+
+            this.outputQueue.RemoveRange(0, gatherCount);
+            return gathered;
         }
 
         /// <summary>
@@ -309,5 +417,239 @@
         }
 
         #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Decodes next message with the native demuxer. Media messages are passed to MediaHandler
+        /// in batches, other messages are returned one by one
+        /// </summary>
+        /// <param name="dataPacket">Packet buffer with new data, can be null</param>
+        /// <returns>
+        /// New RTMP message if parsing was successful, null otherwise.
+        /// If null returned then it means we need more input data.
+        /// </returns>
+        private RtmpMessage DecodeNative(PacketBuffer dataPacket)
+        {
+            if (this.demuxerId < 0)
+            {
+                this.demuxerId = RtmpProtocolParser.MCSSF_CreateChunkDemuxer();
+                if (this.demuxerId < 0)
+                {
+                    throw new CriticalStreamException(string.Format("MCSSF_CreateChunkDemuxer failed {0}", this.demuxerId));
+                }
+
+                // data received together with the end of handshake
+                this.dataStream.Seek(0, System.IO.SeekOrigin.Begin);
+                while (this.dataStream.Position < this.dataStream.Length)
+                {
+                    PacketBuffer packet = Global.Allocator.LockBuffer();
+                    packet.ActualBufferSize = this.dataStream.Read(packet.Buffer, 0, packet.Size);
+                    this.demuxInput.Enqueue(packet);
+                }
+
+                this.dataStream.TrimBegin();
+            }
+
+            if (dataPacket != null)
+            {
+                dataPacket.AddRef();
+                this.demuxInput.Enqueue(dataPacket);
+            }
+
+            while (true)
+            {
+                while (this.demuxMessageIndex < this.demuxMessageCount)
+                {
+                    int index = this.demuxMessageIndex;
+                    RtmpMessageType messageType = (RtmpMessageType)this.demuxMessages[index].nMessageType;
+
+                    if ((messageType == RtmpMessageType.Audio || messageType == RtmpMessageType.Video) && this.MediaHandler != null)
+                    {
+                        // the whole run of media messages goes to the handler at once
+                        int count = 1;
+                        while (index + count < this.demuxMessageCount)
+                        {
+                            RtmpMessageType nextType = (RtmpMessageType)this.demuxMessages[index + count].nMessageType;
+                            if (nextType != RtmpMessageType.Audio && nextType != RtmpMessageType.Video)
+                            {
+                                break;
+                            }
+
+                            ++count;
+                        }
+
+                        int handled = this.MediaHandler(this.demuxMessages, index, count);
+                        if (handled > 0)
+                        {
+                            this.demuxMessageIndex += handled;
+                            continue;
+                        }
+                    }
+
+                    this.demuxMessageIndex++;
+
+                    RtmpMessage msg = this.DecodeNativeMessage(ref this.demuxMessages[index]);
+                    if (msg != null)
+                    {
+                        return msg;
+                    }
+                }
+
+                // all messages processed, their payloads may be overwritten now
+                if (this.demuxPacket != null && this.demuxPacketOffset >= this.demuxPacket.ActualBufferSize)
+                {
+                    this.ReleaseDemuxPacket();
+                }
+
+                if (this.demuxPacket == null)
+                {
+                    if (this.demuxInput.Count == 0)
+                    {
+                        return null;
+                    }
+
+                    this.demuxPacket = this.demuxInput.Dequeue();
+                    this.demuxPacketHandle = GCHandle.Alloc(this.demuxPacket.Buffer, GCHandleType.Pinned);
+                    this.demuxPacketOffset = 0;
+                }
+
+                int consumed = 0;
+                int result = RtmpProtocolParser.MCSSF_DemuxChunks(
+                    this.demuxerId,
+                    Marshal.UnsafeAddrOfPinnedArrayElement(this.demuxPacket.Buffer, this.demuxPacketOffset),
+                    this.demuxPacket.ActualBufferSize - this.demuxPacketOffset,
+                    out consumed,
+                    this.demuxMessages,
+                    this.demuxMessages.Length);
+
+                if (result < 0)
+                {
+                    throw new CriticalStreamException(string.Format("MCSSF_DemuxChunks failed {0}, chunk stream is corrupted", result));
+                }
+
+                this.demuxPacketOffset += consumed;
+                this.demuxMessageCount = result;
+                this.demuxMessageIndex = 0;
+            }
+        }
+
+        /// <summary>
+        /// Decodes RTMP message from the message demuxed by the native demuxer
+        /// </summary>
+        /// <param name="message">Demuxed message</param>
+        /// <returns>New RTMP message, null if the message isn't supported</returns>
+        private RtmpMessage DecodeNativeMessage(ref MCSSF_RTMP_MESSAGE message)
+        {
+            if (!this.registeredMessageStreams.Contains(message.nMessageStreamId))
+            {
+                Global.Log.ErrorFormat("Received message {0} of unknown message stream {1}, dropping it", message.nMessageType, message.nMessageStreamId);
+                return null;
+            }
+
+            RtmpChunkHeader hdr = new RtmpChunkHeader
+            {
+                Format = 0,
+                ChunkStreamId = (uint)message.nChunkStreamId,
+                Timestamp = message.nTimestamp,
+                MessageLength = message.nDataSize,
+                MessageType = (RtmpMessageType)message.nMessageType,
+                MessageStreamId = message.nMessageStreamId
+            };
+
+            if (message.nDataSize > Global.MediaAllocator.BufferSize)
+            {
+                // increase buffer sizes
+                Global.MediaAllocator.Reallocate(message.nDataSize * 3 / 2, Global.MediaAllocator.BufferCount);
+            }
+
+            PacketBuffer packet = message.nDataSize > Global.Allocator.BufferSize ? Global.MediaAllocator.LockBuffer() : Global.Allocator.LockBuffer();
+            packet.ActualBufferSize = message.nDataSize;
+            if (message.nDataSize > 0)
+            {
+                Marshal.Copy(message.pData, packet.Buffer, 0, message.nDataSize);
+            }
+
+            RtmpMessage msg = null;
+            using (PacketBufferStream messageStream = new PacketBufferStream(packet))
+            {
+                messageStream.OneMessage = true;
+                msg = RtmpMessage.Decode(hdr, messageStream);
+            }
+
+            packet.Release();
+
+            return msg;
+        }
+
+        /// <summary>
+        /// Unpins and releases the packet currently parsed by the native demuxer
+        /// </summary>
+        private void ReleaseDemuxPacket()
+        {
+            if (this.demuxPacket != null)
+            {
+                this.demuxPacketHandle.Free();
+                this.demuxPacket.Release();
+                this.demuxPacket = null;
+            }
+
+            this.demuxMessageCount = 0;
+            this.demuxMessageIndex = 0;
+        }
+
+        #endregion
+
+        #region Unmanaged interface to MCommsSSFSDK
+
+        /// <summary>
+        /// MCSSF_RTMP_MESSAGE structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct MCSSF_RTMP_MESSAGE
+        {
+            public Int32 nChunkStreamId;
+            public Int32 nMessageStreamId;
+            public Int32 nMessageType;
+            public UInt32 nTimestamp;
+            public Int32 nDataSize;
+            public IntPtr pData;
+        }
+
+        /// <summary>
+        /// Creates native RTMP chunk demuxer
+        /// </summary>
+        /// <returns>Demuxer id, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_CreateChunkDemuxer();
+
+        /// <summary>
+        /// Parses received data into RTMP messages
+        /// </summary>
+        /// <param name="demuxerId">Demuxer id</param>
+        /// <param name="data">Received data</param>
+        /// <param name="dataSize">Received data size</param>
+        /// <param name="consumedSize">Number of bytes taken, the rest is to be passed again</param>
+        /// <param name="messages">Receives demuxed messages</param>
+        /// <param name="maxMessages">Size of the message array</param>
+        /// <returns>Number of messages, -1 unknown demuxer, -2 invalid arguments, -3 corrupted data</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_DemuxChunks(
+            [In] Int32 demuxerId,
+            [In] IntPtr data,
+            [In] Int32 dataSize,
+            [Out] out Int32 consumedSize,
+            [In, Out] MCSSF_RTMP_MESSAGE[] messages,
+            [In] Int32 maxMessages);
+
+        /// <summary>
+        /// Destroys native RTMP chunk demuxer
+        /// </summary>
+        /// <param name="demuxerId">Demuxer id</param>
+        /// <returns>1 if destroyed, 0 if already destroyed</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_DestroyChunkDemuxer([In] Int32 demuxerId);
+
+        #endregion
     }
 }
@@ -2,6 +2,7 @@
 {
     using System;
     using System.Collections.Generic;
+    using System.Diagnostics;
     using System.Globalization;
     using System.IO;
     using System.Linq;
@@ -11,6 +12,7 @@
     using System.Threading.Tasks;
 
     using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.Output;
     using MComms_Transmuxer.SmoothStreaming;
 
     /// <summary>
@@ -31,7 +33,7 @@
     /// <summary>
     /// RTMP message stream. Used for message stream related operations:
     /// parse metadata and prepare stream media types,
-    /// create and maintain smooth streaming segmenter,
+    /// create and maintain outputs of the published stream,
     /// perform onFI-based synchronization,
     /// dump data to FLV file if necessary
     /// </summary>
@@ -60,19 +62,19 @@
         private bool firstAudioFrame = true;
 
         /// <summary>
-        /// Video stream GUID as registered by segmenter
+        /// Fan-out stage feeding all outputs of the published stream
         /// </summary>
-        private Guid videoStreamId = Guid.Empty;
+        private MediaFanOut fanOut = null;
 
         /// <summary>
-        /// Audio stream GUID as registered by segmenter
+        /// Smooth streaming output, owned by fan-out
         /// </summary>
-        private Guid audioStreamId = Guid.Empty;
+        private SmoothStreamingSink smoothSink = null;
 
         /// <summary>
-        /// Smooth streaming segmenter
+        /// Statistics of the published stream, open while outputs exist
         /// </summary>
-        private SmoothStreamingSegmenter segmenter = null;
+        private StreamStatistics statistics = null;
 
         /// <summary>
         /// Publish name, usually RTMP publish name without trailing number
@@ -102,14 +104,9 @@
         private string flvDumpPath = null;
 
         /// <summary>
-        /// FLV file stream
+        /// FLV dump output, owned by fan-out
         /// </summary>
-        private FileStream flvDumpStream = null;
-
-        /// <summary>
-        /// FLV first timestamp
-        /// </summary>
-        private long flvFirstTimestamp = -1;
+        private FlvArchiveSink flvArchive = null;
 
         /// <summary>
         /// Stored metadata message
@@ -187,6 +184,23 @@
         /// </summary>
         public string FullPublishName { get; set; }
 
+        /// <summary>
+        /// Gets or sets whether outputs make the stream wait when they fall behind instead of dropping
+        /// samples. Set by offline sources like capture replay before publishing
+        /// </summary>
+        public bool Lossless { get; set; }
+
+        /// <summary>
+        /// Gets statistics of the published stream, null if not publishing
+        /// </summary>
+        public StreamStatistics Statistics
+        {
+            get
+            {
+                return this.statistics;
+            }
+        }
+
         /// <summary>
         /// Gets or sets whether we're publishing or not
         /// </summary>
@@ -201,18 +215,17 @@
                 this.publishing = value;
                 if (this.publishing)
                 {
-                    if (this.segmenter == null)
+                    if (this.fanOut == null)
                     {
-                        this.segmenter = new SmoothStreamingSegmenter(this.publishUri);
+                        this.statistics = StreamStatistics.Open(this.publishName + ".isml", this.FullPublishName);
+                        this.smoothSink = new SmoothStreamingSink(this.publishUri, false, this.statistics);
+                        this.fanOut = new MediaFanOut(Global.MediaSinkQueueLength, this.statistics, this.Lossless);
+                        this.fanOut.AddSink(this.publishUri, this.smoothSink);
                     }
                 }
                 else
                 {
-                    if (this.segmenter != null)
-                    {
-                        this.segmenter.Dispose();
-                        this.segmenter = null;
-                    }
+                    this.CloseOutputs();
                 }
             }
         }
@@ -226,19 +239,7 @@
         /// </summary>
         public void Dispose()
         {
-            if (segmenter != null)
-            {
-                segmenter.Dispose();
-                segmenter = null;
-            }
-
-            if (this.flvDumpStream != null)
-            {
-                this.flvDumpStream.Flush();
-                this.flvDumpStream.Close();
-                this.flvDumpStream.Dispose();
-                this.flvDumpStream = null;
-            }
+            this.CloseOutputs();
         }
 
         #endregion
@@ -273,17 +274,57 @@
             }
         }
 
+        /// <summary>
+        /// Pushes media messages demuxed by the native demuxer to the segmenter without decoding them,
+        /// as long as Smooth Streaming is the only output and has caught up with the stream.
+        /// Messages which need managed processing (codec configuration, the first media frame,
+        /// media for other outputs) are left to ProcessMediaData
+        /// </summary>
+        /// <param name="messages">Demuxed messages</param>
+        /// <param name="offset">Index of the first media message</param>
+        /// <param name="count">Number of consecutive media messages</param>
+        /// <returns>Number of messages taken</returns>
+        public int IngestMediaMessages(RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages, int offset, int count)
+        {
+            if (this.fanOut == null || this.firstTimestamp)
+            {
+                return 0;
+            }
+
+            int taken = 0;
+
+            this.fanOut.RunIfSoleAndIdle(
+                this.smoothSink,
+                () => taken = this.smoothSink.IngestMessages(messages, offset, count, this.MessageStreamId, this.timestampAdjust, this.absoluteTimeOrigin));
+
+            return taken;
+        }
+
+        /// <summary>
+        /// Checks outputs, queued media data is pushed by output workers as soon as they catch up.
+        /// Throws CriticalStreamException if an output has failed
+        /// </summary>
+        public void Flush()
+        {
+            if (this.fanOut != null)
+            {
+                this.fanOut.ThrowIfFailed();
+            }
+        }
+
         /// <summary>
         /// Processes stream media data
         /// </summary>
         /// <param name="msg">Media data message</param>
         public void ProcessMediaData(RtmpMessageMedia msg)
         {
-            if (this.segmenter == null)
+            if (this.fanOut == null)
             {
                 throw new CriticalStreamException(string.Format("Command {0}, media data is unexpected in current state, dropping session...", msg.MessageType));
             }
 
+            long started = Stopwatch.GetTimestamp();
+
             switch (msg.MessageType)
             {
                 case RtmpIntMessageType.Audio:
@@ -299,79 +340,9 @@
                     break;
             }
 
-            if (this.flvDump && this.flvDumpStream != null)
+            if (this.statistics != null)
             {
-                // drop data till the first non-zero video frame
-                // or the first non-zero audio frame if there is no video data
-                if (this.flvFirstTimestamp <= 0)
-                {
-                    if (this.videoMediaType == null)
-                    {
-                        if (msg.MessageType == RtmpIntMessageType.Audio && msg.Timestamp > 0)
-                        {
-                            this.flvFirstTimestamp = msg.Timestamp;
-                        }
-                    }
-                    else
-                    {
-                        if (msg.MessageType == RtmpIntMessageType.Video && msg.Timestamp > 0 && msg.KeyFrame)
-                        {
-                            this.flvFirstTimestamp = msg.Timestamp;
-                        }
-                    }
-                }
-
-                if (this.flvFirstTimestamp > 0 || msg.PacketType == RtmpMediaPacketType.Configuration)
-                {
-                    //Global.Log.DebugFormat("Writing to FLV: {0}, timestamp {3}, corrected {1}, keyframe {2}", msg.MessageType, (msg.Timestamp - this.flvFirstTimestamp), msg.KeyFrame, msg.Timestamp);
-
-                    PacketBuffer packet = null;
-
-                    try
-                    {
-                        FlvTagHeader hdr = new FlvTagHeader
-                        {
-                            TagType = msg.OrigMessageType,
-                            DataSize = (uint)msg.MediaData.ActualBufferSize,
-                            StreamId = 0,
-                            Timestamp = 0
-                        };
-
-                        if (msg.PacketType != RtmpMediaPacketType.Configuration)
-                        {
-                            hdr.Timestamp = (uint)(msg.Timestamp - this.flvFirstTimestamp - this.timestampAdjust);
-                        }
-
-                        packet = hdr.ToPacketBuffer();
-
-                        using (EndianBinaryWriter writer = new EndianBinaryWriter(this.flvDumpStream, true))
-                        {
-                            // write tag header
-                            writer.Write(packet.Buffer, 0, packet.ActualBufferSize);
-                            // write media data
-                            writer.Write(msg.MediaData.Buffer, 0, msg.MediaData.ActualBufferSize);
-                            // write previous tag size
-                            writer.Write((uint)(hdr.HeaderSize + msg.MediaData.ActualBufferSize));
-                        }
-                    }
-                    catch (Exception ex)
-                    {
-                        if (this.flvDumpStream != null)
-                        {
-                            this.flvDumpStream.Dispose();
-                            this.flvDumpStream = null;
-                        }
-
-                        Global.Log.ErrorFormat("FLV write failed: {0}", ex.ToString());
-                    }
-                    finally
-                    {
-                        if (packet != null)
-                        {
-                            packet.Release();
-                        }
-                    }
-                }
+                this.statistics.Record(PipelineStage.Timestamp, started);
             }
         }
 
@@ -447,7 +418,8 @@
                 this.audioMediaType.PrivateData = new byte[privateDataLen];
                 Array.Copy(msg.MediaData.Buffer, msg.MediaData.ActualBufferSize - privateDataLen, this.audioMediaType.PrivateData, 0, privateDataLen);
 
-                this.audioStreamId = this.segmenter.RegisterStream(this.audioMediaType);
+                this.fanOut.RegisterStream(this.audioMediaType);
+                this.PushSample(msg, MediaContentType.Audio, true);
 
                 this.firstAudioFrame = false;
             }
@@ -464,22 +436,17 @@
                     this.firstTimestamp = false;
                 }
 
-                long adjustedTimestamp = (msg.Timestamp - this.timestampAdjust) * 10000;
-                DateTime absoluteTime = this.absoluteTimeOrigin.AddTicks(adjustedTimestamp);
-
-                if (msg.PacketType == RtmpMediaPacketType.Media)
-                {
-                    // push to Smooth Streaming segmenter
-                    this.segmenter.PushMediaData(this.audioStreamId, absoluteTime, adjustedTimestamp, true, msg.MediaData.Buffer, msg.MediaDataOffset, msg.MediaData.ActualBufferSize - msg.MediaDataOffset);
-                }
-                else if (msg.PacketType == RtmpMediaPacketType.Eos)
+                if (msg.PacketType == RtmpMediaPacketType.Eos)
                 {
                     Global.Log.DebugFormat("Received audio EOS");
                 }
-                else
+                else if (msg.PacketType != RtmpMediaPacketType.Media)
                 {
                     Global.Log.DebugFormat("Received unexpected audio packet type {0}", msg.PacketType);
                 }
+
+                // pass to outputs, only media packets are segmented
+                this.PushSample(msg, MediaContentType.Audio, true);
             }
         }
 
@@ -539,7 +506,8 @@
                 this.videoMediaType.PrivateData[4] |= 0xFC;
                 this.videoMediaType.PrivateData[5] |= 0xE0;
 
-                this.videoStreamId = this.segmenter.RegisterStream(this.videoMediaType);
+                this.fanOut.RegisterStream(this.videoMediaType);
+                this.PushSample(msg, MediaContentType.Video, msg.KeyFrame);
 
                 this.firstVideoFrame = false;
             }
@@ -556,22 +524,59 @@
                     this.firstTimestamp = false;
                 }
 
-                long adjustedTimestamp = (msg.Timestamp - this.timestampAdjust) * 10000;
-                DateTime absoluteTime = this.absoluteTimeOrigin.AddTicks(adjustedTimestamp);
-
-                if (msg.PacketType == RtmpMediaPacketType.Media)
-                {
-                    // push to Smooth Streaming segmenter
-                    this.segmenter.PushMediaData(this.videoStreamId, absoluteTime, adjustedTimestamp, msg.KeyFrame, msg.MediaData.Buffer, msg.MediaDataOffset, msg.MediaData.ActualBufferSize - msg.MediaDataOffset);
-                }
-                else if (msg.PacketType == RtmpMediaPacketType.Eos)
+                if (msg.PacketType == RtmpMediaPacketType.Eos)
                 {
                     Global.Log.DebugFormat("Received video EOS");
                 }
-                else
+                else if (msg.PacketType != RtmpMediaPacketType.Media)
                 {
                     Global.Log.DebugFormat("Received unexpected video packet type {0}", msg.PacketType);
                 }
+
+                // pass to outputs, only media packets are segmented
+                this.PushSample(msg, MediaContentType.Video, msg.KeyFrame);
+            }
+        }
+
+        /// <summary>
+        /// Hands media message to all outputs with normalized timestamp
+        /// </summary>
+        /// <param name="msg">Media message</param>
+        /// <param name="contentType">Content type of the stream</param>
+        /// <param name="keyFrame">Whether it's a key frame</param>
+        private void PushSample(RtmpMessageMedia msg, MediaContentType contentType, bool keyFrame)
+        {
+            long adjustedTimestamp = (msg.Timestamp - this.timestampAdjust) * 10000;
+
+            this.fanOut.PushSample(new MediaSample
+            {
+                ContentType = contentType,
+                PacketType = msg.PacketType,
+                AbsoluteTime = this.absoluteTimeOrigin.AddTicks(adjustedTimestamp),
+                Timestamp = adjustedTimestamp,
+                KeyFrame = keyFrame,
+                MediaData = msg.MediaData,
+                MediaDataOffset = msg.MediaDataOffset
+            });
+        }
+
+        /// <summary>
+        /// Lets outputs process queued media and closes them
+        /// </summary>
+        private void CloseOutputs()
+        {
+            if (this.fanOut != null)
+            {
+                this.fanOut.Dispose();
+                this.fanOut = null;
+                this.smoothSink = null;
+                this.flvArchive = null;
+            }
+
+            if (this.statistics != null)
+            {
+                this.statistics.Close();
+                this.statistics = null;
             }
         }
 
@@ -698,53 +703,17 @@
                 this.videoMediaType = videoMediaType;
             }
 
-            if (this.flvDump)
+            if (this.flvDump && this.flvArchive == null && this.fanOut != null)
             {
-                PacketBuffer headerPacket = null;
-                PacketBuffer metadataPacket = null;
-
                 try
                 {
-                    this.flvDumpStream = new FileStream(this.flvDumpPath, FileMode.Create, FileAccess.Write, FileShare.Read);
-
-                    FlvFileHeader fileHeader = new FlvFileHeader(audioFound, videoFound);
-                    headerPacket = fileHeader.ToPacketBuffer();
-                    metadataPacket = this.metadataMessage.ToFlvTag();
-
-                    using (EndianBinaryWriter writer = new EndianBinaryWriter(this.flvDumpStream, true))
-                    {
-                        // write file header
-                        writer.Write(headerPacket.Buffer, 0, headerPacket.ActualBufferSize);
-                        // write first previous tag size 0
-                        writer.Write((int)0);
-                        // write metadata
-                        writer.Write(metadataPacket.Buffer, 0, metadataPacket.ActualBufferSize);
-                        // write previous tag size
-                        writer.Write(metadataPacket.ActualBufferSize);
-                    }
+                    this.flvArchive = new FlvArchiveSink(this.flvDumpPath, this.metadataMessage, audioFound, videoFound);
+                    this.fanOut.AddSink(this.flvDumpPath, this.flvArchive);
                 }
                 catch (Exception ex)
                 {
-                    if (this.flvDumpStream != null)
-                    {
-                        this.flvDumpStream.Dispose();
-                        this.flvDumpStream = null;
-                    }
-
                     Global.Log.ErrorFormat("Can't open FLV dump file for writing: {0}", ex.ToString());
                 }
-                finally
-                {
-                    if (headerPacket != null)
-                    {
-                        headerPacket.Release();
-                    }
-
-                    if (metadataPacket != null)
-                    {
-                        metadataPacket.Release();
-                    }
-                }
             }
         }
 
@@ -861,7 +830,11 @@
             {
                 Global.Log.DebugFormat("Synchronization info: gap {0}, absolute time {1:yy-MM-dd HH:mm:ss.fff}", gap, absoluteTime);
                 this.timestampFirstSync = this.timestampSync = gap;
-                this.segmenter.AdjustAbsoluteTime((absoluteTime - this.absoluteTimeOrigin).Ticks);
+                if (this.fanOut != null)
+                {
+                    this.fanOut.AdjustAbsoluteTime((absoluteTime - this.absoluteTimeOrigin).Ticks);
+                }
+
                 this.absoluteTimeOrigin = absoluteTime;
             }
             else
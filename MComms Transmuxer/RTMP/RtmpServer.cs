@@ -23,7 +23,7 @@
         /// <summary>
         /// TCP transport
         /// </summary>
-        private SocketTransport transport = null;
+        private ITransport transport = null;
 
         /// <summary>
         /// Whether we've started
@@ -31,34 +31,44 @@
         private volatile bool isRunning = false;
 
         /// <summary>
-        /// Control thread
+        /// Control timer, collects statistics and deletes expired publishing points
         /// </summary>
-        private Thread controlThread = null;
+        private Timer controlTimer = null;
 
         /// <summary>
-        /// RTMP sessions
+        /// Held by control timer callback, skips calls overlapping a slow one
         /// </summary>
-        private Hashtable sessions = new Hashtable();
+        private object controlLock = new object();
 
         /// <summary>
-        /// Session counter
+        /// Worker pool running RTMP sessions
         /// </summary>
-        private long sessionCounter = 0;
+        private WorkerPool sessionPool = null;
 
         /// <summary>
-        /// Last time we checked publishing points
+        /// Embedded Smooth Streaming origin, null if disabled
         /// </summary>
-        private DateTime lastPublishingPointsChecked = DateTime.MinValue;
+        private SmoothStreamingOrigin origin = null;
 
         /// <summary>
-        /// Perf counters
+        /// Statistics endpoint, null if disabled
         /// </summary>
-        private Statistics stat = new Statistics();
+        private StatisticsEndpoint statisticsEndpoint = null;
+
+        /// <summary>
+        /// RTMP sessions
+        /// </summary>
+        private Hashtable sessions = new Hashtable();
+
+        /// <summary>
+        /// Session counter
+        /// </summary>
+        private long sessionCounter = 0;
 
         /// <summary>
-        /// Last time we've collected the stat
+        /// Perf counters
         /// </summary>
-        private DateTime lastStatCollected = DateTime.MinValue;
+        private Statistics stat = new Statistics();
 
         /// <summary>
         /// Current number of connections
@@ -83,7 +93,24 @@
             EndianBinaryReader.GlobalEndiannes = Endianness.BigEndian;
             EndianBinaryWriter.GlobalEndiannes = Endianness.BigEndian;
 
-            this.transport = new SocketTransport();
+            if (Properties.Settings.Default.UseNativeTransport && Environment.OSVersion.Platform == PlatformID.Unix)
+            {
+                NativeTransport nativeTransport = new NativeTransport();
+                nativeTransport.MaxConnections = Global.RtmpMaxConnections;
+                nativeTransport.ReceiveChunkSize = Global.TransportBufferSize;
+                this.transport = nativeTransport;
+            }
+            else
+            {
+                SocketTransport socketTransport = new SocketTransport();
+                socketTransport.MaxConnections = Global.RtmpMaxConnections;
+                socketTransport.ReceiveContextPoolSize = Global.RtmpMaxConnections;
+                socketTransport.SendContextPoolSize = Global.RtmpMaxConnections;
+                socketTransport.ReceiveBufferSize = Global.TransportBufferSize;
+                socketTransport.SendBufferSize = Global.TransportBufferSize;
+                this.transport = socketTransport;
+            }
+
             this.transport.Connected += Transport_Connected;
             this.transport.Disconnected += Transport_Disconnected;
             this.transport.Received += Transport_Received;
@@ -92,15 +119,7 @@
             this.transport.Sent += Transport_Sent;
 #endif
 
-            this.transport.MaxConnections = Global.RtmpMaxConnections;
-            this.transport.ReceiveContextPoolSize = Global.RtmpMaxConnections;
-            this.transport.SendContextPoolSize = Global.RtmpMaxConnections;
-            this.transport.ReceiveBufferSize = Global.TransportBufferSize;
-            this.transport.SendBufferSize = Global.TransportBufferSize;
-
             this.stat.InitStats();
-
-            this.controlThread = new Thread(this.ControlThreadProc);
         }
 
         #endregion
@@ -113,7 +132,20 @@
         public void Start()
         {
             this.isRunning = true;
-            this.controlThread.Start();
+            this.sessionPool = new WorkerPool("RTMP session", Environment.ProcessorCount);
+            this.controlTimer = new Timer(this.ControlTimerProc, null, 0, 1000);
+
+            if (Properties.Settings.Default.EnableOrigin)
+            {
+                this.origin = new SmoothStreamingOrigin(Properties.Settings.Default.OriginPrefix);
+                this.origin.Start();
+            }
+
+            if (Properties.Settings.Default.EnableStatisticsEndpoint)
+            {
+                this.statisticsEndpoint = new StatisticsEndpoint(Properties.Settings.Default.StatisticsPrefix, this.sessionPool);
+                this.statisticsEndpoint.Start();
+            }
 
             this.transport.Start(new IPEndPoint(IPAddress.Any, Properties.Settings.Default.RtmpPort), System.Net.Sockets.ProtocolType.Tcp);
         }
@@ -126,7 +158,29 @@
             this.transport.Stop();
 
             this.isRunning = false;
-            this.controlThread.Join();
+
+            using (ManualResetEvent timerDisposed = new ManualResetEvent(false))
+            {
+                // waits for the callback if it's running
+                this.controlTimer.Dispose(timerDisposed);
+                timerDisposed.WaitOne();
+                this.controlTimer = null;
+            }
+
+            if (this.statisticsEndpoint != null)
+            {
+                this.statisticsEndpoint.Stop();
+                this.statisticsEndpoint = null;
+            }
+
+            this.sessionPool.Dispose();
+            this.sessionPool = null;
+
+            if (this.origin != null)
+            {
+                this.origin.Stop();
+                this.origin = null;
+            }
 
             // clean up publishing points
             SmoothStreamingPublisher.DeleteAll();
@@ -137,28 +191,35 @@
         #region Private methods and event handlers
 
         /// <summary>
-        /// Main control thread
+        /// Control timer callback, called every second
         /// </summary>
-        private void ControlThreadProc()
+        /// <param name="state">Not used</param>
+        private void ControlTimerProc(object state)
         {
-            Global.Log.Debug("RtmpServer main thread started");
+            if (!this.isRunning || !Monitor.TryEnter(this.controlLock))
+            {
+                // stopping or previous call still running
+                return;
+            }
 
-            while (this.isRunning)
+            try
             {
-                if ((DateTime.Now - this.lastStatCollected).TotalMilliseconds >= 1000)
-                {
-                    this.stat.CollectNetworkInfo(this.statNumberOfConnections, this.statTotalBandwidth * 8);
-                    this.statTotalBandwidth = 0;
-                    this.lastStatCollected = DateTime.Now;
-                }
+                this.stat.CollectNetworkInfo(this.statNumberOfConnections, this.statTotalBandwidth * 8);
 
-                if ((DateTime.Now - this.lastPublishingPointsChecked).TotalMilliseconds >= 1000)
+                SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS poolStats;
+                if (SmoothStreamingSegmenter.MCSSF_GetBufferPoolStats(out poolStats) > 0)
                 {
-                    SmoothStreamingPublisher.DeleteExpired();
-                    this.lastPublishingPointsChecked = DateTime.Now;
+                    this.stat.CollectSegmentBufferInfo(poolStats.nBytesAllocated, poolStats.nHighWaterBytesInUse);
                 }
 
-                Thread.Sleep(1);
+                this.statTotalBandwidth = 0;
+
+                StreamStatistics.UpdateAll();
+                SmoothStreamingPublisher.DeleteExpired();
+            }
+            finally
+            {
+                Monitor.Exit(this.controlLock);
             }
         }
 
@@ -178,7 +239,7 @@
                     return;
                 }
 
-                RtmpSession session = new RtmpSession(++this.sessionCounter, this.transport, e.EndPoint);
+                RtmpSession session = new RtmpSession(++this.sessionCounter, this.transport, e.EndPoint, this.sessionPool);
                 sessions.Add(e.EndPoint, session);
                 this.statNumberOfConnections = sessions.Count;
             }
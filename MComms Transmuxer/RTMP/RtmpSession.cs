@@ -36,7 +36,7 @@
         /// <summary>
         /// TCP transport
         /// </summary>
-        private SocketTransport transport = null;
+        private ITransport transport = null;
 
         /// <summary>
         /// Session IP end point
@@ -44,14 +44,24 @@
         private IPEndPoint sessionEndPoint = null;
 
         /// <summary>
-        /// Whether session thread is running
+        /// Whether session is running, false once it has dropped the connection
         /// </summary>
         private volatile bool isRunning = true;
 
         /// <summary>
-        /// Session thread
+        /// Processing of the session, scheduled on the session pool when data arrives or the inactivity timer fires
         /// </summary>
-        private Thread sessionThread = null;
+        private ScheduledWork sessionWork = null;
+
+        /// <summary>
+        /// Inactivity timer
+        /// </summary>
+        private Timer inactivityTimer = null;
+
+        /// <summary>
+        /// Whether inactivity timer has fired and must be set again
+        /// </summary>
+        private int inactivityTimerFired = 0;
 
         /// <summary>
         /// Session state
@@ -68,6 +78,11 @@
         /// </summary>
         private Queue<PacketBuffer> receivedPackets = new Queue<PacketBuffer>();
 
+        /// <summary>
+        /// Stopwatch timestamps of the first data received into each queued packet
+        /// </summary>
+        private Queue<long> receivedTimes = new Queue<long>();
+
         /// <summary>
         /// Last packet was received. We're using this packet to append received data to it till it's processed.
         /// </summary>
@@ -133,6 +148,11 @@
         /// </summary>
         private int routeReceiveEventState = 0;
 
+        /// <summary>
+        /// Statistics of the stream published last by this session, null while nothing is published
+        /// </summary>
+        private volatile StreamStatistics statistics = null;
+
         #endregion
 
         #region Constructor
@@ -143,13 +163,15 @@
         /// <param name="sessionId">Unique RTMP session id</param>
         /// <param name="transport">TCP transport</param>
         /// <param name="sessionEndPoint">IP end point</param>
-        public RtmpSession(long sessionId, SocketTransport transport, IPEndPoint sessionEndPoint)
+        /// <param name="sessionPool">Worker pool running the session</param>
+        public RtmpSession(long sessionId, ITransport transport, IPEndPoint sessionEndPoint, WorkerPool sessionPool)
         {
             this.sessionId = sessionId;
             this.transport = transport;
             this.sessionEndPoint = sessionEndPoint;
-            this.sessionThread = new Thread(this.SessionThread);
-            this.sessionThread.Start();
+            this.parser.MediaHandler = this.IngestMediaMessages;
+            this.sessionWork = new ScheduledWork(sessionPool, this.SessionWorkProc);
+            this.inactivityTimer = new Timer(this.InactivityTimerProc, null, Global.RtmpSessionInactivityTimeoutMs, Timeout.Infinite);
             Global.Log.DebugFormat("End point {0}, id {1}: created session object", this.sessionEndPoint, this.sessionId);
         }
 
@@ -164,13 +186,17 @@
         {
             this.isRunning = false;
 
-            if (this.sessionThread != null)
+            if (this.sessionWork != null)
             {
-                this.sessionThread.Join();
-                this.sessionThread = null;
+                // waits for the session work if it's running
+                this.sessionWork.Close();
+                this.sessionWork = null;
             }
 
+            this.inactivityTimer.Dispose();
+
             this.ReleaseMessageStreams();
+            this.parser.Dispose();
 
             this.lastReceivedPacket = null;
             while (this.receivedPackets.Count > 0)
@@ -179,6 +205,8 @@
                 this.receivedPackets.Dequeue();
             }
 
+            this.receivedTimes.Clear();
+
             Global.Log.DebugFormat("End point {0}, id {1}: session object disposed", this.sessionEndPoint, this.sessionId);
         }
 
@@ -202,11 +230,19 @@
                 {
                     this.lastReceivedPacket = Global.Allocator.LockBuffer();
                     this.receivedPackets.Enqueue(this.lastReceivedPacket);
+                    this.receivedTimes.Enqueue(Stopwatch.GetTimestamp());
                 }
 
                 Array.Copy(e.Data, e.DataOffset, this.lastReceivedPacket.Buffer, this.lastReceivedPacket.ActualBufferSize, e.DataLength);
                 this.lastReceivedPacket.ActualBufferSize += e.DataLength;
 
+                StreamStatistics currentStatistics = this.statistics;
+                if (currentStatistics != null)
+                {
+                    currentStatistics.AddReceivedBytes(e.DataLength);
+                    currentStatistics.ReceiveQueueDepth = this.receivedPackets.Count;
+                }
+
                 if (this.routeReceiveEventState == 1)
                 {
                     // re-route socket receive event to this RTMP session
@@ -214,6 +250,12 @@
                     this.routeReceiveEventState = 2;
                 }
             }
+
+            ScheduledWork work = this.sessionWork;
+            if (work != null)
+            {
+                work.Schedule();
+            }
         }
 
         #endregion
@@ -221,37 +263,52 @@
         #region Private methods
 
         /// <summary>
-        /// Main session thread
+        /// Session work, runs on the session pool. Decodes and processes a limited number of received packets,
+        /// sends the replies and schedules itself again if more packets are waiting
         /// </summary>
-        private void SessionThread()
+        private void SessionWorkProc()
         {
-            Global.Log.InfoFormat("End point {0}, id {1}: session thread started...", this.sessionEndPoint, this.sessionId);
+            if (!this.isRunning)
+            {
+                return;
+            }
+
+            bool morePackets = false;
 
-            while (this.isRunning)
+            for (int i = 0; i < Global.RtmpSessionPacketsPerRun; ++i)
             {
                 PacketBuffer packet = null;
-                bool nothingToDo = true;
+                long received = 0;
 
                 lock (this.receivedPackets)
                 {
-                    if (this.receivedPackets.Count > 0)
+                    if (this.receivedPackets.Count == 0)
                     {
-                        nothingToDo = false;
-                        packet = this.receivedPackets.Dequeue();
-                        receivedSize += (ulong)packet.ActualBufferSize;
-                        if (this.receivedPackets.Count == 0)
-                        {
-                            this.lastReceivedPacket = null;
-                        }
+                        break;
+                    }
+
+                    packet = this.receivedPackets.Dequeue();
+                    received = this.receivedTimes.Dequeue();
+                    receivedSize += (ulong)packet.ActualBufferSize;
+                    if (this.receivedPackets.Count == 0)
+                    {
+                        this.lastReceivedPacket = null;
                     }
                 }
 
+                StreamStatistics currentStatistics = this.statistics;
+                long decodeStarted = 0;
+                if (currentStatistics != null)
+                {
+                    currentStatistics.Record(PipelineStage.Receive, received);
+                    decodeStarted = Stopwatch.GetTimestamp();
+                }
+
                 try
                 {
                     RtmpMessage msg = null;
                     while ((msg = parser.Decode(packet)) != null)
                     {
-                        nothingToDo = false;
                         this.ProcessMessage(msg);
                         if (packet != null)
                         {
@@ -259,6 +316,14 @@
                             packet = null;
                         }
                     }
+
+                    // push media data received with this packet in one batch
+                    this.FlushMessageStreams();
+
+                    if (currentStatistics != null)
+                    {
+                        currentStatistics.Record(PipelineStage.Decode, decodeStarted);
+                    }
                 }
                 catch (Exception ex)
                 {
@@ -270,8 +335,8 @@
                     }
 
                     Global.Log.ErrorFormat("Decode exception {0}, dropping session...", ex.ToString());
-                    this.transport.Disconnect(this.sessionEndPoint);
-                    break;
+                    this.Drop();
+                    return;
                 }
 
                 if (packet != null)
@@ -280,55 +345,94 @@
                     packet = null;
                 }
 
-                if (this.receiveAckWindowSize > 0)
+                if (!this.isRunning)
                 {
-                    if ((this.receivedSize - this.lastReportedReceivedSize) >= this.receiveAckWindowSize && (DateTime.Now - this.lastReceivedSizeReported).TotalMilliseconds > 60000)
-                    {
-                        this.parser.Encode(new RtmpMessageAck((uint)(this.receivedSize - this.lastReportedReceivedSize)));
-                        this.lastReportedReceivedSize = this.receivedSize;
-                        this.lastReceivedSizeReported = DateTime.Now;
-                    }
+                    // session has been dropped while processing the message
+                    return;
                 }
+            }
+
+            lock (this.receivedPackets)
+            {
+                morePackets = this.receivedPackets.Count > 0;
+            }
 
-                // send packets if any
-                while ((packet = this.parser.GetSendPacket()) != null)
+            if (this.receiveAckWindowSize > 0)
+            {
+                if ((this.receivedSize - this.lastReportedReceivedSize) >= this.receiveAckWindowSize && (DateTime.Now - this.lastReceivedSizeReported).TotalMilliseconds > 60000)
                 {
-                    nothingToDo = false;
+                    this.parser.Encode(new RtmpMessageAck((uint)(this.receivedSize - this.lastReportedReceivedSize)));
+                    this.lastReportedReceivedSize = this.receivedSize;
+                    this.lastReceivedSizeReported = DateTime.Now;
+                }
+            }
 
-                    try
-                    {
-                        this.transport.Send(this.sessionEndPoint, packet);
+            // send packets if any, parser gathers replies of the whole run into as few packets as possible
+            PacketBuffer sendPacket = null;
+            while ((sendPacket = this.parser.GetSendPacket()) != null)
+            {
+                try
+                {
+                    this.transport.Send(this.sessionEndPoint, sendPacket);
 
-                        sentSize += (uint)packet.ActualBufferSize;
-                        if (sentSize > uint.MaxValue)
-                        {
-                            sentSize -= uint.MaxValue;
-                        }
-                    }
-                    catch (Exception ex)
+                    sentSize += (uint)sendPacket.ActualBufferSize;
+                    if (sentSize > uint.MaxValue)
                     {
-                        Global.Log.ErrorFormat("Send exception: {0}", ex.ToString());
+                        sentSize -= uint.MaxValue;
                     }
-
-                    packet.Release();
                 }
-
-                // disconnect by inactivity
-                if ((DateTime.Now - this.lastActivity).TotalMilliseconds >= Global.RtmpSessionInactivityTimeoutMs)
+                catch (Exception ex)
                 {
-                    Global.Log.ErrorFormat("Dropping inactive session ({0} ms timeout)", this.state, (DateTime.Now - this.lastActivity).TotalMilliseconds);
-                    this.transport.Disconnect(this.sessionEndPoint);
-                    break;
+                    Global.Log.ErrorFormat("Send exception: {0}", ex.ToString());
                 }
 
-                if (nothingToDo)
-                {
-                    // sleep only if we don't have anything to do
-                    Thread.Sleep(1);
-                }
+                sendPacket.Release();
+            }
+
+            // disconnect by inactivity
+            double inactiveMs = (DateTime.Now - this.lastActivity).TotalMilliseconds;
+            if (inactiveMs >= Global.RtmpSessionInactivityTimeoutMs)
+            {
+                Global.Log.ErrorFormat("Dropping inactive session ({0} ms timeout)", this.state, inactiveMs);
+                this.Drop();
+                return;
             }
 
-            Global.Log.InfoFormat("End point {0}, id {1}: session thread finished...", this.sessionEndPoint, this.sessionId);
+            if (Interlocked.Exchange(ref this.inactivityTimerFired, 0) != 0)
+            {
+                // wake up again when the session may become inactive
+                this.inactivityTimer.Change(Global.RtmpSessionInactivityTimeoutMs - (int)inactiveMs, Timeout.Infinite);
+            }
+
+            if (morePackets)
+            {
+                // let other sessions of the pool run before processing the rest
+                this.sessionWork.Schedule();
+            }
+        }
+
+        /// <summary>
+        /// Called when the inactivity timer fires, schedules the session to check its activity
+        /// </summary>
+        /// <param name="state">Not used</param>
+        private void InactivityTimerProc(object state)
+        {
+            Interlocked.Exchange(ref this.inactivityTimerFired, 1);
+
+            ScheduledWork work = this.sessionWork;
+            if (work != null)
+            {
+                work.Schedule();
+            }
+        }
+
+        /// <summary>
+        /// Stops processing and disconnects the session, the server disposes it when the transport reports the disconnection
+        /// </summary>
+        private void Drop()
+        {
+            this.isRunning = false;
+            this.transport.Disconnect(this.sessionEndPoint);
         }
 
         /// <summary>
@@ -607,22 +711,7 @@
                         this.parser.Encode(new RtmpMessageSetChunkSize(Global.RtmpOurChunkSize));
 
                         {
-                            List<object> pars = new List<object>();
-
-                            RtmpAmfObject amf = new RtmpAmfObject();
-                            amf.Strings.Add("fmsVer", "FMS/3,0,1,123"); // NOTE: value taken from FFmpeg implementation
-                            amf.Numbers.Add("capabilities", 31); // NOTE: value taken from FFmpeg implementation
-                            pars.Add(amf);
-
-                            amf = new RtmpAmfObject();
-                            amf.Strings.Add("level", "status");
-                            amf.Strings.Add("code", "NetConnection.Connect.Success");
-                            amf.Strings.Add("description", "Connection succeeded.");
-                            amf.Numbers.Add("clientId", this.sessionId);
-                            amf.Numbers.Add("objectEncoding", 0); // AMF0
-                            pars.Add(amf);
-
-                            RtmpMessageCommand sendComm = new RtmpMessageCommand("_result", 1, pars);
+                            RtmpMessageCommandReply sendComm = new RtmpMessageCommandReply(RtmpMessageCommandReply.ConnectResult, (double)this.sessionId);
                             sendComm.ChunkStreamId = recvComm.ChunkStreamId;
                             sendComm.MessageStreamId = recvComm.MessageStreamId;
 
@@ -672,18 +761,7 @@
 
                         Global.Log.DebugFormat("Received command {0}", msg.MessageType);
 
-                        List<object> pars = new List<object>();
-
-                        pars.Add(new RtmpAmfNull());
-
-                        RtmpAmfObject amf = new RtmpAmfObject();
-                        amf.Strings.Add("level", "status");
-                        amf.Strings.Add("code", "NetStream.Publish.Start");
-                        amf.Strings.Add("description", "FCPublish to stream " + publishStreamName);
-                        amf.Numbers.Add("clientId", this.sessionId);
-                        pars.Add(amf);
-
-                        RtmpMessageCommand sendComm = new RtmpMessageCommand("onFCPublish", 0, pars);
+                        RtmpMessageCommandReply sendComm = new RtmpMessageCommandReply(RtmpMessageCommandReply.OnFCPublish, "FCPublish to stream " + publishStreamName, (double)this.sessionId);
                         sendComm.ChunkStreamId = recvComm.ChunkStreamId;
                         sendComm.MessageStreamId = recvComm.MessageStreamId;
 
@@ -710,11 +788,7 @@
                         this.parser.RegisterMessageStream(this.messageStreamCounter);
                         this.messageStreams.Add(this.messageStreamCounter, new RtmpMessageStream(this.messageStreamCounter));
 
-                        List<object> pars = new List<object>();
-                        pars.Add(new RtmpAmfNull());
-                        pars.Add((double)this.messageStreamCounter++);
-
-                        RtmpMessageCommand sendComm = new RtmpMessageCommand("_result", recvComm.TransactionId, pars);
+                        RtmpMessageCommandReply sendComm = new RtmpMessageCommandReply(RtmpMessageCommandReply.CreateStreamResult, (double)recvComm.TransactionId, (double)this.messageStreamCounter++);
                         sendComm.ChunkStreamId = recvComm.ChunkStreamId;
                         sendComm.MessageStreamId = recvComm.MessageStreamId;
 
@@ -844,6 +918,7 @@
                         messageStream.PublishName = publishName;
                         messageStream.FullPublishName = fullPublishName;
                         messageStream.Publishing = true; // creating segmenter
+                        this.statistics = messageStream.Statistics;
 
                         // prepare reply
                         Global.Log.DebugFormat("Received command {0}", msg.MessageType);
@@ -852,18 +927,7 @@
                         this.parser.Encode(new RtmpMessageUserControl(RtmpMessageUserControl.EventTypes.StreamBegin, recvComm.MessageStreamId));
 
                         {
-                            List<object> pars = new List<object>();
-
-                            pars.Add(new RtmpAmfNull());
-
-                            RtmpAmfObject amf = new RtmpAmfObject();
-                            amf.Strings.Add("level", "status");
-                            amf.Strings.Add("code", "NetStream.Publish.Start");
-                            amf.Strings.Add("description", "Publishing " + messageStream.FullPublishName);
-                            amf.Numbers.Add("clientId", this.sessionId);
-                            pars.Add(amf);
-
-                            RtmpMessageCommand sendComm = new RtmpMessageCommand("onStatus", 0, pars);
+                            RtmpMessageCommandReply sendComm = new RtmpMessageCommandReply(RtmpMessageCommandReply.PublishStart, "Publishing " + messageStream.FullPublishName, (double)this.sessionId);
                             sendComm.ChunkStreamId = recvComm.ChunkStreamId;
                             sendComm.MessageStreamId = recvComm.MessageStreamId;
 
@@ -925,6 +989,7 @@
                         {
                             if (messageStream.FullPublishName == publishName)
                             {
+                                this.DetachStatistics(messageStream);
                                 messageStream.Publishing = false;
                                 Global.Log.DebugFormat("Unpublished message stream {0}, publish name {1}", messageStream.MessageStreamId, messageStream.FullPublishName);
                             }
@@ -987,6 +1052,7 @@
                         // just in case reset publising flag one more time
                         if (this.messageStreams.ContainsKey(msg.MessageStreamId))
                         {
+                            this.DetachStatistics(this.messageStreams[msg.MessageStreamId]);
                             this.messageStreams[msg.MessageStreamId].Publishing = false;
                             Global.Log.DebugFormat("Closed message stream {0}", msg.MessageStreamId);
                         }
@@ -1019,6 +1085,7 @@
                         int messageStreamId = (int)(double)recvComm.Parameters[1];
                         if (this.messageStreams.ContainsKey(messageStreamId))
                         {
+                            this.DetachStatistics(this.messageStreams[messageStreamId]);
                             this.messageStreams[messageStreamId].Dispose();
                             this.messageStreams.Remove(messageStreamId);
                             Global.Log.DebugFormat("Deleted message stream {0}", messageStreamId);
@@ -1143,11 +1210,99 @@
             }
         }
 
+        /// <summary>
+        /// Passes media messages demuxed by the native demuxer straight to their message stream
+        /// </summary>
+        /// <param name="messages">Demuxed messages</param>
+        /// <param name="offset">Index of the first media message</param>
+        /// <param name="count">Number of consecutive media messages</param>
+        /// <returns>Number of messages taken, the rest is decoded and processed as usual</returns>
+        private int IngestMediaMessages(RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages, int offset, int count)
+        {
+            RtmpMessageStream messageStream = null;
+            if (this.state != RtmpSessionState.Receiving || !this.messageStreams.TryGetValue(messages[offset].nMessageStreamId, out messageStream))
+            {
+                return 0;
+            }
+
+            int handled = 0;
+
+            try
+            {
+                handled = messageStream.IngestMediaMessages(messages, offset, count);
+            }
+            catch (CriticalStreamException unex)
+            {
+                Global.Log.Error(unex.Message);
+                this.transport.Disconnect(this.sessionEndPoint);
+                return count;
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Failed to process media data: {0}", ex.ToString());
+                return count;
+            }
+
+            if (handled > 0)
+            {
+                this.lastActivity = DateTime.Now;
+
+                if (this.routeReceiveEventState == 0)
+                {
+                    lock (this.receivedPackets)
+                    {
+                        // we're ready to re-route socket receive event to this RTMP session
+                        this.routeReceiveEventState = 1;
+                    }
+                }
+            }
+
+            return handled;
+        }
+
+        /// <summary>
+        /// Pushes media data queued by message streams
+        /// </summary>
+        private void FlushMessageStreams()
+        {
+            foreach (RtmpMessageStream messageStream in this.messageStreams.Values)
+            {
+                try
+                {
+                    messageStream.Flush();
+                }
+                catch (CriticalStreamException unex)
+                {
+                    Global.Log.Error(unex.Message);
+                    this.transport.Disconnect(this.sessionEndPoint);
+                }
+                catch (Exception ex)
+                {
+                    Global.Log.ErrorFormat("Failed to push media data: {0}", ex.ToString());
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops recording session's receive statistics to the message stream's ones, called before
+        /// the message stream stops publishing and closes them
+        /// </summary>
+        /// <param name="messageStream">Message stream</param>
+        private void DetachStatistics(RtmpMessageStream messageStream)
+        {
+            if (messageStream.Statistics != null && messageStream.Statistics == this.statistics)
+            {
+                this.statistics = null;
+            }
+        }
+
         /// <summary>
         /// Releases all message streams
         /// </summary>
         private void ReleaseMessageStreams()
         {
+            this.statistics = null;
+
             foreach (RtmpMessageStream messageStream in this.messageStreams.Values)
             {
                 messageStream.Dispose();
@@ -0,0 +1,683 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Runtime.InteropServices;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// Transmuxes FLV files to Smooth Streaming files offline. Every file is memory mapped and runs through
+    /// its own mux, which takes tag payloads straight from the mapped view, so the only copy of media data
+    /// is the one into fragments. Files are spread over a worker pool, one file per worker at a time.
+    /// AAC and AVC tracks become fragmented MP4 files (isma, ismv) of header, fragments and mfra index
+    /// </summary>
+    public class SmoothStreamingBatchTransmuxer
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// FLV sound format of AAC
+        /// </summary>
+        private const int AacSoundFormat = 10;
+
+        /// <summary>
+        /// FLV codec id of AVC
+        /// </summary>
+        private const int AvcCodecId = 7;
+
+        /// <summary>
+        /// AAC/AVC packet type of codec configuration
+        /// </summary>
+        private const int PacketTypeConfig = 0;
+
+        /// <summary>
+        /// AAC/AVC packet type of media
+        /// </summary>
+        private const int PacketTypeMedia = 1;
+
+        /// <summary>
+        /// Size of file write buffer
+        /// </summary>
+        private const int FileBufferSize = 256 * 1024;
+
+        /// <summary>
+        /// Folder output files are written to
+        /// </summary>
+        private string outputFolder = null;
+
+        /// <summary>
+        /// Number of files transmuxed in parallel
+        /// </summary>
+        private int workerCount = 0;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SmoothStreamingBatchTransmuxer
+        /// </summary>
+        /// <param name="outputFolder">Folder output files are written to</param>
+        /// <param name="workerCount">Number of files transmuxed in parallel</param>
+        public SmoothStreamingBatchTransmuxer(string outputFolder, int workerCount)
+        {
+            this.outputFolder = outputFolder;
+            this.workerCount = workerCount;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Transmuxes files, returns when all of them are done. Output files are named after the input
+        /// file, existing ones are overwritten. A file named as an earlier one from another folder would
+        /// overwrite its output, such files are skipped
+        /// </summary>
+        /// <param name="paths">FLV files</param>
+        /// <returns>Number of files transmuxed successfully</returns>
+        public int Run(IEnumerable<string> paths)
+        {
+            List<string> files = new List<string>();
+            Dictionary<string, string> outputNames = new Dictionary<string, string>(StringComparer.OrdinalIgnoreCase);
+            int transmuxed = 0;
+
+            foreach (string path in paths)
+            {
+                string name = Path.GetFileNameWithoutExtension(path);
+                string firstPath = null;
+                if (outputNames.TryGetValue(name, out firstPath))
+                {
+                    Global.Log.ErrorFormat("Skipped {0}: output files are named as the ones of {1}", path, firstPath);
+                    continue;
+                }
+
+                outputNames.Add(name, path);
+                files.Add(path);
+            }
+
+            Directory.CreateDirectory(this.outputFolder);
+
+            using (CountdownEvent done = new CountdownEvent(files.Count))
+            {
+                using (WorkerPool pool = new WorkerPool("Transmux", this.workerCount))
+                {
+                    foreach (string path in files)
+                    {
+                        string file = path;
+                        ScheduledWork work = new ScheduledWork(pool, () =>
+                        {
+                            try
+                            {
+                                if (this.TransmuxFile(file))
+                                {
+                                    Interlocked.Increment(ref transmuxed);
+                                }
+                            }
+                            finally
+                            {
+                                done.Signal();
+                            }
+                        });
+
+                        // runs once, nothing schedules it again
+                        work.Schedule();
+                    }
+
+                    done.Wait();
+                }
+            }
+
+            return transmuxed;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Transmuxes one file, errors are logged
+        /// </summary>
+        /// <param name="path">FLV file</param>
+        /// <returns>True if transmuxed</returns>
+        private bool TransmuxFile(string path)
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            List<Track> tracks = new List<Track>();
+            SmoothStreamingSegmenter.MCSSF_BUFFER output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            int muxId = -1;
+
+            try
+            {
+                using (FlvFileReader reader = new FlvFileReader(path))
+                {
+                    Track audio = new Track { ContentType = MediaContentType.Audio, MuxerStreamId = -1 };
+                    Track video = new Track { ContentType = MediaContentType.Video, MuxerStreamId = -1 };
+                    RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages = SmoothStreamingBatchTransmuxer.ReadTags(reader, audio, video);
+
+                    muxId = SmoothStreamingBatchTransmuxer.InitializeMux();
+                    if (muxId < 0)
+                    {
+                        throw new InvalidOperationException(string.Format("MCSSF_Initialize failed {0}", muxId));
+                    }
+
+                    foreach (Track track in new Track[] { video, audio })
+                    {
+                        if (track.Config != IntPtr.Zero)
+                        {
+                            this.AddTrack(muxId, path, track);
+                            tracks.Add(track);
+                        }
+                    }
+
+                    if (tracks.Count == 0)
+                    {
+                        throw new InvalidDataException(string.Format("{0} has no AAC or AVC track", path));
+                    }
+
+                    foreach (Track track in tracks)
+                    {
+                        SmoothStreamingBatchTransmuxer.WriteHeader(muxId, track, ref output);
+                    }
+
+                    SmoothStreamingBatchTransmuxer.IngestTags(muxId, messages, audio, video, ref output);
+
+                    foreach (Track track in tracks)
+                    {
+                        SmoothStreamingBatchTransmuxer.EndTrack(muxId, track, ref output);
+                    }
+                }
+
+                foreach (Track track in tracks)
+                {
+                    track.File.Dispose();
+                    track.File = null;
+                }
+
+                stopwatch.Stop();
+                Global.Log.InfoFormat(
+                    "Transmuxed {0}: {1}, {2:0.0} MB in {3:0.00} s",
+                    path,
+                    string.Join(", ", tracks.Select(track => string.Format("{0} {1} kbps, {2} fragments", track.ContentType, track.Bitrate / 1000, track.Fragments)).ToArray()),
+                    tracks.Sum(track => track.Bytes) / 1048576.0,
+                    stopwatch.Elapsed.TotalSeconds);
+
+                return true;
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Failed to transmux {0}: {1}", path, ex.ToString());
+
+                // don't leave incomplete files behind
+                foreach (Track track in tracks)
+                {
+                    if (track.File != null)
+                    {
+                        track.File.Dispose();
+                        track.File = null;
+
+                        try
+                        {
+                            File.Delete(track.Path);
+                        }
+                        catch (Exception deleteEx)
+                        {
+                            Global.Log.WarnFormat("Failed to delete {0}: {1}", track.Path, deleteEx.Message);
+                        }
+                    }
+                }
+
+                return false;
+            }
+            finally
+            {
+                if (muxId >= 0)
+                {
+                    SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+                }
+
+                if (output.pData != IntPtr.Zero)
+                {
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref output);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Walks FLV tags, collecting codec configuration and statistics of AAC and AVC tracks.
+        /// Only the first codec configuration of a track is used, media preceding it is skipped
+        /// as well as media of other codecs
+        /// </summary>
+        /// <param name="reader">FLV file</param>
+        /// <param name="audio">Audio track</param>
+        /// <param name="video">Video track</param>
+        /// <returns>Media messages to ingest, pointing to the mapped file</returns>
+        private static RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] ReadTags(FlvFileReader reader, Track audio, Track video)
+        {
+            List<RtmpProtocolParser.MCSSF_RTMP_MESSAGE> messages = new List<RtmpProtocolParser.MCSSF_RTMP_MESSAGE>();
+            FlvTagHeader header = new FlvTagHeader();
+            IntPtr tagData = IntPtr.Zero;
+
+            while (reader.ReadTag(header, out tagData))
+            {
+                int dataSize = (int)header.DataSize;
+                if ((header.TagType != RtmpMessageType.Audio && header.TagType != RtmpMessageType.Video) || dataSize < 2)
+                {
+                    continue;
+                }
+
+                byte flags = Marshal.ReadByte(tagData);
+                byte packetType = Marshal.ReadByte(tagData, 1);
+                Track track = null;
+                int headerSize = 0;
+
+                if (header.TagType == RtmpMessageType.Audio && (flags >> 4) == SmoothStreamingBatchTransmuxer.AacSoundFormat)
+                {
+                    track = audio;
+                    headerSize = 2;
+                }
+                else if (header.TagType == RtmpMessageType.Video && (flags & 0x0F) == SmoothStreamingBatchTransmuxer.AvcCodecId && dataSize >= 5)
+                {
+                    track = video;
+                    headerSize = 5;
+                }
+                else
+                {
+                    continue;
+                }
+
+                if (packetType == SmoothStreamingBatchTransmuxer.PacketTypeConfig)
+                {
+                    if (track.Config == IntPtr.Zero)
+                    {
+                        track.Config = IntPtr.Add(tagData, headerSize);
+                        track.ConfigSize = dataSize - headerSize;
+                    }
+
+                    continue;
+                }
+
+                if (packetType != SmoothStreamingBatchTransmuxer.PacketTypeMedia || track.Config == IntPtr.Zero)
+                {
+                    continue;
+                }
+
+                long timestamp = header.Timestamp;
+                if (track.Samples == 0)
+                {
+                    track.FirstTimestamp = timestamp;
+                }
+
+                track.PreviousTimestamp = track.Samples > 0 ? track.LastTimestamp : timestamp;
+                track.LastTimestamp = timestamp;
+                track.Bytes += dataSize - headerSize;
+                track.Samples++;
+
+                RtmpProtocolParser.MCSSF_RTMP_MESSAGE message = new RtmpProtocolParser.MCSSF_RTMP_MESSAGE();
+                message.nMessageType = (int)header.TagType;
+                message.nTimestamp = header.Timestamp;
+                message.nDataSize = dataSize;
+                message.pData = tagData;
+                messages.Add(message);
+            }
+
+            if (reader.Truncated)
+            {
+                Global.Log.WarnFormat("{0} is truncated at {1}", reader.Path, reader.Position);
+            }
+
+            return messages.ToArray();
+        }
+
+        /// <summary>
+        /// Creates new mux and applies fragmentation settings to it. Fragments aren't split
+        /// into chunks, low latency doesn't matter for files
+        /// </summary>
+        /// <returns>Mux id, less than zero if error</returns>
+        private static int InitializeMux()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            if (muxId < 0)
+            {
+                return muxId;
+            }
+
+            long msToHns = Global.SmoothStreamingTimescale / 1000;
+
+            SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY policy = new SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY();
+            policy.nMaxDuration = Properties.Settings.Default.MaxFragmentDuration * msToHns;
+
+            policy.nDuration = Properties.Settings.Default.VideoFragmentDuration * msToHns;
+            if (SmoothStreamingSegmenter.MCSSF_SetDefaultFragmentPolicy(muxId, 2 /* video */, ref policy) < 0)
+            {
+                Global.Log.ErrorFormat("Invalid video fragment settings: duration {0} ms, max duration {1} ms", Properties.Settings.Default.VideoFragmentDuration, Properties.Settings.Default.MaxFragmentDuration);
+            }
+
+            policy.nDuration = Properties.Settings.Default.AudioFragmentDuration * msToHns;
+            policy.bAlignToVideo = Properties.Settings.Default.AlignAudioFragments ? 1 : 0;
+            if (SmoothStreamingSegmenter.MCSSF_SetDefaultFragmentPolicy(muxId, 1 /* audio */, ref policy) < 0)
+            {
+                Global.Log.ErrorFormat("Invalid audio fragment settings: duration {0} ms, max duration {1} ms", Properties.Settings.Default.AudioFragmentDuration, Properties.Settings.Default.MaxFragmentDuration);
+            }
+
+            return muxId;
+        }
+
+        /// <summary>
+        /// Adds track to the mux and creates its output file
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="path">FLV file</param>
+        /// <param name="track">Track with codec configuration</param>
+        private void AddTrack(int muxId, string path, Track track)
+        {
+            // average bitrate of the file as FLV doesn't carry it reliably
+            long duration = track.LastTimestamp - track.FirstTimestamp;
+            track.Bitrate = duration > 0 ? (int)(track.Bytes * 8 * 1000 / duration) : 0;
+
+            SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG config = new SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG();
+            config.nStreamType = track.ContentType == MediaContentType.Video ? 2 : 1;
+            config.nBitrate = track.Bitrate;
+            config.nConfigSize = track.ConfigSize;
+            config.pConfig = track.Config;
+
+            track.MuxerStreamId = SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref config);
+            if (track.MuxerStreamId < 0)
+            {
+                throw new InvalidDataException(string.Format("MCSSF_AddStreamConfig failed {0} for {1} of {2}", track.MuxerStreamId, track.ContentType, path));
+            }
+
+            track.Path = Path.Combine(
+                this.outputFolder,
+                Path.GetFileNameWithoutExtension(path) + (track.ContentType == MediaContentType.Video ? ".ismv" : ".isma"));
+            track.File = new FileStream(track.Path, FileMode.Create, FileAccess.Write, FileShare.Read, SmoothStreamingBatchTransmuxer.FileBufferSize);
+        }
+
+        /// <summary>
+        /// Writes header to track's file
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="track">Track</param>
+        /// <param name="output">Pooled output buffer, replaced by a bigger one if necessary</param>
+        private static void WriteHeader(int muxId, Track track, ref SmoothStreamingSegmenter.MCSSF_BUFFER output)
+        {
+            int capacity = Global.SegmentBufferSize;
+
+            while (true)
+            {
+                SmoothStreamingBatchTransmuxer.AcquireOutput(ref output, capacity);
+
+                int dataSize = output.nCapacity;
+                IntPtr data = output.pData;
+                int res = SmoothStreamingSegmenter.MCSSF_GetHeader(muxId, track.MuxerStreamId, ref dataSize, ref data);
+                if (res == -2)
+                {
+                    capacity = dataSize;
+                    continue;
+                }
+                else if (res < 0)
+                {
+                    throw new InvalidOperationException(string.Format("MCSSF_GetHeader failed {0} for {1}", res, track.ContentType));
+                }
+
+                track.Write(data, dataSize);
+                break;
+            }
+        }
+
+        /// <summary>
+        /// Pushes media messages to the mux, writing completed fragments to files of their tracks
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="messages">Media messages of the tracks added to the mux</param>
+        /// <param name="audio">Audio track</param>
+        /// <param name="video">Video track</param>
+        /// <param name="output">Pooled output buffer, replaced by a bigger one if necessary</param>
+        private static void IngestTags(int muxId, RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages, Track audio, Track video, ref SmoothStreamingSegmenter.MCSSF_BUFFER output)
+        {
+            SmoothStreamingSegmenter.MCSSF_INGEST_CONTEXT context = new SmoothStreamingSegmenter.MCSSF_INGEST_CONTEXT();
+            context.nAudioStreamId = audio.MuxerStreamId;
+            context.nVideoStreamId = video.MuxerStreamId;
+
+            SmoothStreamingSegmenter.MCSSF_FRAGMENT[] fragments = new SmoothStreamingSegmenter.MCSSF_FRAGMENT[Global.SmoothStreamingMaxBatchSegments];
+            int capacity = Global.SegmentBufferSize;
+            int position = 0;
+
+            GCHandle messagesHandle = GCHandle.Alloc(messages, GCHandleType.Pinned);
+            try
+            {
+                while (position < messages.Length)
+                {
+                    SmoothStreamingBatchTransmuxer.AcquireOutput(ref output, capacity);
+
+                    SmoothStreamingSegmenter.MCSSF_BUFFER batch = output;
+                    int fragmentCount = 0;
+                    int res = SmoothStreamingSegmenter.MCSSF_IngestMessages(
+                        muxId,
+                        ref context,
+                        Marshal.UnsafeAddrOfPinnedArrayElement(messages, position),
+                        messages.Length - position,
+                        ref batch,
+                        fragments,
+                        fragments.Length,
+                        out fragmentCount);
+
+                    if (res == -6)
+                    {
+                        // fragment doesn't fit, nothing was consumed by the muxer so take a bigger buffer and repeat
+                        capacity = batch.nDataSize;
+                        continue;
+                    }
+                    else if (res < 0)
+                    {
+                        throw new InvalidDataException(string.Format("MCSSF_IngestMessages failed {0}, timestamp {1}", res, messages[position].nTimestamp));
+                    }
+
+                    for (int i = 0; i < fragmentCount; ++i)
+                    {
+                        Track track = fragments[i].nStreamId == video.MuxerStreamId ? video : audio;
+                        track.Write(IntPtr.Add(output.pData, fragments[i].nOffset), fragments[i].nDataSize);
+                        track.Fragments++;
+                    }
+
+                    // all messages belong to added tracks, but don't get stuck on one the muxer refuses
+                    position += Math.Max(res, 1);
+                }
+            }
+            finally
+            {
+                messagesHandle.Free();
+            }
+        }
+
+        /// <summary>
+        /// Completes the last fragment of a track and writes index to its file
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="track">Track</param>
+        /// <param name="output">Pooled output buffer, replaced by a bigger one if necessary</param>
+        private static void EndTrack(int muxId, Track track, ref SmoothStreamingSegmenter.MCSSF_BUFFER output)
+        {
+            long msToHns = Global.SmoothStreamingTimescale / 1000;
+
+            // the last sample is assumed to last as long as the one before it
+            long endTime = (2 * track.LastTimestamp - track.PreviousTimestamp) * msToHns;
+            int capacity = Global.SegmentBufferSize;
+
+            while (true)
+            {
+                SmoothStreamingBatchTransmuxer.AcquireOutput(ref output, capacity);
+
+                SmoothStreamingSegmenter.MCSSF_BUFFER fragment = output;
+                int res = SmoothStreamingSegmenter.MCSSF_EndStream(muxId, track.MuxerStreamId, endTime, ref fragment);
+                if (res == -6)
+                {
+                    capacity = fragment.nDataSize;
+                    continue;
+                }
+                else if (res < 0)
+                {
+                    throw new InvalidOperationException(string.Format("MCSSF_EndStream failed {0} for {1}", res, track.ContentType));
+                }
+
+                if (res > 0)
+                {
+                    track.Write(fragment.pData, fragment.nDataSize);
+                    track.Fragments++;
+                }
+
+                break;
+            }
+
+            while (true)
+            {
+                SmoothStreamingBatchTransmuxer.AcquireOutput(ref output, capacity);
+
+                int dataSize = output.nCapacity;
+                IntPtr data = output.pData;
+                int res = SmoothStreamingSegmenter.MCSSF_GetIndex(muxId, track.MuxerStreamId, ref dataSize, ref data);
+                if (res == -2)
+                {
+                    capacity = dataSize;
+                    continue;
+                }
+                else if (res < 0)
+                {
+                    throw new InvalidOperationException(string.Format("MCSSF_GetIndex failed {0} for {1}", res, track.ContentType));
+                }
+
+                track.Write(data, dataSize);
+                break;
+            }
+        }
+
+        /// <summary>
+        /// Takes output buffer of specified capacity from the native pool unless the current one is big enough
+        /// </summary>
+        /// <param name="output">Output buffer, empty if none is taken yet</param>
+        /// <param name="capacity">Minimum capacity</param>
+        private static void AcquireOutput(ref SmoothStreamingSegmenter.MCSSF_BUFFER output, int capacity)
+        {
+            if (output.pData != IntPtr.Zero)
+            {
+                if (output.nCapacity >= capacity)
+                {
+                    return;
+                }
+
+                SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref output);
+                output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            }
+
+            if (SmoothStreamingSegmenter.MCSSF_AcquireBuffer(capacity, ref output) < 0)
+            {
+                throw new OutOfMemoryException(string.Format("MCSSF_AcquireBuffer failed for {0} bytes", capacity));
+            }
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Track of the file being transmuxed and its output file
+        /// </summary>
+        private class Track
+        {
+            /// <summary>
+            /// Buffer fragments are copied through to the file
+            /// </summary>
+            private byte[] copyBuffer = null;
+
+            /// <summary>
+            /// Gets or sets content type
+            /// </summary>
+            public MediaContentType ContentType { get; set; }
+
+            /// <summary>
+            /// Gets or sets muxer's stream id, -1 if not added
+            /// </summary>
+            public int MuxerStreamId { get; set; }
+
+            /// <summary>
+            /// Gets or sets codec configuration in the mapped file, IntPtr.Zero if not found
+            /// </summary>
+            public IntPtr Config { get; set; }
+
+            /// <summary>
+            /// Gets or sets codec configuration size
+            /// </summary>
+            public int ConfigSize { get; set; }
+
+            /// <summary>
+            /// Gets or sets number of samples
+            /// </summary>
+            public int Samples { get; set; }
+
+            /// <summary>
+            /// Gets or sets size of all samples
+            /// </summary>
+            public long Bytes { get; set; }
+
+            /// <summary>
+            /// Gets or sets average bitrate
+            /// </summary>
+            public int Bitrate { get; set; }
+
+            /// <summary>
+            /// Gets or sets timestamp of the first sample, in ms
+            /// </summary>
+            public long FirstTimestamp { get; set; }
+
+            /// <summary>
+            /// Gets or sets timestamp of the sample before the last one, in ms
+            /// </summary>
+            public long PreviousTimestamp { get; set; }
+
+            /// <summary>
+            /// Gets or sets timestamp of the last sample, in ms
+            /// </summary>
+            public long LastTimestamp { get; set; }
+
+            /// <summary>
+            /// Gets or sets number of written fragments
+            /// </summary>
+            public int Fragments { get; set; }
+
+            /// <summary>
+            /// Gets or sets output file path
+            /// </summary>
+            public string Path { get; set; }
+
+            /// <summary>
+            /// Gets or sets output file
+            /// </summary>
+            public FileStream File { get; set; }
+
+            /// <summary>
+            /// Appends native data to output file
+            /// </summary>
+            /// <param name="data">Data</param>
+            /// <param name="dataSize">Data size</param>
+            public void Write(IntPtr data, int dataSize)
+            {
+                if (this.copyBuffer == null || this.copyBuffer.Length < dataSize)
+                {
+                    this.copyBuffer = new byte[dataSize];
+                }
+
+                Marshal.Copy(data, this.copyBuffer, 0, dataSize);
+                this.File.Write(this.copyBuffer, 0, dataSize);
+            }
+        }
+
+        #endregion
+    }
+}
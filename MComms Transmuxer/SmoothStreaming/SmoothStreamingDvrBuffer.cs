@@ -0,0 +1,763 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.IO;
+    using System.Linq;
+    using System.Runtime.InteropServices;
+    using System.Text;
+    using System.Xml;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// In-memory DVR window of one publishing point served by the embedded origin. Keeps the track
+    /// description from each stream header (live server manifest box) and the fragments of the last
+    /// window length, indexed by their start time (tfxd box).
+    /// The client manifest is maintained incrementally: quality levels are serialized when tracks change,
+    /// the chunk entry of a fragment when it's added, and the assembled manifest is cached until the next
+    /// change, so manifest requests don't build any XML.
+    /// </summary>
+    public class SmoothStreamingDvrBuffer
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Live server manifest box UUID
+        /// </summary>
+        private static readonly byte[] LiveServerManifestUuid = { 0xA5, 0xD4, 0x0B, 0x30, 0xE8, 0x14, 0x11, 0xDD, 0xBA, 0x2F, 0x08, 0x00, 0x20, 0x0C, 0x9A, 0x66 };
+
+        /// <summary>
+        /// Fragment time box UUID
+        /// </summary>
+        private static readonly byte[] TfxdUuid = { 0x6D, 0x1D, 0x9B, 0x05, 0x42, 0xD5, 0x44, 0xE6, 0x80, 0xE2, 0x14, 0x1D, 0xAF, 0xF7, 0x57, 0xB2 };
+
+        /// <summary>
+        /// Publishing point name
+        /// </summary>
+        private string name = null;
+
+        /// <summary>
+        /// DVR window length in hns
+        /// </summary>
+        private long windowLength = 0;
+
+        /// <summary>
+        /// Tracks in registration order
+        /// </summary>
+        private List<DvrTrack> tracks = new List<DvrTrack>();
+
+        /// <summary>
+        /// Serialized QualityLevel elements of video tracks, null when tracks have changed
+        /// </summary>
+        private byte[] videoQualityLevels = null;
+
+        /// <summary>
+        /// Serialized QualityLevel elements of audio tracks, null when tracks have changed
+        /// </summary>
+        private byte[] audioQualityLevels = null;
+
+        /// <summary>
+        /// Cached client manifest, null when the DVR window has changed
+        /// </summary>
+        private byte[] manifest = null;
+
+        /// <summary>
+        /// Mux producing HLS output of the publishing point, -1 if none
+        /// </summary>
+        private volatile int hlsMuxId = -1;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SmoothStreamingDvrBuffer
+        /// </summary>
+        /// <param name="name">Publishing point name</param>
+        /// <param name="windowLength">DVR window length in hns</param>
+        public SmoothStreamingDvrBuffer(string name, long windowLength)
+        {
+            this.name = name;
+            this.windowLength = windowLength;
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets publishing point name
+        /// </summary>
+        public string Name
+        {
+            get
+            {
+                return this.name;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets id of the mux producing HLS output of the publishing point, -1 if none.
+        /// HLS playlists and segments are kept by the mux itself.
+        /// </summary>
+        public int HlsMuxId
+        {
+            get
+            {
+                return this.hlsMuxId;
+            }
+
+            set
+            {
+                this.hlsMuxId = value;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Sets header of the stream, the stream's fragments are dropped if it was known already
+        /// </summary>
+        /// <param name="streamId">Stream GUID</param>
+        /// <param name="data">Native buffer with header data</param>
+        /// <param name="length">Header data length</param>
+        public void SetHeader(Guid streamId, IntPtr data, int length)
+        {
+            byte[] header = new byte[length];
+            Marshal.Copy(data, header, 0, length);
+
+            DvrTrack track = SmoothStreamingDvrBuffer.ParseHeader(header);
+            if (track == null)
+            {
+                Global.Log.ErrorFormat("No live server manifest in header of stream {0}, stream is not served by origin", streamId);
+                return;
+            }
+
+            track.StreamId = streamId;
+
+            lock (this)
+            {
+                int index = this.tracks.FindIndex(t => t.StreamId == streamId);
+                if (index >= 0)
+                {
+                    this.tracks[index] = track;
+                }
+                else
+                {
+                    this.tracks.Add(track);
+                }
+
+                this.InvalidateTracks();
+            }
+        }
+
+        /// <summary>
+        /// Adds fragment (or chunk of a fragment) of the stream, fragments which have left the DVR window are dropped
+        /// </summary>
+        /// <param name="streamId">Stream GUID</param>
+        /// <param name="data">Native buffer with moof and mdat</param>
+        /// <param name="length">Data length</param>
+        public void AddFragment(Guid streamId, IntPtr data, int length)
+        {
+            byte[] fragmentData = new byte[length];
+            Marshal.Copy(data, fragmentData, 0, length);
+
+            long time = 0;
+            long duration = 0;
+            bool startsWithSyncSample = true;
+            if (!SmoothStreamingDvrBuffer.ParseFragment(fragmentData, out time, out duration, out startsWithSyncSample))
+            {
+                Global.Log.ErrorFormat("Invalid fragment of stream {0}, {1} bytes", streamId, length);
+                return;
+            }
+
+            lock (this)
+            {
+                DvrTrack track = this.tracks.Find(t => t.StreamId == streamId);
+                if (track == null)
+                {
+                    return;
+                }
+
+                DvrFragment last = track.Fragments.Count > 0 ? track.Fragments[track.Fragments.Count - 1] : null;
+                if (last != null && time < last.Time)
+                {
+                    // timeline went back, old fragments are useless
+                    track.Fragments.Clear();
+                    last = null;
+                }
+
+                if (last != null && track.IsVideo && !startsWithSyncSample && time == last.Time + last.Duration)
+                {
+                    // chunk continuing the last fragment, clients get all its moof + mdat pairs at once
+                    byte[] merged = new byte[last.Data.Length + fragmentData.Length];
+                    Buffer.BlockCopy(last.Data, 0, merged, 0, last.Data.Length);
+                    Buffer.BlockCopy(fragmentData, 0, merged, last.Data.Length, fragmentData.Length);
+                    last.Data = merged;
+                    last.Duration += duration;
+                    last.ManifestEntry = SmoothStreamingDvrBuffer.SerializeManifestEntry(last);
+                }
+                else
+                {
+                    DvrFragment fragment = new DvrFragment();
+                    fragment.Time = time;
+                    fragment.Duration = duration;
+                    fragment.Data = fragmentData;
+                    fragment.ManifestEntry = SmoothStreamingDvrBuffer.SerializeManifestEntry(fragment);
+                    track.Fragments.Add(fragment);
+                }
+
+                // drop fragments which have left the window entirely
+                long windowStart = time + duration - this.windowLength;
+                int expired = 0;
+                while (expired < track.Fragments.Count - 1 && track.Fragments[expired].Time + track.Fragments[expired].Duration <= windowStart)
+                {
+                    ++expired;
+                }
+
+                if (expired > 0)
+                {
+                    track.Fragments.RemoveRange(0, expired);
+                }
+
+                this.manifest = null;
+            }
+        }
+
+        /// <summary>
+        /// Removes stream with all its fragments
+        /// </summary>
+        /// <param name="streamId">Stream GUID</param>
+        public void RemoveTrack(Guid streamId)
+        {
+            lock (this)
+            {
+                this.tracks.RemoveAll(t => t.StreamId == streamId);
+                this.InvalidateTracks();
+            }
+        }
+
+        /// <summary>
+        /// Removes all streams, called when the publishing point is restarted with a new header
+        /// </summary>
+        public void Clear()
+        {
+            lock (this)
+            {
+                this.tracks.Clear();
+                this.InvalidateTracks();
+            }
+        }
+
+        /// <summary>
+        /// Returns client manifest of the current DVR window, the same instance is returned until the window changes
+        /// </summary>
+        /// <returns>Client manifest XML in UTF-8, must not be modified</returns>
+        public byte[] GetManifest()
+        {
+            lock (this)
+            {
+                if (this.manifest == null)
+                {
+                    this.manifest = this.BuildManifest();
+                }
+
+                return this.manifest;
+            }
+        }
+
+        /// <summary>
+        /// Finds fragment by its quality level and start time
+        /// </summary>
+        /// <param name="streamType">Stream type, "video" or "audio"</param>
+        /// <param name="bitrate">Quality level bitrate</param>
+        /// <param name="time">Fragment start time in hns</param>
+        /// <returns>Fragment data or null if the fragment isn't in the DVR window</returns>
+        public byte[] GetFragment(string streamType, int bitrate, long time)
+        {
+            bool video = string.Compare(streamType, "video", StringComparison.OrdinalIgnoreCase) == 0;
+
+            lock (this)
+            {
+                DvrTrack track = this.tracks.Find(t => t.IsVideo == video && t.Bitrate == bitrate);
+                if (track == null)
+                {
+                    return null;
+                }
+
+                int lo = 0;
+                int hi = track.Fragments.Count - 1;
+                while (lo <= hi)
+                {
+                    int mid = (lo + hi) / 2;
+                    long midTime = track.Fragments[mid].Time;
+                    if (midTime == time)
+                    {
+                        return track.Fragments[mid].Data;
+                    }
+                    else if (midTime < time)
+                    {
+                        lo = mid + 1;
+                    }
+                    else
+                    {
+                        hi = mid - 1;
+                    }
+                }
+
+                return null;
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Drops everything serialized from track descriptions
+        /// </summary>
+        private void InvalidateTracks()
+        {
+            this.videoQualityLevels = null;
+            this.audioQualityLevels = null;
+            this.manifest = null;
+        }
+
+        /// <summary>
+        /// Assembles client manifest from the serialized quality levels and chunk entries
+        /// </summary>
+        /// <returns>Client manifest XML in UTF-8</returns>
+        private byte[] BuildManifest()
+        {
+            MemoryStream output = new MemoryStream();
+
+            SmoothStreamingDvrBuffer.WriteString(output, string.Format(
+                CultureInfo.InvariantCulture,
+                "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<SmoothStreamingMedia MajorVersion=\"2\" MinorVersion=\"0\" TimeScale=\"{0}\" Duration=\"0\" IsLive=\"TRUE\" DVRWindowLength=\"{1}\">\n",
+                Global.SmoothStreamingTimescale,
+                this.windowLength));
+
+            this.WriteStreamIndex(output, true);
+            this.WriteStreamIndex(output, false);
+
+            SmoothStreamingDvrBuffer.WriteString(output, "</SmoothStreamingMedia>\n");
+
+            return output.ToArray();
+        }
+
+        /// <summary>
+        /// Writes StreamIndex element for all tracks of the specified type, the first track's fragments form the timeline
+        /// </summary>
+        /// <param name="output">Manifest being assembled</param>
+        /// <param name="video">Whether video or audio tracks are written</param>
+        private void WriteStreamIndex(MemoryStream output, bool video)
+        {
+            List<DvrTrack> qualityLevels = this.tracks.FindAll(t => t.IsVideo == video);
+            if (qualityLevels.Count == 0)
+            {
+                return;
+            }
+
+            string type = video ? "video" : "audio";
+            List<DvrFragment> timeline = qualityLevels[0].Fragments;
+
+            // only the chunk count varies, the attributes are numbers and need no escaping
+            StringBuilder streamIndex = new StringBuilder();
+            streamIndex.AppendFormat(
+                CultureInfo.InvariantCulture,
+                "  <StreamIndex Type=\"{0}\" Name=\"{0}\" Chunks=\"{1}\" QualityLevels=\"{2}\" Url=\"QualityLevels({{bitrate}})/Fragments({0}={{start time}})\"",
+                type,
+                timeline.Count,
+                qualityLevels.Count);
+            if (video)
+            {
+                streamIndex.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    " MaxWidth=\"{0}\" MaxHeight=\"{1}\" DisplayWidth=\"{2}\" DisplayHeight=\"{3}\"",
+                    qualityLevels.Max(t => t.GetIntParam("MaxWidth")),
+                    qualityLevels.Max(t => t.GetIntParam("MaxHeight")),
+                    qualityLevels.Max(t => t.GetIntParam("DisplayWidth")),
+                    qualityLevels.Max(t => t.GetIntParam("DisplayHeight")));
+            }
+
+            streamIndex.Append(">\n");
+            SmoothStreamingDvrBuffer.WriteString(output, streamIndex.ToString());
+
+            if (video)
+            {
+                if (this.videoQualityLevels == null)
+                {
+                    this.videoQualityLevels = SmoothStreamingDvrBuffer.SerializeQualityLevels(qualityLevels, true);
+                }
+
+                output.Write(this.videoQualityLevels, 0, this.videoQualityLevels.Length);
+            }
+            else
+            {
+                if (this.audioQualityLevels == null)
+                {
+                    this.audioQualityLevels = SmoothStreamingDvrBuffer.SerializeQualityLevels(qualityLevels, false);
+                }
+
+                output.Write(this.audioQualityLevels, 0, this.audioQualityLevels.Length);
+            }
+
+            foreach (DvrFragment fragment in timeline)
+            {
+                output.Write(fragment.ManifestEntry, 0, fragment.ManifestEntry.Length);
+            }
+
+            SmoothStreamingDvrBuffer.WriteString(output, "  </StreamIndex>\n");
+        }
+
+        /// <summary>
+        /// Serializes QualityLevel elements of tracks
+        /// </summary>
+        /// <param name="qualityLevels">Tracks of one type</param>
+        /// <param name="video">Whether tracks are video or audio</param>
+        /// <returns>Serialized elements in UTF-8</returns>
+        private static byte[] SerializeQualityLevels(List<DvrTrack> qualityLevels, bool video)
+        {
+            string[] attributes = video ?
+                new string[] { "FourCC", "MaxWidth", "MaxHeight", "CodecPrivateData" } :
+                new string[] { "FourCC", "SamplingRate", "Channels", "BitsPerSample", "PacketSize", "AudioTag", "CodecPrivateData" };
+
+            MemoryStream output = new MemoryStream();
+            XmlWriterSettings settings = new XmlWriterSettings();
+            settings.ConformanceLevel = ConformanceLevel.Fragment;
+            settings.Encoding = new UTF8Encoding(false);
+
+            using (XmlWriter writer = XmlWriter.Create(output, settings))
+            {
+                for (int i = 0; i < qualityLevels.Count; ++i)
+                {
+                    writer.WriteWhitespace("    ");
+                    writer.WriteStartElement("QualityLevel");
+                    writer.WriteAttributeString("Index", i.ToString(CultureInfo.InvariantCulture));
+                    writer.WriteAttributeString("Bitrate", qualityLevels[i].Bitrate.ToString(CultureInfo.InvariantCulture));
+                    foreach (string attribute in attributes)
+                    {
+                        string value = null;
+                        if (qualityLevels[i].Params.TryGetValue(attribute, out value))
+                        {
+                            writer.WriteAttributeString(attribute, value);
+                        }
+                    }
+
+                    writer.WriteEndElement();
+                    writer.WriteWhitespace("\n");
+                }
+            }
+
+            return output.ToArray();
+        }
+
+        /// <summary>
+        /// Serializes chunk entry of the client manifest
+        /// </summary>
+        /// <param name="fragment">Fragment</param>
+        /// <returns>Serialized c element in UTF-8</returns>
+        private static byte[] SerializeManifestEntry(DvrFragment fragment)
+        {
+            return Encoding.UTF8.GetBytes(string.Format(CultureInfo.InvariantCulture, "    <c t=\"{0}\" d=\"{1}\" />\n", fragment.Time, fragment.Duration));
+        }
+
+        /// <summary>
+        /// Writes string in UTF-8
+        /// </summary>
+        /// <param name="output">Output stream</param>
+        /// <param name="value">String to write</param>
+        private static void WriteString(MemoryStream output, string value)
+        {
+            byte[] bytes = Encoding.UTF8.GetBytes(value);
+            output.Write(bytes, 0, bytes.Length);
+        }
+
+        /// <summary>
+        /// Extracts track description from the live server manifest box of the header
+        /// </summary>
+        /// <param name="header">Stream header (ftyp, live server manifest, moov)</param>
+        /// <returns>Track without fragments or null if the header has no valid manifest box</returns>
+        private static DvrTrack ParseHeader(byte[] header)
+        {
+            int offset = 0;
+            int size = 0;
+            if (!SmoothStreamingDvrBuffer.FindUuidBox(header, 0, header.Length, SmoothStreamingDvrBuffer.LiveServerManifestUuid, out offset, out size))
+            {
+                return null;
+            }
+
+            // box header, uuid, version and flags
+            int smilOffset = offset + 8 + 16 + 4;
+            if (smilOffset > offset + size)
+            {
+                return null;
+            }
+
+            try
+            {
+                XmlDocument smil = new XmlDocument();
+                smil.LoadXml(Encoding.UTF8.GetString(header, smilOffset, offset + size - smilOffset));
+
+                foreach (XmlNode node in smil.GetElementsByTagName("*"))
+                {
+                    if (node.LocalName != "video" && node.LocalName != "audio")
+                    {
+                        continue;
+                    }
+
+                    DvrTrack track = new DvrTrack();
+                    track.IsVideo = node.LocalName == "video";
+                    track.Bitrate = int.Parse(node.Attributes["systemBitrate"].Value, CultureInfo.InvariantCulture);
+                    foreach (XmlNode param in node.ChildNodes)
+                    {
+                        if (param.LocalName == "param" && param.Attributes["name"] != null && param.Attributes["value"] != null)
+                        {
+                            track.Params[param.Attributes["name"].Value] = param.Attributes["value"].Value;
+                        }
+                    }
+
+                    return track;
+                }
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Live server manifest parsing failed: {0}", ex.Message);
+            }
+
+            return null;
+        }
+
+        /// <summary>
+        /// Reads start time and duration (tfxd) and whether the first sample is a sync sample (trun) from fragment
+        /// </summary>
+        /// <param name="data">Fragment data, moof followed by mdat</param>
+        /// <param name="time">Fragment start time in hns</param>
+        /// <param name="duration">Fragment duration in hns</param>
+        /// <param name="startsWithSyncSample">Whether the first sample of the fragment is a sync sample</param>
+        /// <returns>True if the fragment has been parsed</returns>
+        private static bool ParseFragment(byte[] data, out long time, out long duration, out bool startsWithSyncSample)
+        {
+            time = 0;
+            duration = 0;
+            startsWithSyncSample = true;
+
+            int moofOffset = 0;
+            int moofSize = 0;
+            int trafOffset = 0;
+            int trafSize = 0;
+            int tfxdOffset = 0;
+            int tfxdSize = 0;
+            if (!SmoothStreamingDvrBuffer.FindBox(data, 0, data.Length, "moof", out moofOffset, out moofSize) ||
+                !SmoothStreamingDvrBuffer.FindBox(data, moofOffset + 8, moofOffset + moofSize, "traf", out trafOffset, out trafSize) ||
+                !SmoothStreamingDvrBuffer.FindUuidBox(data, trafOffset + 8, trafOffset + trafSize, SmoothStreamingDvrBuffer.TfxdUuid, out tfxdOffset, out tfxdSize))
+            {
+                return false;
+            }
+
+            // box header, uuid, version and flags
+            int position = tfxdOffset + 8 + 16;
+            if (data[position] == 1 && position + 4 + 16 <= tfxdOffset + tfxdSize)
+            {
+                time = (long)EndianBitConverter.Big.ToUInt64(data, position + 4);
+                duration = (long)EndianBitConverter.Big.ToUInt64(data, position + 12);
+            }
+            else if (data[position] == 0 && position + 4 + 8 <= tfxdOffset + tfxdSize)
+            {
+                time = EndianBitConverter.Big.ToUInt32(data, position + 4);
+                duration = EndianBitConverter.Big.ToUInt32(data, position + 8);
+            }
+            else
+            {
+                return false;
+            }
+
+            int trunOffset = 0;
+            int trunSize = 0;
+            if (SmoothStreamingDvrBuffer.FindBox(data, trafOffset + 8, trafOffset + trafSize, "trun", out trunOffset, out trunSize))
+            {
+                uint flags = EndianBitConverter.Big.ToUInt32(data, trunOffset + 8) & 0xFFFFFF;
+                position = trunOffset + 16;
+                if ((flags & 0x000001) != 0)
+                {
+                    position += 4; // data offset
+                }
+
+                if ((flags & 0x000004) == 0 && (flags & 0x000400) != 0)
+                {
+                    // per sample flags follow sample duration and size
+                    position += ((flags & 0x000100) != 0 ? 4 : 0) + ((flags & 0x000200) != 0 ? 4 : 0);
+                }
+
+                if ((flags & 0x000404) != 0 && position + 4 <= trunOffset + trunSize)
+                {
+                    // sample_is_non_sync_sample
+                    startsWithSyncSample = (EndianBitConverter.Big.ToUInt32(data, position) & 0x00010000) == 0;
+                }
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Finds box of the specified type among the boxes in the range
+        /// </summary>
+        /// <param name="data">Data to search</param>
+        /// <param name="start">Range start</param>
+        /// <param name="end">Range end</param>
+        /// <param name="type">Box type</param>
+        /// <param name="offset">Found box offset</param>
+        /// <param name="size">Found box size</param>
+        /// <returns>True if the box has been found</returns>
+        private static bool FindBox(byte[] data, int start, int end, string type, out int offset, out int size)
+        {
+            offset = start;
+            size = 0;
+
+            while (offset + 8 <= end)
+            {
+                size = (int)EndianBitConverter.Big.ToUInt32(data, offset);
+                if (size < 8 || offset + size > end)
+                {
+                    return false;
+                }
+
+                if (data[offset + 4] == type[0] && data[offset + 5] == type[1] && data[offset + 6] == type[2] && data[offset + 7] == type[3])
+                {
+                    return true;
+                }
+
+                offset += size;
+            }
+
+            return false;
+        }
+
+        /// <summary>
+        /// Finds uuid box with the specified UUID among the boxes in the range
+        /// </summary>
+        /// <param name="data">Data to search</param>
+        /// <param name="start">Range start</param>
+        /// <param name="end">Range end</param>
+        /// <param name="uuid">Box UUID</param>
+        /// <param name="offset">Found box offset</param>
+        /// <param name="size">Found box size</param>
+        /// <returns>True if the box has been found</returns>
+        private static bool FindUuidBox(byte[] data, int start, int end, byte[] uuid, out int offset, out int size)
+        {
+            offset = start;
+            size = 0;
+
+            while (SmoothStreamingDvrBuffer.FindBox(data, offset, end, "uuid", out offset, out size))
+            {
+                bool match = size >= 8 + 16 + 4;
+                for (int i = 0; match && i < 16; ++i)
+                {
+                    match = data[offset + 8 + i] == uuid[i];
+                }
+
+                if (match)
+                {
+                    return true;
+                }
+
+                offset += size;
+            }
+
+            return false;
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Quality level of the publishing point
+        /// </summary>
+        private class DvrTrack
+        {
+            /// <summary>
+            /// Creates new instance of DvrTrack
+            /// </summary>
+            public DvrTrack()
+            {
+                this.Params = new Dictionary<string, string>();
+                this.Fragments = new List<DvrFragment>();
+            }
+
+            /// <summary>
+            /// Gets or sets stream GUID
+            /// </summary>
+            public Guid StreamId { get; set; }
+
+            /// <summary>
+            /// Gets or sets whether it's a video track
+            /// </summary>
+            public bool IsVideo { get; set; }
+
+            /// <summary>
+            /// Gets or sets bitrate
+            /// </summary>
+            public int Bitrate { get; set; }
+
+            /// <summary>
+            /// Gets track parameters of the live server manifest (FourCC, CodecPrivateData etc.)
+            /// </summary>
+            public Dictionary<string, string> Params { get; private set; }
+
+            /// <summary>
+            /// Gets fragments of the DVR window ordered by time
+            /// </summary>
+            public List<DvrFragment> Fragments { get; private set; }
+
+            /// <summary>
+            /// Returns integer parameter or 0 if it's missing
+            /// </summary>
+            /// <param name="name">Parameter name</param>
+            /// <returns>Parameter value</returns>
+            public int GetIntParam(string name)
+            {
+                string value = null;
+                int result = 0;
+                if (this.Params.TryGetValue(name, out value))
+                {
+                    int.TryParse(value, NumberStyles.Integer, CultureInfo.InvariantCulture, out result);
+                }
+
+                return result;
+            }
+        }
+
+        /// <summary>
+        /// Fragment of the DVR window
+        /// </summary>
+        private class DvrFragment
+        {
+            /// <summary>
+            /// Gets or sets start time in hns
+            /// </summary>
+            public long Time { get; set; }
+
+            /// <summary>
+            /// Gets or sets duration in hns
+            /// </summary>
+            public long Duration { get; set; }
+
+            /// <summary>
+            /// Gets or sets fragment data, never modified once set so it can be served outside the lock
+            /// </summary>
+            public byte[] Data { get; set; }
+
+            /// <summary>
+            /// Gets or sets serialized c element of the client manifest
+            /// </summary>
+            public byte[] ManifestEntry { get; set; }
+        }
+
+        #endregion
+    }
+}
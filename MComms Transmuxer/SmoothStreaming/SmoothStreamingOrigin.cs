@@ -0,0 +1,366 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Runtime.InteropServices;
+    using System.Text;
+    using System.Text.RegularExpressions;
+    using System.Threading;
+
+    /// <summary>
+    /// Embedded Smooth Streaming origin. Serves Manifest and QualityLevels()/Fragments() requests of
+    /// live publishing points from their DVR buffers, so viewers can be served without IIS Media Services.
+    /// HLS playlists and segments of publishing points with HLS output are served under hls/ from their mux.
+    /// </summary>
+    public class SmoothStreamingOrigin
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Static list of DVR buffers by publishing point name
+        /// </summary>
+        private static Dictionary<string, SmoothStreamingDvrBuffer> buffers = new Dictionary<string, SmoothStreamingDvrBuffer>();
+
+        /// <summary>
+        /// Request path: publishing point followed by Manifest or QualityLevels(bitrate)/Fragments(type=time)
+        /// </summary>
+        private static readonly Regex RequestRegex = new Regex(
+            @"/(?<pp>[^/]+\.isml)/(?:(?<manifest>Manifest)|QualityLevels\((?<bitrate>\d+)\)/Fragments\((?<type>video|audio)=(?<time>\d+)\))$",
+            RegexOptions.IgnoreCase | RegexOptions.Compiled);
+
+        /// <summary>
+        /// HLS request path: publishing point followed by hls/index.m3u8, hls/rendition.m3u8 or hls/rendition-sequence.ts
+        /// </summary>
+        private static readonly Regex HlsRequestRegex = new Regex(
+            @"/(?<pp>[^/]+\.isml)/hls/(?:(?<master>index\.m3u8)|(?<rendition>\d+)(?:\.m3u8|-(?<sequence>\d+)\.ts))$",
+            RegexOptions.IgnoreCase | RegexOptions.Compiled);
+
+        /// <summary>
+        /// Initial size of native buffers HLS data is copied into
+        /// </summary>
+        private const int HlsBufferSize = 65536;
+
+        /// <summary>
+        /// HTTP listener
+        /// </summary>
+        private HttpListener listener = new HttpListener();
+
+        /// <summary>
+        /// Listener thread
+        /// </summary>
+        private Thread listenerThread = null;
+
+        /// <summary>
+        /// Whether we've started
+        /// </summary>
+        private volatile bool isRunning = false;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SmoothStreamingOrigin
+        /// </summary>
+        /// <param name="prefix">HTTP listener prefix, e.g. http://+:8080/</param>
+        public SmoothStreamingOrigin(string prefix)
+        {
+            this.listener.Prefixes.Add(prefix);
+            this.listenerThread = new Thread(this.ListenerThreadProc);
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Creates DVR buffer for the specified publishing point, replacing the previous one
+        /// </summary>
+        /// <param name="publishUri">Publish URI</param>
+        /// <returns>Created buffer</returns>
+        public static SmoothStreamingDvrBuffer CreateBuffer(string publishUri)
+        {
+            string name = SmoothStreamingOrigin.GetPublishingPointName(publishUri);
+            SmoothStreamingDvrBuffer buffer = new SmoothStreamingDvrBuffer(name, Properties.Settings.Default.OriginDvrWindow * (Global.SmoothStreamingTimescale / 1000));
+
+            lock (SmoothStreamingOrigin.buffers)
+            {
+                SmoothStreamingOrigin.buffers[name] = buffer;
+            }
+
+            return buffer;
+        }
+
+        /// <summary>
+        /// Deletes DVR buffer if it's still registered for its publishing point
+        /// </summary>
+        /// <param name="buffer">Buffer to delete</param>
+        public static void DeleteBuffer(SmoothStreamingDvrBuffer buffer)
+        {
+            lock (SmoothStreamingOrigin.buffers)
+            {
+                SmoothStreamingDvrBuffer existing = null;
+                if (SmoothStreamingOrigin.buffers.TryGetValue(buffer.Name, out existing) && existing == buffer)
+                {
+                    SmoothStreamingOrigin.buffers.Remove(buffer.Name);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Finds DVR buffer of the publishing point
+        /// </summary>
+        /// <param name="name">Publishing point name, e.g. live.isml</param>
+        /// <returns>Found buffer or null</returns>
+        public static SmoothStreamingDvrBuffer FindBuffer(string name)
+        {
+            lock (SmoothStreamingOrigin.buffers)
+            {
+                SmoothStreamingDvrBuffer buffer = null;
+                SmoothStreamingOrigin.buffers.TryGetValue(name.ToLowerInvariant(), out buffer);
+                return buffer;
+            }
+        }
+
+        /// <summary>
+        /// Starts listening
+        /// </summary>
+        public void Start()
+        {
+            this.listener.Start();
+            this.isRunning = true;
+            this.listenerThread.Start();
+
+            Global.Log.InfoFormat("Smooth Streaming origin listening on {0}", string.Join(", ", this.listener.Prefixes.ToArray()));
+        }
+
+        /// <summary>
+        /// Stops listening, requests being served are completed
+        /// </summary>
+        public void Stop()
+        {
+            this.isRunning = false;
+            this.listener.Stop();
+            this.listenerThread.Join();
+            this.listener.Close();
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Returns publishing point name from publish URI, which is its last path segment in lower case
+        /// </summary>
+        /// <param name="publishUri">Publish URI</param>
+        /// <returns>Publishing point name</returns>
+        private static string GetPublishingPointName(string publishUri)
+        {
+            return publishUri.Substring(publishUri.LastIndexOf('/') + 1).ToLowerInvariant();
+        }
+
+        /// <summary>
+        /// Copies HLS playlist or segment out of the mux
+        /// </summary>
+        /// <param name="muxId">Mux id, -1 if the publishing point has no HLS output</param>
+        /// <param name="rendition">Rendition index, -1 for master playlist</param>
+        /// <param name="sequence">Segment sequence number, -1 for playlist</param>
+        /// <returns>Playlist or segment data, null if not available</returns>
+        private static byte[] GetHlsData(int muxId, int rendition, int sequence)
+        {
+            if (muxId < 0)
+            {
+                return null;
+            }
+
+            SmoothStreamingSegmenter.MCSSF_BUFFER buffer = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            if (SmoothStreamingSegmenter.MCSSF_AcquireBuffer(SmoothStreamingOrigin.HlsBufferSize, ref buffer) < 0)
+            {
+                return null;
+            }
+
+            try
+            {
+                while (true)
+                {
+                    int res = sequence < 0 ?
+                        SmoothStreamingSegmenter.MCSSF_GetHlsPlaylist(muxId, rendition, ref buffer) :
+                        SmoothStreamingSegmenter.MCSSF_GetHlsSegment(muxId, rendition, sequence, ref buffer);
+
+                    if (res == -2)
+                    {
+                        // doesn't fit, move to the pool buffer of the required size
+                        int requiredSize = buffer.nDataSize;
+                        SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer);
+                        if (SmoothStreamingSegmenter.MCSSF_AcquireBuffer(requiredSize, ref buffer) < 0)
+                        {
+                            return null;
+                        }
+
+                        continue;
+                    }
+                    else if (res < 0)
+                    {
+                        return null;
+                    }
+
+                    byte[] data = new byte[buffer.nDataSize];
+                    Marshal.Copy(buffer.pData, data, 0, buffer.nDataSize);
+                    return data;
+                }
+            }
+            finally
+            {
+                if (buffer.pData != IntPtr.Zero)
+                {
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Listener thread, accepts requests and serves them on the thread pool
+        /// </summary>
+        private void ListenerThreadProc()
+        {
+            Global.Log.Debug("SmoothStreamingOrigin listener thread started");
+
+            while (this.isRunning)
+            {
+                HttpListenerContext context = null;
+                try
+                {
+                    context = this.listener.GetContext();
+                }
+                catch (HttpListenerException)
+                {
+                    // listener stopped
+                    continue;
+                }
+                catch (ObjectDisposedException)
+                {
+                    break;
+                }
+
+                ThreadPool.QueueUserWorkItem(this.ProcessRequest, context);
+            }
+
+            Global.Log.Debug("SmoothStreamingOrigin listener thread stopped");
+        }
+
+        /// <summary>
+        /// Serves manifest, fragment or HLS request
+        /// </summary>
+        /// <param name="state">Listener context</param>
+        private void ProcessRequest(object state)
+        {
+            HttpListenerContext context = (HttpListenerContext)state;
+            HttpListenerResponse response = context.Response;
+
+            try
+            {
+                byte[] data = null;
+                string contentType = null;
+
+                string path = Uri.UnescapeDataString(context.Request.Url.AbsolutePath);
+                Match match = SmoothStreamingOrigin.RequestRegex.Match(path);
+                Match hlsMatch = match.Success ? Match.Empty : SmoothStreamingOrigin.HlsRequestRegex.Match(path);
+                SmoothStreamingDvrBuffer buffer = match.Success || hlsMatch.Success ? SmoothStreamingOrigin.FindBuffer((match.Success ? match : hlsMatch).Groups["pp"].Value) : null;
+                if (buffer != null && hlsMatch.Success)
+                {
+                    int rendition = -1;
+                    int sequence = -1;
+                    if (hlsMatch.Groups["master"].Success ||
+                        (int.TryParse(hlsMatch.Groups["rendition"].Value, NumberStyles.None, CultureInfo.InvariantCulture, out rendition) &&
+                         (!hlsMatch.Groups["sequence"].Success || int.TryParse(hlsMatch.Groups["sequence"].Value, NumberStyles.None, CultureInfo.InvariantCulture, out sequence))))
+                    {
+                        data = SmoothStreamingOrigin.GetHlsData(buffer.HlsMuxId, rendition, sequence);
+                        if (sequence < 0)
+                        {
+                            contentType = "application/vnd.apple.mpegurl";
+
+                            // playlists change with every segment
+                            response.AddHeader("Cache-Control", "no-cache");
+                        }
+                        else
+                        {
+                            contentType = "video/mp2t";
+                            response.AddHeader("Cache-Control", string.Format("max-age={0}", Properties.Settings.Default.OriginDvrWindow / 1000));
+                        }
+                    }
+                }
+                else if (buffer != null)
+                {
+                    if (match.Groups["manifest"].Success)
+                    {
+                        data = buffer.GetManifest();
+                        contentType = "text/xml";
+
+                        // manifest changes with every fragment
+                        response.AddHeader("Cache-Control", "no-cache");
+                    }
+                    else
+                    {
+                        int bitrate = 0;
+                        long time = 0;
+                        if (int.TryParse(match.Groups["bitrate"].Value, NumberStyles.None, CultureInfo.InvariantCulture, out bitrate) &&
+                            long.TryParse(match.Groups["time"].Value, NumberStyles.None, CultureInfo.InvariantCulture, out time))
+                        {
+                            string type = match.Groups["type"].Value.ToLowerInvariant();
+                            data = buffer.GetFragment(type, bitrate, time);
+                            contentType = type + "/mp4";
+
+                            // fragments never change once they're complete
+                            response.AddHeader("Cache-Control", string.Format("max-age={0}", Properties.Settings.Default.OriginDvrWindow / 1000));
+                        }
+                    }
+                }
+
+                if (data == null)
+                {
+                    response.StatusCode = (int)HttpStatusCode.NotFound;
+                    response.Headers.Remove("Cache-Control");
+                    response.ContentLength64 = 0;
+                }
+                else
+                {
+                    response.StatusCode = (int)HttpStatusCode.OK;
+                    response.ContentType = contentType;
+                    response.ContentLength64 = data.Length;
+                    if (context.Request.HttpMethod != "HEAD")
+                    {
+                        response.OutputStream.Write(data, 0, data.Length);
+                    }
+                }
+            }
+            catch (HttpListenerException)
+            {
+                // viewer has gone
+            }
+            catch (IOException)
+            {
+                // viewer has gone
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Origin request {0} failed: {1}", context.Request.Url, ex.ToString());
+            }
+            finally
+            {
+                try
+                {
+                    response.Close();
+                }
+                catch
+                {
+                }
+            }
+        }
+
+        #endregion
+    }
+}
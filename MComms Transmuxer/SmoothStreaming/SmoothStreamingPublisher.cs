@@ -71,14 +71,29 @@
         private long lastPacketTimestamp = long.MinValue;
 
         /// <summary>
-        /// Map from stream GUID to web request
+        /// Map from stream GUID to its uploader
         /// </summary>
-        private Dictionary<Guid, HttpWebRequest> webRequests = new Dictionary<Guid, HttpWebRequest>();
+        private Dictionary<Guid, SmoothStreamingUploader> uploaders = new Dictionary<Guid, SmoothStreamingUploader>();
 
         /// <summary>
-        /// Map from stream GUID to web request stream
+        /// Map from stream GUID to its fragment dump file, null if writing has failed
         /// </summary>
-        private Dictionary<Guid, Stream> webRequestStreams = new Dictionary<Guid, Stream>();
+        private Dictionary<Guid, FileStream> fragmentDumps = new Dictionary<Guid, FileStream>();
+
+        /// <summary>
+        /// Buffer native header and segments are copied to for writing to dump files
+        /// </summary>
+        private byte[] fragmentDumpBuffer = null;
+
+        /// <summary>
+        /// Map from stream GUID to statistics of the RTMP stream it's published by
+        /// </summary>
+        private Dictionary<Guid, StreamStatistics> streamStatistics = new Dictionary<Guid, StreamStatistics>();
+
+        /// <summary>
+        /// DVR buffer served by the embedded origin, null if the origin is disabled
+        /// </summary>
+        private SmoothStreamingDvrBuffer dvrBuffer = null;
 
         /// <summary>
         /// Last time expired streams were checked
@@ -101,7 +116,14 @@
         private SmoothStreamingPublisher(string publishUri, bool unitTest = false)
         {
             this.publishUri = publishUri;
-            this.muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+
+            if (Properties.Settings.Default.EnableOrigin)
+            {
+                this.dvrBuffer = SmoothStreamingOrigin.CreateBuffer(publishUri);
+            }
+
+            this.InitializeMux();
+
             if (!unitTest)
             {
                 // always restart publishing point if we have new publisher instance,
@@ -138,7 +160,15 @@
         {
             lock (this)
             {
-                this.disposeWebRequests();
+                this.disposeUploaders();
+                this.CloseFragmentDumps();
+
+                if (this.dvrBuffer != null)
+                {
+                    SmoothStreamingOrigin.DeleteBuffer(this.dvrBuffer);
+                    this.dvrBuffer.HlsMuxId = -1;
+                    this.dvrBuffer = null;
+                }
 
                 if (this.muxId >= 0)
                 {
@@ -280,14 +310,19 @@
                         this.lastPacketAbsoluteTime = DateTime.MinValue;
                         this.lastPacketTimestamp = long.MinValue;
                         this.publishStreamId2MuxerStreamId.Clear();
-                        this.disposeWebRequests();
+                        this.disposeUploaders();
+                        this.CloseFragmentDumps();
+                        if (this.dvrBuffer != null)
+                        {
+                            this.dvrBuffer.Clear();
+                        }
 
                         if (this.muxId >= 0)
                         {
                             SmoothStreamingSegmenter.MCSSF_Uninitialize(this.muxId);
                         }
 
-                        this.muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+                        this.InitializeMux();
                     }
                 }
 
@@ -299,13 +334,9 @@
         /// Adds registered media stream to muxer.
         /// </summary>
         /// <param name="streamId">Media stream GUID (received from RegisterMediaType)</param>
-        /// <param name="streamType">Stream type (in muxer format)</param>
-        /// <param name="bitrate">Stream bitrate</param>
-        /// <param name="language">Stream language</param>
-        /// <param name="extraDataSize">Codec private data size</param>
-        /// <param name="extraData">Codec private data</param>
+        /// <param name="config">Stream description with codec configuration</param>
         /// <returns>Stream id in the muxer</returns>
-        public int AddStream(Guid streamId, Int32 streamType, Int32 bitrate, UInt16 language, Int32 extraDataSize, IntPtr extraData)
+        public int AddStream(Guid streamId, ref SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG config)
         {
             lock (this)
             {
@@ -319,11 +350,11 @@
                 }
                 else
                 {
-                    muxStreamId = SmoothStreamingSegmenter.MCSSF_AddStream(this.muxId, streamType, bitrate, language, extraDataSize, extraData);
+                    muxStreamId = SmoothStreamingSegmenter.MCSSF_AddStreamConfig(this.muxId, ref config);
 
                     if (muxStreamId < 0)
                     {
-                        Global.Log.ErrorFormat("Stream {0} adding to muxer failed", streamId);
+                        Global.Log.ErrorFormat("Stream {0} adding to muxer failed, result {1}", streamId, muxStreamId);
                         UnregisterStream(streamId);
                     }
                     else
@@ -358,6 +389,25 @@
             }
         }
 
+        /// <summary>
+        /// Sets statistics fragment uploads of the stream are recorded to
+        /// </summary>
+        /// <param name="streamId">Stream GUID</param>
+        /// <param name="statistics">Statistics of the RTMP stream publishing the stream</param>
+        public void SetStreamStatistics(Guid streamId, StreamStatistics statistics)
+        {
+            lock (this)
+            {
+                this.streamStatistics[streamId] = statistics;
+
+                SmoothStreamingUploader uploader = null;
+                if (this.uploaders.TryGetValue(streamId, out uploader))
+                {
+                    uploader.Statistics = statistics;
+                }
+            }
+        }
+
         /// <summary>
         /// Gets media type of the registered stream
         /// </summary>
@@ -398,81 +448,56 @@
         /// <param name="streamId">Stream GUID</param>
         /// <param name="absoluteTime">Current system time</param>
         /// <param name="timestamp">Current timestamp</param>
-        /// <param name="buffer">Data to push</param>
-        /// <param name="offset">Data offset</param>
+        /// <param name="data">Native segment buffer with data to push</param>
         /// <param name="length">Data length</param>
-        public void PushData(Guid streamId, DateTime absoluteTime, long timestamp, byte[] buffer, int offset, int length)
+        public void PushData(Guid streamId, DateTime absoluteTime, long timestamp, IntPtr data, int length)
         {
-            // 3 retries
-            for (int i = 0; i < 3; ++i)
+            lock (this)
             {
-                Stream webRequestStream = null;
+                this.lastActivity = DateTime.Now;
+                this.publishStreamId2LastActivity[streamId] = DateTime.Now;
+                this.UnregisterExpiredStreams();
 
-                lock (this)
+                if (this.publishStreamId2MuxerStreamId.Count < this.streams.Count)
                 {
-                    this.lastActivity = DateTime.Now;
-                    this.publishStreamId2LastActivity[streamId] = DateTime.Now;
-                    this.UnregisterExpiredStreams();
-
-                    if (this.publishStreamId2MuxerStreamId.Count < this.streams.Count)
-                    {
-                        // we haven't added all streams yet, dropping media data
-                        Global.Log.DebugFormat("Dropping media data of stream {0} because header is not written yet", streamId);
-                        return;
-                    }
-                    else
-                    {
-                        if (!this.mediaDataStarted)
-                        {
-                            PushHeader();
-                        }
-                    }
-
-                    if (absoluteTime != DateTime.MinValue)
-                    {
-                        this.lastPacketAbsoluteTime = absoluteTime;
-                    }
-
-                    if (timestamp != long.MinValue)
-                    {
-                        this.lastPacketTimestamp = timestamp;
-                    }
-
-                    if (!this.webRequests.ContainsKey(streamId))
+                    // we haven't added all streams yet, dropping media data
+                    Global.Log.DebugFormat("Dropping media data of stream {0} because header is not written yet", streamId);
+                    return;
+                }
+                else
+                {
+                    if (!this.mediaDataStarted)
                     {
-                        this.CreateWebRequest(streamId);
+                        PushHeader();
                     }
+                }
 
-                    webRequestStream = this.webRequestStreams[streamId];
+                if (absoluteTime != DateTime.MinValue)
+                {
+                    this.lastPacketAbsoluteTime = absoluteTime;
                 }
 
-                try
+                if (timestamp != long.MinValue)
                 {
-                    webRequestStream.Write(buffer, offset, length);
-                    webRequestStream.Flush();
+                    this.lastPacketTimestamp = timestamp;
                 }
-                catch (Exception)
+
+                if (this.dvrBuffer != null)
                 {
-                    //Global.Log.DebugFormat("webRequestStream.Write() failed: {0}", ex.ToString());
-                    try
-                    {
-                        webRequestStream.Dispose();
-                    }
-                    catch
-                    {
-                    }
+                    this.dvrBuffer.AddFragment(streamId, data, length);
+                }
 
-                    webRequestStream = null;
+                if (Properties.Settings.Default.EnableFragmentDump)
+                {
+                    this.WriteFragmentDump(streamId, data, length);
+                }
 
-                    lock (this)
-                    {
-                        this.webRequestStreams.Remove(streamId);
-                        this.webRequests.Remove(streamId);
-                    }
+                if (Properties.Settings.Default.EnablePublishingPointPush)
+                {
+                    // data is only copied to the upload queue, the network is never waited for here
+                    this.GetUploader(streamId).PushData(data, length);
                 }
             }
-
-            //GC.Collect();
         }
 
         /// <summary>
@@ -492,7 +517,13 @@
                     this.mediaDataStarted = false;
                     this.lastPacketAbsoluteTime = DateTime.MinValue;
                     this.lastPacketTimestamp = long.MinValue;
-                    this.disposeWebRequests();
+                    this.disposeUploaders();
+                    this.CloseFragmentDumps();
+                    if (this.dvrBuffer != null)
+                    {
+                        this.dvrBuffer.Clear();
+                    }
+
                     this.ShutdownPublishingPoint();
                     this.StartPublishingPoint();
                 }
@@ -504,23 +535,27 @@
         #region Private methods
 
         /// <summary>
-        /// Creates web request for the specified stream
+        /// Returns uploader of the specified stream, creating it if necessary
         /// </summary>
         /// <param name="streamId">Stream GUID</param>
-        private void CreateWebRequest(Guid streamId)
+        /// <returns>Stream uploader</returns>
+        private SmoothStreamingUploader GetUploader(Guid streamId)
         {
-            string streamPublishUri = string.Format("{0}/Streams({1})", this.publishUri, streamId);
-            HttpWebRequest webRequest = (HttpWebRequest)WebRequest.Create(streamPublishUri);
-            webRequest.Method = "POST";
-            webRequest.SendChunked = true;
-            webRequest.KeepAlive = true;
-            webRequest.AllowWriteStreamBuffering = false;
-            webRequest.ReadWriteTimeout = 3600000;
-            webRequest.Timeout = 3600000;
-            this.webRequests.Add(streamId, webRequest);
-            this.webRequestStreams.Add(streamId, webRequest.GetRequestStream());
-
-            Global.Log.InfoFormat("Created web request {0}", streamPublishUri);
+            SmoothStreamingUploader uploader = null;
+            if (!this.uploaders.TryGetValue(streamId, out uploader))
+            {
+                string streamPublishUri = string.Format("{0}/Streams({1})", this.publishUri, streamId);
+                uploader = new SmoothStreamingUploader(streamPublishUri, Global.SmoothStreamingUploadQueueLength);
+                this.uploaders.Add(streamId, uploader);
+
+                StreamStatistics statistics = null;
+                if (this.streamStatistics.TryGetValue(streamId, out statistics))
+                {
+                    uploader.Statistics = statistics;
+                }
+            }
+
+            return uploader;
         }
 
         /// <summary>
@@ -528,6 +563,12 @@
         /// </summary>
         private void StartPublishingPoint()
         {
+            if (!Properties.Settings.Default.EnablePublishingPointPush)
+            {
+                // media is served by the embedded origin only
+                return;
+            }
+
             Stream reqStream = null;
             HttpWebResponse webResp = null;
 
@@ -636,6 +677,11 @@
         /// </summary>
         private void ShutdownPublishingPoint()
         {
+            if (!Properties.Settings.Default.EnablePublishingPointPush)
+            {
+                return;
+            }
+
             Stream reqStream = null;
             HttpWebResponse webResp = null;
 
@@ -722,6 +768,11 @@
         /// <returns>True if publishing manifest matches to our data, false otherwise</returns>
         private bool IsPublishingPointManifestMatching()
         {
+            if (!Properties.Settings.Default.EnablePublishingPointPush)
+            {
+                return true;
+            }
+
             bool matching = false;
             Stream reqStream = null;
             HttpWebResponse webResp = null;
@@ -945,18 +996,27 @@
         {
             Global.Log.DebugFormat("Unregistering media type {0}", streamId);
 
-            if (this.webRequestStreams.ContainsKey(streamId))
+            SmoothStreamingUploader uploader = null;
+            if (this.uploaders.TryGetValue(streamId, out uploader))
             {
-                try
-                {
-                    this.webRequestStreams[streamId].Close();
-                }
-                catch
+                uploader.Dispose();
+                this.uploaders.Remove(streamId);
+            }
+
+            FileStream fragmentDump = null;
+            if (this.fragmentDumps.TryGetValue(streamId, out fragmentDump))
+            {
+                if (fragmentDump != null)
                 {
+                    fragmentDump.Dispose();
                 }
 
-                this.webRequestStreams.Remove(streamId);
-                this.webRequests.Remove(streamId);
+                this.fragmentDumps.Remove(streamId);
+            }
+
+            if (this.dvrBuffer != null)
+            {
+                this.dvrBuffer.RemoveTrack(streamId);
             }
 
             MediaType mt = this.streamsRev[streamId];
@@ -964,6 +1024,57 @@
             this.streamsRev.Remove(streamId);
             this.publishStreamId2MuxerStreamId.Remove(streamId);
             this.publishStreamId2LastActivity.Remove(streamId);
+            this.streamStatistics.Remove(streamId);
+        }
+
+        /// <summary>
+        /// Creates new mux and applies fragmentation settings to it
+        /// </summary>
+        private void InitializeMux()
+        {
+            this.muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            if (this.muxId < 0)
+            {
+                return;
+            }
+
+            long msToHns = Global.SmoothStreamingTimescale / 1000;
+
+            SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY policy = new SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY();
+            policy.nMaxDuration = Properties.Settings.Default.MaxFragmentDuration * msToHns;
+
+            // low latency mode, segments are pushed in chunks as they are being built
+            policy.nChunkDuration = Properties.Settings.Default.ChunkDuration * msToHns;
+            policy.nChunkSamples = Properties.Settings.Default.ChunkSamples;
+
+            policy.nDuration = Properties.Settings.Default.VideoFragmentDuration * msToHns;
+            if (SmoothStreamingSegmenter.MCSSF_SetDefaultFragmentPolicy(this.muxId, 2 /* video */, ref policy) < 0)
+            {
+                Global.Log.ErrorFormat("Invalid video fragment settings: duration {0} ms, max duration {1} ms", Properties.Settings.Default.VideoFragmentDuration, Properties.Settings.Default.MaxFragmentDuration);
+            }
+
+            policy.nDuration = Properties.Settings.Default.AudioFragmentDuration * msToHns;
+            policy.bAlignToVideo = Properties.Settings.Default.AlignAudioFragments ? 1 : 0;
+            if (SmoothStreamingSegmenter.MCSSF_SetDefaultFragmentPolicy(this.muxId, 1 /* audio */, ref policy) < 0)
+            {
+                Global.Log.ErrorFormat("Invalid audio fragment settings: duration {0} ms, max duration {1} ms", Properties.Settings.Default.AudioFragmentDuration, Properties.Settings.Default.MaxFragmentDuration);
+            }
+
+            // HLS is produced from the same samples and served by the embedded origin
+            if (Properties.Settings.Default.EnableHls && this.dvrBuffer != null)
+            {
+                SmoothStreamingSegmenter.MCSSF_HLS_POLICY hlsPolicy = new SmoothStreamingSegmenter.MCSSF_HLS_POLICY();
+                hlsPolicy.nSegmentDuration = Properties.Settings.Default.HlsSegmentDuration * msToHns;
+                hlsPolicy.nPlaylistLength = Properties.Settings.Default.HlsPlaylistLength;
+                if (SmoothStreamingSegmenter.MCSSF_EnableHlsOutput(this.muxId, ref hlsPolicy) < 0)
+                {
+                    Global.Log.ErrorFormat("Invalid HLS settings: segment duration {0} ms, playlist length {1}", Properties.Settings.Default.HlsSegmentDuration, Properties.Settings.Default.HlsPlaylistLength);
+                }
+                else
+                {
+                    this.dvrBuffer.HlsMuxId = this.muxId;
+                }
+            }
         }
 
         /// <summary>
@@ -973,82 +1084,153 @@
         {
             foreach (KeyValuePair<Guid, int> pair in publishStreamId2MuxerStreamId)
             {
+                // header is written to a pooled native buffer, retrying with the required size if it doesn't fit
+                SmoothStreamingSegmenter.MCSSF_BUFFER header = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+                int headerCapacity = 0;
                 int headerSize = 0;
-                IntPtr headerPtr = IntPtr.Zero;
-                int res = SmoothStreamingSegmenter.MCSSF_GetHeader(this.muxId, pair.Value, out headerSize, out headerPtr);
+                int res = 0;
+
+                while (true)
+                {
+                    if (SmoothStreamingSegmenter.MCSSF_AcquireBuffer(headerCapacity, ref header) < 0)
+                    {
+                        throw new CriticalStreamException(string.Format("MCSSF_AcquireBuffer failed for {0} bytes", headerCapacity));
+                    }
+
+                    IntPtr headerPtr = header.pData;
+                    headerSize = header.nCapacity;
+                    res = SmoothStreamingSegmenter.MCSSF_GetHeader(this.muxId, pair.Value, ref headerSize, ref headerPtr);
+                    if (res != -2)
+                    {
+                        break;
+                    }
+
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref header);
+                    headerCapacity = headerSize;
+                }
+
                 if (res < 0)
                 {
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref header);
                     Global.Log.ErrorFormat("MCSSF_GetHeader failed for stream {0}, result {1}", pair.Key, res);
                     UnregisterStream(pair.Key);
                     throw new CriticalStreamException(string.Format("MCSSF_GetHeader failed {0}", res));
                 }
 
-                if (headerSize > Global.MediaAllocator.BufferSize)
-                {
-                    // increase buffer sizes
-                    Global.MediaAllocator.Reallocate(headerSize * 3 / 2, Global.MediaAllocator.BufferCount);
-                }
-
-                PacketBuffer header = Global.MediaAllocator.LockBuffer();
-                Marshal.Copy(headerPtr, header.Buffer, 0, headerSize);
-
-                header.ActualBufferSize = headerSize;
                 try
                 {
-                    if (header.ActualBufferSize > 0)
+                    if (headerSize > 0)
                     {
-                        this.PushHeaderData(pair.Key, header.Buffer, 0, header.ActualBufferSize);
+                        if (this.dvrBuffer != null)
+                        {
+                            this.dvrBuffer.SetHeader(pair.Key, header.pData, headerSize);
+                        }
+
+                        if (Properties.Settings.Default.EnableFragmentDump)
+                        {
+                            this.WriteFragmentDump(pair.Key, header.pData, headerSize);
+                        }
+
+                        if (Properties.Settings.Default.EnablePublishingPointPush)
+                        {
+                            // uploader sends the header first on every connection it makes
+                            this.GetUploader(pair.Key).SetHeader(header.pData, headerSize);
+                        }
                     }
                 }
-                catch (Exception ex)
+                finally
                 {
-                    // header push failed, unregistering the stream
-                    Global.Log.ErrorFormat("Push header failed for stream {0}: {1}", pair.Key, ex.ToString());
-                    UnregisterStream(pair.Key);
-                    header.Release();
-                    throw;
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref header);
                 }
-
-                header.Release();
             }
 
             this.mediaDataStarted = true;
         }
 
         /// <summary>
-        /// Pushes header data to a publishing point
+        /// Appends header or segment to the dump file of the stream, creating the file on the first write.
+        /// Dump file is a fragmented MP4 file of one track named after publishing point and muxer stream id,
+        /// it's rewritten from the start when the header changes. Write errors are logged and stop dumping
+        /// of the stream, they never break publishing
         /// </summary>
         /// <param name="streamId">Stream GUID</param>
-        /// <param name="buffer">Header data</param>
-        /// <param name="offset">Header data offset</param>
-        /// <param name="length">Header data length</param>
-        private void PushHeaderData(Guid streamId, byte[] buffer, int offset, int length)
+        /// <param name="data">Native buffer with header or segment</param>
+        /// <param name="length">Data length</param>
+        private void WriteFragmentDump(Guid streamId, IntPtr data, int length)
         {
-            if (!this.webRequests.ContainsKey(streamId))
+            FileStream fragmentDump = null;
+            if (!this.fragmentDumps.TryGetValue(streamId, out fragmentDump))
             {
-                this.CreateWebRequest(streamId);
+                MediaType mediaType = this.streamsRev[streamId];
+                string path = string.Format(
+                    "{0}{1}_{2}{3}.ismv",
+                    Properties.Settings.Default.FragmentSaveFolder,
+                    Path.GetFileNameWithoutExtension(this.publishUri),
+                    mediaType.ContentType.ToString().ToLowerInvariant(),
+                    this.publishStreamId2MuxerStreamId[streamId]);
+
+                try
+                {
+                    fragmentDump = new FileStream(path, FileMode.Create, FileAccess.Write, FileShare.Read);
+                }
+                catch (Exception ex)
+                {
+                    Global.Log.ErrorFormat("Can't open fragment dump file {0} for writing: {1}", path, ex.Message);
+                }
+
+                this.fragmentDumps.Add(streamId, fragmentDump);
+            }
+
+            if (fragmentDump == null)
+            {
+                return;
             }
 
-            Stream webRequestStream = this.webRequestStreams[streamId];
-            webRequestStream.Write(buffer, offset, length);
-            webRequestStream.Flush();
+            if (this.fragmentDumpBuffer == null || this.fragmentDumpBuffer.Length < length)
+            {
+                this.fragmentDumpBuffer = new byte[Math.Max(length, Global.SegmentBufferSize)];
+            }
+
+            try
+            {
+                Marshal.Copy(data, this.fragmentDumpBuffer, 0, length);
+                fragmentDump.Write(this.fragmentDumpBuffer, 0, length);
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Fragment dump of stream {0} failed: {1}", streamId, ex.Message);
+                fragmentDump.Dispose();
+                this.fragmentDumps[streamId] = null;
+            }
         }
 
-        private void disposeWebRequests()
+        /// <summary>
+        /// Closes all fragment dump files
+        /// </summary>
+        private void CloseFragmentDumps()
         {
-            foreach (Stream webRequestStream in this.webRequestStreams.Values)
+            foreach (FileStream fragmentDump in this.fragmentDumps.Values)
             {
-                try
-                {
-                    webRequestStream.Dispose();
-                }
-                catch
+                if (fragmentDump != null)
                 {
+                    fragmentDump.Dispose();
                 }
             }
 
-            this.webRequestStreams.Clear();
-            this.webRequests.Clear();
+            this.fragmentDumps.Clear();
+        }
+
+        /// <summary>
+        /// Stops all uploaders, fragments still queued are dropped
+        /// </summary>
+        private void disposeUploaders()
+        {
+            foreach (SmoothStreamingUploader uploader in this.uploaders.Values)
+            {
+                uploader.Dispose();
+            }
+
+            this.uploaders.Clear();
         }
 
         #endregion
@@ -0,0 +1,50 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Media sample queued by segmenter till the next batch is pushed to the muxer
+    /// </summary>
+    public class SmoothStreamingSample
+    {
+        /// <summary>
+        /// Gets or sets stream GUID
+        /// </summary>
+        public Guid PublishStreamId { get; set; }
+
+        /// <summary>
+        /// Gets or sets system time the sample was received at
+        /// </summary>
+        public DateTime AbsoluteTime { get; set; }
+
+        /// <summary>
+        /// Gets or sets sample timestamp adjusted by segmenter's timestamp offset
+        /// </summary>
+        public long Timestamp { get; set; }
+
+        /// <summary>
+        /// Gets or sets whether sample is a key frame
+        /// </summary>
+        public bool KeyFrame { get; set; }
+
+        /// <summary>
+        /// Gets or sets buffer with media data, referenced by the sample
+        /// </summary>
+        public PacketBuffer MediaData { get; set; }
+
+        /// <summary>
+        /// Gets or sets media data offset
+        /// </summary>
+        public int Offset { get; set; }
+
+        /// <summary>
+        /// Gets or sets media data length
+        /// </summary>
+        public int Length { get; set; }
+    }
+}
@@ -2,6 +2,7 @@
 {
     using System;
     using System.Collections.Generic;
+    using System.Diagnostics;
     using System.IO;
     using System.Linq;
     using System.Runtime.InteropServices;
@@ -19,14 +20,44 @@
         #region Private constants and fields
 
         /// <summary>
-        /// Pointer to unmanaged buffer used to communicate with unmanaged SSF SDK wrapper
+        /// Pooled native segment buffer the next fragment is written to by the muxer
         /// </summary>
-        private IntPtr mediaDataPtr = IntPtr.Zero;
+        private MCSSF_BUFFER segment = new MCSSF_BUFFER();
 
         /// <summary>
-        /// Unmanaged buffer size
+        /// Capacity to request for the next segment buffer, follows the biggest segment seen so far
         /// </summary>
-        private int mediaDataPtrSize = 0;
+        private int segmentCapacity = Global.SegmentBufferSize;
+
+        /// <summary>
+        /// Samples queued till the next batch is pushed to the muxer
+        /// </summary>
+        private List<SmoothStreamingSample> pendingSamples = new List<SmoothStreamingSample>();
+
+        /// <summary>
+        /// Samples of the batch being pushed, swapped with the queue by Flush
+        /// </summary>
+        private List<SmoothStreamingSample> flushingSamples = new List<SmoothStreamingSample>();
+
+        /// <summary>
+        /// Muxer stream ids of the batch being pushed
+        /// </summary>
+        private int[] batchStreamIds = new int[Global.SmoothStreamingMaxBatchSize];
+
+        /// <summary>
+        /// Samples of the batch being pushed
+        /// </summary>
+        private MCSSF_SAMPLE[] batchSamples = new MCSSF_SAMPLE[Global.SmoothStreamingMaxBatchSize];
+
+        /// <summary>
+        /// Pinned sample buffers of the batch being pushed
+        /// </summary>
+        private GCHandle[] batchHandles = new GCHandle[Global.SmoothStreamingMaxBatchSize];
+
+        /// <summary>
+        /// Segments completed by the muxer in one batch call
+        /// </summary>
+        private MCSSF_FRAGMENT[] batchFragments = new MCSSF_FRAGMENT[Global.SmoothStreamingMaxBatchSegments];
 
         /// <summary>
         /// Publish URI
@@ -53,6 +84,11 @@
         /// </summary>
         private long timestampOffset = 0;
 
+        /// <summary>
+        /// Statistics of the published stream, null if not collected
+        /// </summary>
+        private StreamStatistics statistics = null;
+
         #endregion
 
         #region Constructor
@@ -61,11 +97,11 @@
         /// Creates new instance of SmoothStreamingSegmenter
         /// </summary>
         /// <param name="publishUri">Publish URI</param>
-        public SmoothStreamingSegmenter(string publishUri, bool unitTest = false)
+        /// <param name="statistics">Statistics of the published stream, null if not collected</param>
+        public SmoothStreamingSegmenter(string publishUri, bool unitTest = false, StreamStatistics statistics = null)
         {
-            this.mediaDataPtrSize = Global.MediaAllocator.BufferSize;
-            this.mediaDataPtr = Marshal.AllocHGlobal(this.mediaDataPtrSize);
             this.publishUri = publishUri;
+            this.statistics = statistics;
             this.publisher = SmoothStreamingPublisher.Create(this.publishUri, unitTest);
         }
 
@@ -78,11 +114,14 @@
         /// </summary>
         public void Dispose()
         {
-            if (this.mediaDataPtr != IntPtr.Zero)
+            // samples which haven't been pushed yet are dropped
+            foreach (SmoothStreamingSample sample in this.pendingSamples)
             {
-                Marshal.FreeHGlobal(this.mediaDataPtr);
-                this.mediaDataPtr = IntPtr.Zero;
+                sample.MediaData.Release();
             }
+
+            this.pendingSamples.Clear();
+            this.ReleaseSegment();
         }
 
         #endregion
@@ -96,134 +135,59 @@
         /// <returns>Registered stream GUID</returns>
         public Guid RegisterStream(MediaType mediaType)
         {
+            // stream registration may re-create the mux, so queued samples must go first
+            this.Flush();
+
             int streamId = -1;
 
             Guid publishStreamId = Guid.Empty;
 
+            // the muxer takes codec configuration as received in the sequence header, parsed configurations
+            // are cached per publishing point so re-registrations don't parse it again
+            MCSSF_STREAM_CONFIG config = new MCSSF_STREAM_CONFIG();
+            config.nBitrate = mediaType.Bitrate;
+            config.szCacheKey = this.publishUri;
+
             if (mediaType.ContentType == MediaContentType.Video)
             {
                 publishStreamId = this.publisher.RegisterMediaType(mediaType);
 
-                SmoothStreamingSegmenter.MPEG2VIDEOINFO mvih = new SmoothStreamingSegmenter.MPEG2VIDEOINFO();
-                mvih.hdr.rcSource = new SmoothStreamingSegmenter.RECT { right = mediaType.Width, bottom = mediaType.Height };
-                mvih.hdr.rcTarget = new SmoothStreamingSegmenter.RECT { right = mediaType.Width, bottom = mediaType.Height };
-                mvih.hdr.dwBitRate = (uint)mediaType.Bitrate;
-                if (mediaType.Framerate.Num != 0 && mediaType.Framerate.Den != 0)
-                {
-                    mvih.hdr.AvgTimePerFrame = (long)(Global.SmoothStreamingTimescale * mediaType.Framerate.Den / mediaType.Framerate.Num);
-                }
-                else
-                {
-                    // framerate not specified, assume 30fps
-                    mvih.hdr.AvgTimePerFrame = 333333;
-                }
-                mvih.hdr.dwPictAspectRatioX = (uint)mediaType.Width;
-                mvih.hdr.dwPictAspectRatioY = (uint)mediaType.Height;
-
-                mvih.hdr.bmiHeader.biSize = (uint)Marshal.SizeOf(mvih.hdr.bmiHeader);
-                mvih.hdr.bmiHeader.biWidth = mediaType.Width;
-                mvih.hdr.bmiHeader.biHeight = mediaType.Height;
-                mvih.hdr.bmiHeader.biPlanes = 1;
-                mvih.hdr.bmiHeader.biBitCount = 24;
-                mvih.hdr.bmiHeader.biCompression = 0x31435641; // the only valid value is 'AVC1' as per Microsoft documentation
-                mvih.hdr.bmiHeader.biSizeImage = (uint)(mvih.hdr.bmiHeader.biWidth * mvih.hdr.bmiHeader.biHeight * mvih.hdr.bmiHeader.biBitCount / 8);
-                mvih.hdr.bmiHeader.biXPelsPerMeter = 0;
-                mvih.hdr.bmiHeader.biYPelsPerMeter = 0;
-                mvih.hdr.bmiHeader.biClrUsed = 0;
-                mvih.hdr.bmiHeader.biClrImportant = 0;
-
-                mvih.cbSequenceHeader = (uint)mediaType.PrivateData.Length;
-                mvih.dwProfile = mediaType.PrivateData[1]; // taking it from AVC configuration record
-                mvih.dwLevel = mediaType.PrivateData[3]; // taking it from AVC configuration record
-                mvih.dwFlags = (uint)(mediaType.PrivateData[4] & 0x03) + 1; // NAL unit size
-
-                byte[] privateData = new byte[mediaType.PrivateData.Length * 2];
-                int privateDataSize = 0;
-                int nalUnitLength = (int)mvih.dwFlags;
-                StringBuilder sb = new StringBuilder();
-
-                // copy SPS
-                sb.Append("00000001");
-                int numOfSps = mediaType.PrivateData[5] & 0x1F;
-                int byteOffset = 6;
-                for (int i = 0; i < numOfSps; ++i)
-                {
-                    int spsLength = (int)mediaType.PrivateData[byteOffset] << 8 | mediaType.PrivateData[byteOffset + 1];
-                    if (i == 0)
-                    {
-                        byte[] lenBytes = EndianBitConverter.Big.GetBytes(spsLength);
-                        Array.Copy(lenBytes, 4 - nalUnitLength, privateData, privateDataSize, nalUnitLength);
-                        privateDataSize += nalUnitLength;
-                        Array.Copy(mediaType.PrivateData, byteOffset + 2, privateData, privateDataSize, spsLength);
-                        privateDataSize += spsLength;
-                        for (int j = 0; j < spsLength; ++j)
-                        {
-                            sb.AppendFormat("{0:x2}", mediaType.PrivateData[byteOffset + 2 + j]);
-                        }
-                    }
-                    byteOffset += 2 + spsLength;
-                }
-
-                sb.Append("00000001");
-                int numOfPps = mediaType.PrivateData[byteOffset];
-                byteOffset++;
-                for (int i = 0; i < numOfPps; ++i)
-                {
-                    int ppsLength = (int)mediaType.PrivateData[byteOffset] << 8 | mediaType.PrivateData[byteOffset + 1];
-                    if (i == 0)
-                    {
-                        byte[] lenBytes = EndianBitConverter.Big.GetBytes(ppsLength);
-                        Array.Copy(lenBytes, 4 - nalUnitLength, privateData, privateDataSize, nalUnitLength);
-                        privateDataSize += nalUnitLength;
-                        Array.Copy(mediaType.PrivateData, byteOffset + 2, privateData, privateDataSize, ppsLength);
-                        privateDataSize += ppsLength;
-                        for (int j = 0; j < ppsLength; ++j)
-                        {
-                            sb.AppendFormat("{0:x2}", mediaType.PrivateData[byteOffset + 2 + j]);
-                        }
-                        break;
-                    }
-                }
+                config.nStreamType = 2; // video
+                config.nWidth = mediaType.Width;
+                config.nHeight = mediaType.Height;
 
                 // save IIS compatible private data,
                 // we'll use it later to compare to publishing point's manifest
-                mediaType.PrivateDataIisString = sb.ToString();
-
-                int totalDataSize = Marshal.SizeOf(mvih) + privateDataSize;
-                Marshal.StructureToPtr(mvih, this.mediaDataPtr, true);
-                IntPtr extraDataPtr = IntPtr.Add(this.mediaDataPtr, Marshal.SizeOf(mvih) - 4); // TODO: research this 4 byte diff
-                Marshal.Copy(privateData, 0, extraDataPtr, privateDataSize);
-
-                streamId = this.publisher.AddStream(publishStreamId, 2 /* video */, mediaType.Bitrate, 0, totalDataSize - 4, this.mediaDataPtr);
+                mediaType.PrivateDataIisString = SmoothStreamingSegmenter.GetIisPrivateData(mediaType.PrivateData);
             }
             else if (mediaType.ContentType == MediaContentType.Audio)
             {
                 publishStreamId = this.publisher.RegisterMediaType(mediaType);
 
-                WAVEFORMATEX wfx = new WAVEFORMATEX();
-                wfx.wFormatTag = 0x00FF; // AAC
-                wfx.nChannels = (ushort)mediaType.Channels;
-                wfx.nSamplesPerSec = (uint)mediaType.SampleRate;
-                wfx.nAvgBytesPerSec = (uint)mediaType.Bitrate / 8;
-                wfx.nBlockAlign = 4;
-                wfx.wBitsPerSample = 16;
-                wfx.cbSize = (ushort)mediaType.PrivateData.Length;
-
-                int totalDataSize = Marshal.SizeOf(wfx) + mediaType.PrivateData.Length;
-                Marshal.StructureToPtr(wfx, this.mediaDataPtr, true);
-                IntPtr extraDataPtr = IntPtr.Add(this.mediaDataPtr, Marshal.SizeOf(wfx) - 2);
-                Marshal.Copy(mediaType.PrivateData, 0, extraDataPtr, mediaType.PrivateData.Length);
-
-                streamId = this.publisher.AddStream(publishStreamId, 1 /* audio */, mediaType.Bitrate, 0, totalDataSize - 2, this.mediaDataPtr);
+                config.nStreamType = 1; // audio
+                config.nChannels = mediaType.Channels;
+                config.nSampleRate = mediaType.SampleRate;
             }
             else
             {
                 throw new CriticalStreamException(string.Format("Unsupported content type {0}", mediaType.ContentType));
             }
 
+            GCHandle privateDataHandle = GCHandle.Alloc(mediaType.PrivateData, GCHandleType.Pinned);
+            try
+            {
+                config.nConfigSize = mediaType.PrivateData.Length;
+                config.pConfig = privateDataHandle.AddrOfPinnedObject();
+                streamId = this.publisher.AddStream(publishStreamId, ref config);
+            }
+            finally
+            {
+                privateDataHandle.Free();
+            }
+
             if (streamId < 0)
             {
-                throw new CriticalStreamException(string.Format("MCSSF_AddStream failed {0}", streamId));
+                throw new CriticalStreamException(string.Format("MCSSF_AddStreamConfig failed {0}", streamId));
             }
 
             if (this.publishStreamId2MuxerStreamId.ContainsKey(publishStreamId))
@@ -235,6 +199,12 @@
                 this.publishStreamId2MuxerStreamId.Add(publishStreamId, streamId);
             }
 
+            if (this.statistics != null)
+            {
+                // fragment uploads of the stream are recorded to the same statistics
+                this.publisher.SetStreamStatistics(publishStreamId, this.statistics);
+            }
+
             return publishStreamId;
         }
 
@@ -250,92 +220,321 @@
         /// <param name="length">Buffer length</param>
         public void PushMediaData(Guid publishStreamId, DateTime absoluteTime, long timestamp, bool keyFrame, byte[] buffer, int offset, int length)
         {
-            int muxId = -1;
-            do
+            // keep samples in order
+            this.Flush();
+
+            int muxId = this.PrepareMux(publishStreamId, absoluteTime, timestamp);
+            long adjustedTimestamp = timestamp + this.timestampOffset;
+
+            // the muxer copies the sample before returning, so it's enough to pin it for the call
+            // and no release callback is needed; the fragment is written straight to the segment buffer
+            MCSSF_SAMPLE sample = new MCSSF_SAMPLE();
+            sample.nStartTime = adjustedTimestamp;
+            sample.bIsKeyFrame = keyFrame ? 1 : 0;
+            sample.nDataSize = length;
+
+            MCSSF_BUFFER output = new MCSSF_BUFFER();
+            int pushResult = 0;
+
+            //Global.Log.DebugFormat("Stream {0}, timestamp {1}, keyframe {2}", streamId, timestamp, keyFrame);
+            GCHandle sampleHandle = GCHandle.Alloc(buffer, GCHandleType.Pinned);
+            try
             {
-                muxId = this.publisher.GetMuxId(publishStreamId);
-                if (muxId < 0)
+                sample.pData = Marshal.UnsafeAddrOfPinnedArrayElement(buffer, offset);
+
+                while (true)
                 {
-                    // stream re-registration necessary (eg added another bitrate)
-                    MediaType mt = this.publisher.GetMediaType(publishStreamId);
-                    if (mt == null)
-                    {
-                        throw new CriticalStreamException(string.Format("Media type {0} already unregistered", publishStreamId));
-                    }
-                    else
+                    this.AcquireSegment();
+
+                    output = this.segment;
+                    output.nDataSize = 0;
+                    long started = Stopwatch.GetTimestamp();
+                    pushResult = SmoothStreamingSegmenter.MCSSF_PushSample(muxId, this.publishStreamId2MuxerStreamId[publishStreamId], ref sample, ref output);
+                    this.RecordMux(started);
+
+                    if (pushResult != -6)
                     {
-                        this.RegisterStream(mt);
+                        break;
                     }
+
+                    // segment doesn't fit, nothing was consumed by the muxer so take a bigger buffer and repeat
+                    this.GrowSegment(output.nDataSize);
                 }
             }
-            while (muxId < 0);
-
-            if (!this.synchronized)
+            finally
             {
-                // make sure that publishing point matches to our media
-                this.publisher.CompareHeader();
+                sampleHandle.Free();
+            }
 
-                DateTime lastAbsoluteTime = DateTime.MinValue;
-                long lastTimestamp = long.MinValue;
-                this.publisher.GetSynchronizationInfo(out lastAbsoluteTime, out lastTimestamp);
+            if (pushResult < 0)
+            {
+                throw new CriticalStreamException(string.Format("MCSSF_PushSample failed {0} (0x{1:x}), timestamp {2}", pushResult, output.nDataSize, adjustedTimestamp));
+            }
 
-                if (lastTimestamp > long.MinValue)
+            if (output.nDataSize > 0)
+            {
+                try
                 {
-                    // this is a continuation of previously connected stream
-                    this.timestampOffset = (absoluteTime - lastAbsoluteTime).Ticks + lastTimestamp - timestamp;
-                    Global.Log.DebugFormat("Re-sync after disconnection: offset {0}, last absolute {1:yy-MM-dd HH:mm:ss.fff}, last timestamp {2}, cur absolute {3:yy-MM-dd HH:mm:ss.fff}, cur timestamp {4}", this.timestampOffset, lastAbsoluteTime, lastTimestamp, absoluteTime, timestamp);
+                    // TODO: start from key frame
+                    publisher.PushData(publishStreamId, absoluteTime, adjustedTimestamp, this.segment.pData, output.nDataSize);
+                }
+                finally
+                {
+                    // segment goes back to the pool until the next one is completed
+                    this.ReleaseSegment();
                 }
-
-                this.synchronized = true;
             }
+        }
 
-            long adjustedTimestamp = timestamp + this.timestampOffset;
+        /// <summary>
+        /// Queues media data to be pushed to the muxer with the next batch.
+        /// Media data buffer is referenced till the batch is pushed
+        /// </summary>
+        /// <param name="publishStreamId">Stream GUID</param>
+        /// <param name="absoluteTime">Current system time</param>
+        /// <param name="timestamp">Current timestamp</param>
+        /// <param name="keyFrame">Is it keyframe</param>
+        /// <param name="mediaData">Buffer with media data</param>
+        /// <param name="offset">Buffer offset</param>
+        /// <param name="length">Buffer length</param>
+        public void QueueMediaData(Guid publishStreamId, DateTime absoluteTime, long timestamp, bool keyFrame, PacketBuffer mediaData, int offset, int length)
+        {
+            this.PrepareMux(publishStreamId, absoluteTime, timestamp);
 
-            if (this.mediaDataPtrSize < length)
+            mediaData.AddRef();
+            this.pendingSamples.Add(new SmoothStreamingSample
+            {
+                PublishStreamId = publishStreamId,
+                AbsoluteTime = absoluteTime,
+                Timestamp = timestamp + this.timestampOffset,
+                KeyFrame = keyFrame,
+                MediaData = mediaData,
+                Offset = offset,
+                Length = length
+            });
+
+            if (this.pendingSamples.Count >= Global.SmoothStreamingMaxBatchSize)
             {
-                Marshal.FreeHGlobal(this.mediaDataPtr);
-                this.mediaDataPtrSize = length * 3 / 2;
-                this.mediaDataPtr = Marshal.AllocHGlobal(this.mediaDataPtrSize);
+                this.Flush();
             }
+        }
 
-            Marshal.Copy(buffer, offset, this.mediaDataPtr, length);
-
-            int outputDataSize = 0;
-            IntPtr outputDataPtr = IntPtr.Zero;
-            //Global.Log.DebugFormat("Stream {0}, timestamp {1}, keyframe {2}", streamId, timestamp, keyFrame);
-            int pushResult = SmoothStreamingSegmenter.MCSSF_PushMedia(muxId, this.publishStreamId2MuxerStreamId[publishStreamId], adjustedTimestamp, 0, keyFrame, length, mediaDataPtr, out outputDataSize, out outputDataPtr);
-
-            if (pushResult < 0)
+        /// <summary>
+        /// Pushes queued media data to the muxer in one call and
+        /// pushes all segments completed by this batch to publisher
+        /// </summary>
+        public void Flush()
+        {
+            int count = this.pendingSamples.Count;
+            if (count == 0)
             {
-                throw new CriticalStreamException(string.Format("MCSSF_PushMedia failed {0} (0x{1:x}), timestamp {2}", pushResult, outputDataSize, adjustedTimestamp));
+                return;
             }
 
-            if (outputDataSize > 0)
+            // stream re-registration flushes the queue, so the batch is taken off it first
+            List<SmoothStreamingSample> batch = this.pendingSamples;
+            this.pendingSamples = this.flushingSamples;
+            this.flushingSamples = batch;
+
+            GCHandle streamIdsHandle = GCHandle.Alloc(this.batchStreamIds, GCHandleType.Pinned);
+            GCHandle samplesHandle = GCHandle.Alloc(this.batchSamples, GCHandleType.Pinned);
+
+            try
             {
-                if (outputDataSize > Global.SegmentAllocator.BufferSize)
+                int muxId = this.ResolveBatch(batch);
+
+                // no release callback, so the muxer copies the samples and media buffers are released right after the call;
+                // borrowing them would keep a 1 MB media buffer locked per sample until its fragment is completed
+                for (int i = 0; i < count; ++i)
                 {
-                    Global.SegmentAllocator.Reallocate(outputDataSize * 3 / 2, Global.SegmentAllocator.BufferCount);
+                    SmoothStreamingSample pending = batch[i];
+                    this.batchHandles[i] = GCHandle.Alloc(pending.MediaData.Buffer, GCHandleType.Pinned);
+                    this.batchSamples[i].nStartTime = pending.Timestamp;
+                    this.batchSamples[i].nStopTime = 0;
+                    this.batchSamples[i].bIsKeyFrame = pending.KeyFrame ? 1 : 0;
+                    this.batchSamples[i].nDataSize = pending.Length;
+                    this.batchSamples[i].pData = Marshal.UnsafeAddrOfPinnedArrayElement(pending.MediaData.Buffer, pending.Offset);
                 }
 
-                PacketBuffer segment = Global.SegmentAllocator.LockBuffer();
-                Marshal.Copy(outputDataPtr, segment.Buffer, 0, outputDataSize);
-                segment.ActualBufferSize = outputDataSize;
-
-                try
+                int position = 0;
+                while (position < count)
                 {
-                    // TODO: start from key frame
-                    publisher.PushData(publishStreamId, absoluteTime, adjustedTimestamp, segment.Buffer, 0, outputDataSize);
+                    this.AcquireSegment();
+
+                    MCSSF_BUFFER output = this.segment;
+                    int fragmentCount = 0;
+                    long started = Stopwatch.GetTimestamp();
+                    int pushResult = SmoothStreamingSegmenter.MCSSF_PushSamples(
+                        muxId,
+                        Marshal.UnsafeAddrOfPinnedArrayElement(this.batchStreamIds, position),
+                        Marshal.UnsafeAddrOfPinnedArrayElement(this.batchSamples, position),
+                        count - position,
+                        ref output,
+                        this.batchFragments,
+                        this.batchFragments.Length,
+                        out fragmentCount);
+
+                    this.RecordMux(started);
+
+                    if (pushResult == -6)
+                    {
+                        // segment doesn't fit, nothing was consumed by the muxer so take a bigger buffer and repeat
+                        this.GrowSegment(output.nDataSize);
+                        continue;
+                    }
+
+                    if (pushResult < 0)
+                    {
+                        throw new CriticalStreamException(string.Format("MCSSF_PushSamples failed {0}, timestamp {1}", pushResult, batch[position].Timestamp));
+                    }
+
+                    if (fragmentCount > 0)
+                    {
+                        try
+                        {
+                            for (int i = 0; i < fragmentCount; ++i)
+                            {
+                                // segment is pushed with the time of the sample which completed it
+                                SmoothStreamingSample next = batch[position + this.batchFragments[i].nSampleIndex];
+
+                                // TODO: start from key frame
+                                publisher.PushData(next.PublishStreamId, next.AbsoluteTime, next.Timestamp, IntPtr.Add(this.segment.pData, this.batchFragments[i].nOffset), this.batchFragments[i].nDataSize);
+                            }
+                        }
+                        finally
+                        {
+                            this.ReleaseSegment();
+                        }
+                    }
+
+                    position += pushResult;
                 }
-                catch
+            }
+            finally
+            {
+                for (int i = 0; i < count; ++i)
                 {
-                    segment.Release();
-                    throw;
+                    if (this.batchHandles[i].IsAllocated)
+                    {
+                        this.batchHandles[i].Free();
+                    }
+
+                    batch[i].MediaData.Release();
                 }
 
-                segment.Release();
+                batch.Clear();
+                streamIdsHandle.Free();
+                samplesHandle.Free();
             }
         }
 
+        /// <summary>
+        /// Pushes audio/video messages demuxed by the native demuxer to the muxer, which strips
+        /// media headers and applies timestamps itself, and pushes completed segments to publisher
+        /// </summary>
+        /// <param name="messages">Demuxed messages</param>
+        /// <param name="offset">Index of the first media message</param>
+        /// <param name="count">Number of consecutive media messages</param>
+        /// <param name="messageStreamId">RTMP message stream the media belongs to</param>
+        /// <param name="audioStreamId">Audio stream GUID, empty if audio isn't registered</param>
+        /// <param name="videoStreamId">Video stream GUID, empty if video isn't registered</param>
+        /// <param name="timestampAdjust">Timestamp adjustment of RTMP message stream, in ms</param>
+        /// <param name="absoluteTimeOrigin">Absolute time of RTMP timestamp 0</param>
+        /// <returns>Number of messages taken, the muxer stops at the first message it can't handle</returns>
+        public int IngestMessages(RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages, int offset, int count, int messageStreamId, Guid audioStreamId, Guid videoStreamId, long timestampAdjust, DateTime absoluteTimeOrigin)
+        {
+            Guid firstStreamId = (RtmpMessageType)messages[offset].nMessageType == RtmpMessageType.Video ? videoStreamId : audioStreamId;
+            if (firstStreamId == Guid.Empty)
+            {
+                return 0;
+            }
+
+            // keep samples in order
+            this.Flush();
+
+            long firstTimestamp = (messages[offset].nTimestamp - timestampAdjust) * 10000;
+            int muxId = this.PrepareMux(firstStreamId, absoluteTimeOrigin.AddTicks(firstTimestamp), firstTimestamp);
+
+            MCSSF_INGEST_CONTEXT context = new MCSSF_INGEST_CONTEXT();
+            context.nMessageStreamId = messageStreamId;
+            context.nAudioStreamId = audioStreamId != Guid.Empty ? this.publishStreamId2MuxerStreamId[audioStreamId] : -1;
+            context.nVideoStreamId = videoStreamId != Guid.Empty ? this.publishStreamId2MuxerStreamId[videoStreamId] : -1;
+            context.nTimestampAdjust = timestampAdjust;
+            context.nTimestampOffset = this.timestampOffset;
+
+            GCHandle messagesHandle = GCHandle.Alloc(messages, GCHandleType.Pinned);
+
+            int position = 0;
+
+            try
+            {
+                while (position < count)
+                {
+                    this.AcquireSegment();
+
+                    MCSSF_BUFFER output = this.segment;
+                    int fragmentCount = 0;
+                    long started = Stopwatch.GetTimestamp();
+                    int pushResult = SmoothStreamingSegmenter.MCSSF_IngestMessages(
+                        muxId,
+                        ref context,
+                        Marshal.UnsafeAddrOfPinnedArrayElement(messages, offset + position),
+                        count - position,
+                        ref output,
+                        this.batchFragments,
+                        this.batchFragments.Length,
+                        out fragmentCount);
+
+                    this.RecordMux(started);
+
+                    if (pushResult == -6)
+                    {
+                        // segment doesn't fit, nothing was consumed by the muxer so take a bigger buffer and repeat
+                        this.GrowSegment(output.nDataSize);
+                        continue;
+                    }
+
+                    if (pushResult < 0)
+                    {
+                        throw new CriticalStreamException(string.Format("MCSSF_IngestMessages failed {0}, timestamp {1}", pushResult, messages[offset + position].nTimestamp));
+                    }
+
+                    if (fragmentCount > 0)
+                    {
+                        try
+                        {
+                            for (int i = 0; i < fragmentCount; ++i)
+                            {
+                                // segment is pushed with the time of the message which completed it
+                                long timestamp = (messages[offset + position + this.batchFragments[i].nSampleIndex].nTimestamp - timestampAdjust) * 10000;
+                                Guid publishStreamId = this.batchFragments[i].nStreamId == context.nVideoStreamId ? videoStreamId : audioStreamId;
+
+                                publisher.PushData(publishStreamId, absoluteTimeOrigin.AddTicks(timestamp), timestamp + this.timestampOffset, IntPtr.Add(this.segment.pData, this.batchFragments[i].nOffset), this.batchFragments[i].nDataSize);
+                            }
+                        }
+                        finally
+                        {
+                            this.ReleaseSegment();
+                        }
+                    }
+
+                    position += pushResult;
+
+                    if (pushResult == 0 || fragmentCount == 0)
+                    {
+                        // stopped at a message to be processed by the caller
+                        break;
+                    }
+                }
+            }
+            finally
+            {
+                messagesHandle.Free();
+            }
+
+            return position;
+        }
+
         /// <summary>
         /// Adjusts timestamp offset after timestamps were re-synchronized in RTMP message stream
         /// </summary>
@@ -354,296 +553,179 @@
         #region Private methods
 
         /// <summary>
-        /// Corrects header data received from SSF SDK
+        /// Records duration of a muxer call
         /// </summary>
-        /// <param name="origHeader">Original header</param>
-        /// <param name="properHeader">Proper header</param>
-        /// <param name="streamId">Stream id</param>
-        /// <param name="mediaType">Media type</param>
-        private void CorrectHeader(PacketBuffer origHeader, PacketBuffer properHeader, int streamId, MediaType mediaType)
+        /// <param name="started">Stopwatch timestamp taken before the call</param>
+        private void RecordMux(long started)
         {
-            long nStreamSMILPos = 0;
-            uint nStreamSMILSize = 0;
-
-            long nMoovPos = 0;
-            uint nMoovSize = 0;
-            long nTrakPos = 0;
-            uint nTrakSize = 0;
-            long nMdiaPos = 0;
-            uint nMdiaSize = 0;
-            long nMinfPos = 0;
-            uint nMinfSize = 0;
-            long nStblPos = 0;
-            uint nStblSize = 0;
-            long nStsdPos = 0;
-            uint nStsdSize = 0;
-            long nAvc1Pos = 0;
-            uint nAvc1Size = 0;
-            long nAvccPos = 0;
-            uint nAvccSize = 0;
-
-            MemoryStream ms = new MemoryStream(origHeader.Buffer);
-
-            // find start of StreamManifestBox
-            using (EndianBinaryReader reader = new EndianBinaryReader(ms, true))
+            if (this.statistics != null)
             {
-                reader.Endiannes = Endianness.BigEndian;
+                this.statistics.Record(PipelineStage.Mux, started);
+            }
+        }
 
-                while (reader.BaseStream.Position < reader.BaseStream.Length)
+        /// <summary>
+        /// Resolves mux id of the stream, re-registering the stream if necessary,
+        /// and synchronizes timestamps with the publishing point on the first call
+        /// </summary>
+        /// <param name="publishStreamId">Stream GUID</param>
+        /// <param name="absoluteTime">Current system time</param>
+        /// <param name="timestamp">Current timestamp</param>
+        /// <returns>Mux id</returns>
+        private int PrepareMux(Guid publishStreamId, DateTime absoluteTime, long timestamp)
+        {
+            int muxId = -1;
+            do
+            {
+                muxId = this.publisher.GetMuxId(publishStreamId);
+                if (muxId < 0)
                 {
-                    long nPos = reader.BaseStream.Position;
-                    uint nBlockSize = reader.ReadUInt32();
-                    uint nBlockType = reader.ReadUInt32();
-
-                    if (nBlockType == 0x75756964) // uuid
-                    {
-                        byte[] gbyte = new byte[16];
-                        reader.Read(gbyte, 0, 16);
-                        Guid guid = new Guid(gbyte);
-                        if (guid == new Guid("{1be52f3c-eee4-a340-ae81-5300199dc378}"))
-                        {
-                            reader.Seek(4, SeekOrigin.Current);
-                            reader.Seek((int)(nBlockSize - 28), SeekOrigin.Current);
-                        }
-                        else if (guid == new Guid("{300bd4a5-14e8-dd11-ba2f-0800200c9a66}"))
-                        {
-                            nStreamSMILPos = nPos;
-                            nStreamSMILSize = nBlockSize;
-                            reader.Seek(4, SeekOrigin.Current);
-                            reader.Seek((int)(nBlockSize - 28), SeekOrigin.Current);
-                        }
-                        else
-                        {
-                            reader.Seek((int)(nBlockSize - 24), SeekOrigin.Current);
-                        }
-                    }
-                    else if (nBlockType == 0x6D6F6F76) // moov
+                    // stream re-registration necessary (eg added another bitrate)
+                    MediaType mt = this.publisher.GetMediaType(publishStreamId);
+                    if (mt == null)
                     {
-                        nMoovPos = nPos;
-                        nMoovSize = nBlockSize;
-
-                        while (reader.BaseStream.Position < nMoovPos + nMoovSize)
-                        {
-                            nPos = reader.BaseStream.Position;
-                            nBlockSize = reader.ReadUInt32();
-                            nBlockType = reader.ReadUInt32();
-
-                            if (nBlockType == 0x7472616B) // trak
-                            {
-                                nTrakPos = nPos;
-                                nTrakSize = nBlockSize;
-
-                                while (reader.BaseStream.Position < nTrakPos + nTrakSize)
-                                {
-                                    nPos = reader.BaseStream.Position;
-                                    nBlockSize = reader.ReadUInt32();
-                                    nBlockType = reader.ReadUInt32();
-
-                                    if (nBlockType == 0x6D646961) // mdia
-                                    {
-                                        nMdiaPos = nPos;
-                                        nMdiaSize = nBlockSize;
-
-                                        while (reader.BaseStream.Position < nMdiaPos + nMdiaSize)
-                                        {
-                                            nPos = reader.BaseStream.Position;
-                                            nBlockSize = reader.ReadUInt32();
-                                            nBlockType = reader.ReadUInt32();
-
-                                            if (nBlockType == 0x6D696E66) // minf
-                                            {
-                                                nMinfPos = nPos;
-                                                nMinfSize = nBlockSize;
-
-                                                while (reader.BaseStream.Position < nMinfPos + nMinfSize)
-                                                {
-                                                    nPos = reader.BaseStream.Position;
-                                                    nBlockSize = reader.ReadUInt32();
-                                                    nBlockType = reader.ReadUInt32();
-
-                                                    if (nBlockType == 0x7374626C) // stbl
-                                                    {
-                                                        nStblPos = nPos;
-                                                        nStblSize = nBlockSize;
-
-                                                        while (reader.BaseStream.Position < nStblPos + nStblSize)
-                                                        {
-                                                            nPos = reader.BaseStream.Position;
-                                                            nBlockSize = reader.ReadUInt32();
-                                                            nBlockType = reader.ReadUInt32();
-
-                                                            if (nBlockType == 0x73747364) // stsd
-                                                            {
-                                                                nStsdPos = nPos;
-                                                                nStsdSize = nBlockSize;
-                                                                reader.Seek(8, SeekOrigin.Current);
-
-                                                                while (reader.BaseStream.Position < nStsdPos + nStsdSize)
-                                                                {
-                                                                    nPos = reader.BaseStream.Position;
-                                                                    nBlockSize = reader.ReadUInt32();
-                                                                    nBlockType = reader.ReadUInt32();
-
-                                                                    if (nBlockType == 0x61766331) // avc1
-                                                                    {
-                                                                        nAvc1Pos = nPos;
-                                                                        nAvc1Size = nBlockSize;
-
-                                                                        reader.Seek(78, SeekOrigin.Current);
-                                                                        nPos = reader.BaseStream.Position;
-                                                                        nBlockSize = reader.ReadUInt32();
-                                                                        nBlockType = reader.ReadUInt32();
-
-                                                                        if (nBlockType == 0x61766343) // avcC
-                                                                        {
-                                                                            nAvccPos = nPos;
-                                                                            nAvccSize = nBlockSize;
-                                                                        }
-                                                                        else
-                                                                        {
-                                                                            reader.Seek((int)(nBlockSize - 8 - 78 - 8), SeekOrigin.Current);
-                                                                        }
-                                                                    }
-                                                                    else
-                                                                    {
-                                                                        reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                                                                    }
-                                                                }
-                                                            }
-                                                            else
-                                                            {
-                                                                reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                                                            }
-                                                        }
-                                                    }
-                                                    else
-                                                    {
-                                                        reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                                                    }
-                                                }
-                                            }
-                                            else
-                                            {
-                                                reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                                            }
-                                        }
-                                    }
-                                    else
-                                    {
-                                        reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
-                            }
-                        }
+                        throw new CriticalStreamException(string.Format("Media type {0} already unregistered", publishStreamId));
                     }
                     else
                     {
-                        reader.Seek((int)(nBlockSize - 8), SeekOrigin.Current);
+                        this.RegisterStream(mt);
                     }
                 }
             }
+            while (muxId < 0);
 
-            if (nStreamSMILPos > 0 && nAvccPos > 0)
+            if (!this.synchronized)
             {
-                StringBuilder sb = new StringBuilder();
+                // make sure that publishing point matches to our media
+                this.publisher.CompareHeader();
 
-                // SPS start code
-                sb.Append("00000001");
-                int numOfSps = mediaType.PrivateData[5] & 0x1F;
-                int byteOffset = 6;
-                for (int i = 0; i < numOfSps; ++i)
+                DateTime lastAbsoluteTime = DateTime.MinValue;
+                long lastTimestamp = long.MinValue;
+                this.publisher.GetSynchronizationInfo(out lastAbsoluteTime, out lastTimestamp);
+
+                if (lastTimestamp > long.MinValue)
                 {
-                    int spsLength = (int)mediaType.PrivateData[byteOffset] << 8 | mediaType.PrivateData[byteOffset + 1];
-                    byteOffset += 2;
-                    for (int j = 0; i < spsLength; ++j)
-                    {
-                        sb.AppendFormat("{0:X2}", mediaType.PrivateData[byteOffset + j]);
-                    }
-                    byteOffset += spsLength;
+                    // this is a continuation of previously connected stream
+                    this.timestampOffset = (absoluteTime - lastAbsoluteTime).Ticks + lastTimestamp - timestamp;
+                    Global.Log.DebugFormat("Re-sync after disconnection: offset {0}, last absolute {1:yy-MM-dd HH:mm:ss.fff}, last timestamp {2}, cur absolute {3:yy-MM-dd HH:mm:ss.fff}, cur timestamp {4}", this.timestampOffset, lastAbsoluteTime, lastTimestamp, absoluteTime, timestamp);
                 }
 
-                // PPS start code
-                sb.Append("00000001");
-                int numOfPps = mediaType.PrivateData[byteOffset];
-                byteOffset++;
-                for (int i = 0; i < numOfPps; ++i)
+                this.synchronized = true;
+            }
+
+            return muxId;
+        }
+
+        /// <summary>
+        /// Resolves mux id and muxer stream ids of a batch at push time: another session of the publishing
+        /// point may have re-created the mux since the samples were queued, streams are re-registered then
+        /// </summary>
+        /// <param name="batch">Samples to push</param>
+        /// <returns>Mux id, muxer stream ids are set to batchStreamIds</returns>
+        private int ResolveBatch(List<SmoothStreamingSample> batch)
+        {
+            while (true)
+            {
+                int muxId = -1;
+                bool resolved = true;
+
+                for (int i = 0; i < batch.Count; ++i)
                 {
-                    int ppsLength = (int)mediaType.PrivateData[byteOffset] << 8 | mediaType.PrivateData[byteOffset + 1];
-                    byteOffset += 2;
-                    for (int j = 0; i < ppsLength; ++j)
+                    SmoothStreamingSample pending = batch[i];
+                    int sampleMuxId = this.PrepareMux(pending.PublishStreamId, pending.AbsoluteTime, pending.Timestamp);
+                    if (muxId >= 0 && sampleMuxId != muxId)
                     {
-                        sb.AppendFormat("{0:X2}", mediaType.PrivateData[byteOffset + j]);
+                        // mux re-created by re-registration of a later stream, ids taken so far are stale
+                        resolved = false;
                     }
-                    byteOffset += ppsLength;
+
+                    muxId = sampleMuxId;
+                    this.batchStreamIds[i] = this.publishStreamId2MuxerStreamId[pending.PublishStreamId];
                 }
 
-                string sSmil = string.Format
-                (
-                    @"<?xml version=""1.0"" encoding=""utf-8""?><smil xmlns=""http://www.w3.org/2001/SMIL20/Language""><head></head><body><switch><video src=""Streams"" systemBitrate=""{0}""><param name=""trackID"" value=""{1}"" valuetype=""data""/><param name=""FourCC"" value=""H264"" valuetype=""data""/><param name=""CodecPrivateData"" value=""{2}"" valuetype=""data""/><param name=""MaxWidth"" value=""{3}"" valuetype=""data""/><param name=""MaxHeight"" value=""{4}"" valuetype=""data""/><param name=""Subtype"" value=""H264"" valuetype=""data""/></video></switch></body></smil>",
-                    mediaType.Bitrate,
-                    streamId + 1,
-                    sb.ToString(),
-                    mediaType.Width,
-                    mediaType.Height
-                );
-                byte[] bySmil = Encoding.UTF8.GetBytes(sSmil);
-
-                ms.Position = 0;
-                int nXmlGap = sSmil.Length + 28 - (int)nStreamSMILSize;
-                int nGap = mediaType.PrivateData.Length + 8 - (int)nAvccSize;
-
-                // adjust block sizes
-                using (EndianBinaryWriter writer = new EndianBinaryWriter(ms, true))
+                if (resolved)
                 {
-
-                    writer.Endiannes = Endianness.BigEndian;
-
-                    writer.BaseStream.Seek(nStreamSMILPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nStreamSMILSize + nXmlGap));
-
-                    writer.BaseStream.Seek(nMoovPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nMoovSize + nGap));
-                    writer.BaseStream.Seek(nTrakPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nTrakSize + nGap));
-                    writer.BaseStream.Seek(nMdiaPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nMdiaSize + nGap));
-                    writer.BaseStream.Seek(nMinfPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nMinfSize + nGap));
-                    writer.BaseStream.Seek(nStblPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nStblSize + nGap));
-                    writer.BaseStream.Seek(nStsdPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nStsdSize + nGap));
-                    writer.BaseStream.Seek(nAvc1Pos, SeekOrigin.Begin);
-                    writer.Write((uint)(nAvc1Size + nGap));
-                    writer.BaseStream.Seek(nAvccPos, SeekOrigin.Begin);
-                    writer.Write((uint)(nAvccSize + nGap));
-
+                    return muxId;
                 }
+            }
+        }
 
-                // copy data before stream SMIL
-                Array.Copy(origHeader.Buffer, 0, properHeader.Buffer, 0, nStreamSMILPos + 28);
-
-                // copy re-created SMIL
-                Array.Copy(bySmil, 0, properHeader.Buffer, nStreamSMILPos + 28, bySmil.Length);
+        /// <summary>
+        /// Takes segment buffer from the native pool unless it's already taken
+        /// </summary>
+        private void AcquireSegment()
+        {
+            if (this.segment.pData == IntPtr.Zero)
+            {
+                if (SmoothStreamingSegmenter.MCSSF_AcquireBuffer(this.segmentCapacity, ref this.segment) < 0)
+                {
+                    throw new CriticalStreamException(string.Format("MCSSF_AcquireBuffer failed for {0} bytes", this.segmentCapacity));
+                }
+            }
+        }
 
-                // copy data between SMIL and avcC block
-                Array.Copy(origHeader.Buffer, nStreamSMILPos + nStreamSMILSize, properHeader.Buffer, nStreamSMILPos + nStreamSMILSize + nXmlGap, nAvccPos - nStreamSMILPos - nStreamSMILSize + 8);
-                long nDestPos = nXmlGap + nAvccPos + 8;
+        /// <summary>
+        /// Returns segment buffer to the native pool
+        /// </summary>
+        private void ReleaseSegment()
+        {
+            if (this.segment.pData != IntPtr.Zero)
+            {
+                SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref this.segment);
+                this.segment = new MCSSF_BUFFER();
+            }
+        }
 
-                // copy real private data
-                Array.Copy(mediaType.PrivateData, 0, properHeader.Buffer, nDestPos, mediaType.PrivateData.Length);
-                nDestPos += mediaType.PrivateData.Length;
+        /// <summary>
+        /// Replaces segment buffer with one which fits specified size, the pool rounds it up to its size class
+        /// </summary>
+        /// <param name="requiredSize">Segment size reported by the muxer</param>
+        private void GrowSegment(int requiredSize)
+        {
+            this.ReleaseSegment();
+            this.segmentCapacity = Math.Max(this.segmentCapacity, requiredSize);
+        }
 
-                // copy remaining data after avcC block
-                Array.Copy(origHeader.Buffer, nAvccPos + nAvccSize, properHeader.Buffer, nDestPos, nMoovSize - (nAvccPos + nAvccSize - nMoovPos));
+        /// <summary>
+        /// Makes IIS style codec private data (SPS and PPS with start codes) from AVC decoder configuration record
+        /// </summary>
+        /// <param name="avcConfig">AVC decoder configuration record</param>
+        /// <returns>Hex string of the first SPS and PPS</returns>
+        private static string GetIisPrivateData(byte[] avcConfig)
+        {
+            StringBuilder sb = new StringBuilder();
 
-                properHeader.ActualBufferSize = origHeader.ActualBufferSize + nXmlGap + nGap;
+            // SPS
+            sb.Append("00000001");
+            int numOfSps = avcConfig[5] & 0x1F;
+            int byteOffset = 6;
+            for (int i = 0; i < numOfSps; ++i)
+            {
+                int spsLength = (int)avcConfig[byteOffset] << 8 | avcConfig[byteOffset + 1];
+                if (i == 0)
+                {
+                    for (int j = 0; j < spsLength; ++j)
+                    {
+                        sb.AppendFormat("{0:x2}", avcConfig[byteOffset + 2 + j]);
+                    }
+                }
+                byteOffset += 2 + spsLength;
+            }
 
+            // PPS
+            sb.Append("00000001");
+            int numOfPps = avcConfig[byteOffset];
+            byteOffset++;
+            if (numOfPps > 0)
+            {
+                int ppsLength = (int)avcConfig[byteOffset] << 8 | avcConfig[byteOffset + 1];
+                for (int j = 0; j < ppsLength; ++j)
+                {
+                    sb.AppendFormat("{0:x2}", avcConfig[byteOffset + 2 + j]);
+                }
             }
+
+            return sb.ToString();
         }
 
         #endregion
@@ -651,125 +733,148 @@
         #region Unmanaged interface to MCommsSSFSDK
 
         /// <summary>
-        /// WAVEFORMATEX structure
+        /// MCSSF_SAMPLE structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct MCSSF_SAMPLE
+        {
+            public Int64 nStartTime;
+            public Int64 nStopTime;
+            public Int32 bIsKeyFrame;
+            public Int32 nDataSize;
+            public IntPtr pData;
+            public IntPtr pfnRelease;
+            public IntPtr pvReleaseContext;
+        }
+
+        /// <summary>
+        /// MCSSF_BUFFER structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct MCSSF_BUFFER
+        {
+            public IntPtr pData;
+            public Int32 nCapacity;
+            public Int32 nDataSize;
+        }
+
+        /// <summary>
+        /// MCSSF_FRAGMENT_POLICY structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct MCSSF_FRAGMENT_POLICY
+        {
+            public Int64 nDuration;
+            public Int64 nMaxDuration;
+            public Int64 nChunkDuration;
+            public Int32 bAlignToVideo;
+            public Int32 nChunkSamples;
+        }
+
+        /// <summary>
+        /// MCSSF_HLS_POLICY structure
         /// </summary>
         [StructLayout(LayoutKind.Sequential)]
-        private struct WAVEFORMATEX
+        public struct MCSSF_HLS_POLICY
         {
-            public ushort wFormatTag;
-            public ushort nChannels;
-            public uint nSamplesPerSec;
-            public uint nAvgBytesPerSec;
-            public ushort nBlockAlign;
-            public ushort wBitsPerSample;
-            public ushort cbSize;
+            public Int64 nSegmentDuration;
+            public Int32 nPlaylistLength;
         }
 
         /// <summary>
-        /// RECT structure
+        /// MCSSF_STREAM_CONFIG structure
         /// </summary>
         [StructLayout(LayoutKind.Sequential)]
-        private struct RECT
+        public struct MCSSF_STREAM_CONFIG
         {
-            public Int32 left;
-            public Int32 top;
-            public Int32 right;
-            public Int32 bottom;
+            public Int32 nStreamType;
+            public Int32 nBitrate;
+            public Int32 nLanguage;
+            public Int32 nWidth;
+            public Int32 nHeight;
+            public Int32 nChannels;
+            public Int32 nSampleRate;
+            public Int32 nConfigSize;
+            public IntPtr pConfig;
+            [MarshalAs(UnmanagedType.LPStr)]
+            public string szCacheKey;
         }
 
         /// <summary>
-        /// BITMAPINFOHEADER structure
+        /// MCSSF_INGEST_CONTEXT structure
         /// </summary>
         [StructLayout(LayoutKind.Sequential)]
-        private struct BITMAPINFOHEADER
+        public struct MCSSF_INGEST_CONTEXT
         {
-            public UInt32 biSize;
-            public Int32 biWidth;
-            public Int32 biHeight;
-            public UInt16 biPlanes;
-            public UInt16 biBitCount;
-            public UInt32 biCompression;
-            public UInt32 biSizeImage;
-            public Int32 biXPelsPerMeter;
-            public Int32 biYPelsPerMeter;
-            public UInt32 biClrUsed;
-            public UInt32 biClrImportant;
+            public Int32 nMessageStreamId;
+            public Int32 nAudioStreamId;
+            public Int32 nVideoStreamId;
+            public Int64 nTimestampAdjust;
+            public Int64 nTimestampOffset;
         }
 
         /// <summary>
-        /// VIDEOINFOHEADER2 structure
+        /// MCSSF_BUFFER_POOL_STATS structure
         /// </summary>
         [StructLayout(LayoutKind.Sequential)]
-        private struct VIDEOINFOHEADER2
+        public struct MCSSF_BUFFER_POOL_STATS
         {
-            public RECT rcSource;
-            public RECT rcTarget;
-            public UInt32 dwBitRate;
-            public UInt32 dwBitErrorRate;
-            public Int64 AvgTimePerFrame;
-            public UInt32 dwInterlaceFlags; // use AMINTERLACE_* defines. Reject connection if undefined bits are not 0
-            public UInt32 dwCopyProtectFlags; // use AMCOPYPROTECT_* defines. Reject connection if undefined bits are not 0
-            public UInt32 dwPictAspectRatioX; // X dimension of picture aspect ratio, e.g. 16 for 16x9 display
-            public UInt32 dwPictAspectRatioY; // Y dimension of picture aspect ratio, e.g.  9 for 16x9 display
-            public UInt32 dwControlFlags; // use AMCONTROL_* defines, use this from now on
-            public UInt32 dwReserved2; // must be 0; reject connection otherwise
-            public BITMAPINFOHEADER bmiHeader;
+            public Int64 nBytesAllocated;
+            public Int64 nBytesInUse;
+            public Int64 nHighWaterBytesAllocated;
+            public Int64 nHighWaterBytesInUse;
+            public Int64 nAcquireCount;
+            public Int64 nAllocationCount;
+            public Int32 nBuffersAllocated;
+            public Int32 nBuffersInUse;
+            public Int32 nHighWaterBuffersAllocated;
+            public Int32 nHighWaterBuffersInUse;
         }
 
         /// <summary>
-        /// MPEG2VIDEOINFO structure
+        /// MCSSF_FRAGMENT structure
         /// </summary>
         [StructLayout(LayoutKind.Sequential)]
-        private struct MPEG2VIDEOINFO
+        public struct MCSSF_FRAGMENT
         {
-            public VIDEOINFOHEADER2 hdr;
-            public UInt32 dwStartTimeCode;
-            public UInt32 cbSequenceHeader;
-            public UInt32 dwProfile;
-            public UInt32 dwLevel;
-            public UInt32 dwFlags;
+            public Int32 nStreamId;
+            public Int32 nSampleIndex;
+            public Int32 nOffset;
+            public Int32 nDataSize;
         }
 
         /// <summary>
         /// Initializes new muxer session
         /// </summary>
         /// <returns>Mux id</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
         public static extern int MCSSF_Initialize();
 
         /// <summary>
-        /// Adds new stream to amux
+        /// Adds new stream to a mux from its AVC decoder configuration record or AAC AudioSpecificConfig
         /// </summary>
         /// <param name="muxId">Mux id</param>
-        /// <param name="streamType">Stream type</param>
-        /// <param name="bitrate">Bitrate</param>
-        /// <param name="language">Language</param>
-        /// <param name="extraDataSize">Codec private data size</param>
-        /// <param name="extraData">Codec private data</param>
-        /// <returns>Stream id</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
-        public static extern int MCSSF_AddStream(
+        /// <param name="config">Stream description</param>
+        /// <returns>Stream id, -1 if mux is unknown, -2 if arguments are invalid, -3 if codec configuration is malformed</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_AddStreamConfig(
             [In] Int32 muxId,
-            [In] Int32 streamType,
-            [In] Int32 bitrate,
-            [In] UInt16 language,
-            [In] Int32 extraDataSize,
-            [In] IntPtr extraData);
+            [In] ref MCSSF_STREAM_CONFIG config);
 
         /// <summary>
         /// Gets stream header
         /// </summary>
         /// <param name="muxId">Mux id</param>
         /// <param name="streamId">Stream id</param>
-        /// <param name="dataSize">Header data size</param>
-        /// <param name="data">Header data</param>
+        /// <param name="dataSize">Header data size, on input capacity of the data buffer if it's provided</param>
+        /// <param name="data">Header data, on input optional buffer to write header to</param>
         /// <returns>Less than zero if error, 1 if success</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
         public static extern int MCSSF_GetHeader(
             [In] Int32 muxId,
             [In] Int32 streamId,
-            [Out] out Int32 dataSize,
-            [Out] out IntPtr data);
+            [In, Out] ref Int32 dataSize,
+            [In, Out] ref IntPtr data);
 
         /// <summary>
         /// Adds new media data to segment
@@ -781,10 +886,10 @@
         /// <param name="keyFrame">Is key frame</param>
         /// <param name="sampleDataSize">Sample data size</param>
         /// <param name="sampleData">Sample data</param>
-        /// <param name="outputDataSize">Segment data size, can be 0</param>
-        /// <param name="outputData">Segment data, can be IntPtr.Zero</param>
+        /// <param name="outputDataSize">Segment data size, can be 0; on input capacity of the output buffer if it's provided</param>
+        /// <param name="outputData">Segment data, can be IntPtr.Zero; on input optional buffer to write segment to</param>
         /// <returns>Less than zero if error, 0 if segment is not readyyet, 1 if segment is ready</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
         private static extern int MCSSF_PushMedia(
             [In] Int32 muxId,
             [In] Int32 streamId,
@@ -793,32 +898,200 @@
             [In] bool keyFrame,
             [In] Int32 sampleDataSize,
             [In] IntPtr sampleData,
-            [Out] out Int32 outputDataSize,
-            [Out] out IntPtr outputData);
+            [In, Out] ref Int32 outputDataSize,
+            [In, Out] ref IntPtr outputData);
+
+        /// <summary>
+        /// Adds new media sample to segment, segment is written to the output buffer when ready
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="streamId">Stream id</param>
+        /// <param name="sample">Sample, copied by the muxer unless release callback is set</param>
+        /// <param name="output">Output buffer, receives segment size or required size if the buffer is too small</param>
+        /// <returns>Less than zero if error, -6 if output buffer is too small, 0 if segment is not ready yet, 1 if segment is ready, 2 if chunk of the current segment is ready</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_PushSample(
+            [In] Int32 muxId,
+            [In] Int32 streamId,
+            [In] ref MCSSF_SAMPLE sample,
+            [In, Out] ref MCSSF_BUFFER output);
+
+        /// <summary>
+        /// Adds batch of media samples to segments, completed segments are packed into the output buffer
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="streamIds">Pointer to stream ids, one per sample</param>
+        /// <param name="samples">Pointer to samples</param>
+        /// <param name="sampleCount">Number of samples</param>
+        /// <param name="output">Output buffer, receives total size of completed segments</param>
+        /// <param name="fragments">Receives descriptors of completed segments</param>
+        /// <param name="maxFragments">Size of the descriptor array</param>
+        /// <param name="fragmentCount">Number of completed segments</param>
+        /// <returns>Less than zero if error, -6 if output buffer is too small, otherwise number of consumed samples</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_PushSamples(
+            [In] Int32 muxId,
+            [In] IntPtr streamIds,
+            [In] IntPtr samples,
+            [In] Int32 sampleCount,
+            [In, Out] ref MCSSF_BUFFER output,
+            [In, Out] MCSSF_FRAGMENT[] fragments,
+            [In] Int32 maxFragments,
+            [Out] out Int32 fragmentCount);
+
+        /// <summary>
+        /// Adds audio/video messages demuxed by the native demuxer to segments, completed segments are packed into the output buffer
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="context">Message stream, muxer stream ids and timestamp adjustments</param>
+        /// <param name="messages">Pointer to messages</param>
+        /// <param name="messageCount">Number of messages</param>
+        /// <param name="output">Output buffer, receives total size of completed segments</param>
+        /// <param name="fragments">Receives descriptors of completed segments</param>
+        /// <param name="maxFragments">Size of the descriptor array</param>
+        /// <param name="fragmentCount">Number of completed segments</param>
+        /// <returns>Less than zero if error, -6 if output buffer is too small, otherwise number of consumed messages</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_IngestMessages(
+            [In] Int32 muxId,
+            [In] ref MCSSF_INGEST_CONTEXT context,
+            [In] IntPtr messages,
+            [In] Int32 messageCount,
+            [In, Out] ref MCSSF_BUFFER output,
+            [In, Out] MCSSF_FRAGMENT[] fragments,
+            [In] Int32 maxFragments,
+            [Out] out Int32 fragmentCount);
 
         /// <summary>
         /// Gets stream index data
         /// </summary>
         /// <param name="muxId">Mux id</param>
         /// <param name="streamId">Stream id</param>
-        /// <param name="dataSize">Data size</param>
-        /// <param name="data">Data</param>
+        /// <param name="dataSize">Data size, on input capacity of the data buffer if it's provided</param>
+        /// <param name="data">Data, on input optional buffer to write index to</param>
         /// <returns>Less than zero if error, 1 if success</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
-        private static extern int MCSSF_GetIndex(
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_GetIndex(
             [In] Int32 muxId,
             [In] Int32 streamId,
-            [Out] out Int32 dataSize,
-            [Out] out IntPtr data);
+            [In, Out] ref Int32 dataSize,
+            [In, Out] ref IntPtr data);
+
+        /// <summary>
+        /// Completes segment in progress at the end of stream
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="streamId">Stream id</param>
+        /// <param name="endTime">Stop time of the last sample</param>
+        /// <param name="output">Output buffer, receives segment size or required size if the buffer is too small</param>
+        /// <returns>Less than zero if error, -6 if output buffer is too small, 0 if there was nothing to complete, 1 if segment is ready</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_EndStream(
+            [In] Int32 muxId,
+            [In] Int32 streamId,
+            [In] Int64 endTime,
+            [In, Out] ref MCSSF_BUFFER output);
 
         /// <summary>
         /// Releases all resources associated with specified mux id
         /// </summary>
         /// <param name="muxId">Mux id to release</param>
         /// <returns>1 if released, 0 if nothing to release (already released)</returns>
-        [DllImport("MCommsSSFSDK.dll", CallingConvention = CallingConvention.Cdecl)]
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
         public static extern int MCSSF_Uninitialize([In] Int32 muxId);
 
+        /// <summary>
+        /// Sets fragmentation policy of streams of specified type added to a mux afterwards
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="streamType">Stream type</param>
+        /// <param name="policy">Fragment duration, max duration and alignment</param>
+        /// <returns>1 if success, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_SetDefaultFragmentPolicy(
+            [In] Int32 muxId,
+            [In] Int32 streamType,
+            [In] ref MCSSF_FRAGMENT_POLICY policy);
+
+        /// <summary>
+        /// Sets fragmentation policy of one stream
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="streamId">Stream id</param>
+        /// <param name="policy">Fragment duration, max duration and alignment</param>
+        /// <returns>1 if success, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_SetFragmentPolicy(
+            [In] Int32 muxId,
+            [In] Int32 streamId,
+            [In] ref MCSSF_FRAGMENT_POLICY policy);
+
+        /// <summary>
+        /// Takes buffer from the native segment buffer pool
+        /// </summary>
+        /// <param name="minCapacity">Minimum buffer capacity, rounded up to the pool size class</param>
+        /// <param name="buffer">Receives buffer pointer and its actual capacity</param>
+        /// <returns>1 if success, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_AcquireBuffer(
+            [In] Int32 minCapacity,
+            [In, Out] ref MCSSF_BUFFER buffer);
+
+        /// <summary>
+        /// Returns buffer to the native segment buffer pool
+        /// </summary>
+        /// <param name="buffer">Buffer taken by MCSSF_AcquireBuffer, cleared on return</param>
+        /// <returns>1 if success, less than zero if the buffer doesn't belong to the pool</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_ReleaseBuffer([In, Out] ref MCSSF_BUFFER buffer);
+
+        /// <summary>
+        /// Gets native segment buffer pool statistics
+        /// </summary>
+        /// <param name="stats">Receives statistics</param>
+        /// <returns>1 if success, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_GetBufferPoolStats([Out] out MCSSF_BUFFER_POOL_STATS stats);
+
+        /// <summary>
+        /// Makes mux produce HLS renditions from the samples pushed to it, must be called before streams are added
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="policy">Segment duration and playlist length</param>
+        /// <returns>1 if success, less than zero if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_EnableHlsOutput(
+            [In] Int32 muxId,
+            [In] ref MCSSF_HLS_POLICY policy);
+
+        /// <summary>
+        /// Copies HLS playlist of a mux into buffer
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="rendition">Rendition index, -1 for master playlist</param>
+        /// <param name="output">Output buffer, receives data size (required size if -2 is returned)</param>
+        /// <returns>1 if success, -2 if buffer is too small, -4 if not available yet, -1 if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_GetHlsPlaylist(
+            [In] Int32 muxId,
+            [In] Int32 rendition,
+            [In, Out] ref MCSSF_BUFFER output);
+
+        /// <summary>
+        /// Copies HLS segment of a mux into buffer
+        /// </summary>
+        /// <param name="muxId">Mux id</param>
+        /// <param name="rendition">Rendition index</param>
+        /// <param name="sequence">Segment sequence number</param>
+        /// <param name="output">Output buffer, receives data size (required size if -2 is returned)</param>
+        /// <returns>1 if success, -2 if buffer is too small, -4 if not available, -1 if error</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int MCSSF_GetHlsSegment(
+            [In] Int32 muxId,
+            [In] Int32 rendition,
+            [In] Int32 sequence,
+            [In, Out] ref MCSSF_BUFFER output);
+
         #endregion
     }
 }
@@ -0,0 +1,145 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.Output;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// Smooth Streaming push output, feeds segmenter with samples of the fan-out
+    /// </summary>
+    public class SmoothStreamingSink : IMediaSink
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Smooth streaming segmenter
+        /// </summary>
+        private SmoothStreamingSegmenter segmenter = null;
+
+        /// <summary>
+        /// Video stream GUID as registered by segmenter
+        /// </summary>
+        private Guid videoStreamId = Guid.Empty;
+
+        /// <summary>
+        /// Audio stream GUID as registered by segmenter
+        /// </summary>
+        private Guid audioStreamId = Guid.Empty;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SmoothStreamingSink
+        /// </summary>
+        /// <param name="publishUri">Publish URI</param>
+        /// <param name="statistics">Statistics of the published stream, null if not collected</param>
+        public SmoothStreamingSink(string publishUri, bool unitTest = false, StreamStatistics statistics = null)
+        {
+            this.segmenter = new SmoothStreamingSegmenter(publishUri, unitTest, statistics);
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Pushes queued media data and releases segmenter
+        /// </summary>
+        public void Dispose()
+        {
+            try
+            {
+                this.segmenter.Flush();
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Failed to push queued media data: {0}", ex.Message);
+            }
+
+            this.segmenter.Dispose();
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Registers stream with segmenter
+        /// </summary>
+        /// <param name="mediaType">Media type with codec private data</param>
+        public void RegisterStream(MediaType mediaType)
+        {
+            Guid publishStreamId = this.segmenter.RegisterStream(mediaType);
+
+            if (mediaType.ContentType == MediaContentType.Video)
+            {
+                this.videoStreamId = publishStreamId;
+            }
+            else
+            {
+                this.audioStreamId = publishStreamId;
+            }
+        }
+
+        /// <summary>
+        /// Queues media sample to segmenter, other packets are skipped
+        /// </summary>
+        /// <param name="sample">Media sample</param>
+        public void PushSample(MediaSample sample)
+        {
+            if (sample.PacketType != RtmpMediaPacketType.Media)
+            {
+                return;
+            }
+
+            Guid publishStreamId = sample.ContentType == MediaContentType.Video ? this.videoStreamId : this.audioStreamId;
+            if (publishStreamId == Guid.Empty)
+            {
+                return;
+            }
+
+            this.segmenter.QueueMediaData(publishStreamId, sample.AbsoluteTime, sample.Timestamp, sample.KeyFrame, sample.MediaData, sample.MediaDataOffset, sample.MediaDataLength);
+        }
+
+        /// <summary>
+        /// Adjusts segmenter's timestamp offset
+        /// </summary>
+        /// <param name="gap">Absolute time change, in 100 ns units</param>
+        public void AdjustAbsoluteTime(long gap)
+        {
+            this.segmenter.AdjustAbsoluteTime(gap);
+        }
+
+        /// <summary>
+        /// Pushes media data queued by segmenter
+        /// </summary>
+        public void Flush()
+        {
+            this.segmenter.Flush();
+        }
+
+        /// <summary>
+        /// Pushes media messages demuxed by the native demuxer to segmenter without decoding them
+        /// </summary>
+        /// <param name="messages">Demuxed messages</param>
+        /// <param name="offset">Index of the first media message</param>
+        /// <param name="count">Number of consecutive media messages</param>
+        /// <param name="messageStreamId">RTMP message stream the media belongs to</param>
+        /// <param name="timestampAdjust">Timestamp adjustment of RTMP message stream, in ms</param>
+        /// <param name="absoluteTimeOrigin">Absolute time of RTMP timestamp 0</param>
+        /// <returns>Number of messages taken</returns>
+        public int IngestMessages(RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages, int offset, int count, int messageStreamId, long timestampAdjust, DateTime absoluteTimeOrigin)
+        {
+            return this.segmenter.IngestMessages(messages, offset, count, messageStreamId, this.audioStreamId, this.videoStreamId, timestampAdjust, absoluteTimeOrigin);
+        }
+
+        #endregion
+    }
+}
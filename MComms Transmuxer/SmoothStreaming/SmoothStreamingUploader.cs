@@ -0,0 +1,508 @@
+﻿namespace MComms_Transmuxer.SmoothStreaming
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Runtime.InteropServices;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Uploads header and fragments of one stream to a publishing point over a persistent chunked POST
+    /// on its own thread. Pushing only copies data into a bounded queue, so a slow publishing point never
+    /// blocks the caller. Every connection starts with the stream header; a fragment stays queued until it
+    /// has been written completely, so fragments are sent again after reconnection.
+    /// </summary>
+    public class SmoothStreamingUploader : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Stream upload URI
+        /// </summary>
+        private string uploadUri = null;
+
+        /// <summary>
+        /// Maximum number of queued fragments, oldest ones are dropped when exceeded
+        /// </summary>
+        private int queueLength = 0;
+
+        /// <summary>
+        /// Protects queue and header, signalled when there is something to upload
+        /// </summary>
+        private object syncRoot = new object();
+
+        /// <summary>
+        /// Fragments waiting for upload, the first one may be being written
+        /// </summary>
+        private LinkedList<UploadFragment> queue = new LinkedList<UploadFragment>();
+
+        /// <summary>
+        /// Fragment buffers for reuse
+        /// </summary>
+        private Stack<UploadFragment> freeFragments = new Stack<UploadFragment>();
+
+        /// <summary>
+        /// Fragment being written by upload thread
+        /// </summary>
+        private UploadFragment sendingFragment = null;
+
+        /// <summary>
+        /// Stream header, sent first on every connection
+        /// </summary>
+        private byte[] header = null;
+
+        /// <summary>
+        /// Whether header has changed since the current connection was opened
+        /// </summary>
+        private bool headerChanged = false;
+
+        /// <summary>
+        /// Current web request
+        /// </summary>
+        private volatile HttpWebRequest webRequest = null;
+
+        /// <summary>
+        /// Current web request stream, used by upload thread only
+        /// </summary>
+        private Stream webRequestStream = null;
+
+        /// <summary>
+        /// Upload thread
+        /// </summary>
+        private Thread uploadThread = null;
+
+        /// <summary>
+        /// Whether uploader is disposed
+        /// </summary>
+        private volatile bool disposed = false;
+
+        /// <summary>
+        /// Number of fragments dropped because the queue was full
+        /// </summary>
+        private long droppedFragments = 0;
+
+        /// <summary>
+        /// Number of fragments uploaded
+        /// </summary>
+        private long uploadedFragments = 0;
+
+        /// <summary>
+        /// Number of connections made
+        /// </summary>
+        private long connections = 0;
+
+        /// <summary>
+        /// Statistics of the published stream, null if not collected
+        /// </summary>
+        private volatile StreamStatistics statistics = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SmoothStreamingUploader and starts its upload thread
+        /// </summary>
+        /// <param name="uploadUri">Stream upload URI</param>
+        /// <param name="queueLength">Maximum number of queued fragments</param>
+        public SmoothStreamingUploader(string uploadUri, int queueLength)
+        {
+            this.uploadUri = uploadUri;
+            this.queueLength = queueLength;
+            this.uploadThread = new Thread(this.UploadThreadProc);
+            this.uploadThread.IsBackground = true;
+            this.uploadThread.Start();
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets stream upload URI
+        /// </summary>
+        public string UploadUri
+        {
+            get
+            {
+                return this.uploadUri;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets statistics of the published stream, upload latency and uploaded bytes are recorded to it
+        /// </summary>
+        public StreamStatistics Statistics
+        {
+            get
+            {
+                return this.statistics;
+            }
+            set
+            {
+                this.statistics = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets number of fragments waiting for upload
+        /// </summary>
+        public int QueuedFragments
+        {
+            get
+            {
+                lock (this.syncRoot)
+                {
+                    return this.queue.Count;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets number of fragments dropped because the queue was full
+        /// </summary>
+        public long DroppedFragments
+        {
+            get
+            {
+                return Interlocked.Read(ref this.droppedFragments);
+            }
+        }
+
+        /// <summary>
+        /// Gets number of uploaded fragments
+        /// </summary>
+        public long UploadedFragments
+        {
+            get
+            {
+                return Interlocked.Read(ref this.uploadedFragments);
+            }
+        }
+
+        /// <summary>
+        /// Gets number of connections made to the publishing point
+        /// </summary>
+        public long Connections
+        {
+            get
+            {
+                return Interlocked.Read(ref this.connections);
+            }
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Stops upload thread, queued fragments are dropped
+        /// </summary>
+        public void Dispose()
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed)
+                {
+                    return;
+                }
+
+                this.disposed = true;
+                Monitor.PulseAll(this.syncRoot);
+            }
+
+            // unblocks upload thread if it's stuck in the network
+            HttpWebRequest request = this.webRequest;
+            if (request != null)
+            {
+                try
+                {
+                    request.Abort();
+                }
+                catch
+                {
+                }
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Sets stream header, the current connection is re-established if the header changes
+        /// </summary>
+        /// <param name="data">Native buffer with header data</param>
+        /// <param name="length">Header data length</param>
+        public void SetHeader(IntPtr data, int length)
+        {
+            byte[] newHeader = new byte[length];
+            Marshal.Copy(data, newHeader, 0, length);
+
+            lock (this.syncRoot)
+            {
+                this.headerChanged = this.header != null;
+                this.header = newHeader;
+                Monitor.PulseAll(this.syncRoot);
+            }
+        }
+
+        /// <summary>
+        /// Queues fragment for upload, never blocks. The oldest fragment which isn't being written is dropped if the queue is full.
+        /// </summary>
+        /// <param name="data">Native buffer with fragment data</param>
+        /// <param name="length">Fragment data length</param>
+        public void PushData(IntPtr data, int length)
+        {
+            lock (this.syncRoot)
+            {
+                if (this.disposed)
+                {
+                    return;
+                }
+
+                if (this.queue.Count >= this.queueLength)
+                {
+                    LinkedListNode<UploadFragment> oldest = this.queue.First;
+                    if (oldest.Value == this.sendingFragment)
+                    {
+                        oldest = oldest.Next;
+                    }
+
+                    if (oldest != null)
+                    {
+                        this.queue.Remove(oldest);
+                        this.freeFragments.Push(oldest.Value);
+                        Interlocked.Increment(ref this.droppedFragments);
+                        Global.Log.WarnFormat("Upload queue of {0} is full, fragment dropped", this.uploadUri);
+                    }
+                }
+
+                UploadFragment fragment = this.freeFragments.Count > 0 ? this.freeFragments.Pop() : new UploadFragment();
+                if (fragment.Data == null || fragment.Data.Length < length)
+                {
+                    fragment.Data = new byte[length];
+                }
+
+                Marshal.Copy(data, fragment.Data, 0, length);
+                fragment.Length = length;
+                fragment.Queued = Stopwatch.GetTimestamp();
+
+                this.queue.AddLast(fragment);
+
+                StreamStatistics currentStatistics = this.statistics;
+                if (currentStatistics != null)
+                {
+                    currentStatistics.UploadQueueDepth = this.queue.Count;
+                }
+
+                Monitor.PulseAll(this.syncRoot);
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Upload thread, (re)connects when necessary and writes queued fragments
+        /// </summary>
+        private void UploadThreadProc()
+        {
+            int retryDelay = Global.SmoothStreamingUploadRetryDelayMs;
+
+            while (true)
+            {
+                byte[] connectHeader = null;
+                UploadFragment fragment = null;
+
+                lock (this.syncRoot)
+                {
+                    while (!this.disposed && (this.header == null || (this.webRequestStream != null && !this.headerChanged && this.queue.Count == 0)))
+                    {
+                        Monitor.Wait(this.syncRoot);
+                    }
+
+                    if (this.disposed)
+                    {
+                        break;
+                    }
+
+                    if (this.webRequestStream == null || this.headerChanged)
+                    {
+                        connectHeader = this.header;
+                        this.headerChanged = false;
+                    }
+                    else
+                    {
+                        fragment = this.queue.First.Value;
+                        this.sendingFragment = fragment;
+                    }
+                }
+
+                try
+                {
+                    if (connectHeader != null)
+                    {
+                        this.CloseWebRequest();
+                        this.Connect(connectHeader);
+                    }
+                    else
+                    {
+                        this.webRequestStream.Write(fragment.Data, 0, fragment.Length);
+                        this.webRequestStream.Flush();
+                        Interlocked.Increment(ref this.uploadedFragments);
+
+                        StreamStatistics currentStatistics = this.statistics;
+                        if (currentStatistics != null)
+                        {
+                            currentStatistics.Record(PipelineStage.Upload, fragment.Queued);
+                            currentStatistics.AddUploadedBytes(fragment.Length);
+                        }
+
+                        lock (this.syncRoot)
+                        {
+                            this.queue.Remove(fragment);
+                            this.freeFragments.Push(fragment);
+                            this.sendingFragment = null;
+
+                            if (currentStatistics != null)
+                            {
+                                currentStatistics.UploadQueueDepth = this.queue.Count;
+                            }
+                        }
+                    }
+
+                    retryDelay = Global.SmoothStreamingUploadRetryDelayMs;
+                }
+                catch (Exception ex)
+                {
+                    this.CloseWebRequest();
+
+                    lock (this.syncRoot)
+                    {
+                        this.sendingFragment = null;
+
+                        if (this.disposed)
+                        {
+                            break;
+                        }
+
+                        Global.Log.InfoFormat("Upload to {0} failed, reconnecting in {1} ms: {2}", this.uploadUri, retryDelay, ex.Message);
+
+                        // disposing wakes us up
+                        Monitor.Wait(this.syncRoot, retryDelay);
+                    }
+
+                    retryDelay = Math.Min(retryDelay * 2, Global.SmoothStreamingUploadMaxRetryDelayMs);
+                }
+            }
+
+            this.CloseWebRequest();
+        }
+
+        /// <summary>
+        /// Opens new chunked POST to the publishing point and writes header to it
+        /// </summary>
+        /// <param name="connectHeader">Stream header</param>
+        private void Connect(byte[] connectHeader)
+        {
+            HttpWebRequest request = (HttpWebRequest)WebRequest.Create(this.uploadUri);
+            request.Method = "POST";
+            request.SendChunked = true;
+            request.KeepAlive = true;
+            request.AllowWriteStreamBuffering = false;
+            request.ReadWriteTimeout = 3600000;
+            request.Timeout = 3600000;
+
+            // every stream keeps its own connection open, they must not wait for each other
+            request.ServicePoint.Expect100Continue = false;
+            if (request.ServicePoint.ConnectionLimit < Global.SmoothStreamingMaxUploadConnections)
+            {
+                request.ServicePoint.ConnectionLimit = Global.SmoothStreamingMaxUploadConnections;
+            }
+
+            this.webRequest = request;
+            if (this.disposed)
+            {
+                throw new ObjectDisposedException(this.uploadUri);
+            }
+
+            Stream stream = request.GetRequestStream();
+            this.webRequestStream = stream;
+
+            stream.Write(connectHeader, 0, connectHeader.Length);
+            stream.Flush();
+
+            Interlocked.Increment(ref this.connections);
+            Global.Log.InfoFormat("Created web request {0}", this.uploadUri);
+        }
+
+        /// <summary>
+        /// Closes current web request if any
+        /// </summary>
+        private void CloseWebRequest()
+        {
+            Stream stream = this.webRequestStream;
+            this.webRequestStream = null;
+
+            if (stream != null)
+            {
+                try
+                {
+                    stream.Dispose();
+                }
+                catch
+                {
+                }
+            }
+
+            HttpWebRequest request = this.webRequest;
+            this.webRequest = null;
+
+            if (request != null)
+            {
+                try
+                {
+                    request.Abort();
+                }
+                catch
+                {
+                }
+            }
+        }
+
+        #endregion
+
+        #region Nested types
+
+        /// <summary>
+        /// Fragment copy waiting for upload
+        /// </summary>
+        private class UploadFragment
+        {
+            /// <summary>
+            /// Gets or sets buffer with fragment data, may be bigger than the fragment
+            /// </summary>
+            public byte[] Data { get; set; }
+
+            /// <summary>
+            /// Gets or sets fragment data length
+            /// </summary>
+            public int Length { get; set; }
+
+            /// <summary>
+            /// Gets or sets Stopwatch timestamp of queuing the fragment
+            /// </summary>
+            public long Queued { get; set; }
+        }
+
+        #endregion
+    }
+}
@@ -15,6 +15,10 @@
         private PerformanceCounter perfCountNumberOfConnection;
         private const string sCounterNameTotalBandwidth = "Total Bandwidth";
         private PerformanceCounter perfCountTotalBandwidth;
+        private const string sCounterNameSegmentBufferMemory = "Segment Buffer Memory";
+        private PerformanceCounter perfCountSegmentBufferMemory;
+        private const string sCounterNameSegmentBufferMemoryPeak = "Segment Buffer Memory Peak";
+        private PerformanceCounter perfCountSegmentBufferMemoryPeak;
 
         /// <summary>
         /// Create the performance counter categories
@@ -47,8 +51,13 @@
                 CounterCreationData cdCounter1 = new CounterCreationData(sCounterNameNumberOfConnection, "Number of Connections", PerformanceCounterType.NumberOfItems32);
                 CounterCreationData cdCounter2 = new CounterCreationData(sCounterNameTotalBandwidth, "Total Bandwidth bps", PerformanceCounterType.NumberOfItems32);
 
+                CounterCreationData cdCounter3 = new CounterCreationData(sCounterNameSegmentBufferMemory, "Bytes held by the native segment buffer pool", PerformanceCounterType.NumberOfItems64);
+                CounterCreationData cdCounter4 = new CounterCreationData(sCounterNameSegmentBufferMemoryPeak, "High-water mark of segment buffer bytes in use", PerformanceCounterType.NumberOfItems64);
+
                 CounterDatas.Add(cdCounter1);
                 CounterDatas.Add(cdCounter2);
+                CounterDatas.Add(cdCounter3);
+                CounterDatas.Add(cdCounter4);
 
                 // Create the category and pass the collection to it.
                 PerformanceCounterCategory.Create(categoryName, categoryHelp, PerformanceCounterCategoryType.MultiInstance, CounterDatas);
@@ -82,6 +91,8 @@
                 string instance = string.Format("Transmuxer {0}", Process.GetCurrentProcess().Id);
                 perfCountNumberOfConnection = new PerformanceCounter(categoryName, sCounterNameNumberOfConnection, instance, false);
                 perfCountTotalBandwidth = new PerformanceCounter(categoryName, sCounterNameTotalBandwidth, instance, false);
+                perfCountSegmentBufferMemory = new PerformanceCounter(categoryName, sCounterNameSegmentBufferMemory, instance, false);
+                perfCountSegmentBufferMemoryPeak = new PerformanceCounter(categoryName, sCounterNameSegmentBufferMemoryPeak, instance, false);
 
                 return true;
             }
@@ -109,5 +120,23 @@
                 perfCountTotalBandwidth.RawValue = totalBandwidth;
             }
         }
+
+        /// <summary>
+        /// Adds native segment buffer pool info to performance counters
+        /// </summary>
+        /// <param name="bytesAllocated">Bytes currently held by the pool</param>
+        /// <param name="highWaterBytesInUse">Maximum number of bytes used at once</param>
+        public void CollectSegmentBufferInfo(long bytesAllocated, long highWaterBytesInUse)
+        {
+            if (perfCountSegmentBufferMemory != null)
+            {
+                perfCountSegmentBufferMemory.RawValue = bytesAllocated;
+            }
+
+            if (perfCountSegmentBufferMemoryPeak != null)
+            {
+                perfCountSegmentBufferMemoryPeak.RawValue = highWaterBytesInUse;
+            }
+        }
     }
 }
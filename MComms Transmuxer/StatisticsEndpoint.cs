@@ -0,0 +1,455 @@
+﻿namespace MComms_Transmuxer
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.SmoothStreaming;
+
+    /// <summary>
+    /// Local HTTP endpoint reporting per stream stage latencies, queue depths and throughput together with
+    /// buffer pool usage. The prefix itself returns plain text, prefix + "json" returns the same as JSON.
+    /// Adding reset=1 to the query clears latency histograms after they've been reported, so the next
+    /// report covers only the time since.
+    /// </summary>
+    public class StatisticsEndpoint
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Reported percentiles
+        /// </summary>
+        private static readonly double[] Percentiles = new double[] { 50, 90, 99, 99.9 };
+
+        /// <summary>
+        /// HTTP listener
+        /// </summary>
+        private HttpListener listener = new HttpListener();
+
+        /// <summary>
+        /// Listener thread
+        /// </summary>
+        private Thread listenerThread = null;
+
+        /// <summary>
+        /// Whether we've started
+        /// </summary>
+        private volatile bool isRunning = false;
+
+        /// <summary>
+        /// Worker pool running RTMP sessions
+        /// </summary>
+        private WorkerPool sessionPool = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of StatisticsEndpoint
+        /// </summary>
+        /// <param name="prefix">HTTP listener prefix, e.g. http://localhost:8081/statistics/</param>
+        /// <param name="sessionPool">Worker pool running RTMP sessions</param>
+        public StatisticsEndpoint(string prefix, WorkerPool sessionPool)
+        {
+            this.sessionPool = sessionPool;
+            this.listener.Prefixes.Add(prefix);
+            this.listenerThread = new Thread(this.ListenerThreadProc);
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Starts listening
+        /// </summary>
+        public void Start()
+        {
+            this.listener.Start();
+            this.isRunning = true;
+            this.listenerThread.Start();
+
+            Global.Log.InfoFormat("Statistics endpoint listening on {0}", string.Join(", ", this.listener.Prefixes.ToArray()));
+        }
+
+        /// <summary>
+        /// Stops listening
+        /// </summary>
+        public void Stop()
+        {
+            this.isRunning = false;
+            this.listener.Stop();
+            this.listenerThread.Join();
+            this.listener.Close();
+        }
+
+        /// <summary>
+        /// Formats statistics of all streams as plain text
+        /// </summary>
+        /// <param name="sessionPool">Worker pool running RTMP sessions, null if not reported</param>
+        /// <returns>Report</returns>
+        public static string FormatText(WorkerPool sessionPool)
+        {
+            StringBuilder sb = new StringBuilder();
+
+            sb.AppendFormat(CultureInfo.InvariantCulture, "MComms Transmuxer statistics {0:yyyy-MM-dd HH:mm:ss}\n\n", DateTime.Now);
+
+            StatisticsEndpoint.AppendAllocatorText(sb, "Transport buffers", Global.Allocator);
+            StatisticsEndpoint.AppendAllocatorText(sb, "Media buffers", Global.MediaAllocator);
+
+            SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS poolStats;
+            if (StatisticsEndpoint.GetSegmentBufferStats(out poolStats))
+            {
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "Segment buffers: {0} bytes allocated, {1} in use, peak {2} in use\n",
+                    poolStats.nBytesAllocated,
+                    poolStats.nBytesInUse,
+                    poolStats.nHighWaterBytesInUse);
+            }
+
+            if (sessionPool != null)
+            {
+                sb.AppendFormat(CultureInfo.InvariantCulture, "Session pool: {0} workers, {1} sessions waiting\n", sessionPool.WorkerCount, sessionPool.QueuedWorks);
+            }
+
+            foreach (StreamStatistics statistics in StreamStatistics.GetAll())
+            {
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "\n{0}/{1}{2}\n",
+                    statistics.PublishingPoint,
+                    statistics.Stream,
+                    statistics.Active ? string.Empty : " (stopped)");
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "  received {0} bytes, {1} bps; uploaded {2} bytes, {3} bps\n",
+                    statistics.ReceivedBytes,
+                    statistics.ReceiveBitrate,
+                    statistics.UploadedBytes,
+                    statistics.UploadBitrate);
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "  queued: {0} received packets, {1} samples, {2} fragments\n",
+                    statistics.ReceiveQueueDepth,
+                    statistics.OutputQueueDepth,
+                    statistics.UploadQueueDepth);
+
+                sb.AppendFormat(CultureInfo.InvariantCulture, "  {0,-12}{1,10}{2,10}", "stage, us", "count", "mean");
+                foreach (double percentile in StatisticsEndpoint.Percentiles)
+                {
+                    sb.AppendFormat(CultureInfo.InvariantCulture, "{0,10}", "p" + percentile.ToString(CultureInfo.InvariantCulture));
+                }
+
+                sb.AppendFormat(CultureInfo.InvariantCulture, "{0,10}\n", "max");
+
+                foreach (PipelineStage stage in Enum.GetValues(typeof(PipelineStage)))
+                {
+                    LatencyHistogram histogram = statistics.GetHistogram(stage);
+                    sb.AppendFormat(CultureInfo.InvariantCulture, "  {0,-12}{1,10}{2,10:0}", stage, histogram.Count, histogram.Mean);
+                    foreach (double percentile in StatisticsEndpoint.Percentiles)
+                    {
+                        sb.AppendFormat(CultureInfo.InvariantCulture, "{0,10}", histogram.GetValueAtPercentile(percentile));
+                    }
+
+                    sb.AppendFormat(CultureInfo.InvariantCulture, "{0,10}\n", histogram.Max);
+                }
+            }
+
+            return sb.ToString();
+        }
+
+        /// <summary>
+        /// Formats statistics of all streams as JSON
+        /// </summary>
+        /// <param name="sessionPool">Worker pool running RTMP sessions, null if not reported</param>
+        /// <returns>Report</returns>
+        public static string FormatJson(WorkerPool sessionPool)
+        {
+            StringBuilder sb = new StringBuilder();
+
+            sb.Append("{\"buffers\":{");
+            StatisticsEndpoint.AppendAllocatorJson(sb, "transport", Global.Allocator);
+            sb.Append(',');
+            StatisticsEndpoint.AppendAllocatorJson(sb, "media", Global.MediaAllocator);
+
+            SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS poolStats;
+            if (StatisticsEndpoint.GetSegmentBufferStats(out poolStats))
+            {
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    ",\"segment\":{{\"bytesAllocated\":{0},\"bytesInUse\":{1},\"peakBytesInUse\":{2}}}",
+                    poolStats.nBytesAllocated,
+                    poolStats.nBytesInUse,
+                    poolStats.nHighWaterBytesInUse);
+            }
+
+            sb.Append('}');
+
+            if (sessionPool != null)
+            {
+                sb.AppendFormat(CultureInfo.InvariantCulture, ",\"sessionPool\":{{\"workers\":{0},\"queued\":{1}}}", sessionPool.WorkerCount, sessionPool.QueuedWorks);
+            }
+
+            sb.Append(",\"streams\":[");
+
+            bool firstStream = true;
+            foreach (StreamStatistics statistics in StreamStatistics.GetAll())
+            {
+                if (!firstStream)
+                {
+                    sb.Append(',');
+                }
+
+                firstStream = false;
+
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "{{\"publishingPoint\":{0},\"stream\":{1},\"active\":{2},\"receivedBytes\":{3},\"receiveBitrate\":{4},\"uploadedBytes\":{5},\"uploadBitrate\":{6}," +
+                    "\"queues\":{{\"receive\":{7},\"output\":{8},\"upload\":{9}}},\"stages\":{{",
+                    StatisticsEndpoint.JsonString(statistics.PublishingPoint),
+                    StatisticsEndpoint.JsonString(statistics.Stream),
+                    statistics.Active ? "true" : "false",
+                    statistics.ReceivedBytes,
+                    statistics.ReceiveBitrate,
+                    statistics.UploadedBytes,
+                    statistics.UploadBitrate,
+                    statistics.ReceiveQueueDepth,
+                    statistics.OutputQueueDepth,
+                    statistics.UploadQueueDepth);
+
+                bool firstStage = true;
+                foreach (PipelineStage stage in Enum.GetValues(typeof(PipelineStage)))
+                {
+                    LatencyHistogram histogram = statistics.GetHistogram(stage);
+
+                    sb.AppendFormat(
+                        CultureInfo.InvariantCulture,
+                        "{0}\"{1}\":{{\"count\":{2},\"mean\":{3:0}",
+                        firstStage ? string.Empty : ",",
+                        stage,
+                        histogram.Count,
+                        histogram.Mean);
+
+                    foreach (double percentile in StatisticsEndpoint.Percentiles)
+                    {
+                        sb.AppendFormat(CultureInfo.InvariantCulture, ",\"p{0}\":{1}", percentile, histogram.GetValueAtPercentile(percentile));
+                    }
+
+                    sb.AppendFormat(CultureInfo.InvariantCulture, ",\"max\":{0}}}", histogram.Max);
+                    firstStage = false;
+                }
+
+                sb.Append("}}");
+            }
+
+            sb.Append("]}");
+
+            return sb.ToString();
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Appends allocator usage as text
+        /// </summary>
+        /// <param name="sb">String builder</param>
+        /// <param name="name">Allocator name</param>
+        /// <param name="allocator">Allocator, skipped if null</param>
+        private static void AppendAllocatorText(StringBuilder sb, string name, PacketBufferAllocator allocator)
+        {
+            if (allocator != null)
+            {
+                sb.AppendFormat(
+                    CultureInfo.InvariantCulture,
+                    "{0}: {1} buffers of {2} bytes, {3} free, {4} locked\n",
+                    name,
+                    allocator.BufferCount,
+                    allocator.BufferSize,
+                    allocator.FreeBufferCount,
+                    allocator.LockedBufferCount);
+            }
+        }
+
+        /// <summary>
+        /// Appends allocator usage as JSON property
+        /// </summary>
+        /// <param name="sb">String builder</param>
+        /// <param name="name">Property name</param>
+        /// <param name="allocator">Allocator, null is reported as null</param>
+        private static void AppendAllocatorJson(StringBuilder sb, string name, PacketBufferAllocator allocator)
+        {
+            if (allocator == null)
+            {
+                sb.AppendFormat("\"{0}\":null", name);
+                return;
+            }
+
+            sb.AppendFormat(
+                CultureInfo.InvariantCulture,
+                "\"{0}\":{{\"bufferSize\":{1},\"buffers\":{2},\"free\":{3},\"locked\":{4}}}",
+                name,
+                allocator.BufferSize,
+                allocator.BufferCount,
+                allocator.FreeBufferCount,
+                allocator.LockedBufferCount);
+        }
+
+        /// <summary>
+        /// Gets native segment buffer pool usage
+        /// </summary>
+        /// <param name="poolStats">Pool usage</param>
+        /// <returns>True if native library is available and has returned the usage</returns>
+        private static bool GetSegmentBufferStats(out SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS poolStats)
+        {
+            try
+            {
+                return SmoothStreamingSegmenter.MCSSF_GetBufferPoolStats(out poolStats) > 0;
+            }
+            catch (DllNotFoundException)
+            {
+                poolStats = new SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS();
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Returns quoted and escaped JSON string
+        /// </summary>
+        /// <param name="value">String</param>
+        /// <returns>JSON string</returns>
+        private static string JsonString(string value)
+        {
+            if (value == null)
+            {
+                return "null";
+            }
+
+            StringBuilder sb = new StringBuilder(value.Length + 2);
+            sb.Append('"');
+            foreach (char c in value)
+            {
+                switch (c)
+                {
+                    case '"':
+                        sb.Append("\\\"");
+                        break;
+
+                    case '\\':
+                        sb.Append("\\\\");
+                        break;
+
+                    default:
+                        if (c < 0x20)
+                        {
+                            sb.AppendFormat(CultureInfo.InvariantCulture, "\\u{0:x4}", (int)c);
+                        }
+                        else
+                        {
+                            sb.Append(c);
+                        }
+
+                        break;
+                }
+            }
+
+            sb.Append('"');
+            return sb.ToString();
+        }
+
+        /// <summary>
+        /// Listener thread, serves requests one by one, they're rare and cheap
+        /// </summary>
+        private void ListenerThreadProc()
+        {
+            Global.Log.Debug("StatisticsEndpoint listener thread started");
+
+            while (this.isRunning)
+            {
+                HttpListenerContext context = null;
+                try
+                {
+                    context = this.listener.GetContext();
+                }
+                catch (HttpListenerException)
+                {
+                    // listener stopped
+                    continue;
+                }
+                catch (ObjectDisposedException)
+                {
+                    break;
+                }
+
+                this.ProcessRequest(context);
+            }
+
+            Global.Log.Debug("StatisticsEndpoint listener thread stopped");
+        }
+
+        /// <summary>
+        /// Serves text or JSON report
+        /// </summary>
+        /// <param name="context">Listener context</param>
+        private void ProcessRequest(HttpListenerContext context)
+        {
+            HttpListenerResponse response = context.Response;
+
+            try
+            {
+                bool json = context.Request.Url.AbsolutePath.EndsWith("/json", StringComparison.OrdinalIgnoreCase);
+                byte[] data = Encoding.UTF8.GetBytes(json ? StatisticsEndpoint.FormatJson(this.sessionPool) : StatisticsEndpoint.FormatText(this.sessionPool));
+
+                if (context.Request.QueryString["reset"] == "1")
+                {
+                    foreach (StreamStatistics statistics in StreamStatistics.GetAll())
+                    {
+                        statistics.Reset();
+                    }
+                }
+
+                response.StatusCode = (int)HttpStatusCode.OK;
+                response.ContentType = json ? "application/json; charset=utf-8" : "text/plain; charset=utf-8";
+                response.AddHeader("Cache-Control", "no-cache");
+                response.ContentLength64 = data.Length;
+                if (context.Request.HttpMethod != "HEAD")
+                {
+                    response.OutputStream.Write(data, 0, data.Length);
+                }
+            }
+            catch (HttpListenerException)
+            {
+                // client has gone
+            }
+            catch (IOException)
+            {
+                // client has gone
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Statistics request {0} failed: {1}", context.Request.Url, ex.ToString());
+            }
+            finally
+            {
+                try
+                {
+                    response.Close();
+                }
+                catch
+                {
+                }
+            }
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,65 @@
+﻿namespace MComms_Transmuxer.Transport
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Net;
+    using System.Net.Sockets;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Server transport used by RTMP server and sessions. Connections are identified by their remote end point,
+    /// events are raised on transport threads
+    /// </summary>
+    public interface ITransport
+    {
+        /// <summary>
+        /// Raised when new connection is accepted
+        /// </summary>
+        event EventHandler<TransportArgs> Connected;
+
+        /// <summary>
+        /// Raised when connection is closed
+        /// </summary>
+        event EventHandler<TransportArgs> Disconnected;
+
+        /// <summary>
+        /// Raised when data is received. Data is valid during the call only. Handler may set
+        /// ReceiveEventHandler of the argument to get further data of the connection directly
+        /// </summary>
+        event EventHandler<TransportArgs> Received;
+
+        /// <summary>
+        /// Raised when packet has been sent
+        /// </summary>
+        event EventHandler<TransportArgs> Sent;
+
+        /// <summary>
+        /// Starts the transport
+        /// </summary>
+        /// <param name="serverEndPoint">Server end point, can be null for client mode</param>
+        /// <param name="protocolType">Protocol type, can be null for client mode</param>
+        void Start(IPEndPoint serverEndPoint = null, ProtocolType protocolType = ProtocolType.Unspecified);
+
+        /// <summary>
+        /// Stops the transport, closes all connections
+        /// </summary>
+        void Stop();
+
+        /// <summary>
+        /// Sends data to a specified end point. If specified end point is not found in
+        /// the list of active connections then exception will be thrown.
+        /// </summary>
+        /// <param name="endPoint">End point to send data to</param>
+        /// <param name="packet">Data to send</param>
+        void Send(IPEndPoint endPoint, PacketBuffer packet);
+
+        /// <summary>
+        /// Disconnects specified end point
+        /// </summary>
+        /// <param name="endPoint">End point to disconnect</param>
+        void Disconnect(IPEndPoint endPoint);
+    }
+}
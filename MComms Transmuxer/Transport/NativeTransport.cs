@@ -0,0 +1,727 @@
+﻿namespace MComms_Transmuxer.Transport
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Net;
+    using System.Net.Sockets;
+    using System.Runtime.InteropServices;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// TCP server transport built on the epoll reactors of MCommsSSFSDK, available on Linux only.
+    /// Every reactor listens on the server port and owns the connections it accepts, one poll thread
+    /// per reactor performs their I/O and raises the events. Sends are written directly to the socket
+    /// by the calling thread, only what the socket doesn't take is queued natively.
+    /// </summary>
+    public class NativeTransport : ITransport
+    {
+        #region Constants
+
+        /// <summary>
+        /// Default maximum number of connections
+        /// </summary>
+        private const int DefaultMaxConnections = 1000;
+
+        /// <summary>
+        /// Default backlog size
+        /// </summary>
+        private const int DefaultBacklog = 100;
+
+        /// <summary>
+        /// Default initial receive buffer size of a connection
+        /// </summary>
+        private const int DefaultMinReceiveBufferSize = 4096;
+
+        /// <summary>
+        /// Default maximum receive buffer size of a connection
+        /// </summary>
+        private const int DefaultMaxReceiveBufferSize = 65536;
+
+        /// <summary>
+        /// Default maximum send queue size of a connection
+        /// </summary>
+        private const int DefaultMaxSendQueueSize = 4 * 1024 * 1024;
+
+        /// <summary>
+        /// Default maximum size of data passed to one receive event
+        /// </summary>
+        private const int DefaultReceiveChunkSize = 8192;
+
+        /// <summary>
+        /// Maximum number of events taken by one poll
+        /// </summary>
+        private const int PollEvents = 64;
+
+        /// <summary>
+        /// Poll timeout, in milliseconds
+        /// </summary>
+        private const int PollTimeoutMs = 100;
+
+        #endregion
+
+        #region Private variables
+
+        /// <summary>
+        /// Native transport id
+        /// </summary>
+        private int transportId = -1;
+
+        /// <summary>
+        /// Whether transport is running
+        /// </summary>
+        private volatile bool isRunning = false;
+
+        /// <summary>
+        /// The maximum number of connections the transport is able to handle simultaneously
+        /// </summary>
+        private int maxConnections = NativeTransport.DefaultMaxConnections;
+
+        /// <summary>
+        /// Max number of pending connections each listener can hold in queue
+        /// </summary>
+        private int backlog = NativeTransport.DefaultBacklog;
+
+        /// <summary>
+        /// Number of reactors, 0 for one per processor
+        /// </summary>
+        private int reactorCount = 0;
+
+        /// <summary>
+        /// Initial and minimum receive buffer size of a connection
+        /// </summary>
+        private int minReceiveBufferSize = NativeTransport.DefaultMinReceiveBufferSize;
+
+        /// <summary>
+        /// Maximum receive buffer size of a connection
+        /// </summary>
+        private int maxReceiveBufferSize = NativeTransport.DefaultMaxReceiveBufferSize;
+
+        /// <summary>
+        /// Maximum send queue size of a connection
+        /// </summary>
+        private int maxSendQueueSize = NativeTransport.DefaultMaxSendQueueSize;
+
+        /// <summary>
+        /// Maximum size of data passed to one receive event
+        /// </summary>
+        private int receiveChunkSize = NativeTransport.DefaultReceiveChunkSize;
+
+        /// <summary>
+        /// Poll threads, one per reactor
+        /// </summary>
+        private List<Thread> pollThreads = new List<Thread>();
+
+        /// <summary>
+        /// Connected clients by native connection id
+        /// </summary>
+        private ConcurrentDictionary<int, ClientContext> clients = new ConcurrentDictionary<int, ClientContext>();
+
+        /// <summary>
+        /// Native connection ids by remote end point
+        /// </summary>
+        private ConcurrentDictionary<IPEndPoint, int> connectionIds = new ConcurrentDictionary<IPEndPoint, int>();
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of NativeTransport
+        /// </summary>
+        public NativeTransport()
+        {
+            // settings may be changed until Start() is called
+        }
+
+        #endregion
+
+        #region Events
+
+        /// <summary>
+        /// Connected event handlers
+        /// </summary>
+        public event EventHandler<TransportArgs> Connected;
+
+        /// <summary>
+        /// Disconnected event handlers
+        /// </summary>
+        public event EventHandler<TransportArgs> Disconnected;
+
+        /// <summary>
+        /// Received event handlers
+        /// </summary>
+        public event EventHandler<TransportArgs> Received;
+
+        /// <summary>
+        /// Sent event handlers
+        /// </summary>
+        public event EventHandler<TransportArgs> Sent;
+
+        #endregion
+
+        #region Public properties and methods
+
+        /// <summary>
+        /// Gets or sets the maximum number of connections the transport is able to handle simultaneously
+        /// </summary>
+        public int MaxConnections
+        {
+            get
+            {
+                return this.maxConnections;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.maxConnections = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the max number of pending connections each listener can hold in queue
+        /// </summary>
+        public int Backlog
+        {
+            get
+            {
+                return this.backlog;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.backlog = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of reactors, 0 for one per processor. Updated by Start with the number actually started
+        /// </summary>
+        public int ReactorCount
+        {
+            get
+            {
+                return this.reactorCount;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.reactorCount = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets initial and minimum size of the native receive buffer of a connection
+        /// </summary>
+        public int MinReceiveBufferSize
+        {
+            get
+            {
+                return this.minReceiveBufferSize;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.minReceiveBufferSize = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets size the native receive buffer of a busy connection can grow to
+        /// </summary>
+        public int MaxReceiveBufferSize
+        {
+            get
+            {
+                return this.maxReceiveBufferSize;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.maxReceiveBufferSize = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum number of bytes waiting to be sent, connection is dropped when exceeded
+        /// </summary>
+        public int MaxSendQueueSize
+        {
+            get
+            {
+                return this.maxSendQueueSize;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.maxSendQueueSize = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum size of data passed to one receive event handler call
+        /// </summary>
+        public int ReceiveChunkSize
+        {
+            get
+            {
+                return this.receiveChunkSize;
+            }
+            set
+            {
+                if (this.isRunning)
+                {
+                    throw new InvalidOperationException("Invalid while transport is running");
+                }
+                else
+                {
+                    this.receiveChunkSize = value;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Starts the transport, listens on the port of the server end point on all addresses
+        /// </summary>
+        /// <param name="serverEndPoint">Server end point</param>
+        /// <param name="protocolType">Protocol type, must be TCP</param>
+        public void Start(IPEndPoint serverEndPoint = null, ProtocolType protocolType = ProtocolType.Unspecified)
+        {
+            if (this.isRunning)
+            {
+                throw new InvalidOperationException("Transport is running already");
+            }
+
+            if (serverEndPoint == null || protocolType != ProtocolType.Tcp)
+            {
+                throw new NotSupportedException("Native transport supports TCP server mode only");
+            }
+
+            MCSSF_TRANSPORT_CONFIG config = new MCSSF_TRANSPORT_CONFIG();
+            config.nPort = serverEndPoint.Port;
+            config.nBacklog = this.backlog;
+            config.nReactors = this.reactorCount;
+            config.nMaxConnections = this.maxConnections;
+            config.nMinReceiveBuffer = this.minReceiveBufferSize;
+            config.nMaxReceiveBuffer = this.maxReceiveBufferSize;
+            config.nMaxSendQueue = this.maxSendQueueSize;
+
+            int result = NativeTransport.MCSSF_StartTransport(ref config);
+            if (result < 0)
+            {
+                throw new Exception(string.Format("Failed to start native transport on port {0}, error {1}", serverEndPoint.Port, result));
+            }
+
+            this.transportId = result;
+            this.reactorCount = config.nReactors;
+            this.isRunning = true;
+
+            for (int i = 0; i < config.nReactors; ++i)
+            {
+                Thread pollThread = new Thread(this.PollThreadProc);
+                pollThread.IsBackground = true;
+                pollThread.Start(i);
+                this.pollThreads.Add(pollThread);
+            }
+
+            Global.Log.InfoFormat("Native transport started on port {0} with {1} reactors", serverEndPoint.Port, config.nReactors);
+        }
+
+        /// <summary>
+        /// Stops the transport, connections still open are reported disconnected
+        /// </summary>
+        public void Stop()
+        {
+            if (!this.isRunning)
+            {
+                return;
+            }
+
+            this.isRunning = false;
+
+            // poll threads exit within the poll timeout; the transport frees connection buffers
+            // when stopped, so it must not be stopped while they may still process received data
+            foreach (Thread pollThread in this.pollThreads)
+            {
+                pollThread.Join();
+            }
+
+            this.pollThreads.Clear();
+            NativeTransport.MCSSF_StopTransport(this.transportId);
+            this.transportId = -1;
+
+            foreach (ClientContext client in this.clients.Values)
+            {
+                this.OnDisconnect(client.RemoteEndPoint);
+            }
+
+            this.clients.Clear();
+            this.connectionIds.Clear();
+        }
+
+        /// <summary>
+        /// Sends data to a specified end point. If specified end point is not found in
+        /// the list of active connections then exception will be thrown. Data is copied,
+        /// the packet can be released as soon as the call returns.
+        /// </summary>
+        /// <param name="endPoint">End point to send data to</param>
+        /// <param name="packet">Data to send</param>
+        public void Send(IPEndPoint endPoint, PacketBuffer packet)
+        {
+            if (!this.isRunning)
+            {
+                throw new InvalidOperationException("Invalid while transport is not running");
+            }
+
+            int connectionId = 0;
+            if (!this.connectionIds.TryGetValue(endPoint, out connectionId))
+            {
+                throw new Exception("Connection not found");
+            }
+
+            int result = NativeTransport.MCSSF_TransportSend(this.transportId, connectionId, packet.Buffer, packet.ActualBufferSize);
+            if (result == -1)
+            {
+                throw new Exception("Connection not found");
+            }
+            else if (result < 0)
+            {
+                throw new Exception(string.Format("Failed to send to {0}, connection is dropped", endPoint));
+            }
+
+            this.OnSent(endPoint, packet);
+        }
+
+        /// <summary>
+        /// Disconnects specified end point
+        /// </summary>
+        /// <param name="endPoint">End point to disconnect</param>
+        public void Disconnect(IPEndPoint endPoint)
+        {
+            if (!this.isRunning)
+            {
+                throw new InvalidOperationException("Invalid while transport is not running");
+            }
+
+            int connectionId = 0;
+            if (!this.connectionIds.TryGetValue(endPoint, out connectionId))
+            {
+                // already disconnected
+                return;
+            }
+
+            // the reactor reports the connection disconnected once it's closed
+            NativeTransport.MCSSF_TransportDisconnect(this.transportId, connectionId);
+        }
+
+        #endregion
+
+        #region Virtual methods to be overridden in inherited class
+
+        /// <summary>
+        /// Calls Connected event handlers
+        /// </summary>
+        /// <param name="endPoint">Connected end point</param>
+        protected virtual void OnConnect(IPEndPoint endPoint)
+        {
+            if (this.Connected != null)
+            {
+                this.Connected(this, new TransportArgs(endPoint));
+            }
+        }
+
+        /// <summary>
+        /// Calls Disconnected event handlers
+        /// </summary>
+        /// <param name="endPoint">Disconnected end point</param>
+        protected virtual void OnDisconnect(IPEndPoint endPoint)
+        {
+            if (this.Disconnected != null)
+            {
+                this.Disconnected(this, new TransportArgs(endPoint));
+            }
+        }
+
+        /// <summary>
+        /// By default calls Received event handler.
+        /// If client context specifies ReceiveEventHandler then it's called on priority basis.
+        /// </summary>
+        /// <param name="client">Client received data from</param>
+        /// <param name="endPoint">Client's end point</param>
+        /// <param name="data">Received data</param>
+        /// <param name="dataOffset">Data offset</param>
+        /// <param name="dataLength">Data length</param>
+        protected virtual void OnReceive(ClientContext client, IPEndPoint endPoint, byte[] data, int dataOffset, int dataLength)
+        {
+            if (client != null && client.ReceiveEventHandler != null)
+            {
+                // direct call to RTMP session event handler
+                client.ReceiveEventHandler(this, new TransportArgs(endPoint, data, dataOffset, dataLength));
+            }
+            else if (this.Received != null)
+            {
+                TransportArgs args = new TransportArgs(endPoint, data, dataOffset, dataLength);
+                this.Received(this, args);
+                if (args.ReceiveEventHandler != null && client != null)
+                {
+                    // we need to route further receive event to RTMP session directly
+                    client.ReceiveEventHandler = args.ReceiveEventHandler;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Calls Sent event handlers
+        /// </summary>
+        /// <param name="endPoint">Client sent data to</param>
+        /// <param name="packet">Packet sent</param>
+        protected virtual void OnSent(IPEndPoint endPoint, PacketBuffer packet)
+        {
+            if (this.Sent != null)
+            {
+                this.Sent(this, new TransportArgs(endPoint, packet));
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Poll thread of one reactor, raises events of its connections
+        /// </summary>
+        /// <param name="reactor">Reactor index</param>
+        private void PollThreadProc(object reactor)
+        {
+            int reactorIndex = (int)reactor;
+            MCSSF_TRANSPORT_EVENT[] events = new MCSSF_TRANSPORT_EVENT[NativeTransport.PollEvents];
+            byte[] data = new byte[this.receiveChunkSize];
+
+            Global.Log.DebugFormat("Native transport reactor {0} started", reactorIndex);
+
+            while (this.isRunning)
+            {
+                int count = NativeTransport.MCSSF_PollTransport(this.transportId, reactorIndex, events, events.Length, NativeTransport.PollTimeoutMs);
+                if (count < 0)
+                {
+                    if (this.isRunning)
+                    {
+                        Global.Log.ErrorFormat("Native transport reactor {0} failed, error {1}", reactorIndex, count);
+                    }
+
+                    break;
+                }
+
+                for (int i = 0; i < count; ++i)
+                {
+                    try
+                    {
+                        this.ProcessEvent(ref events[i], data);
+                    }
+                    catch (Exception ex)
+                    {
+                        Global.Log.ErrorFormat("Native transport event exception: {0}", ex.ToString());
+                    }
+                }
+            }
+
+            Global.Log.DebugFormat("Native transport reactor {0} stopped", reactorIndex);
+        }
+
+        /// <summary>
+        /// Raises event reported by a reactor
+        /// </summary>
+        /// <param name="ev">Native event</param>
+        /// <param name="data">Buffer received data is copied to</param>
+        private void ProcessEvent(ref MCSSF_TRANSPORT_EVENT ev, byte[] data)
+        {
+            ClientContext client = null;
+
+            switch (ev.nType)
+            {
+                case NativeTransport.MCSSF_TRANSPORT_CONNECTED:
+                    client = new ClientContext();
+                    client.RemoteEndPoint = new IPEndPoint(new IPAddress((long)ev.nAddress), ev.nPort);
+                    this.clients[ev.nConnectionId] = client;
+                    this.connectionIds[client.RemoteEndPoint] = ev.nConnectionId;
+                    this.OnConnect(client.RemoteEndPoint);
+                    break;
+
+                case NativeTransport.MCSSF_TRANSPORT_RECEIVED:
+                    if (this.clients.TryGetValue(ev.nConnectionId, out client))
+                    {
+                        // native buffer may be larger than what receive handlers take at once
+                        for (int offset = 0; offset < ev.nDataSize; offset += data.Length)
+                        {
+                            int length = Math.Min(data.Length, ev.nDataSize - offset);
+                            Marshal.Copy(IntPtr.Add(ev.pData, offset), data, 0, length);
+                            this.OnReceive(client, client.RemoteEndPoint, data, 0, length);
+                        }
+                    }
+
+                    break;
+
+                case NativeTransport.MCSSF_TRANSPORT_DISCONNECTED:
+                    if (this.clients.TryRemove(ev.nConnectionId, out client))
+                    {
+                        int connectionId = 0;
+                        this.connectionIds.TryRemove(client.RemoteEndPoint, out connectionId);
+                        this.OnDisconnect(client.RemoteEndPoint);
+                    }
+
+                    break;
+            }
+        }
+
+        #endregion
+
+        #region Unmanaged interface to MCommsSSFSDK
+
+        /// <summary>
+        /// Connection accepted
+        /// </summary>
+        private const int MCSSF_TRANSPORT_CONNECTED = 1;
+
+        /// <summary>
+        /// Data received
+        /// </summary>
+        private const int MCSSF_TRANSPORT_RECEIVED = 2;
+
+        /// <summary>
+        /// Connection closed
+        /// </summary>
+        private const int MCSSF_TRANSPORT_DISCONNECTED = 3;
+
+        /// <summary>
+        /// MCSSF_TRANSPORT_CONFIG structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        private struct MCSSF_TRANSPORT_CONFIG
+        {
+            public Int32 nPort;
+            public Int32 nBacklog;
+            public Int32 nReactors;
+            public Int32 nMaxConnections;
+            public Int32 nMinReceiveBuffer;
+            public Int32 nMaxReceiveBuffer;
+            public Int32 nMaxSendQueue;
+        }
+
+        /// <summary>
+        /// MCSSF_TRANSPORT_EVENT structure
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        private struct MCSSF_TRANSPORT_EVENT
+        {
+            public Int32 nType;
+            public Int32 nConnectionId;
+            public Int32 nDataSize;
+            public IntPtr pData;
+            public UInt32 nAddress;
+            public Int32 nPort;
+        }
+
+        /// <summary>
+        /// Binds listening sockets and creates reactors
+        /// </summary>
+        /// <param name="config">Transport settings, nReactors receives the number of reactors</param>
+        /// <returns>Transport id, -1 if sockets can't be set up, -2 for invalid settings, -4 if not supported</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MCSSF_StartTransport(
+            [In, Out] ref MCSSF_TRANSPORT_CONFIG config);
+
+        /// <summary>
+        /// Performs I/O of one reactor and reports its events
+        /// </summary>
+        /// <param name="transportId">Transport id</param>
+        /// <param name="reactor">Reactor index</param>
+        /// <param name="events">Events, received data is valid until the next poll of the reactor</param>
+        /// <param name="maxEvents">Capacity of the events array</param>
+        /// <param name="timeoutMs">Maximum time to wait for events</param>
+        /// <returns>Number of events, -1 for unknown transport, -2 for invalid arguments, -5 when stopping</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MCSSF_PollTransport(
+            [In] Int32 transportId,
+            [In] Int32 reactor,
+            [Out] MCSSF_TRANSPORT_EVENT[] events,
+            [In] Int32 maxEvents,
+            [In] Int32 timeoutMs);
+
+        /// <summary>
+        /// Sends data or queues what the socket doesn't take at once
+        /// </summary>
+        /// <param name="transportId">Transport id</param>
+        /// <param name="connectionId">Connection id</param>
+        /// <param name="data">Data to send</param>
+        /// <param name="dataSize">Data size</param>
+        /// <returns>0 on success, -1 for unknown connection, -2 for invalid arguments, -3 if connection is dropped</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MCSSF_TransportSend(
+            [In] Int32 transportId,
+            [In] Int32 connectionId,
+            [In] byte[] data,
+            [In] Int32 dataSize);
+
+        /// <summary>
+        /// Shuts connection down
+        /// </summary>
+        /// <param name="transportId">Transport id</param>
+        /// <param name="connectionId">Connection id</param>
+        /// <returns>1 if connection was found</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MCSSF_TransportDisconnect(
+            [In] Int32 transportId,
+            [In] Int32 connectionId);
+
+        /// <summary>
+        /// Stops transport and closes all sockets
+        /// </summary>
+        /// <param name="transportId">Transport id</param>
+        /// <returns>1 if transport has been stopped</returns>
+        [DllImport("MCommsSSFSDK", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MCSSF_StopTransport(
+            [In] Int32 transportId);
+
+        #endregion
+    }
+}
@@ -15,7 +15,7 @@
     /// <summary>
     /// General socket transport class. Implements both server and client
     /// </summary>
-    public class SocketTransport
+    public class SocketTransport : ITransport
     {
         #region Constants
 
@@ -699,6 +699,12 @@
         /// <param name="asyncContext">Async context</param>
         private void ProcessAccept(SocketAsyncEventArgs asyncContext)
         {
+            if (asyncContext.SocketError == SocketError.OperationAborted)
+            {
+                // listen socket has been closed by Stop, context pools may be released already
+                return;
+            }
+
             StartAccept(); // loopback accept
 
             if (!this.isRunning || asyncContext.SocketError != SocketError.Success)
@@ -730,6 +736,13 @@
             client.Socket = asyncContext.AcceptSocket;
             client.RemoteEndPoint = client.Socket.RemoteEndPoint as IPEndPoint;
 
+            if (client.Socket.ProtocolType == ProtocolType.Tcp)
+            {
+                // sessions gather their replies into one send per run,
+                // Nagle would only delay acks and user control events
+                client.Socket.NoDelay = true;
+            }
+
             // push accept context back to pool
             asyncContext.AcceptSocket = null;
             lock (this.acceptAsyncContexts)
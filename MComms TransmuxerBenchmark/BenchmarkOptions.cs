@@ -0,0 +1,237 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.Linq;
+    using System.Text;
+
+    /// <summary>
+    /// Command line options of the benchmark
+    /// </summary>
+    public class BenchmarkOptions
+    {
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of BenchmarkOptions with default values
+        /// </summary>
+        public BenchmarkOptions()
+        {
+            this.Mode = "all";
+            this.Channels = 8;
+            this.Rate = 1.0;
+            this.Duration = 30;
+            this.Warmup = 10;
+            this.SinkPort = 8090;
+            this.MaxLag = 1000;
+            this.Iterations = 200000;
+            this.Threads = Environment.ProcessorCount;
+            this.Runs = 2;
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets or sets what to run: micro, ingest, all (micro and ingest) or replay
+        /// </summary>
+        public string Mode { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of published channels, one RTMP connection each
+        /// </summary>
+        public int Channels { get; set; }
+
+        /// <summary>
+        /// Gets or sets replay speed, 1 is real time
+        /// </summary>
+        public double Rate { get; set; }
+
+        /// <summary>
+        /// Gets or sets measured time in seconds
+        /// </summary>
+        public int Duration { get; set; }
+
+        /// <summary>
+        /// Gets or sets time in seconds to publish before measuring
+        /// </summary>
+        public int Warmup { get; set; }
+
+        /// <summary>
+        /// Gets or sets FLV capture to replay, synthetic stream is generated if null
+        /// </summary>
+        public string FlvPath { get; set; }
+
+        /// <summary>
+        /// Gets or sets host:port of an external server to publish to, the in-process server is started if null
+        /// </summary>
+        public string Server { get; set; }
+
+        /// <summary>
+        /// Gets or sets port of the publishing point stand-in
+        /// </summary>
+        public int SinkPort { get; set; }
+
+        /// <summary>
+        /// Gets or sets p99 send lag in milliseconds up to which a channel counts as keeping up
+        /// </summary>
+        public int MaxLag { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of operations measured by each micro-benchmark
+        /// </summary>
+        public int Iterations { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of threads of multithreaded micro-benchmarks
+        /// </summary>
+        public int Threads { get; set; }
+
+        /// <summary>
+        /// Gets or sets number of replay runs compared to each other
+        /// </summary>
+        public int Runs { get; set; }
+
+        /// <summary>
+        /// Gets or sets folder replay output is written to, temporary folder is used if null
+        /// </summary>
+        public string OutputFolder { get; set; }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Parses command line
+        /// </summary>
+        /// <param name="args">Command line arguments</param>
+        /// <returns>Parsed options</returns>
+        /// <exception cref="ArgumentException">Unknown option or wrong value</exception>
+        public static BenchmarkOptions Parse(string[] args)
+        {
+            BenchmarkOptions options = new BenchmarkOptions();
+
+            int i = 0;
+            if (args.Length > 0 && !args[0].StartsWith("-"))
+            {
+                options.Mode = args[0].ToLowerInvariant();
+                if (options.Mode != "micro" && options.Mode != "ingest" && options.Mode != "all" && options.Mode != "replay")
+                {
+                    throw new ArgumentException(string.Format("Unknown mode {0}", args[0]));
+                }
+
+                ++i;
+            }
+
+            for (; i < args.Length; ++i)
+            {
+                string name = args[i].ToLowerInvariant();
+                if (i + 1 >= args.Length)
+                {
+                    throw new ArgumentException(string.Format("Option {0} needs a value", args[i]));
+                }
+
+                string value = args[++i];
+
+                switch (name)
+                {
+                    case "-channels":
+                        options.Channels = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-rate":
+                        options.Rate = BenchmarkOptions.ParseDouble(name, value);
+                        break;
+
+                    case "-duration":
+                        options.Duration = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-warmup":
+                        options.Warmup = BenchmarkOptions.ParseInt(name, value, 0);
+                        break;
+
+                    case "-flv":
+                        options.FlvPath = value;
+                        break;
+
+                    case "-server":
+                        options.Server = value;
+                        break;
+
+                    case "-sinkport":
+                        options.SinkPort = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-maxlag":
+                        options.MaxLag = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-iterations":
+                        options.Iterations = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-threads":
+                        options.Threads = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-runs":
+                        options.Runs = BenchmarkOptions.ParseInt(name, value, 1);
+                        break;
+
+                    case "-out":
+                        options.OutputFolder = value;
+                        break;
+
+                    default:
+                        throw new ArgumentException(string.Format("Unknown option {0}", args[i - 1]));
+                }
+            }
+
+            return options;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Parses integer option value
+        /// </summary>
+        /// <param name="name">Option name</param>
+        /// <param name="value">Option value</param>
+        /// <param name="minValue">Minimum allowed value</param>
+        /// <returns>Parsed value</returns>
+        private static int ParseInt(string name, string value, int minValue)
+        {
+            int result = 0;
+            if (!int.TryParse(value, NumberStyles.Integer, CultureInfo.InvariantCulture, out result) || result < minValue)
+            {
+                throw new ArgumentException(string.Format("Wrong value {0} of option {1}", value, name));
+            }
+
+            return result;
+        }
+
+        /// <summary>
+        /// Parses positive number option value
+        /// </summary>
+        /// <param name="name">Option name</param>
+        /// <param name="value">Option value</param>
+        /// <returns>Parsed value</returns>
+        private static double ParseDouble(string name, string value)
+        {
+            double result = 0;
+            if (!double.TryParse(value, NumberStyles.Float, CultureInfo.InvariantCulture, out result) || result <= 0)
+            {
+                throw new ArgumentException(string.Format("Wrong value {0} of option {1}", value, name));
+            }
+
+            return result;
+        }
+
+        #endregion
+    }
+}
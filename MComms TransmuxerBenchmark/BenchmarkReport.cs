@@ -0,0 +1,124 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.IO;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Writes benchmark results as aligned plain text, so runs can be diffed and grepped by scripts
+    /// </summary>
+    public class BenchmarkReport
+    {
+        #region Private fields
+
+        /// <summary>
+        /// Output writer
+        /// </summary>
+        private TextWriter writer = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of BenchmarkReport
+        /// </summary>
+        /// <param name="writer">Output writer</param>
+        public BenchmarkReport(TextWriter writer)
+        {
+            this.writer = writer;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Writes section title
+        /// </summary>
+        /// <param name="title">Title</param>
+        public void WriteSection(string title)
+        {
+            this.writer.WriteLine();
+            this.writer.WriteLine(title);
+            this.writer.WriteLine(new string('-', title.Length));
+            this.writer.Flush();
+        }
+
+        /// <summary>
+        /// Writes header of the latency table
+        /// </summary>
+        /// <param name="unit">Latency unit</param>
+        public void WriteLatencyHeader(string unit)
+        {
+            this.writer.WriteLine(
+                string.Format(
+                    CultureInfo.InvariantCulture,
+                    "{0,-36}{1,12}{2,14}{3,10}{4,10}{5,10}{6,10}{7,12}",
+                    "name",
+                    "ops",
+                    "ops/s",
+                    "MB/s",
+                    "mean, " + unit,
+                    "p50",
+                    "p99",
+                    "max"));
+            this.writer.Flush();
+        }
+
+        /// <summary>
+        /// Writes row of the latency table
+        /// </summary>
+        /// <param name="name">Measured operation</param>
+        /// <param name="operations">Number of operations</param>
+        /// <param name="bytes">Number of processed bytes, 0 if not applicable</param>
+        /// <param name="seconds">Elapsed time</param>
+        /// <param name="latency">Operation latencies</param>
+        public void WriteLatencyRow(string name, long operations, long bytes, double seconds, LatencyHistogram latency)
+        {
+            this.writer.WriteLine(
+                string.Format(
+                    CultureInfo.InvariantCulture,
+                    "{0,-36}{1,12}{2,14:0}{3,10}{4,10:0.0}{5,10}{6,10}{7,12}",
+                    name,
+                    operations,
+                    seconds > 0 ? operations / seconds : 0,
+                    bytes > 0 && seconds > 0 ? (bytes / seconds / 1048576).ToString("0.0", CultureInfo.InvariantCulture) : "-",
+                    latency.Mean,
+                    latency.GetValueAtPercentile(50),
+                    latency.GetValueAtPercentile(99),
+                    latency.Max));
+            this.writer.Flush();
+        }
+
+        /// <summary>
+        /// Writes row of a benchmark which couldn't run
+        /// </summary>
+        /// <param name="name">Benchmark name</param>
+        /// <param name="reason">Why it was skipped</param>
+        public void WriteSkipped(string name, string reason)
+        {
+            this.writer.WriteLine(string.Format(CultureInfo.InvariantCulture, "{0,-36}skipped: {1}", name, reason));
+            this.writer.Flush();
+        }
+
+        /// <summary>
+        /// Writes named value
+        /// </summary>
+        /// <param name="name">Value name</param>
+        /// <param name="format">Value format string</param>
+        /// <param name="args">Format arguments</param>
+        public void WriteValue(string name, string format, params object[] args)
+        {
+            this.writer.WriteLine(string.Format(CultureInfo.InvariantCulture, "{0,-36}", name + ":") + string.Format(CultureInfo.InvariantCulture, format, args));
+            this.writer.Flush();
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,339 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Linq;
+    using System.Runtime.InteropServices;
+    using System.Text;
+
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// FLV tag loaded from a capture or generated
+    /// </summary>
+    public class FlvTag
+    {
+        /// <summary>
+        /// Gets or sets tag type: audio, video or AMF0 data
+        /// </summary>
+        public RtmpMessageType TagType { get; set; }
+
+        /// <summary>
+        /// Gets or sets timestamp in milliseconds relative to the first tag
+        /// </summary>
+        public long Timestamp { get; set; }
+
+        /// <summary>
+        /// Gets or sets tag body, sent as RTMP message body as is
+        /// </summary>
+        public byte[] Data { get; set; }
+
+        /// <summary>
+        /// Gets whether the tag has to be sent once per connection only: metadata and codec configurations
+        /// </summary>
+        public bool IsHeader
+        {
+            get
+            {
+                switch (this.TagType)
+                {
+                    case RtmpMessageType.DataAmf0:
+                        return true;
+
+                    case RtmpMessageType.Video:
+                        return this.Data.Length > 1 && (RtmpVideoCodec)(this.Data[0] & 0x0F) == RtmpVideoCodec.AVC && this.Data[1] == (byte)RtmpMediaPacketType.Configuration;
+
+                    case RtmpMessageType.Audio:
+                        return this.Data.Length > 1 && (RtmpAudioCodec)(this.Data[0] >> 4) == RtmpAudioCodec.AAC && this.Data[1] == (byte)RtmpMediaPacketType.Configuration;
+
+                    default:
+                        return false;
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Audio, video and metadata tags replayed by the synthetic publisher. Loaded from an FLV file,
+    /// e.g. one written by FLV dump of a published stream, or generated as H.264/AAC stream with
+    /// random payload, which the muxer doesn't look into.
+    /// </summary>
+    public class FlvCapture
+    {
+        #region Public constants
+
+        /// <summary>
+        /// AVC decoder configuration of generated video, Main profile 720x480
+        /// </summary>
+        public static readonly byte[] AvcConfiguration = new byte[]
+        {
+            0x01, 0x4D, 0x40, 0x1F, 0xFF, 0xE1, 0x00,
+            0x16, 0x67, 0x4D, 0x40, 0x1F, 0xEC, 0xA0, 0x5A, 0x1E, 0xD8, 0x08, 0x80,
+            0x00, 0x01, 0xF4, 0x80, 0x00, 0xEA, 0x60, 0x07, 0x8C, 0x18, 0xCB, 0x01,
+            0x00, 0x04, 0x68, 0xE9, 0x3B, 0xC8
+        };
+
+        /// <summary>
+        /// AAC audio specific config of generated audio, LC 44100 Hz stereo
+        /// </summary>
+        public static readonly byte[] AacConfiguration = new byte[] { 0x12, 0x10 };
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of FlvCapture
+        /// </summary>
+        /// <param name="name">Capture name used in reports</param>
+        /// <param name="tags">Tags ordered by timestamp</param>
+        public FlvCapture(string name, List<FlvTag> tags)
+        {
+            this.Name = name;
+            this.Tags = tags;
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets capture name
+        /// </summary>
+        public string Name { get; private set; }
+
+        /// <summary>
+        /// Gets tags ordered by timestamp
+        /// </summary>
+        public List<FlvTag> Tags { get; private set; }
+
+        /// <summary>
+        /// Gets capture duration in milliseconds, time between the first and the last tag
+        /// </summary>
+        public long Duration
+        {
+            get
+            {
+                return this.Tags.Count > 0 ? this.Tags[this.Tags.Count - 1].Timestamp - this.Tags[0].Timestamp : 0;
+            }
+        }
+
+        /// <summary>
+        /// Gets bitrate of media tags in bits per second
+        /// </summary>
+        public long Bitrate
+        {
+            get
+            {
+                long bytes = this.Tags.Where(tag => !tag.IsHeader).Sum(tag => (long)tag.Data.Length);
+                return this.Duration > 0 ? bytes * 8000 / this.Duration : 0;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Loads FLV file
+        /// </summary>
+        /// <param name="path">File path</param>
+        /// <returns>Loaded capture</returns>
+        /// <exception cref="InvalidDataException">Not an FLV file</exception>
+        public static FlvCapture Load(string path)
+        {
+            List<FlvTag> tags = new List<FlvTag>();
+
+            using (FlvFileReader reader = new FlvFileReader(path))
+            {
+                FlvTagHeader header = new FlvTagHeader();
+                IntPtr body = IntPtr.Zero;
+                long firstTimestamp = -1;
+
+                // a truncated capture ends with its last complete tag
+                while (reader.ReadTag(header, out body))
+                {
+                    if (header.TagType != RtmpMessageType.Audio && header.TagType != RtmpMessageType.Video && header.TagType != RtmpMessageType.DataAmf0)
+                    {
+                        continue;
+                    }
+
+                    byte[] data = new byte[header.DataSize];
+                    Marshal.Copy(body, data, 0, data.Length);
+
+                    if (firstTimestamp < 0)
+                    {
+                        firstTimestamp = header.Timestamp;
+                    }
+
+                    tags.Add(new FlvTag { TagType = header.TagType, Timestamp = Math.Max(0, header.Timestamp - firstTimestamp), Data = data });
+                }
+            }
+
+            return new FlvCapture(Path.GetFileName(path), tags);
+        }
+
+        /// <summary>
+        /// Writes capture to FLV file in the format of FLV dump
+        /// </summary>
+        /// <param name="path">File path</param>
+        public void Save(string path)
+        {
+            bool hasAudio = this.Tags.Any(tag => tag.TagType == RtmpMessageType.Audio);
+            bool hasVideo = this.Tags.Any(tag => tag.TagType == RtmpMessageType.Video);
+
+            using (EndianBinaryWriter writer = new EndianBinaryWriter(File.Create(path)))
+            {
+                writer.Endiannes = Endianness.BigEndian;
+
+                PacketBuffer packet = new FlvFileHeader(hasAudio, hasVideo).ToPacketBuffer();
+                try
+                {
+                    writer.Write(packet.Buffer, 0, packet.ActualBufferSize);
+                    writer.Write((uint)0); // first previous tag size
+
+                    foreach (FlvTag tag in this.Tags)
+                    {
+                        FlvTagHeader hdr = new FlvTagHeader
+                        {
+                            TagType = tag.TagType,
+                            DataSize = (uint)tag.Data.Length,
+                            Timestamp = (uint)tag.Timestamp,
+                            StreamId = 0
+                        };
+
+                        hdr.ToPacketBuffer(packet);
+                        writer.Write(packet.Buffer, 0, packet.ActualBufferSize);
+                        writer.Write(tag.Data, 0, tag.Data.Length);
+                        writer.Write((uint)(hdr.HeaderSize + tag.Data.Length));
+                    }
+                }
+                finally
+                {
+                    packet.Release();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Generates H.264/AAC capture with random payload
+        /// </summary>
+        /// <param name="duration">Duration in milliseconds</param>
+        /// <param name="videoBitrate">Video bitrate in bits per second</param>
+        /// <param name="frameRate">Video frame rate</param>
+        /// <param name="keyFrameInterval">Key frame interval in frames</param>
+        /// <param name="audioBitrate">Audio bitrate in bits per second</param>
+        /// <returns>Generated capture</returns>
+        public static FlvCapture Generate(int duration, int videoBitrate, int frameRate, int keyFrameInterval, int audioBitrate)
+        {
+            // fixed seed, every run replays the same data
+            Random random = new Random(1935);
+            List<FlvTag> tags = new List<FlvTag>();
+
+            tags.Add(new FlvTag { TagType = RtmpMessageType.DataAmf0, Timestamp = 0, Data = FlvCapture.CreateMetadata(videoBitrate, frameRate, audioBitrate) });
+
+            byte[] videoConfig = new byte[5 + FlvCapture.AvcConfiguration.Length];
+            videoConfig[0] = 0x10 | (byte)RtmpVideoCodec.AVC;
+            videoConfig[1] = (byte)RtmpMediaPacketType.Configuration;
+            Array.Copy(FlvCapture.AvcConfiguration, 0, videoConfig, 5, FlvCapture.AvcConfiguration.Length);
+            tags.Add(new FlvTag { TagType = RtmpMessageType.Video, Timestamp = 0, Data = videoConfig });
+
+            byte[] audioConfig = new byte[2 + FlvCapture.AacConfiguration.Length];
+            audioConfig[0] = ((byte)RtmpAudioCodec.AAC << 4) | 0x0F; // 44 kHz, 16 bit, stereo
+            audioConfig[1] = (byte)RtmpMediaPacketType.Configuration;
+            Array.Copy(FlvCapture.AacConfiguration, 0, audioConfig, 2, FlvCapture.AacConfiguration.Length);
+            tags.Add(new FlvTag { TagType = RtmpMessageType.Audio, Timestamp = 0, Data = audioConfig });
+
+            // key frames are 3 times bigger than the average frame
+            int frameSize = videoBitrate / 8 / frameRate;
+            int keyFrameSize = 3 * frameSize;
+            int deltaFrameSize = keyFrameInterval > 1 ? ((keyFrameInterval * frameSize) - keyFrameSize) / (keyFrameInterval - 1) : frameSize;
+            int audioFrameDuration = 1024;
+            int audioFrameSize = audioBitrate / 8 * audioFrameDuration / 44100;
+
+            long videoFrames = (long)duration * frameRate / 1000;
+            long audioFrames = (long)duration * 44100 / 1000 / audioFrameDuration;
+            long videoFrame = 0;
+            long audioFrame = 0;
+
+            while (videoFrame < videoFrames || audioFrame < audioFrames)
+            {
+                long videoTimestamp = videoFrame * 1000 / frameRate;
+                long audioTimestamp = audioFrame * audioFrameDuration * 1000 / 44100;
+
+                if (videoFrame < videoFrames && (audioFrame >= audioFrames || videoTimestamp <= audioTimestamp))
+                {
+                    bool keyFrame = (videoFrame % keyFrameInterval) == 0;
+                    int naluSize = Math.Max(16, keyFrame ? keyFrameSize : deltaFrameSize);
+
+                    byte[] data = new byte[9 + naluSize];
+                    random.NextBytes(data);
+                    data[0] = (byte)((keyFrame ? 0x10 : 0x20) | (byte)RtmpVideoCodec.AVC);
+                    data[1] = (byte)RtmpMediaPacketType.Media;
+                    data[2] = data[3] = data[4] = 0; // composition time
+                    data[5] = (byte)(naluSize >> 24);
+                    data[6] = (byte)(naluSize >> 16);
+                    data[7] = (byte)(naluSize >> 8);
+                    data[8] = (byte)naluSize;
+                    data[9] = (byte)(keyFrame ? 0x65 : 0x41); // IDR or non-IDR slice
+
+                    tags.Add(new FlvTag { TagType = RtmpMessageType.Video, Timestamp = videoTimestamp, Data = data });
+                    ++videoFrame;
+                }
+                else
+                {
+                    byte[] data = new byte[2 + Math.Max(8, audioFrameSize)];
+                    random.NextBytes(data);
+                    data[0] = audioConfig[0];
+                    data[1] = (byte)RtmpMediaPacketType.Media;
+
+                    tags.Add(new FlvTag { TagType = RtmpMessageType.Audio, Timestamp = audioTimestamp, Data = data });
+                    ++audioFrame;
+                }
+            }
+
+            return new FlvCapture(string.Format("synthetic H.264 {0} kbps, AAC {1} kbps", videoBitrate / 1000, audioBitrate / 1000), tags);
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Creates onMetaData body of generated capture
+        /// </summary>
+        /// <param name="videoBitrate">Video bitrate in bits per second</param>
+        /// <param name="frameRate">Video frame rate</param>
+        /// <param name="audioBitrate">Audio bitrate in bits per second</param>
+        /// <returns>AMF0 encoded metadata</returns>
+        private static byte[] CreateMetadata(int videoBitrate, int frameRate, int audioBitrate)
+        {
+            RtmpAmfObject metadata = new RtmpAmfObject();
+            metadata.Numbers.Add("videocodecid", (double)RtmpVideoCodec.AVC);
+            metadata.Numbers.Add("width", 720);
+            metadata.Numbers.Add("height", 480);
+            metadata.Numbers.Add("framerate", frameRate);
+            metadata.Numbers.Add("videodatarate", videoBitrate / 1000);
+            metadata.Numbers.Add("audiocodecid", (double)RtmpAudioCodec.AAC);
+            metadata.Numbers.Add("audiodatarate", audioBitrate / 1000);
+            metadata.Numbers.Add("audiosamplerate", 44100);
+            metadata.Numbers.Add("audiosamplesize", 16);
+            metadata.Numbers.Add("audiochannels", 2);
+
+            using (MemoryStream stream = new MemoryStream())
+            {
+                using (EndianBinaryWriter writer = new EndianBinaryWriter(stream, true))
+                {
+                    writer.WriteAmf0("onMetaData");
+                    writer.WriteAmf0(metadata);
+                }
+
+                return stream.ToArray();
+            }
+        }
+
+        #endregion
+    }
+}
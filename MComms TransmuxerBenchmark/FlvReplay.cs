@@ -0,0 +1,354 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Runtime.InteropServices;
+    using System.Security.Cryptography;
+    using System.Text;
+
+    using MComms_Transmuxer;
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+    using MComms_Transmuxer.SmoothStreaming;
+
+    /// <summary>
+    /// Replays FLV capture, e.g. one written by FLV dump of a published stream, through the message
+    /// stream, segmenter and publisher as fast as they take it, without sockets and publishing points.
+    /// The capture is memory mapped and its tags are decoded as the native demuxer's messages are, outputs
+    /// are lossless and fragments are written to dump files, so every run of the same build produces the
+    /// same files. Runs are repeated and compared, which makes the replay usable for bisecting throughput
+    /// regressions and reproducing stream problems much faster than real time.
+    /// </summary>
+    public class FlvReplay
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Message stream the capture is published on
+        /// </summary>
+        private const int MessageStreamId = 1;
+
+        /// <summary>
+        /// Chunk stream of audio messages
+        /// </summary>
+        private const uint AudioChunkStreamId = 4;
+
+        /// <summary>
+        /// Chunk stream of data messages
+        /// </summary>
+        private const uint DataChunkStreamId = 5;
+
+        /// <summary>
+        /// Chunk stream of video messages
+        /// </summary>
+        private const uint VideoChunkStreamId = 6;
+
+        /// <summary>
+        /// Benchmark options
+        /// </summary>
+        private BenchmarkOptions options = null;
+
+        /// <summary>
+        /// Report to write results to
+        /// </summary>
+        private BenchmarkReport report = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of FlvReplay
+        /// </summary>
+        /// <param name="options">Benchmark options</param>
+        /// <param name="report">Report to write results to</param>
+        public FlvReplay(BenchmarkOptions options, BenchmarkReport report)
+        {
+            this.options = options;
+            this.report = report;
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Runs the replay
+        /// </summary>
+        /// <returns>True if all runs succeeded and produced identical output</returns>
+        public bool Run()
+        {
+            string outputFolder = this.options.OutputFolder ?? Path.Combine(Path.GetTempPath(), "MComms_TransmuxerReplay");
+            Directory.CreateDirectory(outputFolder);
+
+            string path = this.options.FlvPath;
+            if (path == null)
+            {
+                path = Path.Combine(outputFolder, "synthetic.flv");
+                FlvCapture.Generate(60000, 2000000, 30, 60, 128000).Save(path);
+            }
+
+            this.report.WriteSection(string.Format("Replay, {0}, {1} runs to {2}", Path.GetFileName(path), this.options.Runs, outputFolder));
+
+            // nothing leaves the process, fragments are only written to dump files
+            MComms_Transmuxer.Properties.Settings.Default.EnablePublishingPointPush = false;
+            MComms_Transmuxer.Properties.Settings.Default.EnableOrigin = false;
+            MComms_Transmuxer.Properties.Settings.Default.EnableFlvDump = false;
+            MComms_Transmuxer.Properties.Settings.Default.EnableFragmentDump = true;
+
+            string publishName = Path.GetFileNameWithoutExtension(path);
+            Dictionary<string, string> firstDigests = null;
+            bool identical = true;
+
+            for (int run = 0; run < this.options.Runs; ++run)
+            {
+                string runFolder = Path.Combine(outputFolder, string.Format("run{0}", run));
+                if (Directory.Exists(runFolder))
+                {
+                    Directory.Delete(runFolder, true);
+                }
+
+                Directory.CreateDirectory(runFolder);
+                MComms_Transmuxer.Properties.Settings.Default.FragmentSaveFolder = runFolder + Path.DirectorySeparatorChar;
+
+                Process process = Process.GetCurrentProcess();
+                TimeSpan processorTime = process.TotalProcessorTime;
+                Stopwatch stopwatch = Stopwatch.StartNew();
+
+                int tags = 0;
+                long bytes = 0;
+                long duration = 0;
+                string error = null;
+
+                try
+                {
+                    this.ReplayFile(path, publishName, out tags, out bytes, out duration);
+                }
+                catch (CriticalStreamException ex)
+                {
+                    error = ex.Message;
+                }
+                finally
+                {
+                    // closes dump files, the next run starts with new publishers
+                    SmoothStreamingPublisher.DeleteAll();
+                }
+
+                stopwatch.Stop();
+                double seconds = stopwatch.Elapsed.TotalSeconds;
+                process.Refresh();
+                double cores = (process.TotalProcessorTime - processorTime).TotalSeconds / seconds;
+
+                if (error != null)
+                {
+                    this.report.WriteValue(string.Format("run {0}", run), "failed after {0} tags: {1}", tags, error);
+                    identical = false;
+                    continue;
+                }
+
+                this.report.WriteValue(
+                    string.Format("run {0}", run),
+                    "{0} tags in {1:0.000} s, {2:0.0}x real time, {3:0.0} MB/s, {4:0.00} cores",
+                    tags,
+                    seconds,
+                    duration / 1000.0 / seconds,
+                    bytes / seconds / 1048576,
+                    cores);
+
+                Dictionary<string, string> digests = FlvReplay.GetDigests(runFolder);
+                if (firstDigests == null)
+                {
+                    firstDigests = digests;
+                    foreach (KeyValuePair<string, string> pair in digests)
+                    {
+                        this.report.WriteValue(pair.Key, "{0} bytes, SHA-1 {1}", new FileInfo(Path.Combine(runFolder, pair.Key)).Length, pair.Value);
+                    }
+                }
+                else if (digests.Count != firstDigests.Count || digests.Any(pair => !firstDigests.ContainsKey(pair.Key) || firstDigests[pair.Key] != pair.Value))
+                {
+                    this.report.WriteValue(string.Format("run {0} output", run), "differs from run 0");
+                    identical = false;
+                }
+            }
+
+            this.report.WriteValue("identical output", identical ? "yes" : "no");
+            return identical;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Publishes memory mapped FLV file on a new message stream tag by tag
+        /// </summary>
+        /// <param name="path">FLV file path</param>
+        /// <param name="publishName">Publish name</param>
+        /// <param name="tags">Number of replayed tags</param>
+        /// <param name="bytes">Number of replayed bytes</param>
+        /// <param name="duration">Time between the first and the last media tag in milliseconds</param>
+        /// <exception cref="InvalidDataException">Not an FLV file</exception>
+        private void ReplayFile(string path, string publishName, out int tags, out long bytes, out long duration)
+        {
+            tags = 0;
+            bytes = 0;
+            duration = 0;
+
+            long firstTimestamp = -1;
+
+            using (FlvFileReader reader = new FlvFileReader(path))
+            {
+                RtmpMessageStream stream = new RtmpMessageStream(FlvReplay.MessageStreamId);
+                stream.PublishName = publishName;
+                stream.FullPublishName = publishName;
+                stream.Lossless = true;
+                stream.Publishing = true;
+
+                try
+                {
+                    FlvTagHeader header = new FlvTagHeader();
+                    IntPtr data = IntPtr.Zero;
+
+                    // a truncated capture ends with its last complete tag
+                    while (reader.ReadTag(header, out data))
+                    {
+                        long timestamp = header.Timestamp;
+                        RtmpMessage msg = FlvReplay.DecodeTag(header.TagType, timestamp, data, (int)header.DataSize);
+                        if (msg == null)
+                        {
+                            continue;
+                        }
+
+                        ++tags;
+                        bytes += header.DataSize;
+
+                        if (msg is RtmpMessageMedia)
+                        {
+                            if (firstTimestamp < 0)
+                            {
+                                firstTimestamp = timestamp;
+                            }
+
+                            duration = Math.Max(duration, timestamp - firstTimestamp);
+
+                            try
+                            {
+                                stream.ProcessMediaData((RtmpMessageMedia)msg);
+                            }
+                            finally
+                            {
+                                ((RtmpMessageMedia)msg).MediaData.Release();
+                            }
+                        }
+                        else if (msg is RtmpMessageMetadata)
+                        {
+                            stream.ProcessMetadata((RtmpMessageMetadata)msg);
+                        }
+
+                        stream.Flush();
+                    }
+                }
+                finally
+                {
+                    // lets outputs process what's queued
+                    stream.Dispose();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Decodes FLV tag as RTMP message received on the replayed message stream
+        /// </summary>
+        /// <param name="tagType">Tag type</param>
+        /// <param name="timestamp">Tag timestamp</param>
+        /// <param name="data">Tag body in the mapped file</param>
+        /// <param name="dataSize">Tag body size</param>
+        /// <returns>New RTMP message, null if the tag isn't supported</returns>
+        private static RtmpMessage DecodeTag(RtmpMessageType tagType, long timestamp, IntPtr data, int dataSize)
+        {
+            uint chunkStreamId = 0;
+            switch (tagType)
+            {
+                case RtmpMessageType.Audio:
+                    chunkStreamId = FlvReplay.AudioChunkStreamId;
+                    break;
+
+                case RtmpMessageType.Video:
+                    chunkStreamId = FlvReplay.VideoChunkStreamId;
+                    break;
+
+                case RtmpMessageType.DataAmf0:
+                    chunkStreamId = FlvReplay.DataChunkStreamId;
+                    break;
+
+                default:
+                    return null;
+            }
+
+            RtmpChunkHeader hdr = new RtmpChunkHeader
+            {
+                Format = 0,
+                ChunkStreamId = chunkStreamId,
+                Timestamp = timestamp,
+                MessageLength = dataSize,
+                MessageType = tagType,
+                MessageStreamId = FlvReplay.MessageStreamId
+            };
+
+            if (dataSize > Global.MediaAllocator.BufferSize)
+            {
+                // increase buffer sizes
+                Global.MediaAllocator.Reallocate(dataSize * 3 / 2, Global.MediaAllocator.BufferCount);
+            }
+
+            PacketBuffer packet = dataSize > Global.Allocator.BufferSize ? Global.MediaAllocator.LockBuffer() : Global.Allocator.LockBuffer();
+            packet.ActualBufferSize = dataSize;
+            if (dataSize > 0)
+            {
+                Marshal.Copy(data, packet.Buffer, 0, dataSize);
+            }
+
+            RtmpMessage msg = null;
+            using (PacketBufferStream messageStream = new PacketBufferStream(packet))
+            {
+                messageStream.OneMessage = true;
+                msg = RtmpMessage.Decode(hdr, messageStream);
+            }
+
+            packet.Release();
+
+            return msg;
+        }
+
+        /// <summary>
+        /// Computes SHA-1 digests of all files in the folder
+        /// </summary>
+        /// <param name="folder">Folder path</param>
+        /// <returns>Map from file name to hex digest, ordered by name</returns>
+        private static Dictionary<string, string> GetDigests(string folder)
+        {
+            Dictionary<string, string> digests = new Dictionary<string, string>();
+
+            using (SHA1 sha1 = SHA1.Create())
+            {
+                foreach (string file in Directory.GetFiles(folder).OrderBy(name => name, StringComparer.Ordinal))
+                {
+                    byte[] digest = null;
+                    using (FileStream stream = File.OpenRead(file))
+                    {
+                        digest = sha1.ComputeHash(stream);
+                    }
+
+                    digests.Add(Path.GetFileName(file), BitConverter.ToString(digest).Replace("-", string.Empty).ToLowerInvariant());
+                }
+            }
+
+            return digests;
+        }
+
+        #endregion
+    }
+}
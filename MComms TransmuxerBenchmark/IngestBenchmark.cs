@@ -0,0 +1,243 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.Globalization;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer;
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// Publishes the capture over many RTMP connections at once to the in-process server, or to an
+    /// external one, and measures how many channels it sustains. Publishing points are served by the
+    /// loopback stand-in, so the whole pipeline from socket to fragment upload is exercised. A channel
+    /// is sustained if its p99 send lag stays within the limit: a server which can't keep up stops
+    /// reading and publishers fall behind their timestamps.
+    /// </summary>
+    public class IngestBenchmark
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Time between starting publishers, in milliseconds, so that handshakes don't all come at once
+        /// </summary>
+        private const int StartInterval = 20;
+
+        /// <summary>
+        /// Time between progress lines, in seconds
+        /// </summary>
+        private const int ProgressInterval = 5;
+
+        /// <summary>
+        /// Benchmark options
+        /// </summary>
+        private BenchmarkOptions options = null;
+
+        /// <summary>
+        /// Report to write results to
+        /// </summary>
+        private BenchmarkReport report = null;
+
+        /// <summary>
+        /// Replayed capture
+        /// </summary>
+        private FlvCapture capture = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of IngestBenchmark
+        /// </summary>
+        /// <param name="options">Benchmark options</param>
+        /// <param name="report">Report to write results to</param>
+        public IngestBenchmark(BenchmarkOptions options, BenchmarkReport report)
+        {
+            this.options = options;
+            this.report = report;
+            this.capture = options.FlvPath != null ?
+                FlvCapture.Load(options.FlvPath) :
+                FlvCapture.Generate(60000, 2000000, 30, 60, 128000);
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Runs the benchmark
+        /// </summary>
+        public void Run()
+        {
+            string host = "127.0.0.1";
+            int port = MComms_Transmuxer.Properties.Settings.Default.RtmpPort;
+            int channels = this.options.Channels;
+
+            if (this.options.Server != null)
+            {
+                string[] parts = this.options.Server.Split(':');
+                host = parts[0];
+                if (parts.Length > 1)
+                {
+                    port = int.Parse(parts[1], CultureInfo.InvariantCulture);
+                }
+            }
+            else if (channels > Global.RtmpMaxConnections)
+            {
+                // the in-process server doesn't accept more
+                channels = Global.RtmpMaxConnections;
+            }
+
+            this.report.WriteSection(string.Format(
+                "Ingest, {0}, {1} channels at {2}x real time to {3}",
+                this.capture.Name,
+                channels,
+                this.options.Rate.ToString(CultureInfo.InvariantCulture),
+                this.options.Server ?? "in-process server"));
+
+            using (PublishingPointStandIn standIn = new PublishingPointStandIn(this.options.SinkPort))
+            {
+                RtmpServer server = null;
+                List<SyntheticPublisher> publishers = new List<SyntheticPublisher>();
+
+                try
+                {
+                    standIn.Start();
+
+                    if (this.options.Server == null)
+                    {
+                        MComms_Transmuxer.Properties.Settings.Default.PublishingRoot = standIn.Root;
+                        MComms_Transmuxer.Properties.Settings.Default.EnablePublishingPointPush = true;
+                        MComms_Transmuxer.Properties.Settings.Default.EnableFlvDump = false;
+                        MComms_Transmuxer.Properties.Settings.Default.EnableOrigin = false;
+
+                        server = new RtmpServer();
+                        server.Start();
+                    }
+
+                    for (int i = 0; i < channels; ++i)
+                    {
+                        // trailing digits would be taken as bitrate modifier of the same stream
+                        SyntheticPublisher publisher = new SyntheticPublisher(host, port, string.Format("bench-{0}-live", i), this.capture, this.options.Rate);
+                        publishers.Add(publisher);
+                        publisher.Start();
+                        Thread.Sleep(IngestBenchmark.StartInterval);
+                    }
+
+                    this.Measure(publishers, standIn);
+                }
+                finally
+                {
+                    foreach (SyntheticPublisher publisher in publishers)
+                    {
+                        publisher.Stop();
+                    }
+
+                    if (server != null)
+                    {
+                        server.Stop();
+                    }
+                }
+            }
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Waits for the warm up, measures and writes results
+        /// </summary>
+        /// <param name="publishers">Started publishers</param>
+        /// <param name="standIn">Publishing point stand-in</param>
+        private void Measure(List<SyntheticPublisher> publishers, PublishingPointStandIn standIn)
+        {
+            Console.WriteLine("Warming up for {0} s...", this.options.Warmup);
+            Thread.Sleep(this.options.Warmup * 1000);
+
+            foreach (StreamStatistics statistics in StreamStatistics.GetAll())
+            {
+                statistics.Reset();
+            }
+
+            standIn.ResetCounters();
+            foreach (SyntheticPublisher publisher in publishers)
+            {
+                publisher.ResetCounters();
+            }
+
+            Process process = Process.GetCurrentProcess();
+            TimeSpan processorTime = process.TotalProcessorTime;
+            Stopwatch stopwatch = Stopwatch.StartNew();
+
+            while (stopwatch.Elapsed.TotalSeconds < this.options.Duration)
+            {
+                double remaining = this.options.Duration - stopwatch.Elapsed.TotalSeconds;
+                Thread.Sleep((int)Math.Ceiling(Math.Min(IngestBenchmark.ProgressInterval, remaining) * 1000));
+                Console.WriteLine(
+                    "{0,4:0} s: {1} published, {2} uploads, {3} fragments",
+                    stopwatch.Elapsed.TotalSeconds,
+                    publishers.Count(publisher => publisher.Published && publisher.Error == null),
+                    standIn.ActiveUploads,
+                    standIn.Fragments);
+            }
+
+            stopwatch.Stop();
+            double seconds = stopwatch.Elapsed.TotalSeconds;
+
+            // only CPU time of this process: with an external server it's the publishers' only
+            process.Refresh();
+            double cores = (process.TotalProcessorTime - processorTime).TotalSeconds / seconds;
+
+            int published = publishers.Count(publisher => publisher.Published && publisher.Error == null);
+            int failed = publishers.Count(publisher => publisher.Error != null);
+            int sustained = publishers.Count(publisher => publisher.Published && publisher.Error == null && publisher.Lag.GetValueAtPercentile(99) <= this.options.MaxLag * 1000L);
+            double sessions = sustained * this.options.Rate;
+
+            this.report.WriteValue("channels published", "{0}", published);
+            this.report.WriteValue("channels failed", "{0}", failed);
+            this.report.WriteValue("channels sustained", "{0} (p99 send lag <= {1} ms)", sustained, this.options.MaxLag);
+            this.report.WriteValue("real time sessions", "{0:0.0}", sessions);
+            this.report.WriteValue("sessions per core", "{0:0.00} ({1} cores)", sessions / Environment.ProcessorCount, Environment.ProcessorCount);
+            this.report.WriteValue("CPU used", "{0:0.00} cores", cores);
+            this.report.WriteValue("sessions per used core", "{0}", cores > 0 ? (sessions / cores).ToString("0.00", CultureInfo.InvariantCulture) : "-");
+            this.report.WriteValue("sent", "{0:0.0} MB/s", publishers.Sum(publisher => publisher.SentBytes) / seconds / 1048576);
+            this.report.WriteValue("uploaded", "{0:0.0} MB/s", standIn.ReceivedBytes / seconds / 1048576);
+            this.report.WriteValue("fragments", "{0:0.0} /s", standIn.Fragments / seconds);
+
+            this.report.WriteLatencyHeader("us");
+
+            LatencyHistogram lag = new LatencyHistogram();
+            foreach (SyntheticPublisher publisher in publishers)
+            {
+                lag.Add(publisher.Lag);
+            }
+
+            this.report.WriteLatencyRow("publisher send lag (tag)", lag.Count, 0, seconds, lag);
+
+            if (this.options.Server == null)
+            {
+                // stages of all streams together
+                List<StreamStatistics> streams = StreamStatistics.GetAll();
+                foreach (PipelineStage stage in Enum.GetValues(typeof(PipelineStage)))
+                {
+                    LatencyHistogram latency = new LatencyHistogram();
+                    foreach (StreamStatistics statistics in streams)
+                    {
+                        latency.Add(statistics.GetHistogram(stage));
+                    }
+
+                    this.report.WriteLatencyRow(string.Format("stage {0}", stage), latency.Count, 0, seconds, latency);
+                }
+            }
+        }
+
+        #endregion
+    }
+}
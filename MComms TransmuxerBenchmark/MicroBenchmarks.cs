@@ -0,0 +1,545 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer;
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+    using MComms_Transmuxer.SmoothStreaming;
+
+    /// <summary>
+    /// Measures the hot operations of the ingest path one by one, without sockets: chunk decoding,
+    /// AMF0 decoding and encoding, packet buffer allocation and muxing. Every operation is timed
+    /// separately, so the latencies include about as much as two Stopwatch calls take. The synthetic
+    /// capture is always used so that runs on different machines measure the same data.
+    /// </summary>
+    public class MicroBenchmarks
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Chunk size of the decoded chunk stream
+        /// </summary>
+        private const int ChunkSize = 4096;
+
+        /// <summary>
+        /// Message stream of the decoded chunk stream
+        /// </summary>
+        private const int MessageStreamId = 1;
+
+        /// <summary>
+        /// Benchmark options
+        /// </summary>
+        private BenchmarkOptions options = null;
+
+        /// <summary>
+        /// Report to write results to
+        /// </summary>
+        private BenchmarkReport report = null;
+
+        /// <summary>
+        /// Replayed capture
+        /// </summary>
+        private FlvCapture capture = null;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of MicroBenchmarks
+        /// </summary>
+        /// <param name="options">Benchmark options</param>
+        /// <param name="report">Report to write results to</param>
+        public MicroBenchmarks(BenchmarkOptions options, BenchmarkReport report)
+        {
+            this.options = options;
+            this.report = report;
+            this.capture = FlvCapture.Generate(60000, 2000000, 30, 60, 128000);
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Runs all micro-benchmarks
+        /// </summary>
+        public void Run()
+        {
+            this.report.WriteSection(string.Format("Micro-benchmarks, {0}, {1} iterations", this.capture.Name, this.options.Iterations));
+            this.report.WriteLatencyHeader("ns");
+
+            this.Run("chunk decode, managed (packet)", 1, (iterations, latency) => this.DecodeChunks(iterations, latency, false));
+            this.Run("chunk decode, native (packet)", 1, (iterations, latency) => this.DecodeChunks(iterations, latency, true));
+            this.Run("amf0 decode connect", 1, (iterations, latency) => this.DecodeAmf0(iterations, latency, MicroBenchmarks.CreateConnectBody()));
+            this.Run("amf0 decode onMetaData", 1, (iterations, latency) => this.DecodeAmf0(iterations, latency, this.capture.Tags[0].Data));
+            this.Run("amf0 encode connect result, writer", 1, this.EncodeConnectResult);
+            this.Run("amf0 encode connect result, template", 1, this.EncodeConnectResultTemplate);
+            this.Run(string.Format("allocator lock/release, {0} threads", this.options.Threads), this.options.Threads, (iterations, latency) => this.LockReleaseBuffers(iterations, latency, false));
+            this.Run(string.Format("allocator lock/release across threads, {0} threads", this.options.Threads), this.options.Threads, (iterations, latency) => this.LockReleaseBuffers(iterations, latency, true));
+            this.Run("mux, one sample per call (sample)", 1, (iterations, latency) => this.Mux(iterations, latency, false));
+            this.Run("mux, batched samples (sample)", 1, (iterations, latency) => this.Mux(iterations, latency, true));
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Runs benchmark once to warm it up and once measured, and writes the result
+        /// </summary>
+        /// <param name="name">Benchmark name</param>
+        /// <param name="concurrency">Number of threads the benchmark runs operations on</param>
+        /// <param name="benchmark">Benchmark taking number of operations and histogram to record them to, returns number of processed bytes</param>
+        private void Run(string name, int concurrency, Func<int, LatencyHistogram, long> benchmark)
+        {
+            try
+            {
+                // JIT, caches and the muxer's buffer pools
+                benchmark(Math.Max(1, this.options.Iterations / 10), new LatencyHistogram());
+
+                LatencyHistogram latency = new LatencyHistogram();
+                long bytes = benchmark(this.options.Iterations, latency);
+
+                // operations are timed one by one with setup in between, so the time spent
+                // is the sum of operation times spread over the threads
+                double seconds = latency.Mean * latency.Count / 1000000000.0 / concurrency;
+                this.report.WriteLatencyRow(name, latency.Count, bytes, seconds, latency);
+            }
+            catch (DllNotFoundException ex)
+            {
+                this.report.WriteSkipped(name, ex.Message);
+            }
+            catch (EntryPointNotFoundException ex)
+            {
+                this.report.WriteSkipped(name, ex.Message);
+            }
+            catch (BadImageFormatException ex)
+            {
+                this.report.WriteSkipped(name, ex.Message);
+            }
+        }
+
+        /// <summary>
+        /// Decodes capture sent as chunk stream, one transport packet per operation
+        /// </summary>
+        /// <param name="iterations">Number of packets</param>
+        /// <param name="latency">Histogram to record decoding times to</param>
+        /// <param name="native">Whether to decode with the native demuxer</param>
+        /// <returns>Number of decoded bytes</returns>
+        private long DecodeChunks(int iterations, LatencyHistogram latency, bool native)
+        {
+            List<byte[]> packets = this.CreateChunkStreamPackets();
+            long bytes = 0;
+
+            // the parser picks the decoder when created
+            bool enableNativeIngest = MComms_Transmuxer.Properties.Settings.Default.EnableNativeIngest;
+            MComms_Transmuxer.Properties.Settings.Default.EnableNativeIngest = native;
+            RtmpProtocolParser parser = new RtmpProtocolParser();
+            MComms_Transmuxer.Properties.Settings.Default.EnableNativeIngest = enableNativeIngest;
+
+            using (parser)
+            {
+                parser.State = RtmpSessionState.Receiving;
+                parser.RegisterMessageStream(0);
+                parser.RegisterMessageStream(MicroBenchmarks.MessageStreamId);
+
+                // media messages are taken as they are, like RtmpSession does before pushing them to the muxer
+                parser.MediaHandler = (messages, offset, count) => count;
+
+                for (int i = 0; i < iterations; ++i)
+                {
+                    byte[] data = packets[i % packets.Count];
+                    PacketBuffer packet = Global.Allocator.LockBuffer();
+                    Array.Copy(data, packet.Buffer, data.Length);
+                    packet.ActualBufferSize = data.Length;
+
+                    long started = Stopwatch.GetTimestamp();
+
+                    RtmpMessage msg = parser.Decode(packet);
+                    packet.Release();
+
+                    for (; msg != null; msg = parser.Decode(null))
+                    {
+                        RtmpMessageMedia media = msg as RtmpMessageMedia;
+                        if (media != null)
+                        {
+                            media.MediaData.Release();
+                            continue;
+                        }
+
+                        RtmpMessageSetChunkSize setChunkSize = msg as RtmpMessageSetChunkSize;
+                        if (setChunkSize != null)
+                        {
+                            parser.ChunkSize = (int)setChunkSize.ChunkSize;
+                        }
+                    }
+
+                    latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                    bytes += data.Length;
+                }
+            }
+
+            return bytes;
+        }
+
+        /// <summary>
+        /// Decodes AMF0 message body
+        /// </summary>
+        /// <param name="iterations">Number of decodings</param>
+        /// <param name="latency">Histogram to record decoding times to</param>
+        /// <param name="body">Message body</param>
+        /// <returns>Number of decoded bytes</returns>
+        private long DecodeAmf0(int iterations, LatencyHistogram latency, byte[] body)
+        {
+            long bytes = 0;
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                long started = Stopwatch.GetTimestamp();
+                new RtmpAmf0Reader(body, 0, body.Length).ReadAll();
+                latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                bytes += body.Length;
+            }
+
+            return bytes;
+        }
+
+        /// <summary>
+        /// Encodes reply to connect value by value, the way replies were encoded before templates
+        /// </summary>
+        /// <param name="iterations">Number of encodings</param>
+        /// <param name="latency">Histogram to record encoding times to</param>
+        /// <returns>Number of encoded bytes</returns>
+        private long EncodeConnectResult(int iterations, LatencyHistogram latency)
+        {
+            long bytes = 0;
+
+            using (MemoryStream stream = new MemoryStream(Global.TransportBufferSize))
+            {
+                using (EndianBinaryWriter writer = new EndianBinaryWriter(stream, true))
+                {
+                    for (int i = 0; i < iterations; ++i)
+                    {
+                        long started = Stopwatch.GetTimestamp();
+
+                        stream.Position = 0;
+
+                        RtmpAmfObject properties = new RtmpAmfObject();
+                        properties.Strings.Add("fmsVer", "FMS/3,0,1,123");
+                        properties.Numbers.Add("capabilities", 31);
+
+                        RtmpAmfObject information = new RtmpAmfObject();
+                        information.Strings.Add("level", "status");
+                        information.Strings.Add("code", "NetConnection.Connect.Success");
+                        information.Strings.Add("description", "Connection succeeded.");
+                        information.Numbers.Add("clientId", i);
+                        information.Numbers.Add("objectEncoding", 0);
+
+                        writer.WriteAmf0("_result");
+                        writer.WriteAmf0(1.0);
+                        writer.WriteAmf0(properties);
+                        writer.WriteAmf0(information);
+                        writer.Flush();
+
+                        latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                        bytes += stream.Position;
+                    }
+                }
+            }
+
+            return bytes;
+        }
+
+        /// <summary>
+        /// Encodes reply to connect from the precompiled template
+        /// </summary>
+        /// <param name="iterations">Number of encodings</param>
+        /// <param name="latency">Histogram to record encoding times to</param>
+        /// <returns>Number of encoded bytes</returns>
+        private long EncodeConnectResultTemplate(int iterations, LatencyHistogram latency)
+        {
+            long bytes = 0;
+            byte[] buffer = new byte[Global.TransportBufferSize];
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                long started = Stopwatch.GetTimestamp();
+                int size = RtmpMessageCommandReply.ConnectResult.Encode(buffer, 0, new object[] { (double)i });
+                latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                bytes += size;
+            }
+
+            return bytes;
+        }
+
+        /// <summary>
+        /// Locks and releases packet buffers on several threads at once
+        /// </summary>
+        /// <param name="iterations">Number of lock/release pairs of all threads together</param>
+        /// <param name="latency">Histogram to record lock/release times to</param>
+        /// <param name="crossThread">Whether buffers are released by the next thread like packets received on one thread and sent on another</param>
+        /// <returns>Always 0</returns>
+        private long LockReleaseBuffers(int iterations, LatencyHistogram latency, bool crossThread)
+        {
+            int threadCount = this.options.Threads;
+            int threadIterations = Math.Max(1, iterations / threadCount);
+            PacketBufferAllocator allocator = new PacketBufferAllocator(Global.TransportBufferSize, threadCount * 4);
+
+            // threads record to own histograms, a shared one would be contended more than the allocator
+            LatencyHistogram[] threadLatencies = new LatencyHistogram[threadCount];
+            ConcurrentQueue<PacketBuffer>[] handovers = new ConcurrentQueue<PacketBuffer>[threadCount];
+            Thread[] threads = new Thread[threadCount];
+            ManualResetEvent start = new ManualResetEvent(false);
+
+            for (int i = 0; i < threadCount; ++i)
+            {
+                handovers[i] = new ConcurrentQueue<PacketBuffer>();
+            }
+
+            for (int i = 0; i < threadCount; ++i)
+            {
+                LatencyHistogram threadLatency = new LatencyHistogram();
+                ConcurrentQueue<PacketBuffer> received = handovers[i];
+                ConcurrentQueue<PacketBuffer> next = handovers[(i + 1) % threadCount];
+                threadLatencies[i] = threadLatency;
+                threads[i] = new Thread(() =>
+                    {
+                        start.WaitOne();
+                        for (int j = 0; j < threadIterations; ++j)
+                        {
+                            long started = Stopwatch.GetTimestamp();
+                            PacketBuffer buffer = allocator.LockBuffer();
+                            if (!crossThread)
+                            {
+                                buffer.Release();
+                                threadLatency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                                continue;
+                            }
+
+                            long elapsed = Stopwatch.GetTimestamp() - started;
+                            next.Enqueue(buffer);
+
+                            // the handover isn't timed, only locking and releasing
+                            PacketBuffer other = null;
+                            if (received.TryDequeue(out other))
+                            {
+                                started = Stopwatch.GetTimestamp();
+                                other.Release();
+                                elapsed += Stopwatch.GetTimestamp() - started;
+                            }
+
+                            threadLatency.Record(MicroBenchmarks.ToNanoseconds(elapsed));
+                        }
+                    });
+                threads[i].Start();
+            }
+
+            start.Set();
+
+            for (int i = 0; i < threadCount; ++i)
+            {
+                threads[i].Join();
+                latency.Add(threadLatencies[i]);
+            }
+
+            foreach (ConcurrentQueue<PacketBuffer> handover in handovers)
+            {
+                PacketBuffer buffer = null;
+                while (handover.TryDequeue(out buffer))
+                {
+                    buffer.Release();
+                }
+            }
+
+            start.Close();
+            return 0;
+        }
+
+        /// <summary>
+        /// Muxes capture samples to Smooth Streaming fragments. Publishing point push is switched off,
+        /// so completed fragments are dropped by the publisher
+        /// </summary>
+        /// <param name="iterations">Number of samples</param>
+        /// <param name="latency">Histogram to record muxing times to</param>
+        /// <param name="batched">Whether to queue samples for batches or to push them one by one</param>
+        /// <returns>Number of muxed bytes</returns>
+        private long Mux(int iterations, LatencyHistogram latency, bool batched)
+        {
+            bool enablePublishingPointPush = MComms_Transmuxer.Properties.Settings.Default.EnablePublishingPointPush;
+            bool enableOrigin = MComms_Transmuxer.Properties.Settings.Default.EnableOrigin;
+            MComms_Transmuxer.Properties.Settings.Default.EnablePublishingPointPush = false;
+            MComms_Transmuxer.Properties.Settings.Default.EnableOrigin = false;
+
+            try
+            {
+                using (SmoothStreamingSegmenter segmenter = new SmoothStreamingSegmenter(string.Format("benchmark://micro/{0}", Guid.NewGuid()), true))
+                {
+                    Guid videoStreamId = segmenter.RegisterStream(this.CreateVideoMediaType());
+                    Guid audioStreamId = segmenter.RegisterStream(MicroBenchmarks.CreateAudioMediaType());
+
+                    List<FlvTag> samples = this.capture.Tags.Where(tag => !tag.IsHeader && tag.TagType != RtmpMessageType.DataAmf0).ToList();
+                    DateTime absoluteTimeOrigin = DateTime.Now;
+                    long loopOffset = 0;
+                    long bytes = 0;
+
+                    for (int i = 0; i < iterations; ++i)
+                    {
+                        if (i > 0 && i % samples.Count == 0)
+                        {
+                            loopOffset += this.capture.Duration + 33;
+                        }
+
+                        FlvTag tag = samples[i % samples.Count];
+                        bool video = tag.TagType == RtmpMessageType.Video;
+                        Guid streamId = video ? videoStreamId : audioStreamId;
+                        bool keyFrame = !video || (tag.Data[0] >> 4) == 1;
+                        int offset = video ? 5 : 2;
+                        int length = tag.Data.Length - offset;
+                        long timestamp = (tag.Timestamp + loopOffset) * 10000;
+                        DateTime absoluteTime = absoluteTimeOrigin.AddTicks(timestamp);
+
+                        if (batched)
+                        {
+                            PacketBuffer mediaData = Global.MediaAllocator.LockBuffer();
+                            Array.Copy(tag.Data, mediaData.Buffer, tag.Data.Length);
+                            mediaData.ActualBufferSize = tag.Data.Length;
+
+                            // every SmoothStreamingMaxBatchSize-th call pushes the batch
+                            long started = Stopwatch.GetTimestamp();
+                            segmenter.QueueMediaData(streamId, absoluteTime, timestamp, keyFrame, mediaData, offset, length);
+                            latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+
+                            mediaData.Release();
+                        }
+                        else
+                        {
+                            long started = Stopwatch.GetTimestamp();
+                            segmenter.PushMediaData(streamId, absoluteTime, timestamp, keyFrame, tag.Data, offset, length);
+                            latency.Record(MicroBenchmarks.ToNanoseconds(Stopwatch.GetTimestamp() - started));
+                        }
+
+                        bytes += length;
+                    }
+
+                    segmenter.Flush();
+                    return bytes;
+                }
+            }
+            finally
+            {
+                MComms_Transmuxer.Properties.Settings.Default.EnablePublishingPointPush = enablePublishingPointPush;
+                MComms_Transmuxer.Properties.Settings.Default.EnableOrigin = enableOrigin;
+            }
+        }
+
+        /// <summary>
+        /// Sends capture tags to chunk stream the way publishers do and splits it to transport packets
+        /// </summary>
+        /// <returns>
+        /// Packets, the stream starts with chunk size change and ends with complete message so it can be decoded in a loop
+        /// </returns>
+        private List<byte[]> CreateChunkStreamPackets()
+        {
+            byte[] setChunkSize = new byte[] { 0, 0, MicroBenchmarks.ChunkSize >> 8, MicroBenchmarks.ChunkSize & 0xFF };
+            byte[] buffer = new byte[16 + this.capture.Tags.Sum(tag => SyntheticPublisher.GetMaxChunkedSize(tag.Data.Length, MicroBenchmarks.ChunkSize))];
+            int position = SyntheticPublisher.WriteChunks(buffer, 0, 2, RtmpMessageType.SetChunkSize, 0, 0, setChunkSize, Global.RtmpDefaultChunkSize);
+
+            foreach (FlvTag tag in this.capture.Tags)
+            {
+                uint chunkStreamId = tag.TagType == RtmpMessageType.Video ? 6u : tag.TagType == RtmpMessageType.Audio ? 4u : 5u;
+                position = SyntheticPublisher.WriteChunks(buffer, position, chunkStreamId, tag.TagType, (uint)tag.Timestamp, MicroBenchmarks.MessageStreamId, tag.Data, MicroBenchmarks.ChunkSize);
+            }
+
+            List<byte[]> packets = new List<byte[]>();
+            for (int offset = 0; offset < position; offset += Global.TransportBufferSize)
+            {
+                byte[] packet = new byte[Math.Min(Global.TransportBufferSize, position - offset)];
+                Array.Copy(buffer, offset, packet, 0, packet.Length);
+                packets.Add(packet);
+            }
+
+            return packets;
+        }
+
+        /// <summary>
+        /// Creates media type of the capture video
+        /// </summary>
+        /// <returns>Video media type</returns>
+        private MediaType CreateVideoMediaType()
+        {
+            MediaType mediaType = new MediaType();
+            mediaType.ContentType = MediaContentType.Video;
+            mediaType.Codec = MediaCodec.H264;
+            mediaType.Bitrate = (int)this.capture.Bitrate;
+            mediaType.Width = 720;
+            mediaType.Height = 480;
+            mediaType.Framerate = new Fraction(30, 1);
+            mediaType.PrivateData = (byte[])FlvCapture.AvcConfiguration.Clone();
+            return mediaType;
+        }
+
+        /// <summary>
+        /// Creates media type of the capture audio
+        /// </summary>
+        /// <returns>Audio media type</returns>
+        private static MediaType CreateAudioMediaType()
+        {
+            MediaType mediaType = new MediaType();
+            mediaType.ContentType = MediaContentType.Audio;
+            mediaType.Codec = MediaCodec.AAC;
+            mediaType.Bitrate = 128000;
+            mediaType.SampleRate = 44100;
+            mediaType.Channels = 2;
+            mediaType.SampleSize = 16;
+            mediaType.PrivateData = (byte[])FlvCapture.AacConfiguration.Clone();
+            return mediaType;
+        }
+
+        /// <summary>
+        /// Creates body of connect command as sent by encoders
+        /// </summary>
+        /// <returns>AMF0 encoded body</returns>
+        private static byte[] CreateConnectBody()
+        {
+            RtmpAmfObject parameters = new RtmpAmfObject();
+            parameters.Strings.Add("app", "live");
+            parameters.Strings.Add("type", "nonprivate");
+            parameters.Strings.Add("flashVer", "FMLE/3.0 (compatible; FMSc/1.0)");
+            parameters.Strings.Add("swfUrl", "rtmp://localhost/live");
+            parameters.Strings.Add("tcUrl", "rtmp://localhost/live");
+
+            using (MemoryStream stream = new MemoryStream())
+            {
+                using (EndianBinaryWriter writer = new EndianBinaryWriter(stream, true))
+                {
+                    writer.WriteAmf0("connect");
+                    writer.WriteAmf0(1.0);
+                    writer.WriteAmf0(parameters);
+                }
+
+                return stream.ToArray();
+            }
+        }
+
+        /// <summary>
+        /// Converts Stopwatch ticks to nanoseconds
+        /// </summary>
+        /// <param name="ticks">Stopwatch ticks</param>
+        /// <returns>Nanoseconds</returns>
+        private static long ToNanoseconds(long ticks)
+        {
+            return (long)(ticks * (1000000000.0 / Stopwatch.Frequency));
+        }
+
+        #endregion
+    }
+}
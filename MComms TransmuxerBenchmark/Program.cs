@@ -0,0 +1,80 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+    using System.Text;
+
+    using MComms_Transmuxer;
+    using MComms_Transmuxer.Common;
+
+    /// <summary>
+    /// Benchmark program
+    /// </summary>
+    static class Program
+    {
+        /// <summary>
+        /// Command line help
+        /// </summary>
+        private const string Usage =
+            "Usage: \"MComms TransmuxerBenchmark\" [micro|ingest|all|replay] [options]\n" +
+            "  -iterations <n>     operations per micro-benchmark (200000)\n" +
+            "  -threads <n>        threads of multithreaded micro-benchmarks (number of cores)\n" +
+            "  -channels <n>       published channels, one connection each (8)\n" +
+            "  -rate <x>           replay speed, 1 is real time (1)\n" +
+            "  -duration <s>       measured time (30)\n" +
+            "  -warmup <s>         publishing time before measuring (10)\n" +
+            "  -maxlag <ms>        p99 send lag up to which a channel is sustained (1000)\n" +
+            "  -flv <path>         FLV capture to publish or replay instead of the synthetic one\n" +
+            "  -server <host:port> external server to publish to instead of the in-process one\n" +
+            "  -sinkport <port>    port of the publishing point stand-in (8090)\n" +
+            "  -runs <n>           replay runs whose output must be identical (2)\n" +
+            "  -out <folder>       folder replay output is written to (temporary folder)";
+
+        /// <summary>
+        /// The main entry point for the application.
+        /// </summary>
+        static int Main(string[] args)
+        {
+            BenchmarkOptions options = null;
+            try
+            {
+                options = BenchmarkOptions.Parse(args);
+            }
+            catch (ArgumentException ex)
+            {
+                Console.Error.WriteLine(ex.Message);
+                Console.Error.WriteLine(Program.Usage);
+                return 1;
+            }
+
+            // same setup as the service does
+            EndianBinaryReader.GlobalEndiannes = Endianness.BigEndian;
+            EndianBinaryWriter.GlobalEndiannes = Endianness.BigEndian;
+            Global.Allocator = new PacketBufferAllocator(Global.TransportBufferSize, Global.RtmpMaxConnections * 30);
+            Global.MediaAllocator = new PacketBufferAllocator(Global.OneMediaBufferSize, Global.RtmpMaxConnections);
+
+            BenchmarkReport report = new BenchmarkReport(Console.Out);
+            report.WriteValue("machine", "{0}, {1} cores, {2}-bit", Environment.MachineName, Environment.ProcessorCount, IntPtr.Size * 8);
+            report.WriteValue("runtime", "{0}, {1}", Environment.Version, Environment.OSVersion);
+
+            if (options.Mode == "replay")
+            {
+                // exit code tells scripts, e.g. git bisect run, whether the output was reproducible
+                return new FlvReplay(options, report).Run() ? 0 : 2;
+            }
+
+            if (options.Mode != "ingest")
+            {
+                new MicroBenchmarks(options, report).Run();
+            }
+
+            if (options.Mode != "micro")
+            {
+                new IngestBenchmark(options, report).Run();
+            }
+
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,388 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Text;
+    using System.Threading;
+    using System.Xml;
+
+    using MComms_Transmuxer;
+
+    /// <summary>
+    /// Loopback stand-in for IIS Media Services publishing points. Answers the REST state requests
+    /// publishers start and shut down publishing points with, accepts the chunked stream uploads and
+    /// counts their fragments and bytes instead of storing them. Any publishing point name is accepted.
+    /// </summary>
+    public class PublishingPointStandIn : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// State document returned by GET and accepted by PUT of publishing point state
+        /// </summary>
+        private const string StateDocument =
+            "<?xml version=\"1.0\" encoding=\"utf-8\"?>" +
+            "<entry xmlns=\"http://www.w3.org/2005/Atom\"><content type=\"application/xml\">" +
+            "<SmoothStreaming xmlns=\"http://schemas.microsoft.com/iis/media/2011/03/streaming/management\">" +
+            "<State><Value>{0}</Value></State></SmoothStreaming></content></entry>";
+
+        /// <summary>
+        /// HTTP listener
+        /// </summary>
+        private HttpListener listener = new HttpListener();
+
+        /// <summary>
+        /// Listener thread
+        /// </summary>
+        private Thread listenerThread = null;
+
+        /// <summary>
+        /// Whether we've started
+        /// </summary>
+        private volatile bool isRunning = false;
+
+        /// <summary>
+        /// Publishing point states by publishing point path
+        /// </summary>
+        private Dictionary<string, string> states = new Dictionary<string, string>();
+
+        /// <summary>
+        /// Number of received fragments
+        /// </summary>
+        private long fragments = 0;
+
+        /// <summary>
+        /// Number of received bytes
+        /// </summary>
+        private long receivedBytes = 0;
+
+        /// <summary>
+        /// Number of uploads in progress
+        /// </summary>
+        private int activeUploads = 0;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of PublishingPointStandIn
+        /// </summary>
+        /// <param name="port">Loopback port to listen on</param>
+        public PublishingPointStandIn(int port)
+        {
+            this.Root = string.Format("http://127.0.0.1:{0}/", port);
+            this.listener.Prefixes.Add(this.Root);
+            this.listenerThread = new Thread(this.ListenerThreadProc);
+            this.listenerThread.IsBackground = true;
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Stops listening
+        /// </summary>
+        public void Dispose()
+        {
+            this.Stop();
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets URI publishing points are created under, to be used as publishing root
+        /// </summary>
+        public string Root { get; private set; }
+
+        /// <summary>
+        /// Gets number of received fragments
+        /// </summary>
+        public long Fragments
+        {
+            get
+            {
+                return Interlocked.Read(ref this.fragments);
+            }
+        }
+
+        /// <summary>
+        /// Gets number of received bytes
+        /// </summary>
+        public long ReceivedBytes
+        {
+            get
+            {
+                return Interlocked.Read(ref this.receivedBytes);
+            }
+        }
+
+        /// <summary>
+        /// Gets number of uploads in progress
+        /// </summary>
+        public int ActiveUploads
+        {
+            get
+            {
+                return this.activeUploads;
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Starts listening
+        /// </summary>
+        public void Start()
+        {
+            this.listener.Start();
+            this.isRunning = true;
+            this.listenerThread.Start();
+        }
+
+        /// <summary>
+        /// Stops listening
+        /// </summary>
+        public void Stop()
+        {
+            if (!this.isRunning)
+            {
+                return;
+            }
+
+            this.isRunning = false;
+            this.listener.Stop();
+            this.listenerThread.Join();
+            this.listener.Close();
+        }
+
+        /// <summary>
+        /// Clears fragment and byte counters
+        /// </summary>
+        public void ResetCounters()
+        {
+            Interlocked.Exchange(ref this.fragments, 0);
+            Interlocked.Exchange(ref this.receivedBytes, 0);
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Listener thread. State requests are served right away, every upload gets its own thread
+        /// as it lasts as long as the stream is published
+        /// </summary>
+        private void ListenerThreadProc()
+        {
+            while (this.isRunning)
+            {
+                HttpListenerContext context = null;
+                try
+                {
+                    context = this.listener.GetContext();
+                }
+                catch (HttpListenerException)
+                {
+                    // listener stopped
+                    continue;
+                }
+                catch (ObjectDisposedException)
+                {
+                    break;
+                }
+
+                if (context.Request.HttpMethod == "POST")
+                {
+                    Thread uploadThread = new Thread(this.UploadThreadProc, 256 * 1024);
+                    uploadThread.IsBackground = true;
+                    uploadThread.Start(context);
+                }
+                else
+                {
+                    this.ProcessStateRequest(context);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Serves GET and PUT of publishing point state
+        /// </summary>
+        /// <param name="context">Request context</param>
+        private void ProcessStateRequest(HttpListenerContext context)
+        {
+            try
+            {
+                string path = context.Request.Url.AbsolutePath;
+                if (!path.EndsWith("/state", StringComparison.OrdinalIgnoreCase))
+                {
+                    context.Response.StatusCode = (int)HttpStatusCode.NotFound;
+                    return;
+                }
+
+                string publishingPoint = path.Substring(0, path.Length - "/state".Length);
+
+                if (context.Request.HttpMethod == "PUT")
+                {
+                    XmlDocument doc = new XmlDocument();
+                    doc.Load(context.Request.InputStream);
+
+                    XmlNamespaceManager ns = new XmlNamespaceManager(doc.NameTable);
+                    ns.AddNamespace("ssm", "http://schemas.microsoft.com/iis/media/2011/03/streaming/management");
+                    XmlNode nodeState = doc.SelectSingleNode("//ssm:SmoothStreaming/ssm:State/ssm:Value", ns);
+
+                    lock (this.states)
+                    {
+                        this.states[publishingPoint] = nodeState != null ? nodeState.InnerText : "Idle";
+                    }
+                }
+
+                string state = null;
+                lock (this.states)
+                {
+                    if (!this.states.TryGetValue(publishingPoint, out state))
+                    {
+                        state = "Idle";
+                    }
+                }
+
+                byte[] body = Encoding.UTF8.GetBytes(string.Format(PublishingPointStandIn.StateDocument, state));
+                context.Response.ContentType = "application/atom+xml";
+                context.Response.ContentLength64 = body.Length;
+                context.Response.OutputStream.Write(body, 0, body.Length);
+            }
+            catch (Exception ex)
+            {
+                Global.Log.ErrorFormat("Publishing point stand-in failed to serve {0}: {1}", context.Request.Url, ex.ToString());
+                context.Response.StatusCode = (int)HttpStatusCode.InternalServerError;
+            }
+            finally
+            {
+                try
+                {
+                    context.Response.Close();
+                }
+                catch (HttpListenerException)
+                {
+                }
+            }
+        }
+
+        /// <summary>
+        /// Reads stream upload till the publisher ends it, counting top level moof boxes as fragments
+        /// </summary>
+        /// <param name="state">Request context</param>
+        private void UploadThreadProc(object state)
+        {
+            HttpListenerContext context = (HttpListenerContext)state;
+            Interlocked.Increment(ref this.activeUploads);
+
+            try
+            {
+                Stream body = context.Request.InputStream;
+                byte[] header = new byte[16];
+                byte[] skipBuffer = new byte[64 * 1024];
+
+                while (PublishingPointStandIn.ReadExactly(body, header, 8))
+                {
+                    long size = ((long)header[0] << 24) | ((long)header[1] << 16) | ((long)header[2] << 8) | header[3];
+                    string type = Encoding.ASCII.GetString(header, 4, 4);
+                    long headerSize = 8;
+
+                    if (size == 1)
+                    {
+                        // 64-bit box size
+                        if (!PublishingPointStandIn.ReadExactly(body, header, 8))
+                        {
+                            break;
+                        }
+
+                        size = 0;
+                        for (int i = 0; i < 8; ++i)
+                        {
+                            size = (size << 8) | header[i];
+                        }
+
+                        headerSize = 16;
+                    }
+
+                    if (type == "moof")
+                    {
+                        Interlocked.Increment(ref this.fragments);
+                    }
+
+                    Interlocked.Add(ref this.receivedBytes, headerSize);
+
+                    // size 0 means the box lasts till the end of the upload
+                    long remaining = size == 0 ? long.MaxValue : size - headerSize;
+                    while (remaining > 0)
+                    {
+                        int read = body.Read(skipBuffer, 0, (int)Math.Min(skipBuffer.Length, remaining));
+                        if (read <= 0)
+                        {
+                            break;
+                        }
+
+                        remaining -= read;
+                        Interlocked.Add(ref this.receivedBytes, read);
+                    }
+                }
+
+                context.Response.StatusCode = (int)HttpStatusCode.OK;
+            }
+            catch (Exception ex)
+            {
+                if (this.isRunning)
+                {
+                    Global.Log.DebugFormat("Upload to {0} ended: {1}", context.Request.Url, ex.Message);
+                }
+            }
+            finally
+            {
+                Interlocked.Decrement(ref this.activeUploads);
+
+                try
+                {
+                    context.Response.Close();
+                }
+                catch (Exception)
+                {
+                }
+            }
+        }
+
+        /// <summary>
+        /// Reads specified number of bytes
+        /// </summary>
+        /// <param name="stream">Stream to read from</param>
+        /// <param name="buffer">Buffer to read to</param>
+        /// <param name="count">Number of bytes</param>
+        /// <returns>True if all bytes have been read, false if stream has ended</returns>
+        private static bool ReadExactly(Stream stream, byte[] buffer, int count)
+        {
+            int offset = 0;
+            while (offset < count)
+            {
+                int read = stream.Read(buffer, offset, count - offset);
+                if (read <= 0)
+                {
+                    return false;
+                }
+
+                offset += read;
+            }
+
+            return true;
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,634 @@
+﻿namespace MComms_TransmuxerBenchmark
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Net.Sockets;
+    using System.Text;
+    using System.Threading;
+
+    using MComms_Transmuxer;
+    using MComms_Transmuxer.Common;
+    using MComms_Transmuxer.RTMP;
+
+    /// <summary>
+    /// RTMP publisher replaying a capture over one connection the way an encoder does: handshake,
+    /// connect, createStream and publish, then every tag is sent when its timestamp is due, scaled by
+    /// the replay rate. The capture is looped with increasing timestamps. How late tags go out because
+    /// the server doesn't take data fast enough is recorded as send lag.
+    /// </summary>
+    public class SyntheticPublisher : IDisposable
+    {
+        #region Private constants and fields
+
+        /// <summary>
+        /// Chunk size announced to the server
+        /// </summary>
+        private const int ChunkSize = 4096;
+
+        /// <summary>
+        /// Chunk stream of commands
+        /// </summary>
+        private const uint CommandChunkStreamId = 3;
+
+        /// <summary>
+        /// Chunk stream of audio
+        /// </summary>
+        private const uint AudioChunkStreamId = 4;
+
+        /// <summary>
+        /// Chunk stream of metadata
+        /// </summary>
+        private const uint DataChunkStreamId = 5;
+
+        /// <summary>
+        /// Chunk stream of video
+        /// </summary>
+        private const uint VideoChunkStreamId = 6;
+
+        /// <summary>
+        /// Time between the last tag of the capture and the first tag of its next loop, in milliseconds
+        /// </summary>
+        private const int LoopGap = 33;
+
+        /// <summary>
+        /// Timeout of connecting and waiting for replies, in milliseconds
+        /// </summary>
+        private const int ReplyTimeout = 10000;
+
+        /// <summary>
+        /// Server host
+        /// </summary>
+        private string host = null;
+
+        /// <summary>
+        /// Server port
+        /// </summary>
+        private int port = 0;
+
+        /// <summary>
+        /// Replayed capture
+        /// </summary>
+        private FlvCapture capture = null;
+
+        /// <summary>
+        /// Replay speed, 1 is real time
+        /// </summary>
+        private double rate = 1.0;
+
+        /// <summary>
+        /// Publisher thread
+        /// </summary>
+        private Thread thread = null;
+
+        /// <summary>
+        /// Whether we're running
+        /// </summary>
+        private volatile bool isRunning = false;
+
+        /// <summary>
+        /// Connection to the server
+        /// </summary>
+        private TcpClient client = null;
+
+        /// <summary>
+        /// Connection stream
+        /// </summary>
+        private NetworkStream stream = null;
+
+        /// <summary>
+        /// Message stream id assigned by the server
+        /// </summary>
+        private int messageStreamId = 0;
+
+        /// <summary>
+        /// Buffer chunked messages are written to
+        /// </summary>
+        private byte[] sendBuffer = new byte[64 * 1024];
+
+        /// <summary>
+        /// Buffer data received after publishing is read to and dropped
+        /// </summary>
+        private byte[] drainBuffer = new byte[4096];
+
+        /// <summary>
+        /// Number of sent bytes
+        /// </summary>
+        private long sentBytes = 0;
+
+        #endregion
+
+        #region Constructor
+
+        /// <summary>
+        /// Creates new instance of SyntheticPublisher
+        /// </summary>
+        /// <param name="host">Server host</param>
+        /// <param name="port">Server port</param>
+        /// <param name="publishName">Published stream name</param>
+        /// <param name="capture">Capture to replay</param>
+        /// <param name="rate">Replay speed, 1 is real time</param>
+        public SyntheticPublisher(string host, int port, string publishName, FlvCapture capture, double rate)
+        {
+            this.host = host;
+            this.port = port;
+            this.PublishName = publishName;
+            this.capture = capture;
+            this.rate = rate;
+            this.Lag = new LatencyHistogram();
+        }
+
+        #endregion
+
+        #region IDisposable
+
+        /// <summary>
+        /// Stops publishing
+        /// </summary>
+        public void Dispose()
+        {
+            this.Stop();
+        }
+
+        #endregion
+
+        #region Public properties
+
+        /// <summary>
+        /// Gets published stream name
+        /// </summary>
+        public string PublishName { get; private set; }
+
+        /// <summary>
+        /// Gets whether server has accepted publishing
+        /// </summary>
+        public bool Published { get; private set; }
+
+        /// <summary>
+        /// Gets why publishing failed, null if it didn't
+        /// </summary>
+        public string Error { get; private set; }
+
+        /// <summary>
+        /// Gets send lag, how late tags were sent compared to their timestamps, in microseconds
+        /// </summary>
+        public LatencyHistogram Lag { get; private set; }
+
+        /// <summary>
+        /// Gets number of bytes sent
+        /// </summary>
+        public long SentBytes
+        {
+            get
+            {
+                return Interlocked.Read(ref this.sentBytes);
+            }
+        }
+
+        #endregion
+
+        #region Public methods
+
+        /// <summary>
+        /// Starts publishing on own thread
+        /// </summary>
+        public void Start()
+        {
+            this.isRunning = true;
+            this.thread = new Thread(this.ThreadProc, 256 * 1024);
+            this.thread.Name = "Publisher " + this.PublishName;
+            this.thread.IsBackground = true;
+            this.thread.Start();
+        }
+
+        /// <summary>
+        /// Stops publishing and disconnects
+        /// </summary>
+        public void Stop()
+        {
+            if (this.thread == null)
+            {
+                return;
+            }
+
+            this.isRunning = false;
+            if (!this.thread.Join(1000))
+            {
+                // blocked by a server which doesn't read, closing the connection unblocks it
+                this.Disconnect();
+                this.thread.Join();
+            }
+
+            this.thread = null;
+        }
+
+        /// <summary>
+        /// Clears send lag and sent bytes
+        /// </summary>
+        public void ResetCounters()
+        {
+            this.Lag.Reset();
+            Interlocked.Exchange(ref this.sentBytes, 0);
+        }
+
+        /// <summary>
+        /// Returns maximum size of chunked message
+        /// </summary>
+        /// <param name="length">Message length</param>
+        /// <param name="chunkSize">Chunk size</param>
+        /// <returns>Maximum size including chunk headers</returns>
+        public static int GetMaxChunkedSize(int length, int chunkSize)
+        {
+            int chunkCount = Math.Max(1, (length + chunkSize - 1) / chunkSize);
+            return length + 16 + ((chunkCount - 1) * 5);
+        }
+
+        /// <summary>
+        /// Writes message split to chunks, the first one with type 0 header and the rest with type 3 headers
+        /// </summary>
+        /// <param name="buffer">Buffer to write to, at least GetMaxChunkedSize bytes from the position</param>
+        /// <param name="position">Buffer position</param>
+        /// <param name="chunkStreamId">Chunk stream id, 2 to 63</param>
+        /// <param name="messageType">Message type</param>
+        /// <param name="timestamp">Message timestamp</param>
+        /// <param name="messageStreamId">Message stream id</param>
+        /// <param name="data">Message body</param>
+        /// <param name="chunkSize">Chunk size</param>
+        /// <returns>Buffer position after the message</returns>
+        public static int WriteChunks(byte[] buffer, int position, uint chunkStreamId, RtmpMessageType messageType, uint timestamp, int messageStreamId, byte[] data, int chunkSize)
+        {
+            bool extendedTimestamp = timestamp >= 0xFFFFFF;
+            int dataOffset = 0;
+
+            do
+            {
+                if (dataOffset == 0)
+                {
+                    // type 0 header: timestamp, message length, type and stream id
+                    uint headerTimestamp = extendedTimestamp ? 0xFFFFFF : timestamp;
+                    buffer[position++] = (byte)chunkStreamId;
+                    buffer[position++] = (byte)(headerTimestamp >> 16);
+                    buffer[position++] = (byte)(headerTimestamp >> 8);
+                    buffer[position++] = (byte)headerTimestamp;
+                    buffer[position++] = (byte)(data.Length >> 16);
+                    buffer[position++] = (byte)(data.Length >> 8);
+                    buffer[position++] = (byte)data.Length;
+                    buffer[position++] = (byte)messageType;
+                    buffer[position++] = (byte)messageStreamId;
+                    buffer[position++] = (byte)(messageStreamId >> 8);
+                    buffer[position++] = (byte)(messageStreamId >> 16);
+                    buffer[position++] = (byte)(messageStreamId >> 24);
+                }
+                else
+                {
+                    // type 3 header, continuation of the message
+                    buffer[position++] = (byte)(0xC0 | chunkStreamId);
+                }
+
+                if (extendedTimestamp)
+                {
+                    buffer[position++] = (byte)(timestamp >> 24);
+                    buffer[position++] = (byte)(timestamp >> 16);
+                    buffer[position++] = (byte)(timestamp >> 8);
+                    buffer[position++] = (byte)timestamp;
+                }
+
+                int size = Math.Min(chunkSize, data.Length - dataOffset);
+                Array.Copy(data, dataOffset, buffer, position, size);
+                position += size;
+                dataOffset += size;
+            }
+            while (dataOffset < data.Length);
+
+            return position;
+        }
+
+        #endregion
+
+        #region Private methods
+
+        /// <summary>
+        /// Publisher thread
+        /// </summary>
+        private void ThreadProc()
+        {
+            try
+            {
+                this.client = new TcpClient();
+                this.client.NoDelay = true;
+                this.client.ReceiveTimeout = SyntheticPublisher.ReplyTimeout;
+                this.client.Connect(this.host, this.port);
+                this.stream = this.client.GetStream();
+
+                this.Handshake();
+                this.Publish();
+                this.Published = true;
+                this.Replay();
+            }
+            catch (Exception ex)
+            {
+                if (this.isRunning)
+                {
+                    this.Error = ex.Message;
+                    Global.Log.ErrorFormat("Publisher {0} failed: {1}", this.PublishName, ex.ToString());
+                }
+            }
+            finally
+            {
+                this.Disconnect();
+            }
+        }
+
+        /// <summary>
+        /// Closes connection
+        /// </summary>
+        private void Disconnect()
+        {
+            TcpClient client = this.client;
+            if (client != null)
+            {
+                try
+                {
+                    client.Close();
+                }
+                catch
+                {
+                }
+            }
+        }
+
+        /// <summary>
+        /// Performs RTMP handshake, S1 is echoed as C2
+        /// </summary>
+        private void Handshake()
+        {
+            byte[] c0c1 = new byte[1 + Global.RtmpHandshakeSize];
+            new Random().NextBytes(c0c1);
+            c0c1[0] = Global.RtmpVersion;
+            Array.Clear(c0c1, 1, 8); // time and zero
+            this.stream.Write(c0c1, 0, c0c1.Length);
+
+            byte[] s0s1s2 = new byte[1 + (2 * Global.RtmpHandshakeSize)];
+            this.ReadExactly(s0s1s2, s0s1s2.Length);
+            if (s0s1s2[0] != Global.RtmpVersion)
+            {
+                throw new InvalidDataException(string.Format("Unsupported RTMP version {0}", s0s1s2[0]));
+            }
+
+            this.stream.Write(s0s1s2, 1, Global.RtmpHandshakeSize);
+        }
+
+        /// <summary>
+        /// Connects to "live" application and publishes the stream
+        /// </summary>
+        private void Publish()
+        {
+            using (RtmpProtocolParser parser = new RtmpProtocolParser())
+            {
+                // any state after the handshake makes the parser decode chunks, this one also keeps it
+                // on the managed decoder as the native one is only used for receiving media
+                parser.State = RtmpSessionState.Stopped;
+                parser.RegisterMessageStream(0);
+
+                this.Send(new RtmpMessageSetChunkSize(SyntheticPublisher.ChunkSize));
+
+                RtmpAmfObject connectParameters = new RtmpAmfObject();
+                connectParameters.Strings.Add("app", "live");
+                connectParameters.Strings.Add("type", "nonprivate");
+                connectParameters.Strings.Add("flashVer", "FMLE/3.0 (compatible; MComms Transmuxer Benchmark)");
+                connectParameters.Strings.Add("tcUrl", string.Format("rtmp://{0}:{1}/live", this.host, this.port));
+                this.SendCommand("connect", 1, 0, connectParameters);
+                this.WaitForCommand(parser, "_result", 1);
+
+                this.SendCommand("releaseStream", 2, 0, new RtmpAmfNull(), this.PublishName);
+                this.SendCommand("FCPublish", 3, 0, new RtmpAmfNull(), this.PublishName);
+                this.SendCommand("createStream", 4, 0, new RtmpAmfNull());
+                RtmpMessageCommand createStreamResult = this.WaitForCommand(parser, "_result", 4);
+                if (createStreamResult.Parameters.Count < 2 || !(createStreamResult.Parameters[1] is double))
+                {
+                    throw new InvalidDataException("createStream result has no stream id");
+                }
+
+                this.messageStreamId = (int)(double)createStreamResult.Parameters[1];
+                parser.RegisterMessageStream(this.messageStreamId);
+
+                this.SendCommand("publish", 5, this.messageStreamId, new RtmpAmfNull(), this.PublishName, "live");
+                RtmpMessageCommand status = this.WaitForCommand(parser, "onStatus", 0);
+                RtmpAmfObject info = status.Parameters.Count > 1 ? status.Parameters[1] as RtmpAmfObject : null;
+                string code = (info != null && info.Strings.ContainsKey("code")) ? info.Strings["code"] : string.Empty;
+                if (code != "NetStream.Publish.Start")
+                {
+                    throw new InvalidDataException(string.Format("Publishing rejected: {0}", code));
+                }
+            }
+        }
+
+        /// <summary>
+        /// Sends capture tags when they're due till stopped
+        /// </summary>
+        private void Replay()
+        {
+            long start = Stopwatch.GetTimestamp();
+            long loopOffset = 0;
+            bool firstLoop = true;
+
+            while (this.isRunning)
+            {
+                foreach (FlvTag tag in this.capture.Tags)
+                {
+                    if (!firstLoop && tag.IsHeader)
+                    {
+                        continue;
+                    }
+
+                    long timestamp = tag.Timestamp + loopOffset;
+                    long due = start + (long)(timestamp / this.rate * Stopwatch.Frequency / 1000);
+
+                    while (true)
+                    {
+                        if (!this.isRunning)
+                        {
+                            return;
+                        }
+
+                        long wait = (due - Stopwatch.GetTimestamp()) * 1000 / Stopwatch.Frequency;
+                        if (wait <= 0)
+                        {
+                            break;
+                        }
+
+                        Thread.Sleep((int)Math.Min(wait, 100));
+                    }
+
+                    this.SendTag(tag, timestamp);
+                    this.Lag.RecordSince(due);
+                    this.Drain();
+                }
+
+                firstLoop = false;
+                loopOffset += this.capture.Duration + SyntheticPublisher.LoopGap;
+            }
+        }
+
+        /// <summary>
+        /// Sends capture tag as RTMP message of the published stream
+        /// </summary>
+        /// <param name="tag">Tag</param>
+        /// <param name="timestamp">Message timestamp</param>
+        private void SendTag(FlvTag tag, long timestamp)
+        {
+            uint chunkStreamId = SyntheticPublisher.DataChunkStreamId;
+            if (tag.TagType == RtmpMessageType.Audio)
+            {
+                chunkStreamId = SyntheticPublisher.AudioChunkStreamId;
+            }
+            else if (tag.TagType == RtmpMessageType.Video)
+            {
+                chunkStreamId = SyntheticPublisher.VideoChunkStreamId;
+            }
+
+            int maxSize = SyntheticPublisher.GetMaxChunkedSize(tag.Data.Length, SyntheticPublisher.ChunkSize);
+            if (this.sendBuffer.Length < maxSize)
+            {
+                this.sendBuffer = new byte[maxSize * 2];
+            }
+
+            int position = SyntheticPublisher.WriteChunks(this.sendBuffer, 0, chunkStreamId, tag.TagType, (uint)timestamp, this.messageStreamId, tag.Data, SyntheticPublisher.ChunkSize);
+            this.stream.Write(this.sendBuffer, 0, position);
+            Interlocked.Add(ref this.sentBytes, position);
+        }
+
+        /// <summary>
+        /// Sends command on the command chunk stream
+        /// </summary>
+        /// <param name="commandName">Command name</param>
+        /// <param name="transactionId">Transaction id</param>
+        /// <param name="messageStreamId">Message stream id</param>
+        /// <param name="parameters">Command parameters</param>
+        private void SendCommand(string commandName, int transactionId, int messageStreamId, params object[] parameters)
+        {
+            RtmpMessageCommand command = new RtmpMessageCommand(commandName, transactionId, parameters.ToList());
+            command.ChunkStreamId = SyntheticPublisher.CommandChunkStreamId;
+            command.MessageStreamId = messageStreamId;
+            this.Send(command);
+        }
+
+        /// <summary>
+        /// Sends message fitting into one chunk
+        /// </summary>
+        /// <param name="msg">Message</param>
+        private void Send(RtmpMessage msg)
+        {
+            PacketBuffer packet = msg.ToRtmpChunk();
+            try
+            {
+                this.stream.Write(packet.Buffer, 0, packet.ActualBufferSize);
+                Interlocked.Add(ref this.sentBytes, packet.ActualBufferSize);
+            }
+            finally
+            {
+                packet.Release();
+            }
+        }
+
+        /// <summary>
+        /// Receives messages till the specified command comes, applying chunk size changes on the way
+        /// </summary>
+        /// <param name="parser">Parser of received data</param>
+        /// <param name="commandName">Command name</param>
+        /// <param name="transactionId">Transaction id of the command</param>
+        /// <returns>Received command</returns>
+        /// <exception cref="InvalidDataException">Server has replied with an error</exception>
+        private RtmpMessageCommand WaitForCommand(RtmpProtocolParser parser, string commandName, int transactionId)
+        {
+            while (true)
+            {
+                PacketBuffer packet = Global.Allocator.LockBuffer();
+                try
+                {
+                    packet.ActualBufferSize = this.stream.Read(packet.Buffer, 0, packet.Size);
+                    if (packet.ActualBufferSize <= 0)
+                    {
+                        throw new IOException("Connection closed by server");
+                    }
+
+                    RtmpMessage msg = parser.Decode(packet);
+                    packet.Release();
+                    packet = null;
+
+                    for (; msg != null; msg = parser.Decode(null))
+                    {
+                        RtmpMessageSetChunkSize setChunkSize = msg as RtmpMessageSetChunkSize;
+                        if (setChunkSize != null)
+                        {
+                            parser.ChunkSize = (int)setChunkSize.ChunkSize;
+                            continue;
+                        }
+
+                        RtmpMessageCommand command = msg as RtmpMessageCommand;
+                        if (command == null)
+                        {
+                            continue;
+                        }
+
+                        if (command.CommandName == "_error" && command.TransactionId == transactionId)
+                        {
+                            RtmpAmfObject info = command.Parameters.Count > 1 ? command.Parameters[1] as RtmpAmfObject : null;
+                            throw new InvalidDataException(string.Format(
+                                "Command {0} failed: {1}",
+                                transactionId,
+                                (info != null && info.Strings.ContainsKey("description")) ? info.Strings["description"] : string.Empty));
+                        }
+
+                        if (command.CommandName == commandName && command.TransactionId == transactionId)
+                        {
+                            return command;
+                        }
+                    }
+                }
+                finally
+                {
+                    if (packet != null)
+                    {
+                        packet.Release();
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Reads specified number of bytes
+        /// </summary>
+        /// <param name="buffer">Buffer to read to</param>
+        /// <param name="count">Number of bytes</param>
+        private void ReadExactly(byte[] buffer, int count)
+        {
+            int offset = 0;
+            while (offset < count)
+            {
+                int read = this.stream.Read(buffer, offset, count - offset);
+                if (read <= 0)
+                {
+                    throw new IOException("Connection closed by server");
+                }
+
+                offset += read;
+            }
+        }
+
+        /// <summary>
+        /// Drops data received after publishing, acknowledgements and status messages
+        /// </summary>
+        private void Drain()
+        {
+            while (this.client.Available > 0)
+            {
+                this.stream.Read(this.drainBuffer, 0, Math.Min(this.drainBuffer.Length, this.client.Available));
+            }
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,123 @@
+﻿using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using MComms_Transmuxer.RTMP;
+
+namespace MComms_TransmuxerTests
+{
+
+
+    /// <summary>
+    ///This is a test class for FlvFileReaderTest and is intended
+    ///to contain all FlvFileReaderTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class FlvFileReaderTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        //
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///A test for ReadTag
+        ///</summary>
+        [TestMethod()]
+        public void ReadTagTest()
+        {
+            string path = Path.Combine(Path.GetTempPath(), "FlvFileReaderTest.flv");
+            byte[] flv = new byte[]
+            {
+                0x46, 0x4C, 0x56, 0x01, 0x05, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00,
+                // audio tag, 2 bytes at 0x01020304 ms
+                0x08, 0x00, 0x00, 0x02, 0x02, 0x03, 0x04, 0x01, 0x00, 0x00, 0x00, 0xAF, 0x01, 0x00, 0x00, 0x00, 0x0D,
+                // video tag, 3 bytes at 40 ms
+                0x09, 0x00, 0x00, 0x03, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00, 0x17, 0x01, 0x02, 0x00, 0x00, 0x00, 0x0E,
+                // truncated tag
+                0x09, 0x00, 0x01, 0x00, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x00, 0x17
+            };
+            File.WriteAllBytes(path, flv);
+
+            using (FlvFileReader target = new FlvFileReader(path))
+            {
+                FlvTagHeader header = new FlvTagHeader();
+                IntPtr body = IntPtr.Zero;
+
+                Assert.IsTrue(target.ReadTag(header, out body));
+                Assert.AreEqual(RtmpMessageType.Audio, header.TagType);
+                Assert.AreEqual(2u, header.DataSize);
+                Assert.AreEqual(0x01020304u, header.Timestamp);
+                Assert.AreEqual(0xAF, Marshal.ReadByte(body));
+
+                Assert.IsTrue(target.ReadTag(header, out body));
+                Assert.AreEqual(RtmpMessageType.Video, header.TagType);
+                Assert.AreEqual(3u, header.DataSize);
+                Assert.AreEqual(40u, header.Timestamp);
+                Assert.AreEqual(0x02, Marshal.ReadByte(body, 2));
+
+                Assert.IsFalse(target.ReadTag(header, out body));
+                Assert.IsTrue(target.Truncated);
+                Assert.AreEqual(48L, target.Position);
+            }
+        }
+
+        /// <summary>
+        ///A test for FlvFileReader Constructor with a file which is not FLV
+        ///</summary>
+        [TestMethod()]
+        [ExpectedException(typeof(InvalidDataException))]
+        public void FlvFileReaderConstructorTest()
+        {
+            string path = Path.Combine(Path.GetTempPath(), "FlvFileReaderConstructorTest.flv");
+            File.WriteAllBytes(path, new byte[20]);
+            new FlvFileReader(path).Dispose();
+        }
+    }
+}
@@ -0,0 +1,163 @@
+﻿using MComms_Transmuxer.Common;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Threading.Tasks;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for LatencyHistogramTest and is intended
+    ///to contain all LatencyHistogramTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class LatencyHistogramTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///A test for GetValueAtPercentile
+        ///</summary>
+        [TestMethod()]
+        public void GetValueAtPercentileTest()
+        {
+            LatencyHistogram target = new LatencyHistogram();
+            for (long i = 1; i <= 1000; ++i)
+            {
+                target.Record(i);
+            }
+
+            Assert.AreEqual(1000L, target.Count);
+            Assert.AreEqual(1000L, target.Max);
+            Assert.AreEqual(500.5, target.Mean);
+
+            // buckets are at most 1/16 wide
+            long p50 = target.GetValueAtPercentile(50);
+            Assert.IsTrue(p50 >= 500 && p50 <= 500 + 500 / 16, p50.ToString());
+            long p99 = target.GetValueAtPercentile(99);
+            Assert.IsTrue(p99 >= 990 && p99 <= 990 + 990 / 16, p99.ToString());
+            Assert.AreEqual(1000L, target.GetValueAtPercentile(100));
+
+            // small values are exact
+            Assert.AreEqual(1L, target.GetValueAtPercentile(0.1));
+        }
+
+        /// <summary>
+        ///A test for values out of range
+        ///</summary>
+        [TestMethod()]
+        public void RecordOutOfRangeTest()
+        {
+            LatencyHistogram target = new LatencyHistogram();
+            Assert.AreEqual(0L, target.GetValueAtPercentile(50));
+
+            target.Record(-5);
+            target.Record(long.MaxValue);
+
+            Assert.AreEqual(2L, target.Count);
+            Assert.AreEqual(long.MaxValue, target.Max);
+            Assert.AreEqual(0L, target.GetValueAtPercentile(50));
+
+            target.Reset();
+            Assert.AreEqual(0L, target.Count);
+            Assert.AreEqual(0L, target.Max);
+        }
+
+        /// <summary>
+        ///A test for concurrent Record
+        ///</summary>
+        [TestMethod()]
+        public void ConcurrentRecordTest()
+        {
+            LatencyHistogram target = new LatencyHistogram();
+
+            Parallel.For(0, 8, thread =>
+            {
+                for (int i = 0; i < 100000; ++i)
+                {
+                    target.Record(thread * 1000 + (i % 1000));
+                }
+            });
+
+            Assert.AreEqual(800000L, target.Count);
+            Assert.AreEqual(7999L, target.Max);
+        }
+
+        /// <summary>
+        ///A test for Add
+        ///</summary>
+        [TestMethod()]
+        public void AddTest()
+        {
+            LatencyHistogram target = new LatencyHistogram();
+            LatencyHistogram other = new LatencyHistogram();
+            for (long i = 1; i <= 500; ++i)
+            {
+                target.Record(i);
+                other.Record(i + 500);
+            }
+
+            target.Add(other);
+
+            Assert.AreEqual(1000L, target.Count);
+            Assert.AreEqual(1000L, target.Max);
+            Assert.AreEqual(500.5, target.Mean);
+            long p99 = target.GetValueAtPercentile(99);
+            Assert.IsTrue(p99 >= 990 && p99 <= 990 + 990 / 16, p99.ToString());
+
+            // the other histogram is left as it was
+            Assert.AreEqual(500L, other.Count);
+            Assert.AreEqual(1000L, other.Max);
+        }
+    }
+}
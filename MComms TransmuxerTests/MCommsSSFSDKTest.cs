@@ -0,0 +1,1324 @@
+﻿using MComms_Transmuxer.RTMP;
+using MComms_Transmuxer.SmoothStreaming;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace MComms_TransmuxerTests
+{
+
+
+    /// <summary>
+    ///This is a test class for MCommsSSFSDKTest and is intended
+    ///to contain all MCommsSSFSDKTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class MCommsSSFSDKTest
+    {
+        /// <summary>
+        ///AVCDecoderConfigurationRecord of 720x480 Main profile with one SPS and one PPS
+        ///</summary>
+        private static readonly byte[] avcDecoderConfigurationRecord = new byte[]
+        {
+            0x01, 0x4D, 0x40, 0x1F, 0xFF, 0xE1, 0x00, 0x16, 0x67, 0x4D, 0x40, 0x1F, 0xEC, 0xA0, 0x5A, 0x1E, 0xD8, 0x08,
+            0x80, 0x00, 0x01, 0xF4, 0x80, 0x00, 0xEA, 0x60, 0x07, 0x8C, 0x18, 0xCB, 0x01, 0x00, 0x04, 0x68, 0xE9, 0x3B, 0xC8,
+        };
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        //
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///Release callback of borrowed samples, context is the sample index
+        ///</summary>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void ReleaseCallback(IntPtr context);
+
+        /// <summary>
+        ///Adds AAC stream to a mux
+        ///</summary>
+        private static int AddAudioStream(int muxId, int sampleRate, byte[] audioSpecificConfig)
+        {
+            GCHandle config = GCHandle.Alloc(audioSpecificConfig, GCHandleType.Pinned);
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG streamConfig = new SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG();
+                streamConfig.nStreamType = 1;
+                streamConfig.nBitrate = 128000;
+                streamConfig.nChannels = 2;
+                streamConfig.nSampleRate = sampleRate;
+                streamConfig.nConfigSize = audioSpecificConfig.Length;
+                streamConfig.pConfig = config.AddrOfPinnedObject();
+                int streamId = SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig);
+                Assert.IsTrue(streamId >= 0);
+                return streamId;
+            }
+            finally
+            {
+                config.Free();
+            }
+        }
+
+        private static byte[] GetHeader(int muxId, int streamId)
+        {
+            int dataSize = 0;
+            IntPtr data = IntPtr.Zero;
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_GetHeader(muxId, streamId, ref dataSize, ref data));
+
+            byte[] header = new byte[dataSize];
+            Marshal.Copy(data, header, 0, dataSize);
+            return header;
+        }
+
+        private static byte[] GetAudioHeader(int sampleRate, byte[] audioSpecificConfig)
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            try
+            {
+                return GetHeader(muxId, AddAudioStream(muxId, sampleRate, audioSpecificConfig));
+            }
+            finally
+            {
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        private static int FindBox(byte[] data, string boxType)
+        {
+            byte[] type = Encoding.ASCII.GetBytes(boxType);
+            for (int i = 4; i + 4 <= data.Length; ++i)
+            {
+                if (data[i] == type[0] && data[i + 1] == type[1] && data[i + 2] == type[2] && data[i + 3] == type[3])
+                {
+                    return i - 4;
+                }
+            }
+
+            return -1;
+        }
+
+        /// <summary>
+        ///Walks boxes following each other from start to end and returns offset of the first one of boxType, -1 if there is none
+        ///</summary>
+        private static int FindChildBox(byte[] data, int start, int end, string boxType)
+        {
+            int position = start;
+            while (position < end)
+            {
+                int size = ReadInt(data, position);
+                Assert.IsTrue(size >= 8 && position + size <= end);
+                if (Encoding.ASCII.GetString(data, position + 4, 4) == boxType)
+                {
+                    return position;
+                }
+
+                position += size;
+            }
+
+            Assert.AreEqual(end, position);
+            return -1;
+        }
+
+        private static int ReadInt(byte[] data, int offset)
+        {
+            return data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
+        }
+
+        private static long ReadLong(byte[] data, int offset)
+        {
+            return (long)ReadInt(data, offset) << 32 | (uint)ReadInt(data, offset + 4);
+        }
+
+        /// <summary>
+        ///Feeds data to a new chunk demuxer in pieces of pieceSize bytes, passing what it doesn't consume again
+        ///with the next piece. Returns the demuxed messages, payloads copied to the values
+        ///</summary>
+        private static List<KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>> DemuxChunks(byte[] data, int pieceSize)
+        {
+            List<KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>> result = new List<KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>>();
+            RtmpProtocolParser.MCSSF_RTMP_MESSAGE[] messages = new RtmpProtocolParser.MCSSF_RTMP_MESSAGE[4];
+            List<byte> pending = new List<byte>();
+
+            int demuxerId = RtmpProtocolParser.MCSSF_CreateChunkDemuxer();
+            Assert.IsTrue(demuxerId >= 0);
+
+            try
+            {
+                for (int position = 0; position < data.Length; position += pieceSize)
+                {
+                    for (int i = position; i < data.Length && i < position + pieceSize; ++i)
+                    {
+                        pending.Add(data[i]);
+                    }
+
+                    while (pending.Count > 0)
+                    {
+                        byte[] input = pending.ToArray();
+                        int consumed = 0;
+                        int count = 0;
+                        GCHandle inputHandle = GCHandle.Alloc(input, GCHandleType.Pinned);
+                        try
+                        {
+                            count = RtmpProtocolParser.MCSSF_DemuxChunks(demuxerId, inputHandle.AddrOfPinnedObject(), input.Length, out consumed, messages, messages.Length);
+                            Assert.IsTrue(count >= 0);
+
+                            // payloads are valid till the next call only
+                            for (int i = 0; i < count; ++i)
+                            {
+                                byte[] payload = new byte[messages[i].nDataSize];
+                                Marshal.Copy(messages[i].pData, payload, 0, payload.Length);
+                                result.Add(new KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>(messages[i], payload));
+                            }
+                        }
+                        finally
+                        {
+                            inputHandle.Free();
+                        }
+
+                        pending.RemoveRange(0, consumed);
+                        if (count == 0 && consumed == 0)
+                        {
+                            // the rest is waiting for more data
+                            break;
+                        }
+                    }
+                }
+
+                Assert.AreEqual(0, pending.Count);
+                return result;
+            }
+            finally
+            {
+                Assert.AreEqual(1, RtmpProtocolParser.MCSSF_DestroyChunkDemuxer(demuxerId));
+            }
+        }
+
+        /// <summary>
+        ///Checks demuxed message, its payload is expected to be filled with one value
+        ///</summary>
+        private static void CheckMessage(KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]> message, int chunkStreamId, int messageStreamId, RtmpMessageType messageType, uint timestamp, int dataSize, byte fill)
+        {
+            Assert.AreEqual(chunkStreamId, message.Key.nChunkStreamId);
+            Assert.AreEqual(messageStreamId, message.Key.nMessageStreamId);
+            Assert.AreEqual((int)messageType, message.Key.nMessageType);
+            Assert.AreEqual(timestamp, message.Key.nTimestamp);
+            Assert.AreEqual(dataSize, message.Key.nDataSize);
+            Assert.AreEqual(dataSize, message.Value.Length);
+            for (int i = 0; i < dataSize; ++i)
+            {
+                Assert.AreEqual(fill, message.Value[i]);
+            }
+        }
+
+        private static void AddBytes(List<byte> data, byte value, int count)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                data.Add(value);
+            }
+        }
+
+        /// <summary>
+        ///Adds H.264 stream to a mux
+        ///</summary>
+        private static int AddVideoStream(int muxId, byte[] avcDecoderConfigurationRecord)
+        {
+            GCHandle config = GCHandle.Alloc(avcDecoderConfigurationRecord, GCHandleType.Pinned);
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG streamConfig = new SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG();
+                streamConfig.nStreamType = 2;
+                streamConfig.nBitrate = 1000000;
+                streamConfig.nConfigSize = avcDecoderConfigurationRecord.Length;
+                streamConfig.pConfig = config.AddrOfPinnedObject();
+                int streamId = SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig);
+                Assert.IsTrue(streamId >= 0);
+                return streamId;
+            }
+            finally
+            {
+                config.Free();
+            }
+        }
+
+        /// <summary>
+        ///Pushes one sample, its output is left in the stream's own buffer
+        ///</summary>
+        private static int PushSample(int muxId, int streamId, long time, bool keyFrame, byte[] data)
+        {
+            byte[] output;
+            return PushSample(muxId, streamId, time, keyFrame, data, out output);
+        }
+
+        /// <summary>
+        ///Pushes one sample, output is the fragment or chunk the sample has completed, null if none
+        ///</summary>
+        private static int PushSample(int muxId, int streamId, long time, bool keyFrame, byte[] data, out byte[] output)
+        {
+            GCHandle dataHandle = GCHandle.Alloc(data, GCHandleType.Pinned);
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_SAMPLE sample = new SmoothStreamingSegmenter.MCSSF_SAMPLE();
+                sample.nStartTime = time;
+                sample.bIsKeyFrame = keyFrame ? 1 : 0;
+                sample.nDataSize = data.Length;
+                sample.pData = dataHandle.AddrOfPinnedObject();
+
+                SmoothStreamingSegmenter.MCSSF_BUFFER buffer = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+                int result = SmoothStreamingSegmenter.MCSSF_PushSample(muxId, streamId, ref sample, ref buffer);
+                Assert.IsTrue(result >= 0);
+
+                output = null;
+                if (result > 0)
+                {
+                    output = new byte[buffer.nDataSize];
+                    Marshal.Copy(buffer.pData, output, 0, output.Length);
+                }
+
+                return result;
+            }
+            finally
+            {
+                dataHandle.Free();
+            }
+        }
+
+        /// <summary>
+        ///Sets fragment policy of a stream
+        ///</summary>
+        private static void SetFragmentPolicy(int muxId, int streamId, long duration, long maxDuration, bool alignToVideo, int chunkSamples)
+        {
+            SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY policy = new SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY();
+            policy.nDuration = duration;
+            policy.nMaxDuration = maxDuration;
+            policy.bAlignToVideo = alignToVideo ? 1 : 0;
+            policy.nChunkSamples = chunkSamples;
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_SetFragmentPolicy(muxId, streamId, ref policy));
+        }
+
+        /// <summary>
+        ///Gets HLS media playlist (sequence -1) or segment of a rendition
+        ///</summary>
+        private static byte[] GetHls(int muxId, int rendition, int sequence)
+        {
+            SmoothStreamingSegmenter.MCSSF_BUFFER output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            int result = sequence < 0 ? SmoothStreamingSegmenter.MCSSF_GetHlsPlaylist(muxId, rendition, ref output) : SmoothStreamingSegmenter.MCSSF_GetHlsSegment(muxId, rendition, sequence, ref output);
+            Assert.AreEqual(-2, result);
+
+            byte[] data = new byte[output.nDataSize];
+            GCHandle dataHandle = GCHandle.Alloc(data, GCHandleType.Pinned);
+            try
+            {
+                output.pData = dataHandle.AddrOfPinnedObject();
+                output.nCapacity = data.Length;
+                result = sequence < 0 ? SmoothStreamingSegmenter.MCSSF_GetHlsPlaylist(muxId, rendition, ref output) : SmoothStreamingSegmenter.MCSSF_GetHlsSegment(muxId, rendition, sequence, ref output);
+                Assert.AreEqual(1, result);
+                Assert.AreEqual(data.Length, output.nDataSize);
+                return data;
+            }
+            finally
+            {
+                dataHandle.Free();
+            }
+        }
+
+        /// <summary>
+        ///CRC-32 of MPEG-2 sections, 0 over a section including its CRC
+        ///</summary>
+        private static uint Crc32(byte[] data, int offset, int count)
+        {
+            uint crc = 0xFFFFFFFF;
+            for (int i = offset; i < offset + count; ++i)
+            {
+                crc ^= (uint)data[i] << 24;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc & 0x80000000) != 0 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+                }
+            }
+
+            return crc;
+        }
+
+        /// <summary>
+        ///Checks TS packets: sync byte, continuity counters (carried on in continuityCounters) and CRC of PAT and PMT.
+        ///Returns PES packets by PID
+        ///</summary>
+        private static Dictionary<int, List<byte[]>> ReadTransportStream(byte[] data, Dictionary<int, int> continuityCounters)
+        {
+            Assert.AreEqual(0, data.Length % 188);
+
+            Dictionary<int, List<List<byte>>> packets = new Dictionary<int, List<List<byte>>>();
+            for (int offset = 0; offset < data.Length; offset += 188)
+            {
+                Assert.AreEqual(0x47, data[offset]);
+                int pid = (data[offset + 1] & 0x1F) << 8 | data[offset + 2];
+                bool unitStart = (data[offset + 1] & 0x40) != 0;
+
+                int payload = offset + 4;
+                if ((data[offset + 3] & 0x20) != 0)
+                {
+                    payload += 1 + data[offset + 4];
+                }
+
+                Assert.IsTrue(payload <= offset + 188);
+                if ((data[offset + 3] & 0x10) == 0)
+                {
+                    // counter goes on with packets carrying payload only
+                    continue;
+                }
+
+                int counter = data[offset + 3] & 0x0F;
+                int lastCounter;
+                if (continuityCounters.TryGetValue(pid, out lastCounter))
+                {
+                    Assert.AreEqual((lastCounter + 1) & 0x0F, counter);
+                }
+
+                continuityCounters[pid] = counter;
+
+                if (pid == 0 || pid == 0x1000)
+                {
+                    // pointer field, then PAT or PMT section ending with its CRC
+                    Assert.IsTrue(unitStart);
+                    int section = payload + 1 + data[payload];
+                    int sectionLength = (data[section + 1] & 0x0F) << 8 | data[section + 2];
+                    Assert.AreEqual(0u, Crc32(data, section, 3 + sectionLength));
+                    continue;
+                }
+
+                if (unitStart)
+                {
+                    if (!packets.ContainsKey(pid))
+                    {
+                        packets[pid] = new List<List<byte>>();
+                    }
+
+                    packets[pid].Add(new List<byte>());
+                }
+
+                Assert.IsTrue(packets.ContainsKey(pid));
+                List<byte> packet = packets[pid][packets[pid].Count - 1];
+                for (int i = payload; i < offset + 188; ++i)
+                {
+                    packet.Add(data[i]);
+                }
+            }
+
+            Dictionary<int, List<byte[]>> result = new Dictionary<int, List<byte[]>>();
+            foreach (KeyValuePair<int, List<List<byte>>> pid in packets)
+            {
+                result[pid.Key] = new List<byte[]>();
+                foreach (List<byte> packet in pid.Value)
+                {
+                    result[pid.Key].Add(packet.ToArray());
+                }
+            }
+
+            return result;
+        }
+
+        /// <summary>
+        ///Returns payload of PES packet
+        ///</summary>
+        private static byte[] GetPesPayload(byte[] pes)
+        {
+            Assert.AreEqual(0, pes[0]);
+            Assert.AreEqual(0, pes[1]);
+            Assert.AreEqual(1, pes[2]);
+            int length = pes[4] << 8 | pes[5];
+            Assert.IsTrue(length == 0 || length == pes.Length - 6);
+
+            byte[] payload = new byte[pes.Length - 9 - pes[8]];
+            Array.Copy(pes, 9 + pes[8], payload, 0, payload.Length);
+            return payload;
+        }
+
+        /// <summary>
+        ///Returns types of NAL units of Annex B access unit, which has to start with a 4 bytes start code
+        ///</summary>
+        private static List<int> GetNalUnitTypes(byte[] accessUnit)
+        {
+            Assert.AreEqual(1, ReadInt(accessUnit, 0));
+
+            List<int> types = new List<int>();
+            for (int i = 0; i + 3 < accessUnit.Length; ++i)
+            {
+                if (accessUnit[i] == 0 && accessUnit[i + 1] == 0 && accessUnit[i + 2] == 1)
+                {
+                    types.Add(accessUnit[i + 3] & 0x1F);
+                }
+            }
+
+            return types;
+        }
+
+        /// <summary>
+        ///Checks moof + mdat of a fragment of 100 bytes samples
+        ///</summary>
+        private static void CheckFragment(byte[] fragment, int sequenceNumber, int sampleCount, long time, long duration)
+        {
+            int moof = FindChildBox(fragment, 0, fragment.Length, "moof");
+            Assert.AreEqual(0, moof);
+            int moofSize = ReadInt(fragment, moof);
+
+            int mfhd = FindChildBox(fragment, moof + 8, moofSize, "mfhd");
+            Assert.AreEqual(sequenceNumber, ReadInt(fragment, mfhd + 12));
+
+            int traf = FindChildBox(fragment, moof + 8, moofSize, "traf");
+            int trafEnd = traf + ReadInt(fragment, traf);
+            Assert.IsTrue(FindChildBox(fragment, traf + 8, trafEnd, "tfhd") > 0);
+
+            // data offset is relative to moof and points behind the mdat header
+            int trun = FindChildBox(fragment, traf + 8, trafEnd, "trun");
+            Assert.AreEqual(sampleCount, ReadInt(fragment, trun + 12));
+            Assert.AreEqual(moofSize + 8, ReadInt(fragment, trun + 16));
+
+            // tfxd: version 1 with absolute time and duration of the fragment
+            int tfxd = FindChildBox(fragment, traf + 8, trafEnd, "uuid");
+            Assert.AreEqual(0x6D1D9B05, ReadInt(fragment, tfxd + 8));
+            Assert.AreEqual(44, ReadInt(fragment, tfxd));
+            Assert.AreEqual(1, fragment[tfxd + 24]);
+            Assert.AreEqual(time, ReadLong(fragment, tfxd + 28));
+            Assert.AreEqual(duration, ReadLong(fragment, tfxd + 36));
+
+            int mdat = FindChildBox(fragment, moofSize, fragment.Length, "mdat");
+            Assert.AreEqual(moofSize, mdat);
+            Assert.AreEqual(8 + sampleCount * 100, ReadInt(fragment, mdat));
+            Assert.AreEqual(fragment.Length, mdat + ReadInt(fragment, mdat));
+        }
+
+        /// <summary>
+        ///A test for MCSSF_GetHeader, sample rate of the mp4a sample entry
+        ///</summary>
+        [TestMethod()]
+        public void GetHeaderAudioSampleRateTest()
+        {
+            // AAC LC 48 kHz stereo fits the 16.16 field
+            byte[] header = GetAudioHeader(48000, new byte[] { 0x11, 0x90 });
+            int mp4a = FindBox(header, "mp4a");
+            Assert.IsTrue(mp4a > 0);
+            Assert.AreEqual(48000 << 16, ReadInt(header, mp4a + 32));
+
+            // AAC LC 96 kHz stereo doesn't, the field is left 0 and the rate is taken from the esds
+            header = GetAudioHeader(96000, new byte[] { 0x10, 0x10 });
+            mp4a = FindBox(header, "mp4a");
+            Assert.IsTrue(mp4a > 0);
+            Assert.AreEqual(0, ReadInt(header, mp4a + 32));
+            Assert.AreEqual(2, header[mp4a + 25]);
+
+            int esds = FindBox(header, "esds");
+            Assert.IsTrue(esds > mp4a);
+            int esdsEnd = esds + ReadInt(header, esds);
+            // AudioSpecificConfig is followed by 3 bytes of SLConfigDescriptor
+            Assert.AreEqual(0x10, header[esdsEnd - 5]);
+            Assert.AreEqual(0x10, header[esdsEnd - 4]);
+        }
+
+        /// <summary>
+        ///A test for box layout of header, fragments and index of a stream
+        ///</summary>
+        [TestMethod()]
+        public void StreamLayoutTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            SmoothStreamingSegmenter.MCSSF_BUFFER output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            byte[] sampleData = new byte[100];
+            int[] streamIds = new int[60];
+            SmoothStreamingSegmenter.MCSSF_SAMPLE[] samples = new SmoothStreamingSegmenter.MCSSF_SAMPLE[60];
+            GCHandle sampleDataHandle = GCHandle.Alloc(sampleData, GCHandleType.Pinned);
+            GCHandle streamIdsHandle = GCHandle.Alloc(streamIds, GCHandleType.Pinned);
+            GCHandle samplesHandle = GCHandle.Alloc(samples, GCHandleType.Pinned);
+
+            try
+            {
+                int streamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+
+                SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY policy = new SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY();
+                policy.nDuration = 10000000;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_SetFragmentPolicy(muxId, streamId, ref policy));
+
+                // ftyp, manifest uuid and moov follow each other up to the end of the header
+                byte[] header = GetHeader(muxId, streamId);
+                Assert.AreEqual(0, FindChildBox(header, 0, header.Length, "ftyp"));
+                Assert.AreEqual(24, ReadInt(header, 0));
+                Assert.AreEqual("isml", Encoding.ASCII.GetString(header, 8, 4));
+                Assert.AreEqual(24, FindChildBox(header, 0, header.Length, "uuid"));
+                int moov = FindChildBox(header, 0, header.Length, "moov");
+                Assert.AreEqual(header.Length, moov + ReadInt(header, moov));
+                Assert.IsTrue(FindChildBox(header, moov + 8, header.Length, "mvhd") > moov);
+                Assert.IsTrue(FindChildBox(header, moov + 8, header.Length, "trak") > moov);
+                Assert.IsTrue(FindChildBox(header, moov + 8, header.Length, "mvex") > moov);
+
+                // 60 samples of 20 ms, the 51st one completes the first fragment of 1 s
+                for (int i = 0; i < samples.Length; ++i)
+                {
+                    streamIds[i] = streamId;
+                    samples[i].nStartTime = i * 200000L;
+                    samples[i].nStopTime = (i + 1) * 200000L;
+                    samples[i].bIsKeyFrame = 1;
+                    samples[i].nDataSize = sampleData.Length;
+                    samples[i].pData = sampleDataHandle.AddrOfPinnedObject();
+                }
+
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_AcquireBuffer(65536, ref output));
+                SmoothStreamingSegmenter.MCSSF_FRAGMENT[] fragments = new SmoothStreamingSegmenter.MCSSF_FRAGMENT[4];
+                int fragmentCount;
+                int pushed = SmoothStreamingSegmenter.MCSSF_PushSamples(
+                    muxId,
+                    streamIdsHandle.AddrOfPinnedObject(),
+                    samplesHandle.AddrOfPinnedObject(),
+                    samples.Length,
+                    ref output,
+                    fragments,
+                    fragments.Length,
+                    out fragmentCount);
+
+                Assert.AreEqual(samples.Length, pushed);
+                Assert.AreEqual(1, fragmentCount);
+                Assert.AreEqual(50, fragments[0].nSampleIndex);
+                byte[] fragment1 = new byte[fragments[0].nDataSize];
+                Marshal.Copy(IntPtr.Add(output.pData, fragments[0].nOffset), fragment1, 0, fragment1.Length);
+                CheckFragment(fragment1, 1, 50, 0, 10000000);
+
+                // the rest of the samples is completed at the end of the stream
+                output.nDataSize = 0;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_EndStream(muxId, streamId, 12000000, ref output));
+                byte[] fragment2 = new byte[output.nDataSize];
+                Marshal.Copy(output.pData, fragment2, 0, fragment2.Length);
+                CheckFragment(fragment2, 2, 10, 10000000, 2000000);
+
+                // mfra: tfra entries point to the moof boxes in the file, mfro closes it with the mfra size
+                int dataSize = 0;
+                IntPtr data = IntPtr.Zero;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_GetIndex(muxId, streamId, ref dataSize, ref data));
+                byte[] index = new byte[dataSize];
+                Marshal.Copy(data, index, 0, dataSize);
+
+                Assert.AreEqual(0, FindChildBox(index, 0, index.Length, "mfra"));
+                Assert.AreEqual(index.Length, ReadInt(index, 0));
+                int tfra = FindChildBox(index, 8, index.Length, "tfra");
+                Assert.AreEqual(1, index[tfra + 8]);
+                Assert.AreEqual(streamId + 1, ReadInt(index, tfra + 12));
+                Assert.AreEqual(2, ReadInt(index, tfra + 20));
+                Assert.AreEqual(0, ReadLong(index, tfra + 24));
+                Assert.AreEqual(header.Length, ReadLong(index, tfra + 32));
+                Assert.AreEqual(10000000, ReadLong(index, tfra + 43));
+                Assert.AreEqual(header.Length + fragment1.Length, ReadLong(index, tfra + 51));
+
+                int mfro = FindChildBox(index, 8, index.Length, "mfro");
+                Assert.AreEqual(index.Length - 16, mfro);
+                Assert.AreEqual(index.Length, ReadInt(index, mfro + 12));
+            }
+            finally
+            {
+                if (output.pData != IntPtr.Zero)
+                {
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref output);
+                }
+
+                samplesHandle.Free();
+                streamIdsHandle.Free();
+                sampleDataHandle.Free();
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for MCSSF_PushSamples with borrowed samples
+        ///</summary>
+        [TestMethod()]
+        public void PushSamplesBorrowedTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            SmoothStreamingSegmenter.MCSSF_BUFFER output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            byte[] sampleData = new byte[60 * 100];
+            int[] releases = new int[60];
+            int[] streamIds = new int[60];
+            SmoothStreamingSegmenter.MCSSF_SAMPLE[] samples = new SmoothStreamingSegmenter.MCSSF_SAMPLE[60];
+            ReleaseCallback release = delegate(IntPtr context) { ++releases[context.ToInt32()]; };
+            GCHandle sampleDataHandle = GCHandle.Alloc(sampleData, GCHandleType.Pinned);
+            GCHandle streamIdsHandle = GCHandle.Alloc(streamIds, GCHandleType.Pinned);
+            GCHandle samplesHandle = GCHandle.Alloc(samples, GCHandleType.Pinned);
+
+            try
+            {
+                int streamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+
+                SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY policy = new SmoothStreamingSegmenter.MCSSF_FRAGMENT_POLICY();
+                policy.nDuration = 10000000;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_SetFragmentPolicy(muxId, streamId, ref policy));
+
+                // every sample is filled with its index, so the mdat shows where the payload was taken from
+                for (int i = 0; i < samples.Length; ++i)
+                {
+                    for (int j = 0; j < 100; ++j)
+                    {
+                        sampleData[i * 100 + j] = (byte)i;
+                    }
+
+                    streamIds[i] = streamId;
+                    samples[i].nStartTime = i * 200000L;
+                    samples[i].nStopTime = (i + 1) * 200000L;
+                    samples[i].bIsKeyFrame = 1;
+                    samples[i].nDataSize = 100;
+                    samples[i].pData = IntPtr.Add(sampleDataHandle.AddrOfPinnedObject(), i * 100);
+                    samples[i].pfnRelease = Marshal.GetFunctionPointerForDelegate(release);
+                    samples[i].pvReleaseContext = new IntPtr(i);
+                }
+
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_AcquireBuffer(65536, ref output));
+                SmoothStreamingSegmenter.MCSSF_FRAGMENT[] fragments = new SmoothStreamingSegmenter.MCSSF_FRAGMENT[4];
+                int fragmentCount;
+
+                // the first 50 samples don't complete a fragment, the muxer keeps referencing them
+                int pushed = SmoothStreamingSegmenter.MCSSF_PushSamples(
+                    muxId,
+                    streamIdsHandle.AddrOfPinnedObject(),
+                    samplesHandle.AddrOfPinnedObject(),
+                    50,
+                    ref output,
+                    fragments,
+                    fragments.Length,
+                    out fragmentCount);
+
+                Assert.AreEqual(50, pushed);
+                Assert.AreEqual(0, fragmentCount);
+                for (int i = 0; i < samples.Length; ++i)
+                {
+                    Assert.AreEqual(0, releases[i]);
+                }
+
+                // the 51st one completes the fragment, its samples are released once it has been written
+                output.nDataSize = 0;
+                pushed = SmoothStreamingSegmenter.MCSSF_PushSamples(
+                    muxId,
+                    Marshal.UnsafeAddrOfPinnedArrayElement(streamIds, 50),
+                    Marshal.UnsafeAddrOfPinnedArrayElement(samples, 50),
+                    10,
+                    ref output,
+                    fragments,
+                    fragments.Length,
+                    out fragmentCount);
+
+                Assert.AreEqual(10, pushed);
+                Assert.AreEqual(1, fragmentCount);
+                Assert.AreEqual(0, fragments[0].nSampleIndex);
+                byte[] fragment = new byte[fragments[0].nDataSize];
+                Marshal.Copy(IntPtr.Add(output.pData, fragments[0].nOffset), fragment, 0, fragment.Length);
+                CheckFragment(fragment, 1, 50, 0, 10000000);
+
+                int payload = fragment.Length - 50 * 100;
+                for (int i = 0; i < samples.Length; ++i)
+                {
+                    Assert.AreEqual(i < 50 ? 1 : 0, releases[i]);
+                    if (i < 50)
+                    {
+                        Assert.AreEqual((byte)i, fragment[payload + i * 100]);
+                        Assert.AreEqual((byte)i, fragment[payload + i * 100 + 99]);
+                    }
+                }
+
+                // samples of the fragment in progress are released when the mux goes away
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId));
+                for (int i = 0; i < samples.Length; ++i)
+                {
+                    Assert.AreEqual(1, releases[i]);
+                }
+            }
+            finally
+            {
+                if (output.pData != IntPtr.Zero)
+                {
+                    SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref output);
+                }
+
+                // does nothing if the mux has been uninitialized already
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+                samplesHandle.Free();
+                streamIdsHandle.Free();
+                sampleDataHandle.Free();
+                GC.KeepAlive(release);
+            }
+        }
+
+        /// <summary>
+        ///A test for MCSSF_DemuxChunks, same input as RtmpChunkStreamTest.DecodeTest
+        ///</summary>
+        [TestMethod()]
+        public void DemuxChunksTest()
+        {
+            // video message divided into 2 chunks
+            byte[] data = new byte[160 + 12 + 1];
+            new byte[]
+            {
+                0x04,0x00,0x00,0xFF,0x00,0x00,0xA0,0x09,0x01,0x00,0x00,0x00,0x17,0x01,
+            }.CopyTo(data, 0);
+            data[128 + 12] = 0xC4;
+
+            foreach (int pieceSize in new int[] { data.Length, 1 })
+            {
+                List<KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>> messages = DemuxChunks(data, pieceSize);
+                Assert.AreEqual(1, messages.Count);
+
+                RtmpProtocolParser.MCSSF_RTMP_MESSAGE actual = messages[0].Key;
+                Assert.AreEqual(4, actual.nChunkStreamId);
+                Assert.AreEqual(1, actual.nMessageStreamId);
+                Assert.AreEqual((int)RtmpMessageType.Video, actual.nMessageType);
+                Assert.AreEqual(255u, actual.nTimestamp);
+                Assert.AreEqual(160, actual.nDataSize);
+
+                // AVC keyframe, the second chunk header isn't part of the payload
+                Assert.AreEqual(0x17, messages[0].Value[0]);
+                Assert.AreEqual(0x01, messages[0].Value[1]);
+                Assert.AreEqual(0x00, messages[0].Value[128]);
+            }
+        }
+
+        /// <summary>
+        ///A test for MCSSF_DemuxChunks, all chunk header types, extended timestamp, Set Chunk Size and Abort
+        ///</summary>
+        [TestMethod()]
+        public void DemuxChunksSequenceTest()
+        {
+            List<byte> data = new List<byte>();
+
+            // type 0: chunk stream 4, timestamp 1000, 10 bytes of audio, message stream 1
+            data.AddRange(new byte[] { 0x04, 0x00, 0x03, 0xE8, 0x00, 0x00, 0x0A, 0x08, 0x01, 0x00, 0x00, 0x00 });
+            AddBytes(data, 0xA1, 10);
+
+            // type 2: timestamp delta 20
+            data.AddRange(new byte[] { 0x84, 0x00, 0x00, 0x14 });
+            AddBytes(data, 0xA2, 10);
+
+            // type 3: the same delta again
+            data.Add(0xC4);
+            AddBytes(data, 0xA3, 10);
+
+            // type 0 with extended timestamp: chunk stream 6, 200 bytes of video in 2 chunks,
+            // the continuation chunk repeats the extended timestamp
+            data.AddRange(new byte[] { 0x06, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0xC8, 0x09, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00 });
+            AddBytes(data, 0xB1, 128);
+            data.AddRange(new byte[] { 0xC6, 0x01, 0x00, 0x00, 0x00 });
+            AddBytes(data, 0xB1, 72);
+
+            // type 1: timestamp delta 40, 5 bytes of video
+            data.AddRange(new byte[] { 0x46, 0x00, 0x00, 0x28, 0x00, 0x00, 0x05, 0x09 });
+            AddBytes(data, 0xB2, 5);
+
+            // Set Chunk Size 256
+            data.AddRange(new byte[] { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 });
+
+            // type 1: timestamp delta 10, 200 bytes of audio fit one chunk now
+            data.AddRange(new byte[] { 0x44, 0x00, 0x00, 0x0A, 0x00, 0x00, 0xC8, 0x08 });
+            AddBytes(data, 0xA4, 200);
+
+            // first chunk of 300 bytes of video on chunk stream 5, aborted afterwards
+            data.AddRange(new byte[] { 0x05, 0x00, 0x07, 0xD0, 0x00, 0x01, 0x2C, 0x09, 0x01, 0x00, 0x00, 0x00 });
+            AddBytes(data, 0xC1, 256);
+            data.AddRange(new byte[] { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05 });
+
+            // new message on the aborted chunk stream
+            data.AddRange(new byte[] { 0x05, 0x00, 0x07, 0xD0, 0x00, 0x00, 0x03, 0x09, 0x01, 0x00, 0x00, 0x00 });
+            AddBytes(data, 0xC2, 3);
+
+            foreach (int pieceSize in new int[] { data.Count, 7, 1 })
+            {
+                List<KeyValuePair<RtmpProtocolParser.MCSSF_RTMP_MESSAGE, byte[]>> messages = DemuxChunks(data.ToArray(), pieceSize);
+                Assert.AreEqual(9, messages.Count);
+
+                CheckMessage(messages[0], 4, 1, RtmpMessageType.Audio, 1000, 10, 0xA1);
+                CheckMessage(messages[1], 4, 1, RtmpMessageType.Audio, 1020, 10, 0xA2);
+                CheckMessage(messages[2], 4, 1, RtmpMessageType.Audio, 1040, 10, 0xA3);
+                CheckMessage(messages[3], 6, 1, RtmpMessageType.Video, 0x01000000, 200, 0xB1);
+                CheckMessage(messages[4], 6, 1, RtmpMessageType.Video, 0x01000028, 5, 0xB2);
+
+                Assert.AreEqual((int)RtmpMessageType.SetChunkSize, messages[5].Key.nMessageType);
+                Assert.AreEqual(2, messages[5].Key.nChunkStreamId);
+                Assert.AreEqual(256, ReadInt(messages[5].Value, 0));
+
+                CheckMessage(messages[6], 4, 1, RtmpMessageType.Audio, 1050, 200, 0xA4);
+
+                Assert.AreEqual((int)RtmpMessageType.Abort, messages[7].Key.nMessageType);
+                Assert.AreEqual(5, ReadInt(messages[7].Value, 0));
+
+                CheckMessage(messages[8], 5, 1, RtmpMessageType.Video, 2000, 3, 0xC2);
+            }
+        }
+
+        /// <summary>
+        ///A test for HLS output: transport stream packets, playlist and discontinuity after the writer is reset
+        ///</summary>
+        [TestMethod()]
+        public void HlsOutputTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_HLS_POLICY policy = new SmoothStreamingSegmenter.MCSSF_HLS_POLICY();
+                policy.nSegmentDuration = 40000000;
+                policy.nPlaylistLength = 3;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_EnableHlsOutput(muxId, ref policy));
+
+                int videoStreamId = AddVideoStream(muxId, MCommsSSFSDKTest.avcDecoderConfigurationRecord);
+                int audioStreamId = -1;
+                long audioTime = 0;
+
+                // one NAL unit of 996 bytes per frame, prefixed with its length
+                byte[] keyFrame = new byte[1000];
+                byte[] frame = new byte[1000];
+                for (int i = 4; i < frame.Length; ++i)
+                {
+                    keyFrame[i] = 0xAA;
+                    frame[i] = 0xAA;
+                }
+
+                keyFrame[2] = frame[2] = 0x03;
+                keyFrame[3] = frame[3] = 0xE4;
+                keyFrame[4] = 0x65;
+                frame[4] = 0x41;
+
+                byte[] audioFrame = new byte[250];
+
+                // 30 fps with keyframe every 2 s, segments of 4 s are completed at frames 120, 300 and 420.
+                // Audio registered at frame 150 resets the writer of the video rendition, its segment
+                // in progress is dropped and the next one starts at frame 180 with a discontinuity
+                for (int i = 0; i <= 420; ++i)
+                {
+                    long time = i * 333334L;
+                    PushSample(muxId, videoStreamId, time, i % 60 == 0, i % 60 == 0 ? keyFrame : frame);
+
+                    if (i == 150)
+                    {
+                        audioStreamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+                        audioTime = time;
+                    }
+
+                    for (; audioStreamId >= 0 && audioTime <= time; audioTime += 213333)
+                    {
+                        PushSample(muxId, audioStreamId, audioTime, true, audioFrame);
+                    }
+                }
+
+                string playlist = Encoding.ASCII.GetString(GetHls(muxId, 0, -1));
+                Assert.AreEqual(
+                    "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:4\n#EXT-X-MEDIA-SEQUENCE:0\n" +
+                    "#EXTINF:4.000,\n0-0.ts\n" +
+                    "#EXT-X-DISCONTINUITY\n#EXTINF:4.000,\n0-1.ts\n" +
+                    "#EXTINF:4.000,\n0-2.ts\n",
+                    playlist);
+
+                // video only before the reset
+                Dictionary<int, List<byte[]>> pes = ReadTransportStream(GetHls(muxId, 0, 0), new Dictionary<int, int>());
+                Assert.AreEqual(1, pes.Count);
+                Assert.AreEqual(120, pes[0x100].Count);
+
+                // continuity counters of the new writer carry on from segment to segment
+                Dictionary<int, int> continuityCounters = new Dictionary<int, int>();
+                for (int sequence = 1; sequence <= 2; ++sequence)
+                {
+                    pes = ReadTransportStream(GetHls(muxId, 0, sequence), continuityCounters);
+                    Assert.AreEqual(2, pes.Count);
+
+                    // access unit delimiter, SPS and PPS precede every IDR picture
+                    Assert.AreEqual(120, pes[0x100].Count);
+                    for (int i = 0; i < pes[0x100].Count; ++i)
+                    {
+                        byte[] accessUnit = GetPesPayload(pes[0x100][i]);
+                        List<int> types = GetNalUnitTypes(accessUnit);
+                        if (i % 60 == 0)
+                        {
+                            CollectionAssert.AreEqual(new int[] { 9, 7, 8, 5 }, types.ToArray());
+                        }
+                        else
+                        {
+                            CollectionAssert.AreEqual(new int[] { 9, 1 }, types.ToArray());
+                        }
+
+                        Assert.AreEqual(0xAA, accessUnit[accessUnit.Length - 1]);
+                        Assert.AreEqual(1, ReadInt(accessUnit, accessUnit.Length - 996 - 4));
+                    }
+
+                    // ADTS header of AAC LC, frame length includes the header
+                    Assert.IsTrue(pes[0x101].Count > 0);
+                    foreach (byte[] audioPes in pes[0x101])
+                    {
+                        byte[] adts = GetPesPayload(audioPes);
+                        Assert.AreEqual(7 + audioFrame.Length, adts.Length);
+                        Assert.AreEqual(0xFF, adts[0]);
+                        Assert.AreEqual(0xF0, adts[1] & 0xF6);
+                        Assert.AreEqual(adts.Length, (adts[3] & 0x03) << 11 | adts[4] << 3 | adts[5] >> 5);
+                    }
+                }
+            }
+            finally
+            {
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for fragment policy: max duration cuts on a non-keyframe
+        ///</summary>
+        [TestMethod()]
+        public void FragmentPolicyMaxDurationTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            try
+            {
+                int streamId = AddVideoStream(muxId, MCommsSSFSDKTest.avcDecoderConfigurationRecord);
+                SetFragmentPolicy(muxId, streamId, 20000000, 30000000, false, 0);
+
+                // 30 fps with a single keyframe, the frame reaching 3 s completes the fragment
+                byte[] frame = new byte[100];
+                for (int i = 0; i < 100; ++i)
+                {
+                    byte[] fragment;
+                    int result = PushSample(muxId, streamId, i * 333334L, i == 0, frame, out fragment);
+                    if (i == 90)
+                    {
+                        Assert.AreEqual(1, result);
+                        CheckFragment(fragment, 1, 90, 0, 90 * 333334L);
+                    }
+                    else
+                    {
+                        Assert.AreEqual(0, result);
+                    }
+                }
+            }
+            finally
+            {
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for fragment policy: aligned audio is cut together with the video
+        ///</summary>
+        [TestMethod()]
+        public void FragmentPolicyAlignToVideoTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            try
+            {
+                int videoStreamId = AddVideoStream(muxId, MCommsSSFSDKTest.avcDecoderConfigurationRecord);
+                int audioStreamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+                SetFragmentPolicy(muxId, videoStreamId, 20000000, 0, false, 0);
+                SetFragmentPolicy(muxId, audioStreamId, 50000000, 0, true, 0);
+
+                // 30 fps video with keyframe every 2 s, cut at frames 60, 120 and 180;
+                // audio frames of 21.3 ms pushed up to the time of the latest video frame
+                byte[] sample = new byte[100];
+                List<long> videoCuts = new List<long>();
+                List<long> audioCuts = new List<long>();
+                long audioTime = 0;
+                for (int i = 0; i <= 200; ++i)
+                {
+                    long time = i * 333334L;
+                    if (PushSample(muxId, videoStreamId, time, i % 60 == 0, sample) == 1)
+                    {
+                        videoCuts.Add(time);
+                    }
+
+                    for (; audioTime <= time; audioTime += 213333)
+                    {
+                        byte[] fragment;
+                        if (PushSample(muxId, audioStreamId, audioTime, true, sample, out fragment) == 1)
+                        {
+                            // fragment ends where the video one does, i.e. at the first audio frame from then on
+                            long start = audioCuts.Count > 0 ? audioCuts[audioCuts.Count - 1] : 0;
+                            CheckFragment(fragment, audioCuts.Count + 1, (int)((audioTime - start) / 213333), start, audioTime - start);
+                            audioCuts.Add(audioTime);
+                        }
+                    }
+                }
+
+                CollectionAssert.AreEqual(new long[] { 60 * 333334L, 120 * 333334L, 180 * 333334L }, videoCuts.ToArray());
+                Assert.AreEqual(videoCuts.Count, audioCuts.Count);
+                for (int i = 0; i < videoCuts.Count; ++i)
+                {
+                    Assert.IsTrue(audioCuts[i] >= videoCuts[i]);
+                    Assert.IsTrue(audioCuts[i] - 213333 < videoCuts[i]);
+                }
+            }
+            finally
+            {
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for chunked output: chunks until the fragment closes, one index entry per fragment
+        ///</summary>
+        [TestMethod()]
+        public void ChunkedOutputTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            try
+            {
+                int streamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+                SetFragmentPolicy(muxId, streamId, 10000000, 0, false, 10);
+                byte[] header = GetHeader(muxId, streamId);
+
+                // 60 samples of 20 ms, every 10 samples make a chunk, the 51st sample closes the fragment of 1 s
+                byte[] sample = new byte[100];
+                long fragmentSize = 0;
+                for (int i = 0; i < 60; ++i)
+                {
+                    byte[] chunk;
+                    int result = PushSample(muxId, streamId, i * 200000L, true, sample, out chunk);
+                    if (i > 0 && i <= 50 && i % 10 == 0)
+                    {
+                        Assert.AreEqual(i == 50 ? 1 : 2, result);
+                        CheckFragment(chunk, i / 10, 10, (i - 10) * 200000L, 2000000);
+                        fragmentSize += chunk.Length;
+                    }
+                    else
+                    {
+                        Assert.AreEqual(0, result);
+                    }
+                }
+
+                SmoothStreamingSegmenter.MCSSF_BUFFER output = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_EndStream(muxId, streamId, 12000000, ref output));
+                byte[] fragment2 = new byte[output.nDataSize];
+                Marshal.Copy(output.pData, fragment2, 0, fragment2.Length);
+                CheckFragment(fragment2, 6, 10, 10000000, 2000000);
+
+                // tfra lists the fragments, each pointing to the moof of its first chunk
+                int dataSize = 0;
+                IntPtr data = IntPtr.Zero;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_GetIndex(muxId, streamId, ref dataSize, ref data));
+                byte[] index = new byte[dataSize];
+                Marshal.Copy(data, index, 0, dataSize);
+
+                int tfra = FindChildBox(index, 8, index.Length, "tfra");
+                Assert.AreEqual(2, ReadInt(index, tfra + 20));
+                Assert.AreEqual(0, ReadLong(index, tfra + 24));
+                Assert.AreEqual(header.Length, ReadLong(index, tfra + 32));
+                Assert.AreEqual(10000000, ReadLong(index, tfra + 43));
+                Assert.AreEqual(header.Length + fragmentSize, ReadLong(index, tfra + 51));
+            }
+            finally
+            {
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for mux ids: a stale id doesn't reach the mux created later in the same slot
+        ///</summary>
+        [TestMethod()]
+        public void StaleMuxIdTest()
+        {
+            int staleMuxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            Assert.IsTrue(staleMuxId >= 0);
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_Uninitialize(staleMuxId));
+
+            // slots are handed out in turn, cycle through the table until the slot comes round again
+            int muxId = -1;
+            for (int i = 0; i < 0x10000 && muxId < 0; ++i)
+            {
+                int id = SmoothStreamingSegmenter.MCSSF_Initialize();
+                if ((id & 0xFFF) == (staleMuxId & 0xFFF))
+                {
+                    muxId = id;
+                }
+                else
+                {
+                    Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_Uninitialize(id));
+                }
+            }
+
+            try
+            {
+                Assert.IsTrue(muxId >= 0);
+                Assert.IsTrue(muxId != staleMuxId);
+                int streamId = AddAudioStream(muxId, 48000, new byte[] { 0x11, 0x90 });
+
+                byte[] asc = new byte[] { 0x11, 0x90 };
+                GCHandle ascHandle = GCHandle.Alloc(asc, GCHandleType.Pinned);
+                try
+                {
+                    SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG streamConfig = new SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG();
+                    streamConfig.nStreamType = 1;
+                    streamConfig.nConfigSize = asc.Length;
+                    streamConfig.pConfig = ascHandle.AddrOfPinnedObject();
+                    Assert.AreEqual(-1, SmoothStreamingSegmenter.MCSSF_AddStreamConfig(staleMuxId, ref streamConfig));
+                }
+                finally
+                {
+                    ascHandle.Free();
+                }
+
+                int dataSize = 0;
+                IntPtr data = IntPtr.Zero;
+                Assert.AreEqual(-1, SmoothStreamingSegmenter.MCSSF_GetHeader(staleMuxId, streamId, ref dataSize, ref data));
+                Assert.AreEqual(0, SmoothStreamingSegmenter.MCSSF_Uninitialize(staleMuxId));
+
+                // the mux in the slot is untouched
+                GetHeader(muxId, streamId);
+            }
+            finally
+            {
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId));
+            }
+        }
+
+        /// <summary>
+        ///A test for stream ids: streams which fail to be added leave no hole in the ids
+        ///</summary>
+        [TestMethod()]
+        public void AddStreamFailureTest()
+        {
+            int muxId = SmoothStreamingSegmenter.MCSSF_Initialize();
+            byte[] asc = new byte[] { 0x11, 0x90 };
+            GCHandle ascHandle = GCHandle.Alloc(asc, GCHandleType.Pinned);
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG streamConfig = new SmoothStreamingSegmenter.MCSSF_STREAM_CONFIG();
+                streamConfig.nStreamType = 1;
+                streamConfig.nChannels = 2;
+                streamConfig.nSampleRate = 48000;
+                streamConfig.pConfig = ascHandle.AddrOfPinnedObject();
+
+                // a mux holds 64 streams, each one added after an invalid and a malformed one
+                for (int i = 0; i < 64; ++i)
+                {
+                    streamConfig.nStreamType = 3;
+                    streamConfig.nConfigSize = asc.Length;
+                    Assert.AreEqual(-2, SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig));
+
+                    streamConfig.nStreamType = 1;
+                    streamConfig.nConfigSize = 1;
+                    Assert.AreEqual(-3, SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig));
+
+                    streamConfig.nConfigSize = asc.Length;
+                    Assert.AreEqual(i, SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig));
+                }
+
+                Assert.IsTrue(SmoothStreamingSegmenter.MCSSF_AddStreamConfig(muxId, ref streamConfig) < 0);
+            }
+            finally
+            {
+                ascHandle.Free();
+                SmoothStreamingSegmenter.MCSSF_Uninitialize(muxId);
+            }
+        }
+
+        /// <summary>
+        ///A test for MCSSF_ReleaseBuffer: only buffers taken from the pool are released, and only once
+        ///</summary>
+        [TestMethod()]
+        public void ReleaseBufferTest()
+        {
+            byte[] foreign = new byte[4096];
+            GCHandle foreignHandle = GCHandle.Alloc(foreign, GCHandleType.Pinned);
+            try
+            {
+                SmoothStreamingSegmenter.MCSSF_BUFFER buffer = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_AcquireBuffer(1000, ref buffer));
+                Assert.IsTrue(buffer.nCapacity >= 1000);
+
+                // memory the pool doesn't own, and a pointer into one of its buffers
+                SmoothStreamingSegmenter.MCSSF_BUFFER other = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+                other.pData = IntPtr.Add(foreignHandle.AddrOfPinnedObject(), 2048);
+                other.nCapacity = 1000;
+                Assert.IsTrue(SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref other) < 0);
+                other.pData = IntPtr.Add(buffer.pData, 16);
+                Assert.IsTrue(SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref other) < 0);
+
+                other = buffer;
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer));
+                Assert.AreEqual(IntPtr.Zero, buffer.pData);
+                Assert.IsTrue(SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref other) < 0);
+                Assert.IsTrue(SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer) < 0);
+            }
+            finally
+            {
+                foreignHandle.Free();
+            }
+        }
+
+        /// <summary>
+        ///A test for MCSSF_GetBufferPoolStats: reusing a size class allocates nothing new
+        ///</summary>
+        [TestMethod()]
+        public void BufferPoolStatsTest()
+        {
+            SmoothStreamingSegmenter.MCSSF_BUFFER buffer = new SmoothStreamingSegmenter.MCSSF_BUFFER();
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_AcquireBuffer(100000, ref buffer));
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer));
+
+            SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS before;
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_GetBufferPoolStats(out before));
+
+            for (int i = 0; i < 100; ++i)
+            {
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_AcquireBuffer(100000 - i, ref buffer));
+                Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_ReleaseBuffer(ref buffer));
+            }
+
+            SmoothStreamingSegmenter.MCSSF_BUFFER_POOL_STATS after;
+            Assert.AreEqual(1, SmoothStreamingSegmenter.MCSSF_GetBufferPoolStats(out after));
+
+            Assert.AreEqual(before.nAcquireCount + 100, after.nAcquireCount);
+            Assert.AreEqual(before.nAllocationCount, after.nAllocationCount);
+            Assert.AreEqual(before.nBytesAllocated, after.nBytesAllocated);
+            Assert.AreEqual(before.nBytesInUse, after.nBytesInUse);
+            Assert.AreEqual(before.nBuffersAllocated, after.nBuffersAllocated);
+            Assert.AreEqual(before.nBuffersInUse, after.nBuffersInUse);
+            Assert.AreEqual(before.nHighWaterBytesAllocated, after.nHighWaterBytesAllocated);
+            Assert.AreEqual(before.nHighWaterBytesInUse, after.nHighWaterBytesInUse);
+            Assert.AreEqual(before.nHighWaterBuffersAllocated, after.nHighWaterBuffersAllocated);
+            Assert.AreEqual(before.nHighWaterBuffersInUse, after.nHighWaterBuffersInUse);
+        }
+    }
+}
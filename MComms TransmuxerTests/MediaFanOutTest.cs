@@ -0,0 +1,287 @@
+﻿using MComms_Transmuxer;
+using MComms_Transmuxer.Common;
+using MComms_Transmuxer.Output;
+using MComms_Transmuxer.RTMP;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for MediaFanOutTest and is intended
+    ///to contain all MediaFanOutTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class MediaFanOutTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///Sink recording calls made by its worker, can be blocked or made to fail
+        ///</summary>
+        private class RecordingSink : IMediaSink
+        {
+            public List<string> Calls = new List<string>();
+            public ManualResetEvent Gate = new ManualResetEvent(true);
+            public bool Fail = false;
+            public bool Disposed = false;
+
+            public void RegisterStream(MediaType mediaType)
+            {
+                if (this.Fail)
+                {
+                    throw new InvalidOperationException("register failed");
+                }
+
+                this.Calls.Add("register " + mediaType.ContentType);
+            }
+
+            public void PushSample(MediaSample sample)
+            {
+                this.Gate.WaitOne();
+                this.Calls.Add(string.Format("{0} {1}", sample.ContentType, sample.Timestamp));
+            }
+
+            public void AdjustAbsoluteTime(long gap)
+            {
+                this.Calls.Add("adjust " + gap);
+            }
+
+            public void Flush()
+            {
+            }
+
+            public void Dispose()
+            {
+                this.Disposed = true;
+            }
+        }
+
+        private static MediaSample CreateSample(PacketBuffer buffer, MediaContentType contentType, long timestamp, bool keyFrame)
+        {
+            return new MediaSample
+            {
+                ContentType = contentType,
+                PacketType = RtmpMediaPacketType.Media,
+                Timestamp = timestamp,
+                KeyFrame = keyFrame,
+                MediaData = buffer,
+                MediaDataOffset = 0
+            };
+        }
+
+        /// <summary>
+        ///A test for PushSample
+        ///</summary>
+        [TestMethod()]
+        public void PushSampleTest()
+        {
+            PacketBufferAllocator allocator = new PacketBufferAllocator(Global.TransportBufferSize, 1);
+            PacketBuffer buffer = allocator.LockBuffer();
+            buffer.ActualBufferSize = 16;
+
+            RecordingSink first = new RecordingSink();
+            RecordingSink second = new RecordingSink();
+
+            MediaFanOut target = new MediaFanOut(16);
+            target.AddSink("first", first);
+            target.RegisterStream(new MediaType { ContentType = MediaContentType.Video });
+            target.AddSink("second", second);
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 10, true));
+            target.AdjustAbsoluteTime(5);
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 20, false));
+            target.Dispose();
+
+            string[] expected = new string[] { "register Video", "Video 10", "adjust 5", "Video 20" };
+            CollectionAssert.AreEqual(expected, first.Calls);
+            CollectionAssert.AreEqual(expected, second.Calls);
+            Assert.IsTrue(first.Disposed);
+            Assert.IsTrue(second.Disposed);
+
+            // every queue has released its reference
+            Assert.AreEqual(0, buffer.Release());
+            Assert.AreEqual(1, allocator.FreeBufferCount);
+        }
+
+        /// <summary>
+        ///A test for PushSample when the queue of a sink is full
+        ///</summary>
+        [TestMethod()]
+        public void PushSampleQueueFullTest()
+        {
+            PacketBufferAllocator allocator = new PacketBufferAllocator(Global.TransportBufferSize, 1);
+            PacketBuffer buffer = allocator.LockBuffer();
+            buffer.ActualBufferSize = 16;
+
+            RecordingSink slow = new RecordingSink();
+            slow.Gate.Reset();
+
+            MediaFanOut target = new MediaFanOut(2);
+            target.AddSink("slow", slow);
+
+            // slow sink is stuck in the first sample, two more fit its queue
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 10, true));
+            Thread.Sleep(200);
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 20, false));
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 30, false));
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 40, false));
+            target.PushSample(CreateSample(buffer, MediaContentType.Audio, 45, true));
+            slow.Gate.Set();
+            Thread.Sleep(200);
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 50, false));
+            target.PushSample(CreateSample(buffer, MediaContentType.Video, 60, true));
+            target.PushSample(CreateSample(buffer, MediaContentType.Audio, 65, true));
+            target.Dispose();
+
+            // video resumes with the next key frame, audio as soon as there is room
+            CollectionAssert.AreEqual(new string[] { "Video 10", "Video 20", "Video 30", "Video 60", "Audio 65" }, slow.Calls);
+            Assert.AreEqual(0, buffer.Release());
+        }
+
+        /// <summary>
+        ///A test for PushSample of lossless fan-out when the queue of a sink is full
+        ///</summary>
+        [TestMethod()]
+        public void PushSampleLosslessTest()
+        {
+            PacketBufferAllocator allocator = new PacketBufferAllocator(Global.TransportBufferSize, 1);
+            PacketBuffer buffer = allocator.LockBuffer();
+            buffer.ActualBufferSize = 16;
+
+            RecordingSink slow = new RecordingSink();
+            slow.Gate.Reset();
+
+            MediaFanOut target = new MediaFanOut(2, null, true);
+            target.AddSink("slow", slow);
+
+            // slow sink is stuck in the first sample, two more fit its queue and the fourth has to wait
+            Thread pusher = new Thread(() =>
+            {
+                for (int i = 1; i <= 5; ++i)
+                {
+                    target.PushSample(CreateSample(buffer, MediaContentType.Video, i * 10, i == 1));
+                }
+            });
+
+            pusher.Start();
+            Assert.IsFalse(pusher.Join(500));
+
+            slow.Gate.Set();
+            Assert.IsTrue(pusher.Join(5000));
+            target.Dispose();
+
+            // nothing is dropped
+            CollectionAssert.AreEqual(new string[] { "Video 10", "Video 20", "Video 30", "Video 40", "Video 50" }, slow.Calls);
+            Assert.AreEqual(0, buffer.Release());
+        }
+
+        /// <summary>
+        ///A test for ThrowIfFailed
+        ///</summary>
+        [TestMethod()]
+        public void ThrowIfFailedTest()
+        {
+            RecordingSink sink = new RecordingSink();
+            sink.Fail = true;
+
+            MediaFanOut target = new MediaFanOut(16);
+            target.AddSink("failing", sink);
+            target.RegisterStream(new MediaType { ContentType = MediaContentType.Audio });
+
+            bool thrown = false;
+            for (int i = 0; i < 100 && !thrown; ++i)
+            {
+                try
+                {
+                    target.ThrowIfFailed();
+                    Thread.Sleep(10);
+                }
+                catch (CriticalStreamException)
+                {
+                    thrown = true;
+                }
+            }
+
+            Assert.IsTrue(thrown);
+            Assert.IsFalse(target.RunIfSoleAndIdle(sink, () => { }));
+
+            target.Dispose();
+            Assert.IsTrue(sink.Disposed);
+        }
+
+        /// <summary>
+        ///A test for RunIfSoleAndIdle
+        ///</summary>
+        [TestMethod()]
+        public void RunIfSoleAndIdleTest()
+        {
+            RecordingSink first = new RecordingSink();
+            RecordingSink second = new RecordingSink();
+            bool called = false;
+
+            MediaFanOut target = new MediaFanOut(16);
+            target.AddSink("first", first);
+            Assert.IsTrue(target.RunIfSoleAndIdle(first, () => called = true));
+            Assert.IsTrue(called);
+            Assert.IsFalse(target.RunIfSoleAndIdle(second, () => { }));
+
+            target.AddSink("second", second);
+            Assert.IsFalse(target.RunIfSoleAndIdle(first, () => { }));
+
+            target.Dispose();
+        }
+    }
+}
@@ -1,6 +1,7 @@
 ﻿using MComms_Transmuxer.Common;
 using Microsoft.VisualStudio.TestTools.UnitTesting;
 using System;
+using System.Threading;
 
 namespace MComms_TransmuxerTests
 {
@@ -74,13 +75,13 @@ namespace MComms_TransmuxerTests
             PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(bufferSize, bufferCount);
             PacketBuffer buffer1 = target.LockBuffer();
             Assert.IsNotNull(buffer1);
-            Assert.IsTrue(target.freeBuffers.Count == 0);
-            Assert.IsTrue(target.lockedBuffers.Count == 1);
+            Assert.IsTrue(target.FreeBufferCount == 0);
+            Assert.IsTrue(target.LockedBufferCount == 1);
             // automatic expansion
             PacketBuffer buffer2 = target.LockBuffer();
             Assert.IsNotNull(buffer2);
-            Assert.IsTrue(target.freeBuffers.Count == 0);
-            Assert.IsTrue(target.lockedBuffers.Count == 2);
+            Assert.IsTrue(target.FreeBufferCount == 0);
+            Assert.IsTrue(target.LockedBufferCount == 2);
         }
 
         /// <summary>
@@ -94,11 +95,11 @@ namespace MComms_TransmuxerTests
             PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(bufferSize, bufferCount);
             PacketBuffer buffer = target.LockBuffer();
             Assert.IsNotNull(buffer);
-            Assert.IsTrue(target.freeBuffers.Count == 0);
-            Assert.IsTrue(target.lockedBuffers.Count == 1);
+            Assert.IsTrue(target.FreeBufferCount == 0);
+            Assert.IsTrue(target.LockedBufferCount == 1);
             target.ReleaseBuffer(buffer);
-            Assert.IsTrue(target.freeBuffers.Count == 1);
-            Assert.IsTrue(target.lockedBuffers.Count == 0);
+            Assert.IsTrue(target.FreeBufferCount == 1);
+            Assert.IsTrue(target.LockedBufferCount == 0);
         }
 
         /// <summary>
@@ -113,8 +114,133 @@ namespace MComms_TransmuxerTests
             int bufferSize1 = 2048;
             int bufferCount1 = 5;
             target.Reallocate(bufferSize1, bufferCount1);
-            Assert.AreEqual(target.freeBuffers.Count, bufferCount1);
-            Assert.AreEqual(target.freeBuffers[0].Buffer.Length, bufferSize1);
+            Assert.AreEqual(target.FreeBufferCount, bufferCount1);
+            Assert.AreEqual(target.LockBuffer().Buffer.Length, bufferSize1);
+        }
+
+        /// <summary>
+        ///A test for releasing buffer locked before Reallocate
+        ///</summary>
+        [TestMethod()]
+        public void ReleaseAfterReallocateTest()
+        {
+            PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(1024, 1);
+            PacketBuffer buffer = target.LockBuffer();
+            target.Reallocate(2048, 2);
+            buffer.Release();
+            Assert.AreEqual(2, target.FreeBufferCount);
+            Assert.AreEqual(0, target.LockedBufferCount);
+        }
+
+        /// <summary>
+        ///A test for releasing the same buffer twice
+        ///</summary>
+        [TestMethod()]
+        public void DoubleReleaseTest()
+        {
+            PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(1024, 1);
+            PacketBuffer buffer = target.LockBuffer();
+            target.ReleaseBuffer(buffer);
+            target.ReleaseBuffer(buffer);
+            Assert.AreEqual(1, target.FreeBufferCount);
+            Assert.AreEqual(0, target.LockedBufferCount);
+            Assert.AreSame(buffer, target.LockBuffer());
+            Assert.AreEqual(0, target.FreeBufferCount);
+        }
+
+        /// <summary>
+        ///A test for locking and releasing buffers from several threads
+        ///</summary>
+        [TestMethod()]
+        public void ConcurrentLockReleaseTest()
+        {
+            int bufferCount = 16;
+            PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(1024, bufferCount);
+            PacketBuffer[] sharedBuffers = new PacketBuffer[4];
+            Thread[] threads = new Thread[4];
+
+            for (int i = 0; i < threads.Length; ++i)
+            {
+                int index = i;
+                threads[i] = new Thread(() =>
+                {
+                    for (int j = 0; j < 10000; ++j)
+                    {
+                        PacketBuffer buffer = target.LockBuffer();
+                        buffer.ActualBufferSize = 1;
+
+                        // hand buffer over, release happens on another thread
+                        PacketBuffer previous = Interlocked.Exchange(ref sharedBuffers[index], buffer);
+                        if (previous != null)
+                        {
+                            previous.Release();
+                        }
+
+                        previous = Interlocked.Exchange(ref sharedBuffers[(index + 1) % sharedBuffers.Length], null);
+                        if (previous != null)
+                        {
+                            previous.Release();
+                        }
+                    }
+                });
+            }
+
+            foreach (Thread thread in threads)
+            {
+                thread.Start();
+            }
+
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+
+            foreach (PacketBuffer buffer in sharedBuffers)
+            {
+                if (buffer != null)
+                {
+                    buffer.Release();
+                }
+            }
+
+            Assert.AreEqual(0, target.LockedBufferCount);
+            Assert.AreEqual(target.BufferCount, target.FreeBufferCount);
+            Assert.IsTrue(target.LockBuffer().ActualBufferSize == 0);
+        }
+
+        /// <summary>
+        ///A test for buffers released by a thread which has finished
+        ///</summary>
+        [TestMethod()]
+        public void ReleaseOnFinishedThreadTest()
+        {
+            PacketBufferAllocator_Accessor target = new PacketBufferAllocator_Accessor(1024, 4);
+            PacketBuffer[] buffers = new PacketBuffer[4];
+            for (int i = 0; i < buffers.Length; ++i)
+            {
+                buffers[i] = target.LockBuffer();
+            }
+
+            // buffers stay in the cache of the releasing thread
+            Thread thread = new Thread(() =>
+            {
+                foreach (PacketBuffer buffer in buffers)
+                {
+                    buffer.Release();
+                }
+            });
+            thread.Start();
+            thread.Join();
+
+            Assert.AreEqual(4, target.FreeBufferCount);
+            for (int i = 0; i < buffers.Length; ++i)
+            {
+                Assert.IsNotNull(target.LockBuffer());
+            }
+
+            Assert.AreEqual(4, target.BufferCount);
+            Assert.AreEqual(0, target.FreeBufferCount);
+            Assert.AreEqual(4, target.LockedBufferCount);
         }
     }
 }
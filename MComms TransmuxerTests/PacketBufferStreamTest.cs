@@ -81,7 +81,7 @@ namespace MComms_TransmuxerTests
             target.Append(packet, 0, packet.ActualBufferSize);
             bool disposing = true;
             target.Dispose(disposing);
-            Assert.AreEqual(target.bufferId2BufferEntry.Count, 0);
+            Assert.IsNull(target.FirstPacketBuffer);
         }
 
         /// <summary>
@@ -230,11 +230,12 @@ namespace MComms_TransmuxerTests
             PacketBuffer packet = Global.Allocator.LockBuffer();
             packet.ActualBufferSize = 10;
             target.Append(packet, 0, packet.ActualBufferSize);
-            Assert.AreEqual(target.position2BufferId[0], packet.Id);
-            PacketBufferStream_Accessor.BufferEntry entry = new PacketBufferStream_Accessor.BufferEntry(new PrivateObject(target.bufferId2BufferEntry[packet.Id]));
-            Assert.AreEqual(entry.Offset, 0);
-            Assert.AreEqual(entry.Size, packet.ActualBufferSize);
-            Assert.AreEqual(entry.Buffer, packet);
+            Assert.AreEqual(target.FirstPacketBuffer, packet);
+            Assert.AreEqual((int)target.Position, 0);
+            ArraySegment<byte> segment = target.PeekSegment();
+            Assert.AreEqual(segment.Array, packet.Buffer);
+            Assert.AreEqual(segment.Offset, 0);
+            Assert.AreEqual(segment.Count, packet.ActualBufferSize);
         }
 
         /// <summary>
@@ -277,10 +278,11 @@ namespace MComms_TransmuxerTests
             // cut the beginning of the first packet
             target.Position = 8;
             target.TrimBegin();
-            PacketBufferStream_Accessor.BufferEntry entry = new PacketBufferStream_Accessor.BufferEntry(new PrivateObject(target.bufferId2BufferEntry[packet1.Id]));
-            Assert.AreEqual(entry.Offset, 8);
-            Assert.AreEqual(entry.Size, 2);
-            Assert.AreEqual(entry.Buffer, packet1);
+            Assert.AreEqual((int)target.Length, 2);
+            ArraySegment<byte> segment = target.PeekSegment();
+            Assert.AreEqual(segment.Array, packet1.Buffer);
+            Assert.AreEqual(segment.Offset, 8);
+            Assert.AreEqual(segment.Count, 2);
 
             // cut out the first packet completely
             PacketBuffer packet2 = Global.Allocator.LockBuffer();
@@ -288,12 +290,53 @@ namespace MComms_TransmuxerTests
             target.Append(packet2, 0, packet1.ActualBufferSize);
             target.Position = 8;
             target.TrimBegin();
-            Assert.AreEqual(target.position2BufferId.Count, 1);
-            Assert.AreEqual(target.position2BufferId[0], packet2.Id);
-            entry = new PacketBufferStream_Accessor.BufferEntry(new PrivateObject(target.bufferId2BufferEntry[packet2.Id]));
-            Assert.AreEqual(entry.Offset, 6);
-            Assert.AreEqual(entry.Size, 4);
-            Assert.AreEqual(entry.Buffer, packet2);
+            Assert.AreEqual(target.FirstPacketBuffer, packet2);
+            Assert.AreEqual((int)target.Length, 4);
+            segment = target.PeekSegment();
+            Assert.AreEqual(segment.Array, packet2.Buffer);
+            Assert.AreEqual(segment.Offset, 6);
+            Assert.AreEqual(segment.Count, 4);
+        }
+
+        /// <summary>
+        ///A test for reading across buffer boundaries
+        ///</summary>
+        [TestMethod()]
+        public void ReadAcrossBuffersTest()
+        {
+            PacketBufferStream_Accessor target = new PacketBufferStream_Accessor();
+            for (int i = 0; i < 3; ++i)
+            {
+                PacketBuffer packet = Global.Allocator.LockBuffer();
+                for (int j = 0; j < 4; ++j)
+                {
+                    packet.Buffer[j] = (byte)(i * 4 + j);
+                }
+                packet.ActualBufferSize = 4;
+                target.Append(packet, 0, packet.ActualBufferSize);
+                packet.Release();
+            }
+
+            target.Position = 2;
+            byte[] actual = new byte[6];
+            Assert.AreEqual(target.Peek(actual, 0, actual.Length), 6);
+            CollectionAssert.AreEqual(new byte[] { 2, 3, 4, 5, 6, 7 }, actual);
+            Assert.AreEqual((int)target.Position, 2);
+
+            Assert.AreEqual(target.ReadByte(), 2);
+            Assert.AreEqual(target.ReadByte(), 3);
+            Assert.AreEqual(target.ReadByte(), 4);
+            Assert.AreEqual(target.Read(actual, 0, actual.Length), 6);
+            CollectionAssert.AreEqual(new byte[] { 5, 6, 7, 8, 9, 10 }, actual);
+            Assert.AreEqual(target.Available, 1L);
+
+            // seek back into the first buffer
+            target.Seek(-8, SeekOrigin.Current);
+            Assert.AreEqual(target.ReadByte(), 3);
+
+            target.Seek(0, SeekOrigin.End);
+            Assert.AreEqual(target.ReadByte(), -1);
+            Assert.AreEqual(target.PeekSegment().Count, 0);
         }
     }
 }
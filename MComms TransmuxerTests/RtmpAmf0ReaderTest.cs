@@ -0,0 +1,219 @@
+﻿using MComms_Transmuxer.RTMP;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for RtmpAmf0ReaderTest and is intended
+    ///to contain all RtmpAmf0ReaderTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class RtmpAmf0ReaderTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///A test for ReadAll on template encoded reply
+        ///</summary>
+        [TestMethod()]
+        public void ReadAllTemplateTest()
+        {
+            byte[] buffer = new byte[1024];
+            int length = RtmpMessageCommandReply.PublishStart.Encode(buffer, 10, new object[] { "live is now published", 123.0 });
+
+            RtmpAmf0Reader target = new RtmpAmf0Reader(buffer, 10, length);
+            List<object> actual = target.ReadAll();
+
+            Assert.AreEqual(4, actual.Count);
+            Assert.AreEqual("onStatus", actual[0]);
+            Assert.AreEqual(0.0, actual[1]);
+            Assert.IsInstanceOfType(actual[2], typeof(RtmpAmfNull));
+            RtmpAmfObject obj = (RtmpAmfObject)actual[3];
+            Assert.AreEqual("status", obj.Strings["level"]);
+            Assert.AreEqual("NetStream.Publish.Start", obj.Strings["code"]);
+            Assert.AreEqual("live is now published", obj.Strings["description"]);
+            Assert.AreEqual(123.0, obj.Numbers["clientId"]);
+        }
+
+        /// <summary>
+        ///A test for ReadAll with nested objects, booleans and AMF3 values
+        ///</summary>
+        [TestMethod()]
+        public void ReadAllMixedTest()
+        {
+            byte[] buffer = new byte[]
+            {
+                0x02,0x00,0x03,(byte)'a',(byte)'b',(byte)'c',                   // "abc"
+                0x03,                                                           // object
+                    0x00,0x01,(byte)'b',0x01,0x01,                              // b: true
+                    0x00,0x01,(byte)'o',0x03,                                   // o: object
+                        0x00,0x01,(byte)'u',0x06,                               // u: undefined
+                    0x00,0x00,0x09,
+                0x00,0x00,0x09,
+                0x11,0x04,0x81,0x00,                                            // AMF3 integer 128
+                0x11,0x06,0x05,(byte)'x',(byte)'y',                             // AMF3 string "xy"
+                0x11,0x06,0x00,                                                 // AMF3 string reference 0
+                0x0C,0x00,0x00,0x00,0x01,(byte)'z',                             // long string "z"
+            };
+
+            RtmpAmf0Reader target = new RtmpAmf0Reader(buffer, 0, buffer.Length);
+            List<object> actual = target.ReadAll();
+
+            Assert.AreEqual(6, actual.Count);
+            Assert.AreEqual("abc", actual[0]);
+            RtmpAmfObject obj = (RtmpAmfObject)actual[1];
+            Assert.AreEqual(true, obj.Booleans["b"]);
+            Assert.AreEqual(1u, obj.Objects["o"].Nulls);
+            Assert.AreEqual(128.0, actual[2]);
+            Assert.AreEqual("xy", actual[3]);
+            Assert.AreEqual("xy", actual[4]);
+            Assert.AreEqual("z", actual[5]);
+        }
+
+        /// <summary>
+        ///A test for ReadAll on AMF3 connect command with objects, arrays and references
+        ///</summary>
+        [TestMethod()]
+        public void ReadAllAmf3ConnectTest()
+        {
+            byte[] buffer = new byte[]
+            {
+                0x00,                                                           // AMF3 command format byte
+                0x02,0x00,0x07,(byte)'c',(byte)'o',(byte)'n',(byte)'n',(byte)'e',(byte)'c',(byte)'t',
+                0x00,0x3F,0xF0,0x00,0x00,0x00,0x00,0x00,0x00,                   // 1.0
+                0x11,0x0A,0x0B,0x01,                                            // AMF3 dynamic object, anonymous
+                    0x07,(byte)'a',(byte)'p',(byte)'p',
+                    0x06,0x09,(byte)'l',(byte)'i',(byte)'v',(byte)'e',          // app: "live"
+                    0x0B,(byte)'t',(byte)'c',(byte)'U',(byte)'r',(byte)'l',
+                    0x06,0x1B,(byte)'r',(byte)'t',(byte)'m',(byte)'p',(byte)':',(byte)'/',(byte)'/',
+                        (byte)'h',(byte)'/',(byte)'l',(byte)'i',(byte)'v',(byte)'e',
+                    0x09,(byte)'f',(byte)'p',(byte)'a',(byte)'d',0x02,          // fpad: false
+                    0x19,(byte)'c',(byte)'a',(byte)'p',(byte)'a',(byte)'b',(byte)'i',(byte)'l',(byte)'i',(byte)'t',(byte)'i',(byte)'e',(byte)'s',
+                    0x04,0x81,0x6F,                                             // capabilities: 239
+                    0x17,(byte)'a',(byte)'u',(byte)'d',(byte)'i',(byte)'o',(byte)'C',(byte)'o',(byte)'d',(byte)'e',(byte)'c',(byte)'s',
+                    0x05,0x40,0xAB,0xEE,0x00,0x00,0x00,0x00,0x00,               // audioCodecs: 3575.0
+                    0x1D,(byte)'o',(byte)'b',(byte)'j',(byte)'e',(byte)'c',(byte)'t',(byte)'E',(byte)'n',(byte)'c',(byte)'o',(byte)'d',(byte)'i',(byte)'n',(byte)'g',
+                    0x04,0x03,                                                  // objectEncoding: 3
+                    0x09,(byte)'a',(byte)'p',(byte)'p',(byte)'2',0x06,0x02,     // app2: string reference 1 ("live")
+                    0x09,(byte)'l',(byte)'i',(byte)'s',(byte)'t',
+                    0x09,0x05,                                                  // list: array of 2 elements
+                        0x03,(byte)'k',0x06,0x00,                               // k: string reference 0 ("app")
+                        0x01,
+                        0x04,0x01,0x03,                                         // [1, true]
+                    0x0D,(byte)'s',(byte)'e',(byte)'a',(byte)'l',(byte)'e',(byte)'d',
+                    0x0A,0x13,0x03,(byte)'C',0x03,(byte)'x',0x04,0x05,          // sealed: C { x: 5 }
+                    0x0B,(byte)'a',(byte)'g',(byte)'a',(byte)'i',(byte)'n',
+                    0x0A,0x05,0x04,0x06,                                        // again: traits reference 1, C { x: 6 }
+                    0x09,(byte)'s',(byte)'e',(byte)'l',(byte)'f',
+                    0x0A,0x00,                                                  // self: object reference 0
+                    0x01,
+                0x05,                                                           // null
+            };
+
+            RtmpAmf0Reader target = new RtmpAmf0Reader(buffer, 1, buffer.Length - 1);
+            List<object> actual = target.ReadAll();
+
+            Assert.AreEqual(4, actual.Count);
+            Assert.AreEqual("connect", actual[0]);
+            Assert.AreEqual(1.0, actual[1]);
+            Assert.IsInstanceOfType(actual[3], typeof(RtmpAmfNull));
+
+            RtmpAmfObject obj = (RtmpAmfObject)actual[2];
+            Assert.AreEqual("live", obj.Strings["app"]);
+            Assert.AreEqual("rtmp://h/live", obj.Strings["tcUrl"]);
+            Assert.AreEqual(false, obj.Booleans["fpad"]);
+            Assert.AreEqual(239.0, obj.Numbers["capabilities"]);
+            Assert.AreEqual(3575.0, obj.Numbers["audioCodecs"]);
+            Assert.AreEqual(3.0, obj.Numbers["objectEncoding"]);
+            Assert.AreEqual("live", obj.Strings["app2"]);
+
+            RtmpAmfObject list = obj.Objects["list"];
+            Assert.AreEqual("app", list.Strings["k"]);
+            Assert.AreEqual(1.0, list.Numbers["0"]);
+            Assert.AreEqual(true, list.Booleans["1"]);
+
+            Assert.AreEqual(5.0, obj.Objects["sealed"].Numbers["x"]);
+            Assert.AreEqual(6.0, obj.Objects["again"].Numbers["x"]);
+            Assert.AreSame(obj, obj.Objects["self"]);
+        }
+
+        /// <summary>
+        ///A test for short strings being interned
+        ///</summary>
+        [TestMethod()]
+        public void ReadAllInternTest()
+        {
+            byte[] buffer = new byte[] { 0x02, 0x00, 0x05, (byte)'t', (byte)'c', (byte)'U', (byte)'r', (byte)'l' };
+
+            object first = new RtmpAmf0Reader(buffer, 0, buffer.Length).ReadAll()[0];
+            object second = new RtmpAmf0Reader(buffer, 0, buffer.Length).ReadAll()[0];
+
+            Assert.AreEqual("tcUrl", first);
+            Assert.AreSame(first, second);
+        }
+
+        /// <summary>
+        ///A test for truncated data
+        ///</summary>
+        [TestMethod()]
+        [ExpectedException(typeof(IndexOutOfRangeException))]
+        public void ReadAllTruncatedTest()
+        {
+            byte[] buffer = new byte[] { 0x02, 0x00, 0x05, (byte)'t', (byte)'c' };
+            new RtmpAmf0Reader(buffer, 0, buffer.Length).ReadAll();
+        }
+    }
+}
@@ -4,6 +4,7 @@ using System;
 using System.Collections.Generic;
 using MComms_Transmuxer;
 using MComms_Transmuxer.Common;
+using MComms_Transmuxer.Output;
 using MComms_Transmuxer.SmoothStreaming;
 
 namespace MComms_TransmuxerTests
@@ -82,7 +83,9 @@ namespace MComms_TransmuxerTests
             RtmpMessageStream_Accessor target = new RtmpMessageStream_Accessor(messageStreamId);
             target.PublishName = "test";
             target.FullPublishName = "test";
-            target.segmenter = new SmoothStreamingSegmenter("test", true);
+            target.smoothSink = new SmoothStreamingSink("test", true);
+            target.fanOut = new MediaFanOut(Global.MediaSinkQueueLength);
+            target.fanOut.AddSink("test", target.smoothSink);
 
             List<object> pars = new List<object>();
             pars.Add("onMetaData");
@@ -114,11 +117,6 @@ namespace MComms_TransmuxerTests
             msg.MediaData.ActualBufferSize = data.Length;
             target.ProcessMediaData(msg);
 
-            Assert.IsNotNull(target.videoMediaType);
-            Assert.IsNotNull(target.videoMediaType.PrivateData);
-            Assert.IsNotNull(target.videoMediaType.PrivateDataIisString);
-            Assert.AreNotEqual(Guid.Empty, target.videoStreamId);
-
             msg = new RtmpMessageMedia(RtmpAudioCodec.AAC, RtmpMediaPacketType.Configuration, 44100, 16, 2);
             msg.MediaData = Global.Allocator.LockBuffer();
             data = new byte[]
@@ -129,11 +127,18 @@ namespace MComms_TransmuxerTests
             msg.MediaData.ActualBufferSize = data.Length;
             target.ProcessMediaData(msg);
 
+            // streams are registered by output worker, disposing waits for it
+            SmoothStreamingSink_Accessor sink = new SmoothStreamingSink_Accessor(new PrivateObject(target.smoothSink));
+            target.Dispose();
+
+            Assert.IsNotNull(target.videoMediaType);
+            Assert.IsNotNull(target.videoMediaType.PrivateData);
+            Assert.IsNotNull(target.videoMediaType.PrivateDataIisString);
+            Assert.AreNotEqual(Guid.Empty, sink.videoStreamId);
+
             Assert.IsNotNull(target.audioMediaType);
             Assert.IsNotNull(target.audioMediaType.PrivateData);
-            Assert.AreNotEqual(Guid.Empty, target.audioStreamId);
-
-            target.Dispose();
+            Assert.AreNotEqual(Guid.Empty, sink.audioStreamId);
         }
 
         /// <summary>
@@ -149,7 +154,9 @@ namespace MComms_TransmuxerTests
             RtmpMessageStream_Accessor target = new RtmpMessageStream_Accessor(messageStreamId);
             target.PublishName = "test";
             target.FullPublishName = "test";
-            target.segmenter = new SmoothStreamingSegmenter("test", true);
+            target.smoothSink = new SmoothStreamingSink("test", true);
+            target.fanOut = new MediaFanOut(Global.MediaSinkQueueLength);
+            target.fanOut.AddSink("test", target.smoothSink);
 
             List<object> pars = new List<object>();
             pars.Add("onMetaData");
@@ -192,7 +199,9 @@ namespace MComms_TransmuxerTests
             RtmpMessageStream_Accessor target = new RtmpMessageStream_Accessor(messageStreamId);
             target.PublishName = "test";
             target.FullPublishName = "test";
-            target.segmenter = new SmoothStreamingSegmenter("test", true);
+            target.smoothSink = new SmoothStreamingSink("test", true);
+            target.fanOut = new MediaFanOut(Global.MediaSinkQueueLength);
+            target.fanOut.AddSink("test", target.smoothSink);
 
             List<object> pars = new List<object>();
             pars.Add("onMetaData");
@@ -248,7 +257,9 @@ namespace MComms_TransmuxerTests
             RtmpMessageStream_Accessor target = new RtmpMessageStream_Accessor(messageStreamId);
             target.PublishName = "test";
             target.FullPublishName = "test";
-            target.segmenter = new SmoothStreamingSegmenter("test", true);
+            target.smoothSink = new SmoothStreamingSink("test", true);
+            target.fanOut = new MediaFanOut(Global.MediaSinkQueueLength);
+            target.fanOut.AddSink("test", target.smoothSink);
 
             List<object> pars = new List<object>();
             pars.Add("onMetaData");
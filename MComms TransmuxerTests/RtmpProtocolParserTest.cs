@@ -168,6 +168,28 @@ namespace MComms_TransmuxerTests
             CollectionAssert.AreEqual(correctBuffer, actualBuffer);
         }
 
+        /// <summary>
+        ///A test for GetSendPacket gathering several queued messages
+        ///</summary>
+        [TestMethod()]
+        public void GetSendPacketGatherTest()
+        {
+            Global.Allocator = new PacketBufferAllocator(Global.TransportBufferSize, 1);
+            RtmpProtocolParser_Accessor target = new RtmpProtocolParser_Accessor();
+            target.Encode(new RtmpMessageSetChunkSize(1024));
+            target.Encode(new RtmpMessageSetChunkSize(2048));
+            target.Encode(new RtmpMessageSetChunkSize(4096));
+            PacketBuffer actual = target.GetSendPacket();
+            Assert.IsNotNull(actual);
+            Assert.AreEqual(48, actual.ActualBufferSize);
+            Assert.AreEqual(0x04, actual.Buffer[14]);
+            Assert.AreEqual(0x08, actual.Buffer[30]);
+            Assert.AreEqual(0x10, actual.Buffer[46]);
+            Assert.IsNull(target.GetSendPacket());
+            actual.Release();
+            Assert.AreEqual(0, Global.Allocator.LockedBufferCount);
+        }
+
         /// <summary>
         ///A test for IsMessageStreamRegistered
         ///</summary>
@@ -5,6 +5,7 @@ using MComms_Transmuxer.Transport;
 using System.Net;
 using MComms_Transmuxer;
 using MComms_Transmuxer.Common;
+using System.Threading;
 
 namespace MComms_TransmuxerTests
 {
@@ -79,9 +80,16 @@ namespace MComms_TransmuxerTests
             SocketTransport transport = new SocketTransport();
             transport.Start();
             IPEndPoint sessionEndPoint = new IPEndPoint(IPAddress.Parse("127.0.0.1"), 9999);
-            RtmpSession_Accessor target = new RtmpSession_Accessor(sessionId, transport, sessionEndPoint);
+
+            // keep the only worker busy so received packets stay queued
+            WorkerPool pool = new WorkerPool("Test", 1);
+            ManualResetEvent gate = new ManualResetEvent(false);
+            new ScheduledWork(pool, () => gate.WaitOne()).Schedule();
+
+            RtmpSession_Accessor target = new RtmpSession_Accessor(sessionId, transport, sessionEndPoint, pool);
 
             target.messageStreams.Add(1, new RtmpMessageStream(1));
+            target.statistics = new StreamStatistics("test.isml", "test");
 
             byte[] buf = new byte[Global.TransportBufferSize];
             for (int i = 0; i < 10; ++i)
@@ -92,11 +100,14 @@ namespace MComms_TransmuxerTests
             Assert.IsTrue(target.receivedPackets.Count > 0);
 
             target.Dispose();
-            Assert.IsNull(target.sessionThread);
+            Assert.IsNull(target.sessionWork);
             Assert.AreEqual(0, target.messageStreams.Count);
+            Assert.IsNull(target.statistics);
             Assert.AreEqual(0, target.receivedPackets.Count);
             Assert.IsNull(target.lastReceivedPacket);
 
+            gate.Set();
+            pool.Dispose();
             transport.Stop();
         }
     }
@@ -0,0 +1,201 @@
+﻿using MComms_Transmuxer.SmoothStreaming;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.IO;
+using System.Text;
+
+namespace MComms_TransmuxerTests
+{
+
+
+    /// <summary>
+    ///This is a test class for SmoothStreamingBatchTransmuxerTest and is intended
+    ///to contain all SmoothStreamingBatchTransmuxerTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class SmoothStreamingBatchTransmuxerTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        //
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///Makes audio only FLV file: AAC LC 44.1 kHz stereo configuration followed by dummy frames
+        ///</summary>
+        private static byte[] CreateAudioFlv(int frames)
+        {
+            MemoryStream flv = new MemoryStream();
+            flv.Write(new byte[] { 0x46, 0x4C, 0x56, 0x01, 0x04, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00 }, 0, 13);
+
+            WriteTag(flv, 0x08, 0, new byte[] { 0xAF, 0x00, 0x12, 0x10 });
+            for (int i = 0; i < frames; ++i)
+            {
+                byte[] frame = new byte[200];
+                frame[0] = 0xAF;
+                frame[1] = 0x01;
+                frame[2] = (byte)i;
+                WriteTag(flv, 0x08, i * 1024 * 1000 / 44100, frame);
+            }
+
+            return flv.ToArray();
+        }
+
+        private static void WriteTag(MemoryStream flv, byte tagType, int timestamp, byte[] data)
+        {
+            flv.WriteByte(tagType);
+            flv.WriteByte((byte)(data.Length >> 16));
+            flv.WriteByte((byte)(data.Length >> 8));
+            flv.WriteByte((byte)data.Length);
+            flv.WriteByte((byte)(timestamp >> 16));
+            flv.WriteByte((byte)(timestamp >> 8));
+            flv.WriteByte((byte)timestamp);
+            flv.WriteByte((byte)(timestamp >> 24));
+            flv.Write(new byte[3], 0, 3);
+            flv.Write(data, 0, data.Length);
+
+            int tagSize = data.Length + 11;
+            flv.Write(new byte[] { (byte)(tagSize >> 24), (byte)(tagSize >> 16), (byte)(tagSize >> 8), (byte)tagSize }, 0, 4);
+        }
+
+        private static int ReadInt(byte[] data, int offset)
+        {
+            return data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
+        }
+
+        /// <summary>
+        ///A test for Run
+        ///</summary>
+        [TestMethod()]
+        public void RunTest()
+        {
+            string folder = Path.Combine(Path.GetTempPath(), "SmoothStreamingBatchTransmuxerTest");
+            string inputFolder = Path.Combine(folder, "in");
+            string outputFolder = Path.Combine(folder, "out");
+            if (Directory.Exists(folder))
+            {
+                Directory.Delete(folder, true);
+            }
+
+            Directory.CreateDirectory(inputFolder);
+            string audio = Path.Combine(inputFolder, "audio.flv");
+            string invalid = Path.Combine(inputFolder, "invalid.flv");
+            File.WriteAllBytes(audio, CreateAudioFlv(100));
+            File.WriteAllBytes(invalid, Encoding.ASCII.GetBytes("not an FLV file"));
+
+            SmoothStreamingBatchTransmuxer target = new SmoothStreamingBatchTransmuxer(outputFolder, 2);
+            int actual = target.Run(new string[] { audio, invalid });
+
+            Assert.AreEqual(1, actual);
+            Assert.IsFalse(File.Exists(Path.Combine(outputFolder, "audio.ismv")));
+            Assert.IsFalse(File.Exists(Path.Combine(outputFolder, "invalid.isma")));
+
+            byte[] data = File.ReadAllBytes(Path.Combine(outputFolder, "audio.isma"));
+            Assert.AreEqual("ftyp", Encoding.ASCII.GetString(data, 4, 4));
+
+            // the last fragment is completed at the end of the file, index follows it
+            int moofCount = 0;
+            int position = 0;
+            string lastBox = null;
+            while (position < data.Length)
+            {
+                lastBox = Encoding.ASCII.GetString(data, position + 4, 4);
+                if (lastBox == "moof")
+                {
+                    ++moofCount;
+                }
+
+                position += ReadInt(data, position);
+            }
+
+            Assert.AreEqual(data.Length, position);
+            Assert.IsTrue(moofCount > 0);
+            Assert.AreEqual("mfra", lastBox);
+            Assert.AreEqual("mfro", Encoding.ASCII.GetString(data, data.Length - 12, 4));
+        }
+
+        /// <summary>
+        ///A test for Run with files of the same name from different folders
+        ///</summary>
+        [TestMethod()]
+        public void RunDuplicateNameTest()
+        {
+            string folder = Path.Combine(Path.GetTempPath(), "SmoothStreamingBatchTransmuxerDuplicateTest");
+            string firstFolder = Path.Combine(folder, "first");
+            string secondFolder = Path.Combine(folder, "second");
+            if (Directory.Exists(folder))
+            {
+                Directory.Delete(folder, true);
+            }
+
+            Directory.CreateDirectory(firstFolder);
+            Directory.CreateDirectory(secondFolder);
+            string first = Path.Combine(firstFolder, "audio.flv");
+            string second = Path.Combine(secondFolder, "Audio.flv");
+            File.WriteAllBytes(first, CreateAudioFlv(100));
+            File.WriteAllBytes(second, CreateAudioFlv(50));
+
+            SmoothStreamingBatchTransmuxer target = new SmoothStreamingBatchTransmuxer(Path.Combine(folder, "out"), 2);
+            int actual = target.Run(new string[] { first, second });
+            Assert.AreEqual(1, actual);
+
+            // the second file is skipped, output is the one of the first file alone
+            SmoothStreamingBatchTransmuxer reference = new SmoothStreamingBatchTransmuxer(Path.Combine(folder, "reference"), 1);
+            Assert.AreEqual(1, reference.Run(new string[] { first }));
+
+            byte[] expected = File.ReadAllBytes(Path.Combine(Path.Combine(folder, "reference"), "audio.isma"));
+            byte[] data = File.ReadAllBytes(Path.Combine(Path.Combine(folder, "out"), "audio.isma"));
+            Assert.AreEqual(expected.Length, data.Length);
+            for (int i = 0; i < expected.Length; ++i)
+            {
+                Assert.AreEqual(expected[i], data[i]);
+            }
+        }
+    }
+}
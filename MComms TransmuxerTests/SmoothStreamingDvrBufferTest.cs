@@ -0,0 +1,292 @@
+﻿using MComms_Transmuxer.SmoothStreaming;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Xml;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for SmoothStreamingDvrBufferTest and is intended
+    ///to contain all SmoothStreamingDvrBufferTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class SmoothStreamingDvrBufferTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        private static byte[] Box(string type, params byte[][] payload)
+        {
+            MemoryStream box = new MemoryStream();
+            int size = 8;
+            foreach (byte[] part in payload)
+            {
+                size += part.Length;
+            }
+
+            box.Write(UInt32(size), 0, 4);
+            box.Write(Encoding.ASCII.GetBytes(type), 0, 4);
+            foreach (byte[] part in payload)
+            {
+                box.Write(part, 0, part.Length);
+            }
+
+            return box.ToArray();
+        }
+
+        private static byte[] UInt32(long value)
+        {
+            return new byte[] { (byte)(value >> 24), (byte)(value >> 16), (byte)(value >> 8), (byte)value };
+        }
+
+        private static byte[] UInt64(long value)
+        {
+            byte[] result = new byte[8];
+            Array.Copy(UInt32(value >> 32), 0, result, 0, 4);
+            Array.Copy(UInt32(value), 0, result, 4, 4);
+            return result;
+        }
+
+        private static byte[] Header(string type, int bitrate, string codecPrivateData)
+        {
+            string smil = string.Format(
+                "<?xml version=\"1.0\" encoding=\"utf-8\"?><smil xmlns=\"http://www.w3.org/2001/SMIL20/Language\"><body><switch>" +
+                "<{0} src=\"test\" systemBitrate=\"{1}\"><param name=\"FourCC\" value=\"{2}\" valuetype=\"data\" />" +
+                "<param name=\"CodecPrivateData\" value=\"{3}\" valuetype=\"data\" /><param name=\"MaxWidth\" value=\"640\" valuetype=\"data\" />" +
+                "<param name=\"MaxHeight\" value=\"360\" valuetype=\"data\" /></{0}></switch></body></smil>",
+                type, bitrate, type == "video" ? "H264" : "AACL", codecPrivateData);
+
+            byte[] uuid = { 0xA5, 0xD4, 0x0B, 0x30, 0xE8, 0x14, 0x11, 0xDD, 0xBA, 0x2F, 0x08, 0x00, 0x20, 0x0C, 0x9A, 0x66 };
+            byte[] ftyp = Box("ftyp", Encoding.ASCII.GetBytes("piff"), UInt32(1));
+            byte[] manifest = Box("uuid", uuid, UInt32(0), Encoding.UTF8.GetBytes(smil));
+            byte[] moov = Box("moov");
+
+            byte[] header = new byte[ftyp.Length + manifest.Length + moov.Length];
+            ftyp.CopyTo(header, 0);
+            manifest.CopyTo(header, ftyp.Length);
+            moov.CopyTo(header, ftyp.Length + manifest.Length);
+            return header;
+        }
+
+        private static byte[] Fragment(long time, long duration, bool sync, byte payload)
+        {
+            byte[] uuid = { 0x6D, 0x1D, 0x9B, 0x05, 0x42, 0xD5, 0x44, 0xE6, 0x80, 0xE2, 0x14, 0x1D, 0xAF, 0xF7, 0x57, 0xB2 };
+            byte[] trun = Box("trun", UInt32(0x000701), UInt32(1), UInt32(0), UInt32(duration), UInt32(1), UInt32(sync ? 0x02000000 : 0x01010000));
+            byte[] tfxd = Box("uuid", uuid, UInt32(0x01000000), UInt64(time), UInt64(duration));
+            byte[] traf = Box("traf", Box("tfhd", UInt32(0), UInt32(1)), trun, tfxd);
+            byte[] moof = Box("moof", Box("mfhd", UInt32(0), UInt32(1)), traf);
+            byte[] mdat = Box("mdat", new byte[] { payload });
+
+            byte[] fragment = new byte[moof.Length + mdat.Length];
+            moof.CopyTo(fragment, 0);
+            mdat.CopyTo(fragment, moof.Length);
+            return fragment;
+        }
+
+        private static void Push(SmoothStreamingDvrBuffer target, Guid streamId, byte[] data, bool header)
+        {
+            GCHandle handle = GCHandle.Alloc(data, GCHandleType.Pinned);
+            try
+            {
+                if (header)
+                {
+                    target.SetHeader(streamId, handle.AddrOfPinnedObject(), data.Length);
+                }
+                else
+                {
+                    target.AddFragment(streamId, handle.AddrOfPinnedObject(), data.Length);
+                }
+            }
+            finally
+            {
+                handle.Free();
+            }
+        }
+
+        /// <summary>
+        ///A test for GetFragment
+        ///</summary>
+        [TestMethod()]
+        public void GetFragmentTest()
+        {
+            SmoothStreamingDvrBuffer target = new SmoothStreamingDvrBuffer("test.isml", 60000000);
+            Guid video = Guid.NewGuid();
+            Guid audio = Guid.NewGuid();
+            Push(target, video, Header("video", 1000000, "00000001"), true);
+            Push(target, audio, Header("audio", 64000, "1190"), true);
+
+            byte[] fragment = Fragment(0, 20000000, true, 1);
+            Push(target, video, fragment, false);
+            Push(target, video, Fragment(20000000, 20000000, true, 2), false);
+            Push(target, audio, Fragment(0, 50000000, true, 3), false);
+
+            CollectionAssert.AreEqual(fragment, target.GetFragment("video", 1000000, 0));
+            Assert.IsNotNull(target.GetFragment("video", 1000000, 20000000));
+            Assert.IsNotNull(target.GetFragment("audio", 64000, 0));
+            Assert.IsNull(target.GetFragment("video", 1000000, 10000000));
+            Assert.IsNull(target.GetFragment("video", 500000, 0));
+            Assert.IsNull(target.GetFragment("audio", 64000, 20000000));
+        }
+
+        /// <summary>
+        ///A test for AddFragment with chunks continuing a fragment
+        ///</summary>
+        [TestMethod()]
+        public void AddFragmentChunkTest()
+        {
+            SmoothStreamingDvrBuffer target = new SmoothStreamingDvrBuffer("test.isml", 60000000);
+            Guid video = Guid.NewGuid();
+            Push(target, video, Header("video", 1000000, "00000001"), true);
+
+            byte[] first = Fragment(0, 5000000, true, 1);
+            byte[] second = Fragment(5000000, 15000000, false, 2);
+            Push(target, video, first, false);
+            Push(target, video, second, false);
+
+            byte[] fragment = target.GetFragment("video", 1000000, 0);
+            Assert.AreEqual(first.Length + second.Length, fragment.Length);
+            Assert.IsNull(target.GetFragment("video", 1000000, 5000000));
+
+            XmlDocument manifest = new XmlDocument();
+            manifest.Load(new MemoryStream(target.GetManifest()));
+            XmlNodeList chunks = manifest.SelectNodes("/SmoothStreamingMedia/StreamIndex/c");
+            Assert.AreEqual(1, chunks.Count);
+            Assert.AreEqual("20000000", chunks[0].Attributes["d"].Value);
+        }
+
+        /// <summary>
+        ///A test for AddFragment leaving the DVR window
+        ///</summary>
+        [TestMethod()]
+        public void AddFragmentWindowTest()
+        {
+            SmoothStreamingDvrBuffer target = new SmoothStreamingDvrBuffer("test.isml", 60000000);
+            Guid video = Guid.NewGuid();
+            Push(target, video, Header("video", 1000000, "00000001"), true);
+
+            for (int i = 0; i < 10; ++i)
+            {
+                Push(target, video, Fragment(i * 20000000L, 20000000, true, (byte)i), false);
+            }
+
+            // 6 s window ends at 20 s, fragments up to 14 s are gone
+            Assert.IsNull(target.GetFragment("video", 1000000, 120000000));
+            Assert.IsNotNull(target.GetFragment("video", 1000000, 140000000));
+            Assert.IsNotNull(target.GetFragment("video", 1000000, 180000000));
+        }
+
+        /// <summary>
+        ///A test for GetManifest caching
+        ///</summary>
+        [TestMethod()]
+        public void GetManifestCacheTest()
+        {
+            SmoothStreamingDvrBuffer target = new SmoothStreamingDvrBuffer("test.isml", 60000000);
+            Guid video = Guid.NewGuid();
+            Push(target, video, Header("video", 1000000, "00000001"), true);
+            Push(target, video, Fragment(0, 20000000, true, 1), false);
+
+            // manifest is only assembled again once the window changes
+            byte[] manifest = target.GetManifest();
+            Assert.AreSame(manifest, target.GetManifest());
+
+            Push(target, video, Fragment(20000000, 20000000, true, 2), false);
+            byte[] updated = target.GetManifest();
+            Assert.AreNotSame(manifest, updated);
+            Assert.IsTrue(updated.Length > manifest.Length);
+
+            Guid audio = Guid.NewGuid();
+            Push(target, audio, Header("audio", 64000, "1190"), true);
+            Assert.AreNotSame(updated, target.GetManifest());
+        }
+
+        /// <summary>
+        ///A test for GetManifest
+        ///</summary>
+        [TestMethod()]
+        public void GetManifestTest()
+        {
+            SmoothStreamingDvrBuffer target = new SmoothStreamingDvrBuffer("test.isml", 60000000);
+            Guid video = Guid.NewGuid();
+            Guid audio = Guid.NewGuid();
+            Push(target, audio, Header("audio", 64000, "1190"), true);
+            Push(target, video, Header("video", 1000000, "00000001"), true);
+            Push(target, video, Fragment(0, 20000000, true, 1), false);
+            Push(target, video, Fragment(20000000, 20000000, true, 2), false);
+            Push(target, audio, Fragment(0, 50000000, true, 3), false);
+
+            XmlDocument manifest = new XmlDocument();
+            manifest.Load(new MemoryStream(target.GetManifest()));
+
+            XmlNodeList streams = manifest.SelectNodes("/SmoothStreamingMedia/StreamIndex");
+            Assert.AreEqual(2, streams.Count);
+            Assert.AreEqual("video", streams[0].Attributes["Type"].Value);
+            Assert.AreEqual("2", streams[0].Attributes["Chunks"].Value);
+            Assert.AreEqual("QualityLevels({bitrate})/Fragments(video={start time})", streams[0].Attributes["Url"].Value);
+            Assert.AreEqual("1000000", streams[0].SelectSingleNode("QualityLevel").Attributes["Bitrate"].Value);
+            Assert.AreEqual("00000001", streams[0].SelectSingleNode("QualityLevel").Attributes["CodecPrivateData"].Value);
+            Assert.AreEqual("20000000", streams[0].SelectNodes("c")[1].Attributes["t"].Value);
+            Assert.AreEqual("audio", streams[1].Attributes["Type"].Value);
+            Assert.AreEqual("AACL", streams[1].SelectSingleNode("QualityLevel").Attributes["FourCC"].Value);
+
+            // tracks are gone once the publishing point restarts
+            target.Clear();
+            manifest.Load(new MemoryStream(target.GetManifest()));
+            Assert.AreEqual(0, manifest.SelectNodes("/SmoothStreamingMedia/StreamIndex").Count);
+        }
+    }
+}
@@ -91,7 +91,29 @@ namespace MComms_TransmuxerTests
             string publishUri = "test";
             SmoothStreamingSegmenter_Accessor target = new SmoothStreamingSegmenter_Accessor(publishUri, true);
             target.Dispose();
-            Assert.AreEqual(IntPtr.Zero, target.mediaDataPtr);
+            Assert.AreEqual(IntPtr.Zero, target.segment.pData);
+        }
+
+        /// <summary>
+        ///A test for Dispose with queued media data
+        ///</summary>
+        [TestMethod()]
+        public void DisposeQueuedMediaDataTest()
+        {
+            Global.MediaAllocator = new PacketBufferAllocator(Global.OneMediaBufferSize, 2);
+            string publishUri = "test";
+            SmoothStreamingSegmenter_Accessor target = new SmoothStreamingSegmenter_Accessor(publishUri, true);
+
+            PacketBuffer mediaData = Global.MediaAllocator.LockBuffer();
+            mediaData.ActualBufferSize = 100;
+            mediaData.AddRef();
+            target.pendingSamples.Add(new SmoothStreamingSample { PublishStreamId = Guid.NewGuid(), MediaData = mediaData, Offset = 0, Length = 100 });
+            mediaData.Release();
+            Assert.AreEqual(1, Global.MediaAllocator.FreeBufferCount);
+
+            target.Dispose();
+            Assert.AreEqual(0, target.pendingSamples.Count);
+            Assert.AreEqual(2, Global.MediaAllocator.FreeBufferCount);
         }
 
         /// <summary>
@@ -0,0 +1,320 @@
+﻿using MComms_Transmuxer.SmoothStreaming;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Net;
+using System.Net.Sockets;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for SmoothStreamingUploaderTest and is intended
+    ///to contain all SmoothStreamingUploaderTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class SmoothStreamingUploaderTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///Local stand-in for a publishing point, collects chunked POST bodies of accepted connections
+        ///</summary>
+        private class PublishingPointStub : IDisposable
+        {
+            private TcpListener listener;
+            private Thread acceptThread;
+            private List<byte> received = new List<byte>();
+
+            public PublishingPointStub(int port)
+            {
+                this.listener = new TcpListener(IPAddress.Loopback, port);
+                this.listener.Start();
+                this.acceptThread = new Thread(this.AcceptProc);
+                this.acceptThread.IsBackground = true;
+                this.acceptThread.Start();
+            }
+
+            public int Port
+            {
+                get
+                {
+                    return ((IPEndPoint)this.listener.LocalEndpoint).Port;
+                }
+            }
+
+            public int Connections { get; private set; }
+
+            public byte[] Received
+            {
+                get
+                {
+                    lock (this.received)
+                    {
+                        return this.received.ToArray();
+                    }
+                }
+            }
+
+            public bool WaitForReceived(int length, int timeout)
+            {
+                DateTime deadline = DateTime.Now.AddMilliseconds(timeout);
+                while (DateTime.Now < deadline)
+                {
+                    if (this.Received.Length >= length)
+                    {
+                        return true;
+                    }
+
+                    Thread.Sleep(10);
+                }
+
+                return false;
+            }
+
+            public void Dispose()
+            {
+                this.listener.Stop();
+            }
+
+            private void AcceptProc()
+            {
+                try
+                {
+                    while (true)
+                    {
+                        TcpClient client = this.listener.AcceptTcpClient();
+                        ++this.Connections;
+                        Thread clientThread = new Thread(this.ClientProc);
+                        clientThread.IsBackground = true;
+                        clientThread.Start(client);
+                    }
+                }
+                catch (SocketException)
+                {
+                }
+            }
+
+            private void ClientProc(object state)
+            {
+                using (TcpClient client = (TcpClient)state)
+                {
+                    try
+                    {
+                        Stream stream = client.GetStream();
+
+                        // request headers
+                        while (ReadLine(stream).Length > 0)
+                        {
+                        }
+
+                        // chunked body
+                        while (true)
+                        {
+                            int chunkSize = Convert.ToInt32(ReadLine(stream).Split(';')[0], 16);
+                            if (chunkSize == 0)
+                            {
+                                break;
+                            }
+
+                            byte[] chunk = new byte[chunkSize];
+                            int offset = 0;
+                            while (offset < chunkSize)
+                            {
+                                int read = stream.Read(chunk, offset, chunkSize - offset);
+                                if (read <= 0)
+                                {
+                                    return;
+                                }
+
+                                offset += read;
+                            }
+
+                            lock (this.received)
+                            {
+                                this.received.AddRange(chunk);
+                            }
+
+                            ReadLine(stream);
+                        }
+                    }
+                    catch (IOException)
+                    {
+                    }
+                }
+            }
+
+            private static string ReadLine(Stream stream)
+            {
+                StringBuilder line = new StringBuilder();
+                while (true)
+                {
+                    int b = stream.ReadByte();
+                    if (b < 0)
+                    {
+                        throw new IOException("Connection closed");
+                    }
+
+                    if (b == '\n')
+                    {
+                        return line.ToString().TrimEnd('\r');
+                    }
+
+                    line.Append((char)b);
+                }
+            }
+        }
+
+        private static int GetFreePort()
+        {
+            TcpListener listener = new TcpListener(IPAddress.Loopback, 0);
+            listener.Start();
+            int port = ((IPEndPoint)listener.LocalEndpoint).Port;
+            listener.Stop();
+            return port;
+        }
+
+        private static void Push(SmoothStreamingUploader target, byte[] data, bool header)
+        {
+            GCHandle handle = GCHandle.Alloc(data, GCHandleType.Pinned);
+            try
+            {
+                if (header)
+                {
+                    target.SetHeader(handle.AddrOfPinnedObject(), data.Length);
+                }
+                else
+                {
+                    target.PushData(handle.AddrOfPinnedObject(), data.Length);
+                }
+            }
+            finally
+            {
+                handle.Free();
+            }
+        }
+
+        /// <summary>
+        ///A test for PushData
+        ///</summary>
+        [TestMethod()]
+        public void PushDataTest()
+        {
+            using (PublishingPointStub server = new PublishingPointStub(0))
+            using (SmoothStreamingUploader target = new SmoothStreamingUploader(string.Format("http://127.0.0.1:{0}/pp.isml/Streams(0)", server.Port), 16))
+            {
+                Push(target, new byte[] { 1, 2, 3 }, true);
+                Push(target, new byte[] { 4, 5 }, false);
+                Push(target, new byte[] { 6 }, false);
+
+                Assert.IsTrue(server.WaitForReceived(6, 10000));
+                CollectionAssert.AreEqual(new byte[] { 1, 2, 3, 4, 5, 6 }, server.Received);
+                Assert.AreEqual(1, server.Connections);
+                Assert.AreEqual(2L, target.UploadedFragments);
+                Assert.AreEqual(0L, target.DroppedFragments);
+            }
+        }
+
+        /// <summary>
+        ///A test for PushData while the publishing point is unreachable
+        ///</summary>
+        [TestMethod()]
+        public void PushDataReconnectTest()
+        {
+            int port = GetFreePort();
+            using (SmoothStreamingUploader target = new SmoothStreamingUploader(string.Format("http://127.0.0.1:{0}/pp.isml/Streams(0)", port), 16))
+            {
+                Push(target, new byte[] { 1 }, true);
+                Push(target, new byte[] { 2 }, false);
+                Push(target, new byte[] { 3 }, false);
+                Assert.AreEqual(2, target.QueuedFragments);
+
+                // fragments queued while disconnected are sent after the header once the server is up
+                using (PublishingPointStub server = new PublishingPointStub(port))
+                {
+                    Assert.IsTrue(server.WaitForReceived(3, 30000));
+                    CollectionAssert.AreEqual(new byte[] { 1, 2, 3 }, server.Received);
+                    Assert.AreEqual(0, target.QueuedFragments);
+                }
+            }
+        }
+
+        /// <summary>
+        ///A test for PushData with full queue
+        ///</summary>
+        [TestMethod()]
+        public void PushDataQueueFullTest()
+        {
+            int port = GetFreePort();
+            using (SmoothStreamingUploader target = new SmoothStreamingUploader(string.Format("http://127.0.0.1:{0}/pp.isml/Streams(0)", port), 4))
+            {
+                Push(target, new byte[] { 1 }, true);
+
+                DateTime start = DateTime.Now;
+                for (byte i = 0; i < 10; ++i)
+                {
+                    Push(target, new byte[] { i }, false);
+                }
+
+                // pushing never waits for the network
+                Assert.IsTrue((DateTime.Now - start).TotalMilliseconds < 1000);
+                Assert.AreEqual(4, target.QueuedFragments);
+                Assert.AreEqual(6L, target.DroppedFragments);
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+﻿using MComms_Transmuxer;
+using MComms_Transmuxer.Common;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Diagnostics;
+using System.Linq;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for StreamStatisticsTest and is intended
+    ///to contain all StreamStatisticsTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class StreamStatisticsTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///A test for Open and Close
+        ///</summary>
+        [TestMethod()]
+        public void OpenCloseTest()
+        {
+            StreamStatistics first = StreamStatistics.Open("test.isml", "test1");
+            StreamStatistics second = StreamStatistics.Open("test.isml", "test1");
+
+            Assert.AreSame(first, second);
+            Assert.IsTrue(first.Active);
+            Assert.IsTrue(StreamStatistics.GetAll().Contains(first));
+
+            first.Close();
+            Assert.IsTrue(second.Active);
+            second.Close();
+            Assert.IsFalse(second.Active);
+
+            // kept for a while after the stream has stopped
+            StreamStatistics.UpdateAll();
+            Assert.IsTrue(StreamStatistics.GetAll().Contains(first));
+        }
+
+        /// <summary>
+        ///A test for Record
+        ///</summary>
+        [TestMethod()]
+        public void RecordTest()
+        {
+            StreamStatistics target = new StreamStatistics("test.isml", "test2");
+
+            target.Record(PipelineStage.Mux, Stopwatch.GetTimestamp() - Stopwatch.Frequency / 100);
+            target.AddReceivedBytes(1000);
+
+            Assert.AreEqual(1L, target.GetHistogram(PipelineStage.Mux).Count);
+            Assert.IsTrue(target.GetHistogram(PipelineStage.Mux).Max >= 10000);
+            Assert.AreEqual(0L, target.GetHistogram(PipelineStage.Upload).Count);
+            Assert.AreEqual(1000L, target.ReceivedBytes);
+
+            target.Reset();
+            Assert.AreEqual(0L, target.GetHistogram(PipelineStage.Mux).Count);
+            Assert.AreEqual(1000L, target.ReceivedBytes);
+        }
+    }
+}
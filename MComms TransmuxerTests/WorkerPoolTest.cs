@@ -0,0 +1,192 @@
+﻿using MComms_Transmuxer.Common;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Threading;
+
+namespace MComms_TransmuxerTests
+{
+    
+    
+    /// <summary>
+    ///This is a test class for WorkerPoolTest and is intended
+    ///to contain all WorkerPoolTest Unit Tests
+    ///</summary>
+    [TestClass()]
+    public class WorkerPoolTest
+    {
+
+
+        private TestContext testContextInstance;
+
+        /// <summary>
+        ///Gets or sets the test context which provides
+        ///information about and functionality for the current test run.
+        ///</summary>
+        public TestContext TestContext
+        {
+            get
+            {
+                return testContextInstance;
+            }
+            set
+            {
+                testContextInstance = value;
+            }
+        }
+
+        #region Additional test attributes
+        // 
+        //You can use the following additional attributes as you write your tests:
+        //
+        //Use ClassInitialize to run code before running the first test in the class
+        //[ClassInitialize()]
+        //public static void MyClassInitialize(TestContext testContext)
+        //{
+        //}
+        //
+        //Use ClassCleanup to run code after all tests in a class have run
+        //[ClassCleanup()]
+        //public static void MyClassCleanup()
+        //{
+        //}
+        //
+        //Use TestInitialize to run code before running each test
+        //[TestInitialize()]
+        //public void MyTestInitialize()
+        //{
+        //}
+        //
+        //Use TestCleanup to run code after each test has run
+        //[TestCleanup()]
+        //public void MyTestCleanup()
+        //{
+        //}
+        //
+        #endregion
+
+
+        /// <summary>
+        ///A test for ScheduledWork.Schedule while the work is running
+        ///</summary>
+        [TestMethod()]
+        public void ScheduleWhileRunningTest()
+        {
+            WorkerPool pool = new WorkerPool("Test", 2);
+            ManualResetEvent started = new ManualResetEvent(false);
+            ManualResetEvent gate = new ManualResetEvent(false);
+            int runs = 0;
+
+            ScheduledWork target = new ScheduledWork(pool, () =>
+            {
+                if (Interlocked.Increment(ref runs) == 1)
+                {
+                    started.Set();
+                    gate.WaitOne();
+                }
+            });
+
+            target.Schedule();
+            started.WaitOne();
+
+            // scheduling a running work several times makes it run once more
+            target.Schedule();
+            target.Schedule();
+            target.Schedule();
+            gate.Set();
+
+            pool.Dispose();
+            Assert.AreEqual(2, runs);
+        }
+
+        /// <summary>
+        ///A test for WorkerPool running many works from many threads
+        ///</summary>
+        [TestMethod()]
+        public void RunsNeverOverlapTest()
+        {
+            const int WorkCount = 16;
+            const int ScheduleCount = 1000;
+
+            WorkerPool pool = new WorkerPool("Test", 4);
+            int[] pending = new int[WorkCount];
+            int[] running = new int[WorkCount];
+            int overlaps = 0;
+            ScheduledWork[] works = new ScheduledWork[WorkCount];
+
+            for (int i = 0; i < WorkCount; ++i)
+            {
+                int index = i;
+                works[i] = new ScheduledWork(pool, () =>
+                {
+                    if (Interlocked.Increment(ref running[index]) != 1)
+                    {
+                        Interlocked.Increment(ref overlaps);
+                    }
+
+                    // takes everything scheduled so far, like a session draining its queue
+                    Interlocked.Exchange(ref pending[index], 0);
+                    Interlocked.Decrement(ref running[index]);
+                });
+            }
+
+            Thread[] threads = new Thread[4];
+            for (int t = 0; t < threads.Length; ++t)
+            {
+                threads[t] = new Thread(() =>
+                {
+                    for (int n = 0; n < ScheduleCount; ++n)
+                    {
+                        int index = n % WorkCount;
+                        Interlocked.Increment(ref pending[index]);
+                        works[index].Schedule();
+                    }
+                });
+                threads[t].Start();
+            }
+
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+
+            pool.Dispose();
+
+            Assert.AreEqual(0, overlaps);
+            for (int i = 0; i < WorkCount; ++i)
+            {
+                Assert.AreEqual(0, pending[i], "work {0} has unprocessed schedules", i);
+            }
+        }
+
+        /// <summary>
+        ///A test for ScheduledWork.Close
+        ///</summary>
+        [TestMethod()]
+        public void CloseTest()
+        {
+            WorkerPool pool = new WorkerPool("Test", 1);
+            ManualResetEvent started = new ManualResetEvent(false);
+            int runs = 0;
+            bool finished = false;
+
+            ScheduledWork target = new ScheduledWork(pool, () =>
+            {
+                Interlocked.Increment(ref runs);
+                started.Set();
+                Thread.Sleep(200);
+                finished = true;
+            });
+
+            target.Schedule();
+            started.WaitOne();
+
+            // waits for the running action, later schedules are ignored
+            target.Close();
+            Assert.IsTrue(finished);
+            target.Schedule();
+
+            pool.Dispose();
+            Assert.AreEqual(1, runs);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "BoxWriter.h"
+
+#include <string.h>
+
+BoxWriter::BoxWriter(BYTE* pbBuffer, DWORD cbBuffer)
+    : m_pbBuffer(pbBuffer), m_cbBuffer(pbBuffer ? cbBuffer : 0), m_cbPosition(0), m_nDepth(0)
+{
+}
+
+BYTE* BoxWriter::Reserve(DWORD cbData)
+{
+    BYTE* pbResult = NULL;
+    if (m_pbBuffer != NULL && m_cbPosition + cbData <= m_cbBuffer)
+    {
+        pbResult = m_pbBuffer + m_cbPosition;
+    }
+
+    m_cbPosition += cbData;
+    return pbResult;
+}
+
+void BoxWriter::BeginBox(DWORD dwType)
+{
+    if (m_nDepth < BOXWRITER_MAX_DEPTH)
+    {
+        m_adwBoxStart[m_nDepth] = m_cbPosition;
+    }
+    ++m_nDepth;
+
+    // size is patched in EndBox
+    WriteUInt32(0);
+    WriteUInt32(dwType);
+}
+
+void BoxWriter::BeginFullBox(DWORD dwType, BYTE bVersion, DWORD dwFlags)
+{
+    BeginBox(dwType);
+    WriteUInt8(bVersion);
+    WriteUInt24(dwFlags);
+}
+
+void BoxWriter::BeginUuidBox(const BYTE* pbUuid)
+{
+    BeginBox(MAKEBOXTYPE('u', 'u', 'i', 'd'));
+    WriteBytes(pbUuid, 16);
+}
+
+void BoxWriter::BeginUuidFullBox(const BYTE* pbUuid, BYTE bVersion, DWORD dwFlags)
+{
+    BeginUuidBox(pbUuid);
+    WriteUInt8(bVersion);
+    WriteUInt24(dwFlags);
+}
+
+void BoxWriter::EndBox()
+{
+    if (m_nDepth <= 0)
+    {
+        return;
+    }
+
+    --m_nDepth;
+    if (m_nDepth < BOXWRITER_MAX_DEPTH)
+    {
+        DWORD dwStart = m_adwBoxStart[m_nDepth];
+        PatchUInt32(dwStart, m_cbPosition - dwStart);
+    }
+}
+
+void BoxWriter::WriteUInt8(BYTE bValue)
+{
+    BYTE* pb = Reserve(1);
+    if (pb)
+    {
+        pb[0] = bValue;
+    }
+}
+
+void BoxWriter::WriteUInt16(WORD wValue)
+{
+    BYTE* pb = Reserve(2);
+    if (pb)
+    {
+        pb[0] = (BYTE)(wValue >> 8);
+        pb[1] = (BYTE)(wValue);
+    }
+}
+
+void BoxWriter::WriteUInt24(DWORD dwValue)
+{
+    BYTE* pb = Reserve(3);
+    if (pb)
+    {
+        pb[0] = (BYTE)(dwValue >> 16);
+        pb[1] = (BYTE)(dwValue >> 8);
+        pb[2] = (BYTE)(dwValue);
+    }
+}
+
+void BoxWriter::WriteUInt32(DWORD dwValue)
+{
+    BYTE* pb = Reserve(4);
+    if (pb)
+    {
+        pb[0] = (BYTE)(dwValue >> 24);
+        pb[1] = (BYTE)(dwValue >> 16);
+        pb[2] = (BYTE)(dwValue >> 8);
+        pb[3] = (BYTE)(dwValue);
+    }
+}
+
+void BoxWriter::WriteUInt64(ULONGLONG qwValue)
+{
+    WriteUInt32((DWORD)(qwValue >> 32));
+    WriteUInt32((DWORD)(qwValue & 0xFFFFFFFF));
+}
+
+void BoxWriter::WriteBytes(const BYTE* pbData, DWORD cbData)
+{
+    BYTE* pb = Reserve(cbData);
+    if (pb && cbData > 0)
+    {
+        memcpy(pb, pbData, cbData);
+    }
+}
+
+void BoxWriter::WriteZeroes(DWORD cbData)
+{
+    BYTE* pb = Reserve(cbData);
+    if (pb && cbData > 0)
+    {
+        memset(pb, 0, cbData);
+    }
+}
+
+void BoxWriter::PatchUInt32(DWORD dwPosition, DWORD dwValue)
+{
+    if (m_pbBuffer != NULL && dwPosition + 4 <= m_cbBuffer)
+    {
+        BYTE* pb = m_pbBuffer + dwPosition;
+        pb[0] = (BYTE)(dwValue >> 24);
+        pb[1] = (BYTE)(dwValue >> 16);
+        pb[2] = (BYTE)(dwValue >> 8);
+        pb[3] = (BYTE)(dwValue);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#define MAKEBOXTYPE(a, b, c, d) ((DWORD)(((DWORD)(BYTE)(a) << 24) | ((DWORD)(BYTE)(b) << 16) | ((DWORD)(BYTE)(c) << 8) | (DWORD)(BYTE)(d)))
+
+#define BOXWRITER_MAX_DEPTH 16
+
+// Big-endian ISO BMFF box serializer writing into caller-provided memory.
+// When the buffer is missing or too small the writer keeps counting, so the
+// same code path can be used first to measure and then to write.
+class BoxWriter
+{
+public:
+    BoxWriter(BYTE* pbBuffer, DWORD cbBuffer);
+
+    void BeginBox(DWORD dwType);
+    void BeginFullBox(DWORD dwType, BYTE bVersion, DWORD dwFlags);
+    void BeginUuidBox(const BYTE* pbUuid);
+    void BeginUuidFullBox(const BYTE* pbUuid, BYTE bVersion, DWORD dwFlags);
+    void EndBox();
+
+    void WriteUInt8(BYTE bValue);
+    void WriteUInt16(WORD wValue);
+    void WriteUInt24(DWORD dwValue);
+    void WriteUInt32(DWORD dwValue);
+    void WriteUInt64(ULONGLONG qwValue);
+    void WriteBytes(const BYTE* pbData, DWORD cbData);
+    void WriteZeroes(DWORD cbData);
+
+    // Overwrites a 32 bit value at an absolute position that was written before
+    void PatchUInt32(DWORD dwPosition, DWORD dwValue);
+
+    DWORD GetPosition() const { return m_cbPosition; }
+    BOOL IsOverflow() const { return m_cbPosition > m_cbBuffer || m_pbBuffer == NULL; }
+
+private:
+    BoxWriter(const BoxWriter&);
+    BoxWriter& operator=(const BoxWriter&);
+
+    BYTE* Reserve(DWORD cbData);
+
+    BYTE* m_pbBuffer;
+    DWORD m_cbBuffer;
+    DWORD m_cbPosition;
+    DWORD m_adwBoxStart[BOXWRITER_MAX_DEPTH];
+    int m_nDepth;
+};
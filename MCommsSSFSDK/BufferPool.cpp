@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "BufferPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// header tags, tell buffers handed out from the ones sitting in the pool
+#define BUFFERPOOL_MAGIC_USED 0x4642504D // 'MPBF'
+#define BUFFERPOOL_MAGIC_FREE 0x6662706D // 'mpbf'
+
+static BufferPool g_pool;
+
+BufferPool& BufferPool::Instance()
+{
+    return g_pool;
+}
+
+BufferPool::BufferPool()
+{
+    InitializeCriticalSection(&m_cs);
+    ZeroMemory(m_apFree, sizeof(m_apFree));
+    ZeroMemory(&m_stats, sizeof(m_stats));
+}
+
+BufferPool::~BufferPool()
+{
+    // buffers still in use belong to their callers now
+    for (int nClass = 0; nClass < BUFFERPOOL_CLASS_COUNT; ++nClass)
+    {
+        while (m_apFree[nClass] != NULL)
+        {
+            BufferHeader* pHeader = m_apFree[nClass];
+            m_apFree[nClass] = pHeader->pNext;
+            free(pHeader);
+        }
+    }
+
+    DeleteCriticalSection(&m_cs);
+}
+
+int BufferPool::GetClass(DWORD cbSize)
+{
+    for (int nClass = 0; nClass < BUFFERPOOL_CLASS_COUNT; ++nClass)
+    {
+        if (cbSize <= GetClassSize(nClass))
+        {
+            return nClass;
+        }
+    }
+
+    return -1;
+}
+
+BYTE* BufferPool::Acquire(DWORD cbMinSize, DWORD* pcbSize)
+{
+    int nClass = GetClass(cbMinSize);
+    if (nClass < 0)
+    {
+        return NULL;
+    }
+
+    DWORD cbSize = GetClassSize(nClass);
+
+    EnterCriticalSection(&m_cs);
+
+    ++m_stats.qwAcquireCount;
+
+    BufferHeader* pHeader = m_apFree[nClass];
+    if (pHeader != NULL)
+    {
+        m_apFree[nClass] = pHeader->pNext;
+        AddInUse(cbSize);
+    }
+
+    LeaveCriticalSection(&m_cs);
+
+    if (pHeader == NULL)
+    {
+        // allocate outside of the lock, big allocations may take a while
+        pHeader = (BufferHeader*)malloc(HeaderSize + cbSize);
+        if (pHeader == NULL)
+        {
+            return NULL;
+        }
+
+        pHeader->nClass = nClass;
+
+        EnterCriticalSection(&m_cs);
+
+        m_blocks.insert(pHeader);
+
+        ++m_stats.qwAllocationCount;
+        ++m_stats.lBuffersAllocated;
+        m_stats.qwBytesAllocated += cbSize;
+
+        if (m_stats.lBuffersAllocated > m_stats.lHighWaterBuffersAllocated)
+        {
+            m_stats.lHighWaterBuffersAllocated = m_stats.lBuffersAllocated;
+        }
+
+        if (m_stats.qwBytesAllocated > m_stats.qwHighWaterBytesAllocated)
+        {
+            m_stats.qwHighWaterBytesAllocated = m_stats.qwBytesAllocated;
+        }
+
+        AddInUse(cbSize);
+
+        LeaveCriticalSection(&m_cs);
+    }
+
+    pHeader->dwMagic = BUFFERPOOL_MAGIC_USED;
+    pHeader->pNext = NULL;
+
+    *pcbSize = cbSize;
+    return (BYTE*)pHeader + HeaderSize;
+}
+
+void BufferPool::AddInUse(DWORD cbSize)
+{
+    ++m_stats.lBuffersInUse;
+    m_stats.qwBytesInUse += cbSize;
+
+    if (m_stats.lBuffersInUse > m_stats.lHighWaterBuffersInUse)
+    {
+        m_stats.lHighWaterBuffersInUse = m_stats.lBuffersInUse;
+    }
+
+    if (m_stats.qwBytesInUse > m_stats.qwHighWaterBytesInUse)
+    {
+        m_stats.qwHighWaterBytesInUse = m_stats.qwBytesInUse;
+    }
+}
+
+HRESULT BufferPool::Release(BYTE* pbBuffer)
+{
+    if (pbBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    BufferHeader* pHeader = (BufferHeader*)(pbBuffer - HeaderSize);
+
+    EnterCriticalSection(&m_cs);
+
+    // the header of a foreign pointer may not be readable, so look the block up first;
+    // the magic then catches a second release of the same buffer
+    if (m_blocks.find(pHeader) == m_blocks.end() || pHeader->dwMagic != BUFFERPOOL_MAGIC_USED)
+    {
+        LeaveCriticalSection(&m_cs);
+        return E_INVALIDARG;
+    }
+
+    pHeader->dwMagic = BUFFERPOOL_MAGIC_FREE;
+    pHeader->pNext = m_apFree[pHeader->nClass];
+    m_apFree[pHeader->nClass] = pHeader;
+
+    --m_stats.lBuffersInUse;
+    m_stats.qwBytesInUse -= GetClassSize(pHeader->nClass);
+
+    LeaveCriticalSection(&m_cs);
+
+    return S_OK;
+}
+
+void BufferPool::GetStats(BufferPoolStats* pStats)
+{
+    EnterCriticalSection(&m_cs);
+    *pStats = m_stats;
+    LeaveCriticalSection(&m_cs);
+}
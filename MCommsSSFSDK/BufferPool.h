@@ -0,0 +1,68 @@
+#pragma once
+
+#include <set>
+
+// smallest class is 64 KB, every next one doubles up to 64 MB
+#define BUFFERPOOL_MIN_CLASS_SHIFT  16
+#define BUFFERPOOL_CLASS_COUNT      11
+
+struct BufferPoolStats
+{
+    LONGLONG qwBytesAllocated;
+    LONGLONG qwBytesInUse;
+    LONGLONG qwHighWaterBytesAllocated;
+    LONGLONG qwHighWaterBytesInUse;
+    LONGLONG qwAcquireCount;
+    LONGLONG qwAllocationCount;
+    LONG lBuffersAllocated;
+    LONG lBuffersInUse;
+    LONG lHighWaterBuffersAllocated;
+    LONG lHighWaterBuffersInUse;
+};
+
+// Process-wide pool of fragment output buffers. Buffer sizes are rounded up to power of
+// two classes and released buffers are kept for reuse, so memory stays at the high-water
+// mark of concurrently used buffers instead of following every bitrate spike.
+class BufferPool
+{
+public:
+    BufferPool();
+    ~BufferPool();
+
+    // Returns buffer of at least cbMinSize bytes and its actual size,
+    // NULL when the size exceeds the biggest class or memory is exhausted
+    BYTE* Acquire(DWORD cbMinSize, DWORD* pcbSize);
+
+    // Returns buffer obtained from Acquire to the pool, E_INVALIDARG for foreign pointers
+    HRESULT Release(BYTE* pbBuffer);
+
+    void GetStats(BufferPoolStats* pStats);
+
+    static BufferPool& Instance();
+
+private:
+    struct BufferHeader
+    {
+        DWORD dwMagic;
+        int nClass;
+        BufferHeader* pNext;
+    };
+
+    // header is placed in front of the payload, rounded up to keep the payload aligned
+    enum { HeaderSize = 32 };
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    // updates in-use counters and their high-water marks, called under m_cs
+    void AddInUse(DWORD cbSize);
+
+    static int GetClass(DWORD cbSize);
+    static DWORD GetClassSize(int nClass) { return (DWORD)1 << (BUFFERPOOL_MIN_CLASS_SHIFT + nClass); }
+
+    CRITICAL_SECTION m_cs;
+    BufferHeader* m_apFree[BUFFERPOOL_CLASS_COUNT];
+    // every block allocated by the pool, Release checks pointers against it before touching the header
+    std::set<BufferHeader*> m_blocks;
+    BufferPoolStats m_stats;
+};
@@ -0,0 +1,735 @@
+#include "stdafx.h"
+#include "BoxWriter.h"
+#include "CodecConfig.h"
+#include "FragmentWriter.h"
+
+#include <string.h>
+
+using namespace std;
+
+// offsets inside MPEG2VIDEOINFO as it is laid out by the managed side
+#define MPEG2VI_BMI_WIDTH_OFFSET 76
+#define MPEG2VI_BMI_HEIGHT_OFFSET 80
+#define MPEG2VI_FLAGS_OFFSET 128
+#define MPEG2VI_SEQUENCE_HEADER_OFFSET 132
+
+// offsets inside WAVEFORMATEX
+#define WFX_CHANNELS_OFFSET 2
+#define WFX_SAMPLES_PER_SEC_OFFSET 4
+#define WFX_SIZE 18
+
+#define AVCC_MIN_SIZE 7
+#define AVC_NAL_TYPE_MASK 0x1F
+
+static const DWORD g_adwAacSampleRates[13] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+static CodecConfigCache g_cache;
+
+// Reads fixed size and Exp-Golomb coded fields, reads past the end return zeroes
+class BitReader
+{
+public:
+    BitReader(const BYTE* pbData, DWORD cbData)
+        : m_pbData(pbData), m_cbData(cbData), m_dwPosition(0), m_fOverflow(FALSE)
+    {
+    }
+
+    DWORD ReadBits(DWORD dwCount)
+    {
+        DWORD dwValue = 0;
+        for (DWORD i = 0; i < dwCount; ++i)
+        {
+            if (m_dwPosition >= m_cbData * 8)
+            {
+                m_fOverflow = TRUE;
+                return 0;
+            }
+
+            dwValue = (dwValue << 1) | ((m_pbData[m_dwPosition >> 3] >> (7 - (m_dwPosition & 7))) & 1);
+            ++m_dwPosition;
+        }
+
+        return dwValue;
+    }
+
+    DWORD ReadUE()
+    {
+        DWORD dwZeroes = 0;
+        while (ReadBits(1) == 0)
+        {
+            if (m_fOverflow || ++dwZeroes > 31)
+            {
+                m_fOverflow = TRUE;
+                return 0;
+            }
+        }
+
+        return ((1u << dwZeroes) - 1) + ReadBits(dwZeroes);
+    }
+
+    LONG ReadSE()
+    {
+        DWORD dwValue = ReadUE();
+        return (dwValue & 1) ? (LONG)((dwValue + 1) / 2) : -(LONG)(dwValue / 2);
+    }
+
+    BOOL IsOverflow() const { return m_fOverflow; }
+
+private:
+    const BYTE* m_pbData;
+    DWORD m_cbData;
+    DWORD m_dwPosition;
+    BOOL m_fOverflow;
+};
+
+static DWORD ReadLE16(const BYTE* pb)
+{
+    return (DWORD)pb[0] | ((DWORD)pb[1] << 8);
+}
+
+static DWORD ReadLE32(const BYTE* pb)
+{
+    return (DWORD)pb[0] | ((DWORD)pb[1] << 8) | ((DWORD)pb[2] << 16) | ((DWORD)pb[3] << 24);
+}
+
+static DWORD ReadBE(const BYTE* pb, DWORD cb)
+{
+    DWORD dwValue = 0;
+    for (DWORD i = 0; i < cb; ++i)
+    {
+        dwValue = (dwValue << 8) | pb[i];
+    }
+    return dwValue;
+}
+
+static void AppendHex(string& str, const BYTE* pbData, DWORD cbData)
+{
+    static const char szDigits[] = "0123456789ABCDEF";
+    for (DWORD i = 0; i < cbData; ++i)
+    {
+        str += szDigits[pbData[i] >> 4];
+        str += szDigits[pbData[i] & 0x0F];
+    }
+}
+
+// writes MPEG-4 descriptor tag and length (ISO/IEC 14496-1 expandable size)
+static void WriteDescriptorHeader(BoxWriter& writer, BYTE bTag, DWORD dwLength)
+{
+    writer.WriteUInt8(bTag);
+    if (dwLength < 0x80)
+    {
+        writer.WriteUInt8((BYTE)dwLength);
+    }
+    else
+    {
+        writer.WriteUInt8((BYTE)(0x80 | ((dwLength >> 21) & 0x7F)));
+        writer.WriteUInt8((BYTE)(0x80 | ((dwLength >> 14) & 0x7F)));
+        writer.WriteUInt8((BYTE)(0x80 | ((dwLength >> 7) & 0x7F)));
+        writer.WriteUInt8((BYTE)(dwLength & 0x7F));
+    }
+}
+
+static DWORD DescriptorHeaderSize(DWORD dwLength)
+{
+    return dwLength < 0x80 ? 2 : 5;
+}
+
+static void SkipScalingList(BitReader& reader, int nSize)
+{
+    LONG lLastScale = 8;
+    LONG lNextScale = 8;
+    for (int i = 0; i < nSize; ++i)
+    {
+        if (lNextScale != 0)
+        {
+            lNextScale = (lLastScale + reader.ReadSE() + 256) % 256;
+        }
+
+        lLastScale = lNextScale == 0 ? lLastScale : lNextScale;
+    }
+}
+
+// Picture size of SPS NAL unit (header byte included), cropping applied
+static HRESULT GetSpsDimensions(const BYTE* pbSps, DWORD cbSps, DWORD* pdwWidth, DWORD* pdwHeight)
+{
+    // drop emulation prevention bytes to get the RBSP
+    vector<BYTE> rbsp;
+    rbsp.reserve(cbSps);
+    for (DWORD i = 1; i < cbSps; ++i)
+    {
+        if (i + 2 < cbSps && pbSps[i] == 0 && pbSps[i + 1] == 0 && pbSps[i + 2] == 3)
+        {
+            rbsp.push_back(0);
+            rbsp.push_back(0);
+            i += 2;
+            continue;
+        }
+
+        rbsp.push_back(pbSps[i]);
+    }
+
+    if (rbsp.empty())
+    {
+        return E_INVALIDARG;
+    }
+
+    BitReader reader(&rbsp[0], (DWORD)rbsp.size());
+
+    DWORD dwProfile = reader.ReadBits(8);
+    reader.ReadBits(16); // constraint flags and level
+    reader.ReadUE(); // seq_parameter_set_id
+
+    DWORD dwChromaFormat = 1;
+    BOOL fSeparateColourPlanes = FALSE;
+    if (dwProfile == 100 || dwProfile == 110 || dwProfile == 122 || dwProfile == 244 || dwProfile == 44 ||
+        dwProfile == 83 || dwProfile == 86 || dwProfile == 118 || dwProfile == 128 || dwProfile == 138 ||
+        dwProfile == 139 || dwProfile == 134 || dwProfile == 135)
+    {
+        dwChromaFormat = reader.ReadUE();
+        if (dwChromaFormat == 3)
+        {
+            fSeparateColourPlanes = reader.ReadBits(1);
+        }
+
+        reader.ReadUE(); // bit_depth_luma_minus8
+        reader.ReadUE(); // bit_depth_chroma_minus8
+        reader.ReadBits(1); // qpprime_y_zero_transform_bypass_flag
+
+        if (reader.ReadBits(1)) // seq_scaling_matrix_present_flag
+        {
+            int nLists = dwChromaFormat != 3 ? 8 : 12;
+            for (int i = 0; i < nLists; ++i)
+            {
+                if (reader.ReadBits(1))
+                {
+                    SkipScalingList(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+
+    reader.ReadUE(); // log2_max_frame_num_minus4
+
+    DWORD dwPocType = reader.ReadUE();
+    if (dwPocType == 0)
+    {
+        reader.ReadUE(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (dwPocType == 1)
+    {
+        reader.ReadBits(1); // delta_pic_order_always_zero_flag
+        reader.ReadSE(); // offset_for_non_ref_pic
+        reader.ReadSE(); // offset_for_top_to_bottom_field
+        DWORD dwCycle = reader.ReadUE();
+        for (DWORD i = 0; i < dwCycle && !reader.IsOverflow(); ++i)
+        {
+            reader.ReadSE();
+        }
+    }
+
+    reader.ReadUE(); // max_num_ref_frames
+    reader.ReadBits(1); // gaps_in_frame_num_value_allowed_flag
+
+    DWORD dwWidthInMbs = reader.ReadUE() + 1;
+    DWORD dwHeightInMapUnits = reader.ReadUE() + 1;
+    DWORD dwFrameMbsOnly = reader.ReadBits(1);
+    if (!dwFrameMbsOnly)
+    {
+        reader.ReadBits(1); // mb_adaptive_frame_field_flag
+    }
+
+    reader.ReadBits(1); // direct_8x8_inference_flag
+
+    DWORD adwCrop[4] = { 0, 0, 0, 0 }; // left, right, top, bottom
+    if (reader.ReadBits(1))
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            adwCrop[i] = reader.ReadUE();
+        }
+    }
+
+    if (reader.IsOverflow())
+    {
+        return E_INVALIDARG;
+    }
+
+    // crop units depend on chroma subsampling
+    DWORD dwCropUnitX = 1;
+    DWORD dwCropUnitY = 2 - dwFrameMbsOnly;
+    if (dwChromaFormat != 0 && !fSeparateColourPlanes)
+    {
+        dwCropUnitX = dwChromaFormat == 3 ? 1 : 2;
+        dwCropUnitY *= dwChromaFormat == 1 ? 2 : 1;
+    }
+
+    DWORD dwWidth = dwWidthInMbs * 16;
+    DWORD dwHeight = (2 - dwFrameMbsOnly) * dwHeightInMapUnits * 16;
+    DWORD dwCropX = dwCropUnitX * (adwCrop[0] + adwCrop[1]);
+    DWORD dwCropY = dwCropUnitY * (adwCrop[2] + adwCrop[3]);
+    if (dwCropX >= dwWidth || dwCropY >= dwHeight)
+    {
+        return E_INVALIDARG;
+    }
+
+    *pdwWidth = dwWidth - dwCropX;
+    *pdwHeight = dwHeight - dwCropY;
+
+    return S_OK;
+}
+
+CodecConfig::CodecConfig()
+    : m_lRefCount(1)
+{
+    ZeroMemory(&m_params, sizeof(m_params));
+    ZeroMemory(&m_requested, sizeof(m_requested));
+}
+
+HRESULT CodecConfig::Create(const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig, CodecConfig** ppConfig)
+{
+    *ppConfig = NULL;
+
+    if (pbConfig == NULL || cbConfig == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    CodecConfig* pConfig = new CodecConfig();
+    pConfig->m_params = *pParams;
+    pConfig->m_requested = *pParams;
+    pConfig->m_config.assign(pbConfig, pbConfig + cbConfig);
+
+    HRESULT hr = E_INVALIDARG;
+    if (pParams->nStreamType == FRAGMENT_STREAM_VIDEO)
+    {
+        hr = pConfig->ParseAvcConfig();
+    }
+    else if (pParams->nStreamType == FRAGMENT_STREAM_AUDIO)
+    {
+        hr = pConfig->ParseAudioConfig();
+    }
+
+    if (FAILED(hr))
+    {
+        pConfig->Release();
+        return hr;
+    }
+
+    pConfig->BuildSampleEntry();
+
+    *ppConfig = pConfig;
+    return S_OK;
+}
+
+HRESULT CodecConfig::CreateFromTypeInfo(int nStreamType, int nBitrate, const BYTE* pbTypeInfo, DWORD cbTypeInfo, CodecConfig** ppConfig)
+{
+    *ppConfig = NULL;
+
+    if (pbTypeInfo == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    CodecParameters params;
+    ZeroMemory(&params, sizeof(params));
+    params.nStreamType = nStreamType;
+    params.nBitrate = nBitrate;
+
+    if (nStreamType == FRAGMENT_STREAM_AUDIO)
+    {
+        if (cbTypeInfo <= WFX_SIZE)
+        {
+            return E_INVALIDARG;
+        }
+
+        params.wChannels = (WORD)ReadLE16(pbTypeInfo + WFX_CHANNELS_OFFSET);
+        params.dwSampleRate = ReadLE32(pbTypeInfo + WFX_SAMPLES_PER_SEC_OFFSET);
+
+        return Create(&params, pbTypeInfo + WFX_SIZE, cbTypeInfo - WFX_SIZE, ppConfig);
+    }
+
+    if (nStreamType != FRAGMENT_STREAM_VIDEO || cbTypeInfo < MPEG2VI_SEQUENCE_HEADER_OFFSET)
+    {
+        return E_INVALIDARG;
+    }
+
+    params.dwWidth = ReadLE32(pbTypeInfo + MPEG2VI_BMI_WIDTH_OFFSET);
+    params.dwHeight = ReadLE32(pbTypeInfo + MPEG2VI_BMI_HEIGHT_OFFSET);
+
+    DWORD dwNalLength = ReadLE32(pbTypeInfo + MPEG2VI_FLAGS_OFFSET);
+    if (dwNalLength < 1 || dwNalLength > 4)
+    {
+        return E_INVALIDARG;
+    }
+
+    // sequence header is SPS followed by PPS, each prefixed with NAL unit length,
+    // they are repacked into AVCDecoderConfigurationRecord
+    vector<BYTE> config;
+    config.push_back(1);
+    config.push_back(0); // profile, compatibility and level are copied from the SPS below
+    config.push_back(0);
+    config.push_back(0);
+    config.push_back((BYTE)(0xFC | (dwNalLength - 1)));
+
+    const BYTE* pb = pbTypeInfo + MPEG2VI_SEQUENCE_HEADER_OFFSET;
+    const BYTE* pbEnd = pbTypeInfo + cbTypeInfo;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (pb + dwNalLength > pbEnd)
+        {
+            return E_INVALIDARG;
+        }
+
+        DWORD cbUnit = ReadBE(pb, dwNalLength);
+        pb += dwNalLength;
+        if (cbUnit == 0 || cbUnit > 0xFFFF || pb + cbUnit > pbEnd)
+        {
+            return E_INVALIDARG;
+        }
+
+        if (i == 0)
+        {
+            if (cbUnit < 4)
+            {
+                return E_INVALIDARG;
+            }
+
+            config[1] = pb[1];
+            config[2] = pb[2];
+            config[3] = pb[3];
+        }
+
+        config.push_back(i == 0 ? 0xE1 : 1);
+        config.push_back((BYTE)(cbUnit >> 8));
+        config.push_back((BYTE)cbUnit);
+        config.insert(config.end(), pb, pb + cbUnit);
+        pb += cbUnit;
+    }
+
+    return Create(&params, &config[0], (DWORD)config.size(), ppConfig);
+}
+
+void CodecConfig::AddRef()
+{
+    InterlockedIncrement(&m_lRefCount);
+}
+
+void CodecConfig::Release()
+{
+    if (InterlockedDecrement(&m_lRefCount) == 0)
+    {
+        delete this;
+    }
+}
+
+BOOL CodecConfig::Matches(const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig) const
+{
+    return m_requested.nStreamType == pParams->nStreamType && m_requested.nBitrate == pParams->nBitrate &&
+        m_requested.dwWidth == pParams->dwWidth && m_requested.dwHeight == pParams->dwHeight &&
+        m_requested.wChannels == pParams->wChannels && m_requested.dwSampleRate == pParams->dwSampleRate &&
+        m_config.size() == cbConfig && memcmp(&m_config[0], pbConfig, cbConfig) == 0;
+}
+
+HRESULT CodecConfig::ParseAvcConfig()
+{
+    const BYTE* pb = &m_config[0];
+    DWORD cb = (DWORD)m_config.size();
+
+    if (cb < AVCC_MIN_SIZE || pb[0] != 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    // the manifest carries the first SPS and PPS as Annex B stream
+    const BYTE* pbSps = NULL;
+    DWORD cbSps = 0;
+    const BYTE* pbPps = NULL;
+    DWORD cbPps = 0;
+
+    DWORD dwOffset = 5;
+    for (int nSet = 0; nSet < 2; ++nSet)
+    {
+        if (dwOffset >= cb)
+        {
+            return E_INVALIDARG;
+        }
+
+        DWORD dwCount = nSet == 0 ? (pb[dwOffset] & AVC_NAL_TYPE_MASK) : pb[dwOffset];
+        ++dwOffset;
+        if (dwCount == 0)
+        {
+            return E_INVALIDARG;
+        }
+
+        for (DWORD i = 0; i < dwCount; ++i)
+        {
+            if (dwOffset + 2 > cb)
+            {
+                return E_INVALIDARG;
+            }
+
+            DWORD cbUnit = ReadBE(pb + dwOffset, 2);
+            dwOffset += 2;
+            if (cbUnit == 0 || dwOffset + cbUnit > cb)
+            {
+                return E_INVALIDARG;
+            }
+
+            if (i == 0)
+            {
+                if (nSet == 0)
+                {
+                    pbSps = pb + dwOffset;
+                    cbSps = cbUnit;
+                }
+                else
+                {
+                    pbPps = pb + dwOffset;
+                    cbPps = cbUnit;
+                }
+            }
+
+            dwOffset += cbUnit;
+        }
+    }
+
+    if (m_params.dwWidth == 0 || m_params.dwHeight == 0)
+    {
+        HRESULT hr = GetSpsDimensions(pbSps, cbSps, &m_params.dwWidth, &m_params.dwHeight);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    m_codecPrivateData = "00000001";
+    AppendHex(m_codecPrivateData, pbSps, cbSps);
+    m_codecPrivateData += "00000001";
+    AppendHex(m_codecPrivateData, pbPps, cbPps);
+
+    return S_OK;
+}
+
+HRESULT CodecConfig::ParseAudioConfig()
+{
+    BitReader reader(&m_config[0], (DWORD)m_config.size());
+
+    DWORD dwObjectType = reader.ReadBits(5);
+    if (dwObjectType == 31)
+    {
+        dwObjectType = 32 + reader.ReadBits(6);
+    }
+
+    DWORD dwSampleRate = 0;
+    DWORD dwFrequencyIndex = reader.ReadBits(4);
+    if (dwFrequencyIndex == 15)
+    {
+        dwSampleRate = reader.ReadBits(24);
+    }
+    else if (dwFrequencyIndex < sizeof(g_adwAacSampleRates) / sizeof(g_adwAacSampleRates[0]))
+    {
+        dwSampleRate = g_adwAacSampleRates[dwFrequencyIndex];
+    }
+
+    // 0 means the layout is defined by a program config element, 7 is 7.1
+    DWORD dwChannelConfig = reader.ReadBits(4);
+    WORD wChannels = (WORD)(dwChannelConfig == 7 ? 8 : dwChannelConfig < 7 ? dwChannelConfig : 0);
+
+    if (reader.IsOverflow() || dwObjectType == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // FLV audio headers always claim 44.1 kHz stereo for AAC, the config is what counts
+    if (dwSampleRate != 0)
+    {
+        m_params.dwSampleRate = dwSampleRate;
+    }
+
+    if (wChannels != 0)
+    {
+        m_params.wChannels = wChannels;
+    }
+
+    if (m_params.dwSampleRate == 0 || m_params.wChannels == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    AppendHex(m_codecPrivateData, &m_config[0], (DWORD)m_config.size());
+
+    return S_OK;
+}
+
+void CodecConfig::BuildSampleEntry()
+{
+    // first pass measures, second one writes
+    for (int nPass = 0; nPass < 2; ++nPass)
+    {
+        BoxWriter writer(nPass == 0 ? NULL : &m_sampleEntry[0], (DWORD)m_sampleEntry.size());
+
+        if (m_params.nStreamType == FRAGMENT_STREAM_VIDEO)
+        {
+            writer.BeginBox(MAKEBOXTYPE('a', 'v', 'c', '1'));
+            writer.WriteZeroes(6);
+            writer.WriteUInt16(1); // data reference index
+            writer.WriteZeroes(16);
+            writer.WriteUInt16((WORD)m_params.dwWidth);
+            writer.WriteUInt16((WORD)m_params.dwHeight);
+            writer.WriteUInt32(0x00480000); // 72 dpi
+            writer.WriteUInt32(0x00480000);
+            writer.WriteUInt32(0);
+            writer.WriteUInt16(1); // frame count
+            writer.WriteZeroes(32); // compressor name
+            writer.WriteUInt16(0x0018); // depth
+            writer.WriteUInt16(0xFFFF);
+
+            writer.BeginBox(MAKEBOXTYPE('a', 'v', 'c', 'C'));
+            writer.WriteBytes(&m_config[0], (DWORD)m_config.size());
+            writer.EndBox();
+
+            writer.EndBox();
+        }
+        else
+        {
+            writer.BeginBox(MAKEBOXTYPE('m', 'p', '4', 'a'));
+            writer.WriteZeroes(6);
+            writer.WriteUInt16(1); // data reference index
+            writer.WriteZeroes(8);
+            writer.WriteUInt16(m_params.wChannels);
+            writer.WriteUInt16(GetBitsPerSample());
+            writer.WriteUInt16(0);
+            writer.WriteUInt16(0);
+            // 16.16 field can't hold 88.2 and 96 kHz, the real rate is carried by the esds then
+            writer.WriteUInt32(m_params.dwSampleRate <= 0xFFFF ? m_params.dwSampleRate << 16 : 0);
+
+            DWORD cbConfig = (DWORD)m_config.size();
+            DWORD cbDecoderSpecificInfo = cbConfig;
+            DWORD cbDecoderConfig = 13 + DescriptorHeaderSize(cbDecoderSpecificInfo) + cbDecoderSpecificInfo;
+            DWORD cbSLConfig = 1;
+            DWORD cbES = 3 + DescriptorHeaderSize(cbDecoderConfig) + cbDecoderConfig + DescriptorHeaderSize(cbSLConfig) + cbSLConfig;
+
+            writer.BeginFullBox(MAKEBOXTYPE('e', 's', 'd', 's'), 0, 0);
+
+            WriteDescriptorHeader(writer, 0x03, cbES); // ES_Descriptor
+            writer.WriteUInt16(0); // ES_ID is 0 in files (ISO/IEC 14496-14), the entry doesn't depend on the track
+            writer.WriteUInt8(0);
+
+            WriteDescriptorHeader(writer, 0x04, cbDecoderConfig); // DecoderConfigDescriptor
+            writer.WriteUInt8(0x40); // MPEG-4 audio
+            writer.WriteUInt8(0x15); // audio stream
+            writer.WriteUInt24(0); // buffer size
+            writer.WriteUInt32((DWORD)m_params.nBitrate);
+            writer.WriteUInt32((DWORD)m_params.nBitrate);
+
+            WriteDescriptorHeader(writer, 0x05, cbDecoderSpecificInfo); // DecoderSpecificInfo
+            writer.WriteBytes(&m_config[0], cbConfig);
+
+            WriteDescriptorHeader(writer, 0x06, cbSLConfig); // SLConfigDescriptor
+            writer.WriteUInt8(0x02);
+
+            writer.EndBox(); // esds
+            writer.EndBox(); // mp4a
+        }
+
+        if (nPass == 0)
+        {
+            m_sampleEntry.resize(writer.GetPosition());
+        }
+    }
+}
+
+CodecConfigCache& CodecConfigCache::Instance()
+{
+    return g_cache;
+}
+
+CodecConfigCache::CodecConfigCache()
+    : m_dwUseCounter(0)
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+CodecConfigCache::~CodecConfigCache()
+{
+    // writers still holding a configuration keep it alive
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        m_entries[i].pConfig->Release();
+    }
+
+    DeleteCriticalSection(&m_cs);
+}
+
+HRESULT CodecConfigCache::Acquire(const char* szKey, const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig, CodecConfig** ppConfig)
+{
+    *ppConfig = NULL;
+
+    if (szKey == NULL)
+    {
+        return CodecConfig::Create(pParams, pbConfig, cbConfig, ppConfig);
+    }
+
+    if (pbConfig == NULL || cbConfig == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    EnterCriticalSection(&m_cs);
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        Entry& entry = m_entries[i];
+        if (entry.key == szKey && entry.pConfig->Matches(pParams, pbConfig, cbConfig))
+        {
+            entry.dwLastUse = ++m_dwUseCounter;
+            entry.pConfig->AddRef();
+            *ppConfig = entry.pConfig;
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&m_cs);
+
+    if (*ppConfig != NULL)
+    {
+        return S_OK;
+    }
+
+    // parse outside of the lock, a concurrent miss for the same configuration only costs a duplicate entry
+    CodecConfig* pConfig = NULL;
+    HRESULT hr = CodecConfig::Create(pParams, pbConfig, cbConfig, &pConfig);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    EnterCriticalSection(&m_cs);
+
+    if (m_entries.size() >= CODECCONFIG_CACHE_SIZE)
+    {
+        size_t nOldest = 0;
+        for (size_t i = 1; i < m_entries.size(); ++i)
+        {
+            if (m_entries[i].dwLastUse < m_entries[nOldest].dwLastUse)
+            {
+                nOldest = i;
+            }
+        }
+
+        m_entries[nOldest].pConfig->Release();
+        m_entries.erase(m_entries.begin() + nOldest);
+    }
+
+    Entry entry;
+    entry.key = szKey;
+    entry.pConfig = pConfig;
+    entry.dwLastUse = ++m_dwUseCounter;
+    pConfig->AddRef();
+    m_entries.push_back(entry);
+
+    LeaveCriticalSection(&m_cs);
+
+    *ppConfig = pConfig;
+    return S_OK;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#define CODECCONFIG_CACHE_SIZE 256
+
+// Everything the stream header needs to know about the codec of one track
+struct CodecParameters
+{
+    int nStreamType;
+    int nBitrate;
+    DWORD dwWidth;
+    DWORD dwHeight;
+    WORD wChannels;
+    DWORD dwSampleRate;
+};
+
+// Codec configuration of one track built from the AVCDecoderConfigurationRecord (video) or
+// AudioSpecificConfig (audio) as carried by FLV sequence headers. Parsing happens once: the
+// stsd sample entry and the CodecPrivateData string of the manifest are serialized up front
+// and only copied into headers afterwards.
+//
+// Objects are immutable once created and reference counted, so one instance can be shared by
+// the writers of all streams with the same configuration.
+class CodecConfig
+{
+public:
+    // Video dimensions are taken from the SPS when dwWidth/dwHeight are 0. Audio format is
+    // taken from the AudioSpecificConfig, wChannels/dwSampleRate are used when it doesn't
+    // define them. Returns E_INVALIDARG for malformed configurations.
+    static HRESULT Create(const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig, CodecConfig** ppConfig);
+
+    // Same from MPEG2VIDEOINFO (video) or WAVEFORMATEX (audio) type info
+    static HRESULT CreateFromTypeInfo(int nStreamType, int nBitrate, const BYTE* pbTypeInfo, DWORD cbTypeInfo, CodecConfig** ppConfig);
+
+    void AddRef();
+    void Release();
+
+    BOOL Matches(const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig) const;
+
+    int GetStreamType() const { return m_params.nStreamType; }
+    int GetBitrate() const { return m_params.nBitrate; }
+    DWORD GetWidth() const { return m_params.dwWidth; }
+    DWORD GetHeight() const { return m_params.dwHeight; }
+    WORD GetChannels() const { return m_params.wChannels; }
+    DWORD GetSampleRate() const { return m_params.dwSampleRate; }
+    WORD GetBitsPerSample() const { return 16; }
+
+    // hex string for the CodecPrivateData manifest attribute
+    const std::string& GetCodecPrivateData() const { return m_codecPrivateData; }
+
+    // serialized avc1 or mp4a box
+    const BYTE* GetSampleEntry() const { return &m_sampleEntry[0]; }
+    DWORD GetSampleEntrySize() const { return (DWORD)m_sampleEntry.size(); }
+
+    // AVCDecoderConfigurationRecord or AudioSpecificConfig the object was created from
+    const BYTE* GetConfig() const { return &m_config[0]; }
+    DWORD GetConfigSize() const { return (DWORD)m_config.size(); }
+
+private:
+    CodecConfig();
+
+    CodecConfig(const CodecConfig&);
+    CodecConfig& operator=(const CodecConfig&);
+
+    HRESULT ParseAvcConfig();
+    HRESULT ParseAudioConfig();
+    void BuildSampleEntry();
+
+    volatile LONG m_lRefCount;
+
+    CodecParameters m_params;
+    CodecParameters m_requested; // parameters as passed to Create, the cache matches on these
+
+    // AVCDecoderConfigurationRecord or AudioSpecificConfig
+    std::vector<BYTE> m_config;
+
+    std::string m_codecPrivateData;
+    std::vector<BYTE> m_sampleEntry;
+};
+
+// Process-wide cache of codec configurations keyed by publishing point and configuration,
+// so a stream registered again (publisher reconnect, mux re-created for another bitrate)
+// reuses the already built header parts. Holds at most CODECCONFIG_CACHE_SIZE entries,
+// the least recently used one is dropped first.
+class CodecConfigCache
+{
+public:
+    CodecConfigCache();
+    ~CodecConfigCache();
+
+    // Returns a referenced configuration, the caller releases it. szKey may be NULL to bypass the cache.
+    HRESULT Acquire(const char* szKey, const CodecParameters* pParams, const BYTE* pbConfig, DWORD cbConfig, CodecConfig** ppConfig);
+
+    static CodecConfigCache& Instance();
+
+private:
+    struct Entry
+    {
+        std::string key;
+        CodecConfig* pConfig;
+        DWORD dwLastUse;
+    };
+
+    CodecConfigCache(const CodecConfigCache&);
+    CodecConfigCache& operator=(const CodecConfigCache&);
+
+    CRITICAL_SECTION m_cs;
+    std::vector<Entry> m_entries;
+    DWORD m_dwUseCounter;
+};
@@ -0,0 +1,510 @@
+#include "stdafx.h"
+#include "BoxWriter.h"
+#include "CodecConfig.h"
+#include "FragmentWriter.h"
+
+#include <string.h>
+
+using namespace std;
+
+#define SMOOTH_TIMESCALE 10000000
+
+// trun sample flags
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+static const BYTE g_uuidLiveServerManifest[16] = { 0xA5, 0xD4, 0x0B, 0x30, 0xE8, 0x14, 0x11, 0xDD, 0xBA, 0x2F, 0x08, 0x00, 0x20, 0x0C, 0x9A, 0x66 };
+static const BYTE g_uuidTfxd[16] = { 0x6D, 0x1D, 0x9B, 0x05, 0x42, 0xD5, 0x44, 0xE6, 0x80, 0xE2, 0x14, 0x1D, 0xAF, 0xF7, 0x57, 0xB2 };
+
+static const DWORD g_matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+
+static void AppendParam(string& str, const char* szName, const string& value)
+{
+    str += "        <param name=\"";
+    str += szName;
+    str += "\" value=\"";
+    str += value;
+    str += "\" valuetype=\"data\" />\n";
+}
+
+static void AppendParam(string& str, const char* szName, DWORD dwValue)
+{
+    char szValue[16];
+    sprintf_s(szValue, sizeof(szValue), "%u", dwValue);
+    AppendParam(str, szName, string(szValue));
+}
+
+FragmentWriter::FragmentWriter()
+    : m_nStreamType(0), m_dwTrackId(0), m_wLanguage(0), m_pConfig(NULL),
+      m_dwSequenceNumber(1), m_qwFileOffset(0), m_fFileOffsetKnown(FALSE), m_fFragmentOpen(FALSE)
+{
+}
+
+FragmentWriter::~FragmentWriter()
+{
+    ReleaseSamples();
+
+    if (m_pConfig != NULL)
+    {
+        m_pConfig->Release();
+    }
+}
+
+void FragmentWriter::ReleaseSamples()
+{
+    for (size_t i = 0; i < m_samples.size(); ++i)
+    {
+        if (m_samples[i].pfnRelease != NULL)
+        {
+            m_samples[i].pfnRelease(m_samples[i].pvContext);
+        }
+    }
+
+    m_samples.clear();
+    m_payload.clear();
+}
+
+HRESULT FragmentWriter::Initialize(DWORD dwTrackId, WORD wLanguage, const char* szSourceName, CodecConfig* pConfig)
+{
+    if (pConfig == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_nStreamType = pConfig->GetStreamType();
+    m_dwTrackId = dwTrackId;
+    m_wLanguage = wLanguage;
+    m_sourceName = szSourceName ? szSourceName : "";
+
+    pConfig->AddRef();
+    m_pConfig = pConfig;
+
+    return S_OK;
+}
+
+HRESULT FragmentWriter::AddSample(LONGLONG rtStart, LONGLONG rtStop, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData)
+{
+    if (pbData == NULL && cbData > 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    SampleEntry sample;
+    sample.rtStart = rtStart;
+    sample.rtStop = rtStop;
+    sample.cbSize = cbData;
+    sample.dwOffset = (DWORD)m_payload.size();
+    sample.fKeyFrame = fKeyFrame;
+    sample.pbData = NULL;
+    sample.pfnRelease = NULL;
+    sample.pvContext = NULL;
+
+    m_payload.insert(m_payload.end(), pbData, pbData + cbData);
+    m_samples.push_back(sample);
+
+    return S_OK;
+}
+
+HRESULT FragmentWriter::AddSampleReference(LONGLONG rtStart, LONGLONG rtStop, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData, PFN_SAMPLE_RELEASE pfnRelease, void* pvContext)
+{
+    if (pbData == NULL && cbData > 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    SampleEntry sample;
+    sample.rtStart = rtStart;
+    sample.rtStop = rtStop;
+    sample.cbSize = cbData;
+    sample.dwOffset = 0;
+    sample.fKeyFrame = fKeyFrame;
+    sample.pbData = pbData;
+    sample.pfnRelease = pfnRelease;
+    sample.pvContext = pvContext;
+
+    m_samples.push_back(sample);
+
+    return S_OK;
+}
+
+HRESULT FragmentWriter::WriteHeader(BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    BoxWriter writer(pbOutput, cbOutput);
+    WriteHeaderBoxes(writer);
+
+    *pcbWritten = writer.GetPosition();
+    if (writer.IsOverflow())
+    {
+        return E_NOT_SUFFICIENT_BUFFER;
+    }
+
+    if (!m_fFileOffsetKnown)
+    {
+        m_qwFileOffset = writer.GetPosition();
+        m_fFileOffsetKnown = TRUE;
+    }
+
+    return S_OK;
+}
+
+void FragmentWriter::WriteHeaderBoxes(BoxWriter& writer)
+{
+    writer.BeginBox(MAKEBOXTYPE('f', 't', 'y', 'p'));
+    writer.WriteUInt32(MAKEBOXTYPE('i', 's', 'm', 'l'));
+    writer.WriteUInt32(1);
+    writer.WriteUInt32(MAKEBOXTYPE('p', 'i', 'f', 'f'));
+    writer.WriteUInt32(MAKEBOXTYPE('i', 's', 'o', '2'));
+    writer.EndBox();
+
+    WriteManifestBox(writer);
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'o', 'o', 'v'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('m', 'v', 'h', 'd'), 1, 0);
+    writer.WriteUInt64(0); // creation time
+    writer.WriteUInt64(0); // modification time
+    writer.WriteUInt32(SMOOTH_TIMESCALE);
+    writer.WriteUInt64(0); // duration is unknown for live
+    writer.WriteUInt32(0x00010000); // rate 1.0
+    writer.WriteUInt16(0x0100); // volume 1.0
+    writer.WriteZeroes(10);
+    for (int i = 0; i < 9; ++i)
+    {
+        writer.WriteUInt32(g_matrix[i]);
+    }
+    writer.WriteZeroes(24);
+    writer.WriteUInt32(m_dwTrackId + 1); // next track ID
+    writer.EndBox();
+
+    WriteTrackBox(writer);
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'v', 'e', 'x'));
+    writer.BeginFullBox(MAKEBOXTYPE('t', 'r', 'e', 'x'), 0, 0);
+    writer.WriteUInt32(m_dwTrackId);
+    writer.WriteUInt32(1); // sample description index
+    writer.WriteUInt32(0);
+    writer.WriteUInt32(0);
+    writer.WriteUInt32(0);
+    writer.EndBox();
+    writer.EndBox();
+
+    writer.EndBox();
+}
+
+void FragmentWriter::WriteManifestBox(BoxWriter& writer)
+{
+    string smil;
+    smil += "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+    smil += "<smil xmlns=\"http://www.w3.org/2001/SMIL20/Language\">\n";
+    smil += "  <head>\n";
+    smil += "    <meta name=\"creator\" content=\"pushEncoder\" />\n";
+    smil += "  </head>\n";
+    smil += "  <body>\n";
+    smil += "    <switch>\n";
+
+    char szBitrate[16];
+    sprintf_s(szBitrate, sizeof(szBitrate), "%d", m_pConfig->GetBitrate());
+
+    if (m_nStreamType == FRAGMENT_STREAM_VIDEO)
+    {
+        smil += "      <video src=\"" + m_sourceName + "\" systemBitrate=\"" + szBitrate + "\">\n";
+        AppendParam(smil, "trackID", m_dwTrackId);
+        AppendParam(smil, "FourCC", string("H264"));
+        AppendParam(smil, "CodecPrivateData", m_pConfig->GetCodecPrivateData());
+        AppendParam(smil, "MaxWidth", m_pConfig->GetWidth());
+        AppendParam(smil, "MaxHeight", m_pConfig->GetHeight());
+        AppendParam(smil, "DisplayWidth", m_pConfig->GetWidth());
+        AppendParam(smil, "DisplayHeight", m_pConfig->GetHeight());
+        AppendParam(smil, "Subtype", string("H264"));
+        smil += "      </video>\n";
+    }
+    else
+    {
+        smil += "      <audio src=\"" + m_sourceName + "\" systemBitrate=\"" + szBitrate + "\">\n";
+        AppendParam(smil, "trackID", m_dwTrackId);
+        AppendParam(smil, "FourCC", string("AACL"));
+        AppendParam(smil, "CodecPrivateData", m_pConfig->GetCodecPrivateData());
+        AppendParam(smil, "AudioTag", 255);
+        AppendParam(smil, "Channels", m_pConfig->GetChannels());
+        AppendParam(smil, "SamplingRate", m_pConfig->GetSampleRate());
+        AppendParam(smil, "BitsPerSample", m_pConfig->GetBitsPerSample());
+        AppendParam(smil, "PacketSize", 4);
+        AppendParam(smil, "Subtype", string("AACL"));
+        smil += "      </audio>\n";
+    }
+
+    smil += "    </switch>\n";
+    smil += "  </body>\n";
+    smil += "</smil>\n";
+
+    writer.BeginUuidFullBox(g_uuidLiveServerManifest, 0, 0);
+    writer.WriteBytes((const BYTE*)smil.c_str(), (DWORD)smil.size());
+    writer.EndBox();
+}
+
+void FragmentWriter::WriteTrackBox(BoxWriter& writer)
+{
+    BOOL fVideo = (m_nStreamType == FRAGMENT_STREAM_VIDEO);
+
+    writer.BeginBox(MAKEBOXTYPE('t', 'r', 'a', 'k'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('t', 'k', 'h', 'd'), 1, 0x000007); // enabled, in movie, in preview
+    writer.WriteUInt64(0); // creation time
+    writer.WriteUInt64(0); // modification time
+    writer.WriteUInt32(m_dwTrackId);
+    writer.WriteUInt32(0);
+    writer.WriteUInt64(0); // duration
+    writer.WriteZeroes(8);
+    writer.WriteUInt16(0); // layer
+    writer.WriteUInt16(0); // alternate group
+    writer.WriteUInt16(fVideo ? 0 : 0x0100); // volume
+    writer.WriteUInt16(0);
+    for (int i = 0; i < 9; ++i)
+    {
+        writer.WriteUInt32(g_matrix[i]);
+    }
+    writer.WriteUInt32(fVideo ? (m_pConfig->GetWidth() << 16) : 0);
+    writer.WriteUInt32(fVideo ? (m_pConfig->GetHeight() << 16) : 0);
+    writer.EndBox();
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'd', 'i', 'a'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('m', 'd', 'h', 'd'), 1, 0);
+    writer.WriteUInt64(0); // creation time
+    writer.WriteUInt64(0); // modification time
+    writer.WriteUInt32(SMOOTH_TIMESCALE);
+    writer.WriteUInt64(0); // duration
+    writer.WriteUInt16(m_wLanguage ? m_wLanguage : 0x55C4); // 'und' if not specified
+    writer.WriteUInt16(0);
+    writer.EndBox();
+
+    const char* szHandlerName = fVideo ? "Video Media Handler" : "Sound Media Handler";
+    writer.BeginFullBox(MAKEBOXTYPE('h', 'd', 'l', 'r'), 0, 0);
+    writer.WriteUInt32(0);
+    writer.WriteUInt32(fVideo ? MAKEBOXTYPE('v', 'i', 'd', 'e') : MAKEBOXTYPE('s', 'o', 'u', 'n'));
+    writer.WriteZeroes(12);
+    writer.WriteBytes((const BYTE*)szHandlerName, (DWORD)strlen(szHandlerName) + 1);
+    writer.EndBox();
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'i', 'n', 'f'));
+
+    if (fVideo)
+    {
+        writer.BeginFullBox(MAKEBOXTYPE('v', 'm', 'h', 'd'), 0, 1);
+        writer.WriteZeroes(8); // graphics mode and opcolor
+        writer.EndBox();
+    }
+    else
+    {
+        writer.BeginFullBox(MAKEBOXTYPE('s', 'm', 'h', 'd'), 0, 0);
+        writer.WriteZeroes(4); // balance
+        writer.EndBox();
+    }
+
+    writer.BeginBox(MAKEBOXTYPE('d', 'i', 'n', 'f'));
+    writer.BeginFullBox(MAKEBOXTYPE('d', 'r', 'e', 'f'), 0, 0);
+    writer.WriteUInt32(1);
+    writer.BeginFullBox(MAKEBOXTYPE('u', 'r', 'l', ' '), 0, 1); // media data is in the same file
+    writer.EndBox();
+    writer.EndBox();
+    writer.EndBox();
+
+    writer.BeginBox(MAKEBOXTYPE('s', 't', 'b', 'l'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('s', 't', 's', 'd'), 0, 0);
+    writer.WriteUInt32(1);
+    writer.WriteBytes(m_pConfig->GetSampleEntry(), m_pConfig->GetSampleEntrySize());
+    writer.EndBox();
+
+    // sample tables are empty, all samples are in fragments
+    writer.BeginFullBox(MAKEBOXTYPE('s', 't', 't', 's'), 0, 0);
+    writer.WriteUInt32(0);
+    writer.EndBox();
+    writer.BeginFullBox(MAKEBOXTYPE('s', 't', 's', 'c'), 0, 0);
+    writer.WriteUInt32(0);
+    writer.EndBox();
+    writer.BeginFullBox(MAKEBOXTYPE('s', 't', 's', 'z'), 0, 0);
+    writer.WriteUInt32(0);
+    writer.WriteUInt32(0);
+    writer.EndBox();
+    writer.BeginFullBox(MAKEBOXTYPE('s', 't', 'c', 'o'), 0, 0);
+    writer.WriteUInt32(0);
+    writer.EndBox();
+
+    writer.EndBox(); // stbl
+    writer.EndBox(); // minf
+    writer.EndBox(); // mdia
+    writer.EndBox(); // trak
+}
+
+HRESULT FragmentWriter::WriteFragment(LONGLONG rtEnd, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    return WriteMovieFragment(rtEnd, TRUE, pbOutput, cbOutput, pcbWritten);
+}
+
+HRESULT FragmentWriter::WriteChunk(LONGLONG rtEnd, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    return WriteMovieFragment(rtEnd, FALSE, pbOutput, cbOutput, pcbWritten);
+}
+
+HRESULT FragmentWriter::WriteMovieFragment(LONGLONG rtEnd, BOOL fCloseFragment, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    if (m_samples.empty())
+    {
+        *pcbWritten = 0;
+        return S_FALSE;
+    }
+
+    if (!m_fFileOffsetKnown)
+    {
+        // header was never requested, account for it anyway so index offsets are valid
+        BoxWriter measure(NULL, 0);
+        WriteHeaderBoxes(measure);
+        m_qwFileOffset = measure.GetPosition();
+        m_fFileOffsetKnown = TRUE;
+    }
+
+    BOOL fVideo = (m_nStreamType == FRAGMENT_STREAM_VIDEO);
+    DWORD dwSampleCount = (DWORD)m_samples.size();
+    LONGLONG rtFragmentStart = m_samples[0].rtStart;
+
+    BoxWriter writer(pbOutput, cbOutput);
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'o', 'o', 'f'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('m', 'f', 'h', 'd'), 0, 0);
+    writer.WriteUInt32(m_dwSequenceNumber);
+    writer.EndBox();
+
+    writer.BeginBox(MAKEBOXTYPE('t', 'r', 'a', 'f'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('t', 'f', 'h', 'd'), 0, 0);
+    writer.WriteUInt32(m_dwTrackId);
+    writer.EndBox();
+
+    // data offset, sample duration, sample size and (video only) sample flags
+    DWORD dwTrunFlags = 0x000001 | 0x000100 | 0x000200;
+    if (fVideo)
+    {
+        dwTrunFlags |= 0x000400;
+    }
+
+    writer.BeginFullBox(MAKEBOXTYPE('t', 'r', 'u', 'n'), 0, dwTrunFlags);
+    writer.WriteUInt32(dwSampleCount);
+    DWORD dwDataOffsetPosition = writer.GetPosition();
+    writer.WriteUInt32(0); // patched below once moof size is known
+    for (DWORD i = 0; i < dwSampleCount; ++i)
+    {
+        const SampleEntry& sample = m_samples[i];
+
+        LONGLONG rtDuration;
+        if (sample.rtStop > sample.rtStart)
+        {
+            rtDuration = sample.rtStop - sample.rtStart;
+        }
+        else if (i + 1 < dwSampleCount)
+        {
+            rtDuration = m_samples[i + 1].rtStart - sample.rtStart;
+        }
+        else
+        {
+            rtDuration = rtEnd - sample.rtStart;
+        }
+
+        if (rtDuration < 0)
+        {
+            rtDuration = 0;
+        }
+
+        writer.WriteUInt32((DWORD)rtDuration);
+        writer.WriteUInt32(sample.cbSize);
+        if (fVideo)
+        {
+            writer.WriteUInt32(sample.fKeyFrame ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+        }
+    }
+    writer.EndBox();
+
+    LONGLONG rtFragmentDuration = rtEnd - rtFragmentStart;
+    if (rtFragmentDuration < 0)
+    {
+        rtFragmentDuration = 0;
+    }
+
+    writer.BeginUuidFullBox(g_uuidTfxd, 1, 0);
+    writer.WriteUInt64((ULONGLONG)rtFragmentStart);
+    writer.WriteUInt64((ULONGLONG)rtFragmentDuration);
+    writer.EndBox();
+
+    writer.EndBox(); // traf
+    writer.EndBox(); // moof
+
+    writer.PatchUInt32(dwDataOffsetPosition, writer.GetPosition() + 8);
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'd', 'a', 't'));
+    for (DWORD i = 0; i < dwSampleCount; ++i)
+    {
+        const SampleEntry& sample = m_samples[i];
+        if (sample.cbSize > 0)
+        {
+            writer.WriteBytes(sample.pbData ? sample.pbData : &m_payload[sample.dwOffset], sample.cbSize);
+        }
+    }
+    writer.EndBox();
+
+    *pcbWritten = writer.GetPosition();
+    if (writer.IsOverflow())
+    {
+        return E_NOT_SUFFICIENT_BUFFER;
+    }
+
+    if (!m_fFragmentOpen)
+    {
+        IndexEntry entry;
+        entry.qwTime = (ULONGLONG)rtFragmentStart;
+        entry.qwMoofOffset = m_qwFileOffset;
+        m_index.push_back(entry);
+    }
+
+    m_fFragmentOpen = !fCloseFragment;
+    m_qwFileOffset += writer.GetPosition();
+    ++m_dwSequenceNumber;
+    ReleaseSamples();
+
+    return S_OK;
+}
+
+HRESULT FragmentWriter::WriteIndex(BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    BoxWriter writer(pbOutput, cbOutput);
+
+    writer.BeginBox(MAKEBOXTYPE('m', 'f', 'r', 'a'));
+
+    writer.BeginFullBox(MAKEBOXTYPE('t', 'f', 'r', 'a'), 1, 0);
+    writer.WriteUInt32(m_dwTrackId);
+    writer.WriteUInt32(0); // traf, trun and sample numbers are 1 byte each
+    writer.WriteUInt32((DWORD)m_index.size());
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        writer.WriteUInt64(m_index[i].qwTime);
+        writer.WriteUInt64(m_index[i].qwMoofOffset);
+        writer.WriteUInt8(1);
+        writer.WriteUInt8(1);
+        writer.WriteUInt8(1);
+    }
+    writer.EndBox();
+
+    writer.BeginFullBox(MAKEBOXTYPE('m', 'f', 'r', 'o'), 0, 0);
+    writer.WriteUInt32(writer.GetPosition() + 4);
+    writer.EndBox();
+
+    writer.EndBox();
+
+    *pcbWritten = writer.GetPosition();
+    if (writer.IsOverflow())
+    {
+        return E_NOT_SUFFICIENT_BUFFER;
+    }
+
+    return S_OK;
+}
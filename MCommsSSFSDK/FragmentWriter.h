@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+class CodecConfig;
+
+#define FRAGMENT_STREAM_AUDIO 1
+#define FRAGMENT_STREAM_VIDEO 2
+
+// Called once a borrowed sample is no longer referenced by the writer
+typedef void (__cdecl *PFN_SAMPLE_RELEASE)(void* pvContext);
+
+// Writes PIFF 1.1 (Smooth Streaming) headers and fragments for a single track.
+// Samples are accumulated with AddSample and serialized into caller-provided memory
+// by WriteFragment. All Write* methods return E_NOT_SUFFICIENT_BUFFER together with
+// the required size when the supplied buffer is too small (or NULL); in that case
+// the writer state is left untouched so the call can simply be repeated.
+class FragmentWriter
+{
+public:
+    FragmentWriter();
+    ~FragmentWriter();
+
+    // Keeps a reference to the codec configuration, stream type and bitrate are taken from it
+    HRESULT Initialize(DWORD dwTrackId, WORD wLanguage, const char* szSourceName, CodecConfig* pConfig);
+
+    HRESULT AddSample(LONGLONG rtStart, LONGLONG rtStop, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData);
+
+    // Adds sample without copying it, pbData must stay valid until pfnRelease is called,
+    // which happens after the sample has been written to a fragment or the writer is destroyed
+    HRESULT AddSampleReference(LONGLONG rtStart, LONGLONG rtStop, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData, PFN_SAMPLE_RELEASE pfnRelease, void* pvContext);
+
+    // ftyp + live server manifest box + moov
+    HRESULT WriteHeader(BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+    // moof (mfhd, traf: tfhd, trun, tfxd) + mdat for all pending samples,
+    // rtEnd is the start time of the first sample of the next fragment
+    HRESULT WriteFragment(LONGLONG rtEnd, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+    // Same boxes as WriteFragment for the samples pending so far, but the fragment stays open:
+    // following chunks and the closing WriteFragment continue it. Only the first moof of a
+    // fragment is added to the index, so random access points stay at fragment starts.
+    HRESULT WriteChunk(LONGLONG rtEnd, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+    // mfra (tfra + mfro) for all fragments written so far
+    HRESULT WriteIndex(BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+    DWORD GetPendingSampleCount() const { return (DWORD)m_samples.size(); }
+    LONGLONG GetPendingStartTime() const { return m_samples.empty() ? -1 : m_samples[0].rtStart; }
+    int GetStreamType() const { return m_nStreamType; }
+    DWORD GetTrackId() const { return m_dwTrackId; }
+
+private:
+    struct SampleEntry
+    {
+        LONGLONG rtStart;
+        LONGLONG rtStop;
+        DWORD cbSize;
+        DWORD dwOffset;
+        BOOL fKeyFrame;
+
+        // set for borrowed samples, otherwise data is in m_payload at dwOffset
+        const BYTE* pbData;
+        PFN_SAMPLE_RELEASE pfnRelease;
+        void* pvContext;
+    };
+
+    struct IndexEntry
+    {
+        ULONGLONG qwTime;
+        ULONGLONG qwMoofOffset;
+    };
+
+    FragmentWriter(const FragmentWriter&);
+    FragmentWriter& operator=(const FragmentWriter&);
+
+    void ReleaseSamples();
+
+    HRESULT WriteMovieFragment(LONGLONG rtEnd, BOOL fCloseFragment, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+    void WriteHeaderBoxes(class BoxWriter& writer);
+    void WriteManifestBox(class BoxWriter& writer);
+    void WriteTrackBox(class BoxWriter& writer);
+
+    int m_nStreamType;
+    DWORD m_dwTrackId;
+    WORD m_wLanguage;
+    std::string m_sourceName;
+    CodecConfig* m_pConfig;
+
+    std::vector<SampleEntry> m_samples;
+    std::vector<BYTE> m_payload;
+
+    DWORD m_dwSequenceNumber;
+    ULONGLONG m_qwFileOffset;
+    BOOL m_fFileOffsetKnown;
+
+    // set once the first chunk of a fragment has been written
+    BOOL m_fFragmentOpen;
+    std::vector<IndexEntry> m_index;
+};
@@ -0,0 +1,113 @@
+#include "stdafx.h"
+#include "HandleTable.h"
+
+#include <string.h>
+
+HandleTable::HandleTable()
+    : m_lNextSlot(0)
+{
+    ZeroMemory((void*)m_aSlots, sizeof(m_aSlots));
+}
+
+HandleTable::Slot* HandleTable::GetSlot(int nHandle, LONG* plGeneration)
+{
+    if (nHandle <= 0)
+    {
+        return NULL;
+    }
+
+    LONG lGeneration = (LONG)((nHandle >> HANDLETABLE_INDEX_BITS) & HANDLETABLE_GENERATION_MASK);
+    if ((lGeneration & 1) == 0)
+    {
+        return NULL;
+    }
+
+    *plGeneration = lGeneration;
+    return &m_aSlots[nHandle & HANDLETABLE_INDEX_MASK];
+}
+
+int HandleTable::Insert(void* pObject)
+{
+    for (int nProbe = 0; nProbe < HANDLETABLE_CAPACITY; ++nProbe)
+    {
+        int nIndex = (int)(InterlockedIncrement(&m_lNextSlot) & HANDLETABLE_INDEX_MASK);
+        Slot* pSlot = &m_aSlots[nIndex];
+
+        if (InterlockedCompareExchange(&pSlot->lUsed, 1, 0) != 0)
+        {
+            continue;
+        }
+
+        // slot is ours, generation is even while it is free
+        LONG lGeneration = (pSlot->lGeneration + 1) & HANDLETABLE_GENERATION_MASK;
+        pSlot->pObject = pObject;
+        InterlockedExchange(&pSlot->lGeneration, lGeneration);
+
+        return (int)((lGeneration << HANDLETABLE_INDEX_BITS) | nIndex);
+    }
+
+    return -1;
+}
+
+void* HandleTable::Acquire(int nHandle)
+{
+    LONG lGeneration = 0;
+    Slot* pSlot = GetSlot(nHandle, &lGeneration);
+
+    if (pSlot == NULL || pSlot->lGeneration != lGeneration)
+    {
+        return NULL;
+    }
+
+    InterlockedIncrement(&pSlot->lPins);
+
+    // Remove may have run between the check and the pin
+    if (pSlot->lGeneration != lGeneration)
+    {
+        InterlockedDecrement(&pSlot->lPins);
+        return NULL;
+    }
+
+    return pSlot->pObject;
+}
+
+void HandleTable::Release(int nHandle)
+{
+    LONG lGeneration = 0;
+    Slot* pSlot = GetSlot(nHandle, &lGeneration);
+
+    if (pSlot != NULL)
+    {
+        InterlockedDecrement(&pSlot->lPins);
+    }
+}
+
+void* HandleTable::Remove(int nHandle)
+{
+    LONG lGeneration = 0;
+    Slot* pSlot = GetSlot(nHandle, &lGeneration);
+
+    if (pSlot == NULL)
+    {
+        return NULL;
+    }
+
+    // only one caller can retire a given generation
+    LONG lRetired = (lGeneration + 1) & HANDLETABLE_GENERATION_MASK;
+    if (InterlockedCompareExchange(&pSlot->lGeneration, lRetired, lGeneration) != lGeneration)
+    {
+        return NULL;
+    }
+
+    // new pins fail the generation check from now on, wait for the existing ones
+    while (InterlockedCompareExchange(&pSlot->lPins, 0, 0) != 0)
+    {
+        SwitchToThread();
+    }
+
+    void* pObject = pSlot->pObject;
+    pSlot->pObject = NULL;
+    InterlockedExchange(&pSlot->lUsed, 0);
+
+    return pObject;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#define HANDLETABLE_INDEX_BITS      12
+#define HANDLETABLE_CAPACITY        (1 << HANDLETABLE_INDEX_BITS)
+#define HANDLETABLE_INDEX_MASK      (HANDLETABLE_CAPACITY - 1)
+#define HANDLETABLE_GENERATION_MASK 0x7FFFF
+
+// Fixed size table mapping positive integer handles to objects without a global lock.
+// A handle encodes the slot index in the low HANDLETABLE_INDEX_BITS bits and the slot
+// generation above them, so a handle of a removed object never resolves to an object
+// inserted later into the same slot. Live slots have an odd generation.
+//
+// Acquire is wait-free: it pins the slot with an interlocked increment and verifies the
+// generation afterwards. Remove invalidates the generation first and then waits until
+// all pins are dropped, so the object may be deleted as soon as Remove returns.
+class HandleTable
+{
+public:
+    HandleTable();
+
+    // Returns the new handle, or -1 when all slots are in use
+    int Insert(void* pObject);
+
+    // Returns the object with the slot pinned or NULL for a stale or unknown handle,
+    // every successful call must be paired with Release
+    void* Acquire(int nHandle);
+    void Release(int nHandle);
+
+    // Invalidates the handle and returns its object once no caller holds it any more,
+    // NULL when the handle is stale or unknown
+    void* Remove(int nHandle);
+
+private:
+    struct Slot
+    {
+        volatile LONG lGeneration;
+        volatile LONG lPins;
+        volatile LONG lUsed;
+        void* volatile pObject;
+    };
+
+    HandleTable(const HandleTable&);
+    HandleTable& operator=(const HandleTable&);
+
+    Slot* GetSlot(int nHandle, LONG* plGeneration);
+
+    Slot m_aSlots[HANDLETABLE_CAPACITY];
+    volatile LONG m_lNextSlot;
+};
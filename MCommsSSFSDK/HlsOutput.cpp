@@ -0,0 +1,414 @@
+#include "stdafx.h"
+#include "HlsOutput.h"
+#include "CodecConfig.h"
+#include "FragmentWriter.h"
+
+#include <string.h>
+
+using namespace std;
+
+// segments kept beyond the playlist for clients which are one playlist reload behind
+#define HLS_EXTRA_SEGMENTS 2
+
+#define HNS_PER_SECOND 10000000
+
+HlsOutput::HlsOutput(LONGLONG rtSegmentDuration, DWORD dwPlaylistLength)
+    : m_rtSegmentDuration(rtSegmentDuration), m_dwPlaylistLength(dwPlaylistLength), m_nAudioStream(-1), m_pAudioConfig(NULL)
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+HlsOutput::~HlsOutput()
+{
+    for (size_t i = 0; i < m_renditions.size(); ++i)
+    {
+        DeleteRendition(m_renditions[i]);
+    }
+
+    for (size_t i = 0; i < m_freeSegments.size(); ++i)
+    {
+        delete m_freeSegments[i];
+    }
+
+    if (m_pAudioConfig != NULL)
+    {
+        m_pAudioConfig->Release();
+    }
+
+    DeleteCriticalSection(&m_cs);
+}
+
+HRESULT HlsOutput::AddStream(int nStreamId, CodecConfig* pConfig)
+{
+    EnterCriticalSection(&m_cs);
+
+    HRESULT hr = S_OK;
+    if (pConfig->GetStreamType() == FRAGMENT_STREAM_VIDEO)
+    {
+        hr = AddRendition(nStreamId, pConfig);
+    }
+    else if (m_nAudioStream < 0)
+    {
+        m_nAudioStream = nStreamId;
+        m_pAudioConfig = pConfig;
+        m_pAudioConfig->AddRef();
+
+        hr = AddRendition(-1, NULL);
+        if (FAILED(hr))
+        {
+            m_nAudioStream = -1;
+            m_pAudioConfig->Release();
+            m_pAudioConfig = NULL;
+        }
+        else
+        {
+            // video renditions created so far get the audio from their next keyframe on
+            for (size_t i = 0; i < m_renditions.size() && SUCCEEDED(hr); ++i)
+            {
+                if (m_renditions[i]->nVideoStream >= 0 && m_renditions[i]->nAudioStream < 0)
+                {
+                    hr = ResetWriter(m_renditions[i]);
+                }
+            }
+        }
+    }
+    else
+    {
+        // only the first audio stream is carried
+        hr = S_FALSE;
+    }
+
+    LeaveCriticalSection(&m_cs);
+    return hr;
+}
+
+void HlsOutput::AddSample(int nStreamId, LONGLONG rtStart, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData)
+{
+    EnterCriticalSection(&m_cs);
+
+    for (size_t i = 0; i < m_renditions.size(); ++i)
+    {
+        Rendition* pRendition = m_renditions[i];
+
+        if (nStreamId == pRendition->nVideoStream)
+        {
+            if (fKeyFrame && (pRendition->pCurrent == NULL || rtStart - pRendition->pCurrent->rtStart >= m_rtSegmentDuration))
+            {
+                CompleteSegment(pRendition, rtStart);
+                StartSegment(pRendition, rtStart);
+            }
+
+            if (pRendition->pCurrent != NULL)
+            {
+                // a malformed sample is left out, the segment goes on
+                pRendition->pWriter->WriteVideoSample(rtStart, fKeyFrame, pbData, cbData, pRendition->pCurrent->data);
+            }
+        }
+        else if (nStreamId == pRendition->nAudioStream)
+        {
+            if (pRendition->nVideoStream < 0 && (pRendition->pCurrent == NULL || rtStart - pRendition->pCurrent->rtStart >= m_rtSegmentDuration))
+            {
+                CompleteSegment(pRendition, rtStart);
+                StartSegment(pRendition, rtStart);
+            }
+
+            if (pRendition->pCurrent != NULL)
+            {
+                pRendition->pWriter->WriteAudioSample(rtStart, pbData, cbData, pRendition->pCurrent->data);
+            }
+        }
+    }
+
+    LeaveCriticalSection(&m_cs);
+}
+
+HRESULT HlsOutput::GetPlaylist(int nRendition, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    EnterCriticalSection(&m_cs);
+
+    HRESULT hr = S_OK;
+    *pcbWritten = 0;
+
+    if (nRendition < -1 || nRendition >= (int)m_renditions.size())
+    {
+        hr = E_INVALIDARG;
+    }
+    else if (!BuildPlaylist(nRendition))
+    {
+        hr = S_FALSE;
+    }
+    else
+    {
+        *pcbWritten = (DWORD)m_playlist.size();
+        if (pbOutput == NULL || cbOutput < *pcbWritten)
+        {
+            hr = E_NOT_SUFFICIENT_BUFFER;
+        }
+        else
+        {
+            memcpy(pbOutput, m_playlist.data(), *pcbWritten);
+        }
+    }
+
+    LeaveCriticalSection(&m_cs);
+    return hr;
+}
+
+HRESULT HlsOutput::GetSegment(int nRendition, DWORD dwSequence, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    EnterCriticalSection(&m_cs);
+
+    HRESULT hr = S_FALSE;
+    *pcbWritten = 0;
+
+    if (nRendition < 0 || nRendition >= (int)m_renditions.size())
+    {
+        hr = E_INVALIDARG;
+    }
+    else
+    {
+        // sequence numbers of the window are consecutive
+        deque<Segment*>& segments = m_renditions[nRendition]->segments;
+        if (!segments.empty() && dwSequence >= segments.front()->dwSequence && dwSequence - segments.front()->dwSequence < segments.size())
+        {
+            const vector<BYTE>& data = segments[dwSequence - segments.front()->dwSequence]->data;
+
+            hr = S_OK;
+            *pcbWritten = (DWORD)data.size();
+            if (pbOutput == NULL || cbOutput < *pcbWritten)
+            {
+                hr = E_NOT_SUFFICIENT_BUFFER;
+            }
+            else if (!data.empty())
+            {
+                memcpy(pbOutput, &data[0], data.size());
+            }
+        }
+    }
+
+    LeaveCriticalSection(&m_cs);
+    return hr;
+}
+
+// Creates rendition of the video stream (NULL configuration for the audio only one), called under m_cs
+HRESULT HlsOutput::AddRendition(int nVideoStream, CodecConfig* pVideoConfig)
+{
+    Rendition* pRendition = new Rendition();
+    pRendition->nVideoStream = nVideoStream;
+    pRendition->nAudioStream = -1;
+    pRendition->pVideoConfig = pVideoConfig;
+    pRendition->pWriter = NULL;
+    pRendition->pCurrent = NULL;
+    pRendition->dwNextSequence = 0;
+    pRendition->fDiscontinuity = FALSE;
+    pRendition->dwDiscontinuitySequence = 0;
+
+    if (pVideoConfig != NULL)
+    {
+        pVideoConfig->AddRef();
+    }
+
+    HRESULT hr = ResetWriter(pRendition);
+    if (FAILED(hr))
+    {
+        DeleteRendition(pRendition);
+        return hr;
+    }
+
+    m_renditions.push_back(pRendition);
+    return S_OK;
+}
+
+// Replaces writer of the rendition with one for its video and the current audio stream,
+// the segment in progress is dropped since its tables don't describe the new writer. The new
+// writer restarts continuity counters and table versions, so clients are told to expect it.
+HRESULT HlsOutput::ResetWriter(Rendition* pRendition)
+{
+    TsWriter* pWriter = new TsWriter();
+    HRESULT hr = pWriter->Initialize(pRendition->pVideoConfig, m_pAudioConfig);
+    if (FAILED(hr))
+    {
+        delete pWriter;
+        return hr;
+    }
+
+    delete pRendition->pWriter;
+    pRendition->pWriter = pWriter;
+    pRendition->nAudioStream = m_nAudioStream;
+    pRendition->fDiscontinuity = !pRendition->segments.empty();
+
+    if (pRendition->pCurrent != NULL)
+    {
+        // the next segment takes its sequence number, GetSegment relies on consecutive ones
+        --pRendition->dwNextSequence;
+        m_freeSegments.push_back(pRendition->pCurrent);
+        pRendition->pCurrent = NULL;
+    }
+
+    return S_OK;
+}
+
+void HlsOutput::StartSegment(Rendition* pRendition, LONGLONG rtStart)
+{
+    Segment* pSegment = NULL;
+    if (!m_freeSegments.empty())
+    {
+        pSegment = m_freeSegments.back();
+        m_freeSegments.pop_back();
+        pSegment->data.clear();
+    }
+    else
+    {
+        pSegment = new Segment();
+    }
+
+    pSegment->dwSequence = pRendition->dwNextSequence++;
+    pSegment->rtStart = rtStart;
+    pSegment->rtDuration = 0;
+    pSegment->fDiscontinuity = pRendition->fDiscontinuity;
+    pRendition->fDiscontinuity = FALSE;
+
+    pRendition->pWriter->WriteTables(pSegment->data);
+    pRendition->pCurrent = pSegment;
+}
+
+// Moves the segment in progress to the window, the oldest ones beyond it are recycled
+void HlsOutput::CompleteSegment(Rendition* pRendition, LONGLONG rtEnd)
+{
+    Segment* pSegment = pRendition->pCurrent;
+    if (pSegment == NULL)
+    {
+        return;
+    }
+
+    pRendition->pCurrent = NULL;
+    pSegment->rtDuration = rtEnd > pSegment->rtStart ? rtEnd - pSegment->rtStart : 0;
+    pRendition->segments.push_back(pSegment);
+
+    while (pRendition->segments.size() > m_dwPlaylistLength + HLS_EXTRA_SEGMENTS)
+    {
+        if (pRendition->segments.front()->fDiscontinuity)
+        {
+            ++pRendition->dwDiscontinuitySequence;
+        }
+
+        m_freeSegments.push_back(pRendition->segments.front());
+        pRendition->segments.pop_front();
+    }
+}
+
+void HlsOutput::DeleteRendition(Rendition* pRendition)
+{
+    for (size_t i = 0; i < pRendition->segments.size(); ++i)
+    {
+        delete pRendition->segments[i];
+    }
+
+    delete pRendition->pCurrent;
+    delete pRendition->pWriter;
+
+    if (pRendition->pVideoConfig != NULL)
+    {
+        pRendition->pVideoConfig->Release();
+    }
+
+    delete pRendition;
+}
+
+void HlsOutput::AppendStreamInfo(const Rendition* pRendition)
+{
+    char szLine[256];
+
+    int nBandwidth = pRendition->nAudioStream >= 0 ? m_pAudioConfig->GetBitrate() : 0;
+    if (pRendition->pVideoConfig != NULL)
+    {
+        nBandwidth += pRendition->pVideoConfig->GetBitrate();
+        sprintf_s(szLine, sizeof(szLine), "#EXT-X-STREAM-INF:BANDWIDTH=%d,RESOLUTION=%ux%u,CODECS=\"%s\"\n", nBandwidth,
+            (unsigned int)pRendition->pVideoConfig->GetWidth(), (unsigned int)pRendition->pVideoConfig->GetHeight(), pRendition->pWriter->GetCodecs().c_str());
+    }
+    else
+    {
+        sprintf_s(szLine, sizeof(szLine), "#EXT-X-STREAM-INF:BANDWIDTH=%d,CODECS=\"%s\"\n", nBandwidth, pRendition->pWriter->GetCodecs().c_str());
+    }
+
+    m_playlist += szLine;
+}
+
+// Builds master (nRendition -1) or media playlist into m_playlist, FALSE if there's nothing to list yet
+BOOL HlsOutput::BuildPlaylist(int nRendition)
+{
+    char szLine[64];
+    m_playlist = "#EXTM3U\n";
+
+    if (nRendition < 0)
+    {
+        // players start with the first entry, the audio only rendition goes last
+        for (int nPass = 0; nPass < 2; ++nPass)
+        {
+            for (size_t i = 0; i < m_renditions.size(); ++i)
+            {
+                if ((m_renditions[i]->nVideoStream < 0) == (nPass == 1))
+                {
+                    AppendStreamInfo(m_renditions[i]);
+                    sprintf_s(szLine, sizeof(szLine), "%d.m3u8\n", (int)i);
+                    m_playlist += szLine;
+                }
+            }
+        }
+
+        return !m_renditions.empty();
+    }
+
+    const Rendition* pRendition = m_renditions[nRendition];
+    const deque<Segment*>& segments = pRendition->segments;
+    if (segments.empty())
+    {
+        return FALSE;
+    }
+
+    size_t nFirst = segments.size() > m_dwPlaylistLength ? segments.size() - m_dwPlaylistLength : 0;
+
+    // target duration must not be exceeded by any segment duration rounded to seconds
+    LONGLONG rtMaxDuration = m_rtSegmentDuration;
+    for (size_t i = nFirst; i < segments.size(); ++i)
+    {
+        if (segments[i]->rtDuration > rtMaxDuration)
+        {
+            rtMaxDuration = segments[i]->rtDuration;
+        }
+    }
+
+    sprintf_s(szLine, sizeof(szLine), "#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n", (int)((rtMaxDuration + HNS_PER_SECOND / 2) / HNS_PER_SECOND));
+    m_playlist += szLine;
+    sprintf_s(szLine, sizeof(szLine), "#EXT-X-MEDIA-SEQUENCE:%u\n", (unsigned int)segments[nFirst]->dwSequence);
+    m_playlist += szLine;
+
+    // discontinuities which have scrolled out of the playlist, kept but not listed
+    DWORD dwDiscontinuitySequence = pRendition->dwDiscontinuitySequence;
+    for (size_t i = 0; i < nFirst; ++i)
+    {
+        if (segments[i]->fDiscontinuity)
+        {
+            ++dwDiscontinuitySequence;
+        }
+    }
+
+    if (dwDiscontinuitySequence != 0)
+    {
+        sprintf_s(szLine, sizeof(szLine), "#EXT-X-DISCONTINUITY-SEQUENCE:%u\n", (unsigned int)dwDiscontinuitySequence);
+        m_playlist += szLine;
+    }
+
+    for (size_t i = nFirst; i < segments.size(); ++i)
+    {
+        if (segments[i]->fDiscontinuity)
+        {
+            m_playlist += "#EXT-X-DISCONTINUITY\n";
+        }
+
+        sprintf_s(szLine, sizeof(szLine), "#EXTINF:%.3f,\n%d-%u.ts\n", (double)segments[i]->rtDuration / HNS_PER_SECOND, nRendition, (unsigned int)segments[i]->dwSequence);
+        m_playlist += szLine;
+    }
+
+    return TRUE;
+}
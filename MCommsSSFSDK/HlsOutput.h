@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+
+#include "TsWriter.h"
+
+class CodecConfig;
+
+// HLS output of one mux, fed with the same samples as its Smooth Streaming fragment writers.
+// Every video stream gets a rendition of its own with the first audio stream muxed in, the
+// first audio stream gets an audio only rendition as well. Renditions are numbered in the
+// order they are created.
+//
+// Segments are MPEG-2 transport streams kept in memory: a segment of a rendition with video
+// is completed by the first keyframe once the segment duration has passed (audio only ones
+// are cut on time), the latest dwPlaylistLength segments are listed in the media playlist
+// and two more are kept for clients which have just loaded an older playlist.
+//
+// All methods may be called concurrently, the object has a lock of its own.
+class HlsOutput
+{
+public:
+    HlsOutput(LONGLONG rtSegmentDuration, DWORD dwPlaylistLength);
+    ~HlsOutput();
+
+    // Registers stream of the mux, keeps a reference to the configuration. Returns E_INVALIDARG
+    // if the codec can't be carried in a transport stream, the stream is left out of HLS then.
+    HRESULT AddStream(int nStreamId, CodecConfig* pConfig);
+
+    void AddSample(int nStreamId, LONGLONG rtStart, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData);
+
+    // Master playlist for nRendition -1, media playlist otherwise. The Get* methods return
+    // E_NOT_SUFFICIENT_BUFFER with the required size when the buffer is too small, E_INVALIDARG
+    // for unknown renditions and S_FALSE when there's nothing to serve (yet).
+    HRESULT GetPlaylist(int nRendition, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+    HRESULT GetSegment(int nRendition, DWORD dwSequence, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten);
+
+private:
+    struct Segment
+    {
+        DWORD dwSequence;
+        LONGLONG rtStart;
+        LONGLONG rtDuration;
+        BOOL fDiscontinuity;    // first segment of a new writer, listed with EXT-X-DISCONTINUITY
+        std::vector<BYTE> data;
+    };
+
+    struct Rendition
+    {
+        int nVideoStream;   // -1 for the audio only rendition
+        int nAudioStream;   // -1 while there's no audio stream
+        CodecConfig* pVideoConfig;
+        TsWriter* pWriter;
+        Segment* pCurrent;  // segment in progress, NULL until the first random access point
+        std::deque<Segment*> segments;
+        DWORD dwNextSequence;
+        BOOL fDiscontinuity;    // the writer has been reset, the next segment starts a discontinuity
+        DWORD dwDiscontinuitySequence;  // discontinuities of the segments which have left the window
+    };
+
+    HlsOutput(const HlsOutput&);
+    HlsOutput& operator=(const HlsOutput&);
+
+    HRESULT AddRendition(int nVideoStream, CodecConfig* pVideoConfig);
+    HRESULT ResetWriter(Rendition* pRendition);
+    void StartSegment(Rendition* pRendition, LONGLONG rtStart);
+    void CompleteSegment(Rendition* pRendition, LONGLONG rtEnd);
+    void DeleteRendition(Rendition* pRendition);
+
+    void AppendStreamInfo(const Rendition* pRendition);
+    BOOL BuildPlaylist(int nRendition);
+
+    CRITICAL_SECTION m_cs;
+
+    LONGLONG m_rtSegmentDuration;
+    DWORD m_dwPlaylistLength;
+
+    int m_nAudioStream;
+    CodecConfig* m_pAudioConfig;
+    std::vector<Rendition*> m_renditions;
+
+    // segments which have left the window, their buffers are reused by the next ones
+    std::vector<Segment*> m_freeSegments;
+
+    // playlist text is built here before it's copied out
+    std::string m_playlist;
+};
@@ -1,307 +1,513 @@
 #include "stdafx.h"
 #include "MCommsSSFSDK.h"
-#include <dshow.h>
-#include <dvdmedia.h>
-
-#include "../3rdParty/SSFSDK/ssfsdkapi.h"
-#ifdef _WIN64
-#pragma comment(lib, "../3rdParty/SSFSDK/ssfsdk_x64.lib")
-#else
-#pragma comment(lib, "../3rdParty/SSFSDK/ssfsdk.lib")
-#endif
-#pragma comment(lib, "xmllite.lib")
-
-#include <map>
+#include "FragmentWriter.h"
+#include "HandleTable.h"
+#include "BufferPool.h"
+#include "CodecConfig.h"
+#include "RtmpChunkDemuxer.h"
+#include "HlsOutput.h"
+#include "NativeTransport.h"
 
 using namespace std;
 
 typedef LONGLONG REFERENCE_TIME;
 
+// FLV audio/video tag header fields of media messages taken by MCSSF_IngestMessages
+#define FLV_AUDIO_CODEC_AAC 10
+#define FLV_VIDEO_CODEC_AVC 7
+#define FLV_FRAME_KEY       1
+#define FLV_PACKET_MEDIA    1   // AAC raw frame or AVC NAL units, 0 is codec configuration
+
+// Fragment durations used until changed with MCSSF_SetDefaultFragmentPolicy
+#define DEFAULT_AUDIO_FRAGMENT_DURATION 50000000 // 5 seconds in hns units
+#define DEFAULT_VIDEO_FRAGMENT_DURATION 20000000 // 2 seconds in hns units
+
+struct MuxContext;
+
 struct StreamContext
 {
-    WCHAR szStreamName[MAX_PATH];
+    MuxContext* pMux;
+    char szStreamName[MAX_PATH];
     int nBitrate;
-    SSF_STREAM_TYPE eStreamType;
-    BYTE* pbTypeInfo;
-    ULONG cbTypeInfo;
+    int nStreamType;
     DWORD dwStreamIndex;
     DWORD dwChunkIndex;
     BOOL fChunkInProgress;
     WORD wLanguage;
     REFERENCE_TIME rtChunkStartTime;
     REFERENCE_TIME rtChunkCurrentTime;
-    REFERENCE_TIME rtChunkDuration;
     REFERENCE_TIME rtFirstTimestamp;
+    MCSSF_FRAGMENT_POLICY policy;
+    FragmentWriter* pWriter;
+
+    // pooled buffer for output handed out when the caller doesn't provide one
+    BYTE* pbOutput;
+    DWORD cbOutput;
 };
 
+// Upper bound of streams per mux, stream ids are indexes into MuxContext::apStreams
+#define MUX_MAX_STREAMS 64
+
 struct MuxContext
 {
     int nMuxId;
-    SSFMUXHANDLE hSSFMux;
-    map<int, StreamContext*>* pStreams;
-    int nVideoStreams;
-    int nAudioStreams;
+    volatile LONG lStreamCount;
+    volatile LONG lVideoStreams;
+    volatile LONG lAudioStreams;
+
+    // policies of streams added later, indexed by stream type - 1
+    MCSSF_FRAGMENT_POLICY aDefaultPolicy[2];
+
+    // index + 1 of the video stream audio fragments are aligned to (the first one), 0 if none;
+    // start time of its latest fragment, -1 before the first cut
+    volatile LONG lReferenceVideoStream;
+    volatile LONGLONG rtVideoCutTime;
+
+    // entries are published once fully initialized and never change until the mux is removed
+    StreamContext* volatile apStreams[MUX_MAX_STREAMS];
+
+    // non-zero for entries of apStreams claimed by AddStream, cleared again if the stream fails to initialize
+    volatile LONG alStreamSlots[MUX_MAX_STREAMS];
+
+    // set by MCSSF_EnableHlsOutput before streams are added, NULL if HLS is not produced
+    HlsOutput* volatile pHls;
 };
 
-CRITICAL_SECTION g_csInstance;
-map<int, MuxContext*>* g_pMuxes = NULL;
-int g_nMuxCounter = 0;
+enum OutputKind
+{
+    OutputHeader,
+    OutputFragment,
+    OutputChunk,
+    OutputIndex
+};
 
-int MCOMMS_API MCSSF_Initialize()
+// Mux ids are handles of this table, lookups do not take any lock
+static HandleTable g_muxes;
+static HandleTable g_demuxers;
+static HandleTable g_transports;
+
+// Pins the mux for the lifetime of the object so MCSSF_Uninitialize can't free it meanwhile
+class MuxReference
 {
-    int nMuxId = -1;
-    SSFMUXHANDLE hSSFMux = NULL;
-    HRESULT hr = SSFMuxCreate(&hSSFMux);
-    if (FAILED(hr))
+public:
+    explicit MuxReference(int nMuxId)
+        : m_nMuxId(nMuxId), m_pMux((MuxContext*)g_muxes.Acquire(nMuxId))
     {
-        goto done;
     }
 
-    UINT64 timeScale = 10000000;
-    hr = SSFMuxSetOption(hSSFMux, SSF_MUX_OPTION_TIME_SCALE, &timeScale, sizeof(timeScale));
-    if (FAILED(hr))
+    ~MuxReference()
     {
-        goto done;
+        if (m_pMux != NULL)
+        {
+            g_muxes.Release(m_nMuxId);
+        }
     }
 
-    //BOOL fVariableBitRate = TRUE;
-    //hr = SSFMuxSetOption(hSSFMux, SSF_MUX_OPTION_VARIABLE_RATE, &fVariableBitRate, sizeof(fVariableBitRate));
-    //if (FAILED(hr))
-    //{
-    //    goto done;
-    //}
+    MuxContext* Get() const { return m_pMux; }
 
-    BOOL fLive = TRUE;
-    hr = SSFMuxSetOption(hSSFMux, SSF_MUX_OPTION_LIVE_MODE, &fLive, sizeof(fLive));
-    if (FAILED(hr))
-    {
-        goto done;
-    }
+private:
+    MuxReference(const MuxReference&);
+    MuxReference& operator=(const MuxReference&);
 
-    BOOL fEnable = TRUE;
-    hr = SSFMuxSetOption(hSSFMux, SSF_MUX_OPTION_ENABLE_STREAM_MANIFEST_BOX_FOR_LIVE_MODE, &fEnable, sizeof(fEnable));
-    if (FAILED(hr))
+    int m_nMuxId;
+    MuxContext* m_pMux;
+};
+
+static StreamContext* FindStream(MuxContext* pMux, int nStreamId)
+{
+    if (nStreamId < 0 || nStreamId >= MUX_MAX_STREAMS)
     {
-        goto done;
+        return NULL;
     }
 
-    MuxContext* pMux = new MuxContext();
-    ZeroMemory(pMux, sizeof(MuxContext));
+    return pMux->apStreams[nStreamId];
+}
+
+static BOOL IsValidPolicy(const MCSSF_FRAGMENT_POLICY* pPolicy)
+{
+    return pPolicy != NULL && pPolicy->nDuration > 0 && (pPolicy->nMaxDuration == 0 || pPolicy->nMaxDuration >= pPolicy->nDuration) &&
+        pPolicy->nChunkDuration >= 0 && pPolicy->nChunkSamples >= 0;
+}
 
-    pMux->pStreams = new map<int, StreamContext*>();
+static void DeleteStream(StreamContext* pStream)
+{
+    delete pStream->pWriter;
+
+    if (pStream->pbOutput != NULL)
+    {
+        BufferPool::Instance().Release(pStream->pbOutput);
+    }
 
-    EnterCriticalSection(&g_csInstance);
+    delete pStream;
+}
 
-    if (g_pMuxes == NULL)
+static HRESULT WriteOutput(StreamContext* pStream, OutputKind eKind, REFERENCE_TIME rtEnd, BYTE* pbOutput, DWORD cbOutput, DWORD* pcbWritten)
+{
+    switch (eKind)
     {
-        g_pMuxes = new map<int, MuxContext*>();
+    case OutputHeader:
+        return pStream->pWriter->WriteHeader(pbOutput, cbOutput, pcbWritten);
+    case OutputFragment:
+        return pStream->pWriter->WriteFragment(rtEnd, pbOutput, cbOutput, pcbWritten);
+    case OutputChunk:
+        return pStream->pWriter->WriteChunk(rtEnd, pbOutput, cbOutput, pcbWritten);
+    case OutputIndex:
+        return pStream->pWriter->WriteIndex(pbOutput, cbOutput, pcbWritten);
     }
 
-    nMuxId = pMux->nMuxId = ++g_nMuxCounter;
-    pMux->hSSFMux = hSSFMux;
-    g_pMuxes->insert(make_pair(nMuxId, pMux));
+    return E_INVALIDARG;
+}
 
-    LeaveCriticalSection(&g_csInstance);
+// Produces output either into the caller's buffer (when *ppData is not NULL and *pDataSize
+// holds its capacity) or into the stream's own buffer, which stays valid until the next call
+// for the same stream. When the caller's buffer is too small *pDataSize receives the required size.
+static HRESULT ProduceOutput(StreamContext* pStream, OutputKind eKind, REFERENCE_TIME rtEnd, int* pDataSize, BYTE** ppData)
+{
+    DWORD cbWritten = 0;
+    HRESULT hr;
 
-done:
+    if (*ppData != NULL && *pDataSize > 0)
+    {
+        hr = WriteOutput(pStream, eKind, rtEnd, *ppData, (DWORD)*pDataSize, &cbWritten);
+        *pDataSize = (int)cbWritten;
+        return hr;
+    }
 
-    if (nMuxId < 0)
+    BufferPool& pool = BufferPool::Instance();
+    if (pStream->pbOutput == NULL)
     {
-        if (NULL != hSSFMux)
+        pStream->pbOutput = pool.Acquire(0, &pStream->cbOutput);
+        if (pStream->pbOutput == NULL)
         {
-            SSFMuxDestroy(hSSFMux);
+            return E_OUTOFMEMORY;
         }
     }
 
-    return nMuxId;
+    hr = WriteOutput(pStream, eKind, rtEnd, pStream->pbOutput, pStream->cbOutput, &cbWritten);
+    if (hr == E_NOT_SUFFICIENT_BUFFER)
+    {
+        // move to the size class which fits, the old buffer goes back to the pool
+        pool.Release(pStream->pbOutput);
+        pStream->pbOutput = pool.Acquire(cbWritten, &pStream->cbOutput);
+        if (pStream->pbOutput == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        hr = WriteOutput(pStream, eKind, rtEnd, pStream->pbOutput, pStream->cbOutput, &cbWritten);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        *pDataSize = (int)cbWritten;
+        *ppData = cbWritten > 0 ? pStream->pbOutput : NULL;
+    }
+
+    return hr;
 }
 
-int MCOMMS_API MCSSF_AddStream(int nMuxId, int nStreamType, int nBitrate, unsigned short nLanguage, int nExtraDataSize, BYTE* pExtraData)
+int MCOMMS_API MCSSF_Initialize()
 {
-    int nStreamId = -1;
-    MuxContext* pMux = NULL;
+    MuxContext* pMux = new MuxContext();
+    ZeroMemory((void*)pMux, sizeof(MuxContext));
 
-    EnterCriticalSection(&g_csInstance);
+    pMux->aDefaultPolicy[FRAGMENT_STREAM_AUDIO - 1].nDuration = DEFAULT_AUDIO_FRAGMENT_DURATION;
+    pMux->aDefaultPolicy[FRAGMENT_STREAM_VIDEO - 1].nDuration = DEFAULT_VIDEO_FRAGMENT_DURATION;
+    pMux->rtVideoCutTime = -1;
 
-    map<int, MuxContext*>::iterator i_m = g_pMuxes->find(nMuxId);
-    if (i_m != g_pMuxes->end())
+    int nMuxId = g_muxes.Insert(pMux);
+    if (nMuxId < 0)
     {
-        pMux = i_m->second;
+        delete pMux;
+        return -1;
     }
 
-    LeaveCriticalSection(&g_csInstance);
+    pMux->nMuxId = nMuxId;
+    return nMuxId;
+}
 
-    if (pMux == NULL)
+// Adds stream described by pConfig to the mux, the stream keeps its own reference to the configuration
+static int AddStream(MuxContext* pMux, WORD wLanguage, CodecConfig* pConfig)
+{
+    int nStreamType = pConfig->GetStreamType();
+
+    // claim the index first, streams may be added concurrently
+    int nStreamId = -1;
+    for (int nSlot = 0; nSlot < MUX_MAX_STREAMS && nStreamId < 0; ++nSlot)
+    {
+        if (InterlockedCompareExchange(&pMux->alStreamSlots[nSlot], 1, 0) == 0)
+        {
+            nStreamId = nSlot;
+        }
+    }
+
+    if (nStreamId < 0)
     {
         return -1;
     }
 
+    InterlockedIncrement(&pMux->lStreamCount);
+
     StreamContext* pStream = new StreamContext();
     ZeroMemory(pStream, sizeof(StreamContext));
 
-    pStream->eStreamType = (SSF_STREAM_TYPE)nStreamType;
-    pStream->nBitrate = nBitrate;
+    pStream->pMux = pMux;
+    pStream->nStreamType = nStreamType;
+    pStream->policy = pMux->aDefaultPolicy[nStreamType - 1];
+    pStream->nBitrate = pConfig->GetBitrate();
     pStream->rtChunkStartTime = -1;
     pStream->rtFirstTimestamp = -1;
-    pStream->wLanguage = nLanguage;
-    if (nExtraDataSize > 0)
+    pStream->wLanguage = wLanguage;
+    pStream->dwStreamIndex = (DWORD)nStreamId;
+
+    if (pStream->nStreamType == FRAGMENT_STREAM_AUDIO)
+    {
+        sprintf_s(pStream->szStreamName, MAX_PATH, "Audio%d.isma", InterlockedIncrement(&pMux->lAudioStreams) - 1);
+    }
+    else if (pStream->nStreamType == FRAGMENT_STREAM_VIDEO)
+    {
+        sprintf_s(pStream->szStreamName, MAX_PATH, "Video%d.ismv", InterlockedIncrement(&pMux->lVideoStreams) - 1);
+    }
+
+    pStream->pWriter = new FragmentWriter();
+
+    HRESULT hr = pStream->pWriter->Initialize(pStream->dwStreamIndex + 1, pStream->wLanguage, pStream->szStreamName, pConfig);
+    if (FAILED(hr))
     {
-        pStream->cbTypeInfo = nExtraDataSize;
-        pStream->pbTypeInfo = new BYTE[nExtraDataSize];
-        memcpy(pStream->pbTypeInfo, pExtraData, nExtraDataSize);
+        DeleteStream(pStream);
+
+        // give the index back, otherwise it stays a hole nobody can use
+        InterlockedDecrement(&pMux->lStreamCount);
+        InterlockedExchange(&pMux->alStreamSlots[nStreamId], 0);
+        return -1;
     }
 
-    if (pStream->eStreamType == SSF_STREAM_AUDIO)
+    if (pMux->pHls != NULL)
     {
-        swprintf_s(pStream->szStreamName, MAX_PATH, L"Audio%d.isma", pMux->nAudioStreams++);
-        pStream->rtChunkDuration = 50000000; // 5 seconds in hns units
+        // a codec HLS can't carry only leaves the stream out of the HLS renditions
+        pMux->pHls->AddStream(nStreamId, pConfig);
     }
-    else if (pStream->eStreamType == SSF_STREAM_VIDEO)
+
+    InterlockedExchangePointer((void* volatile*)&pMux->apStreams[nStreamId], pStream);
+
+    if (nStreamType == FRAGMENT_STREAM_VIDEO)
     {
-        swprintf_s(pStream->szStreamName, MAX_PATH, L"Video%d.ismv", pMux->nVideoStreams++);
-        pStream->rtChunkDuration = 20000000; // 2 seconds in hns units
+        InterlockedCompareExchange(&pMux->lReferenceVideoStream, nStreamId + 1, 0);
     }
 
-    SSF_STREAM_INFO streamInfo;
-    ZeroMemory(&streamInfo, sizeof(streamInfo));
-    streamInfo.streamType = pStream->eStreamType;
-    streamInfo.dwBitrate = pStream->nBitrate;
-    streamInfo.pszSourceFileName = pStream->szStreamName;
-    streamInfo.pTypeSpecificInfo = pStream->pbTypeInfo;
-    streamInfo.cbTypeSpecificInfo = pStream->cbTypeInfo;
-    streamInfo.wLanguage = pStream->wLanguage;
+    return nStreamId;
+}
 
-    HRESULT hr = SSFMuxAddStream(pMux->hSSFMux, &streamInfo, &pStream->dwStreamIndex);
-    if (SUCCEEDED(hr))
+int MCOMMS_API MCSSF_AddStream(int nMuxId, int nStreamType, int nBitrate, unsigned short nLanguage, int nExtraDataSize, BYTE* pExtraData)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
     {
-        nStreamId = pStream->dwStreamIndex;
-        pMux->pStreams->insert(make_pair(nStreamId, pStream));
+        return -1;
     }
-    else
+
+    if (nStreamType != FRAGMENT_STREAM_AUDIO && nStreamType != FRAGMENT_STREAM_VIDEO)
+    {
+        return -1;
+    }
+
+    CodecConfig* pConfig = NULL;
+    HRESULT hr = CodecConfig::CreateFromTypeInfo(nStreamType, nBitrate, pExtraData, nExtraDataSize > 0 ? (DWORD)nExtraDataSize : 0, &pConfig);
+    if (FAILED(hr))
     {
-        delete pStream;
+        return -1;
     }
 
+    int nStreamId = AddStream(pMux, nLanguage, pConfig);
+    pConfig->Release();
+
     return nStreamId;
 }
 
-int MCOMMS_API MCSSF_GetHeader(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData)
+int MCOMMS_API MCSSF_AddStreamConfig(int nMuxId, const MCSSF_STREAM_CONFIG* pConfig)
 {
-    MuxContext* pMux = NULL;
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
+    {
+        return -1;
+    }
 
-    EnterCriticalSection(&g_csInstance);
+    if (pConfig == NULL || (pConfig->nStreamType != FRAGMENT_STREAM_AUDIO && pConfig->nStreamType != FRAGMENT_STREAM_VIDEO) ||
+        pConfig->pConfig == NULL || pConfig->nConfigSize <= 0 || pConfig->nWidth < 0 || pConfig->nHeight < 0 ||
+        pConfig->nChannels < 0 || pConfig->nChannels > 0xFFFF || pConfig->nSampleRate < 0)
+    {
+        return -2;
+    }
 
-    map<int, MuxContext*>::iterator i_m = g_pMuxes->find(nMuxId);
-    if (i_m != g_pMuxes->end())
+    CodecParameters params;
+    ZeroMemory(&params, sizeof(params));
+    params.nStreamType = pConfig->nStreamType;
+    params.nBitrate = pConfig->nBitrate;
+    params.dwWidth = (DWORD)pConfig->nWidth;
+    params.dwHeight = (DWORD)pConfig->nHeight;
+    params.wChannels = (WORD)pConfig->nChannels;
+    params.dwSampleRate = (DWORD)pConfig->nSampleRate;
+
+    CodecConfig* pCodecConfig = NULL;
+    HRESULT hr = CodecConfigCache::Instance().Acquire(pConfig->szCacheKey, &params, pConfig->pConfig, (DWORD)pConfig->nConfigSize, &pCodecConfig);
+    if (FAILED(hr))
     {
-        pMux = i_m->second;
+        return -3;
     }
 
-    LeaveCriticalSection(&g_csInstance);
+    int nStreamId = AddStream(pMux, (WORD)pConfig->nLanguage, pCodecConfig);
+    pCodecConfig->Release();
+
+    return nStreamId;
+}
+
+int MCOMMS_API MCSSF_GetHeader(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
 
     if (pMux == NULL)
     {
         return -1;
     }
 
-    map<int, StreamContext*>::iterator i_s = pMux->pStreams->find(nStreamId);
-    if (i_s == pMux->pStreams->end())
+    StreamContext* pStream = FindStream(pMux, nStreamId);
+    if (pStream == NULL)
     {
         return -1;
     }
 
-    StreamContext* pStream = i_s->second;
-
-    SSF_BUFFER outputBuffer;
-    HRESULT hr = SSFMuxGetHeader(pMux->hSSFMux, &pStream->dwStreamIndex, 1, &outputBuffer);
-    if (FAILED(hr))
+    HRESULT hr = ProduceOutput(pStream, OutputHeader, 0, pDataSize, ppData);
+    if (hr == E_NOT_SUFFICIENT_BUFFER)
+    {
+        return -2;
+    }
+    else if (FAILED(hr))
     {
         return -1;
     }
 
-    *pDataSize = outputBuffer.cbBuffer;
-    *ppData = outputBuffer.pbBuffer;
-
     return 1;
 }
 
-int MCOMMS_API MCSSF_PushMedia(int nMuxId, int nStreamId, LONGLONG nStartTime, LONGLONG nStopTime, BOOL bIsKeyFrame, int nSampleDataSize, BYTE* pSampleData, int* pOutputDataSize, BYTE** ppOutputData)
+// Whether the sample completes the fragment currently in progress: on the first keyframe once the
+// fragment duration has passed, on any sample once the max duration has passed, and for aligned
+// audio on the first sample at or after the latest cut of the reference video stream
+static BOOL IsFragmentBoundary(StreamContext* pStream, const MCSSF_SAMPLE* pSample)
 {
-    MuxContext* pMux = NULL;
+    if (!pStream->fChunkInProgress || pStream->rtChunkStartTime < 0)
+    {
+        return FALSE;
+    }
+
+    REFERENCE_TIME rtElapsed = pSample->nStartTime - pStream->rtChunkStartTime;
+    if (pStream->policy.nMaxDuration > 0 && rtElapsed >= pStream->policy.nMaxDuration)
+    {
+        return TRUE;
+    }
+
+    MuxContext* pMux = pStream->pMux;
+    if (pStream->nStreamType == FRAGMENT_STREAM_AUDIO && pStream->policy.bAlignToVideo && pMux->lReferenceVideoStream != 0)
+    {
+        REFERENCE_TIME rtVideoCut = InterlockedCompareExchange64(&pMux->rtVideoCutTime, 0, 0);
+        return rtVideoCut > pStream->rtChunkStartTime && pSample->nStartTime >= rtVideoCut;
+    }
+
+    return pSample->bIsKeyFrame && rtElapsed >= pStream->policy.nDuration;
+}
 
-    EnterCriticalSection(&g_csInstance);
+// Whether the samples pending in the fragment in progress are to be emitted as a chunk
+// before the sample is added, only in chunked output mode
+static BOOL IsChunkBoundary(StreamContext* pStream, const MCSSF_SAMPLE* pSample)
+{
+    DWORD dwPending = pStream->pWriter->GetPendingSampleCount();
+    if (!pStream->fChunkInProgress || dwPending == 0)
+    {
+        return FALSE;
+    }
 
-    map<int, MuxContext*>::iterator i_m = g_pMuxes->find(nMuxId);
-    if (i_m != g_pMuxes->end())
+    if (pStream->policy.nChunkSamples > 0 && dwPending >= (DWORD)pStream->policy.nChunkSamples)
     {
-        pMux = i_m->second;
+        return TRUE;
     }
 
-    LeaveCriticalSection(&g_csInstance);
+    return pStream->policy.nChunkDuration > 0 && pSample->nStartTime - pStream->pWriter->GetPendingStartTime() >= pStream->policy.nChunkDuration;
+}
 
-    if (pMux == NULL)
+// Output the sample triggers: fragment, chunk or none (returns FALSE)
+static BOOL GetBoundary(StreamContext* pStream, const MCSSF_SAMPLE* pSample, OutputKind* peKind)
+{
+    if (IsFragmentBoundary(pStream, pSample))
     {
-        return -1;
+        *peKind = OutputFragment;
+        return TRUE;
     }
 
-    map<int, StreamContext*>::iterator i_s = pMux->pStreams->find(nStreamId);
-    if (i_s == pMux->pStreams->end())
+    if (IsChunkBoundary(pStream, pSample))
     {
-        return -2;
+        *peKind = OutputChunk;
+        return TRUE;
     }
 
-    StreamContext* pStream = i_s->second;
+    return FALSE;
+}
+
+// Adds sample to the stream, first writing the output fBoundary/eKind says the sample triggers, as
+// decided by GetBoundary. The caller decides it once: for aligned audio the decision depends on the
+// video cut time, which other threads pushing video to the mux may change meanwhile.
+static int PushStreamSample(StreamContext* pStream, const MCSSF_SAMPLE* pSample, BOOL fBoundary, OutputKind eKind, int* pOutputDataSize, BYTE** ppOutputData)
+{
+    LONGLONG nStartTime = pSample->nStartTime;
 
     if (pStream->rtFirstTimestamp < 0)
     {
         pStream->rtFirstTimestamp = nStartTime;
     }
 
-    pStream->rtChunkCurrentTime = nStartTime;
     HRESULT hr;
     int nResult = 0;
 
-    if (bIsKeyFrame && pStream->fChunkInProgress && (pStream->rtChunkStartTime >= 0) && (pStream->rtChunkCurrentTime - pStream->rtChunkStartTime >= pStream->rtChunkDuration))
+    if (fBoundary)
     {
-        hr = SSFMuxAdjustDuration(pMux->hSSFMux, pStream->dwStreamIndex, nStartTime);
-        if (FAILED(hr))
+        hr = ProduceOutput(pStream, eKind, nStartTime, pOutputDataSize, ppOutputData);
+        if (hr == E_NOT_SUFFICIENT_BUFFER)
         {
-            *pOutputDataSize = hr;
-            return -3;
+            // nothing consumed, caller may repeat the call with a bigger buffer
+            return -6;
         }
-
-        SSF_BUFFER outputBuffer;
-        hr = SSFMuxProcessOutput(pMux->hSSFMux, pStream->dwStreamIndex, &outputBuffer);
-        if (FAILED(hr))
+        else if (FAILED(hr))
         {
             *pOutputDataSize = hr;
             return -4;
         }
 
-        ++pStream->dwChunkIndex;
-        pStream->fChunkInProgress = FALSE;
+        if (eKind == OutputChunk)
+        {
+            nResult = 2;
+        }
+        else
+        {
+            ++pStream->dwChunkIndex;
+            pStream->fChunkInProgress = FALSE;
+            nResult = 1;
 
-        *pOutputDataSize = outputBuffer.cbBuffer;
-        *ppOutputData = outputBuffer.pbBuffer;
-        nResult = 1;
+            if (pStream->pMux->lReferenceVideoStream == (LONG)pStream->dwStreamIndex + 1)
+            {
+                // aligned audio streams cut at this time as well
+                InterlockedExchange64(&pStream->pMux->rtVideoCutTime, nStartTime);
+            }
+        }
     }
-
-    SSF_SAMPLE inputSample = { 0 };
-    inputSample.qwSampleStartTime = (UINT64)(nStartTime);
-    inputSample.pSampleData = pSampleData;
-    inputSample.cbSampleData = nSampleDataSize;
-    inputSample.flags = SSF_SAMPLE_FLAG_START_TIME;
-
-    if (bIsKeyFrame)
+    else
     {
-        inputSample.FrameType = FRAMETYPE_I;
+        *pOutputDataSize = 0;
     }
 
-    if (nStopTime > 0)
-    {
-        inputSample.qwSampleDuration = nStopTime - nStartTime;
-        inputSample.flags |= SSF_SAMPLE_FLAG_DURATION;
-    }
+    pStream->rtChunkCurrentTime = nStartTime;
 
     if (!pStream->fChunkInProgress)
     {
@@ -309,102 +515,810 @@ int MCOMMS_API MCSSF_PushMedia(int nMuxId, int nStreamId, LONGLONG nStartTime, L
         pStream->fChunkInProgress = TRUE;
     }
 
-    hr = SSFMuxProcessInput(pMux->hSSFMux, pStream->dwStreamIndex, &inputSample);
+    LONGLONG nStopTime = pSample->nStopTime > 0 ? pSample->nStopTime : 0;
+    DWORD cbData = pSample->nDataSize > 0 ? (DWORD)pSample->nDataSize : 0;
+    if (pSample->pfnRelease != NULL)
+    {
+        hr = pStream->pWriter->AddSampleReference(nStartTime, nStopTime, pSample->bIsKeyFrame, pSample->pData, cbData, pSample->pfnRelease, pSample->pvReleaseContext);
+    }
+    else
+    {
+        hr = pStream->pWriter->AddSample(nStartTime, nStopTime, pSample->bIsKeyFrame, pSample->pData, cbData);
+    }
+
     if (FAILED(hr))
     {
         *pOutputDataSize = hr;
         return -5;
     }
 
+    if (pStream->pMux->pHls != NULL)
+    {
+        pStream->pMux->pHls->AddSample((int)pStream->dwStreamIndex, nStartTime, pSample->bIsKeyFrame, pSample->pData, cbData);
+    }
+
     return nResult;
 }
 
-int MCOMMS_API MCSSF_GetIndex(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData)
+// Adds sample of a batch call, packing the fragment it completes into pOutput. Returns 1 when the
+// sample is taken, 0 when there's no room for its fragment, -6 with the required size when the
+// fragment doesn't fit into the remaining space, other negative codes as PushStreamSample with
+// its HRESULT in *pRequiredSize. *pOutputKind receives the result of PushStreamSample for a taken
+// sample: 0 without output, 1 for a fragment and 2 for a chunk.
+static int PackSample(StreamContext* pStream, const MCSSF_SAMPLE* pSample, int nIndex, MCSSF_BUFFER* pOutput, MCSSF_FRAGMENT* pFragments, int nMaxFragments, int* pFragmentCount, int* pRequiredSize, int* pOutputKind)
 {
-    MuxContext* pMux = NULL;
+    OutputKind eKind = OutputFragment;
+    int nSpace = pOutput->nCapacity - pOutput->nDataSize;
+    BOOL fBoundary = GetBoundary(pStream, pSample, &eKind);
+    if (fBoundary && (*pFragmentCount >= nMaxFragments || nSpace <= 0))
+    {
+        return 0;
+    }
 
-    EnterCriticalSection(&g_csInstance);
+    BYTE* pbFragment = pOutput->pData + pOutput->nDataSize;
+    int nResult = PushStreamSample(pStream, pSample, fBoundary, eKind, &nSpace, &pbFragment);
+    if (nResult < 0)
+    {
+        *pRequiredSize = nSpace;
+        return nResult;
+    }
 
-    map<int, MuxContext*>::iterator i_m = g_pMuxes->find(nMuxId);
-    if (i_m != g_pMuxes->end())
+    *pOutputKind = nResult;
+    if (nResult > 0)
     {
-        pMux = i_m->second;
+        MCSSF_FRAGMENT* pFragment = &pFragments[(*pFragmentCount)++];
+        pFragment->nStreamId = (int)pStream->dwStreamIndex;
+        pFragment->nSampleIndex = nIndex;
+        pFragment->nOffset = pOutput->nDataSize;
+        pFragment->nDataSize = nSpace;
+        pOutput->nDataSize += nSpace;
     }
 
-    LeaveCriticalSection(&g_csInstance);
+    return 1;
+}
+
+// Pushes one sample through PackSample. Output goes to the caller's buffer when *ppOutputData is
+// not NULL and *pOutputDataSize holds its capacity, otherwise to the stream's own buffer, which
+// moves to a bigger size class when the output doesn't fit. Returns as MCSSF_PushSample.
+static int PushSample(int nMuxId, int nStreamId, const MCSSF_SAMPLE* pSample, int* pOutputDataSize, BYTE** ppOutputData)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
 
     if (pMux == NULL)
     {
         return -1;
     }
 
-    map<int, StreamContext*>::iterator i_s = pMux->pStreams->find(nStreamId);
-    if (i_s == pMux->pStreams->end())
+    StreamContext* pStream = FindStream(pMux, nStreamId);
+    if (pStream == NULL)
     {
-        return -1;
+        return -2;
     }
 
-    StreamContext* pStream = i_s->second;
+    BufferPool& pool = BufferPool::Instance();
+    BOOL fOwnOutput = *ppOutputData == NULL || *pOutputDataSize <= 0;
+    if (fOwnOutput && pStream->pbOutput == NULL)
+    {
+        pStream->pbOutput = pool.Acquire(0, &pStream->cbOutput);
+        if (pStream->pbOutput == NULL)
+        {
+            *pOutputDataSize = E_OUTOFMEMORY;
+            return -4;
+        }
+    }
 
-    SSF_BUFFER outputBuffer;
-    HRESULT hr = SSFMuxGetIndex(pMux->hSSFMux, &pStream->dwStreamIndex, 1, &outputBuffer);
-    if (FAILED(hr))
+    MCSSF_BUFFER output;
+    output.pData = fOwnOutput ? pStream->pbOutput : *ppOutputData;
+    output.nCapacity = fOwnOutput ? (int)pStream->cbOutput : *pOutputDataSize;
+    output.nDataSize = 0;
+
+    MCSSF_FRAGMENT fragment;
+    int nFragmentCount = 0;
+    int nRequiredSize = 0;
+    int nOutputKind = 0;
+    int nResult = PackSample(pStream, pSample, 0, &output, &fragment, 1, &nFragmentCount, &nRequiredSize, &nOutputKind);
+    if (nResult == -6 && fOwnOutput)
     {
-        return -1;
+        // nothing consumed, move to the size class which fits and repeat, the old buffer goes back to the pool
+        pool.Release(pStream->pbOutput);
+        pStream->pbOutput = pool.Acquire((DWORD)nRequiredSize, &pStream->cbOutput);
+        if (pStream->pbOutput == NULL)
+        {
+            *pOutputDataSize = E_OUTOFMEMORY;
+            return -4;
+        }
+
+        output.pData = pStream->pbOutput;
+        output.nCapacity = (int)pStream->cbOutput;
+        nResult = PackSample(pStream, pSample, 0, &output, &fragment, 1, &nFragmentCount, &nRequiredSize, &nOutputKind);
     }
 
-    *pDataSize = outputBuffer.cbBuffer;
-    *ppData = outputBuffer.pbBuffer;
+    if (nResult < 0)
+    {
+        *pOutputDataSize = nRequiredSize;
+        return nResult;
+    }
 
-    return 1;
+    *pOutputDataSize = output.nDataSize;
+    if (fOwnOutput)
+    {
+        *ppOutputData = output.nDataSize > 0 ? output.pData : NULL;
+    }
+
+    return nOutputKind;
 }
 
-int MCOMMS_API MCSSF_Uninitialize(int nMuxId)
+int MCOMMS_API MCSSF_PushMedia(int nMuxId, int nStreamId, LONGLONG nStartTime, LONGLONG nStopTime, BOOL bIsKeyFrame, int nSampleDataSize, BYTE* pSampleData, int* pOutputDataSize, BYTE** ppOutputData)
+{
+    MCSSF_SAMPLE sample;
+    ZeroMemory(&sample, sizeof(sample));
+    sample.nStartTime = nStartTime;
+    sample.nStopTime = nStopTime;
+    sample.bIsKeyFrame = bIsKeyFrame;
+    sample.nDataSize = nSampleDataSize;
+    sample.pData = pSampleData;
+
+    return PushSample(nMuxId, nStreamId, &sample, pOutputDataSize, ppOutputData);
+}
+
+int MCOMMS_API MCSSF_PushSample(int nMuxId, int nStreamId, const MCSSF_SAMPLE* pSample, MCSSF_BUFFER* pOutput)
 {
-    int nResult = 1;
+    if (pSample == NULL || pOutput == NULL)
+    {
+        return -5;
+    }
 
-    EnterCriticalSection(&g_csInstance);
+    BYTE* pbOutput = pOutput->pData;
+    pOutput->nDataSize = pOutput->nCapacity;
 
-    if (g_pMuxes != NULL)
+    int nResult = PushSample(nMuxId, nStreamId, pSample, &pOutput->nDataSize, &pbOutput);
+    if (nResult > 0 && pbOutput != pOutput->pData)
     {
-        map<int, MuxContext*>::iterator i_m = g_pMuxes->find(nMuxId);
-        if (i_m != g_pMuxes->end())
-        {
-            MuxContext* pMux = i_m->second;
+        // caller did not provide a buffer, hand out the stream's own one
+        pOutput->pData = pbOutput;
+    }
+
+    return nResult;
+}
+
+int MCOMMS_API MCSSF_PushSamples(int nMuxId, const int* pStreamIds, const MCSSF_SAMPLE* pSamples, int nSampleCount, MCSSF_BUFFER* pOutput, MCSSF_FRAGMENT* pFragments, int nMaxFragments, int* pFragmentCount)
+{
+    if (pStreamIds == NULL || pSamples == NULL || pOutput == NULL || pOutput->pData == NULL || pFragments == NULL || pFragmentCount == NULL)
+    {
+        return -5;
+    }
+
+    *pFragmentCount = 0;
+    pOutput->nDataSize = 0;
+
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    StreamContext* pStream = NULL;
+    int nSample = 0;
 
-            if (pMux->pStreams)
+    for (; nSample < nSampleCount; ++nSample)
+    {
+        if (pStream == NULL || (int)pStream->dwStreamIndex != pStreamIds[nSample])
+        {
+            pStream = FindStream(pMux, pStreamIds[nSample]);
+            if (pStream == NULL)
             {
-                for (map<int, StreamContext*>::iterator i_s = pMux->pStreams->begin(); i_s != pMux->pStreams->end(); ++i_s)
-                {
-                    if (i_s->second->pbTypeInfo)
-                    {
-                        delete[] i_s->second->pbTypeInfo;
-                    }
-                    delete i_s->second;
-                }
+                return nSample > 0 ? nSample : -2;
             }
+        }
 
-            if (NULL != pMux->hSSFMux)
+        int nRequiredSize = 0;
+        int nOutputKind = 0;
+        int nResult = PackSample(pStream, &pSamples[nSample], nSample, pOutput, pFragments, nMaxFragments, pFragmentCount, &nRequiredSize, &nOutputKind);
+        if (nResult == -6)
+        {
+            if (nSample == 0)
             {
-                SSFMuxDestroy(pMux->hSSFMux);
+                pOutput->nDataSize = nRequiredSize;
+                return -6;
             }
 
-            delete pMux;
-            g_pMuxes->erase(i_m);
+            break;
         }
-        else
+        else if (nResult < 0)
+        {
+            return nSample > 0 ? nSample : nResult;
+        }
+        else if (nResult == 0)
+        {
+            // no room for another fragment, the rest is to be pushed again
+            break;
+        }
+    }
+
+    return nSample;
+}
+
+// Converts media message of the ingest context to a sample of its mux stream, stripping the FLV
+// audio/video tag header. Returns FALSE for everything the caller handles itself: other messages,
+// other codecs, codec configuration, end of sequence and media of tracks not registered yet.
+// Composition time offset of AVC frames is ignored, samples are timed by their decode time.
+static BOOL GetIngestSample(const MCSSF_INGEST_CONTEXT* pContext, const MCSSF_RTMP_MESSAGE* pMessage, int* pStreamId, MCSSF_SAMPLE* pSample)
+{
+    if (pMessage->nMessageStreamId != pContext->nMessageStreamId || pMessage->nDataSize < 2)
+    {
+        return FALSE;
+    }
+
+    const BYTE* pb = pMessage->pData;
+    BOOL fKeyFrame = TRUE;
+    int cbHeader = 0;
+
+    switch (pMessage->nMessageType)
+    {
+    case RTMPCHUNK_MESSAGE_AUDIO:
+        // sound format in the high nibble, AAC packet type follows
+        if ((pb[0] >> 4) != FLV_AUDIO_CODEC_AAC || pb[1] != FLV_PACKET_MEDIA)
         {
-            nResult = 0;
+            return FALSE;
         }
 
-        if (g_pMuxes->size() == 0)
+        *pStreamId = pContext->nAudioStreamId;
+        cbHeader = 2;
+        break;
+
+    case RTMPCHUNK_MESSAGE_VIDEO:
+        // frame type in the high nibble, codec in the low one, AVC packet type and composition time follow
+        if ((pb[0] & 0x0F) != FLV_VIDEO_CODEC_AVC || pMessage->nDataSize < 5 || pb[1] != FLV_PACKET_MEDIA)
         {
-            delete g_pMuxes;
-            g_pMuxes = NULL;
+            return FALSE;
         }
+
+        *pStreamId = pContext->nVideoStreamId;
+        fKeyFrame = (pb[0] >> 4) == FLV_FRAME_KEY;
+        cbHeader = 5;
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    if (*pStreamId < 0)
+    {
+        return FALSE;
     }
 
-    LeaveCriticalSection(&g_csInstance);
+    ZeroMemory(pSample, sizeof(MCSSF_SAMPLE));
+    pSample->nStartTime = ((LONGLONG)pMessage->nTimestamp - pContext->nTimestampAdjust) * 10000 + pContext->nTimestampOffset;
+    pSample->bIsKeyFrame = fKeyFrame;
+    pSample->nDataSize = pMessage->nDataSize - cbHeader;
+    pSample->pData = (BYTE*)pb + cbHeader;
 
-    return nResult;
+    return TRUE;
+}
+
+int MCOMMS_API MCSSF_IngestMessages(int nMuxId, const MCSSF_INGEST_CONTEXT* pContext, const MCSSF_RTMP_MESSAGE* pMessages, int nMessageCount, MCSSF_BUFFER* pOutput, MCSSF_FRAGMENT* pFragments, int nMaxFragments, int* pFragmentCount)
+{
+    if (pContext == NULL || pMessages == NULL || pOutput == NULL || pOutput->pData == NULL || pFragments == NULL || pFragmentCount == NULL)
+    {
+        return -5;
+    }
+
+    *pFragmentCount = 0;
+    pOutput->nDataSize = 0;
+
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    int nMessage = 0;
+
+    for (; nMessage < nMessageCount; ++nMessage)
+    {
+        int nStreamId = -1;
+        MCSSF_SAMPLE sample;
+        if (!GetIngestSample(pContext, &pMessages[nMessage], &nStreamId, &sample))
+        {
+            break;
+        }
+
+        StreamContext* pStream = FindStream(pMux, nStreamId);
+        if (pStream == NULL)
+        {
+            return nMessage > 0 ? nMessage : -2;
+        }
+
+        // the payload belongs to the demuxer, so the sample is copied
+        int nRequiredSize = 0;
+        int nOutputKind = 0;
+        int nResult = PackSample(pStream, &sample, nMessage, pOutput, pFragments, nMaxFragments, pFragmentCount, &nRequiredSize, &nOutputKind);
+        if (nResult == -6)
+        {
+            if (nMessage == 0)
+            {
+                pOutput->nDataSize = nRequiredSize;
+                return -6;
+            }
+
+            break;
+        }
+        else if (nResult < 0)
+        {
+            return nMessage > 0 ? nMessage : nResult;
+        }
+        else if (nResult == 0)
+        {
+            break;
+        }
+    }
+
+    return nMessage;
+}
+
+int MCOMMS_API MCSSF_EndStream(int nMuxId, int nStreamId, LONGLONG nEndTime, MCSSF_BUFFER* pOutput)
+{
+    if (pOutput == NULL)
+    {
+        return -5;
+    }
+
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    StreamContext* pStream = FindStream(pMux, nStreamId);
+    if (pStream == NULL)
+    {
+        return -2;
+    }
+
+    BYTE* pbOutput = pOutput->pData;
+    int nDataSize = pOutput->nCapacity;
+
+    HRESULT hr = ProduceOutput(pStream, OutputFragment, nEndTime, &nDataSize, &pbOutput);
+    if (hr == E_NOT_SUFFICIENT_BUFFER)
+    {
+        pOutput->nDataSize = nDataSize;
+        return -6;
+    }
+    else if (FAILED(hr))
+    {
+        pOutput->nDataSize = hr;
+        return -4;
+    }
+
+    pOutput->nDataSize = nDataSize;
+    if (nDataSize == 0)
+    {
+        return 0;
+    }
+
+    if (pbOutput != pOutput->pData)
+    {
+        // caller did not provide a buffer, hand out the stream's own one
+        pOutput->pData = pbOutput;
+    }
+
+    ++pStream->dwChunkIndex;
+    pStream->fChunkInProgress = FALSE;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_GetIndex(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    StreamContext* pStream = FindStream(pMux, nStreamId);
+    if (pStream == NULL)
+    {
+        return -1;
+    }
+
+    HRESULT hr = ProduceOutput(pStream, OutputIndex, 0, pDataSize, ppData);
+    if (hr == E_NOT_SUFFICIENT_BUFFER)
+    {
+        return -2;
+    }
+    else if (FAILED(hr))
+    {
+        return -1;
+    }
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_Uninitialize(int nMuxId)
+{
+    // waits for calls still using the mux, no new ones can get it
+    MuxContext* pMux = (MuxContext*)g_muxes.Remove(nMuxId);
+    if (pMux == NULL)
+    {
+        return 0;
+    }
+
+    for (int nStream = 0; nStream < MUX_MAX_STREAMS; ++nStream)
+    {
+        if (pMux->apStreams[nStream] != NULL)
+        {
+            DeleteStream(pMux->apStreams[nStream]);
+        }
+    }
+
+    delete pMux->pHls;
+    delete pMux;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_SetDefaultFragmentPolicy(int nMuxId, int nStreamType, const MCSSF_FRAGMENT_POLICY* pPolicy)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL || (nStreamType != FRAGMENT_STREAM_AUDIO && nStreamType != FRAGMENT_STREAM_VIDEO))
+    {
+        return -1;
+    }
+
+    if (!IsValidPolicy(pPolicy))
+    {
+        return -3;
+    }
+
+    pMux->aDefaultPolicy[nStreamType - 1] = *pPolicy;
+    return 1;
+}
+
+int MCOMMS_API MCSSF_SetFragmentPolicy(int nMuxId, int nStreamId, const MCSSF_FRAGMENT_POLICY* pPolicy)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    StreamContext* pStream = FindStream(pMux, nStreamId);
+    if (pStream == NULL)
+    {
+        return -2;
+    }
+
+    if (!IsValidPolicy(pPolicy))
+    {
+        return -3;
+    }
+
+    pStream->policy = *pPolicy;
+    return 1;
+}
+
+int MCOMMS_API MCSSF_AcquireBuffer(int nMinCapacity, MCSSF_BUFFER* pBuffer)
+{
+    if (pBuffer == NULL || nMinCapacity < 0)
+    {
+        return -1;
+    }
+
+    DWORD cbSize = 0;
+    BYTE* pbBuffer = BufferPool::Instance().Acquire((DWORD)nMinCapacity, &cbSize);
+    if (pbBuffer == NULL)
+    {
+        return -1;
+    }
+
+    pBuffer->pData = pbBuffer;
+    pBuffer->nCapacity = (int)cbSize;
+    pBuffer->nDataSize = 0;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_ReleaseBuffer(MCSSF_BUFFER* pBuffer)
+{
+    if (pBuffer == NULL || pBuffer->pData == NULL)
+    {
+        return -1;
+    }
+
+    if (FAILED(BufferPool::Instance().Release(pBuffer->pData)))
+    {
+        return -1;
+    }
+
+    pBuffer->pData = NULL;
+    pBuffer->nCapacity = 0;
+    pBuffer->nDataSize = 0;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_GetBufferPoolStats(MCSSF_BUFFER_POOL_STATS* pStats)
+{
+    if (pStats == NULL)
+    {
+        return -1;
+    }
+
+    BufferPoolStats stats;
+    BufferPool::Instance().GetStats(&stats);
+
+    pStats->nBytesAllocated = stats.qwBytesAllocated;
+    pStats->nBytesInUse = stats.qwBytesInUse;
+    pStats->nHighWaterBytesAllocated = stats.qwHighWaterBytesAllocated;
+    pStats->nHighWaterBytesInUse = stats.qwHighWaterBytesInUse;
+    pStats->nAcquireCount = stats.qwAcquireCount;
+    pStats->nAllocationCount = stats.qwAllocationCount;
+    pStats->nBuffersAllocated = stats.lBuffersAllocated;
+    pStats->nBuffersInUse = stats.lBuffersInUse;
+    pStats->nHighWaterBuffersAllocated = stats.lHighWaterBuffersAllocated;
+    pStats->nHighWaterBuffersInUse = stats.lHighWaterBuffersInUse;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_CreateChunkDemuxer()
+{
+    RtmpChunkDemuxer* pDemuxer = new RtmpChunkDemuxer();
+
+    int nDemuxerId = g_demuxers.Insert(pDemuxer);
+    if (nDemuxerId < 0)
+    {
+        delete pDemuxer;
+        return -1;
+    }
+
+    return nDemuxerId;
+}
+
+int MCOMMS_API MCSSF_DemuxChunks(int nDemuxerId, const BYTE* pData, int nDataSize, int* pConsumedSize, MCSSF_RTMP_MESSAGE* pMessages, int nMaxMessages)
+{
+    if ((pData == NULL && nDataSize > 0) || nDataSize < 0 || pConsumedSize == NULL || pMessages == NULL || nMaxMessages <= 0)
+    {
+        return -2;
+    }
+
+    RtmpChunkDemuxer* pDemuxer = (RtmpChunkDemuxer*)g_demuxers.Acquire(nDemuxerId);
+    if (pDemuxer == NULL)
+    {
+        return -1;
+    }
+
+    DWORD cbConsumed = 0;
+    DWORD dwCount = 0;
+    HRESULT hr = pDemuxer->Demux(pData, (DWORD)nDataSize, &cbConsumed, pMessages, (DWORD)nMaxMessages, &dwCount);
+
+    g_demuxers.Release(nDemuxerId);
+
+    *pConsumedSize = (int)cbConsumed;
+
+    return SUCCEEDED(hr) ? (int)dwCount : -3;
+}
+
+int MCOMMS_API MCSSF_DestroyChunkDemuxer(int nDemuxerId)
+{
+    RtmpChunkDemuxer* pDemuxer = (RtmpChunkDemuxer*)g_demuxers.Remove(nDemuxerId);
+    if (pDemuxer == NULL)
+    {
+        return 0;
+    }
+
+    delete pDemuxer;
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_EnableHlsOutput(int nMuxId, const MCSSF_HLS_POLICY* pPolicy)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL)
+    {
+        return -1;
+    }
+
+    if (pPolicy == NULL || pPolicy->nSegmentDuration <= 0 || pPolicy->nPlaylistLength <= 0)
+    {
+        return -3;
+    }
+
+    if (pMux->lStreamCount != 0)
+    {
+        return -2;
+    }
+
+    HlsOutput* pHls = new HlsOutput(pPolicy->nSegmentDuration, (DWORD)pPolicy->nPlaylistLength);
+    if (InterlockedCompareExchangePointer((void* volatile*)&pMux->pHls, pHls, NULL) != NULL)
+    {
+        delete pHls;
+        return -2;
+    }
+
+    return 1;
+}
+
+// Maps result of HlsOutput::Get* to export return codes, the buffer follows MCSSF_BUFFER rules
+static int GetHlsResult(HRESULT hr, DWORD cbWritten, MCSSF_BUFFER* pOutput)
+{
+    pOutput->nDataSize = (int)cbWritten;
+
+    if (hr == E_NOT_SUFFICIENT_BUFFER)
+    {
+        return -2;
+    }
+    else if (hr == S_FALSE)
+    {
+        return -4;
+    }
+    else if (FAILED(hr))
+    {
+        return -1;
+    }
+
+    return 1;
+}
+
+int MCOMMS_API MCSSF_GetHlsPlaylist(int nMuxId, int nRendition, MCSSF_BUFFER* pOutput)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL || pMux->pHls == NULL || pOutput == NULL || pOutput->nCapacity < 0)
+    {
+        return -1;
+    }
+
+    DWORD cbWritten = 0;
+    HRESULT hr = pMux->pHls->GetPlaylist(nRendition, pOutput->pData, (DWORD)pOutput->nCapacity, &cbWritten);
+    return GetHlsResult(hr, cbWritten, pOutput);
+}
+
+int MCOMMS_API MCSSF_GetHlsSegment(int nMuxId, int nRendition, int nSequence, MCSSF_BUFFER* pOutput)
+{
+    MuxReference mux(nMuxId);
+    MuxContext* pMux = mux.Get();
+
+    if (pMux == NULL || pMux->pHls == NULL || pOutput == NULL || pOutput->nCapacity < 0 || nSequence < 0)
+    {
+        return -1;
+    }
+
+    DWORD cbWritten = 0;
+    HRESULT hr = pMux->pHls->GetSegment(nRendition, (DWORD)nSequence, pOutput->pData, (DWORD)pOutput->nCapacity, &cbWritten);
+    return GetHlsResult(hr, cbWritten, pOutput);
+}
+
+int MCOMMS_API MCSSF_StartTransport(MCSSF_TRANSPORT_CONFIG* pConfig)
+{
+    NativeTransport* pTransport = NULL;
+
+    HRESULT hr = NativeTransport::Create(pConfig, &pTransport);
+    if (hr == E_NOTIMPL)
+    {
+        return -4;
+    }
+    else if (hr == E_POINTER || hr == E_INVALIDARG)
+    {
+        return -2;
+    }
+    else if (FAILED(hr))
+    {
+        return -1;
+    }
+
+    int nTransportId = g_transports.Insert(pTransport);
+    if (nTransportId < 0)
+    {
+        delete pTransport;
+        return -1;
+    }
+
+    return nTransportId;
+}
+
+int MCOMMS_API MCSSF_PollTransport(int nTransportId, int nReactor, MCSSF_TRANSPORT_EVENT* pEvents, int nMaxEvents, int nTimeoutMs)
+{
+    if (pEvents == NULL || nMaxEvents <= 0 || nTimeoutMs < 0)
+    {
+        return -2;
+    }
+
+    NativeTransport* pTransport = (NativeTransport*)g_transports.Acquire(nTransportId);
+    if (pTransport == NULL)
+    {
+        return -1;
+    }
+
+    DWORD dwCount = 0;
+    HRESULT hr = pTransport->Poll(nReactor, pEvents, (DWORD)nMaxEvents, (DWORD)nTimeoutMs, &dwCount);
+
+    g_transports.Release(nTransportId);
+
+    if (hr == S_FALSE)
+    {
+        return -5;
+    }
+
+    return SUCCEEDED(hr) ? (int)dwCount : -2;
+}
+
+int MCOMMS_API MCSSF_TransportSend(int nTransportId, int nConnectionId, const BYTE* pData, int nDataSize)
+{
+    if ((pData == NULL && nDataSize > 0) || nDataSize < 0)
+    {
+        return -2;
+    }
+
+    NativeTransport* pTransport = (NativeTransport*)g_transports.Acquire(nTransportId);
+    if (pTransport == NULL)
+    {
+        return -1;
+    }
+
+    HRESULT hr = pTransport->Send(nConnectionId, pData, (DWORD)nDataSize);
+
+    g_transports.Release(nTransportId);
+
+    if (hr == E_INVALIDARG)
+    {
+        return -1;
+    }
+
+    return SUCCEEDED(hr) ? 0 : -3;
+}
+
+int MCOMMS_API MCSSF_TransportDisconnect(int nTransportId, int nConnectionId)
+{
+    NativeTransport* pTransport = (NativeTransport*)g_transports.Acquire(nTransportId);
+    if (pTransport == NULL)
+    {
+        return 0;
+    }
+
+    BOOL fFound = pTransport->Disconnect(nConnectionId);
+
+    g_transports.Release(nTransportId);
+
+    return fFound ? 1 : 0;
+}
+
+int MCOMMS_API MCSSF_StopTransport(int nTransportId)
+{
+    NativeTransport* pTransport = (NativeTransport*)g_transports.Acquire(nTransportId);
+    if (pTransport == NULL)
+    {
+        return 0;
+    }
+
+    // wake up the pollers first, removing the handle waits for them to let go of the transport
+    pTransport->Stop();
+
+    g_transports.Release(nTransportId);
+
+    if (g_transports.Remove(nTransportId) != pTransport)
+    {
+        // stopped concurrently, the other caller deletes it
+        return 0;
+    }
+
+    delete pTransport;
+
+    return 1;
 }
@@ -1,17 +1,291 @@
 #pragma once
 
-#include "resource.h"
+#include "Resource.h"
 
 #define MCOMMS_EXPORTS
-#ifdef MCOMMS_EXPORTS
+#ifndef _WIN32
+#define MCOMMS_API __attribute__((visibility("default")))
+#elif defined(MCOMMS_EXPORTS)
 #define MCOMMS_API __declspec(dllexport)
 #else
 #define MCOMMS_API __declspec(dllimport)
 #endif
 
+// Output parameters (ppData/ppOutputData with their sizes) are in/out: when the caller passes
+// a non-NULL buffer together with its capacity the output is written there, otherwise the
+// returned pointer refers to a pooled buffer owned by the stream and valid until the next call
+// for it or until the mux is uninitialized.
+// A too small caller buffer yields -2 (-6 for MCSSF_PushMedia) with the required size set and
+// nothing consumed, so the call can be repeated with a bigger buffer.
+//
+// Mux ids are generation-checked handles, an id stays invalid once its mux is uninitialized.
+// Calls for different streams may run concurrently, including MCSSF_AddStream and
+// MCSSF_Uninitialize, which waits for calls still using the mux. Calls for the same stream
+// must be serialized by the caller.
+
+// Called by the muxer when it no longer references a borrowed sample
+typedef void (__cdecl *MCSSF_RELEASE_CALLBACK)(void* pvContext);
+
+// Media sample for MCSSF_PushSample(s). When pfnRelease is set the sample memory is borrowed:
+// it must stay valid until the muxer calls pfnRelease(pvReleaseContext), which happens once
+// the fragment containing the sample has been produced or the mux is uninitialized.
+// Without pfnRelease the sample is copied before the call returns.
+struct MCSSF_SAMPLE
+{
+    LONGLONG nStartTime;
+    LONGLONG nStopTime;
+    BOOL bIsKeyFrame;
+    int nDataSize;
+    BYTE* pData;
+    MCSSF_RELEASE_CALLBACK pfnRelease;
+    void* pvReleaseContext;
+};
+
+// Caller-provided output buffer, nDataSize receives the number of bytes written
+// (or the required size if nCapacity is not enough)
+struct MCSSF_BUFFER
+{
+    BYTE* pData;
+    int nCapacity;
+    int nDataSize;
+};
+
+// Fragment completed by MCSSF_PushSamples, placed at nOffset of the output buffer.
+// nSampleIndex is the batch index of the sample that started the next fragment.
+struct MCSSF_FRAGMENT
+{
+    int nStreamId;
+    int nSampleIndex;
+    int nOffset;
+    int nDataSize;
+};
+
+// When fragments of a stream are cut, all times in hns units.
+// nDuration: the fragment is completed by the first keyframe once this duration has passed.
+// nMaxDuration: the fragment is completed by any sample once this duration has passed, 0 disables it.
+// bAlignToVideo: audio only, fragments are completed together with the fragments of the first video
+// stream of the mux instead of on nDuration (nMaxDuration still applies).
+// nChunkDuration, nChunkSamples: chunked output mode, 0 disables. Samples of the fragment in progress
+// are emitted as a standalone moof + mdat chunk once they span nChunkDuration or number nChunkSamples;
+// push calls return 2 for a chunk and 1 for the chunk (or fragment) which completes a fragment.
+struct MCSSF_FRAGMENT_POLICY
+{
+    LONGLONG nDuration;
+    LONGLONG nMaxDuration;
+    LONGLONG nChunkDuration;
+    BOOL bAlignToVideo;
+    int nChunkSamples;
+};
+
+// Fragment buffer pool counters, high-water marks are kept since the library was loaded.
+// Allocated figures include the released buffers the pool keeps for reuse.
+struct MCSSF_BUFFER_POOL_STATS
+{
+    LONGLONG nBytesAllocated;
+    LONGLONG nBytesInUse;
+    LONGLONG nHighWaterBytesAllocated;
+    LONGLONG nHighWaterBytesInUse;
+    LONGLONG nAcquireCount;
+    LONGLONG nAllocationCount;
+    int nBuffersAllocated;
+    int nBuffersInUse;
+    int nHighWaterBuffersAllocated;
+    int nHighWaterBuffersInUse;
+};
+
+// Message reassembled by MCSSF_DemuxChunks. pData points into the input or into a buffer of the
+// demuxer and stays valid until the next call for the demuxer (the input must be kept as well).
+// nTimestamp is the absolute 32-bit RTMP timestamp in milliseconds, it wraps around.
+struct MCSSF_RTMP_MESSAGE
+{
+    int nChunkStreamId;
+    int nMessageStreamId;
+    int nMessageType;
+    DWORD nTimestamp;
+    int nDataSize;
+    const BYTE* pData;
+};
+
+// Routing and timing of media messages passed to MCSSF_IngestMessages. Audio and video of
+// nMessageStreamId go to the given mux streams (-1 while a track is not registered), sample
+// time is (nTimestamp - nTimestampAdjust) * 10000 + nTimestampOffset in hns units.
+struct MCSSF_INGEST_CONTEXT
+{
+    int nMessageStreamId;
+    int nAudioStreamId;
+    int nVideoStreamId;
+    LONGLONG nTimestampAdjust;
+    LONGLONG nTimestampOffset;
+};
+
+// Stream description for MCSSF_AddStreamConfig. pConfig is the AVCDecoderConfigurationRecord (video)
+// or AudioSpecificConfig (audio) as carried by FLV sequence headers. Video dimensions are taken from
+// the SPS when nWidth/nHeight are 0; the audio format comes from the AudioSpecificConfig, nChannels and
+// nSampleRate only fill in what it leaves undefined. szCacheKey (usually the publishing point) enables
+// reuse of the parsed configuration by later registrations of the same stream, NULL disables it.
+struct MCSSF_STREAM_CONFIG
+{
+    int nStreamType;
+    int nBitrate;
+    int nLanguage;
+    int nWidth;
+    int nHeight;
+    int nChannels;
+    int nSampleRate;
+    int nConfigSize;
+    const BYTE* pConfig;
+    const char* szCacheKey;
+};
+
+// HLS output settings for MCSSF_EnableHlsOutput. nSegmentDuration in hns units: a segment is completed
+// by the first video keyframe once this duration has passed. nPlaylistLength is the number of segments
+// listed in media playlists.
+struct MCSSF_HLS_POLICY
+{
+    LONGLONG nSegmentDuration;
+    int nPlaylistLength;
+};
+
+#define MCSSF_TRANSPORT_CONNECTED       1
+#define MCSSF_TRANSPORT_RECEIVED        2
+#define MCSSF_TRANSPORT_DISCONNECTED    3
+
+// Settings for MCSSF_StartTransport. nReactors 0 starts one reactor per processor and receives the
+// number actually started. Receive buffers start at nMinReceiveBuffer bytes per connection, grow up to
+// nMaxReceiveBuffer while reads fill them and shrink back when connections calm down. A connection
+// with more than nMaxSendQueue bytes waiting to be sent is dropped.
+struct MCSSF_TRANSPORT_CONFIG
+{
+    int nPort;
+    int nBacklog;
+    int nReactors;
+    int nMaxConnections;
+    int nMinReceiveBuffer;
+    int nMaxReceiveBuffer;
+    int nMaxSendQueue;
+};
+
+// Event reported by MCSSF_PollTransport. Received data is in the receive buffer of the connection
+// and stays valid until the next poll of the same reactor. nAddress (IPv4, network byte order) and
+// nPort identify the peer and are set for all event types.
+struct MCSSF_TRANSPORT_EVENT
+{
+    int nType;
+    int nConnectionId;
+    int nDataSize;
+    BYTE* pData;
+    unsigned int nAddress;
+    int nPort;
+};
+
 extern "C" int MCOMMS_API MCSSF_Initialize();
 extern "C" int MCOMMS_API MCSSF_AddStream(int nMuxId, int nStreamType, int nBitrate, unsigned short nLanguage, int nExtraDataSize, BYTE* pExtraData);
 extern "C" int MCOMMS_API MCSSF_GetHeader(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData);
 extern "C" int MCOMMS_API MCSSF_PushMedia(int nMuxId, int nStreamId, LONGLONG nStartTime, LONGLONG nStopTime, BOOL bIsKeyFrame, int nSampleDataSize, BYTE* pSampleData, int* pOutputDataSize, BYTE** ppOutputData);
 extern "C" int MCOMMS_API MCSSF_GetIndex(int nMuxId, int nStreamId, int* pDataSize, BYTE** ppData);
 extern "C" int MCOMMS_API MCSSF_Uninitialize(int nMuxId);
+// Adds stream from its FLV codec configuration, no MPEG2VIDEOINFO/WAVEFORMATEX needed.
+// Returns the stream id, -1 for unknown mux or too many streams, -2 for invalid arguments,
+// -3 for a malformed codec configuration.
+extern "C" int MCOMMS_API MCSSF_AddStreamConfig(int nMuxId, const MCSSF_STREAM_CONFIG* pConfig);
+
+// Pushes one sample, the same as MCSSF_PushSamples with a single sample except that without
+// pOutput->pData the stream's own buffer is handed out as described above. Returns 0 if nothing
+// has been completed, 1 if a fragment and 2 if a chunk of the current fragment has been written,
+// -6 with the required size if pOutput is too small, -1 for unknown mux, -2 for unknown stream,
+// -4 if the output can't be written, -5 for invalid arguments or if the sample can't be added.
+extern "C" int MCOMMS_API MCSSF_PushSample(int nMuxId, int nStreamId, const MCSSF_SAMPLE* pSample, MCSSF_BUFFER* pOutput);
+
+// Pushes samples of one or more streams of a mux, pStreamIds[i] is the stream of pSamples[i].
+// Completed fragments are packed into pOutput and described by pFragments. Returns the number
+// of samples consumed, which is less than nSampleCount when the output buffer or the fragment
+// list is full; the remaining samples should be pushed again once the output has been taken.
+extern "C" int MCOMMS_API MCSSF_PushSamples(int nMuxId, const int* pStreamIds, const MCSSF_SAMPLE* pSamples, int nSampleCount, MCSSF_BUFFER* pOutput, MCSSF_FRAGMENT* pFragments, int nMaxFragments, int* pFragmentCount);
+
+// Sets the policy of streams of nStreamType (1 audio, 2 video) added to the mux afterwards.
+// Defaults are 5 s for audio and 2 s for video without max duration and alignment.
+// Returns 1 on success, -1 for unknown mux or stream type, -3 for invalid policy.
+extern "C" int MCOMMS_API MCSSF_SetDefaultFragmentPolicy(int nMuxId, int nStreamType, const MCSSF_FRAGMENT_POLICY* pPolicy);
+
+// Changes the policy of one stream, effective for the fragment in progress. Counts as a call for
+// the stream, so it must not run concurrently with pushes to it.
+// Returns 1 on success, -1 for unknown mux, -2 for unknown stream, -3 for invalid policy.
+extern "C" int MCOMMS_API MCSSF_SetFragmentPolicy(int nMuxId, int nStreamId, const MCSSF_FRAGMENT_POLICY* pPolicy);
+
+// Takes a buffer of at least nMinCapacity bytes from the fragment buffer pool (sizes are rounded
+// up to power of two classes from 64 KB to 64 MB), pData and nCapacity of pBuffer are set.
+// The buffer belongs to the caller until it's passed to MCSSF_ReleaseBuffer and can be used as
+// output buffer of any call. Returns 1 on success, -1 on error.
+extern "C" int MCOMMS_API MCSSF_AcquireBuffer(int nMinCapacity, MCSSF_BUFFER* pBuffer);
+extern "C" int MCOMMS_API MCSSF_ReleaseBuffer(MCSSF_BUFFER* pBuffer);
+extern "C" int MCOMMS_API MCSSF_GetBufferPoolStats(MCSSF_BUFFER_POOL_STATS* pStats);
+
+// Creates RTMP chunk stream demuxer for the data following the handshake of one connection,
+// returns its id (same handle rules as mux ids) or -1 on error. Calls for the same demuxer
+// must be serialized by the caller.
+extern "C" int MCOMMS_API MCSSF_CreateChunkDemuxer();
+
+// Parses raw connection data and fills pMessages with complete messages, Set Chunk Size and
+// Abort messages are also applied by the demuxer. *pConsumedSize receives the number of bytes
+// taken, the rest should be passed again, prepended to new data, once the messages are handled.
+// Returns the number of messages, -1 for unknown demuxer, -2 for invalid arguments, -3 for
+// corrupted data (the connection has to be dropped).
+extern "C" int MCOMMS_API MCSSF_DemuxChunks(int nDemuxerId, const BYTE* pData, int nDataSize, int* pConsumedSize, MCSSF_RTMP_MESSAGE* pMessages, int nMaxMessages);
+
+// Returns 1 if the demuxer has been destroyed, 0 if it's unknown
+extern "C" int MCOMMS_API MCSSF_DestroyChunkDemuxer(int nDemuxerId);
+
+// Pushes demuxed AAC audio and AVC video messages to the mux: FLV tag headers are stripped and
+// completed fragments are packed into pOutput as by MCSSF_PushSamples, nSampleIndex being the
+// message index. Stops at the first message it doesn't take (any other message, codec
+// configuration, end of sequence, a track not registered in pContext), which the caller has to
+// handle before passing the rest again. Returns the number of messages consumed or the negative
+// codes of MCSSF_PushSamples.
+extern "C" int MCOMMS_API MCSSF_IngestMessages(int nMuxId, const MCSSF_INGEST_CONTEXT* pContext, const MCSSF_RTMP_MESSAGE* pMessages, int nMessageCount, MCSSF_BUFFER* pOutput, MCSSF_FRAGMENT* pFragments, int nMaxFragments, int* pFragmentCount);
+
+// Completes the fragment in progress at the end of the stream, nEndTime is the stop time of its
+// last sample. pOutput is used as by MCSSF_PushSample. Returns 1 if the fragment has been written,
+// 0 if no samples are pending, -6 with the required size if pOutput is too small, -1 for unknown
+// mux, -2 for unknown stream, -4 if the fragment can't be written, -5 for invalid arguments.
+extern "C" int MCOMMS_API MCSSF_EndStream(int nMuxId, int nStreamId, LONGLONG nEndTime, MCSSF_BUFFER* pOutput);
+
+// Makes the mux produce HLS (MPEG-2 TS segments and m3u8 playlists in memory) from the samples pushed
+// to it, in addition to the Smooth Streaming output. Each video stream becomes a rendition with the
+// first audio stream muxed in, the first audio stream an audio only rendition as well; renditions are
+// numbered in the order streams are added. Must be called before streams are added.
+// Returns 1 on success, -1 for unknown mux, -2 if streams are added already or HLS is enabled, -3 for invalid policy.
+extern "C" int MCOMMS_API MCSSF_EnableHlsOutput(int nMuxId, const MCSSF_HLS_POLICY* pPolicy);
+
+// Copies playlist into pOutput: master playlist (referring to "<rendition>.m3u8") for nRendition -1,
+// otherwise media playlist of the rendition (referring to "<rendition>-<sequence>.ts").
+// Returns 1 on success, -1 for unknown mux, rendition or HLS not enabled, -2 with the required size
+// when the buffer is too small, -4 if there's no stream or complete segment yet.
+extern "C" int MCOMMS_API MCSSF_GetHlsPlaylist(int nMuxId, int nRendition, MCSSF_BUFFER* pOutput);
+
+// Copies segment of the rendition into pOutput, return codes as MCSSF_GetHlsPlaylist, -4 if the
+// segment is not (or no longer) available.
+extern "C" int MCOMMS_API MCSSF_GetHlsSegment(int nMuxId, int nRendition, int nSequence, MCSSF_BUFFER* pOutput);
+
+// Native TCP server transport: every reactor has its own listening socket on the port (SO_REUSEPORT),
+// so the kernel spreads new connections over reactors, and its own edge-triggered epoll set which
+// serves accepted connections till they are closed. Reactors are driven by the caller, one thread
+// per reactor calling MCSSF_PollTransport. Returns the transport id (same handle rules as mux ids),
+// -1 if the listening sockets can't be set up, -2 for invalid settings, -4 where epoll isn't available.
+extern "C" int MCOMMS_API MCSSF_StartTransport(MCSSF_TRANSPORT_CONFIG* pConfig);
+
+// Waits up to nTimeoutMs for events of the reactor and performs the I/O behind them. Every connection
+// reports at most one receive per call. Returns the number of events, -1 for unknown transport,
+// -2 for invalid arguments, -5 once the transport is being stopped. Calls for the same reactor
+// must be serialized by the caller.
+extern "C" int MCOMMS_API MCSSF_PollTransport(int nTransportId, int nReactor, MCSSF_TRANSPORT_EVENT* pEvents, int nMaxEvents, int nTimeoutMs);
+
+// Sends data or queues what the socket doesn't take at once, may be called from any thread.
+// Returns 0 on success, -1 for unknown transport or connection, -2 for invalid arguments, -3 if the
+// connection has failed or its send queue overflowed, it's being dropped then.
+extern "C" int MCOMMS_API MCSSF_TransportSend(int nTransportId, int nConnectionId, const BYTE* pData, int nDataSize);
+
+// Shuts connection down, its reactor reports it disconnected. Returns 1 if the connection was found.
+extern "C" int MCOMMS_API MCSSF_TransportDisconnect(int nTransportId, int nConnectionId);
+
+// Wakes up pending polls, waits for them and closes all sockets. Returns 1 if the transport has been stopped.
+extern "C" int MCOMMS_API MCSSF_StopTransport(int nTransportId);
@@ -0,0 +1,700 @@
+#include "stdafx.h"
+#include "NativeTransport.h"
+
+#ifdef __linux__
+
+#include <deque>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace std;
+
+// epoll_wait batch size per reactor
+#define NATIVETRANSPORT_EPOLL_EVENTS 256
+
+struct NativeTransport::Connection
+{
+    int fd;
+    int nId;
+    unsigned int nAddress;
+    int nPort;
+
+    // touched by the reactor only
+    BYTE* pbReceive;
+    DWORD cbReceive;
+    DWORD cbNextReceive;    // size the buffer gets before the next read
+    DWORD dwSmallReads;
+    DWORD dwLastPoll;       // poll which reported the buffer content
+    BOOL fReady;            // in the ready list
+    BOOL fAnnounced;        // connected event has been reported
+
+    // protects everything below and the socket against concurrent senders
+    CRITICAL_SECTION cs;
+    vector<BYTE> sendQueue;
+    size_t cbSendOffset;
+    BOOL fFailed;
+};
+
+struct NativeTransport::Reactor
+{
+    int fdListen;
+    int fdEpoll;
+    int fdWake;
+
+    // serializes polls and Stop
+    CRITICAL_SECTION csPoll;
+    DWORD dwPoll;
+
+    vector<Connection*> connections;
+
+    // connections which may have unread data, edge-triggered epoll won't tell again
+    deque<Connection*> ready;
+
+    // accepted connections whose connected event didn't fit into the last poll
+    deque<Connection*> accepted;
+
+    // closed connections, deleted by the next poll once their data isn't referenced anymore
+    vector<Connection*> closed;
+
+    vector<epoll_event> events;
+};
+
+NativeTransport::NativeTransport(const MCSSF_TRANSPORT_CONFIG* pConfig)
+    : m_lConnectionCount(0), m_lStopping(0)
+{
+    m_config = *pConfig;
+}
+
+NativeTransport::~NativeTransport()
+{
+    Stop();
+
+    for (size_t i = 0; i < m_reactors.size(); ++i)
+    {
+        DeleteCriticalSection(&m_reactors[i]->csPoll);
+        delete m_reactors[i];
+    }
+}
+
+HRESULT NativeTransport::Create(MCSSF_TRANSPORT_CONFIG* pConfig, NativeTransport** ppTransport)
+{
+    if (pConfig == NULL || ppTransport == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (pConfig->nPort <= 0 || pConfig->nPort > 65535 || pConfig->nBacklog <= 0 || pConfig->nReactors < 0 ||
+        pConfig->nMaxConnections <= 0 || pConfig->nMaxConnections >= HANDLETABLE_CAPACITY ||
+        pConfig->nMinReceiveBuffer < NATIVETRANSPORT_MIN_RECEIVE_BUFFER || pConfig->nMaxReceiveBuffer < pConfig->nMinReceiveBuffer ||
+        pConfig->nMaxSendQueue <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    MCSSF_TRANSPORT_CONFIG config = *pConfig;
+    if (config.nReactors == 0)
+    {
+        long lProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+        config.nReactors = lProcessors > 0 ? (int)lProcessors : 1;
+    }
+
+    NativeTransport* pTransport = new NativeTransport(&config);
+
+    HRESULT hr = pTransport->Start();
+    if (FAILED(hr))
+    {
+        delete pTransport;
+        return hr;
+    }
+
+    pConfig->nReactors = config.nReactors;
+    *ppTransport = pTransport;
+
+    return S_OK;
+}
+
+HRESULT NativeTransport::Start()
+{
+    for (int i = 0; i < m_config.nReactors; ++i)
+    {
+        Reactor* pReactor = new Reactor();
+        pReactor->fdListen = -1;
+        pReactor->fdEpoll = -1;
+        pReactor->fdWake = -1;
+        pReactor->dwPoll = 0;
+        pReactor->events.resize(NATIVETRANSPORT_EPOLL_EVENTS);
+        InitializeCriticalSection(&pReactor->csPoll);
+        m_reactors.push_back(pReactor);
+
+        // every reactor listens on the port, the kernel spreads incoming connections among them
+        pReactor->fdListen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (pReactor->fdListen < 0)
+        {
+            return E_FAIL;
+        }
+
+        int nOn = 1;
+        if (setsockopt(pReactor->fdListen, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn)) != 0 ||
+            setsockopt(pReactor->fdListen, SOL_SOCKET, SO_REUSEPORT, &nOn, sizeof(nOn)) != 0)
+        {
+            return E_FAIL;
+        }
+
+        sockaddr_in addr;
+        ZeroMemory(&addr, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((unsigned short)m_config.nPort);
+
+        if (bind(pReactor->fdListen, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(pReactor->fdListen, m_config.nBacklog) != 0)
+        {
+            return E_FAIL;
+        }
+
+        pReactor->fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+        pReactor->fdWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (pReactor->fdEpoll < 0 || pReactor->fdWake < 0)
+        {
+            return E_FAIL;
+        }
+
+        // listening socket is tagged with NULL, wake-up event with the reactor, connections with themselves
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_ADD, pReactor->fdListen, &ev) != 0)
+        {
+            return E_FAIL;
+        }
+
+        ev.data.ptr = pReactor;
+        if (epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_ADD, pReactor->fdWake, &ev) != 0)
+        {
+            return E_FAIL;
+        }
+    }
+
+    return S_OK;
+}
+
+void NativeTransport::Stop()
+{
+    if (InterlockedExchange(&m_lStopping, 1) != 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_reactors.size(); ++i)
+    {
+        if (m_reactors[i]->fdWake >= 0)
+        {
+            uint64_t nWake = 1;
+            ssize_t cbWritten = write(m_reactors[i]->fdWake, &nWake, sizeof(nWake));
+            (void)cbWritten;
+        }
+    }
+
+    for (size_t i = 0; i < m_reactors.size(); ++i)
+    {
+        Reactor* pReactor = m_reactors[i];
+
+        // polls in progress return after the wake-up, later ones see the stopping flag
+        EnterCriticalSection(&pReactor->csPoll);
+
+        for (size_t j = 0; j < pReactor->connections.size(); ++j)
+        {
+            Connection* pConnection = pReactor->connections[j];
+            m_connections.Remove(pConnection->nId);
+            close(pConnection->fd);
+            DeleteConnection(pConnection);
+        }
+
+        for (size_t j = 0; j < pReactor->closed.size(); ++j)
+        {
+            DeleteConnection(pReactor->closed[j]);
+        }
+
+        pReactor->connections.clear();
+        pReactor->closed.clear();
+        pReactor->ready.clear();
+        pReactor->accepted.clear();
+
+        if (pReactor->fdListen >= 0)
+        {
+            close(pReactor->fdListen);
+            pReactor->fdListen = -1;
+        }
+
+        if (pReactor->fdEpoll >= 0)
+        {
+            close(pReactor->fdEpoll);
+            pReactor->fdEpoll = -1;
+        }
+
+        if (pReactor->fdWake >= 0)
+        {
+            close(pReactor->fdWake);
+            pReactor->fdWake = -1;
+        }
+
+        LeaveCriticalSection(&pReactor->csPoll);
+    }
+}
+
+HRESULT NativeTransport::Poll(int nReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents, DWORD dwTimeoutMs, DWORD* pdwEventCount)
+{
+    if (nReactor < 0 || nReactor >= (int)m_reactors.size() || pEvents == NULL || dwMaxEvents == 0 || pdwEventCount == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    *pdwEventCount = 0;
+
+    Reactor* pReactor = m_reactors[nReactor];
+    EnterCriticalSection(&pReactor->csPoll);
+
+    if (m_lStopping)
+    {
+        LeaveCriticalSection(&pReactor->csPoll);
+        return S_FALSE;
+    }
+
+    // events reported by the previous poll have been processed, their buffers can be reused
+    ++pReactor->dwPoll;
+
+    for (size_t i = 0; i < pReactor->closed.size(); ++i)
+    {
+        DeleteConnection(pReactor->closed[i]);
+    }
+    pReactor->closed.clear();
+
+    DWORD dwCount = AnnounceConnections(pReactor, pEvents, dwMaxEvents);
+    dwCount += ServeReadyList(pReactor, pEvents + dwCount, dwMaxEvents - dwCount);
+
+    if (dwCount < dwMaxEvents)
+    {
+        // don't wait while there is something to report or to read
+        int nTimeout = (dwCount > 0 || !pReactor->ready.empty()) ? 0 : (int)dwTimeoutMs;
+
+        int nReady = epoll_wait(pReactor->fdEpoll, &pReactor->events[0], (int)pReactor->events.size(), nTimeout);
+
+        for (int i = 0; i < nReady; ++i)
+        {
+            const epoll_event& ev = pReactor->events[i];
+
+            if (ev.data.ptr == NULL)
+            {
+                Accept(pReactor);
+            }
+            else if (ev.data.ptr == pReactor)
+            {
+                uint64_t nWake = 0;
+                ssize_t cbRead = read(pReactor->fdWake, &nWake, sizeof(nWake));
+                (void)cbRead;
+            }
+            else
+            {
+                Connection* pConnection = (Connection*)ev.data.ptr;
+
+                if (ev.events & EPOLLOUT)
+                {
+                    FlushSendQueue(pConnection);
+                }
+
+                if ((ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !pConnection->fReady)
+                {
+                    pConnection->fReady = TRUE;
+                    pReactor->ready.push_back(pConnection);
+                }
+            }
+        }
+
+        dwCount += AnnounceConnections(pReactor, pEvents + dwCount, dwMaxEvents - dwCount);
+        dwCount += ServeReadyList(pReactor, pEvents + dwCount, dwMaxEvents - dwCount);
+    }
+
+    *pdwEventCount = dwCount;
+
+    LeaveCriticalSection(&pReactor->csPoll);
+
+    return S_OK;
+}
+
+void NativeTransport::Accept(Reactor* pReactor)
+{
+    // edge-triggered, accept till the backlog is empty
+    while (true)
+    {
+        sockaddr_in addr;
+        socklen_t cbAddr = sizeof(addr);
+
+        int fd = accept4(pReactor->fdListen, (sockaddr*)&addr, &cbAddr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        if (InterlockedIncrement(&m_lConnectionCount) > m_config.nMaxConnections)
+        {
+            InterlockedDecrement(&m_lConnectionCount);
+            close(fd);
+            continue;
+        }
+
+        int nOn = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nOn, sizeof(nOn));
+
+        Connection* pConnection = new Connection();
+        pConnection->fd = fd;
+        pConnection->nAddress = addr.sin_addr.s_addr;
+        pConnection->nPort = ntohs(addr.sin_port);
+        pConnection->cbReceive = (DWORD)m_config.nMinReceiveBuffer;
+        pConnection->cbNextReceive = pConnection->cbReceive;
+        pConnection->pbReceive = (BYTE*)malloc(pConnection->cbReceive);
+        pConnection->dwSmallReads = 0;
+        pConnection->dwLastPoll = 0;
+        pConnection->fReady = FALSE;
+        pConnection->fAnnounced = FALSE;
+        pConnection->cbSendOffset = 0;
+        pConnection->fFailed = FALSE;
+        InitializeCriticalSection(&pConnection->cs);
+
+        pConnection->nId = pConnection->pbReceive != NULL ? m_connections.Insert(pConnection) : -1;
+        if (pConnection->nId < 0)
+        {
+            close(fd);
+            DeleteConnection(pConnection);
+            continue;
+        }
+
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = pConnection;
+        if (epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            m_connections.Remove(pConnection->nId);
+            close(fd);
+            DeleteConnection(pConnection);
+            continue;
+        }
+
+        pReactor->connections.push_back(pConnection);
+        pReactor->accepted.push_back(pConnection);
+    }
+}
+
+DWORD NativeTransport::AnnounceConnections(Reactor* pReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents)
+{
+    DWORD dwCount = 0;
+
+    while (dwCount < dwMaxEvents && !pReactor->accepted.empty())
+    {
+        Connection* pConnection = pReactor->accepted.front();
+        pReactor->accepted.pop_front();
+
+        pConnection->fAnnounced = TRUE;
+        FillEvent(&pEvents[dwCount++], MCSSF_TRANSPORT_CONNECTED, pConnection);
+    }
+
+    return dwCount;
+}
+
+DWORD NativeTransport::ServeReadyList(Reactor* pReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents)
+{
+    DWORD dwCount = 0;
+
+    // one read per connection and poll, connections with more data go to the back of the list
+    for (size_t nLeft = pReactor->ready.size(); nLeft > 0 && dwCount < dwMaxEvents; --nLeft)
+    {
+        Connection* pConnection = pReactor->ready.front();
+        pReactor->ready.pop_front();
+
+        if (pConnection->dwLastPoll == pReactor->dwPoll || !pConnection->fAnnounced)
+        {
+            // buffer is already reported by this poll, or the connect hasn't been
+            pReactor->ready.push_back(pConnection);
+            continue;
+        }
+
+        if (pConnection->cbNextReceive != pConnection->cbReceive)
+        {
+            BYTE* pbReceive = (BYTE*)realloc(pConnection->pbReceive, pConnection->cbNextReceive);
+            if (pbReceive != NULL)
+            {
+                pConnection->pbReceive = pbReceive;
+                pConnection->cbReceive = pConnection->cbNextReceive;
+            }
+            else
+            {
+                pConnection->cbNextReceive = pConnection->cbReceive;
+            }
+        }
+
+        ssize_t cbRead = recv(pConnection->fd, pConnection->pbReceive, pConnection->cbReceive, 0);
+
+        if (cbRead > 0)
+        {
+            FillEvent(&pEvents[dwCount], MCSSF_TRANSPORT_RECEIVED, pConnection);
+            pEvents[dwCount].nDataSize = (int)cbRead;
+            pEvents[dwCount].pData = pConnection->pbReceive;
+            ++dwCount;
+
+            pConnection->dwLastPoll = pReactor->dwPoll;
+
+            if ((DWORD)cbRead == pConnection->cbReceive)
+            {
+                // buffer filled up, there's probably more
+                pConnection->cbNextReceive = min(pConnection->cbReceive * 2, (DWORD)m_config.nMaxReceiveBuffer);
+                pConnection->dwSmallReads = 0;
+                pReactor->ready.push_back(pConnection);
+                continue;
+            }
+
+            if ((DWORD)cbRead < pConnection->cbReceive / 4 && ++pConnection->dwSmallReads >= NATIVETRANSPORT_SHRINK_READS)
+            {
+                pConnection->cbNextReceive = max(pConnection->cbReceive / 2, (DWORD)m_config.nMinReceiveBuffer);
+                pConnection->dwSmallReads = 0;
+            }
+
+            // short read drained the socket, data arriving later raises a new edge
+            pConnection->fReady = FALSE;
+        }
+        else if (cbRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pConnection->fReady = FALSE;
+        }
+        else if (cbRead < 0 && errno == EINTR)
+        {
+            pReactor->ready.push_back(pConnection);
+        }
+        else
+        {
+            pConnection->fReady = FALSE;
+            CloseConnection(pReactor, pConnection, &pEvents[dwCount++]);
+        }
+    }
+
+    return dwCount;
+}
+
+void NativeTransport::FlushSendQueue(Connection* pConnection)
+{
+    EnterCriticalSection(&pConnection->cs);
+
+    while (!pConnection->fFailed && pConnection->cbSendOffset < pConnection->sendQueue.size())
+    {
+        ssize_t cbSent = send(pConnection->fd, &pConnection->sendQueue[pConnection->cbSendOffset],
+            pConnection->sendQueue.size() - pConnection->cbSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (cbSent > 0)
+        {
+            pConnection->cbSendOffset += cbSent;
+        }
+        else if (cbSent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (cbSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else
+        {
+            DropConnection(pConnection);
+        }
+    }
+
+    if (pConnection->cbSendOffset == pConnection->sendQueue.size())
+    {
+        pConnection->sendQueue.clear();
+        pConnection->cbSendOffset = 0;
+    }
+
+    LeaveCriticalSection(&pConnection->cs);
+}
+
+HRESULT NativeTransport::Send(int nConnectionId, const BYTE* pbData, DWORD cbData)
+{
+    Connection* pConnection = (Connection*)m_connections.Acquire(nConnectionId);
+    if (pConnection == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    EnterCriticalSection(&pConnection->cs);
+
+    DWORD cbSent = 0;
+
+    // write directly unless something is queued already, the order must be kept
+    if (!pConnection->fFailed && pConnection->cbSendOffset == pConnection->sendQueue.size())
+    {
+        while (cbSent < cbData)
+        {
+            ssize_t cbResult = send(pConnection->fd, pbData + cbSent, cbData - cbSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+            if (cbResult > 0)
+            {
+                cbSent += (DWORD)cbResult;
+            }
+            else if (cbResult < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (cbResult < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            else
+            {
+                DropConnection(pConnection);
+                break;
+            }
+        }
+    }
+
+    if (!pConnection->fFailed && cbSent < cbData)
+    {
+        size_t cbQueued = pConnection->sendQueue.size() - pConnection->cbSendOffset;
+
+        if (cbQueued + (cbData - cbSent) > (size_t)m_config.nMaxSendQueue)
+        {
+            // peer doesn't keep up
+            DropConnection(pConnection);
+        }
+        else
+        {
+            if (pConnection->cbSendOffset > 0)
+            {
+                pConnection->sendQueue.erase(pConnection->sendQueue.begin(), pConnection->sendQueue.begin() + pConnection->cbSendOffset);
+                pConnection->cbSendOffset = 0;
+            }
+
+            pConnection->sendQueue.insert(pConnection->sendQueue.end(), pbData + cbSent, pbData + cbData);
+        }
+    }
+
+    HRESULT hr = pConnection->fFailed ? E_FAIL : S_OK;
+
+    LeaveCriticalSection(&pConnection->cs);
+    m_connections.Release(nConnectionId);
+
+    return hr;
+}
+
+BOOL NativeTransport::Disconnect(int nConnectionId)
+{
+    Connection* pConnection = (Connection*)m_connections.Acquire(nConnectionId);
+    if (pConnection == NULL)
+    {
+        return FALSE;
+    }
+
+    // the reactor sees the socket hung up and closes it
+    shutdown(pConnection->fd, SHUT_RDWR);
+
+    m_connections.Release(nConnectionId);
+
+    return TRUE;
+}
+
+void NativeTransport::DropConnection(Connection* pConnection)
+{
+    // called with the connection locked
+    pConnection->fFailed = TRUE;
+    pConnection->sendQueue.clear();
+    pConnection->cbSendOffset = 0;
+    shutdown(pConnection->fd, SHUT_RDWR);
+}
+
+void NativeTransport::CloseConnection(Reactor* pReactor, Connection* pConnection, MCSSF_TRANSPORT_EVENT* pEvent)
+{
+    // waits for senders still holding the connection, new ones don't find it
+    m_connections.Remove(pConnection->nId);
+
+    epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_DEL, pConnection->fd, NULL);
+    close(pConnection->fd);
+    pConnection->fd = -1;
+
+    InterlockedDecrement(&m_lConnectionCount);
+
+    for (size_t i = 0; i < pReactor->connections.size(); ++i)
+    {
+        if (pReactor->connections[i] == pConnection)
+        {
+            pReactor->connections[i] = pReactor->connections.back();
+            pReactor->connections.pop_back();
+            break;
+        }
+    }
+
+    FillEvent(pEvent, MCSSF_TRANSPORT_DISCONNECTED, pConnection);
+
+    pReactor->closed.push_back(pConnection);
+}
+
+void NativeTransport::DeleteConnection(Connection* pConnection)
+{
+    DeleteCriticalSection(&pConnection->cs);
+    free(pConnection->pbReceive);
+    delete pConnection;
+}
+
+void NativeTransport::FillEvent(MCSSF_TRANSPORT_EVENT* pEvent, int nType, const Connection* pConnection)
+{
+    pEvent->nType = nType;
+    pEvent->nConnectionId = pConnection->nId;
+    pEvent->nDataSize = 0;
+    pEvent->pData = NULL;
+    pEvent->nAddress = pConnection->nAddress;
+    pEvent->nPort = pConnection->nPort;
+}
+
+#else
+
+NativeTransport::NativeTransport(const MCSSF_TRANSPORT_CONFIG* pConfig)
+    : m_lConnectionCount(0), m_lStopping(0)
+{
+    m_config = *pConfig;
+}
+
+NativeTransport::~NativeTransport()
+{
+}
+
+HRESULT NativeTransport::Create(MCSSF_TRANSPORT_CONFIG* pConfig, NativeTransport** ppTransport)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT NativeTransport::Poll(int nReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents, DWORD dwTimeoutMs, DWORD* pdwEventCount)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT NativeTransport::Send(int nConnectionId, const BYTE* pbData, DWORD cbData)
+{
+    return E_NOTIMPL;
+}
+
+BOOL NativeTransport::Disconnect(int nConnectionId)
+{
+    return FALSE;
+}
+
+void NativeTransport::Stop()
+{
+}
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include "MCommsSSFSDK.h"
+#include "HandleTable.h"
+
+#define NATIVETRANSPORT_MIN_RECEIVE_BUFFER  1024
+#define NATIVETRANSPORT_SHRINK_READS        16  // small reads in a row before a receive buffer is halved
+
+// TCP server transport built on edge-triggered epoll, one reactor per processor by default.
+// Each reactor owns a listening socket bound with SO_REUSEPORT and an epoll set, connections
+// accepted by a reactor stay with it, so reactors share nothing but the connection table.
+//
+// Reactors have no threads of their own: Poll performs the I/O of one reactor on the calling
+// thread and reports connects, received data and disconnects. Edge-triggered readiness is
+// tracked in a ready list, a connection is read once per Poll (into a buffer sized to its
+// traffic) and stays in the list until the socket is drained, so one busy connection can't
+// starve the others. Send and Disconnect may be called from any thread, Send writes directly
+// while nothing is queued and leaves the rest to the reactor.
+//
+// Only available where epoll is, Create returns E_NOTIMPL elsewhere.
+class NativeTransport
+{
+public:
+    // Binds the listening sockets, pConfig->nReactors receives the number of reactors
+    static HRESULT Create(MCSSF_TRANSPORT_CONFIG* pConfig, NativeTransport** ppTransport);
+
+    // Stops the transport if it's still running
+    ~NativeTransport();
+
+    int GetReactorCount() const { return (int)m_reactors.size(); }
+
+    // Returns S_FALSE once the transport is being stopped
+    HRESULT Poll(int nReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents, DWORD dwTimeoutMs, DWORD* pdwEventCount);
+
+    // Returns E_INVALIDARG for unknown connections, E_FAIL when the connection is being dropped
+    HRESULT Send(int nConnectionId, const BYTE* pbData, DWORD cbData);
+
+    BOOL Disconnect(int nConnectionId);
+
+    // Wakes up and waits for pending polls, closes all sockets. Polls fail afterwards.
+    void Stop();
+
+private:
+    struct Connection;
+    struct Reactor;
+
+    NativeTransport(const MCSSF_TRANSPORT_CONFIG* pConfig);
+
+    NativeTransport(const NativeTransport&);
+    NativeTransport& operator=(const NativeTransport&);
+
+    HRESULT Start();
+
+    void Accept(Reactor* pReactor);
+    DWORD ServeReadyList(Reactor* pReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents);
+    DWORD AnnounceConnections(Reactor* pReactor, MCSSF_TRANSPORT_EVENT* pEvents, DWORD dwMaxEvents);
+    void FlushSendQueue(Connection* pConnection);
+    void DropConnection(Connection* pConnection);
+    void CloseConnection(Reactor* pReactor, Connection* pConnection, MCSSF_TRANSPORT_EVENT* pEvent);
+    void DeleteConnection(Connection* pConnection);
+
+    static void FillEvent(MCSSF_TRANSPORT_EVENT* pEvent, int nType, const Connection* pConnection);
+
+    MCSSF_TRANSPORT_CONFIG m_config;
+
+    std::vector<Reactor*> m_reactors;
+
+    // connection ids, a removed connection can't be found by senders any more
+    HandleTable m_connections;
+    volatile LONG m_lConnectionCount;
+
+    volatile LONG m_lStopping;
+};
@@ -0,0 +1,140 @@
+// Platform.h : Win32 types and helpers used by the muxer on non-Windows platforms.
+// On Windows everything comes from windows.h, this file only fills the gaps elsewhere.
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef int BOOL;
+typedef wchar_t WCHAR;
+typedef LONG HRESULT;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef MAX_PATH
+#define MAX_PATH 260
+#endif
+
+#define S_OK                        ((HRESULT)0x00000000L)
+#define S_FALSE                     ((HRESULT)0x00000001L)
+#define E_FAIL                      ((HRESULT)0x80004005L)
+#define E_NOTIMPL                   ((HRESULT)0x80004001L)
+#define E_POINTER                   ((HRESULT)0x80004003L)
+#define E_INVALIDARG                ((HRESULT)0x80070057L)
+#define E_OUTOFMEMORY               ((HRESULT)0x8007000EL)
+#define E_NOT_SUFFICIENT_BUFFER     ((HRESULT)0x8007007AL)
+
+#define SUCCEEDED(hr)               (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)                  (((HRESULT)(hr)) < 0)
+
+#ifndef __cdecl
+#define __cdecl
+#endif
+
+#define ZeroMemory(p, cb)           memset((p), 0, (cb))
+#define sprintf_s                   snprintf
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* pcs)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(pcs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+inline void DeleteCriticalSection(CRITICAL_SECTION* pcs)
+{
+    pthread_mutex_destroy(pcs);
+}
+
+inline void EnterCriticalSection(CRITICAL_SECTION* pcs)
+{
+    pthread_mutex_lock(pcs);
+}
+
+inline void LeaveCriticalSection(CRITICAL_SECTION* pcs)
+{
+    pthread_mutex_unlock(pcs);
+}
+
+// Interlocked operations are full barriers, same as on Windows
+
+inline LONG InterlockedIncrement(volatile LONG* plValue)
+{
+    return __sync_add_and_fetch(plValue, 1);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* plValue)
+{
+    return __sync_sub_and_fetch(plValue, 1);
+}
+
+inline LONG InterlockedExchangeAdd(volatile LONG* plValue, LONG lAdd)
+{
+    return __sync_fetch_and_add(plValue, lAdd);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* plValue, LONG lExchange, LONG lComparand)
+{
+    return __sync_val_compare_and_swap(plValue, lComparand, lExchange);
+}
+
+inline LONG InterlockedExchange(volatile LONG* plValue, LONG lValue)
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set(plValue, lValue);
+}
+
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* pqwValue, LONGLONG qwExchange, LONGLONG qwComparand)
+{
+    return __sync_val_compare_and_swap(pqwValue, qwComparand, qwExchange);
+}
+
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* pqwValue, LONGLONG qwValue)
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set(pqwValue, qwValue);
+}
+
+inline void* InterlockedExchangePointer(void* volatile* ppValue, void* pValue)
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set(ppValue, pValue);
+}
+
+inline void* InterlockedCompareExchangePointer(void* volatile* ppValue, void* pExchange, void* pComparand)
+{
+    return __sync_val_compare_and_swap(ppValue, pComparand, pExchange);
+}
+
+inline BOOL SwitchToThread()
+{
+    return sched_yield() == 0;
+}
+
+#endif // _WIN32
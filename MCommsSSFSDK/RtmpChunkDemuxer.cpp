@@ -0,0 +1,378 @@
+#include "stdafx.h"
+#include "RtmpChunkDemuxer.h"
+#include "BufferPool.h"
+
+#include <string.h>
+
+// message header size by chunk format (type 0..3)
+static const DWORD s_acbMessageHeader[4] = { 11, 7, 3, 0 };
+
+static DWORD ReadUInt24(const BYTE* pb)
+{
+    return ((DWORD)pb[0] << 16) | ((DWORD)pb[1] << 8) | pb[2];
+}
+
+static DWORD ReadUInt32(const BYTE* pb)
+{
+    return ((DWORD)pb[0] << 24) | ((DWORD)pb[1] << 16) | ((DWORD)pb[2] << 8) | pb[3];
+}
+
+// message stream id is the only little endian field of the protocol
+static DWORD ReadUInt32LE(const BYTE* pb)
+{
+    return ((DWORD)pb[3] << 24) | ((DWORD)pb[2] << 16) | ((DWORD)pb[1] << 8) | pb[0];
+}
+
+// size of the basic header, chunk stream ids 0 and 1 announce 1 and 2 extra id bytes
+static DWORD GetBasicHeaderSize(BYTE bFirst)
+{
+    switch (bFirst & 0x3F)
+    {
+    case 0:
+        return 2;
+    case 1:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+static DWORD GetChunkStreamId(const BYTE* pbHeader)
+{
+    switch (pbHeader[0] & 0x3F)
+    {
+    case 0:
+        return 64 + pbHeader[1];
+    case 1:
+        return 64 + pbHeader[1] + ((DWORD)pbHeader[2] << 8);
+    default:
+        return pbHeader[0] & 0x3F;
+    }
+}
+
+RtmpChunkDemuxer::RtmpChunkDemuxer()
+    : m_state(StateHeader)
+    , m_cbChunkSize(RTMPCHUNK_DEFAULT_CHUNK_SIZE)
+    , m_cbHeader(0)
+    , m_pCurrent(NULL)
+    , m_cbChunkRemaining(0)
+    , m_dwStreamCount(0)
+{
+    ZeroMemory(m_abHeader, sizeof(m_abHeader));
+    ZeroMemory(m_aStreams, sizeof(m_aStreams));
+}
+
+RtmpChunkDemuxer::~RtmpChunkDemuxer()
+{
+    for (DWORD i = 0; i < m_dwStreamCount; ++i)
+    {
+        if (m_aStreams[i].pbBuffer != NULL)
+        {
+            BufferPool::Instance().Release(m_aStreams[i].pbBuffer);
+        }
+    }
+}
+
+DWORD RtmpChunkDemuxer::GetHeaderSize()
+{
+    if (m_cbHeader == 0)
+    {
+        return 1;
+    }
+
+    DWORD cbBasic = GetBasicHeaderSize(m_abHeader[0]);
+    if (m_cbHeader < cbBasic)
+    {
+        return cbBasic;
+    }
+
+    int nFormat = m_abHeader[0] >> 6;
+    DWORD cbSize = cbBasic + s_acbMessageHeader[nFormat];
+    if (m_cbHeader < cbSize)
+    {
+        return cbSize;
+    }
+
+    BOOL fExtended = FALSE;
+    if (nFormat < 3)
+    {
+        fExtended = ReadUInt24(m_abHeader + cbBasic) == 0xFFFFFF;
+    }
+    else
+    {
+        // type 3 chunks repeat the extended timestamp of the preceding header
+        ChunkStream* pStream = FindStream(GetChunkStreamId(m_abHeader), FALSE);
+        fExtended = pStream != NULL && pStream->fExtendedTimestamp;
+    }
+
+    return fExtended ? cbSize + 4 : cbSize;
+}
+
+RtmpChunkDemuxer::ChunkStream* RtmpChunkDemuxer::FindStream(DWORD dwChunkStreamId, BOOL fCreate)
+{
+    for (DWORD i = 0; i < m_dwStreamCount; ++i)
+    {
+        if (m_aStreams[i].dwChunkStreamId == dwChunkStreamId)
+        {
+            return &m_aStreams[i];
+        }
+    }
+
+    if (!fCreate || m_dwStreamCount >= RTMPCHUNK_MAX_STREAMS)
+    {
+        return NULL;
+    }
+
+    ChunkStream* pStream = &m_aStreams[m_dwStreamCount++];
+    ZeroMemory(pStream, sizeof(ChunkStream));
+    pStream->dwChunkStreamId = dwChunkStreamId;
+    pStream->nMessageType = -1; // until the first type 0 header
+
+    return pStream;
+}
+
+HRESULT RtmpChunkDemuxer::ApplyHeader(ChunkStream* pStream)
+{
+    int nFormat = m_abHeader[0] >> 6;
+    const BYTE* pb = m_abHeader + GetBasicHeaderSize(m_abHeader[0]);
+
+    if (nFormat != 0 && pStream->nMessageType < 0)
+    {
+        // compressed header without a context to expand it, we're out of sync
+        return E_FAIL;
+    }
+
+    if (nFormat < 3)
+    {
+        DWORD dwTimestamp = ReadUInt24(pb);
+        pStream->fExtendedTimestamp = dwTimestamp == 0xFFFFFF;
+        if (pStream->fExtendedTimestamp)
+        {
+            dwTimestamp = ReadUInt32(m_abHeader + m_cbHeader - 4);
+        }
+
+        if (nFormat == 0)
+        {
+            pStream->dwTimestamp = dwTimestamp;
+            pStream->nMessageStreamId = (int)ReadUInt32LE(pb + 7);
+        }
+        else
+        {
+            pStream->dwTimestampDelta = dwTimestamp;
+        }
+
+        if (nFormat < 2)
+        {
+            pStream->cbMessageLength = ReadUInt24(pb + 3);
+            pStream->nMessageType = pb[6];
+        }
+
+        // a full header in the middle of a message means the rest of it has been dropped
+        if (pStream->cbReceived > 0)
+        {
+            pStream->cbReceived = 0;
+        }
+
+        if (nFormat != 0)
+        {
+            pStream->dwTimestamp += pStream->dwTimestampDelta;
+        }
+    }
+    else if (pStream->cbReceived == 0)
+    {
+        // type 3 header starting a new message repeats the previous delta
+        pStream->dwTimestamp += pStream->dwTimestampDelta;
+    }
+
+    m_pCurrent = pStream;
+    m_cbChunkRemaining = pStream->cbMessageLength - pStream->cbReceived;
+    if (m_cbChunkRemaining > m_cbChunkSize)
+    {
+        m_cbChunkRemaining = m_cbChunkSize;
+    }
+
+    return S_OK;
+}
+
+void RtmpChunkDemuxer::ApplyControlMessage(const MCSSF_RTMP_MESSAGE* pMessage)
+{
+    if (pMessage->nDataSize < 4)
+    {
+        return;
+    }
+
+    switch (pMessage->nMessageType)
+    {
+    case RTMPCHUNK_MESSAGE_SET_CHUNK_SIZE:
+        {
+            DWORD cbChunkSize = ReadUInt32(pMessage->pData) & 0x7FFFFFFF;
+            if (cbChunkSize > 0)
+            {
+                m_cbChunkSize = cbChunkSize;
+            }
+            break;
+        }
+
+    case RTMPCHUNK_MESSAGE_ABORT:
+        {
+            ChunkStream* pStream = FindStream(ReadUInt32(pMessage->pData), FALSE);
+            if (pStream != NULL)
+            {
+                pStream->cbReceived = 0;
+            }
+            break;
+        }
+    }
+}
+
+HRESULT RtmpChunkDemuxer::Demux(const BYTE* pbData, DWORD cbData, DWORD* pcbConsumed, MCSSF_RTMP_MESSAGE* pMessages, DWORD dwMaxMessages, DWORD* pdwMessageCount)
+{
+    *pcbConsumed = 0;
+    *pdwMessageCount = 0;
+
+    if (m_state == StateFailed)
+    {
+        return E_FAIL;
+    }
+
+    // messages reported by the previous call are gone, their buffers can be reused
+    for (DWORD i = 0; i < m_dwStreamCount; ++i)
+    {
+        m_aStreams[i].fReported = FALSE;
+    }
+
+    const BYTE* pb = pbData;
+    DWORD cb = cbData;
+    DWORD dwCount = 0;
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        if (m_state == StateHeader)
+        {
+            DWORD cbNeeded = GetHeaderSize();
+            while (cbNeeded > m_cbHeader && cb > 0)
+            {
+                DWORD cbCopy = cbNeeded - m_cbHeader;
+                if (cbCopy > cb)
+                {
+                    cbCopy = cb;
+                }
+
+                memcpy(m_abHeader + m_cbHeader, pb, cbCopy);
+                m_cbHeader += cbCopy;
+                pb += cbCopy;
+                cb -= cbCopy;
+
+                cbNeeded = GetHeaderSize();
+            }
+
+            if (cbNeeded > m_cbHeader)
+            {
+                break;
+            }
+
+            ChunkStream* pStream = FindStream(GetChunkStreamId(m_abHeader), TRUE);
+            if (pStream == NULL)
+            {
+                hr = E_FAIL;
+                break;
+            }
+
+            // the header stays staged when the chunk may complete a message we can't report now
+            if (dwCount >= dwMaxMessages || pStream->fReported)
+            {
+                break;
+            }
+
+            hr = ApplyHeader(pStream);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            m_cbHeader = 0;
+            m_state = StatePayload;
+        }
+
+        ChunkStream* pStream = m_pCurrent;
+        MCSSF_RTMP_MESSAGE* pMessage = &pMessages[dwCount];
+
+        if (pStream->cbReceived == 0 && m_cbChunkRemaining == pStream->cbMessageLength && cb >= m_cbChunkRemaining)
+        {
+            // single chunk message available in the input, report it in place
+            pMessage->pData = pb;
+            pb += m_cbChunkRemaining;
+            cb -= m_cbChunkRemaining;
+            m_cbChunkRemaining = 0;
+        }
+        else
+        {
+            if (cb == 0)
+            {
+                break;
+            }
+
+            if (pStream->cbReceived == 0 && pStream->cbBuffer < pStream->cbMessageLength)
+            {
+                if (pStream->pbBuffer != NULL)
+                {
+                    BufferPool::Instance().Release(pStream->pbBuffer);
+                    pStream->cbBuffer = 0;
+                }
+
+                pStream->pbBuffer = BufferPool::Instance().Acquire(pStream->cbMessageLength, &pStream->cbBuffer);
+                if (pStream->pbBuffer == NULL)
+                {
+                    hr = E_OUTOFMEMORY;
+                    break;
+                }
+            }
+
+            DWORD cbCopy = m_cbChunkRemaining < cb ? m_cbChunkRemaining : cb;
+            memcpy(pStream->pbBuffer + pStream->cbReceived, pb, cbCopy);
+            pStream->cbReceived += cbCopy;
+            m_cbChunkRemaining -= cbCopy;
+            pb += cbCopy;
+            cb -= cbCopy;
+
+            if (m_cbChunkRemaining > 0)
+            {
+                break;
+            }
+
+            m_state = StateHeader;
+
+            if (pStream->cbReceived < pStream->cbMessageLength)
+            {
+                continue;
+            }
+
+            pMessage->pData = pStream->pbBuffer;
+            pStream->cbReceived = 0;
+            pStream->fReported = TRUE;
+        }
+
+        m_state = StateHeader;
+
+        pMessage->nChunkStreamId = (int)pStream->dwChunkStreamId;
+        pMessage->nMessageStreamId = pStream->nMessageStreamId;
+        pMessage->nMessageType = pStream->nMessageType;
+        pMessage->nTimestamp = pStream->dwTimestamp;
+        pMessage->nDataSize = (int)pStream->cbMessageLength;
+        ++dwCount;
+
+        ApplyControlMessage(pMessage);
+    }
+
+    if (FAILED(hr))
+    {
+        m_state = StateFailed;
+        return hr;
+    }
+
+    *pcbConsumed = cbData - cb;
+    *pdwMessageCount = dwCount;
+
+    return S_OK;
+}
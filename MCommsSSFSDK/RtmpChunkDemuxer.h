@@ -0,0 +1,81 @@
+#pragma once
+
+#include "MCommsSSFSDK.h"
+
+#define RTMPCHUNK_DEFAULT_CHUNK_SIZE    128
+#define RTMPCHUNK_MAX_STREAMS           64
+#define RTMPCHUNK_MAX_HEADER_SIZE       18  // 3 bytes basic header + 11 bytes message header + 4 bytes extended timestamp
+
+#define RTMPCHUNK_MESSAGE_SET_CHUNK_SIZE 1
+#define RTMPCHUNK_MESSAGE_ABORT          2
+#define RTMPCHUNK_MESSAGE_AUDIO          8
+#define RTMPCHUNK_MESSAGE_VIDEO          9
+
+// Incremental RTMP chunk stream parser. Raw socket data is fed in pieces of any size and
+// complete messages are reported as descriptors pointing to their payload, no memory is
+// allocated per message or chunk.
+//
+// A message received in a single chunk which is entirely in the input is reported in place,
+// other messages are reassembled in a pooled buffer of their chunk stream. Payloads stay
+// valid until the next Demux call (the caller's input must be kept for that long too).
+// Set Chunk Size and Abort messages are applied by the demuxer and reported as well.
+class RtmpChunkDemuxer
+{
+public:
+    RtmpChunkDemuxer();
+    ~RtmpChunkDemuxer();
+
+    // Parses as much of pbData as possible, stops early when pMessages is full or when
+    // a chunk stream with a reported message starts the next one in its reassembly buffer,
+    // the rest has to be passed again. Returns E_FAIL on corrupted data, the demuxer is
+    // unusable afterwards.
+    HRESULT Demux(const BYTE* pbData, DWORD cbData, DWORD* pcbConsumed, MCSSF_RTMP_MESSAGE* pMessages, DWORD dwMaxMessages, DWORD* pdwMessageCount);
+
+    DWORD GetChunkSize() const { return m_cbChunkSize; }
+    void SetChunkSize(DWORD cbChunkSize) { m_cbChunkSize = cbChunkSize; }
+
+private:
+    struct ChunkStream
+    {
+        DWORD dwChunkStreamId;
+        DWORD dwTimestamp;
+        DWORD dwTimestampDelta;
+        DWORD cbMessageLength;
+        DWORD cbReceived;
+        int nMessageType;
+        int nMessageStreamId;
+        BOOL fExtendedTimestamp;
+        BOOL fReported;         // reassembly buffer holds a message reported by the current Demux call
+        BYTE* pbBuffer;
+        DWORD cbBuffer;
+    };
+
+    enum State
+    {
+        StateHeader,
+        StatePayload,
+        StateFailed
+    };
+
+    RtmpChunkDemuxer(const RtmpChunkDemuxer&);
+    RtmpChunkDemuxer& operator=(const RtmpChunkDemuxer&);
+
+    // Size of the chunk header staged in m_abHeader, grows as its fields become known
+    DWORD GetHeaderSize();
+
+    ChunkStream* FindStream(DWORD dwChunkStreamId, BOOL fCreate);
+    HRESULT ApplyHeader(ChunkStream* pStream);
+    void ApplyControlMessage(const MCSSF_RTMP_MESSAGE* pMessage);
+
+    State m_state;
+    DWORD m_cbChunkSize;
+
+    BYTE m_abHeader[RTMPCHUNK_MAX_HEADER_SIZE];
+    DWORD m_cbHeader;
+
+    ChunkStream* m_pCurrent;    // stream of the chunk whose payload is being received
+    DWORD m_cbChunkRemaining;
+
+    ChunkStream m_aStreams[RTMPCHUNK_MAX_STREAMS];
+    DWORD m_dwStreamCount;
+};
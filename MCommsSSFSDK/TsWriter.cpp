@@ -0,0 +1,490 @@
+#include "stdafx.h"
+#include "TsWriter.h"
+#include "CodecConfig.h"
+
+#include <string.h>
+
+using namespace std;
+
+#define TS_STREAM_TYPE_AAC  0x0F    // ISO/IEC 13818-7 audio with ADTS transport syntax
+#define TS_STREAM_TYPE_AVC  0x1B
+#define TS_STREAM_ID_AUDIO  0xC0
+#define TS_STREAM_ID_VIDEO  0xE0
+
+#define TS_PES_HEADER_SIZE  14      // start code, stream id, length, flags and PTS
+#define TS_PCR_SIZE         6
+
+// PTS runs this far ahead of PCR (700 ms, 90 kHz units) so each frame has arrived before it's presented
+#define TS_PCR_DELAY        63000
+
+#define AVC_NAL_TYPE_MASK   0x1F
+#define AVC_NAL_TYPE_AUD    9
+
+#define AAC_OBJECT_TYPE_SBR 5
+#define AAC_OBJECT_TYPE_PS  29
+#define ADTS_HEADER_SIZE    7
+#define ADTS_MAX_FRAME_SIZE 0x1FFF
+
+static const BYTE g_abStartCode[4] = { 0, 0, 0, 1 };
+static const BYTE g_abAccessUnitDelimiter[6] = { 0, 0, 0, 1, AVC_NAL_TYPE_AUD, 0xF0 };
+
+static DWORD ReadBE(const BYTE* pb, DWORD cb)
+{
+    DWORD dwValue = 0;
+    for (DWORD i = 0; i < cb; ++i)
+    {
+        dwValue = (dwValue << 8) | pb[i];
+    }
+    return dwValue;
+}
+
+// CRC-32/MPEG-2 of PSI sections, they're written twice per segment so no table is kept
+static DWORD Crc32(const BYTE* pbData, DWORD cbData)
+{
+    DWORD dwCrc = 0xFFFFFFFF;
+    for (DWORD i = 0; i < cbData; ++i)
+    {
+        dwCrc ^= (DWORD)pbData[i] << 24;
+        for (int nBit = 0; nBit < 8; ++nBit)
+        {
+            dwCrc = (dwCrc & 0x80000000) ? (dwCrc << 1) ^ 0x04C11DB7 : dwCrc << 1;
+        }
+    }
+
+    return dwCrc;
+}
+
+// 90 kHz clock of sample time in hns units, wrapped to 33 bits
+static ULONGLONG ToClock(LONGLONG rtTime)
+{
+    return (ULONGLONG)(rtTime > 0 ? rtTime * 9 / 1000 : 0) & 0x1FFFFFFFFULL;
+}
+
+TsWriter::TsWriter()
+    : m_pVideoConfig(NULL), m_pAudioConfig(NULL), m_cbNalLength(4),
+    m_bPatCounter(0), m_bPmtCounter(0), m_bVideoCounter(0), m_bAudioCounter(0)
+{
+    ZeroMemory(m_abAdtsHeader, sizeof(m_abAdtsHeader));
+}
+
+TsWriter::~TsWriter()
+{
+    if (m_pVideoConfig != NULL)
+    {
+        m_pVideoConfig->Release();
+    }
+
+    if (m_pAudioConfig != NULL)
+    {
+        m_pAudioConfig->Release();
+    }
+}
+
+HRESULT TsWriter::Initialize(CodecConfig* pVideoConfig, CodecConfig* pAudioConfig)
+{
+    if (pVideoConfig == NULL && pAudioConfig == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_pVideoConfig = pVideoConfig;
+    if (m_pVideoConfig != NULL)
+    {
+        m_pVideoConfig->AddRef();
+    }
+
+    m_pAudioConfig = pAudioConfig;
+    if (m_pAudioConfig != NULL)
+    {
+        m_pAudioConfig->AddRef();
+    }
+
+    HRESULT hr = S_OK;
+    if (m_pVideoConfig != NULL)
+    {
+        hr = ParseVideoConfig();
+    }
+
+    if (SUCCEEDED(hr) && m_pAudioConfig != NULL)
+    {
+        hr = ParseAudioConfig();
+    }
+
+    return hr;
+}
+
+HRESULT TsWriter::ParseVideoConfig()
+{
+    const BYTE* pb = m_pVideoConfig->GetConfig();
+    DWORD cb = m_pVideoConfig->GetConfigSize();
+
+    if (cb < 7)
+    {
+        return E_INVALIDARG;
+    }
+
+    char szCodec[16];
+    sprintf_s(szCodec, sizeof(szCodec), "avc1.%02X%02X%02X", pb[1], pb[2], pb[3]);
+    m_codecs = szCodec;
+
+    m_cbNalLength = (pb[4] & 3) + 1;
+
+    // all SPS and PPS units, each behind a start code
+    DWORD dwOffset = 5;
+    for (int nSet = 0; nSet < 2; ++nSet)
+    {
+        if (dwOffset >= cb)
+        {
+            return E_INVALIDARG;
+        }
+
+        DWORD dwCount = nSet == 0 ? (pb[dwOffset] & AVC_NAL_TYPE_MASK) : pb[dwOffset];
+        ++dwOffset;
+
+        for (DWORD i = 0; i < dwCount; ++i)
+        {
+            if (dwOffset + 2 > cb)
+            {
+                return E_INVALIDARG;
+            }
+
+            DWORD cbUnit = ReadBE(pb + dwOffset, 2);
+            dwOffset += 2;
+            if (dwOffset + cbUnit > cb)
+            {
+                return E_INVALIDARG;
+            }
+
+            m_parameterSets.insert(m_parameterSets.end(), g_abStartCode, g_abStartCode + sizeof(g_abStartCode));
+            m_parameterSets.insert(m_parameterSets.end(), pb + dwOffset, pb + dwOffset + cbUnit);
+            dwOffset += cbUnit;
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT TsWriter::ParseAudioConfig()
+{
+    const BYTE* pb = m_pAudioConfig->GetConfig();
+    DWORD cb = m_pAudioConfig->GetConfigSize();
+
+    if (cb < 2)
+    {
+        return E_INVALIDARG;
+    }
+
+    DWORD dwObjectType = pb[0] >> 3;
+    DWORD dwFrequencyIndex = ((pb[0] & 7) << 1) | (pb[1] >> 7);
+    DWORD dwChannelConfig = (pb[1] >> 3) & 0x0F;
+
+    char szCodec[16];
+    sprintf_s(szCodec, sizeof(szCodec), "mp4a.40.%u", (unsigned int)dwObjectType);
+    if (!m_codecs.empty())
+    {
+        m_codecs += ",";
+    }
+    m_codecs += szCodec;
+
+    // explicit HE-AAC signalling: ADTS carries the core object type, SBR and PS are implicit then
+    if (dwObjectType == AAC_OBJECT_TYPE_SBR || dwObjectType == AAC_OBJECT_TYPE_PS)
+    {
+        if (cb < 3)
+        {
+            return E_INVALIDARG;
+        }
+
+        DWORD dwExtensionIndex = ((pb[1] & 7) << 1) | (pb[2] >> 7);
+        if (dwExtensionIndex == 15)
+        {
+            return E_INVALIDARG;
+        }
+
+        dwObjectType = (pb[2] >> 2) & 0x1F;
+    }
+
+    // ADTS has two bits for the profile, no escape for the frequency and needs a channel configuration
+    if (dwObjectType < 1 || dwObjectType > 4 || dwFrequencyIndex >= 13 || dwChannelConfig == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_abAdtsHeader[0] = 0xFF;
+    m_abAdtsHeader[1] = 0xF1; // MPEG-4, no CRC
+    m_abAdtsHeader[2] = (BYTE)(((dwObjectType - 1) << 6) | (dwFrequencyIndex << 2) | (dwChannelConfig >> 2));
+    m_abAdtsHeader[3] = (BYTE)((dwChannelConfig & 3) << 6);
+    m_abAdtsHeader[4] = 0;
+    m_abAdtsHeader[5] = 0x1F; // buffer fullness 0x7FF means variable bitrate
+    m_abAdtsHeader[6] = 0xFC;
+
+    return S_OK;
+}
+
+void TsWriter::WriteTables(vector<BYTE>& output)
+{
+    BYTE abSection[TS_PACKET_SIZE];
+
+    // PAT with the only program
+    DWORD cbSection = 0;
+    abSection[cbSection++] = 0x00; // table id
+    abSection[cbSection++] = 0xB0;
+    abSection[cbSection++] = 13;   // section length
+    abSection[cbSection++] = 0x00; // transport stream id
+    abSection[cbSection++] = 0x01;
+    abSection[cbSection++] = 0xC1; // version 0, current
+    abSection[cbSection++] = 0x00; // section number
+    abSection[cbSection++] = 0x00; // last section number
+    abSection[cbSection++] = 0x00; // program number
+    abSection[cbSection++] = 0x01;
+    abSection[cbSection++] = (BYTE)(0xE0 | (TS_PID_PMT >> 8));
+    abSection[cbSection++] = (BYTE)(TS_PID_PMT & 0xFF);
+    WriteSection(TS_PID_PAT, abSection, cbSection, output);
+
+    // PMT, clock reference is on the video track if there's one
+    WORD wPcrPid = HasVideo() ? TS_PID_VIDEO : TS_PID_AUDIO;
+    DWORD cbLength = 9 + (HasVideo() ? 5 : 0) + (HasAudio() ? 5 : 0) + 4;
+
+    cbSection = 0;
+    abSection[cbSection++] = 0x02;
+    abSection[cbSection++] = (BYTE)(0xB0 | (cbLength >> 8));
+    abSection[cbSection++] = (BYTE)(cbLength & 0xFF);
+    abSection[cbSection++] = 0x00;
+    abSection[cbSection++] = 0x01;
+    abSection[cbSection++] = 0xC1;
+    abSection[cbSection++] = 0x00;
+    abSection[cbSection++] = 0x00;
+    abSection[cbSection++] = (BYTE)(0xE0 | (wPcrPid >> 8));
+    abSection[cbSection++] = (BYTE)(wPcrPid & 0xFF);
+    abSection[cbSection++] = 0xF0; // no program descriptors
+    abSection[cbSection++] = 0x00;
+
+    if (HasVideo())
+    {
+        abSection[cbSection++] = TS_STREAM_TYPE_AVC;
+        abSection[cbSection++] = (BYTE)(0xE0 | (TS_PID_VIDEO >> 8));
+        abSection[cbSection++] = (BYTE)(TS_PID_VIDEO & 0xFF);
+        abSection[cbSection++] = 0xF0;
+        abSection[cbSection++] = 0x00;
+    }
+
+    if (HasAudio())
+    {
+        abSection[cbSection++] = TS_STREAM_TYPE_AAC;
+        abSection[cbSection++] = (BYTE)(0xE0 | (TS_PID_AUDIO >> 8));
+        abSection[cbSection++] = (BYTE)(TS_PID_AUDIO & 0xFF);
+        abSection[cbSection++] = 0xF0;
+        abSection[cbSection++] = 0x00;
+    }
+
+    WriteSection(TS_PID_PMT, abSection, cbSection, output);
+}
+
+HRESULT TsWriter::WriteVideoSample(LONGLONG rtStart, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData, vector<BYTE>& output)
+{
+    if (!HasVideo())
+    {
+        return E_INVALIDARG;
+    }
+
+    m_payload.resize(TS_PES_HEADER_SIZE);
+    m_payload.insert(m_payload.end(), g_abAccessUnitDelimiter, g_abAccessUnitDelimiter + sizeof(g_abAccessUnitDelimiter));
+
+    if (fKeyFrame)
+    {
+        m_payload.insert(m_payload.end(), m_parameterSets.begin(), m_parameterSets.end());
+    }
+
+    // length prefixed NAL units to start code prefixed ones
+    DWORD dwOffset = 0;
+    while (dwOffset < cbData)
+    {
+        if (dwOffset + m_cbNalLength > cbData)
+        {
+            return E_INVALIDARG;
+        }
+
+        DWORD cbUnit = ReadBE(pbData + dwOffset, m_cbNalLength);
+        dwOffset += m_cbNalLength;
+        if (cbUnit == 0 || cbUnit > cbData - dwOffset)
+        {
+            return E_INVALIDARG;
+        }
+
+        // we've already put our own delimiter in front
+        if ((pbData[dwOffset] & AVC_NAL_TYPE_MASK) != AVC_NAL_TYPE_AUD)
+        {
+            m_payload.insert(m_payload.end(), g_abStartCode, g_abStartCode + sizeof(g_abStartCode));
+            m_payload.insert(m_payload.end(), pbData + dwOffset, pbData + dwOffset + cbUnit);
+        }
+
+        dwOffset += cbUnit;
+    }
+
+    WritePes(TS_PID_VIDEO, TS_STREAM_ID_VIDEO, rtStart, fKeyFrame, output);
+    return S_OK;
+}
+
+HRESULT TsWriter::WriteAudioSample(LONGLONG rtStart, const BYTE* pbData, DWORD cbData, vector<BYTE>& output)
+{
+    if (!HasAudio())
+    {
+        return E_INVALIDARG;
+    }
+
+    DWORD cbFrame = ADTS_HEADER_SIZE + cbData;
+    if (cbFrame > ADTS_MAX_FRAME_SIZE)
+    {
+        return E_INVALIDARG;
+    }
+
+    BYTE abHeader[ADTS_HEADER_SIZE];
+    memcpy(abHeader, m_abAdtsHeader, ADTS_HEADER_SIZE);
+    abHeader[3] |= (BYTE)(cbFrame >> 11);
+    abHeader[4] = (BYTE)(cbFrame >> 3);
+    abHeader[5] |= (BYTE)((cbFrame & 7) << 5);
+
+    m_payload.resize(TS_PES_HEADER_SIZE);
+    m_payload.insert(m_payload.end(), abHeader, abHeader + ADTS_HEADER_SIZE);
+    m_payload.insert(m_payload.end(), pbData, pbData + cbData);
+
+    // without video every audio frame is a random access point
+    WritePes(TS_PID_AUDIO, TS_STREAM_ID_AUDIO, rtStart, !HasVideo(), output);
+    return S_OK;
+}
+
+BYTE TsWriter::NextContinuityCounter(WORD wPid)
+{
+    BYTE* pbCounter = &m_bAudioCounter;
+    switch (wPid)
+    {
+    case TS_PID_PAT:
+        pbCounter = &m_bPatCounter;
+        break;
+    case TS_PID_PMT:
+        pbCounter = &m_bPmtCounter;
+        break;
+    case TS_PID_VIDEO:
+        pbCounter = &m_bVideoCounter;
+        break;
+    }
+
+    BYTE bCounter = *pbCounter;
+    *pbCounter = (bCounter + 1) & 0x0F;
+    return bCounter;
+}
+
+// Writes PSI section into a single packet, it always fits
+void TsWriter::WriteSection(WORD wPid, const BYTE* pbSection, DWORD cbSection, vector<BYTE>& output)
+{
+    size_t nOffset = output.size();
+    output.resize(nOffset + TS_PACKET_SIZE, 0xFF);
+    BYTE* pb = &output[nOffset];
+
+    pb[0] = 0x47;
+    pb[1] = (BYTE)(0x40 | (wPid >> 8)); // payload unit start
+    pb[2] = (BYTE)(wPid & 0xFF);
+    pb[3] = (BYTE)(0x10 | NextContinuityCounter(wPid));
+    pb[4] = 0; // pointer field
+
+    memcpy(pb + 5, pbSection, cbSection);
+
+    DWORD dwCrc = Crc32(pbSection, cbSection);
+    pb[5 + cbSection] = (BYTE)(dwCrc >> 24);
+    pb[6 + cbSection] = (BYTE)(dwCrc >> 16);
+    pb[7 + cbSection] = (BYTE)(dwCrc >> 8);
+    pb[8 + cbSection] = (BYTE)dwCrc;
+}
+
+// Completes the PES header reserved at the start of m_payload and splits the packet into TS packets
+void TsWriter::WritePes(WORD wPid, BYTE bStreamId, LONGLONG rtStart, BOOL fRandomAccess, vector<BYTE>& output)
+{
+    ULONGLONG qwPcr = ToClock(rtStart);
+    ULONGLONG qwPts = (qwPcr + TS_PCR_DELAY) & 0x1FFFFFFFFULL;
+    BOOL fPcr = wPid == (HasVideo() ? TS_PID_VIDEO : TS_PID_AUDIO);
+
+    BYTE* pb = &m_payload[0];
+    DWORD cbPes = (DWORD)m_payload.size();
+
+    // length of what follows the length field, 0 (unbounded) is allowed for video only
+    DWORD cbLength = cbPes - 6;
+    if (cbLength > 0xFFFF)
+    {
+        cbLength = 0;
+    }
+
+    pb[0] = 0;
+    pb[1] = 0;
+    pb[2] = 1;
+    pb[3] = bStreamId;
+    pb[4] = (BYTE)(cbLength >> 8);
+    pb[5] = (BYTE)cbLength;
+    pb[6] = 0x80;
+    pb[7] = 0x80; // PTS only
+    pb[8] = 5;
+    pb[9] = (BYTE)(0x21 | ((qwPts >> 29) & 0x0E));
+    pb[10] = (BYTE)(qwPts >> 22);
+    pb[11] = (BYTE)(0x01 | ((qwPts >> 14) & 0xFE));
+    pb[12] = (BYTE)(qwPts >> 7);
+    pb[13] = (BYTE)(0x01 | ((qwPts << 1) & 0xFE));
+
+    DWORD dwOffset = 0;
+    BOOL fFirst = TRUE;
+    while (dwOffset < cbPes)
+    {
+        size_t nPacket = output.size();
+        output.resize(nPacket + TS_PACKET_SIZE);
+        BYTE* pbPacket = &output[nPacket];
+
+        // adaptation field: flags with PCR on the first packet, stuffing on the last one
+        DWORD cbAdaptation = 0;
+        BOOL fFlags = fFirst && (fPcr || fRandomAccess);
+        if (fFlags)
+        {
+            cbAdaptation = 2 + (fPcr ? TS_PCR_SIZE : 0);
+        }
+
+        DWORD cbRemaining = cbPes - dwOffset;
+        DWORD cbPayload = TS_PACKET_SIZE - 4 - cbAdaptation;
+        if (cbRemaining < cbPayload)
+        {
+            cbAdaptation += cbPayload - cbRemaining;
+            cbPayload = cbRemaining;
+        }
+
+        pbPacket[0] = 0x47;
+        pbPacket[1] = (BYTE)((fFirst ? 0x40 : 0x00) | (wPid >> 8));
+        pbPacket[2] = (BYTE)(wPid & 0xFF);
+        pbPacket[3] = (BYTE)((cbAdaptation > 0 ? 0x30 : 0x10) | NextContinuityCounter(wPid));
+
+        BYTE* pbField = pbPacket + 4;
+        if (cbAdaptation > 0)
+        {
+            pbField[0] = (BYTE)(cbAdaptation - 1);
+            if (cbAdaptation > 1)
+            {
+                pbField[1] = 0;
+                DWORD cbUsed = 2;
+                if (fFlags)
+                {
+                    pbField[1] = (BYTE)((fRandomAccess ? 0x40 : 0) | (fPcr ? 0x10 : 0));
+                    if (fPcr)
+                    {
+                        pbField[2] = (BYTE)(qwPcr >> 25);
+                        pbField[3] = (BYTE)(qwPcr >> 17);
+                        pbField[4] = (BYTE)(qwPcr >> 9);
+                        pbField[5] = (BYTE)(qwPcr >> 1);
+                        pbField[6] = (BYTE)(((qwPcr & 1) << 7) | 0x7E);
+                        pbField[7] = 0;
+                        cbUsed += TS_PCR_SIZE;
+                    }
+                }
+
+                memset(pbField + cbUsed, 0xFF, cbAdaptation - cbUsed);
+            }
+        }
+
+        memcpy(pbField + cbAdaptation, pb + dwOffset, cbPayload);
+        dwOffset += cbPayload;
+        fFirst = FALSE;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+class CodecConfig;
+
+#define TS_PACKET_SIZE      188
+#define TS_PID_PAT          0x0000
+#define TS_PID_PMT          0x1000
+#define TS_PID_VIDEO        0x0100
+#define TS_PID_AUDIO        0x0101
+
+// Writes MPEG-2 transport stream (ISO/IEC 13818-1) for one HLS rendition: an H.264 and/or an
+// AAC track as carried by Smooth Streaming samples. Video samples are converted from AVCC
+// (NAL unit length prefixes) to Annex B with an access unit delimiter, SPS and PPS are
+// repeated in front of every keyframe. Audio samples get an ADTS header each.
+//
+// Each sample becomes one PES packet with PTS only, composition offsets are not known to the
+// muxer. The PCR is carried on the first TS packet of every PES packet of the video track
+// (the audio track without video). Continuity counters carry on across segments.
+class TsWriter
+{
+public:
+    TsWriter();
+    ~TsWriter();
+
+    // Either configuration may be NULL, references are kept. Returns E_INVALIDARG for
+    // configurations which can't be carried (e.g. AAC with explicit sampling frequency).
+    HRESULT Initialize(CodecConfig* pVideoConfig, CodecConfig* pAudioConfig);
+
+    // PAT and PMT, every segment starts with them
+    void WriteTables(std::vector<BYTE>& output);
+
+    HRESULT WriteVideoSample(LONGLONG rtStart, BOOL fKeyFrame, const BYTE* pbData, DWORD cbData, std::vector<BYTE>& output);
+    HRESULT WriteAudioSample(LONGLONG rtStart, const BYTE* pbData, DWORD cbData, std::vector<BYTE>& output);
+
+    BOOL HasVideo() const { return m_pVideoConfig != NULL; }
+    BOOL HasAudio() const { return m_pAudioConfig != NULL; }
+
+    // RFC 6381 codecs of the rendition for the master playlist, e.g. avc1.4D401F,mp4a.40.2
+    const std::string& GetCodecs() const { return m_codecs; }
+
+private:
+    TsWriter(const TsWriter&);
+    TsWriter& operator=(const TsWriter&);
+
+    HRESULT ParseVideoConfig();
+    HRESULT ParseAudioConfig();
+
+    void WriteSection(WORD wPid, const BYTE* pbSection, DWORD cbSection, std::vector<BYTE>& output);
+    void WritePes(WORD wPid, BYTE bStreamId, LONGLONG rtStart, BOOL fRandomAccess, std::vector<BYTE>& output);
+    BYTE NextContinuityCounter(WORD wPid);
+
+    CodecConfig* m_pVideoConfig;
+    CodecConfig* m_pAudioConfig;
+    std::string m_codecs;
+
+    // Annex B SPS and PPS units from the AVCDecoderConfigurationRecord
+    std::vector<BYTE> m_parameterSets;
+    DWORD m_cbNalLength;
+
+    // ADTS header of the track, frame length is filled in per sample
+    BYTE m_abAdtsHeader[7];
+
+    // payload of the PES packet being written, kept to avoid reallocation per sample
+    std::vector<BYTE> m_payload;
+
+    BYTE m_bPatCounter;
+    BYTE m_bPmtCounter;
+    BYTE m_bVideoCounter;
+    BYTE m_bAudioCounter;
+};
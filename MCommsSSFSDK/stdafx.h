@@ -8,7 +8,15 @@
 #define VC_EXTRALEAN            // Exclude rarely-used stuff from Windows headers
 #endif
 
+#ifdef _WIN32
+
 #include "targetver.h"
 
 #include <stdio.h>
 #include <windows.h>
+
+#else
+
+#include "Platform.h"
+
+#endif